@@ -719,6 +719,10 @@ call <SID>OptionG("km", &km)
 call <SID>Header("editing text")
 call append("$", "undolevels\tmaximum number of changes that can be undone")
 call append("$", " \tset ul=" . &ul)
+if has("persistent_undo")
+  call append("$", "undomaxmem\tmaximum memory in Kbyte for undo text")
+  call append("$", " \tset umm=" . &umm)
+endif
 call append("$", "undoreload\tmaximum number lines to save for undo on a buffer reload")
 call append("$", " \tset ur=" . &ur)
 call append("$", "modified\tchanges have been made and not written to a file")
@@ -1011,6 +1015,10 @@ call append("$", "maxmem\tmaximum amount of memory in Kbyte used for one buffer"
 call append("$", " \tset mm=" . &mm)
 call append("$", "maxmemtot\tmaximum amount of memory in Kbyte used for all buffers")
 call append("$", " \tset mmt=" . &mmt)
+if has("memzip")
+  call append("$", "maxmemzip\tamount of memory in Kbyte for compressed text blocks")
+  call append("$", " \tset mmz=" . &mmz)
+endif
 
 
 call <SID>Header("command line editing")
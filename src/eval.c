@@ -592,6 +592,11 @@ static void f_invert __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_isdirectory __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_islocked __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_items __ARGS((typval_T *argvars, typval_T *rettv));
+#ifdef FEAT_JOB_CONTROL
+static void f_jobsend __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_jobstart __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_jobstop __ARGS((typval_T *argvars, typval_T *rettv));
+#endif
 static void f_join __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_keys __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_last_buffer_nr __ARGS((typval_T *argvars, typval_T *rettv));
@@ -646,6 +651,7 @@ static void f_pyeval __ARGS((typval_T *argvars, typval_T *rettv));
 #endif
 static void f_range __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_readfile __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_regexpcache __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_reltime __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_reltimestr __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_remote_expr __ARGS((typval_T *argvars, typval_T *rettv));
@@ -734,6 +740,10 @@ static void f_test __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_tan __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_tanh __ARGS((typval_T *argvars, typval_T *rettv));
 #endif
+#ifdef FEAT_TIMERS
+static void f_timer_start __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_timer_stop __ARGS((typval_T *argvars, typval_T *rettv));
+#endif
 static void f_tolower __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_toupper __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_tr __ARGS((typval_T *argvars, typval_T *rettv));
@@ -7984,6 +7994,11 @@ static struct fst
     {"isdirectory",	1, 1, f_isdirectory},
     {"islocked",	1, 1, f_islocked},
     {"items",		1, 1, f_items},
+#ifdef FEAT_JOB_CONTROL
+    {"jobsend",		2, 2, f_jobsend},
+    {"jobstart",	2, 3, f_jobstart},
+    {"jobstop",		1, 1, f_jobstop},
+#endif
     {"join",		1, 2, f_join},
     {"keys",		1, 1, f_keys},
     {"last_buffer_nr",	0, 0, f_last_buffer_nr},/* obsolete */
@@ -8038,6 +8053,7 @@ static struct fst
 #endif
     {"range",		1, 3, f_range},
     {"readfile",	1, 3, f_readfile},
+    {"regexpcache",	0, 0, f_regexpcache},
     {"reltime",		0, 2, f_reltime},
     {"reltimestr",	1, 1, f_reltimestr},
     {"remote_expr",	2, 3, f_remote_expr},
@@ -8126,6 +8142,10 @@ static struct fst
 #endif
     {"tempname",	0, 0, f_tempname},
     {"test",		1, 1, f_test},
+#ifdef FEAT_TIMERS
+    {"timer_start",	2, 3, f_timer_start},
+    {"timer_stop",	1, 1, f_timer_stop},
+#endif
     {"tolower",		1, 1, f_tolower},
     {"toupper",		1, 1, f_toupper},
     {"tr",		3, 3, f_tr},
@@ -8734,6 +8754,82 @@ f_and(argvars, rettv)
 					& get_tv_number_chk(&argvars[1], NULL);
 }
 
+static long append_tv_lines __ARGS((linenr_T lnum, typval_T *tv, listitem_T *li, int *errp));
+
+/*
+ * Append string "tv" after line "lnum" in the current buffer, or the items of
+ * a list starting at "li" when "tv" is NULL.  The lines are appended at once
+ * with ml_append_lines().
+ * Stops at an item that is not a String or Number and sets "*errp".
+ * Returns the number of lines appended.
+ */
+    static long
+append_tv_lines(lnum, tv, li, errp)
+    linenr_T	lnum;
+    typval_T	*tv;
+    listitem_T	*li;
+    int		*errp;
+{
+    garray_T	lines;
+    garray_T	tofree;
+    char_u	*line;
+    listitem_T	*item;
+    long	added;
+    int		n = 1;
+
+    if (tv == NULL)
+	for (n = 0, item = li; item != NULL; item = item->li_next)
+	    ++n;
+    ga_init2(&lines, (int)sizeof(char_u *), n);
+    ga_init2(&tofree, (int)sizeof(char_u *), 10);
+    for (;;)
+    {
+	if (tv == NULL)
+	{
+	    if (li == NULL)
+		break;			/* end of list */
+	    line = get_tv_string_chk(&li->li_tv);
+	}
+	else
+	    line = get_tv_string_chk(tv);
+	if (line == NULL)		/* type error */
+	{
+	    *errp = TRUE;
+	    break;
+	}
+	/* A Number is in a static buffer, it must be copied. */
+	if ((tv == NULL ? li->li_tv.v_type : tv->v_type) != VAR_STRING)
+	{
+	    if (tofree.ga_len >= tofree.ga_growsize)
+		tofree.ga_growsize = tofree.ga_len;	/* avoid many copies */
+	    if (ga_grow(&tofree, 1) == FAIL
+				       || (line = vim_strsave(line)) == NULL)
+	    {
+		*errp = TRUE;
+		break;
+	    }
+	    ((char_u **)tofree.ga_data)[tofree.ga_len++] = line;
+	}
+	if (ga_grow(&lines, 1) == FAIL)
+	{
+	    *errp = TRUE;
+	    break;
+	}
+	((char_u **)lines.ga_data)[lines.ga_len++] = line;
+	if (tv != NULL)
+	    break;
+	li = li->li_next;
+    }
+
+    added = ml_append_lines(curbuf, lnum, (char_u **)lines.ga_data, NULL,
+						  (long)lines.ga_len, FALSE);
+    if (added < lines.ga_len)
+	*errp = TRUE;
+    ga_clear(&lines);
+    ga_clear_strings(&tofree);
+    return added;
+}
+
 /*
  * "append(lnum, string/list)" function
  */
@@ -8743,11 +8839,9 @@ f_append(argvars, rettv)
     typval_T	*rettv;
 {
     long	lnum;
-    char_u	*line;
-    list_T	*l = NULL;
     listitem_T	*li = NULL;
-    typval_T	*tv;
     long	added = 0;
+    int		err = FALSE;
 
     /* When coming here from Insert mode, sync undo, so that this can be
      * undone separately from what was previously inserted. */
@@ -8764,31 +8858,15 @@ f_append(argvars, rettv)
     {
 	if (argvars[1].v_type == VAR_LIST)
 	{
-	    l = argvars[1].vval.v_list;
-	    if (l == NULL)
+	    if (argvars[1].vval.v_list == NULL)
 		return;
-	    li = l->lv_first;
-	}
-	for (;;)
-	{
-	    if (l == NULL)
-		tv = &argvars[1];	/* append a string */
-	    else if (li == NULL)
-		break;			/* end of list */
-	    else
-		tv = &li->li_tv;	/* append item from list */
-	    line = get_tv_string_chk(tv);
-	    if (line == NULL)		/* type error */
-	    {
-		rettv->vval.v_number = 1;	/* Failed */
-		break;
-	    }
-	    ml_append(lnum + added, line, (colnr_T)0, FALSE);
-	    ++added;
-	    if (l == NULL)
-		break;
-	    li = li->li_next;
+	    li = argvars[1].vval.v_list->lv_first;
+	    added = append_tv_lines((linenr_T)lnum, NULL, li, &err);
 	}
+	else
+	    added = append_tv_lines((linenr_T)lnum, &argvars[1], NULL, &err);
+	if (err)
+	    rettv->vval.v_number = 1;	/* Failed */
 
 	appended_lines_mark(lnum, added);
 	if (curwin->w_cursor.lnum > lnum)
@@ -11127,6 +11205,10 @@ get_buffer_lines(buf, start, end, retlist, rettv)
 
     if (buf == NULL || buf->b_ml.ml_mfp == NULL || start < 0)
 	return;
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /* The lines may be in the part of the file that wasn't read yet. */
+    (void)buf_load_more(buf, retlist ? end : start);
+#endif
 
     if (!retlist)
     {
@@ -12326,6 +12408,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_INS_EXPAND
 	"insert_expand",
 #endif
+#ifdef FEAT_JOB_CONTROL
+	"job_control",
+#endif
 #ifdef FEAT_JUMPLIST
 	"jumplist",
 #endif
@@ -12361,6 +12446,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_SESSION
 	"mksession",
 #endif
+#ifdef FEAT_MMAP
+	"mmap",
+#endif
 #ifdef FEAT_MODIFY_FNAME
 	"modify_fname",
 #endif
@@ -12446,6 +12534,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_PROFILE
 	"profile",
 #endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+	"progressive_load",
+#endif
 #ifdef FEAT_RELTIME
 	"reltime",
 #endif
@@ -12489,6 +12580,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_SPELL
 	"spell",
 #endif
+#ifdef FEAT_SWAP_THREAD
+	"swap_thread",
+#endif
 #ifdef FEAT_SYN_HL
 	"syntax",
 #endif
@@ -12521,6 +12615,9 @@ f_has(argvars, rettv)
 #ifdef HAVE_TGETENT
 	"tgetent",
 #endif
+#ifdef FEAT_TIMERS
+	"timers",
+#endif
 #ifdef FEAT_TITLE
 	"title",
 #endif
@@ -13489,6 +13586,104 @@ f_items(argvars, rettv)
     dict_list(argvars, rettv, 2);
 }
 
+#ifdef FEAT_JOB_CONTROL
+/*
+ * "jobsend({job}, {data})" function
+ */
+    static void
+f_jobsend(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    char_u	*data;
+
+    rettv->vval.v_number = 0;
+    if (check_restricted() || check_secure())
+	return;
+    data = get_tv_string_chk(&argvars[1]);
+    if (data != NULL && job_send((int)get_tv_number(&argvars[0]),
+					       data, (int)STRLEN(data)) == OK)
+	rettv->vval.v_number = 1;
+}
+
+/*
+ * "jobstart({name}, {prog} [, {argv}])" function
+ */
+    static void
+f_jobstart(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    char_u	buf[NUMBUFLEN];
+    char_u	*name;
+    char_u	*prog;
+    list_T	*l = NULL;
+    listitem_T	*li;
+    char	**argv;
+    int		argc = 1;
+    int		i;
+
+    rettv->vval.v_number = 0;
+    if (check_restricted() || check_secure())
+	return;
+    name = get_tv_string_chk(&argvars[0]);
+    prog = get_tv_string_buf_chk(&argvars[1], buf);
+    if (name == NULL || prog == NULL)
+	return;
+    if (*name == NUL || *prog == NUL)
+    {
+	EMSG(_(e_invarg));
+	return;
+    }
+    if (argvars[2].v_type != VAR_UNKNOWN)
+    {
+	if (argvars[2].v_type != VAR_LIST)
+	{
+	    EMSG2(_(e_listarg), "jobstart()");
+	    return;
+	}
+	l = argvars[2].vval.v_list;
+	if (l != NULL)
+	    argc += l->lv_len;
+    }
+
+    argv = (char **)alloc_clear((unsigned)((argc + 1) * sizeof(char *)));
+    if (argv == NULL)
+	return;
+    argv[0] = (char *)vim_strsave(prog);
+    argc = 1;
+    if (l != NULL)
+	for (li = l->lv_first; li != NULL; li = li->li_next)
+	{
+	    /* copy, get_tv_string() uses a static buffer for a Number */
+	    argv[argc] = (char *)vim_strsave(get_tv_string(&li->li_tv));
+	    if (argv[argc++] == NULL)
+		break;
+	}
+    if (argv[argc - 1] != NULL)
+	rettv->vval.v_number = job_start(name, argv);
+
+    for (i = 0; i < argc; ++i)
+	vim_free(argv[i]);
+    vim_free(argv);
+}
+
+/*
+ * "jobstop({job})" function
+ */
+    static void
+f_jobstop(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    rettv->vval.v_number = 0;
+    if (check_restricted() || check_secure())
+	return;
+    rettv->vval.v_number =
+		    job_stop((int)get_tv_number(&argvars[0])) == OK ? 1 : 0;
+}
+#endif
+
 /*
  * "join()" function
  */
@@ -14980,6 +15175,18 @@ list2proftime(arg, tm)
 }
 #endif /* FEAT_RELTIME */
 
+/*
+ * "regexpcache()" function
+ */
+    static void
+f_regexpcache(argvars, rettv)
+    typval_T	*argvars UNUSED;
+    typval_T	*rettv;
+{
+    if (rettv_dict_alloc(rettv) == OK)
+	regcache_eval(rettv->vval.v_dict);
+}
+
 /*
  * "reltime()" function
  */
@@ -16448,7 +16655,9 @@ f_setline(argvars, rettv)
     char_u	*line = NULL;
     list_T	*l = NULL;
     listitem_T	*li = NULL;
+    listitem_T	*li_cur = NULL;
     long	added = 0;
+    int		err = FALSE;
     linenr_T	lcount = curbuf->b_ml.ml_line_count;
 
     lnum = get_tv_lnum(&argvars[0]);
@@ -16469,6 +16678,7 @@ f_setline(argvars, rettv)
 	    if (li == NULL)
 		break;
 	    line = get_tv_string_chk(&li->li_tv);
+	    li_cur = li;
 	    li = li->li_next;
 	}
 
@@ -16495,12 +16705,17 @@ f_setline(argvars, rettv)
 		rettv->vval.v_number = 0;	/* OK */
 	    }
 	}
-	else if (added > 0 || u_save(lnum - 1, lnum) == OK)
+	else if (u_save(lnum - 1, lnum) == OK)
 	{
-	    /* lnum is one past the last line, append the line */
-	    ++added;
-	    if (ml_append(lnum - 1, line, (colnr_T)0, FALSE) == OK)
+	    /* lnum is one past the last line, append the line or the rest of
+	     * the list at once */
+	    if (l == NULL)
+		added = append_tv_lines(lnum - 1, &argvars[1], NULL, &err);
+	    else
+		added = append_tv_lines(lnum - 1, NULL, li_cur, &err);
+	    if (!err)
 		rettv->vval.v_number = 0;	/* OK */
+	    break;
 	}
 
 	if (l == NULL)			/* only one string argument */
@@ -18420,6 +18635,61 @@ f_tanh(argvars, rettv)
 }
 #endif
 
+#ifdef FEAT_TIMERS
+/*
+ * "timer_start({msec}, {callback} [, {options}])" function
+ */
+    static void
+f_timer_start(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    long	msec = get_tv_number(&argvars[0]);
+    char_u	*callback;
+    dict_T	*dict;
+    int		repeat = 1;
+
+    rettv->vval.v_number = 0;
+    if (check_secure())
+	return;
+    if (argvars[1].v_type == VAR_FUNC)
+	callback = argvars[1].vval.v_string;
+    else
+	callback = get_tv_string_chk(&argvars[1]);
+    if (callback == NULL)
+	return;
+    if (*callback == NUL || msec < 0)
+    {
+	EMSG(_(e_invarg));
+	return;
+    }
+    if (argvars[2].v_type != VAR_UNKNOWN)
+    {
+	if (argvars[2].v_type != VAR_DICT
+				   || (dict = argvars[2].vval.v_dict) == NULL)
+	{
+	    EMSG(_(e_dictreq));
+	    return;
+	}
+	if (dict_find(dict, (char_u *)"repeat", -1) != NULL)
+	    repeat = get_dict_number(dict, (char_u *)"repeat");
+    }
+    rettv->vval.v_number = timer_start(msec, callback, repeat);
+}
+
+/*
+ * "timer_stop({timer})" function
+ */
+    static void
+f_timer_stop(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    rettv->vval.v_number =
+		  timer_stop((int)get_tv_number(&argvars[0])) == OK ? 1 : 0;
+}
+#endif
+
 /*
  * "tolower(string)" function
  */
@@ -18699,7 +18969,8 @@ f_undotree(argvars, rettv)
 	list = list_alloc();
 	if (list != NULL)
 	{
-	    u_eval_tree(curbuf->b_u_oldhead, list);
+	    dict_add_nr_str(dict, "mem",
+				u_eval_tree(curbuf->b_u_oldhead, list), NULL);
 	    dict_add_list(dict, "entries", list);
 	}
     }
@@ -19172,6 +19443,9 @@ var2fpos(varp, dollar_lnum, fnum)
     {
 	if (dollar_lnum)
 	{
+#ifdef FEAT_PROGRESSIVE_LOAD
+	    buf_load_finish(curbuf);
+#endif
 	    pos.lnum = curbuf->b_ml.ml_line_count;
 	    pos.col = 0;
 	}
@@ -20126,7 +20400,12 @@ get_tv_lnum_buf(argvars, buf)
 	    && argvars[0].vval.v_string != NULL
 	    && argvars[0].vval.v_string[0] == '$'
 	    && buf != NULL)
+    {
+#ifdef FEAT_PROGRESSIVE_LOAD
+	buf_load_finish(buf);
+#endif
 	return buf->b_ml.ml_line_count;
+    }
     return get_tv_number_chk(&argvars[0], NULL);
 }
 
@@ -9,17 +9,34 @@
 /* This file implements vim event loop. Here's how it works:
  *
  * The function 'ev_trigger' will push events to a thread-safe queue(ev_trigger
- * may be called by any thread).
+ * may be called by any thread). The queue is a bounded lock-free ring, its
+ * size is set with 'eventqueuesize' and 'eventqueuefull' decides whether a
+ * producer blocks, drops the event or coalesces it when the ring is full.
  *
  * The function 'ev_next' provides a drop-in replacement for 'ui_inchar' which
  * is always called when new characters are needed.
  *
  * The difference is that when an infinite timeout is passed as argument(-1),
- * ev_next will poll the queue for new events at regular intervals. When a new
+ * ev_next will also return when an event is pushed to the queue. When a new
  * event is available, it will pull from the queue(in a safe way) and return the
  * K_USEREVENT special key, which will be handled at higher levels
  * by triggering 'User' autocommands for that event.
  *
+ * To avoid polling, every push also signals a wake-up descriptor (an eventfd
+ * or the write end of a pipe). The console input loop in os_unix.c waits on
+ * its read end next to the terminal, so a blocking wait is interrupted as soon
+ * as another thread triggers an event. Where that isn't possible (the GUI, or
+ * when the descriptor could not be created) the queue is polled every
+ * POLL_INTERVAL msec, like before.
+ *
+ * While a timer is running (timer.c) the wait is cut off at its deadline,
+ * ev_next then returns K_USEREVENT as well and apply_event_autocmd() invokes
+ * the timer callbacks before the User autocommands.
+ *
+ * While the rest of a big file is being read (see 'loadlines') ev_next only
+ * checks for typed keys without waiting and returns K_USEREVENT when there
+ * are none, apply_event_autocmd() then reads the next part of the file.
+ *
  * This event loop was 'injected' in vim by replacing all calls to ui_inchar by
  * the io_inchar macro, which is translated into ev_next when compiled with
  * --enable-eventloop or ui_inchar otherwise. Since vim has specialized loops
@@ -30,32 +47,108 @@
 
 #ifdef FEAT_EVENT_LOOP
 #include <pthread.h>
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+#endif
 
 #define POLL_INTERVAL 100 /* Interval used to poll for events */
 
+/* Events with a name and argument that fit in here don't need an allocation */
+#define EV_INLINE_LEN	112
+
+/* How long a blocked producer waits before checking the queue again, in case
+ * a wake-up got lost */
+#define BLOCK_RECHECK	50
+
 /* An event has a name that will be matched against the autocommand pattern (au
  * User [PATTERN]) and an argument which will be set to v:cmdarg before the
- * autocommand is called */
+ * autocommand is called.  Both are stored as "name NUL args NUL" in "ev_buf",
+ * or in "ev_alloced" when they don't fit.  Producers may not use alloc(), it
+ * is not thread-safe, so malloc() and free() are used. */
 typedef struct ev_T
-{ 
-    struct ev_T * next;
-    char_u *name, *event_args;
+{
+    long_u volatile	ev_seq;	    /* sequence number, see queue_push() */
+    char_u		*ev_alloced;
+    int			ev_args_off; /* offset of the args, -1 for none */
+    char_u		ev_buf[EV_INLINE_LEN];
 } ev_T;
 
-/* The event queue, which is implemented as a singly-linked list protected by
- * a mutex */
+#define EV_NAME(e)  ((e)->ev_alloced != NULL ? (e)->ev_alloced : (e)->ev_buf)
+#define EV_ARGS(e)  ((e)->ev_args_off < 0 ? NULL : EV_NAME(e) + (e)->ev_args_off)
+
+/* Events that were coalesced because the ring was full, see queue_push(). */
+typedef struct ev_overflow_T
+{
+    struct ev_overflow_T *next;
+    char_u		*name;
+    char_u		*event_args;
+} ev_overflow_T;
+
+/*
+ * The event queue: a bounded ring that any number of threads push to and
+ * only the main thread takes from, without a lock.
+ *
+ * Every cell has a sequence number.  A cell at position "pos" is free for a
+ * producer when its number is "pos", and filled for the consumer when it is
+ * "pos + 1".  Producers claim a position by incrementing "enq_pos" with a
+ * compare-and-swap, fill the cell and then publish it by setting the sequence
+ * number.  The consumer releases a cell by setting it to "pos + size", which
+ * is the number a producer expects one lap later.
+ */
 typedef struct event_queue_T
 {
+    ev_T		*cells;
+    long_u		mask;	    /* number of cells minus one */
+    long_u volatile	enq_pos;    /* next position producers claim */
+    long_u		deq_pos;    /* next position the consumer takes */
+    ev_T		*drain;	    /* consumer copy of pending events */
+    int			drain_busy; /* autocommands for "drain" executing */
+    int volatile	ready;	    /* TRUE when "cells" can be used */
+
+    /* Only used when the ring is full. */
     pthread_mutex_t	mutex;
-    /* The first element of the queue, or NULL if the queue is empty. */
-    ev_T		*head;
-    /* The last element of the queue, or NULL if the queue is empty. */
-    ev_T		*tail;
+    pthread_cond_t	not_full;
+    int volatile	waiters;    /* producers blocked on "not_full" */
+    ev_overflow_T	*overflow;  /* coalesced events */
+    int volatile	overflow_count;
 } event_queue_T;
 
 static event_queue_T	    event_queue;
 
+/* Descriptors used to wake up the main thread, -1 when not available.  With
+ * eventfd() both are the same descriptor. */
+static int wakeup_rfd = -1;
+static int wakeup_wfd = -1;
+
+/* TRUE while the wake-up descriptor is readable or about to be. */
+static int volatile wakeup_pending = FALSE;
+
+static pthread_t main_thread;
+
+/* What to do when the ring is full, set from 'eventqueuefull'. */
+#define FULL_BLOCK	0
+#define FULL_DROP	1
+#define FULL_COALESCE	2
+static int volatile full_policy = FULL_BLOCK;
+
+/* Waiting for a typed key, for 'updatetime'.  Events and timers don't reset
+ * it, otherwise CursorHold would never happen while a timer is running. */
+#define IDLE_NONE	0   /* not waiting */
+#define IDLE_WAIT	1   /* waiting since "idle_start" */
+#define IDLE_HELD	2   /* 'updatetime' passed */
+static int idle_state = IDLE_NONE;
+static struct timeval idle_start;
+
+#ifdef FEAT_PROGRESSIVE_LOAD
+/* K_USEREVENT was returned to read the next part of a file. */
+static int load_step_due = FALSE;
+#endif
+
+/* Nesting of apply_event_autocmd(). */
+static int dispatch_depth = 0;
+
 static pthread_once_t once_control = PTHREAD_ONCE_INIT;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
 
 /*
  * Private helpers to used to deal with threading structures
@@ -84,90 +177,328 @@ unlock(pthread_mutex_t *mutex)
 }
 
 
+    static void
+init_wakeup()
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    wakeup_rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wakeup_wfd = wakeup_rfd;
+#else
+    int		fds[2];
+    int		i;
+
+    if (pipe(fds) != 0)
+	return;
+    for (i = 0; i < 2; i++)
+    {
+	fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    wakeup_rfd = fds[0];
+    wakeup_wfd = fds[1];
+#endif
+}
+
+
     static void
 init_queue()
 {
-    if (pthread_mutex_init(&event_queue.mutex, NULL) != 0)
+    if (pthread_mutex_init(&event_queue.mutex, NULL) != 0
+	    || pthread_cond_init(&event_queue.not_full, NULL) != 0)
 	pthread_error("Failed to init the mutex");
+    init_wakeup();
 }
 
 
-/* 
- * TODO This should block when vim is unable to process events
- * Insert a event at the end of the queue.
+/*
+ * Allocate the ring.  Done when the first event is pushed, so that
+ * 'eventqueuesize' can still be set in the vimrc.
  */
     static void
-queue_push(name, event_args)
-    char_u              *name;		/* Event name */
-    char_u              *event_args;	/* Event arg */
+init_ring()
 {
-    ev_T *ev = (ev_T *)alloc(sizeof(ev_T));
-    ev->name = name;
-    ev->event_args = event_args;
-    ev->next = NULL;
+    long_u	size = 16;
+    long_u	i;
+
+    while (size < (long_u)p_eqs && size < (1UL << 20))
+	size <<= 1;
+
+    event_queue.cells = (ev_T *)malloc(size * sizeof(ev_T));
+    event_queue.drain = (ev_T *)malloc(size * sizeof(ev_T));
+    if (event_queue.cells == NULL || event_queue.drain == NULL)
+	pthread_error("Failed to allocate the event queue");
+    for (i = 0; i < size; i++)
+	event_queue.cells[i].ev_seq = i;
+    event_queue.mask = size - 1;
+    event_queue.enq_pos = 0;
+    event_queue.deq_pos = 0;
+
+    /* Everything above must be visible before other threads use the ring. */
+    __sync_synchronize();
+    event_queue.ready = TRUE;
+}
 
-    pthread_once(&once_control, init_queue);
 
-    /* Nothing much to comment here, basic linked list insertion protected
-     * by the queue mutext */
-    lock(&event_queue.mutex);
+/*
+ * Make the wake-up descriptor readable.  Called after an event was pushed, so
+ * the main thread finds it in the queue when it wakes up.  Only the first
+ * event after the main thread woke up needs a write().
+ */
+    static void
+wakeup_signal()
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t	one = 1;
+#else
+    char	one = 1;
+#endif
+
+    if (__sync_lock_test_and_set(&wakeup_pending, TRUE))
+	return;
+    /* When the pipe is full the main thread is going to wake up anyway, so a
+     * failed write can be ignored. */
+    if (wakeup_wfd >= 0)
+	ignored = (int)write(wakeup_wfd, &one, sizeof(one));
+}
+
+
+/*
+ * Store "name" and "event_args" in cell "ev".
+ * Returns FAIL when out of memory.
+ */
+    static int
+cell_fill(ev, name, event_args)
+    ev_T	*ev;
+    char_u	*name;
+    char_u	*event_args;
+{
+    size_t	name_len = STRLEN(name) + 1;
+    size_t	len = name_len;
+    char_u	*p;
 
-    if (event_queue.head == NULL) {
-	event_queue.head = ev;
+    if (event_args != NULL)
+	len += STRLEN(event_args) + 1;
+    if (len <= EV_INLINE_LEN)
+    {
+	ev->ev_alloced = NULL;
+	p = ev->ev_buf;
+    }
+    else
+    {
+	ev->ev_alloced = (char_u *)malloc(len);
+	if (ev->ev_alloced == NULL)
+	    return FAIL;
+	p = ev->ev_alloced;
     }
+    mch_memmove(p, name, name_len);
+    if (event_args != NULL)
+    {
+	mch_memmove(p + name_len, event_args, len - name_len);
+	ev->ev_args_off = (int)name_len;
+    }
+    else
+	ev->ev_args_off = -1;
+    return OK;
+}
+
+
+/*
+ * Add "name" to the coalesced events, replacing the argument of an earlier
+ * event with the same name.  Must be called with the mutex held.
+ */
+    static void
+overflow_add(name, event_args)
+    char_u	*name;
+    char_u	*event_args;
+{
+    ev_overflow_T	*o;
+    ev_overflow_T	**lastp = &event_queue.overflow;
+    char_u		*args = NULL;
 
-    if (event_queue.tail == NULL) {
-	event_queue.tail = ev;
-    } else {
-	event_queue.tail->next = ev;
+    if (event_args != NULL && (args = (char_u *)strdup((char *)event_args))
+								       == NULL)
+	return;
+
+    for (o = event_queue.overflow; o != NULL; o = o->next)
+    {
+	if (STRCMP(o->name, name) == 0)
+	{
+	    free(o->event_args);
+	    o->event_args = args;
+	    return;
+	}
+	lastp = &o->next;
     }
 
-    unlock(&event_queue.mutex);
+    o = (ev_overflow_T *)malloc(sizeof(ev_overflow_T));
+    if (o == NULL || (o->name = (char_u *)strdup((char *)name)) == NULL)
+    {
+	free(o);
+	free(args);
+	return;
+    }
+    o->event_args = args;
+    o->next = NULL;
+    *lastp = o;
+    ++event_queue.overflow_count;
 }
 
 
-/* Take an event from the beginning of the queue.
- * Returns NULL if the queue is empty. */
-    static ev_T *
-queue_shift()
+/*
+ * Try to claim a free cell and fill it.  Returns FAIL when the ring is full.
+ */
+    static int
+ring_push(name, event_args)
+    char_u	*name;
+    char_u	*event_args;
 {
-    ev_T	*rv = NULL;
-    ev_T	*next = NULL;
+    ev_T	*ev;
+    long_u	pos = event_queue.enq_pos;
+    long	dif;
+
+    for (;;)
+    {
+	ev = &event_queue.cells[pos & event_queue.mask];
+	dif = (long)(ev->ev_seq - pos);
+	__sync_synchronize();
+	if (dif == 0)
+	{
+	    if (__sync_bool_compare_and_swap(&event_queue.enq_pos,
+							       pos, pos + 1))
+		break;
+	}
+	else if (dif < 0)
+	    return FAIL;    /* a lap behind: full */
+	pos = event_queue.enq_pos;
+    }
+
+    if (cell_fill(ev, name, event_args) == FAIL)
+    {
+	/* Must still publish the cell, the consumer skips it. */
+	ev->ev_alloced = NULL;
+	ev->ev_buf[0] = NUL;
+	ev->ev_args_off = -1;
+    }
+    __sync_synchronize();
+    ev->ev_seq = pos + 1;
+    return OK;
+}
+
+
+/*
+ * Insert a event at the end of the queue and wake up the main thread.
+ * When the ring is full 'eventqueuefull' decides what happens.  The main
+ * thread can never wait for itself, it coalesces instead of blocking.
+ */
+    static void
+queue_push(name, event_args)
+    char_u              *name;		/* Event name */
+    char_u              *event_args;	/* Event arg */
+{
+    struct timespec	ts;
+    struct timeval	tv;
 
     pthread_once(&once_control, init_queue);
+    pthread_once(&ring_once, init_ring);
 
-    lock(&event_queue.mutex);
-    rv = event_queue.head;
-    if (rv != NULL) {
-        next = rv->next;
-        /* Prevent unserialized access to subsequent elements */
-        rv->next = NULL;
-        event_queue.head = next;
-        if (next == NULL) {
-            /* We reached the end of the queue */
-            event_queue.tail = NULL;
-        }
+    while (ring_push(name, event_args) == FAIL)
+    {
+	if (full_policy == FULL_DROP)
+	    return;
+	if (full_policy == FULL_COALESCE
+			       || pthread_equal(pthread_self(), main_thread))
+	{
+	    lock(&event_queue.mutex);
+	    overflow_add(name, event_args);
+	    unlock(&event_queue.mutex);
+	    break;
+	}
+
+	/* Block until the main thread made room.  "waiters" is incremented
+	 * before checking again, so that queue_release() either sees it or
+	 * the check sees the released cells. */
+	lock(&event_queue.mutex);
+	__sync_fetch_and_add(&event_queue.waiters, 1);
+	if (event_queue.cells[event_queue.enq_pos & event_queue.mask].ev_seq
+						    != event_queue.enq_pos)
+	{
+	    gettimeofday(&tv, NULL);
+	    tv.tv_usec += BLOCK_RECHECK * 1000;
+	    ts.tv_sec = tv.tv_sec + tv.tv_usec / 1000000;
+	    ts.tv_nsec = (tv.tv_usec % 1000000) * 1000;
+	    pthread_cond_timedwait(&event_queue.not_full, &event_queue.mutex,
+									&ts);
+	}
+	__sync_fetch_and_sub(&event_queue.waiters, 1);
+	unlock(&event_queue.mutex);
     }
-    unlock(&event_queue.mutex);
 
-    return rv;
+    wakeup_signal();
 }
 
 
-/* Returns 1 if the queue is non-empty, 0 otherwise */
+/*
+ * Take all events that are in the ring into the "drain" array in one pass
+ * and release their cells.  Returns the number of events.
+ * Only called by the main thread.
+ */
     static int
-queue_peek()
+queue_drain()
 {
-    int		rv = 0;
+    ev_T	*ev;
+    long_u	pos = event_queue.deq_pos;
+    long_u	end;
+    int		n = 0;
+
+    if (!event_queue.ready)
+	return 0;
+    __sync_synchronize();
+
+    /* Events pushed while the autocommands run are handled next time. */
+    end = event_queue.enq_pos;
+    for ( ; pos != end; ++pos)
+    {
+	ev = &event_queue.cells[pos & event_queue.mask];
+	if (ev->ev_seq != pos + 1)
+	    break;	/* claimed but not filled yet */
+	__sync_synchronize();
+	event_queue.drain[n] = *ev;
+	if (ev->ev_buf[0] != NUL || ev->ev_alloced != NULL)
+	    ++n;
+	__sync_synchronize();
+	ev->ev_seq = pos + event_queue.mask + 1;
+    }
+    event_queue.deq_pos = pos;
 
-    pthread_once(&once_control, init_queue);
+    /* Wake up producers that are blocked on a full ring. */
+    __sync_synchronize();
+    if (n > 0 && event_queue.waiters > 0)
+    {
+	lock(&event_queue.mutex);
+	pthread_cond_broadcast(&event_queue.not_full);
+	unlock(&event_queue.mutex);
+    }
+    return n;
+}
 
-    lock(&event_queue.mutex);
-    if (event_queue.head != NULL)
-        rv = 1;
-    unlock(&event_queue.mutex);
 
-    return rv;
+/* Returns 1 if the queue is non-empty, 0 otherwise.  Also 0 while the
+ * autocommands for drained events execute, the events wait until they are
+ * done. */
+    static int
+queue_peek()
+{
+    ev_T	*ev;
+
+    if (event_queue.drain_busy)
+	return 0;
+    if (event_queue.overflow_count > 0)
+	return 1;
+    if (!event_queue.ready)
+	return 0;
+    __sync_synchronize();
+    ev = &event_queue.cells[event_queue.deq_pos & event_queue.mask];
+    return ev->ev_seq == event_queue.deq_pos + 1;
 }
 
 
@@ -184,6 +515,40 @@ event_user(buf)
 }
 
 
+/*
+ * Return TRUE when an event is waiting, a timer expired or a job has output
+ * for its callback.
+ */
+    static int
+event_ready()
+{
+#ifdef FEAT_TIMERS
+    if (timer_due())
+	return TRUE;
+#endif
+#ifdef FEAT_JOB_CONTROL
+    if (job_callbacks_pending())
+	return TRUE;
+#endif
+    return queue_peek();
+}
+
+
+/*
+ * Return the number of msec since "start".
+ */
+    static long
+msec_since(start)
+    struct timeval	*start;
+{
+    struct timeval	now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000L
+				       + (now.tv_usec - start->tv_usec) / 1000L;
+}
+
+
 /* Set the CURSORHOLD special key into the input buffer */
     static int
 event_cursorhold(buf)
@@ -210,42 +575,159 @@ ev_next(buf, maxlen, wtime, tb_change_cnt)
 {
     int		len;
     int		trig_curshold;
-    long	ellapsed;
+    int		can_block;
+    long	wait;
+    long	left;
 
     /* Dont poll for events when a timeout is passed */
     if (wtime >= 0)
-	return ui_inchar(buf, maxlen, wtime, tb_change_cnt);
+    {
+	len = ui_inchar(buf, maxlen, wtime, tb_change_cnt);
+	if (len > 0)
+	    idle_state = IDLE_NONE;
+	return len;
+    }
 
-    trig_curshold = trigger_cursorhold();
+    if (event_ready())
+	return event_user(buf);
 
-    if (trig_curshold)
-	ellapsed = 0;	    /* Time waiting for a char in milliseconds */
-    else
-	before_blocking();  /* Normally called when doing a blocking wait */
+    /* Without a wake-up descriptor the queue must be polled. */
+    can_block = ev_wakeup_fd() >= 0
+#ifdef FEAT_GUI
+	    && !gui.in_use
+#endif
+	    ;
 
-    while (!queue_peek())
+    if (idle_state == IDLE_NONE)
     {
-	len = ui_inchar(buf, maxlen, POLL_INTERVAL, tb_change_cnt);
-	ellapsed += POLL_INTERVAL;
+	gettimeofday(&idle_start, NULL);
+	idle_state = IDLE_WAIT;
+    }
+    trig_curshold = trigger_cursorhold();
 
+    /* Wait until a key is typed, an event is pushed, the first timer
+     * expires or 'updatetime' passed.  CursorHold must be triggered here,
+     * mch_inchar() would measure 'updatetime' from each call, every event
+     * and timer would start it again. */
+    for (;;)
+    {
+	wait = can_block ? -1L : POLL_INTERVAL;
+#ifdef FEAT_TIMERS
+	left = timer_wait_time();
+	if (left >= 0 && (wait < 0 || left < wait))
+	    wait = left;
+#endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+	if (buf_load_pending())
+	    wait = 0;
+#endif
+	if (idle_state == IDLE_WAIT)
+	{
+	    left = p_ut - msec_since(&idle_start);
+	    if (left < 0)
+		left = 0;
+	    if (wait < 0 || left < wait)
+		wait = left;
+	}
+
+	len = ui_inchar(buf, maxlen, wait, tb_change_cnt);
 	if (len > 0)
+	{
+	    idle_state = IDLE_NONE;
 	    return len; /* Got something, return now */
+	}
+	if (event_ready())
+	    return event_user(buf);
+#ifdef FEAT_PROGRESSIVE_LOAD
+	if (buf_load_pending())
+	{
+	    load_step_due = TRUE;
+	    return event_user(buf);
+	}
+#endif
+	if (typebuf_changed(tb_change_cnt))
+	    return 0;
+
+	if (idle_state == IDLE_WAIT && msec_since(&idle_start) >= p_ut)
+	{
+	    idle_state = IDLE_HELD;
+	    if (trig_curshold && maxlen >= 3)
+		return event_cursorhold(buf);
+	    before_blocking();  /* Normally called when doing a blocking wait */
+	}
+    }
+}
+
+/*
+ * Return the descriptor that becomes readable when an event is pushed to the
+ * queue, or -1 when there is none.  Used by the input loop to wait for
+ * events and typed characters at the same time.
+ */
+    int
+ev_wakeup_fd()
+{
+    pthread_once(&once_control, init_queue);
 
-	/* We must trigger cursorhold events ourselves. Normally cursorholds
-	 * are triggered at a platform-specific lower function when an
-	 * infinite timeout is passed, but those won't get the chance
-	 * because we never pass infinite timeout in order to poll for
-	 * events from other threads */
-	if (trig_curshold && ellapsed >= p_ut)
-	    return event_cursorhold(buf);
+    return wakeup_rfd;
+}
 
-    }
+/*
+ * Consume pending wake-ups after the descriptor was found readable.
+ */
+    void
+ev_wakeup_clear()
+{
+    char	buf[64];
+
+    if (wakeup_rfd < 0)
+	return;
+    /* Events pushed from now on must signal again. */
+    wakeup_pending = FALSE;
+    __sync_synchronize();
+    /* An eventfd is reset with one read, a pipe may need a few. */
+    while (read(wakeup_rfd, buf, sizeof(buf)) > 0)
+	;
+}
+
+/*
+ * Return TRUE if there are events, expired timers or job output waiting to be
+ * handled.
+ */
+    int
+ev_pending()
+{
+    return event_ready();
+}
 
-    return event_user(buf);
+/*
+ * Record which thread is the main thread, it must be called from there before
+ * any events are pushed.
+ */
+    void
+ev_init()
+{
+    main_thread = pthread_self();
+    pthread_once(&once_control, init_queue);
+}
+
+/*
+ * Called when 'eventqueuefull' was set.  The option value itself is not used
+ * by other threads, it may be freed at any time.
+ */
+    void
+ev_set_full_policy(val)
+    char_u	*val;
+{
+    if (*val == 'd')
+	full_policy = FULL_DROP;
+    else if (*val == 'c')
+	full_policy = FULL_COALESCE;
+    else
+	full_policy = FULL_BLOCK;
 }
 
 /* Push an event to the queue. This is the function other threads will call
- * when they need to notify vimscript of something*/
+ * when they need to notify vimscript of something. The strings are copied. */
     void
 ev_trigger(char_u *name, char_u *event_args)
 {
@@ -254,27 +736,107 @@ ev_trigger(char_u *name, char_u *event_args)
 
 
 /*
- * Invoke the User autocommand. Called by other layers after we return
- * K_USEREVENT.
+ * Invoke the User autocommand for one event.  Also used for the output of
+ * jobs, which doesn't go through the queue.
  */
     void
-apply_event_autocmd()
+event_autocmd(name, event_args)
+    char_u	*name;
+    char_u	*event_args;
 {
-    ev_T	*e = NULL;
+    if (event_args != NULL)
+	set_vim_var_string(VV_EVENT_ARG, event_args, -1);
+    else
+	set_vim_var_string(VV_EVENT_ARG, (char_u *)"", -1);
+
+    apply_autocmds(EVENT_USER, name, NULL, TRUE, NULL);
+}
 
-    while ((e = queue_shift()) != NULL)
+
+/*
+ * Invoke the timer callbacks, the job callbacks and the User autocommands
+ * for pending events.  All events that are pending are taken from the queue
+ * at once, so producers can continue while the autocommands execute.
+ * An autocommand that waits for a key may get here again.  The "drain" array
+ * is still in use then, the queue is left alone until the autocommands are
+ * done.
+ */
+    static void
+dispatch_events()
+{
+    ev_T		*e;
+    ev_overflow_T	*o;
+    ev_overflow_T	*next;
+    int			n;
+    int			i;
+
+#ifdef FEAT_TIMERS
+    timer_run_due();
+#endif
+#ifdef FEAT_JOB_CONTROL
+    job_run_callbacks();
+#endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+    if (load_step_due)
     {
-        if (e->event_args != NULL)
-            set_vim_var_string(VV_EVENT_ARG, e->event_args, -1);
-        else
-            set_vim_var_string(VV_EVENT_ARG, (char_u *)"", -1);
+	load_step_due = FALSE;
+	buf_load_step();
+    }
+#endif
 
-        apply_autocmds(EVENT_USER, e->name, NULL, TRUE, NULL);
+    if (event_queue.drain_busy)
+	return;
+    event_queue.drain_busy = TRUE;
+
+    n = queue_drain();
+    for (i = 0; i < n; i++)
+    {
+	e = &event_queue.drain[i];
+	event_autocmd(EV_NAME(e), EV_ARGS(e));
+	free(e->ev_alloced);
+    }
 
-        vim_free(e->name);
-        vim_free(e->event_args);
-        vim_free(e);
+    if (event_queue.overflow_count > 0)
+    {
+	lock(&event_queue.mutex);
+	o = event_queue.overflow;
+	event_queue.overflow = NULL;
+	event_queue.overflow_count = 0;
+	unlock(&event_queue.mutex);
+
+	for ( ; o != NULL; o = next)
+	{
+	    next = o->next;
+	    event_autocmd(o->name, o->event_args);
+	    free(o->name);
+	    free(o->event_args);
+	    free(o);
+	}
     }
+
+    event_queue.drain_busy = FALSE;
+}
+
+/*
+ * Invoke the User autocommand. Called by other layers after we return
+ * K_USEREVENT.
+ */
+    void
+apply_event_autocmd()
+{
+    ++dispatch_depth;
+    dispatch_events();
+    --dispatch_depth;
+}
+
+/*
+ * Return TRUE while apply_event_autocmd() is invoking callbacks or
+ * autocommands.
+ */
+    int
+ev_dispatching()
+{
+    return dispatch_depth > 0;
 }
 
 #endif
@@ -0,0 +1,208 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * event_loop_bench.c: Benchmark for event_loop.c.
+ *
+ * Measures the time from ev_trigger() in another thread until the User
+ * autocommand for the event has executed, with the main thread blocked in
+ * ev_next() the way it is when Vim is idle.  Then measures throughput with
+ * several threads pushing as fast as they can into a full queue.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Must include main.c because it contains much more than just main() */
+#define NO_VIM_MAIN
+#include "main.c"
+
+#include <pthread.h>
+
+#define BENCH_COUNT 2000
+#define FLOOD_THREADS 4
+#define FLOOD_COUNT 50000
+
+static pthread_mutex_t	bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	bench_cond = PTHREAD_COND_INITIALIZER;
+static int		bench_delivered;    /* events handled by the main thread */
+static struct timeval	bench_sent;	    /* when the last event was pushed */
+
+static long bench_usec_since __ARGS((struct timeval *tv));
+static void *bench_producer __ARGS((void *arg));
+static void *bench_flooder __ARGS((void *arg));
+static void bench_flood __ARGS((void));
+static int bench_compare __ARGS((const void *a, const void *b));
+static void bench_init __ARGS((void));
+
+    static long
+bench_usec_since(tv)
+    struct timeval *tv;
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - tv->tv_sec) * 1000000L + (now.tv_usec - tv->tv_usec);
+}
+
+/*
+ * Other thread: push one event, then wait until it was delivered before
+ * pushing the next one, so that every event finds the main thread idle.
+ */
+    static void *
+bench_producer(arg)
+    void *arg UNUSED;
+{
+    int	    i;
+
+    for (i = 0; i < BENCH_COUNT; i++)
+    {
+	/* give the main thread time to block in poll() */
+	usleep(200);
+
+	pthread_mutex_lock(&bench_mutex);
+	gettimeofday(&bench_sent, NULL);
+	pthread_mutex_unlock(&bench_mutex);
+
+	ev_trigger((char_u *)"Bench", NULL);
+
+	pthread_mutex_lock(&bench_mutex);
+	while (bench_delivered <= i)
+	    pthread_cond_wait(&bench_cond, &bench_mutex);
+	pthread_mutex_unlock(&bench_mutex);
+    }
+    return NULL;
+}
+
+/*
+ * Other thread: push events without waiting.
+ */
+    static void *
+bench_flooder(arg)
+    void *arg UNUSED;
+{
+    int	    i;
+
+    for (i = 0; i < FLOOD_COUNT; i++)
+	ev_trigger((char_u *)"Flood", (char_u *)"some argument");
+    return NULL;
+}
+
+/*
+ * With 'eventqueuefull' at "block" no event may get lost.
+ */
+    static void
+bench_flood()
+{
+    pthread_t	    flooders[FLOOD_THREADS];
+    struct timeval  start;
+    long	    usec;
+    char_u	    buf[10];
+    int		    i;
+
+    do_cmdline_cmd((char_u *)"let g:flood_count = 0");
+    do_cmdline_cmd((char_u *)"autocmd User Flood let g:flood_count += 1");
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < FLOOD_THREADS; i++)
+	assert(pthread_create(&flooders[i], NULL, bench_flooder, NULL) == 0);
+    while (atol((char *)get_var_value((char_u *)"g:flood_count"))
+					     < FLOOD_THREADS * FLOOD_COUNT)
+	if (ev_next(buf, (int)sizeof(buf), -1L, 0) == 3)
+	    apply_event_autocmd();
+    usec = bench_usec_since(&start);
+    for (i = 0; i < FLOOD_THREADS; i++)
+	pthread_join(flooders[i], NULL);
+
+    printf("  %d threads pushed %d events, %ld events/sec\n",
+	    FLOOD_THREADS, FLOOD_THREADS * FLOOD_COUNT,
+	    (long)((double)FLOOD_THREADS * FLOOD_COUNT * 1000000.0 / usec));
+}
+
+    static int
+bench_compare(a, b)
+    const void *a;
+    const void *b;
+{
+    return *(long *)a < *(long *)b ? -1 : *(long *)a > *(long *)b;
+}
+
+/*
+ * The parts of Vim's startup that the autocommand needs.
+ */
+    static void
+bench_init()
+{
+    int	    fds[2];
+
+    mch_early_init();
+    ev_init();
+#ifdef FEAT_MBYTE
+    (void)mb_init();
+#endif
+    eval_init();
+    init_normal_cmds();
+    IObuff = alloc(IOSIZE);
+    NameBuff = alloc(MAXPATHL);
+    assert(IObuff != NULL && NameBuff != NULL);
+    assert(win_alloc_first() == OK);
+    set_init_1();
+
+    /* Input comes from a pipe that nobody writes to, waiting for a
+     * character blocks until the wake-up descriptor fires. */
+    assert(pipe(fds) == 0);
+    read_cmd_fd = fds[0];
+}
+
+    int
+main()
+{
+    char_u	buf[10];
+    long	latency[BENCH_COUNT];
+    long	total = 0;
+    pthread_t	producer;
+    int		i;
+    int		len;
+
+    bench_init();
+    do_cmdline_cmd((char_u *)"let g:bench_count = 0");
+    do_cmdline_cmd((char_u *)"autocmd User Bench let g:bench_count += 1");
+
+    assert(pthread_create(&producer, NULL, bench_producer, NULL) == 0);
+
+    for (i = 0; i < BENCH_COUNT; )
+    {
+	len = ev_next(buf, (int)sizeof(buf), -1L, 0);
+	if (len != 3 || buf[0] != K_SPECIAL || buf[1] != KS_EXTRA
+					  || buf[2] != (int)KE_USEREVENT)
+	    continue;
+	apply_event_autocmd();
+
+	pthread_mutex_lock(&bench_mutex);
+	latency[i] = bench_usec_since(&bench_sent);
+	total += latency[i];
+	bench_delivered = ++i;
+	pthread_cond_signal(&bench_cond);
+	pthread_mutex_unlock(&bench_mutex);
+    }
+    pthread_join(producer, NULL);
+    assert(atol((char *)get_var_value((char_u *)"g:bench_count"))
+								== BENCH_COUNT);
+
+    qsort(latency, BENCH_COUNT, sizeof(long), bench_compare);
+    printf("event_loop_bench: %d events, trigger to User autocommand:\n",
+								 BENCH_COUNT);
+    printf("  min %ld us, median %ld us, p99 %ld us, max %ld us, mean %ld us\n",
+	    latency[0], latency[BENCH_COUNT / 2],
+	    latency[BENCH_COUNT * 99 / 100], latency[BENCH_COUNT - 1],
+	    total / BENCH_COUNT);
+
+    bench_flood();
+    return 0;
+}
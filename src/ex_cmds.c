@@ -551,8 +551,7 @@ ex_sort(eap)
 
     /* delete the original lines if appending worked */
     if (i == count)
-	for (i = 0; i < count; ++i)
-	    ml_delete(eap->line1, FALSE);
+	ml_delete_lines(eap->line1, (long)count, FALSE);
     else
 	count = 0;
 
@@ -808,8 +807,7 @@ do_move(line1, line2, dest)
     if (u_save(line1 + extra - 1, line2 + extra + 1) == FAIL)
 	return FAIL;
 
-    for (l = line1; l <= line2; l++)
-	ml_delete(line1 + extra, TRUE);
+    ml_delete_lines(line1 + extra, (long)num_lines, TRUE);
 
     if (!global_busy && num_lines > p_report)
     {
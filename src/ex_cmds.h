@@ -773,6 +773,8 @@ EX(CMD_redrawstatus,	"redrawstatus",	ex_redrawstatus,
 			BANG|TRLBAR|CMDWIN),
 EX(CMD_registers,	"registers",	ex_display,
 			EXTRA|NOTRLCOM|TRLBAR|CMDWIN),
+EX(CMD_regexpprofile,	"regexpprofile", ex_regexpprofile,
+			NEEDARG|WORD1|TRLBAR|CMDWIN),
 EX(CMD_resize,		"resize",	ex_resize,
 			RANGE|NOTADR|TRLBAR|WORD1),
 EX(CMD_retab,		"retab",	ex_retab,
@@ -245,6 +245,9 @@ static void	ex_popup __ARGS((exarg_T *eap));
 #if !defined(FEAT_SYN_HL) || !defined(FEAT_PROFILE)
 # define ex_syntime		ex_ni
 #endif
+#ifndef FEAT_PROFILE
+# define ex_regexpprofile	ex_ni
+#endif
 #ifndef FEAT_SPELL
 # define ex_spell		ex_ni
 # define ex_mkspell		ex_ni
@@ -2024,6 +2027,10 @@ do_one_cmd(cmdlinep, sourcing,
 	    if (*ea.cmd == '%')		    /* '%' - all lines */
 	    {
 		++ea.cmd;
+#ifdef FEAT_PROGRESSIVE_LOAD
+		if (!ea.skip)
+		    buf_load_finish(curbuf);
+#endif
 		ea.line1 = 1;
 		ea.line2 = curbuf->b_ml.ml_line_count;
 		++ea.addr_count;
@@ -2112,7 +2119,11 @@ do_one_cmd(cmdlinep, sourcing,
 	}
 	else if (ea.addr_count != 0)
 	{
-	    if (ea.line2 > curbuf->b_ml.ml_line_count)
+	    if (ea.line2 > curbuf->b_ml.ml_line_count
+#ifdef FEAT_PROGRESSIVE_LOAD
+		    && !buf_load_more(curbuf, ea.line2)
+#endif
+		    )
 	    {
 		/* With '-' in 'cpoptions' a line number past the file is an
 		 * error, otherwise put it at the end of the file. */
@@ -2437,6 +2448,10 @@ do_one_cmd(cmdlinep, sourcing,
 
     if ((ea.argt & DFLALL) && ea.addr_count == 0)
     {
+#ifdef FEAT_PROGRESSIVE_LOAD
+	if (!ea.skip && !(ea.argt & NOTADR))
+	    buf_load_finish(curbuf);
+#endif
 	ea.line1 = 1;
 	ea.line2 = curbuf->b_ml.ml_line_count;
     }
@@ -4009,6 +4024,7 @@ set_one_cmd_context(xp, buff)
 #endif
 #if defined(FEAT_PROFILE)
 	case CMD_syntime:
+	case CMD_regexpprofile:
 	    xp->xp_context = EXPAND_SYNTIME;
 	    xp->xp_pattern = arg;
 	    break;
@@ -4100,6 +4116,10 @@ get_address(ptr, skip, to_other_file)
 
 	    case '$':			    /* '$' - last line */
 			++cmd;
+#ifdef FEAT_PROGRESSIVE_LOAD
+			if (!skip)
+			    buf_load_finish(curbuf);
+#endif
 			lnum = curbuf->b_ml.ml_line_count;
 			break;
 
@@ -4317,6 +4337,9 @@ invalid_range(eap)
 		&& eap->line2 > curbuf->b_ml.ml_line_count
 #ifdef FEAT_DIFF
 			+ (eap->cmdidx == CMD_diffget)
+#endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+		&& !buf_load_more(curbuf, eap->line2)
 #endif
 		))
 	return (char_u *)_(e_invrange);
@@ -8386,7 +8409,13 @@ ex_sleep(eap)
 
 /*
  * Sleep for "msec" milliseconds, but keep checking for a CTRL-C every second.
+ * With the event loop also handle events, timers and job output in between.
  */
+#ifdef FEAT_EVENT_LOOP
+# define SLEEP_STEP	100L
+#else
+# define SLEEP_STEP	1000L
+#endif
     void
 do_sleep(msec)
     long	msec;
@@ -8395,15 +8424,24 @@ do_sleep(msec)
 
     cursor_on();
     out_flush();
-    for (done = 0; !got_int && done < msec; done += 1000L)
+    for (done = 0; !got_int && done < msec; done += SLEEP_STEP)
     {
-	ui_delay(msec - done > 1000L ? 1000L : msec - done, TRUE);
+	ui_delay(msec - done > SLEEP_STEP ? SLEEP_STEP : msec - done, TRUE);
 	ui_breakcheck();
 #ifdef FEAT_NETBEANS_INTG
 	/* Process the netbeans messages that may have been received in the
 	 * call to ui_breakcheck() when the GUI is in use. This may occur when
 	 * running a test case. */
 	netbeans_parse_messages();
+#endif
+#ifdef FEAT_JOB_CONTROL
+	job_poll();
+#endif
+#ifdef FEAT_EVENT_LOOP
+	/* A script can wait for a timer or a job this way.  Not in a
+	 * callback or event autocommand, it would invoke itself again. */
+	if (!ev_dispatching() && ev_pending())
+	    apply_event_autocmd();
 #endif
     }
 }
@@ -926,10 +926,12 @@ getcmdline(firstc, count, indent)
 	 */
 	switch (c)
 	{
+#ifdef FEAT_EVENT_LOOP
 	case K_USEREVENT:
 	    apply_event_autocmd();
 	    shell_resized();
 	    goto cmdline_not_changed;
+#endif
 	case K_BS:
 	case Ctrl_H:
 	case K_DEL:
@@ -2257,6 +2259,15 @@ getexmodeline(promptc, cookie, indent)
 	    break;
 	}
 
+#ifdef FEAT_EVENT_LOOP
+	if (c1 == K_USEREVENT)
+	{
+	    apply_event_autocmd();
+	    c1 = prev_char;
+	    continue;
+	}
+#endif
+
 	if (!escaped)
 	{
 	    /* CR typed means "enter", which is NL */
@@ -1366,3 +1366,54 @@
 	    || (defined(WIN3264) && defined(FEAT_GUI_W32))
 # define FEAT_FILTERPIPE
 #endif
+
+/*
+ * +job_control		jobstart(), jobsend() and jobstop(): commands running
+ *			in the background, their output is read by the event
+ *			loop.
+ */
+#if defined(FEAT_EVENT_LOOP) && defined(FEAT_EVAL) && defined(FEAT_AUTOCMD) \
+	&& defined(UNIX) && !defined(USE_SYSTEM)
+# define FEAT_JOB_CONTROL
+#endif
+
+/*
+ * +timers		timer_start() and timer_stop(), the callbacks are
+ *			invoked by the event loop.
+ */
+#if defined(FEAT_EVENT_LOOP) && defined(FEAT_EVAL) \
+	&& defined(HAVE_GETTIMEOFDAY) && defined(HAVE_SYS_TIME_H)
+# define FEAT_TIMERS
+#endif
+
+/*
+ * +mmap		Big files are mapped into memory instead of being read
+ *			into the buffer, see 'mmapsize'.
+ */
+#if defined(FEAT_NORMAL) && defined(UNIX) && defined(HAVE_SYS_MMAN_H)
+# define FEAT_MMAP
+#endif
+
+/*
+ * +memzip		Blocks of text that are not in memory are kept
+ *			compressed, see 'maxmemzip'.
+ */
+#ifdef FEAT_NORMAL
+# define FEAT_MEMZIP
+#endif
+
+/*
+ * +progressive_load	Big files are displayed before they have been read
+ *			completely, see 'loadlines'.
+ */
+#if defined(FEAT_EVENT_LOOP) && defined(FEAT_NORMAL)
+# define FEAT_PROGRESSIVE_LOAD
+#endif
+
+/*
+ * +swap_thread		Swap files are written by another thread, see
+ *			'swapthread'.
+ */
+#if defined(FEAT_EVENT_LOOP) && defined(UNIX) && defined(HAVE_PWRITE)
+# define FEAT_SWAP_THREAD
+#endif
@@ -21,7 +21,11 @@
 # include <utime.h>		/* for struct utimbuf */
 #endif
 
-#define BUFSIZE		8192	/* size of normal write buffer */
+#if SIZEOF_INT > 2
+# define BUFSIZE	65536	/* size of normal write buffer */
+#else
+# define BUFSIZE	8192	/* size of normal write buffer */
+#endif
 #define SMBUFSIZE	256	/* size of emergency write buffer */
 
 #ifdef FEAT_CRYPT
@@ -38,6 +42,34 @@ static int	crypt_seed_len[] = {0, 8};
 #define CRYPT_SEED_LEN_MAX 8
 #endif
 
+#if defined(UNIX) && defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+# include <sys/uio.h>
+/* Long lines are written from the memline blocks with writev(), see
+ * buf_write_direct(). */
+# define USE_WRITEV
+# ifdef IOV_MAX
+#  define WRITEV_MAX	(IOV_MAX < 1024 ? IOV_MAX : 1024)
+# else
+#  define WRITEV_MAX	16
+# endif
+# define WRITEV_LINES	256	/* lines obtained from memline at once */
+# define WRITEV_MIN_LEN	1024	/* shorter lines are copied, an iovec costs
+				   about as much as copying this much */
+
+/* Text collected for writev(). */
+typedef struct
+{
+    int		    wb_fd;
+    struct iovec    wb_iov[WRITEV_MAX];
+    int		    wb_niov;	/* used entries in wb_iov[] */
+    int		    wb_direct;	/* an iovec has text from a memline block */
+    char_u	    *wb_buf;	/* buffer for copied text */
+    long	    wb_size;	/* size of wb_buf */
+    char_u	    *wb_seg;	/* copied text not in wb_iov[] yet */
+    char_u	    *wb_end;	/* end of copied text */
+} wvbuf_T;
+#endif
+
 /* Is there any system that doesn't have access()? */
 #define USE_MCH_ACCESS
 
@@ -66,6 +98,13 @@ static int msg_add_fileformat __ARGS((int eol_type));
 static void msg_add_eol __ARGS((void));
 static int check_mtime __ARGS((buf_T *buf, struct stat *s));
 static int time_differs __ARGS((long t1, long t2));
+#ifdef FEAT_PROGRESSIVE_LOAD
+static long buf_load_chunk __ARGS((buf_T *buf));
+static void buf_load_appended __ARGS((buf_T *buf, linenr_T lnum, linenr_T lnume));
+static void buf_load_end __ARGS((buf_T *buf));
+static void buf_load_abort __ARGS((buf_T *buf));
+static int buf_load_uses_file __ARGS((buf_T *buf, char_u *fname));
+#endif
 #ifdef FEAT_AUTOCMD
 static int apply_autocmds_exarg __ARGS((event_T event, char_u *fname, char_u *fname_io, int force, buf_T *buf, exarg_T *eap));
 static int au_find_group __ARGS((char_u *name));
@@ -132,6 +171,12 @@ struct bw_info
 };
 
 static int  buf_write_bytes __ARGS((struct bw_info *ip));
+#ifdef USE_WRITEV
+static int  wv_flush __ARGS((wvbuf_T *wb));
+static void wv_close_seg __ARGS((wvbuf_T *wb));
+static int  wv_add __ARGS((wvbuf_T *wb, char_u *p, long len, int text, int mac));
+static int  buf_write_direct __ARGS((buf_T *buf, int fd, char_u *buffer, int bufsize, linenr_T start, linenr_T end, int fileformat, int no_eol, context_sha256_T *sha_ctx, long *ncharsp, linenr_T *lnump));
+#endif
 
 #ifdef FEAT_MBYTE
 static linenr_T readfile_linenr __ARGS((linenr_T linecnt, char_u *p, char_u *endp));
@@ -196,7 +241,8 @@ filemess(buf, name, s, attr)
  *
  * 1. We allocate blocks with lalloc, as big as possible.
  * 2. Each block is filled with characters from the file with a single read().
- * 3. The lines are inserted in the buffer with ml_append().
+ * 3. The lines are inserted in the buffer with ml_append_lines(), all the
+ *    lines in a block at once.
  *
  * (caller must check that fname != NULL, unless READ_STDIN is used)
  *
@@ -262,6 +308,10 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     int		error = FALSE;		/* errors encountered */
     int		ff_error = EOL_UNKNOWN; /* file format with errors */
     long	linerest = 0;		/* remaining chars in line */
+    long	skip;			/* bytes before a line break */
+    garray_T	append_lines;		/* lines in "buffer" to be appended */
+    garray_T	append_lens;		/* their lengths */
+    long	added;
 #ifdef UNIX
     int		perm = 0;
     int		swap_mode = -1;		/* protection bits for swap file */
@@ -281,6 +331,15 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     int		try_dos = (vim_strchr(p_ffs, 'd') != NULL);
     int		try_unix = (vim_strchr(p_ffs, 'x') != NULL);
     int		file_rewind = FALSE;
+#ifdef FEAT_MMAP
+    int		mapped = FALSE;		/* text is in a mapped file */
+    int		map_ff = 0;
+    int		map_bom = FALSE;
+    int		map_eol = TRUE;
+#endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+    int		load_later = FALSE;	/* read the rest when idle */
+#endif
 #ifdef FEAT_MBYTE
     int		can_retry;
     linenr_T	conv_error = 0;		/* line nr with conversion error */
@@ -319,6 +378,13 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
 #endif
 
     curbuf->b_no_eol_lnum = 0;	/* in case it was set by the previous read */
+    ga_init2(&append_lines, (int)sizeof(char_u *), 1000);
+    ga_init2(&append_lens, (int)sizeof(colnr_T), 1000);
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /* Forget about the rest of a previous read of the buffer. */
+    if (newfile)
+	buf_load_stop(curbuf);
+#endif
 
     /*
      * If there is no file name yet, use the one for the read file.
@@ -687,6 +753,36 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
 #endif
     }
 
+#ifdef FEAT_MMAP
+    /*
+     * A big file is mapped into memory instead of reading it, when no
+     * conversion or other processing of the text is needed.  This must be
+     * done before creating a swap file.
+     */
+    if (newfile && !filtering && !read_stdin && !read_buffer && !recoverymode
+	    && p_mms > 0 && (long)(curbuf->b_orig_size >> 10) >= p_mms
+	    && (curbuf->b_ml.ml_flags & ML_EMPTY)
+	    && curbuf->b_ml.ml_mfp != NULL && curbuf->b_ml.ml_mfp->mf_fd < 0
+	    && (eap == NULL || (eap->force_ff == 0 && eap->force_bin == 0
+# ifdef FEAT_MBYTE
+				&& eap->force_enc == 0 && eap->bad_char == 0
+# endif
+			       ))
+	    && !curbuf->b_p_bin && !curbuf->b_help
+# ifdef FEAT_PERSISTENT_UNDO
+	    && !curbuf->b_p_udf
+# endif
+# ifdef FEAT_CRYPT
+	    && *curbuf->b_p_key == NUL
+# endif
+# ifdef FEAT_AUTOCMD
+	    && !has_autocmd(EVENT_BUFREADPRE, sfname, curbuf)
+# endif
+	    && lines_to_skip == 0 && lines_to_read == MAXLNUM
+	    && ml_map_file(curbuf, fname, &map_ff, &map_bom, &map_eol) == OK)
+	mapped = TRUE;
+#endif
+
     /* Create a swap file now, so that other Vims are warned that we are
      * editing this file.
      * Don't do this for a "nofile" or "nowrite" buffer type. */
@@ -918,6 +1014,48 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     }
 #endif
 
+#ifdef FEAT_MMAP
+    if (mapped)
+    {
+	/* The lines are in the buffer already, set the options like reading
+	 * the file would. */
+# ifdef FEAT_MBYTE
+	if (map_bom)
+	{
+	    if (fenc_alloced)
+		vim_free(fenc);
+	    fenc = (char_u *)"utf-8";
+	    fenc_alloced = FALSE;
+	}
+	else
+	    while (fenc_next != NULL && STRCMP(fenc, "ucs-bom") == 0)
+	    {
+		if (fenc_alloced)
+		    vim_free(fenc);
+		fenc = next_fenc(&fenc_next);
+		fenc_alloced = (fenc_next != NULL);
+	    }
+# endif
+	fileformat = map_ff;
+	if (set_options)
+	{
+	    set_fileformat(fileformat, OPT_LOCAL);
+# ifdef FEAT_MBYTE
+	    curbuf->b_p_bomb = map_bom;
+	    curbuf->b_start_bomb = map_bom;
+# endif
+	    if (!map_eol)
+		curbuf->b_p_eol = FALSE;
+	}
+	if (!map_eol)
+	    read_no_eol_lnum = curbuf->b_ml.ml_line_count;
+	filesize = curbuf->b_orig_size;
+	wasempty = FALSE;
+	linecnt = 0;
+	goto failed;
+    }
+#endif
+
     /*
      * Jump back here to retry reading the file in different ways.
      * Reasons to retry:
@@ -953,8 +1091,9 @@ retry:
 	    goto failed;
 	}
 	/* Delete the previously read lines. */
-	while (lnum > from)
-	    ml_delete(lnum--, FALSE);
+	if (lnum > from)
+	    ml_delete_lines(from + 1, (long)(lnum - from), FALSE);
+	lnum = from;
 	file_rewind = FALSE;
 #ifdef FEAT_MBYTE
 	if (set_options)
@@ -1177,6 +1316,30 @@ retry:
 #endif
     }
 
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /*
+     * When editing a big file only read the first 'loadlines' lines now, the
+     * rest is read by buf_load_step() while waiting for the user to type.
+     * Not when the text must be converted, decrypted or hashed, that needs
+     * more state than is kept for loading later.  Nothing was appended yet,
+     * also when retrying.
+     */
+    load_later = (p_lol > 0 && newfile && !filtering && !read_stdin
+	    && !read_buffer && !recoverymode && (flags & READ_DUMMY) == 0
+	    && lines_to_skip == 0 && lines_to_read == MAXLNUM
+# ifdef FEAT_MBYTE
+	    && !converted
+# endif
+# ifdef FEAT_PERSISTENT_UNDO
+	    && !read_undo_file
+# endif
+# ifdef FEAT_CRYPT
+	    && cryptkey == NULL
+# endif
+	    && lseek(fd, (off_t)0L, SEEK_CUR) >= 0);
+    read_count = load_later ? (linenr_T)p_lol : lines_to_read;
+#endif
+
     while (!error && !got_int)
     {
 	/*
@@ -1409,9 +1572,18 @@ retry:
 		 * At start of file: Check for magic number of encryption.
 		 */
 		if (filesize == 0)
+		{
 		    cryptkey = check_for_cryptkey(cryptkey, ptr, &size,
 					&filesize, newfile, sfname,
 					&did_ask_for_key);
+# ifdef FEAT_PROGRESSIVE_LOAD
+		    if (cryptkey != NULL && load_later)
+		    {
+			load_later = FALSE;
+			read_count = lines_to_read;
+		    }
+# endif
+		}
 		/*
 		 * Decrypt the read bytes.
 		 */
@@ -1966,10 +2138,17 @@ retry:
 		for (p = ptr; ; ++p)
 		{
 		    int	 todo = (int)((ptr + size) - p);
+		    int	 valid;
 		    int	 l;
 
 		    if (todo <= 0)
 			break;
+		    /* Skip over valid UTF-8 quickly. */
+		    valid = (int)scan_utf8(p, (long)todo);
+		    p += valid;
+		    todo -= valid;
+		    if (todo == 0)
+			break;
 		    if (*p >= 0x80)
 		    {
 			/* A length of 1 means it's an illegal byte.  Accept
@@ -2056,17 +2235,13 @@ rewind_retry:
 		/* First try finding a NL, for Dos and Unix */
 		if (try_dos || try_unix)
 		{
-		    for (p = ptr; p < ptr + size; ++p)
+		    p = (char_u *)memchr(ptr, NL, (size_t)size);
+		    if (p != NULL)
 		    {
-			if (*p == NL)
-			{
-			    if (!try_unix
-				    || (try_dos && p > ptr && p[-1] == CAR))
-				fileformat = EOL_DOS;
-			    else
-				fileformat = EOL_UNIX;
-			    break;
-			}
+			if (!try_unix || (try_dos && p > ptr && p[-1] == CAR))
+			    fileformat = EOL_DOS;
+			else
+			    fileformat = EOL_UNIX;
 		    }
 
 		    /* Don't give in to EOL_UNIX if EOL_MAC is more likely */
@@ -2079,13 +2254,8 @@ rewind_retry:
 			    ;
 			if (p >= ptr)
 			{
-			    for (p = ptr; p < ptr + size; ++p)
-			    {
-				if (*p == NL)
-				    try_unix++;
-				else if (*p == CAR)
-				    try_mac++;
-			    }
+			    try_unix += (int)scan_count(ptr, size, NL);
+			    try_mac += (int)scan_count(ptr, size, CAR);
 			    if (try_mac > try_unix)
 				fileformat = EOL_MAC;
 			}
@@ -2107,17 +2277,20 @@ rewind_retry:
 	}
 
 	/*
-	 * This loop is executed once for every character read.
-	 * Keep it fast!
+	 * This loop is executed once for every line read.
+	 * Keep it fast!  scan_eol() skips to the next line break.
 	 */
 	if (fileformat == EOL_MAC)
 	{
 	    --ptr;
 	    while (++ptr, --size >= 0)
 	    {
-		/* catch most common case first */
-		if ((c = *ptr) != NUL && c != CAR && c != NL)
-		    continue;
+		skip = scan_eol(ptr, size + 1, TRUE);
+		ptr += skip;
+		size -= skip;
+		if (size < 0)
+		    break;
+		c = *ptr;
 		if (c == NUL)
 		    *ptr = NL;	/* NULs are replaced by newlines! */
 		else if (c == NL)
@@ -2128,11 +2301,16 @@ rewind_retry:
 		    {
 			*ptr = NUL;	    /* end of line */
 			len = (colnr_T) (ptr - line_start + 1);
-			if (ml_append(lnum, line_start, len, newfile) == FAIL)
+			if (ga_grow(&append_lines, 1) == FAIL
+				      || ga_grow(&append_lens, 1) == FAIL)
 			{
 			    error = TRUE;
 			    break;
 			}
+			((char_u **)append_lines.ga_data)[append_lines.ga_len++]
+								 = line_start;
+			((colnr_T *)append_lens.ga_data)[append_lens.ga_len++]
+									= len;
 #ifdef FEAT_PERSISTENT_UNDO
 			if (read_undo_file)
 			    sha256_update(&sha_ctx, line_start, len);
@@ -2156,8 +2334,12 @@ rewind_retry:
 	    --ptr;
 	    while (++ptr, --size >= 0)
 	    {
-		if ((c = *ptr) != NUL && c != NL)  /* catch most common case */
-		    continue;
+		skip = scan_eol(ptr, size + 1, FALSE);
+		ptr += skip;
+		size -= skip;
+		if (size < 0)
+		    break;
+		c = *ptr;
 		if (c == NUL)
 		    *ptr = NL;	/* NULs are replaced by newlines! */
 		else
@@ -2191,16 +2373,25 @@ rewind_retry:
 					set_fileformat(EOL_UNIX, OPT_LOCAL);
 				    file_rewind = TRUE;
 				    keep_fileformat = TRUE;
+				    /* Drop the lines not appended yet. */
+				    lnum -= append_lines.ga_len;
+				    append_lines.ga_len = 0;
+				    append_lens.ga_len = 0;
 				    goto retry;
 				}
 				ff_error = EOL_DOS;
 			    }
 			}
-			if (ml_append(lnum, line_start, len, newfile) == FAIL)
+			if (ga_grow(&append_lines, 1) == FAIL
+				      || ga_grow(&append_lens, 1) == FAIL)
 			{
 			    error = TRUE;
 			    break;
 			}
+			((char_u **)append_lines.ga_data)[append_lines.ga_len++]
+								 = line_start;
+			((colnr_T *)append_lens.ga_data)[append_lens.ga_len++]
+									= len;
 #ifdef FEAT_PERSISTENT_UNDO
 			if (read_undo_file)
 			    sha256_update(&sha_ctx, line_start, len);
@@ -2219,11 +2410,52 @@ rewind_retry:
 		}
 	    }
 	}
+
+	/* Append the lines found in the block at once, they are in "buffer"
+	 * until it is reused. */
+	if (append_lines.ga_len > 0)
+	{
+	    added = ml_append_lines(curbuf, lnum - append_lines.ga_len,
+		    (char_u **)append_lines.ga_data,
+		    (colnr_T *)append_lens.ga_data, (long)append_lines.ga_len,
+								     newfile);
+	    if (added < append_lines.ga_len)
+	    {
+		lnum -= append_lines.ga_len - added;
+		error = TRUE;
+	    }
+	    append_lines.ga_len = 0;
+	    append_lens.ga_len = 0;
+	}
 	linerest = (long)(ptr - line_start);
 	ui_breakcheck();
     }
 
 failed:
+    ga_clear(&append_lines);
+    ga_clear(&append_lens);
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /* Stopped after 'loadlines' lines: the rest is read later, starting at
+     * the line after "ptr". */
+    if (load_later && error && read_count == 0)
+    {
+	off_t	offset = lseek(fd, (off_t)0L, SEEK_CUR) - size;
+
+# ifdef FEAT_MBYTE
+	offset -= conv_restlen;
+# endif
+	if (buf_load_start(curbuf, fd, fileformat, offset) == OK)
+	    filesize = offset;
+	else
+	{
+	    /* Lines are missing, report it as a read error. */
+	    load_later = FALSE;
+	    read_count = 1;
+	}
+    }
+    else
+	load_later = FALSE;
+#endif
     /* not an error, max. number of lines reached */
     if (error && read_count == 0)
 	error = FALSE;
@@ -2290,7 +2522,11 @@ failed:
 # endif
 #endif
 
-    if (!read_buffer && !read_stdin)
+    if (!read_buffer && !read_stdin
+#ifdef FEAT_PROGRESSIVE_LOAD
+	    && !load_later
+#endif
+	    )
 	close(fd);				/* errors are ignored */
 #ifdef HAVE_FD_CLOEXEC
     else
@@ -2437,6 +2673,13 @@ failed:
 		STRCAT(IObuff, _("[CR missing]"));
 		c = TRUE;
 	    }
+#ifdef FEAT_PROGRESSIVE_LOAD
+	    if (load_later)
+	    {
+		STRCAT(IObuff, _("[loading]"));
+		c = TRUE;
+	    }
+#endif
 	    if (split)
 	    {
 		STRCAT(IObuff, _("[long lines split]"));
@@ -2640,6 +2883,347 @@ failed:
     return OK;
 }
 
+#if defined(FEAT_PROGRESSIVE_LOAD) || defined(PROTO)
+
+# define LOAD_BUFSIZE	0x10000L    /* initial size of the read buffer */
+# define LOAD_STEP	0x80000L    /* bytes read by one buf_load_step() */
+
+static int	bufs_loading = 0;   /* number of buffers with "b_load" set */
+
+/*
+ * Remember that the file "fd" of buffer "buf" is to be read further from
+ * byte "offset" on, with line breaks according to "fileformat".  Used by
+ * readfile() when it stopped after 'loadlines' lines.
+ * When OK is returned "fd" is owned by the buffer.
+ */
+    int
+buf_load_start(buf, fd, fileformat, offset)
+    buf_T	*buf;
+    int		fd;
+    int		fileformat;
+    off_t	offset;
+{
+    bufload_T	*bl;
+
+    if (offset < 0 || lseek(fd, offset, SEEK_SET) != offset)
+	return FAIL;
+    bl = (bufload_T *)alloc_clear((unsigned)sizeof(bufload_T));
+    if (bl == NULL)
+	return FAIL;
+    bl->bl_buf = alloc((unsigned)LOAD_BUFSIZE);
+    if (bl->bl_buf == NULL)
+    {
+	vim_free(bl);
+	return FAIL;
+    }
+    bl->bl_size = LOAD_BUFSIZE;
+    bl->bl_fd = fd;
+    bl->bl_fileformat = fileformat;
+    bl->bl_done = offset;
+    buf->b_load = bl;
+    ++bufs_loading;
+    return OK;
+}
+
+/*
+ * Stop reading the rest of the file for buffer "buf".  Called when the
+ * buffer is unloaded or the file is read again.
+ */
+    void
+buf_load_stop(buf)
+    buf_T	*buf;
+{
+    bufload_T	*bl = buf->b_load;
+    win_T	*wp;
+#ifdef FEAT_WINDOWS
+    tabpage_T	*tp;
+#endif
+
+    if (bl == NULL)
+	return;
+    close(bl->bl_fd);
+    vim_free(bl->bl_buf);
+    vim_free(bl);
+    buf->b_load = NULL;
+    --bufs_loading;
+
+    FOR_ALL_TAB_WINDOWS(tp, wp)
+	if (wp->w_buffer == buf)
+	    wp->w_redr_status = TRUE;
+}
+
+/*
+ * Stop loading "buf" when the rest of the file could not be read or reading
+ * was interrupted.  The file must not be overwritten with what is in the
+ * buffer then, require ":w!" like readfile() does.
+ */
+    static void
+buf_load_abort(buf)
+    buf_T	*buf;
+{
+    buf_load_stop(buf);
+    buf->b_p_ro = TRUE;
+}
+
+/*
+ * Return TRUE when buffer "buf" is being loaded from file "fname".
+ */
+    static int
+buf_load_uses_file(buf, fname)
+    buf_T	*buf;
+    char_u	*fname;
+{
+    struct stat	st_load;
+    struct stat	st;
+
+    return buf->b_load != NULL
+	    && fstat(buf->b_load->bl_fd, &st_load) == 0
+	    && mch_stat((char *)fname, &st) == 0
+	    && st_load.st_dev == st.st_dev
+	    && st_load.st_ino == st.st_ino;
+}
+
+/*
+ * Return TRUE when a buffer is being loaded and Vim waits for a Normal mode
+ * command, then the next part of the file can be read.  Not while a count,
+ * operator or the second character of a command is being typed, or in
+ * another mode: the K_USEREVENT from ev_next() would get in the way.
+ */
+    int
+buf_load_pending()
+{
+    return bufs_loading > 0
+	    && State == NORMAL_BUSY
+	    && !finish_op
+	    && !no_mapping
+	    && no_zero_mapping == 0
+	    && typebuf.tb_len == 0
+	    && !exmode_active;
+}
+
+/*
+ * Read the next part of the files that are being loaded.  Called from
+ * apply_event_autocmd() when ev_next() found no typed keys while
+ * buf_load_pending() returned TRUE.
+ */
+    void
+buf_load_step()
+{
+    buf_T	*buf;
+    long	done = 0;
+
+    for (buf = firstbuf; buf != NULL && done < LOAD_STEP; buf = buf->b_next)
+	while (buf->b_load != NULL && done < LOAD_STEP)
+	    done += buf_load_chunk(buf);
+}
+
+/*
+ * Read the rest of the file for buffer "buf".  Used before the buffer is
+ * changed or written and when the last line is needed.
+ */
+    void
+buf_load_finish(buf)
+    buf_T	*buf;
+{
+    (void)buf_load_more(buf, MAXLNUM);
+}
+
+/*
+ * Return TRUE when line "lnum" exists in buffer "buf", reading more of its
+ * file when needed.  Used for searching forward into the part that was not
+ * read yet.
+ */
+    int
+buf_load_more(buf, lnum)
+    buf_T	*buf;
+    linenr_T	lnum;
+{
+    while (lnum > buf->b_ml.ml_line_count && buf->b_load != NULL)
+    {
+	(void)buf_load_chunk(buf);
+	ui_breakcheck();
+	if (got_int)
+	    buf_load_abort(buf);
+    }
+    return lnum <= buf->b_ml.ml_line_count;
+}
+
+/*
+ * Return how much of the file of buffer "buf" was read, in percent.
+ */
+    int
+buf_load_percent(buf)
+    buf_T	*buf;
+{
+    if (buf->b_load == NULL || buf->b_load->bl_done >= buf->b_orig_size)
+	return 100;
+    return (int)(buf->b_load->bl_done * 100 / buf->b_orig_size);
+}
+
+/*
+ * Read one buffer full of the file of "buf" and append the complete lines,
+ * like readfile() does for the first part.  The text is never converted.
+ * Returns the number of bytes read, zero when loading ended.
+ */
+    static long
+buf_load_chunk(buf)
+    buf_T	*buf;
+{
+    bufload_T	*bl = buf->b_load;
+    linenr_T	lnum = buf->b_ml.ml_line_count;
+    linenr_T	old_count = lnum;
+    int		eol_char = bl->bl_fileformat == EOL_MAC ? CAR : NL;
+    char_u	*start;
+    char_u	*end;
+    char_u	*p;
+    char_u	*newbuf;
+    long	size;
+    colnr_T	len;
+
+    /* A line that doesn't fit: double the buffer, keep room for a NUL. */
+    if (bl->bl_len >= bl->bl_size - 1)
+    {
+	newbuf = lalloc((long_u)(bl->bl_size * 2), FALSE);
+	if (newbuf == NULL)
+	{
+	    do_outofmem_msg((long_u)(bl->bl_size * 2));
+	    buf_load_abort(buf);
+	    return 0;
+	}
+	mch_memmove(newbuf, bl->bl_buf, (size_t)bl->bl_len);
+	vim_free(bl->bl_buf);
+	bl->bl_buf = newbuf;
+	bl->bl_size *= 2;
+    }
+
+    size = read_eintr(bl->bl_fd, bl->bl_buf + bl->bl_len,
+					       bl->bl_size - bl->bl_len - 1);
+    if (size < 0)
+    {
+	buf_load_abort(buf);
+	return 0;
+    }
+    if (size == 0)
+    {
+	buf_load_end(buf);
+	return 0;
+    }
+    bl->bl_done += size;
+
+    start = bl->bl_buf;
+    end = bl->bl_buf + bl->bl_len + size;
+    for (p = bl->bl_buf + bl->bl_len; p < end; ++p)
+    {
+	p += scan_eol(p, (long)(end - p), eol_char == CAR);
+	if (p == end)
+	    break;
+	if (*p == eol_char)
+	{
+	    *p = NUL;		/* end of line */
+	    len = (colnr_T)(p - start + 1);
+	    if (bl->bl_fileformat == EOL_DOS && p > start && p[-1] == CAR)
+	    {
+		p[-1] = NUL;	/* remove CR */
+		--len;
+	    }
+	    if (ml_append_buf(buf, lnum, start, len, TRUE) == FAIL)
+	    {
+		buf_load_abort(buf);
+		break;
+	    }
+	    ++lnum;
+	    start = p + 1;
+	}
+	else if (*p == NUL)
+	    *p = NL;		/* NULs are replaced by newlines! */
+	else if (*p == NL)
+	    *p = CAR;		/* NLs are replaced by CRs! (Mac format) */
+    }
+
+    if (buf->b_load != NULL)
+    {
+	/* Keep the partial line for the next time. */
+	bl->bl_len = (long)(end - start);
+	mch_memmove(bl->bl_buf, start, (size_t)bl->bl_len);
+    }
+    if (lnum > old_count)
+	buf_load_appended(buf, old_count, lnum);
+    return size;
+}
+
+/*
+ * Reached the end of the file of "buf": append the last line when it has no
+ * line break, like readfile() does, and stop loading.
+ */
+    static void
+buf_load_end(buf)
+    buf_T	*buf;
+{
+    bufload_T	*bl = buf->b_load;
+    linenr_T	lnum = buf->b_ml.ml_line_count;
+
+    /* In Dos format ignore a trailing CTRL-Z, unless 'binary' set. */
+    if (bl->bl_len > 0 && !(!buf->b_p_bin && bl->bl_fileformat == EOL_DOS
+				 && bl->bl_len == 1 && *bl->bl_buf == Ctrl_Z))
+    {
+	bl->bl_buf[bl->bl_len] = NUL;
+	if (ml_append_buf(buf, lnum, bl->bl_buf,
+					    (colnr_T)bl->bl_len + 1, TRUE) == OK)
+	{
+	    buf->b_p_eol = FALSE;
+	    buf->b_start_eol = FALSE;
+	    buf->b_no_eol_lnum = lnum + 1;
+	    buf_load_appended(buf, lnum, lnum + 1);
+	}
+    }
+    buf_load_stop(buf);
+}
+
+/*
+ * Lines "lnum" + 1 to "lnume" were appended to buffer "buf": update the
+ * windows that show the end of the buffer and the status lines.  The buffer
+ * isn't changed, the lines are part of the file.
+ */
+    static void
+buf_load_appended(buf, lnum, lnume)
+    buf_T	*buf;
+    linenr_T	lnum;
+    linenr_T	lnume;
+{
+    win_T	*wp;
+#ifdef FEAT_WINDOWS
+    tabpage_T	*tp;
+#endif
+#ifdef FEAT_FOLDING
+    win_T	*save_curwin;
+#endif
+
+    FOR_ALL_TAB_WINDOWS(tp, wp)
+	if (wp->w_buffer == buf)
+	{
+	    wp->w_redr_status = TRUE;
+	    if (wp->w_botline > lnum)
+	    {
+		invalidate_botline_win(wp);
+		redraw_win_later(wp, NOT_VALID);
+	    }
+#ifdef FEAT_FOLDING
+	    if (hasAnyFolding(wp))
+	    {
+		/* foldUpdate() works on the current window. */
+		save_curwin = curwin;
+		curwin = wp;
+		curbuf = buf;
+		foldUpdate(wp, lnum, lnume);
+		curwin = save_curwin;
+		curbuf = curwin->w_buffer;
+	    }
+#endif
+	}
+}
+
+#endif /* FEAT_PROGRESSIVE_LOAD */
+
 #ifdef OPEN_CHR_FILES
 /*
  * Returns TRUE if the file name argument is of the form "/dev/fd/\d\+",
@@ -2743,6 +3327,72 @@ set_file_options(set_options, eap)
     }
 }
 
+#if (defined(UNIX) && defined(HAVE_SYS_MMAN_H)) || defined(PROTO)
+/*
+ * Find out how the bytes of a file must look for readfile() to use them as
+ * they are for buffer "buf", without trying another encoding or converting.
+ * "buf" is NULL for a new buffer.  Sets "*bomp" when 'fileencodings' has
+ * "ucs-bom".  A NUL byte is never used as it is, readfile() turns it into a
+ * NL.  Returns RAW_ANY, RAW_UTF8 or RAW_ASCII, RAW_NONE when the bytes are
+ * always converted.
+ */
+    int
+fenc_raw_mode(buf, bomp)
+    buf_T	*buf;
+    int		*bomp;
+{
+# ifdef FEAT_MBYTE
+    char_u	*p = p_fencs;
+    char_u	name[50];
+    char_u	*fenc = NULL;
+    int		mode = RAW_ANY;
+
+    *bomp = FALSE;
+    if (*p_fencs == NUL)
+    {
+	/* The encoding of the buffer is used. */
+	if (buf != NULL && *buf->b_p_fenc != NUL)
+	    fenc = vim_strsave(buf->b_p_fenc);
+    }
+    while (*p != NUL)
+    {
+	copy_option_part(&p, name, (int)sizeof(name), ",");
+	if (STRCMP(name, "ucs-bom") == 0)
+	{
+	    *bomp = TRUE;
+	    continue;
+	}
+	/* Only the first encoding matters, when the file isn't valid in it
+	 * the next one is tried. */
+	fenc = enc_canonize(name);
+	if (fenc == NULL)
+	    return RAW_NONE;
+	break;
+    }
+    if (fenc != NULL && STRCMP(fenc, p_enc) != 0)
+    {
+	/* ASCII is converted to itself, unless it is one of the wide
+	 * Unicode encodings or an unknown one. */
+	int prop = enc_canon_props(fenc);
+
+	if ((prop & (ENC_8BIT | ENC_DBCS | ENC_UNICODE)) == 0
+		|| (prop & (ENC_2BYTE | ENC_4BYTE | ENC_2WORD)) != 0)
+	    mode = RAW_NONE;
+	else
+	    mode = RAW_ASCII;
+    }
+    vim_free(fenc);
+    if (mode != RAW_ANY)
+	return mode;
+    /* Illegal bytes are replaced when reading UTF-8. */
+    return enc_utf8 ? RAW_UTF8 : RAW_ANY;
+# else
+    *bomp = FALSE;
+    return RAW_ANY;
+# endif
+}
+#endif
+
 #if defined(FEAT_MBYTE) || defined(PROTO)
 /*
  * Set forced 'fileencoding'.
@@ -3238,6 +3888,19 @@ buf_write(buf, fname, sfname, start, end, eap, append, forceit,
 	return FAIL;
     }
 
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /* Writing the whole buffer includes the part of the file that wasn't
+     * read yet. */
+    if (whole && buf->b_load != NULL)
+    {
+	buf_load_finish(buf);
+	end = buf->b_ml.ml_line_count;
+# ifdef FEAT_AUTOCMD
+	old_line_count = end;
+# endif
+    }
+#endif
+
     /*
      * Disallow writing from .exrc and .vimrc in current directory for
      * security reasons.
@@ -4379,6 +5042,27 @@ buf_write(buf, fname, sfname, start, end, eap, append, forceit,
     }
 #endif
 
+#if defined(FEAT_MMAP) || defined(FEAT_PROGRESSIVE_LOAD)
+    /* When overwriting a file that the text of a buffer is mapped from or
+     * still being read from, that text must be read first. */
+    if (!append)
+    {
+	buf_T	*mbuf;
+
+	for (mbuf = firstbuf; mbuf != NULL; mbuf = mbuf->b_next)
+	{
+# ifdef FEAT_MMAP
+	    if (ml_map_uses_file(mbuf, wfname))
+		ml_map_detach(mbuf);
+# endif
+# ifdef FEAT_PROGRESSIVE_LOAD
+	    if (buf_load_uses_file(mbuf, wfname))
+		buf_load_finish(mbuf);
+# endif
+	}
+    }
+#endif
+
     /*
      * Open the file "wfname" for writing.
      * We may try to open the file twice: If we can't write to the
@@ -4573,6 +5257,31 @@ restore_backup:
     fileformat = get_fileformat_force(buf, eap);
     s = buffer;
     len = 0;
+#ifdef USE_WRITEV
+    /* When the text is written as it is buf_write_bytes() isn't needed. */
+    if (end > 0
+# ifdef HAS_BW_FLAGS
+	    && wb_flags == 0
+# endif
+# ifdef FEAT_MBYTE
+	    && write_info.bw_conv_buf == NULL
+# endif
+	    )
+    {
+	no_eol = write_bin && (end == buf->b_no_eol_lnum
+		     || (end == buf->b_ml.ml_line_count && !buf->b_p_eol));
+	if (buf_write_direct(buf, fd, buffer, bufsize, start, end,
+							   fileformat, no_eol,
+# ifdef FEAT_PERSISTENT_UNDO
+		    write_undo_file ? &sha_ctx : NULL,
+# else
+		    NULL,
+# endif
+		    &nchars, &lnum) == FAIL)
+	    end = 0;
+    }
+    else
+#endif
     for (lnum = start; lnum <= end; ++lnum)
     {
 	/*
@@ -4710,8 +5419,13 @@ restore_backup:
      * been written to disk and we don't lose it.
      * For a device do try the fsync() but don't complain if it does not work
      * (could be a pipe).
-     * If the 'fsync' option is FALSE, don't fsync().  Useful for laptops. */
+     * If the 'fsync' option is FALSE, don't fsync().  Useful for laptops.
+     * fdatasync() is enough, the timestamps don't need to be on disk. */
+# ifdef HAVE_FDATASYNC
+    if (p_fs && fdatasync(fd) != 0 && !device)
+# else
     if (p_fs && fsync(fd) != 0 && !device)
+# endif
     {
 	errmsg = (char_u *)_("E667: Fsync failed");
 	end = 0;
@@ -5748,6 +6462,234 @@ buf_write_bytes(ip)
     return (wlen < len) ? FAIL : OK;
 }
 
+#ifdef USE_WRITEV
+/*
+ * Write the iovecs of "wb" and the text in its buffer that isn't in an iovec
+ * yet.  Repeats writev() after a partial write or when interrupted by a
+ * signal.  Returns FAIL for a write error.
+ */
+    static int
+wv_flush(wb)
+    wvbuf_T	*wb;
+{
+    struct iovec    *iov = wb->wb_iov;
+    int		    count;
+    ssize_t	    wlen;
+
+    wv_close_seg(wb);
+    count = wb->wb_niov;
+    wb->wb_niov = 0;
+    wb->wb_seg = wb->wb_end = wb->wb_buf;
+    while (count > 0)
+    {
+	wlen = writev(wb->wb_fd, iov, count);
+	if (wlen < 0)
+	{
+	    if (errno != EINTR)
+		return FAIL;
+	    continue;
+	}
+	/* Skip over what was written. */
+	while (count > 0 && (size_t)wlen >= iov->iov_len)
+	{
+	    wlen -= iov->iov_len;
+	    ++iov;
+	    --count;
+	}
+	if (count > 0)
+	{
+	    iov->iov_base = (char *)iov->iov_base + wlen;
+	    iov->iov_len -= wlen;
+	}
+    }
+    return OK;
+}
+
+/*
+ * Put the text copied into the buffer of "wb" since the last iovec in an
+ * iovec.
+ */
+    static void
+wv_close_seg(wb)
+    wvbuf_T	*wb;
+{
+    if (wb->wb_end > wb->wb_seg)
+    {
+	wb->wb_iov[wb->wb_niov].iov_base = (char *)wb->wb_seg;
+	wb->wb_iov[wb->wb_niov++].iov_len = wb->wb_end - wb->wb_seg;
+	wb->wb_seg = wb->wb_end;
+    }
+}
+
+/*
+ * Add "len" bytes at "p" to "wb".  When "text" is TRUE they are the text of a
+ * line: a NL becomes a NUL and with "mac" a CR becomes a NL.  Long text that
+ * doesn't need to be changed gets its own iovec, "p" must then stay valid
+ * until wv_flush().  Otherwise it is copied.
+ * Returns FAIL for a write error.
+ */
+    static int
+wv_add(wb, p, len, text, mac)
+    wvbuf_T	*wb;
+    char_u	*p;
+    long	len;
+    int		text;
+    int		mac;
+{
+    int		plain = TRUE;
+    long	n;
+    long	i;
+
+    /* A NUL in the text is stored as a NL, there is no NUL. */
+    if (text && (memchr(p, NL, (size_t)len) != NULL
+				|| (mac && memchr(p, CAR, (size_t)len) != NULL)))
+	plain = FALSE;
+
+    if (plain && len >= WRITEV_MIN_LEN)
+    {
+	if (wb->wb_niov + 2 > WRITEV_MAX && wv_flush(wb) == FAIL)
+	    return FAIL;
+	wv_close_seg(wb);
+	wb->wb_iov[wb->wb_niov].iov_base = (char *)p;
+	wb->wb_iov[wb->wb_niov++].iov_len = len;
+	wb->wb_direct = TRUE;
+	return OK;
+    }
+
+    while (len > 0)
+    {
+	if (wb->wb_end == wb->wb_buf + wb->wb_size
+		|| wb->wb_niov + 2 > WRITEV_MAX)
+	    if (wv_flush(wb) == FAIL)
+		return FAIL;
+	n = (long)(wb->wb_buf + wb->wb_size - wb->wb_end);
+	if (n > len)
+	    n = len;
+	mch_memmove(wb->wb_end, p, (size_t)n);
+	if (!plain)
+	    for (i = 0; i < n; ++i)
+	    {
+		if (wb->wb_end[i] == NL)
+		    wb->wb_end[i] = NUL;    /* replace newlines with NULs */
+		else if (wb->wb_end[i] == CAR && mac)
+		    wb->wb_end[i] = NL;	    /* Mac: replace CRs with NLs */
+	    }
+	wb->wb_end += n;
+	p += n;
+	len -= n;
+    }
+    return OK;
+}
+
+/*
+ * Write lines "start" to "end" of "buf" to "fd" without buf_write_bytes():
+ * the text is copied into "buffer" with mch_memmove() instead of a byte at a
+ * time, and long lines are not copied at all, writev() gets them from the
+ * memline blocks.  Only to be used when the text doesn't need to be converted
+ * or encrypted.  When "no_eol" is TRUE the last line doesn't get a line
+ * break.  Updates "sha_ctx" when it's not NULL.
+ * Adds the number of bytes written to "*ncharsp" and sets "*lnump" to the
+ * line after the last one written.
+ * Returns FAIL for a write error or when interrupted.
+ */
+    static int
+buf_write_direct(buf, fd, buffer, bufsize, start, end, fileformat, no_eol,
+						       sha_ctx, ncharsp, lnump)
+    buf_T		*buf;
+    int			fd;
+    char_u		*buffer;
+    int			bufsize;
+    linenr_T		start;
+    linenr_T		end;
+    int			fileformat;
+    int			no_eol;
+    context_sha256_T	*sha_ctx;
+    long		*ncharsp;
+    linenr_T		*lnump;
+{
+    wvbuf_T	*wb;
+    char_u	*lines[WRITEV_LINES];
+    colnr_T	lens[WRITEV_LINES];
+    char_u	*eol;
+    long	eol_len;
+    linenr_T	lnum = start;
+    int		mac = (fileformat == EOL_MAC);
+    int		retval = OK;
+    int		count;
+    int		i;
+
+    wb = (wvbuf_T *)alloc((unsigned)sizeof(wvbuf_T));
+    if (wb == NULL)
+    {
+	*lnump = start;	    /* nothing was written */
+	return FAIL;
+    }
+    wb->wb_fd = fd;
+    wb->wb_niov = 0;
+    wb->wb_buf = wb->wb_seg = wb->wb_end = buffer;
+    wb->wb_size = bufsize;
+    wb->wb_direct = FALSE;
+
+    if (fileformat == EOL_DOS)
+	eol = (char_u *)"\r\n";
+    else if (mac)
+	eol = (char_u *)"\r";
+    else
+	eol = (char_u *)"\n";
+    eol_len = (long)STRLEN(eol);
+
+    while (lnum <= end && retval == OK)
+    {
+	count = ml_get_buf_lines(buf, lnum, end, WRITEV_LINES, lines, lens);
+	if (count == 0)
+	{
+	    retval = FAIL;
+	    break;
+	}
+	for (i = 0; i < count; ++i)
+	{
+#ifdef FEAT_PERSISTENT_UNDO
+	    if (sha_ctx != NULL)
+		sha256_update(sha_ctx, lines[i], (UINT32_T)(lens[i] + 1));
+#endif
+	    *ncharsp += lens[i];
+	    if (wv_add(wb, lines[i], (long)lens[i], TRUE, mac) == FAIL)
+	    {
+		retval = FAIL;
+		break;
+	    }
+	    if (!no_eol || lnum + i != end)
+	    {
+		*ncharsp += eol_len;
+		if (wv_add(wb, eol, eol_len, FALSE, FALSE) == FAIL)
+		{
+		    retval = FAIL;
+		    break;
+		}
+	    }
+	}
+	lnum += count;
+
+	/* The text of the lines is only valid until the next ml_ call. */
+	if (retval == OK && wb->wb_direct)
+	{
+	    wb->wb_direct = FALSE;
+	    if (wv_flush(wb) == FAIL)
+		retval = FAIL;
+	}
+
+	ui_breakcheck();
+	if (got_int)
+	    retval = FAIL;
+    }
+    if (retval == OK && wv_flush(wb) == FAIL)
+	retval = FAIL;
+    vim_free(wb);
+    *lnump = lnum;
+    return retval;
+}
+#endif
+
 #ifdef FEAT_MBYTE
 /*
  * Convert a Unicode character to bytes.
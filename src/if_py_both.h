@@ -802,25 +802,30 @@ VimToPython(typval_T *our_tv, int depth, PyObject *lookup_dict)
 VimTrigger(PyObject *self UNUSED, PyObject *args)
 {
     char_u	*ev, *ev_arg = NULL;
-    PyObject	*event, *event_arg = Py_None, *todecref;
+    PyObject	*event, *event_arg = Py_None, *todecref, *argdecref = NULL;
 
     
     if (!PyArg_ParseTuple(args, "O|O", &event, &event_arg))
 	return NULL;
 
-    if (!(ev = strdup(StringToChars(event, &todecref))))
+    if (!(ev = StringToChars(event, &todecref)))
 	return NULL;
 
-    Py_XDECREF(todecref);
-
     if (event_arg != Py_None &&
-	    !(ev_arg = strdup(StringToChars(event_arg, &todecref))))
-	return NULL;
-
-    if (ev_arg != NULL)
+	    !(ev_arg = StringToChars(event_arg, &argdecref)))
+    {
 	Py_XDECREF(todecref);
+	return NULL;
+    }
 
+    /* The queue copies the strings.  When it is full this may wait for the
+     * main thread, let it run Python meanwhile. */
+    Py_BEGIN_ALLOW_THREADS
     ev_trigger(ev, ev_arg);
+    Py_END_ALLOW_THREADS
+
+    Py_XDECREF(todecref);
+    Py_XDECREF(argdecref);
 
     Py_INCREF(Py_None);
 
@@ -0,0 +1,634 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * job.c: Commands running in the background, see ":help job-control".
+ *
+ * A job is started with mch_start_job(), which connects its stdin, stdout
+ * and stderr to non-blocking pipes.  The descriptors are waited on in
+ * RealWaitForChar() together with the keyboard, through job_get_fds() and
+ * job_fd_ready().  Output is collected per job while reading and passed on by
+ * job_run_callbacks(), which apply_event_autocmd() invokes: the User
+ * autocommands "{name}:stdout" and "{name}:stderr" get it in chunks in
+ * v:event_arg.  When both have been closed and the process was reaped
+ * "{name}:exit" is triggered with the exit status, after all the output.
+ * The output does not go through the event queue, where a full queue would
+ * merge chunks with the same event name and lose output.
+ *
+ * A job started with job_start_cb() has a C callback instead, which gets the
+ * collected output the same way.  A job is only freed after the exit status
+ * was passed on.
+ */
+
+#include "vim.h"
+
+#if defined(FEAT_JOB_CONTROL) || defined(PROTO)
+
+#define JOB_READ_SIZE	4096	/* size of a chunk of output */
+#define JOB_REAP_WAIT	50L	/* msec between checks for a job to exit */
+#define JOB_OUT_MAX	(256 * JOB_READ_SIZE)	/* stop reading when this much
+						   output is not passed on */
+
+typedef struct
+{
+    int		job_id;		/* zero when the entry is not used */
+    int		job_pid;
+    int		job_in;		/* descriptors, -1 when closed */
+    int		job_out;
+    int		job_err;
+    char_u	*job_ev_out;	/* event names "{name}:stdout" etc. */
+    char_u	*job_ev_err;
+    char_u	*job_ev_exit;
+    garray_T	job_pending;	/* input that wasn't written yet */
+    void	(*job_cb) __ARGS((int id, int what, char_u *data, int len));
+    garray_T	job_output[2];	/* output not passed on yet */
+    int		job_exited;	/* reaped, "job_status" is valid */
+    int		job_status;
+} job_T;
+
+static job_T	jobs[JOB_MAX];
+static int	last_job_id = 0;
+static int	jobs_reaping = 0;   /* jobs with all output read, not reaped */
+static int	jobs_cb_pending = FALSE;    /* output or exit to pass on */
+static int	jobs_cb_busy = FALSE;	    /* job_run_callbacks() active */
+
+static job_T *find_job __ARGS((int id));
+static char_u *job_event_name __ARGS((char_u *name, char *suffix));
+static void job_free __ARGS((job_T *job));
+static job_T *job_new __ARGS((void));
+static int job_launch __ARGS((job_T *job, char **argv));
+static void job_split_args __ARGS((char_u *p, char **argv, int *argcp));
+static void job_write __ARGS((job_T *job));
+static void job_read __ARGS((job_T *job, int *fdp, int what));
+static void job_reap __ARGS((job_T *job));
+static void job_pass_output __ARGS((job_T *job, int what));
+
+    static job_T *
+find_job(id)
+    int		id;
+{
+    int		i;
+
+    if (id <= 0)
+	return NULL;
+    for (i = 0; i < JOB_MAX; ++i)
+	if (jobs[i].job_id == id)
+	    return &jobs[i];
+    return NULL;
+}
+
+    static char_u *
+job_event_name(name, suffix)
+    char_u	*name;
+    char	*suffix;
+{
+    return concat_str(name, (char_u *)suffix);
+}
+
+    static void
+job_free(job)
+    job_T	*job;
+{
+    if (job->job_in >= 0)
+	close(job->job_in);
+    if (job->job_out >= 0)
+	close(job->job_out);
+    if (job->job_err >= 0)
+	close(job->job_err);
+    vim_free(job->job_ev_out);
+    vim_free(job->job_ev_err);
+    vim_free(job->job_ev_exit);
+    ga_clear(&job->job_pending);
+    ga_clear(&job->job_output[JOB_STDOUT]);
+    ga_clear(&job->job_output[JOB_STDERR]);
+    vim_memset(job, 0, sizeof(job_T));
+}
+
+/*
+ * Find a free entry for a job.  Gives an error message when there is none.
+ */
+    static job_T *
+job_new()
+{
+    job_T	*job;
+    int		i;
+
+    for (i = 0; i < JOB_MAX; ++i)
+	if (jobs[i].job_id == 0)
+	{
+	    job = &jobs[i];
+	    ga_init2(&job->job_pending, 1, JOB_READ_SIZE);
+	    ga_init2(&job->job_output[JOB_STDOUT], 1, JOB_READ_SIZE);
+	    ga_init2(&job->job_output[JOB_STDERR], 1, JOB_READ_SIZE);
+	    job->job_in = job->job_out = job->job_err = -1;
+	    return job;
+	}
+    EMSGN(_("E881: Too many jobs, the maximum is %ld"), JOB_MAX);
+    return NULL;
+}
+
+/*
+ * Run "argv" for entry "job" obtained with job_new().
+ * Returns the job ID, 0 for an error.
+ */
+    static int
+job_launch(job, argv)
+    job_T	*job;
+    char	**argv;
+{
+    if (mch_start_job(argv, &job->job_pid, &job->job_in,
+				       &job->job_out, &job->job_err) == FAIL)
+    {
+	job->job_in = job->job_out = job->job_err = -1;
+	job_free(job);
+	EMSG2(_("E882: Cannot start job: %s"), argv[0]);
+	return 0;
+    }
+    job->job_id = ++last_job_id;
+    return job->job_id;
+}
+
+/*
+ * Start command "argv" as job "name".
+ * Returns the job ID, 0 for an error and -1 when "argv[0]" is not
+ * executable.
+ */
+    int
+job_start(name, argv)
+    char_u	*name;
+    char	**argv;
+{
+    job_T	*job;
+
+    if (!mch_can_exe((char_u *)argv[0]))
+	return -1;
+    if ((job = job_new()) == NULL)
+	return 0;
+
+    job->job_ev_out = job_event_name(name, ":stdout");
+    job->job_ev_err = job_event_name(name, ":stderr");
+    job->job_ev_exit = job_event_name(name, ":exit");
+    if (job->job_ev_out == NULL || job->job_ev_err == NULL
+						   || job->job_ev_exit == NULL)
+    {
+	job_free(job);
+	return 0;
+    }
+    return job_launch(job, argv);
+}
+
+/*
+ * Start command "argv" as a job that passes its output to "cb" instead of
+ * triggering events.  "cb" is called with the job ID, JOB_STDOUT or
+ * JOB_STDERR and a chunk of output, which is not NUL terminated.  The last
+ * call is with JOB_EXIT, NULL and the exit status, the job is gone then.
+ * Returns the job ID, 0 for an error and -1 when "argv[0]" is not
+ * executable.
+ */
+    int
+job_start_cb(argv, cb)
+    char	**argv;
+    void	(*cb) __ARGS((int id, int what, char_u *data, int len));
+{
+    job_T	*job;
+
+    if (!mch_can_exe((char_u *)argv[0]))
+	return -1;
+    if ((job = job_new()) == NULL)
+	return 0;
+    job->job_cb = cb;
+    return job_launch(job, argv);
+}
+
+/*
+ * Split "p" into arguments at white space that is not inside double quotes,
+ * the way mch_call_shell() does it.  "p" is modified.
+ */
+    static void
+job_split_args(p, argv, argcp)
+    char_u	*p;
+    char	**argv;
+    int		*argcp;
+{
+    int		inquote = FALSE;
+
+    p = skipwhite(p);
+    while (*p != NUL)
+    {
+	argv[(*argcp)++] = (char *)p;
+	while (*p != NUL && (inquote || !vim_iswhite(*p)))
+	{
+	    if (*p == '"')
+		inquote = !inquote;
+	    ++p;
+	}
+	if (*p != NUL)
+	    *p++ = NUL;
+	p = skipwhite(p);
+    }
+}
+
+/*
+ * Start shell command "cmd" with 'shell' and 'shellcmdflag', like ":!" does,
+ * as a job with callback "cb".  'shellxquote' is added like call_shell()
+ * does.  See job_start_cb().
+ */
+    int
+job_start_shell(cmd, cb)
+    char_u	*cmd;
+    void	(*cb) __ARGS((int id, int what, char_u *data, int len));
+{
+    char_u	*shell = vim_strsave(p_sh);
+    char_u	*shcf = vim_strsave(p_shcf);
+    char_u	*xcmd = shell_xquote(cmd);
+    char	**argv;
+    int		argc = 0;
+    int		id = 0;
+
+    /* every argument takes at least two bytes */
+    argv = (char **)alloc((unsigned)((STRLEN(p_sh) + STRLEN(p_shcf) + 6) / 2
+							    * sizeof(char *)));
+    if (shell != NULL && shcf != NULL && xcmd != NULL && argv != NULL)
+    {
+	job_split_args(shell, argv, &argc);
+	job_split_args(shcf, argv, &argc);
+	argv[argc++] = (char *)xcmd;
+	argv[argc] = NULL;
+	id = job_start_cb(argv, cb);
+    }
+    vim_free(shell);
+    vim_free(shcf);
+    vim_free(xcmd);
+    vim_free(argv);
+    return id;
+}
+
+/*
+ * Send "len" bytes of "data" to the stdin of job "id".  What can't be
+ * written without blocking is kept until the job reads it.
+ * Returns FAIL when there is no such job or its input was closed.
+ */
+    int
+job_send(id, data, len)
+    int		id;
+    char_u	*data;
+    int		len;
+{
+    job_T	*job = find_job(id);
+
+    if (job == NULL || job->job_in < 0)
+	return FAIL;
+    if (ga_grow(&job->job_pending, len) == FAIL)
+	return FAIL;
+    mch_memmove((char_u *)job->job_pending.ga_data + job->job_pending.ga_len,
+								    data, len);
+    job->job_pending.ga_len += len;
+    job_write(job);
+    return OK;
+}
+
+/*
+ * Terminate job "id" and the processes it started.  Its output is still
+ * read and "{name}:exit" is triggered when it is gone.
+ * Returns FAIL when there is no such job.
+ */
+    int
+job_stop(id)
+    int		id;
+{
+    job_T	*job = find_job(id);
+
+    if (job == NULL)
+	return FAIL;
+    /* The pid of a job that was reaped may have been reused. */
+    if (!job->job_exited)
+	mch_stop_job(job->job_pid);
+    return OK;
+}
+
+/*
+ * Terminate all jobs, called when exiting.
+ */
+    void
+job_stop_all()
+{
+    int		i;
+
+    for (i = 0; i < JOB_MAX; ++i)
+	if (jobs[i].job_id != 0 && !jobs[i].job_exited)
+	    mch_stop_job(jobs[i].job_pid);
+}
+
+/*
+ * Write as much of the pending input as the pipe takes.
+ */
+    static void
+job_write(job)
+    job_T	*job;
+{
+    char_u	*p = (char_u *)job->job_pending.ga_data;
+    int		len;
+
+    while (job->job_pending.ga_len > 0)
+    {
+	len = write(job->job_in, p, job->job_pending.ga_len);
+	if (len < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    {
+		/* the job closed its stdin */
+		close(job->job_in);
+		job->job_in = -1;
+		job->job_pending.ga_len = 0;
+	    }
+	    break;
+	}
+	job->job_pending.ga_len -= len;
+	mch_memmove(p, p + len, job->job_pending.ga_len);
+    }
+}
+
+/*
+ * Read one chunk from "*fdp", which is stdout or stderr as said by "what",
+ * and keep it for job_run_callbacks().  Closes the descriptor at
+ * end-of-file.
+ */
+    static void
+job_read(job, fdp, what)
+    job_T	*job;
+    int		*fdp;
+    int		what;
+{
+    char_u	buf[JOB_READ_SIZE + 1];
+    int		len;
+    int		i;
+
+    len = read(*fdp, buf, JOB_READ_SIZE);
+    if (len < 0 && (errno == EINTR || errno == EAGAIN
+						   || errno == EWOULDBLOCK))
+	return;
+    if (len <= 0)
+    {
+	close(*fdp);
+	*fdp = -1;
+	if (job->job_out < 0 && job->job_err < 0)
+	{
+	    ++jobs_reaping;
+	    job_reap(job);
+	}
+	return;
+    }
+
+    /* Change NUL into SOH, otherwise the string is truncated. */
+    for (i = 0; i < len; ++i)
+	if (buf[i] == NUL)
+	    buf[i] = 1;
+
+    if (ga_grow(&job->job_output[what], len) == FAIL)
+	return;
+    mch_memmove((char_u *)job->job_output[what].ga_data
+				      + job->job_output[what].ga_len, buf, len);
+    job->job_output[what].ga_len += len;
+    jobs_cb_pending = TRUE;
+}
+
+/*
+ * When job "job" has exited remember the exit status, job_run_callbacks()
+ * passes it on after the output and frees the job.
+ */
+    static void
+job_reap(job)
+    job_T	*job;
+{
+    int		status;
+
+    if (mch_job_status(job->job_pid, &status) == FAIL)
+	return;	    /* still running, try again later */
+    job->job_exited = TRUE;
+    job->job_status = status;
+    jobs_cb_pending = TRUE;
+    --jobs_reaping;
+}
+
+/*
+ * Store the descriptors that jobs are waiting on in "fds[max]".  "writing"
+ * is set to TRUE for descriptors that need to be checked for writing.
+ * Returns the number of descriptors.
+ */
+    int
+job_get_fds(fds, writing, max)
+    int		*fds;
+    int		*writing;
+    int		max;
+{
+    int		n = 0;
+    int		i;
+
+    for (i = 0; i < JOB_MAX && n + 3 <= max; ++i)
+    {
+	if (jobs[i].job_id == 0 || jobs[i].job_exited)
+	    continue;
+	if (jobs[i].job_out < 0 && jobs[i].job_err < 0)
+	{
+	    /* Output is done, the process may have exited meanwhile. */
+	    job_reap(&jobs[i]);
+	    continue;
+	}
+	/* Don't read more while a lot of output was not passed on, the job
+	 * blocks when the pipe is full. */
+	if (jobs[i].job_out >= 0
+		       && jobs[i].job_output[JOB_STDOUT].ga_len < JOB_OUT_MAX)
+	{
+	    fds[n] = jobs[i].job_out;
+	    writing[n++] = FALSE;
+	}
+	if (jobs[i].job_err >= 0
+		       && jobs[i].job_output[JOB_STDERR].ga_len < JOB_OUT_MAX)
+	{
+	    fds[n] = jobs[i].job_err;
+	    writing[n++] = FALSE;
+	}
+	if (jobs[i].job_in >= 0 && jobs[i].job_pending.ga_len > 0)
+	{
+	    fds[n] = jobs[i].job_in;
+	    writing[n++] = TRUE;
+	}
+    }
+    return n;
+}
+
+/*
+ * Limit the time to wait for input to "msec", while a job has closed its
+ * output but didn't exit yet, so that it is reaped without a delay.
+ */
+    long
+job_wait_time(msec)
+    long	msec;
+{
+    if (jobs_reaping > 0 && (msec < 0 || msec > JOB_REAP_WAIT))
+	return JOB_REAP_WAIT;
+    return msec;
+}
+
+/*
+ * Called when descriptor "fd" returned by job_get_fds() is ready.
+ */
+    void
+job_fd_ready(fd, writing)
+    int		fd;
+    int		writing;
+{
+    int		i;
+
+    for (i = 0; i < JOB_MAX; ++i)
+    {
+	if (jobs[i].job_id == 0)
+	    continue;
+	if (writing && fd == jobs[i].job_in)
+	    job_write(&jobs[i]);
+	else if (!writing && fd == jobs[i].job_out)
+	    job_read(&jobs[i], &jobs[i].job_out, JOB_STDOUT);
+	else if (!writing && fd == jobs[i].job_err)
+	    job_read(&jobs[i], &jobs[i].job_err, JOB_STDERR);
+	else
+	    continue;
+	break;
+    }
+}
+
+/*
+ * Read what the jobs have written and write pending input, without waiting.
+ * Used while not waiting for a key, the descriptors are non-blocking.
+ */
+    void
+job_poll()
+{
+    int		fds[JOB_MAX_FDS];
+    int		writing[JOB_MAX_FDS];
+    int		n;
+    int		i;
+
+    n = job_get_fds(fds, writing, JOB_MAX_FDS);
+    for (i = 0; i < n; ++i)
+	job_fd_ready(fds[i], writing[i]);
+}
+
+/*
+ * Return TRUE when job_run_callbacks() has something to do.
+ */
+    int
+job_callbacks_pending()
+{
+    return jobs_cb_pending && !jobs_cb_busy;
+}
+
+/*
+ * Pass the output collected for "job" on stdout or stderr, as said by "what",
+ * to the User autocommand in chunks of up to JOB_READ_SIZE bytes.
+ */
+    static void
+job_pass_output(job, what)
+    job_T	*job;
+    int		what;
+{
+    garray_T	ga;
+    char_u	*name;
+    char_u	*p;
+    int		done;
+    int		len;
+
+    name = vim_strsave(what == JOB_STDOUT ? job->job_ev_out
+							 : job->job_ev_err);
+    if (name == NULL)
+	return;
+    /* More output may arrive and the job may be freed while the
+     * autocommands run. */
+    ga = job->job_output[what];
+    ga_init2(&job->job_output[what], 1, JOB_READ_SIZE);
+    for (done = 0; done < ga.ga_len; done += len)
+    {
+	len = ga.ga_len - done;
+	if (len > JOB_READ_SIZE)
+	    len = JOB_READ_SIZE;
+	p = vim_strnsave((char_u *)ga.ga_data + done, len);
+	if (p == NULL)
+	    break;
+	event_autocmd(name, p);
+	vim_free(p);
+    }
+    ga_clear(&ga);
+    vim_free(name);
+}
+
+/*
+ * Pass the output collected for jobs to their callbacks or User autocommands,
+ * and the exit status of those that exited.  The callbacks may do anything,
+ * thus this must be called where autocommands can be executed.
+ */
+    void
+job_run_callbacks()
+{
+    job_T	*job;
+    garray_T	ga;
+    int		i;
+    int		what;
+    int		id;
+    int		status;
+    char_u	*name;
+    char_u	buf[NUMBUFLEN];
+    void	(*cb) __ARGS((int id, int what, char_u *data, int len));
+
+    /* A callback waiting for a key may get here again, the output must not
+     * be handed over out of order. */
+    if (jobs_cb_busy || !jobs_cb_pending)
+	return;
+    jobs_cb_busy = TRUE;
+    jobs_cb_pending = FALSE;
+
+    for (i = 0; i < JOB_MAX; ++i)
+    {
+	job = &jobs[i];
+	if (job->job_id == 0)
+	    continue;
+	for (what = JOB_STDOUT; what <= JOB_STDERR; ++what)
+	    if (job->job_output[what].ga_len > 0 && job->job_cb == NULL)
+		job_pass_output(job, what);
+	    else if (job->job_output[what].ga_len > 0)
+	    {
+		/* More output may arrive while the callback runs. */
+		ga = job->job_output[what];
+		ga_init2(&job->job_output[what], 1, JOB_READ_SIZE);
+		job->job_cb(job->job_id, what, (char_u *)ga.ga_data, ga.ga_len);
+		ga_clear(&ga);
+	    }
+	if (job->job_exited && job->job_output[JOB_STDOUT].ga_len == 0
+		&& job->job_output[JOB_STDERR].ga_len == 0)
+	{
+	    id = job->job_id;
+	    status = job->job_status;
+	    cb = job->job_cb;
+	    name = job->job_ev_exit;
+	    job->job_ev_exit = NULL;
+	    job_free(job);
+	    if (cb != NULL)
+		cb(id, JOB_EXIT, NULL, status);
+	    else if (name != NULL)
+	    {
+		sprintf((char *)buf, "%d", status);
+		event_autocmd(name, buf);
+	    }
+	    vim_free(name);
+	}
+    }
+    jobs_cb_busy = FALSE;
+}
+
+#endif /* FEAT_JOB_CONTROL */
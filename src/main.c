@@ -177,6 +177,11 @@ main
      */
     mch_early_init();
 
+#ifdef FEAT_EVENT_LOOP
+    /* Remember the main thread before other threads can push events. */
+    ev_init();
+#endif
+
     /* Many variables are in "params" so that we can pass them to invoked
      * functions without a lot of arguments.  "argc" and "argv" are also
      * copied, so that they can be changed. */
@@ -67,21 +67,109 @@ extern int dos2;			/* this is in os_amiga.c */
 
 #define MEMFILE_PAGE_SIZE 4096		/* default page size */
 
+#ifdef FEAT_SWAP_THREAD
+# include <pthread.h>
+#endif
+
+#ifdef FEAT_MMAP
+/* TRUE when block "nr" of "mfp" can be filled from a mapped file. */
+# define MF_MAPPED(mfp, nr) ((mfp)->mf_map != NULL \
+	&& (nr) >= (mfp)->mf_map->mm_first && (nr) < (mfp)->mf_map->mm_last)
+#else
+# define MF_MAPPED(mfp, nr) FALSE
+#endif
+
 static long_u	total_mem_used = 0;	/* total memory used for memfiles */
 
-static void mf_ins_hash __ARGS((memfile_T *, bhdr_T *));
-static void mf_rem_hash __ARGS((memfile_T *, bhdr_T *));
-static bhdr_T *mf_find_hash __ARGS((memfile_T *, blocknr_T));
-static void mf_ins_used __ARGS((memfile_T *, bhdr_T *));
-static void mf_rem_used __ARGS((memfile_T *, bhdr_T *));
+#ifdef FEAT_SWAP_THREAD
+/*
+ * The swap file writer thread.
+ *
+ * When 'swapthread' is set, syncing after 'updatecount' characters or
+ * 'updatetime' (mf_sync() with MFS_ASYNC) doesn't write the blocks.  It
+ * copies the dirty blocks into jobs for the writer thread and marks them
+ * clean, the thread does the writing and the fsync().  When the file is to be
+ * flushed block 0 comes last, after an fsync() of the other blocks, and is
+ * synced again.  Thus block 0 never says the file was changed while the
+ * changes are not on disk yet.
+ *
+ * Everything else that uses the swap file first waits for the jobs of that
+ * memfile to be done: reading a block (it may have been written by a job),
+ * writing a block (an older copy must not overwrite it), closing the file.
+ * Except in preserve_exit(), which may be called from a signal handler that
+ * interrupted the main thread while holding the lock: then the thread is no
+ * longer used and the main thread writes the jobs itself, see
+ * mf_writer_stop().
+ *
+ * The thread doesn't use any Vim functions, only system calls.  Jobs are
+ * allocated and freed by the main thread, the thread puts a finished job in
+ * the done list.
+ */
+typedef struct mf_job_S mf_job_T;
+
+struct mf_job_S
+{
+    mf_job_T	*mj_next;
+    memfile_T	*mj_mfp;	/* memfile the job is for */
+    int		mj_fd;		/* swap file descriptor */
+    off_t	mj_offset;	/* where to write "mj_data" */
+    char_u	*mj_data;	/* text to write, NULL to only sync */
+    unsigned	mj_size;	/* number of bytes in "mj_data" */
+    int		mj_sync;	/* MJ_FSYNC, MJ_SYNC or zero */
+};
+
+# define MJ_FSYNC	1	/* fsync() the file after writing */
+# define MJ_SYNC	2	/* sync() after writing */
+
+static pthread_mutex_t	mf_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	mf_job_added = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	mf_job_done = PTHREAD_COND_INITIALIZER;
+static mf_job_T		*mf_job_first = NULL;	/* jobs to do, oldest first */
+static mf_job_T		*mf_job_last = NULL;
+static mf_job_T		*mf_job_free = NULL;	/* jobs done, to be freed */
+
+# define MFT_NONE	0	/* thread not started yet */
+# define MFT_RUNNING	1
+# define MFT_FAILED	2	/* could not start the thread */
+# define MFT_STOPPED	3	/* not used when exiting */
+static int		mf_thread_state = MFT_NONE;
+static volatile int	mf_thread_busy = FALSE;	/* thread is doing a job */
+
+static void *mf_thread_main __ARGS((void *arg));
+static int  mf_thread_write __ARGS((mf_job_T *job));
+static int  mf_thread_start __ARGS((void));
+static int  mf_job_add __ARGS((memfile_T *mfp, char_u *data, unsigned size, off_t offset, int sync));
+static void mf_job_free_done __ARGS((void));
+static int  mf_sync_async __ARGS((memfile_T *mfp, int flags));
+static void mf_writer_stop __ARGS((void));
+#endif
+
+#ifdef FEAT_MEMZIP
+static long_u	total_zip_used = 0;	/* memory used for compressed blocks */
+
+static int  mf_zip_put_seq __ARGS((char_u *dst, unsigned *opp, unsigned maxlen, char_u *lit, unsigned litlen, unsigned offset, unsigned mlen));
+static unsigned mf_zip_compress __ARGS((char_u *src, unsigned len, char_u *dst, unsigned maxlen));
+static int  mf_zip_expand __ARGS((char_u *src, unsigned len, char_u *dst, unsigned dstlen));
+static void mf_zip_add __ARGS((memfile_T *mfp, bhdr_T *hp));
+static int  mf_zip_get __ARGS((memfile_T *mfp, bhdr_T *hp));
+static void mf_zip_drop __ARGS((memfile_T *mfp, blocknr_T nr));
+static void mf_zip_rem __ARGS((memfile_T *mfp, mf_zipblock_T *zb));
+static void mf_zip_link __ARGS((memfile_T *mfp, mf_zipblock_T *zb));
+static void mf_zip_unlink __ARGS((memfile_T *mfp, mf_zipblock_T *zb));
+static int  mf_zip_clear __ARGS((memfile_T *mfp));
+#endif
+
+static int  mf_ins_block __ARGS((memfile_T *, bhdr_T *));
+static void mf_rem_block __ARGS((memfile_T *, bhdr_T *));
+static bhdr_T *mf_clock __ARGS((memfile_T *, int));
 static bhdr_T *mf_release __ARGS((memfile_T *, int));
 static bhdr_T *mf_alloc_bhdr __ARGS((memfile_T *, int));
 static void mf_free_bhdr __ARGS((bhdr_T *));
 static void mf_ins_free __ARGS((memfile_T *, bhdr_T *));
 static bhdr_T *mf_rem_free __ARGS((memfile_T *));
 static int  mf_read __ARGS((memfile_T *, bhdr_T *));
-static int  mf_write __ARGS((memfile_T *, bhdr_T *));
-static int  mf_write_block __ARGS((memfile_T *mfp, bhdr_T *hp, off_t offset, unsigned size));
+static int  mf_write __ARGS((memfile_T *, bhdr_T *, int));
+static int  mf_write_block __ARGS((memfile_T *mfp, bhdr_T *hp, off_t offset, unsigned size, int async));
 static int  mf_trans_add __ARGS((memfile_T *, bhdr_T *));
 static void mf_do_open __ARGS((memfile_T *, char_u *, int));
 static void mf_hash_init __ARGS((mf_hashtab_T *));
@@ -91,6 +179,13 @@ static mf_hashitem_T *mf_hash_find __ARGS((mf_hashtab_T *, blocknr_T));
 static void mf_hash_add_item __ARGS((mf_hashtab_T *, mf_hashitem_T *));
 static void mf_hash_rem_item __ARGS((mf_hashtab_T *, mf_hashitem_T *));
 static int mf_hash_grow __ARGS((mf_hashtab_T *));
+static void mf_bt_init __ARGS((mf_blocktab_T *));
+static void mf_bt_free __ARGS((mf_blocktab_T *));
+static long_u mf_bt_hash __ARGS((mf_blocktab_T *, blocknr_T));
+static long_u mf_bt_lookup __ARGS((mf_blocktab_T *, blocknr_T));
+static int mf_bt_add __ARGS((mf_blocktab_T *, bhdr_T *));
+static void mf_bt_remove __ARGS((mf_blocktab_T *, blocknr_T));
+static int mf_bt_grow __ARGS((mf_blocktab_T *));
 
 /*
  * The functions for using a memfile:
@@ -105,6 +200,7 @@ static int mf_hash_grow __ARGS((mf_hashtab_T *));
  * mf_sync()	    sync changed parts of memfile to disk
  * mf_release_all() release as much memory as possible
  * mf_trans_del()   may translate negative to positive block number
+ * mf_find_block()  find a block that is in memory, without locking it
  * mf_fullname()    make file name full path (use before first :cd)
  */
 
@@ -154,16 +250,26 @@ mf_open(fname, flags)
     }
 
     mfp->mf_free_first = NULL;		/* free list is empty */
-    mfp->mf_used_first = NULL;		/* used list is empty */
-    mfp->mf_used_last = NULL;
     mfp->mf_dirty = FALSE;
+#ifdef FEAT_SWAP_THREAD
+    mfp->mf_jobs = 0;
+    mfp->mf_job_failed = FALSE;
+#endif
     mfp->mf_used_count = 0;
-    mf_hash_init(&mfp->mf_hash);
+    mf_bt_init(&mfp->mf_blocks);
     mf_hash_init(&mfp->mf_trans);
+#ifdef FEAT_MEMZIP
+    mf_hash_init(&mfp->mf_zip);
+    mfp->mf_zip_first = NULL;
+    mfp->mf_zip_last = NULL;
+#endif
     mfp->mf_page_size = MEMFILE_PAGE_SIZE;
 #ifdef FEAT_CRYPT
     mfp->mf_old_key = NULL;
 #endif
+#ifdef FEAT_MMAP
+    mfp->mf_map = NULL;
+#endif
 
 #ifdef USE_FSTATFS
     /*
@@ -244,28 +350,44 @@ mf_close(mfp, del_file)
     memfile_T	*mfp;
     int		del_file;
 {
-    bhdr_T	*hp, *nextp;
+    bhdr_T	*hp;
+    long_u	idx;
 
     if (mfp == NULL)		    /* safety check */
 	return;
+#ifdef FEAT_SWAP_THREAD
+    mf_writer_wait(mfp);
+#endif
     if (mfp->mf_fd >= 0)
     {
 	if (close(mfp->mf_fd) < 0)
 	    EMSG(_(e_swapclose));
     }
     if (del_file && mfp->mf_fname != NULL)
+    {
 	mch_remove(mfp->mf_fname);
-					    /* free entries in used list */
-    for (hp = mfp->mf_used_first; hp != NULL; hp = nextp)
+#ifdef UNIX
+	ml_swap_index(mfp->mf_fname, FALSE);
+#endif
+    }
+					    /* free blocks in memory */
+    for (idx = 0; idx <= mfp->mf_blocks.mbt_mask; ++idx)
     {
-	total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
-	nextp = hp->bh_next;
-	mf_free_bhdr(hp);
+	hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+	if (hp != NULL)
+	{
+	    total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
+	    mf_free_bhdr(hp);
+	}
     }
     while (mfp->mf_free_first != NULL)	    /* free entries in free list */
 	vim_free(mf_rem_free(mfp));
-    mf_hash_free(&mfp->mf_hash);
+    mf_bt_free(&mfp->mf_blocks);
     mf_hash_free_all(&mfp->mf_trans);	    /* free hashtable and its items */
+#ifdef FEAT_MEMZIP
+    (void)mf_zip_clear(mfp);
+    mf_hash_free(&mfp->mf_zip);
+#endif
     vim_free(mfp->mf_fname);
     vim_free(mfp->mf_ffname);
     vim_free(mfp);
@@ -296,6 +418,13 @@ mf_close_file(buf, getlines)
 	/* TODO: should check if all blocks are really in core */
     }
 
+#ifdef FEAT_SWAP_THREAD
+    mf_writer_wait(mfp);
+#endif
+#ifdef FEAT_MEMZIP
+    /* Without the file the compressed blocks can't be dropped. */
+    (void)mf_zip_clear(mfp);
+#endif
     if (close(mfp->mf_fd) < 0)			/* close the file */
 	EMSG(_(e_swapclose));
     mfp->mf_fd = -1;
@@ -303,6 +432,9 @@ mf_close_file(buf, getlines)
     if (mfp->mf_fname != NULL)
     {
 	mch_remove(mfp->mf_fname);		/* delete the swap file */
+#ifdef UNIX
+	ml_swap_index(mfp->mf_fname, FALSE);
+#endif
 	vim_free(mfp->mf_fname);
 	vim_free(mfp->mf_ffname);
 	mfp->mf_fname = NULL;
@@ -402,11 +534,15 @@ mf_new(mfp, negative, page_count)
 	    mfp->mf_blocknr_max += page_count;
 	}
     }
-    hp->bh_flags = BH_LOCKED | BH_DIRTY;	/* new block is always dirty */
+    hp->bh_flags = BH_LOCKED | BH_DIRTY | BH_USED;  /* new block is dirty */
     mfp->mf_dirty = TRUE;
     hp->bh_page_count = page_count;
-    mf_ins_used(mfp, hp);
-    mf_ins_hash(mfp, hp);
+    if (mf_ins_block(mfp, hp) == FAIL)
+    {
+	/* Can only happen when out of memory.  The number is lost. */
+	mf_free_bhdr(hp);
+	return NULL;
+    }
 
     /*
      * Init the data to all zero, to avoid reading uninitialized data.
@@ -437,11 +573,11 @@ mf_get(mfp, nr, page_count)
     /*
      * see if it is in the cache
      */
-    hp = mf_find_hash(mfp, nr);
-    if (hp == NULL)	/* not in the hash list */
+    hp = mf_find_block(mfp, nr);
+    if (hp == NULL)	/* not in memory */
     {
-	if (nr < 0 || nr >= mfp->mf_infile_count)   /* can't be in the file */
-	    return NULL;
+	if ((nr < 0 || nr >= mfp->mf_infile_count) && !MF_MAPPED(mfp, nr))
+	    return NULL;		/* can't be in the file */
 
 	/* could check here if the block is in the free list */
 
@@ -457,21 +593,25 @@ mf_get(mfp, nr, page_count)
 	hp->bh_bnum = nr;
 	hp->bh_flags = 0;
 	hp->bh_page_count = page_count;
+#ifdef FEAT_MMAP
+	if (MF_MAPPED(mfp, nr))
+	    ml_map_fill(mfp, hp);
+	else
+#endif
 	if (mf_read(mfp, hp) == FAIL)	    /* cannot read the block! */
 	{
 	    mf_free_bhdr(hp);
 	    return NULL;
 	}
-    }
-    else
-    {
-	mf_rem_used(mfp, hp);	/* remove from list, insert in front below */
-	mf_rem_hash(mfp, hp);
+	if (mf_ins_block(mfp, hp) == FAIL)
+	{
+	    mf_free_bhdr(hp);
+	    return NULL;
+	}
     }
 
-    hp->bh_flags |= BH_LOCKED;
-    mf_ins_used(mfp, hp);	/* put in front of used list */
-    mf_ins_hash(mfp, hp);	/* put in front of hash list */
+    /* Only sets a flag, the CLOCK hand will see it. */
+    hp->bh_flags |= BH_LOCKED | BH_USED;
 
     return hp;
 }
@@ -517,17 +657,54 @@ mf_free(mfp, hp)
     bhdr_T	*hp;
 {
     vim_free(hp->bh_data);	/* free the memory */
-    mf_rem_hash(mfp, hp);	/* get *hp out of the hash list */
-    mf_rem_used(mfp, hp);	/* get *hp out of the used list */
+    mf_rem_block(mfp, hp);	/* get *hp out of the block table */
+#ifdef FEAT_MEMZIP
+    mf_zip_drop(mfp, hp->bh_bnum);
+#endif
     if (hp->bh_bnum < 0)
     {
+	/* A block of a mapped file is only counted once translated. */
+	if (!MF_MAPPED(mfp, hp->bh_bnum))
+	    mfp->mf_neg_count--;
 	vim_free(hp);		/* don't want negative numbers in free list */
-	mfp->mf_neg_count--;
     }
     else
 	mf_ins_free(mfp, hp);	/* put *hp in the free list */
 }
 
+/*
+ * Like mf_free() for block "nr" with "page_count" pages, without reading it
+ * when it is not in memory.  A negative number is translated first.
+ */
+    void
+mf_free_nr(mfp, nr, page_count)
+    memfile_T	*mfp;
+    blocknr_T	nr;
+    int		page_count;
+{
+    bhdr_T	*hp;
+
+    if (nr < 0)
+	nr = mf_trans_del(mfp, nr);
+    hp = mf_find_block(mfp, nr);
+    if (hp != NULL)
+	mf_free(mfp, hp);
+    else if (nr > 0)
+    {
+#ifdef FEAT_MEMZIP
+	mf_zip_drop(mfp, nr);
+#endif
+	/* Only the number goes in the free list.  When out of memory the
+	 * number is lost. */
+	if ((hp = (bhdr_T *)alloc((unsigned)sizeof(bhdr_T))) == NULL)
+	    return;
+	hp->bh_bnum = nr;
+	hp->bh_page_count = page_count;
+	hp->bh_data = NULL;
+	mf_ins_free(mfp, hp);
+    }
+}
+
 #if defined(__MORPHOS__) && defined(__libnix__)
 /* function is missing in MorphOS libnix version */
 extern unsigned long *__stdfiledes;
@@ -559,6 +736,8 @@ mf_sync(mfp, flags)
 {
     int		status;
     bhdr_T	*hp;
+    long_u	idx;
+    int		moved;
 #if defined(SYNC_DUP_CLOSE) && !defined(MSDOS)
     int		fd;
 #endif
@@ -570,31 +749,42 @@ mf_sync(mfp, flags)
 	return FAIL;
     }
 
+#ifdef FEAT_SWAP_THREAD
+    if ((flags & MFS_ASYNC) && p_swt && mf_sync_async(mfp, flags) == OK)
+	return OK;
+    mf_writer_wait(mfp);
+#endif
+
     /* Only a CTRL-C while writing will break us here, not one typed
      * previously. */
     got_int = FALSE;
 
     /*
-     * sync from last to first (may reduce the probability of an inconsistent
-     * file) If a write fails, it is very likely caused by a full filesystem.
+     * If a write fails, it is very likely caused by a full filesystem.
      * Then we only try to write blocks within the existing file. If that also
      * fails then we give up.
      */
     status = OK;
-    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
-	if (((flags & MFS_ALL) || hp->bh_bnum >= 0)
+    for (idx = 0; idx <= mfp->mf_blocks.mbt_mask; ++idx)
+    {
+	hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+	if (hp != NULL
+		&& ((flags & MFS_ALL) || hp->bh_bnum >= 0)
 		&& (hp->bh_flags & BH_DIRTY)
 		&& (status == OK || (hp->bh_bnum >= 0
 		    && hp->bh_bnum < mfp->mf_infile_count)))
 	{
 	    if ((flags & MFS_ZERO) && hp->bh_bnum != 0)
 		continue;
-	    if (mf_write(mfp, hp) == FAIL)
+	    if (mf_write(mfp, hp, FALSE) == FAIL)
 	    {
 		if (status == FAIL)	/* double error: quit syncing */
 		    break;
 		status = FAIL;
 	    }
+	    /* A block that got a positive number moved to another slot, a
+	     * block after it may have been moved into this one. */
+	    moved = (mfp->mf_blocks.mbt_slots[idx].mbs_hp != hp);
 	    if (flags & MFS_STOP)
 	    {
 		/* Stop when char available now. */
@@ -605,13 +795,16 @@ mf_sync(mfp, flags)
 		ui_breakcheck();
 	    if (got_int)
 		break;
+	    if (moved)
+		--idx;
 	}
+    }
 
     /*
-     * If the whole list is flushed, the memfile is not dirty anymore.
+     * If all blocks are flushed, the memfile is not dirty anymore.
      * In case of an error this flag is also set, to avoid trying all the time.
      */
-    if (hp == NULL || status == FAIL)
+    if (idx > mfp->mf_blocks.mbt_mask || status == FAIL)
 	mfp->mf_dirty = FALSE;
 
     if ((flags & MFS_FLUSH) && *p_sws != NUL)
@@ -725,88 +918,94 @@ mf_set_dirty(mfp)
     memfile_T	*mfp;
 {
     bhdr_T	*hp;
+    long_u	idx;
 
-    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
-	if (hp->bh_bnum > 0)
+    for (idx = 0; idx <= mfp->mf_blocks.mbt_mask; ++idx)
+    {
+	hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+	if (hp != NULL && hp->bh_bnum > 0)
 	    hp->bh_flags |= BH_DIRTY;
+    }
     mfp->mf_dirty = TRUE;
 }
 
 /*
- * insert block *hp in front of hashlist of memfile *mfp
+ * Insert block *hp in the block table of memfile *mfp.
+ * Return FAIL when out of memory.
  */
-    static void
-mf_ins_hash(mfp, hp)
+    static int
+mf_ins_block(mfp, hp)
     memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    mf_hash_add_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
+    if (mf_bt_add(&mfp->mf_blocks, hp) == FAIL)
+	return FAIL;
+    mfp->mf_used_count += hp->bh_page_count;
+    total_mem_used += hp->bh_page_count * mfp->mf_page_size;
+    return OK;
 }
 
 /*
- * remove block *hp from hashlist of memfile list *mfp
+ * Remove block *hp from the block table of memfile *mfp.
  */
     static void
-mf_rem_hash(mfp, hp)
+mf_rem_block(mfp, hp)
     memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    mf_hash_rem_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
+    mf_bt_remove(&mfp->mf_blocks, hp->bh_bnum);
+    mfp->mf_used_count -= hp->bh_page_count;
+    total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
 }
 
 /*
- * look in hash lists of memfile *mfp for block header with number 'nr'
+ * Return the header of block "nr" of memfile *mfp if it is in memory, NULL
+ * otherwise.  The block is not locked.
  */
-    static bhdr_T *
-mf_find_hash(mfp, nr)
+    bhdr_T *
+mf_find_block(mfp, nr)
     memfile_T	*mfp;
     blocknr_T	nr;
 {
-    return (bhdr_T *)mf_hash_find(&mfp->mf_hash, nr);
+    return mfp->mf_blocks.mbt_slots[
+			       mf_bt_lookup(&mfp->mf_blocks, nr)].mbs_hp;
 }
 
 /*
- * insert block *hp in front of used list of memfile *mfp
+ * Move the CLOCK hand around the block table of *mfp until it finds a block
+ * that can be released: not locked and the BH_USED flag not set.  The flag
+ * is reset on the way, thus a block that is used again before the hand comes
+ * by again stays.  When "mapped" is TRUE only a clean block of the mapped
+ * file is taken.
+ * Returns NULL when going around twice didn't find one.
  */
-    static void
-mf_ins_used(mfp, hp)
+    static bhdr_T *
+mf_clock(mfp, mapped)
     memfile_T	*mfp;
-    bhdr_T	*hp;
+    int		mapped;
 {
-    hp->bh_next = mfp->mf_used_first;
-    mfp->mf_used_first = hp;
-    hp->bh_prev = NULL;
-    if (hp->bh_next == NULL)	    /* list was empty, adjust last pointer */
-	mfp->mf_used_last = hp;
-    else
-	hp->bh_next->bh_prev = hp;
-    mfp->mf_used_count += hp->bh_page_count;
-    total_mem_used += hp->bh_page_count * mfp->mf_page_size;
-}
+    mf_blocktab_T   *mbt = &mfp->mf_blocks;
+    bhdr_T	    *hp;
+    long_u	    todo;
 
-/*
- * remove block *hp from used list of memfile *mfp
- */
-    static void
-mf_rem_used(mfp, hp)
-    memfile_T	*mfp;
-    bhdr_T	*hp;
-{
-    if (hp->bh_next == NULL)	    /* last block in used list */
-	mfp->mf_used_last = hp->bh_prev;
-    else
-	hp->bh_next->bh_prev = hp->bh_prev;
-    if (hp->bh_prev == NULL)	    /* first block in used list */
-	mfp->mf_used_first = hp->bh_next;
-    else
-	hp->bh_prev->bh_next = hp->bh_next;
-    mfp->mf_used_count -= hp->bh_page_count;
-    total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
+    for (todo = (mbt->mbt_mask + 1) * 2; todo > 0; --todo)
+    {
+	hp = mbt->mbt_slots[mbt->mbt_hand].mbs_hp;
+	mbt->mbt_hand = (mbt->mbt_hand + 1) & mbt->mbt_mask;
+	if (hp == NULL || (hp->bh_flags & BH_LOCKED))
+	    continue;
+	if (hp->bh_flags & BH_USED)
+	    hp->bh_flags &= ~BH_USED;
+	else if (!mapped || (!(hp->bh_flags & BH_DIRTY)
+					       && MF_MAPPED(mfp, hp->bh_bnum)))
+	    return hp;
+    }
+    return NULL;
 }
 
 /*
- * Release the least recently used block from the used list if the number
- * of used memory blocks gets to big.
+ * Release a block that wasn't used recently if the number of used memory
+ * blocks gets to big.
  *
  * Return the block header to the caller, including the memory block, so
  * it can be re-used. Make sure the page_count is right.
@@ -853,24 +1052,44 @@ mf_release(mfp, page_count)
      *	  and
      *	total memory used is not up to 'maxmemtot'
      */
-    if (mfp->mf_fd < 0 || !need_release)
-	return NULL;
+#ifdef FEAT_MMAP
+    /*
+     * Without a swap file a clean block of a mapped file can be released,
+     * it is filled from the file again when needed.  When there is no such
+     * block allow for more blocks.
+     */
+    if (mfp->mf_fd < 0 && need_release && mfp->mf_map != NULL)
+    {
+	hp = mf_clock(mfp, TRUE);
+	if (hp == NULL)
+	{
+	    if (mfp->mf_used_count >= mfp->mf_used_count_max)
+		mfp->mf_used_count_max = mfp->mf_used_count * 2;
+	    return NULL;
+	}
+    }
+    else
+#endif
+    {
+	if (mfp->mf_fd < 0 || !need_release)
+	    return NULL;
 
-    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
-	if (!(hp->bh_flags & BH_LOCKED))
-	    break;
-    if (hp == NULL)	/* not a single one that can be released */
-	return NULL;
+	hp = mf_clock(mfp, FALSE);
+	if (hp == NULL)	/* not a single one that can be released */
+	    return NULL;
+    }
 
     /*
      * If the block is dirty, write it.
      * If the write fails we don't free it.
      */
-    if ((hp->bh_flags & BH_DIRTY) && mf_write(mfp, hp) == FAIL)
+    if ((hp->bh_flags & BH_DIRTY) && mf_write(mfp, hp, FALSE) == FAIL)
 	return NULL;
 
-    mf_rem_used(mfp, hp);
-    mf_rem_hash(mfp, hp);
+#ifdef FEAT_MEMZIP
+    mf_zip_add(mfp, hp);
+#endif
+    mf_rem_block(mfp, hp);
 
     /*
      * If a bhdr_T is returned, make sure that the page_count of bh_data is
@@ -901,6 +1120,7 @@ mf_release_all()
     buf_T	*buf;
     memfile_T	*mfp;
     bhdr_T	*hp;
+    long_u	idx;
     int		retval = FALSE;
 
     for (buf = firstbuf; buf != NULL; buf = buf->b_next)
@@ -912,25 +1132,36 @@ mf_release_all()
 	    if (mfp->mf_fd < 0 && buf->b_may_swap)
 		ml_open_file(buf);
 
-	    /* only if there is a swapfile */
-	    if (mfp->mf_fd >= 0)
+	    /* only if there is a swapfile or a mapped file */
+	    if (mfp->mf_fd >= 0
+#ifdef FEAT_MMAP
+		    || mfp->mf_map != NULL
+#endif
+	       )
 	    {
-		for (hp = mfp->mf_used_last; hp != NULL; )
+		idx = 0;
+		while (idx <= mfp->mf_blocks.mbt_mask)
 		{
-		    if (!(hp->bh_flags & BH_LOCKED)
+		    hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+		    if (hp != NULL && !(hp->bh_flags & BH_LOCKED)
+			    && (mfp->mf_fd >= 0 || MF_MAPPED(mfp, hp->bh_bnum))
 			    && (!(hp->bh_flags & BH_DIRTY)
-				|| mf_write(mfp, hp) != FAIL))
+			    || (mfp->mf_fd >= 0 && mf_write(mfp, hp, FALSE) != FAIL)))
 		    {
-			mf_rem_used(mfp, hp);
-			mf_rem_hash(mfp, hp);
+			mf_rem_block(mfp, hp);
 			mf_free_bhdr(hp);
-			hp = mfp->mf_used_last;	/* re-start, list was changed */
 			retval = TRUE;
+			/* check this slot again, another block may have been
+			 * moved into it */
 		    }
 		    else
-			hp = hp->bh_prev;
+			++idx;
 		}
 	    }
+#ifdef FEAT_MEMZIP
+	    if (mf_zip_clear(mfp))
+		retval = TRUE;
+#endif
 	}
     }
     return retval;
@@ -1011,8 +1242,15 @@ mf_read(mfp, hp)
     unsigned	page_size;
     unsigned	size;
 
+#ifdef FEAT_MEMZIP
+    if (mf_zip_get(mfp, hp) == OK)
+	return OK;
+#endif
     if (mfp->mf_fd < 0)	    /* there is no file, can't read */
 	return FAIL;
+#ifdef FEAT_SWAP_THREAD
+    mf_writer_wait(mfp);
+#endif
 
     page_size = mfp->mf_page_size;
     offset = (off_t)page_size * hp->bh_bnum;
@@ -1039,13 +1277,15 @@ mf_read(mfp, hp)
 
 /*
  * write a block to disk
+ * When "async" is TRUE the writer thread gets a copy to write.
  *
  * Return FAIL for failure, OK otherwise
  */
     static int
-mf_write(mfp, hp)
+mf_write(mfp, hp, async)
     memfile_T	*mfp;
     bhdr_T	*hp;
+    int		async;
 {
     off_t	offset;	    /* offset in the file */
     blocknr_T	nr;	    /* block nr which is being written */
@@ -1056,6 +1296,10 @@ mf_write(mfp, hp)
 
     if (mfp->mf_fd < 0)	    /* there is no file, can't write */
 	return FAIL;
+#ifdef FEAT_SWAP_THREAD
+    if (!async)
+	mf_writer_wait(mfp);
+#endif
 
     if (hp->bh_bnum < 0)	/* must assign file block number */
 	if (mf_trans_add(mfp, hp) == FAIL)
@@ -1075,13 +1319,13 @@ mf_write(mfp, hp)
 	if (nr > mfp->mf_infile_count)		/* beyond end of file */
 	{
 	    nr = mfp->mf_infile_count;
-	    hp2 = mf_find_hash(mfp, nr);	/* NULL caught below */
+	    hp2 = mf_find_block(mfp, nr);	/* NULL caught below */
 	}
 	else
 	    hp2 = hp;
 
 	offset = (off_t)page_size * nr;
-	if (lseek(mfp->mf_fd, offset, SEEK_SET) != offset)
+	if (!async && lseek(mfp->mf_fd, offset, SEEK_SET) != offset)
 	{
 	    PERROR(_("E296: Seek error in swap file write"));
 	    return FAIL;
@@ -1091,7 +1335,8 @@ mf_write(mfp, hp)
 	else
 	    page_count = hp2->bh_page_count;
 	size = page_size * page_count;
-	if (mf_write_block(mfp, hp2 == NULL ? hp : hp2, offset, size) == FAIL)
+	if (mf_write_block(mfp, hp2 == NULL ? hp : hp2, offset, size, async)
+								      == FAIL)
 	{
 	    /*
 	     * Avoid repeating the error message, this mostly happens when the
@@ -1106,7 +1351,13 @@ mf_write(mfp, hp)
 	}
 	did_swapwrite_msg = FALSE;
 	if (hp2 != NULL)		    /* written a non-dummy block */
+	{
 	    hp2->bh_flags &= ~BH_DIRTY;
+#ifdef FEAT_MEMZIP
+	    /* a compressed copy has the old text */
+	    mf_zip_drop(mfp, nr);
+#endif
+	}
 					    /* appended to the file */
 	if (nr + (blocknr_T)page_count > mfp->mf_infile_count)
 	    mfp->mf_infile_count = nr + page_count;
@@ -1119,14 +1370,16 @@ mf_write(mfp, hp)
 /*
  * Write block "hp" with data size "size" to file "mfp->mf_fd".
  * Takes care of encryption.
+ * When "async" is TRUE a copy is made for the writer thread.
  * Return FAIL or OK.
  */
     static int
-mf_write_block(mfp, hp, offset, size)
+mf_write_block(mfp, hp, offset, size, async)
     memfile_T	*mfp;
     bhdr_T	*hp;
     off_t	offset UNUSED;
     unsigned	size;
+    int		async UNUSED;
 {
     char_u	*data = hp->bh_data;
     int		result = OK;
@@ -1141,6 +1394,21 @@ mf_write_block(mfp, hp, offset, size)
     }
 #endif
 
+#ifdef FEAT_SWAP_THREAD
+    if (async)
+    {
+	/* The block may change before the thread writes it. */
+	if (data == hp->bh_data)
+	{
+	    data = lalloc((long_u)size, TRUE);
+	    if (data == NULL)
+		return FAIL;
+	    mch_memmove(data, hp->bh_data, (size_t)size);
+	}
+	return mf_job_add(mfp, data, size, offset, 0);
+    }
+#endif
+
     if ((unsigned)write_eintr(mfp->mf_fd, data, size) != size)
 	result = FAIL;
 
@@ -1152,6 +1420,679 @@ mf_write_block(mfp, hp, offset, size)
     return result;
 }
 
+#if defined(FEAT_SWAP_THREAD) || defined(PROTO)
+/*
+ * Write the dirty blocks of "mfp" with the writer thread, see the comment at
+ * mf_job_T.  Only blocks with a positive number are written, block 0 last.
+ * Return FAIL when the thread can't be used, the caller must then write the
+ * blocks itself.
+ */
+    static int
+mf_sync_async(mfp, flags)
+    memfile_T	*mfp;
+    int		flags;
+{
+    bhdr_T	*hp;
+    bhdr_T	*hp0 = NULL;
+    long_u	idx;
+    int		pending;
+    int		failed;
+    int		sync = 0;
+
+    if (mf_thread_start() == FAIL)
+	return FAIL;
+
+    pthread_mutex_lock(&mf_job_mutex);
+    pending = mfp->mf_jobs;
+    failed = mfp->mf_job_failed;
+    mfp->mf_job_failed = FALSE;
+    pthread_mutex_unlock(&mf_job_mutex);
+    mf_job_free_done();
+
+    /* Still writing the previous snapshot: try again later, otherwise jobs
+     * pile up on a slow file system. */
+    if (pending > 0)
+	return OK;
+
+    /* Writing failed, let the caller try the normal way and give the error. */
+    if (failed)
+    {
+	mf_set_dirty(mfp);
+	return FAIL;
+    }
+
+    if ((flags & MFS_FLUSH) && *p_sws != NUL)
+	sync = STRCMP(p_sws, "fsync") == 0 ? MJ_FSYNC : MJ_SYNC;
+
+    for (idx = 0; idx <= mfp->mf_blocks.mbt_mask; ++idx)
+    {
+	hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+	if (hp == NULL || hp->bh_bnum < 0 || !(hp->bh_flags & BH_DIRTY))
+	    continue;
+	if (hp->bh_bnum == 0)
+	    hp0 = hp;
+	else if (mf_write(mfp, hp, TRUE) == FAIL)
+	    return FAIL;
+    }
+
+    if (hp0 != NULL)
+    {
+	/* Block 0 may only say the file was changed when the blocks with
+	 * the changes are on disk. */
+	if (sync != 0 && mf_job_add(mfp, NULL, 0, (off_t)0, sync) == FAIL)
+	    return FAIL;
+	if (mf_write(mfp, hp0, TRUE) == FAIL)
+	    return FAIL;
+    }
+    if (sync != 0 && mf_job_add(mfp, NULL, 0, (off_t)0, sync) == FAIL)
+	return FAIL;
+
+    mfp->mf_dirty = FALSE;
+    return OK;
+}
+
+/*
+ * Start the writer thread if it isn't running yet.
+ * Return FAIL if it can't be started.
+ */
+    static int
+mf_thread_start()
+{
+    pthread_t	thread;
+    sigset_t	all;
+    sigset_t	old;
+    int		r;
+
+    if (mf_thread_state == MFT_NONE)
+    {
+	/* Signals must be handled by the main thread, block them all in the
+	 * writer thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	r = pthread_create(&thread, NULL, mf_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (r == 0)
+	{
+	    pthread_detach(thread);
+	    mf_thread_state = MFT_RUNNING;
+	}
+	else
+	    mf_thread_state = MFT_FAILED;
+    }
+    return mf_thread_state == MFT_RUNNING ? OK : FAIL;
+}
+
+/*
+ * Add a job for the writer thread: write "size" bytes of "data" at "offset",
+ * then sync when "sync" is not zero.  "data" is freed when the job is done,
+ * also when adding fails.
+ */
+    static int
+mf_job_add(mfp, data, size, offset, sync)
+    memfile_T	*mfp;
+    char_u	*data;
+    unsigned	size;
+    off_t	offset;
+    int		sync;
+{
+    mf_job_T	*job;
+
+    job = (mf_job_T *)alloc((unsigned)sizeof(mf_job_T));
+    if (job == NULL)
+    {
+	vim_free(data);
+	return FAIL;
+    }
+    job->mj_next = NULL;
+    job->mj_mfp = mfp;
+    job->mj_fd = mfp->mf_fd;
+    job->mj_offset = offset;
+    job->mj_data = data;
+    job->mj_size = size;
+    job->mj_sync = sync;
+
+    pthread_mutex_lock(&mf_job_mutex);
+    if (mf_job_last == NULL)
+	mf_job_first = job;
+    else
+	mf_job_last->mj_next = job;
+    mf_job_last = job;
+    ++mfp->mf_jobs;
+    pthread_cond_signal(&mf_job_added);
+    pthread_mutex_unlock(&mf_job_mutex);
+    return OK;
+}
+
+/*
+ * Free the jobs that the writer thread is done with.
+ */
+    static void
+mf_job_free_done()
+{
+    mf_job_T	*job;
+    mf_job_T	*next;
+
+    pthread_mutex_lock(&mf_job_mutex);
+    job = mf_job_free;
+    mf_job_free = NULL;
+    pthread_mutex_unlock(&mf_job_mutex);
+
+    for ( ; job != NULL; job = next)
+    {
+	next = job->mj_next;
+	vim_free(job->mj_data);
+	vim_free(job);
+    }
+}
+
+/*
+ * Wait for the writer thread to finish the jobs for "mfp".  When one of them
+ * failed the blocks are marked dirty, so that they are written again.
+ */
+    void
+mf_writer_wait(mfp)
+    memfile_T	*mfp;
+{
+    int		failed;
+
+    if (mf_thread_state != MFT_RUNNING)
+	return;
+    if (really_exiting)
+    {
+	mf_writer_stop();
+	return;
+    }
+
+    pthread_mutex_lock(&mf_job_mutex);
+    while (mfp->mf_jobs > 0)
+	pthread_cond_wait(&mf_job_done, &mf_job_mutex);
+    failed = mfp->mf_job_failed;
+    mfp->mf_job_failed = FALSE;
+    pthread_mutex_unlock(&mf_job_mutex);
+    mf_job_free_done();
+
+    if (failed)
+	mf_set_dirty(mfp);
+}
+
+/*
+ * Stop using the writer thread, called from preserve_exit().  This may be
+ * inside a signal handler that interrupted the main thread while it was
+ * holding the lock or waiting for a job, thus don't wait for the lock or a
+ * condition.  The jobs that were not started are written here, everything
+ * after that is written without the thread.  When the lock can't be obtained
+ * these jobs are lost, the blocks are still written by mf_sync() when they
+ * are dirty.
+ */
+    static void
+mf_writer_stop()
+{
+    mf_job_T	*job = NULL;
+    int		i;
+
+    mf_thread_state = MFT_STOPPED;
+    for (i = 0; i < 10; ++i)
+    {
+	if (pthread_mutex_trylock(&mf_job_mutex) == 0)
+	{
+	    job = mf_job_first;
+	    mf_job_first = NULL;
+	    mf_job_last = NULL;
+	    pthread_mutex_unlock(&mf_job_mutex);
+	    break;
+	}
+	mch_delay(1L, TRUE);
+    }
+
+    /* The job the thread is doing has an older copy of a block than what is
+     * written after this, give it some time to finish. */
+    for (i = 0; i < 100 && mf_thread_busy; ++i)
+	mch_delay(10L, TRUE);
+
+    for ( ; job != NULL; job = job->mj_next)
+	(void)mf_thread_write(job);
+}
+
+/*
+ * The writer thread: do the jobs in the order they were added.
+ * Only uses system calls, no Vim functions.
+ */
+    static void *
+mf_thread_main(arg)
+    void	*arg UNUSED;
+{
+    mf_job_T	*job;
+    int		ok;
+
+    for (;;)
+    {
+	pthread_mutex_lock(&mf_job_mutex);
+	while (mf_job_first == NULL)
+	    pthread_cond_wait(&mf_job_added, &mf_job_mutex);
+	job = mf_job_first;
+	mf_job_first = job->mj_next;
+	if (mf_job_first == NULL)
+	    mf_job_last = NULL;
+	mf_thread_busy = TRUE;
+	pthread_mutex_unlock(&mf_job_mutex);
+
+	ok = mf_thread_write(job);
+
+	pthread_mutex_lock(&mf_job_mutex);
+	mf_thread_busy = FALSE;
+	if (!ok)
+	    job->mj_mfp->mf_job_failed = TRUE;
+	--job->mj_mfp->mf_jobs;
+	job->mj_next = mf_job_free;
+	mf_job_free = job;
+	pthread_cond_broadcast(&mf_job_done);
+	pthread_mutex_unlock(&mf_job_mutex);
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+
+/*
+ * Do the writing and syncing for "job" in the writer thread, or in the main
+ * thread after mf_writer_stop().
+ * Return FALSE when it failed.
+ */
+    static int
+mf_thread_write(job)
+    mf_job_T	*job;
+{
+    char_u	*p = job->mj_data;
+    size_t	todo = job->mj_size;
+    off_t	offset = job->mj_offset;
+    ssize_t	n;
+
+    while (todo > 0)
+    {
+	n = pwrite(job->mj_fd, p, todo, offset);
+	if (n < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	if (n == 0)
+	    return FALSE;
+	p += n;
+	todo -= n;
+	offset += n;
+    }
+# ifdef HAVE_FSYNC
+    if (job->mj_sync == MJ_FSYNC)
+	return fsync(job->mj_fd) == 0;
+# endif
+    if (job->mj_sync != 0)
+	sync();
+    return TRUE;
+}
+#endif
+
+#ifdef FEAT_MEMZIP
+/*
+ * Compressed blocks.
+ *
+ * When 'maxmemzip' is not zero, a block that mf_release() takes out of
+ * memory is compressed and kept, up to 'maxmemzip' Kbyte for all memfiles
+ * together.  mf_read() then expands it instead of reading the swap file.
+ * Only clean blocks are kept, they are also in the swap file, thus a
+ * compressed block can be dropped at any time.  When the space is needed the
+ * least recently used blocks of the memfile go first.  A block that is read
+ * keeps its compressed copy, when it is released again unchanged it doesn't
+ * need to be compressed again.  The copy is dropped when the block is
+ * written, it must have been changed then, or freed.
+ *
+ * The codec is a simple LZ77 variant.  Each sequence starts with a token
+ * byte: the number of literal bytes in the upper four bits and the match
+ * length minus MF_ZIP_MINMATCH in the lower four bits.  A value of 15 is
+ * continued in the following bytes, until a byte that is not 255; all these
+ * bytes are added.  The literal bytes follow, then the offset of the match
+ * in two bytes, least significant first, then the continuation of the match
+ * length.  The last sequence only has literal bytes.
+ */
+# define MF_ZIP_MINMATCH	4
+# define MF_ZIP_HASH_BITS	10
+# define MF_ZIP_HASH_SIZE	(1 << MF_ZIP_HASH_BITS)
+# define MF_ZIP_HASH(p) (((((unsigned)(p)[0] | ((unsigned)(p)[1] << 8) \
+	    | ((unsigned)(p)[2] << 16) | ((unsigned)(p)[3] << 24)) \
+		    * 2654435761U) >> (32 - MF_ZIP_HASH_BITS)) \
+							& (MF_ZIP_HASH_SIZE - 1))
+
+/*
+ * Add a sequence with "litlen" literal bytes at "lit" and a match of "mlen"
+ * bytes "offset" bytes back to "dst" at "*opp".  When "mlen" is zero there
+ * is no match, for the last sequence.
+ * Returns FALSE when it doesn't fit in "maxlen" bytes.
+ */
+    static int
+mf_zip_put_seq(dst, opp, maxlen, lit, litlen, offset, mlen)
+    char_u	*dst;
+    unsigned	*opp;
+    unsigned	maxlen;
+    char_u	*lit;
+    unsigned	litlen;
+    unsigned	offset;
+    unsigned	mlen;
+{
+    unsigned	op = *opp;
+    unsigned	ml = mlen == 0 ? 0 : mlen - MF_ZIP_MINMATCH;
+    unsigned	n;
+
+    if (op + litlen + litlen / 255 + ml / 255 + 5 > maxlen)
+	return FALSE;
+    dst[op++] = ((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15);
+    if (litlen >= 15)
+    {
+	for (n = litlen - 15; n >= 255; n -= 255)
+	    dst[op++] = 255;
+	dst[op++] = n;
+    }
+    mch_memmove(dst + op, lit, (size_t)litlen);
+    op += litlen;
+    if (mlen > 0)
+    {
+	dst[op++] = offset & 0xff;
+	dst[op++] = offset >> 8;
+	if (ml >= 15)
+	{
+	    for (n = ml - 15; n >= 255; n -= 255)
+		dst[op++] = 255;
+	    dst[op++] = n;
+	}
+    }
+    *opp = op;
+    return TRUE;
+}
+
+/*
+ * Compress "len" bytes at "src" into "dst", which has room for "maxlen"
+ * bytes.
+ * Returns the compressed length, zero when it doesn't fit.
+ */
+    static unsigned
+mf_zip_compress(src, len, dst, maxlen)
+    char_u	*src;
+    unsigned	len;
+    char_u	*dst;
+    unsigned	maxlen;
+{
+    unsigned	table[MF_ZIP_HASH_SIZE];
+    unsigned	ip = 0;		/* next input byte */
+    unsigned	anchor = 0;	/* first literal byte */
+    unsigned	op = 0;
+    unsigned	ref;
+    unsigned	mlen;
+    unsigned	h;
+
+    /* A zero entry is position zero, the bytes are compared anyway. */
+    vim_memset(table, 0, sizeof(table));
+    while (ip + MF_ZIP_MINMATCH <= len)
+    {
+	h = MF_ZIP_HASH(src + ip);
+	ref = table[h];
+	table[h] = ip;
+	if (ref < ip && ip - ref <= 0xffff
+		      && memcmp(src + ref, src + ip, MF_ZIP_MINMATCH) == 0)
+	{
+	    mlen = MF_ZIP_MINMATCH;
+	    while (ip + mlen < len && src[ref + mlen] == src[ip + mlen])
+		++mlen;
+	    if (!mf_zip_put_seq(dst, &op, maxlen, src + anchor, ip - anchor,
+							       ip - ref, mlen))
+		return 0;
+	    ip += mlen;
+	    anchor = ip;
+	}
+	else
+	    ++ip;
+    }
+    if (!mf_zip_put_seq(dst, &op, maxlen, src + anchor, len - anchor, 0, 0))
+	return 0;
+    return op;
+}
+
+/*
+ * Expand "len" bytes at "src", made with mf_zip_compress(), into "dst",
+ * which must get exactly "dstlen" bytes.
+ * Returns FAIL when the data is invalid.
+ */
+    static int
+mf_zip_expand(src, len, dst, dstlen)
+    char_u	*src;
+    unsigned	len;
+    char_u	*dst;
+    unsigned	dstlen;
+{
+    unsigned	ip = 0;
+    unsigned	op = 0;
+    unsigned	token;
+    unsigned	offset;
+    unsigned	n;
+    unsigned	from;
+    unsigned	c;
+
+    for (;;)
+    {
+	if (ip >= len)
+	    return FAIL;
+	token = src[ip++];
+	n = token >> 4;
+	if (n == 15)
+	    do
+	    {
+		if (ip >= len)
+		    return FAIL;
+		n += src[ip];
+	    } while (src[ip++] == 255);
+	if (n > len - ip || n > dstlen - op)
+	    return FAIL;
+	if (len - ip >= 16 && dstlen - op >= 16 && n <= 16)
+	    /* Short literal: a copy of fixed size is much faster.  The extra
+	     * bytes are overwritten later. */
+	    mch_memmove(dst + op, src + ip, 16);
+	else
+	    mch_memmove(dst + op, src + ip, (size_t)n);
+	ip += n;
+	op += n;
+	if (ip == len)
+	    break;
+
+	if (len - ip < 2)
+	    return FAIL;
+	offset = src[ip] | (src[ip + 1] << 8);
+	ip += 2;
+	n = token & 15;
+	if (n == 15)
+	    do
+	    {
+		if (ip >= len)
+		    return FAIL;
+		n += src[ip];
+	    } while (src[ip++] == 255);
+	n += MF_ZIP_MINMATCH;
+	if (offset == 0 || offset > op || n > dstlen - op)
+	    return FAIL;
+	/* The match may overlap with what it produces.  The bytes from "from"
+	 * repeat every "offset" bytes, thus each copy can be twice as long
+	 * as the previous one. */
+	from = op - offset;
+	if (offset >= 8 && dstlen - op >= n + 8)
+	{
+	    /* copy eight bytes at a time, may copy a few too many */
+	    for (c = 0; c < n; c += 8)
+		mch_memmove(dst + op + c, dst + from + c, 8);
+	    op += n;
+	    n = 0;
+	}
+	while (n > 0)
+	{
+	    c = op - from < n ? op - from : n;
+	    mch_memmove(dst + op, dst + from, (size_t)c);
+	    op += c;
+	    n -= c;
+	}
+    }
+    return op == dstlen ? OK : FAIL;
+}
+
+/*
+ * Keep block "hp" of memfile "mfp" compressed, when it compresses well
+ * enough and there is room.  The block must be clean.
+ */
+    static void
+mf_zip_add(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+    unsigned	size = mfp->mf_page_size * hp->bh_page_count;
+    unsigned	maxlen = size - size / 4;
+    unsigned	len;
+    long_u	need;
+    char_u	*buf;
+    mf_zipblock_T *zb;
+
+    if (p_mmz <= 0 || hp->bh_bnum < 0 || MF_MAPPED(mfp, hp->bh_bnum))
+	return;
+    zb = (mf_zipblock_T *)mf_hash_find(&mfp->mf_zip, hp->bh_bnum);
+    if (zb != NULL)
+    {
+	/* still have the compressed copy, make it the newest one */
+	mf_zip_unlink(mfp, zb);
+	mf_zip_link(mfp, zb);
+	return;
+    }
+    if ((buf = lalloc((long_u)maxlen, FALSE)) == NULL)
+	return;
+    len = mf_zip_compress(hp->bh_data, size, buf, maxlen);
+    need = sizeof(mf_zipblock_T) + len;
+    if (len > 0)
+    {
+	while (total_zip_used + need > (long_u)p_mmz << 10
+						 && mfp->mf_zip_first != NULL)
+	    mf_zip_rem(mfp, mfp->mf_zip_first);
+	if (total_zip_used + need <= (long_u)p_mmz << 10
+		&& (zb = (mf_zipblock_T *)lalloc(need, FALSE)) != NULL)
+	{
+	    zb->zb_bnum = hp->bh_bnum;
+	    zb->zb_page_count = hp->bh_page_count;
+	    zb->zb_len = len;
+	    mch_memmove(zb->zb_data, buf, (size_t)len);
+	    mf_hash_add_item(&mfp->mf_zip, (mf_hashitem_T *)zb);
+	    mf_zip_link(mfp, zb);
+	    total_zip_used += need;
+	}
+    }
+    vim_free(buf);
+}
+
+/*
+ * Fill block "hp" from its compressed copy, if there is one.
+ * Returns FAIL when there is no usable compressed copy.
+ */
+    static int
+mf_zip_get(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+    mf_zipblock_T *zb;
+    int		retval;
+
+    zb = (mf_zipblock_T *)mf_hash_find(&mfp->mf_zip, hp->bh_bnum);
+    if (zb == NULL)
+	return FAIL;
+    if (zb->zb_page_count != hp->bh_page_count)
+	retval = FAIL;
+    else
+	retval = mf_zip_expand(zb->zb_data, zb->zb_len, hp->bh_data,
+				    mfp->mf_page_size * hp->bh_page_count);
+    if (retval == FAIL)
+	mf_zip_rem(mfp, zb);
+    return retval;
+}
+
+/*
+ * Drop the compressed copy of block "nr", if there is one.
+ */
+    static void
+mf_zip_drop(mfp, nr)
+    memfile_T	*mfp;
+    blocknr_T	nr;
+{
+    mf_zipblock_T *zb;
+
+    if (mfp->mf_zip_first != NULL
+	    && (zb = (mf_zipblock_T *)mf_hash_find(&mfp->mf_zip, nr)) != NULL)
+	mf_zip_rem(mfp, zb);
+}
+
+/*
+ * Remove compressed block "zb" from memfile "mfp" and free it.
+ */
+    static void
+mf_zip_rem(mfp, zb)
+    memfile_T	*mfp;
+    mf_zipblock_T *zb;
+{
+    mf_hash_rem_item(&mfp->mf_zip, (mf_hashitem_T *)zb);
+    mf_zip_unlink(mfp, zb);
+    total_zip_used -= sizeof(mf_zipblock_T) + zb->zb_len;
+    vim_free(zb);
+}
+
+/*
+ * Add compressed block "zb" at the new end of the list of memfile "mfp".
+ */
+    static void
+mf_zip_link(mfp, zb)
+    memfile_T	*mfp;
+    mf_zipblock_T *zb;
+{
+    zb->zb_next = NULL;
+    zb->zb_prev = mfp->mf_zip_last;
+    if (mfp->mf_zip_last == NULL)
+	mfp->mf_zip_first = zb;
+    else
+	mfp->mf_zip_last->zb_next = zb;
+    mfp->mf_zip_last = zb;
+}
+
+/*
+ * Take compressed block "zb" out of the list of memfile "mfp".
+ */
+    static void
+mf_zip_unlink(mfp, zb)
+    memfile_T	*mfp;
+    mf_zipblock_T *zb;
+{
+    if (zb->zb_prev == NULL)
+	mfp->mf_zip_first = zb->zb_next;
+    else
+	zb->zb_prev->zb_next = zb->zb_next;
+    if (zb->zb_next == NULL)
+	mfp->mf_zip_last = zb->zb_prev;
+    else
+	zb->zb_next->zb_prev = zb->zb_prev;
+}
+
+/*
+ * Free all compressed blocks of memfile "mfp".
+ * Returns TRUE when there were any.
+ */
+    static int
+mf_zip_clear(mfp)
+    memfile_T	*mfp;
+{
+    int		retval = mfp->mf_zip_first != NULL;
+
+    while (mfp->mf_zip_first != NULL)
+	mf_zip_rem(mfp, mfp->mf_zip_first);
+    return retval;
+}
+#endif
+
 /*
  * Make block number for *hp positive and add it to the translation list
  *
@@ -1204,12 +2145,19 @@ mf_trans_add(mfp, hp)
 	mfp->mf_blocknr_max += page_count;
     }
 
+    /* A block of a mapped file was not counted as negative, it is now that
+     * its number must be translated. */
+    if (MF_MAPPED(mfp, hp->bh_bnum))
+	mfp->mf_neg_count++;
+
     np->nt_old_bnum = hp->bh_bnum;	    /* adjust number */
     np->nt_new_bnum = new_bnum;
 
-    mf_rem_hash(mfp, hp);		    /* remove from old hash list */
+    /* Move it to the slot for the new number.  Adding can't fail, there
+     * is room for the slot that was just freed. */
+    mf_bt_remove(&mfp->mf_blocks, hp->bh_bnum);
     hp->bh_bnum = new_bnum;
-    mf_ins_hash(mfp, hp);		    /* insert in new hash list */
+    (void)mf_bt_add(&mfp->mf_blocks, hp);
 
     /* Insert "np" into "mf_trans" hashtable with key "np->nt_old_bnum" */
     mf_hash_add_item(&mfp->mf_trans, (mf_hashitem_T *)np);
@@ -1284,6 +2232,29 @@ mf_need_trans(mfp)
     return (mfp->mf_fname != NULL && mfp->mf_neg_count > 0);
 }
 
+#if defined(FEAT_MMAP) || defined(PROTO)
+/*
+ * Stop filling blocks of "mfp" from its mapped file.  All the blocks of the
+ * file must be in memory.  The ones that were not written to the swap file
+ * are counted as negative blocks from now on.
+ */
+    void
+mf_unmap(mfp)
+    memfile_T	*mfp;
+{
+    long_u	idx;
+    bhdr_T	*hp;
+
+    for (idx = 0; idx <= mfp->mf_blocks.mbt_mask; ++idx)
+    {
+	hp = mfp->mf_blocks.mbt_slots[idx].mbs_hp;
+	if (hp != NULL && MF_MAPPED(mfp, hp->bh_bnum))
+	    ++mfp->mf_neg_count;
+    }
+    mfp->mf_map = NULL;
+}
+#endif
+
 /*
  * Open a swap file for a memfile.
  * The "fname" must be in allocated memory, and is consumed (also when an
@@ -1374,7 +2345,7 @@ mf_do_open(mfp, fname, flags)
  * MHT_GROWTH_FACTOR when the average number of items per bucket
  * exceeds 2 ^ MHT_LOG_LOAD_FACTOR.
  */
-#define MHT_LOG_LOAD_FACTOR 6
+#define MHT_LOG_LOAD_FACTOR 1
 #define MHT_GROWTH_FACTOR   2   /* must be a power of two */
 
 /*
@@ -1568,3 +2539,164 @@ mf_hash_grow(mht)
 
     return OK;
 }
+
+/*
+ * Implementation of mf_blocktab_T follows.
+ */
+
+/*
+ * Initialize an empty block table.
+ */
+    static void
+mf_bt_init(mbt)
+    mf_blocktab_T *mbt;
+{
+    vim_memset(mbt, 0, sizeof(mf_blocktab_T));
+    mbt->mbt_slots = mbt->mbt_small_slots;
+    mbt->mbt_mask = MBT_INIT_SIZE - 1;
+}
+
+/*
+ * Free the array of a block table.  Does not free the blocks in it!
+ */
+    static void
+mf_bt_free(mbt)
+    mf_blocktab_T *mbt;
+{
+    if (mbt->mbt_slots != mbt->mbt_small_slots)
+	vim_free(mbt->mbt_slots);
+}
+
+/*
+ * Return the slot where block "nr" is looked for first.
+ * Block numbers are mostly consecutive, multiplying spreads them out, so
+ * that looking for a block that isn't there doesn't have to go over a long
+ * run of used slots.
+ */
+    static long_u
+mf_bt_hash(mbt, nr)
+    mf_blocktab_T   *mbt;
+    blocknr_T	    nr;
+{
+    long_u	h = (long_u)nr * 0x9e3779b1UL;
+
+    return (h ^ (h >> 15)) & mbt->mbt_mask;
+}
+
+/*
+ * Return the index of the slot for block "nr": the slot that holds it, or
+ * the empty slot where it would be added.
+ */
+    static long_u
+mf_bt_lookup(mbt, nr)
+    mf_blocktab_T   *mbt;
+    blocknr_T	    nr;
+{
+    long_u	    idx = mf_bt_hash(mbt, nr);
+    mf_blockslot_T  *slot;
+
+    for (;;)
+    {
+	slot = &mbt->mbt_slots[idx];
+	if (slot->mbs_hp == NULL || slot->mbs_bnum == nr)
+	    return idx;
+	idx = (idx + 1) & mbt->mbt_mask;
+    }
+}
+
+/*
+ * Add block "hp" to the block table "mbt".  It must not be in it yet.
+ * The number of slots is doubled when more than half of them would be used,
+ * a lookup then only needs to look at a few slots.
+ * Returns FAIL when the table is full and can't grow.
+ */
+    static int
+mf_bt_add(mbt, hp)
+    mf_blocktab_T   *mbt;
+    bhdr_T	    *hp;
+{
+    long_u	    idx;
+
+    if (mbt->mbt_count * 2 >= mbt->mbt_mask + 1
+	    && mf_bt_grow(mbt) == FAIL
+	    /* one slot must stay empty, lookups stop there */
+	    && mbt->mbt_count + 1 >= mbt->mbt_mask)
+	return FAIL;
+
+    idx = mf_bt_lookup(mbt, hp->bh_bnum);
+    mbt->mbt_slots[idx].mbs_bnum = hp->bh_bnum;
+    mbt->mbt_slots[idx].mbs_hp = hp;
+    mbt->mbt_count++;
+    return OK;
+}
+
+/*
+ * Remove block "nr" from the block table "mbt", if it is there.
+ * Blocks in the following slots that were not added in their first slot
+ * because it was used are moved back, so that lookups still find them.
+ */
+    static void
+mf_bt_remove(mbt, nr)
+    mf_blocktab_T   *mbt;
+    blocknr_T	    nr;
+{
+    long_u	    hole = mf_bt_lookup(mbt, nr);
+    long_u	    idx;
+    long_u	    first;
+
+    if (mbt->mbt_slots[hole].mbs_hp == NULL)
+	return;
+    mbt->mbt_count--;
+    idx = hole;
+    for (;;)
+    {
+	mbt->mbt_slots[hole].mbs_hp = NULL;
+	for (;;)
+	{
+	    idx = (idx + 1) & mbt->mbt_mask;
+	    if (mbt->mbt_slots[idx].mbs_hp == NULL)
+		return;
+	    /* The block can move back when its first slot is not after the
+	     * hole (taking the wrap around into account). */
+	    first = mf_bt_hash(mbt, mbt->mbt_slots[idx].mbs_bnum);
+	    if (((idx - first) & mbt->mbt_mask) >= ((idx - hole) & mbt->mbt_mask))
+		break;
+	}
+	mbt->mbt_slots[hole] = mbt->mbt_slots[idx];
+	hole = idx;
+    }
+}
+
+/*
+ * Double the number of slots in the block table and add the blocks again.
+ * Returns FAIL when out of memory.
+ */
+    static int
+mf_bt_grow(mbt)
+    mf_blocktab_T   *mbt;
+{
+    mf_blockslot_T  *old_slots = mbt->mbt_slots;
+    long_u	    old_size = mbt->mbt_mask + 1;
+    mf_blockslot_T  *slots;
+    long_u	    i;
+    long_u	    idx;
+
+    slots = (mf_blockslot_T *)lalloc_clear(
+			   old_size * 2 * sizeof(mf_blockslot_T), FALSE);
+    if (slots == NULL)
+	return FAIL;
+
+    mbt->mbt_slots = slots;
+    mbt->mbt_mask = old_size * 2 - 1;
+    mbt->mbt_hand = 0;
+    for (i = 0; i < old_size; ++i)
+	if (old_slots[i].mbs_hp != NULL)
+	{
+	    idx = mf_bt_lookup(mbt, old_slots[i].mbs_bnum);
+	    slots[idx] = old_slots[i];
+	}
+
+    if (old_slots != mbt->mbt_small_slots)
+	vim_free(old_slots);
+    return OK;
+}
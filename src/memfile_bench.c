@@ -0,0 +1,197 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * memfile_bench.c: Benchmark for the block cache of memfile.c.
+ *
+ * Fills a buffer with ten million lines, with a swap file and room for only
+ * part of the blocks in memory.  Then replays traces of ml_get() calls:
+ * going through the buffer, jumping around at random and mostly staying in
+ * a part of the buffer that fits in memory.  Every ml_get() in another
+ * block goes through mf_get() for each level of the tree.
+ * An optional argument gives the number of lines.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Must include main.c because it contains much more than just main() */
+#define NO_VIM_MAIN
+#include "main.c"
+
+#define BENCH_LINES	10000000L   /* default number of lines */
+#define BENCH_GETS	2000000L    /* ml_get() calls per trace */
+#define BENCH_CACHE	4096	    /* blocks kept in memory */
+
+typedef enum
+{
+    TRACE_SEQUENTIAL,	/* every line in order */
+    TRACE_SCROLL,	/* jump to a random place, get the next screenful */
+    TRACE_RANDOM,	/* any line */
+    TRACE_HOT,		/* nine out of ten in a part that fits in memory */
+    TRACE_COUNT
+} trace_T;
+
+static char *trace_names[] = {"sequential", "scroll", "random", "hot"};
+
+static unsigned long bench_seed = 1;
+static long	bench_lines = BENCH_LINES;
+
+static long bench_random __ARGS((long n));
+static long bench_usec_since __ARGS((struct timeval *tv));
+static void bench_fill __ARGS((void));
+static long_u bench_trace __ARGS((trace_T trace, long *usec));
+static void bench_init __ARGS((void));
+
+/*
+ * Return a pseudo random number from 0 to "n" - 1.
+ */
+    static long
+bench_random(n)
+    long	n;
+{
+    bench_seed = bench_seed * 1103515245UL + 12345UL;
+    return (long)(((bench_seed >> 16) ^ (bench_seed << 15)) % (unsigned long)n);
+}
+
+    static long
+bench_usec_since(tv)
+    struct timeval *tv;
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - tv->tv_sec) * 1000000L + (now.tv_usec - tv->tv_usec);
+}
+
+/*
+ * Fill the current buffer with "bench_lines" lines of 20 to 80 bytes, using a
+ * temp file as swap file.
+ */
+    static void
+bench_fill()
+{
+    char_u	line[100];
+    char_u	*fname;
+    linenr_T	lnum;
+    int		len;
+
+    assert(ml_open(curbuf) == OK);
+    fname = vim_tempname('m');
+    assert(fname != NULL);
+    assert(mf_open_file(curbuf->b_ml.ml_mfp, fname) == OK);  /* consumes fname */
+    curbuf->b_ml.ml_mfp->mf_used_count_max = BENCH_CACHE;
+
+    for (lnum = 0; lnum < bench_lines; ++lnum)
+    {
+	len = sprintf((char *)line, "%ld: ", (long)lnum + 1);
+	while (len < 20 + lnum % 61)
+	    line[len++] = 'a' + (lnum + len) % 26;
+	line[len] = NUL;
+	assert(ml_append(lnum, line, (colnr_T)0, FALSE) == OK);
+    }
+    /* remove the empty line that was there */
+    assert(ml_delete(bench_lines + 1, FALSE) == OK);
+    assert(curbuf->b_ml.ml_line_count == bench_lines);
+}
+
+/*
+ * Replay BENCH_GETS calls of ml_get() for "trace".  Sets "*usec" to the time
+ * it took.  Returns a hash of the text.
+ */
+    static long_u
+bench_trace(trace, usec)
+    trace_T	trace;
+    long	*usec;
+{
+    struct timeval  start;
+    long_u	    hash = 0;
+    long	    i;
+    linenr_T	    lnum = 1;
+    long	    hot = BENCH_CACHE * 50L;   /* about half the cache */
+
+    if (hot > bench_lines)
+	hot = bench_lines;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_GETS; ++i)
+    {
+	switch (trace)
+	{
+	    case TRACE_SEQUENTIAL:
+		lnum = i % bench_lines + 1;
+		break;
+	    case TRACE_SCROLL:
+		if (i % 50 == 0 || lnum >= bench_lines)
+		    lnum = bench_random(bench_lines) + 1;
+		else
+		    ++lnum;
+		break;
+	    case TRACE_RANDOM:
+		lnum = bench_random(bench_lines) + 1;
+		break;
+	    default:
+		if (bench_random(10) == 0)
+		    lnum = bench_random(bench_lines) + 1;
+		else
+		    lnum = bench_lines / 3 + bench_random(hot) + 1;
+		break;
+	}
+	hash = hash * 31 + *ml_get(lnum) + STRLEN(ml_get(lnum));
+    }
+    *usec = bench_usec_since(&start);
+    return hash;
+}
+
+/*
+ * The parts of Vim's startup that the memline functions need.
+ */
+    static void
+bench_init()
+{
+    mch_early_init();
+#ifdef FEAT_MBYTE
+    (void)mb_init();
+#endif
+    eval_init();
+    IObuff = alloc(IOSIZE);
+    NameBuff = alloc(MAXPATHL);
+    assert(IObuff != NULL && NameBuff != NULL);
+    assert(win_alloc_first() == OK);
+    set_init_1();
+    msg_silent = 1;
+}
+
+    int
+main(argc, argv)
+    int		argc;
+    char	**argv;
+{
+    struct timeval  start;
+    long	    usec;
+    int		    trace;
+
+    bench_init();
+    if (argc > 1)
+	bench_lines = atol(argv[1]);
+    assert(bench_lines > 0);
+
+    gettimeofday(&start, NULL);
+    bench_fill();
+    printf("memfile_bench: %ld lines, %d blocks in memory, filled in %ld msec\n",
+	       bench_lines, BENCH_CACHE, bench_usec_since(&start) / 1000L);
+
+    for (trace = 0; trace < TRACE_COUNT; ++trace)
+    {
+	(void)bench_trace((trace_T)trace, &usec);
+	printf("  %-10s %7.1f nsec per ml_get()\n", trace_names[trace],
+					  (double)usec * 1000.0 / BENCH_GETS);
+    }
+    ml_close(curbuf, TRUE);
+    return 0;
+}
@@ -24,8 +24,12 @@
 
 #define index_to_key(i) ((i) ^ 15167)
 #define TEST_COUNT 50000
+#define CLOCK_COUNT 20
 
 static void test_mf_hash __ARGS((void));
+static void test_mf_blocktab __ARGS((void));
+static void test_mf_clock __ARGS((void));
+static void test_mf_free_nr __ARGS((void));
 
 /*
  * Test mf_hash_*() functions.
@@ -137,9 +141,312 @@ test_mf_hash()
     mf_hash_free_all(&ht);
 }
 
+/*
+ * Test mf_bt_*() functions.
+ */
+    static void
+test_mf_blocktab()
+{
+    mf_blocktab_T   mbt;
+    bhdr_T	    *hp;
+    blocknr_T	    key;
+    long_u	    i;
+    long_u	    num_slots;
+
+    mf_bt_init(&mbt);
+
+    /* add blocks with positive and negative numbers, check invariants */
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+	assert(mbt.mbt_count == i);
+
+	/* check that number of slots is a power of 2 */
+	num_slots = mbt.mbt_mask + 1;
+	assert(num_slots > 0 && (num_slots & (num_slots - 1)) == 0);
+
+	/* check load factor */
+	assert(mbt.mbt_count * 2 <= num_slots);
+
+	key = (i & 1) ? -(blocknr_T)i : (blocknr_T)i;
+	assert(mbt.mbt_slots[mf_bt_lookup(&mbt, key)].mbs_hp == NULL);
+
+	hp = (bhdr_T *)lalloc_clear(sizeof(bhdr_T), FALSE);
+	assert(hp != NULL);
+	hp->bh_bnum = key;
+	assert(mf_bt_add(&mbt, hp) == OK);
+	assert(mbt.mbt_slots[mf_bt_lookup(&mbt, key)].mbs_hp == hp);
+    }
+    assert(mbt.mbt_slots != mbt.mbt_small_slots);
+
+    /* remove most blocks, every time check that the others are found */
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+	if (i % 100 < 70)
+	{
+	    key = (i & 1) ? -(blocknr_T)i : (blocknr_T)i;
+	    hp = mbt.mbt_slots[mf_bt_lookup(&mbt, key)].mbs_hp;
+	    assert(hp != NULL && hp->bh_bnum == key);
+	    mf_bt_remove(&mbt, key);
+	    assert(mbt.mbt_slots[mf_bt_lookup(&mbt, key)].mbs_hp == NULL);
+	    vim_free(hp);
+
+	    /* removing again does nothing */
+	    mf_bt_remove(&mbt, key);
+	}
+    }
+    assert(mbt.mbt_count == TEST_COUNT * 3 / 10);
+
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+	key = (i & 1) ? -(blocknr_T)i : (blocknr_T)i;
+	hp = mbt.mbt_slots[mf_bt_lookup(&mbt, key)].mbs_hp;
+	if (i % 100 < 70)
+	    assert(hp == NULL);
+	else
+	{
+	    assert(hp != NULL && hp->bh_bnum == key);
+	    mf_bt_remove(&mbt, key);
+	    vim_free(hp);
+	}
+    }
+    assert(mbt.mbt_count == 0);
+    for (i = 0; i <= mbt.mbt_mask; i++)
+	assert(mbt.mbt_slots[i].mbs_hp == NULL);
+
+    mf_bt_free(&mbt);
+}
+
+/*
+ * Test the CLOCK eviction in mf_clock().
+ */
+    static void
+test_mf_clock()
+{
+    memfile_T	*mfp;
+    bhdr_T	*hps[CLOCK_COUNT];
+    bhdr_T	*hp;
+    int		i;
+
+    mfp = mf_open(NULL, 0);
+    assert(mfp != NULL);
+    for (i = 0; i < CLOCK_COUNT; i++)
+    {
+	hps[i] = mf_new(mfp, FALSE, 1);
+	assert(hps[i] != NULL);
+	assert(mf_find_block(mfp, hps[i]->bh_bnum) == hps[i]);
+    }
+    assert(mfp->mf_used_count == CLOCK_COUNT);
+
+    /* locked blocks are never released */
+    assert(mf_clock(mfp, FALSE) == NULL);
+
+    /* a block that was used is taken the second time around */
+    mf_put(mfp, hps[3], FALSE, FALSE);
+    assert(hps[3]->bh_flags & BH_USED);
+    assert(mf_clock(mfp, FALSE) == hps[3]);
+    assert(!(hps[3]->bh_flags & BH_USED));
+    assert(mf_clock(mfp, FALSE) == hps[3]);
+
+    /* after using it again another block goes first */
+    for (i = 0; i < CLOCK_COUNT; i++)
+	if (i != 3)
+	    mf_put(mfp, hps[i], FALSE, FALSE);
+    assert(mf_get(mfp, hps[3]->bh_bnum, 1) == hps[3]);
+    mf_put(mfp, hps[3], FALSE, FALSE);
+    hp = mf_clock(mfp, FALSE);
+    assert(hp != NULL && hp != hps[3]);
+
+    mf_close(mfp, TRUE);
+}
+
+/*
+ * Test freeing blocks by number with mf_free_nr().
+ */
+    static void
+test_mf_free_nr()
+{
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+    blocknr_T	nr;
+
+    mfp = mf_open(NULL, 0);
+    assert(mfp != NULL);
+
+    /* a block in memory is freed and its number re-used */
+    hp = mf_new(mfp, FALSE, 1);
+    assert(hp != NULL);
+    nr = hp->bh_bnum;
+    mf_put(mfp, hp, FALSE, FALSE);
+    mf_free_nr(mfp, nr, 1);
+    assert(mf_find_block(mfp, nr) == NULL);
+    hp = mf_new(mfp, FALSE, 1);
+    assert(hp != NULL && hp->bh_bnum == nr);
+    mf_put(mfp, hp, FALSE, FALSE);
+
+    /* a block that is not in memory only has its number put in the free
+     * list, one with several pages is split when re-used */
+    hp = mf_new(mfp, FALSE, 2);
+    assert(hp != NULL);
+    nr = hp->bh_bnum;
+    mf_rem_block(mfp, hp);
+    mf_free_bhdr(hp);
+    mf_free_nr(mfp, nr, 2);
+    assert(mfp->mf_free_first != NULL && mfp->mf_free_first->bh_bnum == nr);
+    hp = mf_new(mfp, FALSE, 1);
+    assert(hp != NULL && hp->bh_bnum == nr);
+    mf_put(mfp, hp, FALSE, FALSE);
+    hp = mf_new(mfp, FALSE, 1);
+    assert(hp != NULL && hp->bh_bnum == nr + 1);
+    mf_put(mfp, hp, FALSE, FALSE);
+    assert(mfp->mf_free_first == NULL);
+
+    /* a negative number doesn't go in the free list */
+    hp = mf_new(mfp, TRUE, 1);
+    assert(hp != NULL && hp->bh_bnum < 0);
+    nr = hp->bh_bnum;
+    mf_put(mfp, hp, FALSE, FALSE);
+    assert(mfp->mf_neg_count == 1);
+    mf_free_nr(mfp, nr, 1);
+    assert(mf_find_block(mfp, nr) == NULL);
+    assert(mfp->mf_neg_count == 0);
+    assert(mfp->mf_free_first == NULL);
+
+    mf_close(mfp, TRUE);
+}
+
+#ifdef FEAT_MEMZIP
+/*
+ * Compress "len" bytes at "src", expand the result and check it's the same.
+ * Returns the compressed length, zero when it didn't fit in "maxlen".
+ */
+    static unsigned
+zip_roundtrip(src, len, maxlen)
+    char_u	*src;
+    unsigned	len;
+    unsigned	maxlen;
+{
+    char_u	*zip = alloc(maxlen);
+    char_u	*out = alloc(len + 1);
+    unsigned	zlen;
+
+    assert(zip != NULL && out != NULL);
+    zlen = mf_zip_compress(src, len, zip, maxlen);
+    if (zlen > 0)
+    {
+	assert(zlen <= maxlen);
+	assert(mf_zip_expand(zip, zlen, out, len) == OK);
+	assert(memcmp(src, out, len) == 0);
+	/* truncated data and a wrong length are detected */
+	assert(mf_zip_expand(zip, zlen - 1, out, len) == FAIL);
+	assert(len == 0 || mf_zip_expand(zip, zlen, out, len - 1) == FAIL);
+    }
+    vim_free(zip);
+    vim_free(out);
+    return zlen;
+}
+
+/*
+ * Test the codec and keeping blocks compressed.
+ */
+    static void
+test_mf_zip()
+{
+    char_u	buf[3 * MEMFILE_PAGE_SIZE];
+    unsigned	i;
+    unsigned	seed = 12345;
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+    bhdr_T	*hp2;
+    blocknr_T	nr;
+    mf_zipblock_T *zb;
+    long	save_mmz = p_mmz;
+
+    /* zeros, repeated text, long literal and match runs */
+    vim_memset(buf, 0, sizeof(buf));
+    assert(zip_roundtrip(buf, sizeof(buf), sizeof(buf)) < 100);
+    for (i = 0; i < sizeof(buf); ++i)
+	buf[i] = "line of text\n"[i % 13];
+    assert(zip_roundtrip(buf, sizeof(buf), sizeof(buf)) < 100);
+    for (i = 0; i < 1000; ++i)
+	buf[i] = (seed = seed * 1103515245 + 12345) >> 16;
+    assert(zip_roundtrip(buf, sizeof(buf), sizeof(buf)) > 1000);
+    assert(zip_roundtrip(buf, 1, 100) > 0);
+    assert(zip_roundtrip(buf, 0, 100) > 0);
+
+    /* random bytes don't compress */
+    for (i = 0; i < sizeof(buf); ++i)
+	buf[i] = (seed = seed * 1103515245 + 12345) >> 16;
+    assert(zip_roundtrip(buf, sizeof(buf), sizeof(buf) - 1) == 0);
+
+    /* a block is kept compressed and expanded when read */
+    p_mmz = 1000;
+    mfp = mf_open(NULL, 0);
+    assert(mfp != NULL);
+    hp = mf_new(mfp, FALSE, 1);
+    assert(hp != NULL);
+    nr = hp->bh_bnum;
+    for (i = 0; i < mfp->mf_page_size; ++i)
+	((char_u *)hp->bh_data)[i] = "some text\n"[i % 10];
+    mf_zip_add(mfp, hp);
+    assert(mfp->mf_zip_first != NULL && mfp->mf_zip_first->zb_bnum == nr);
+    assert(total_zip_used > 0);
+    hp2 = mf_alloc_bhdr(mfp, 1);
+    assert(hp2 != NULL);
+    hp2->bh_bnum = nr;
+    assert(mf_zip_get(mfp, hp2) == OK);
+    assert(memcmp(hp->bh_data, hp2->bh_data, mfp->mf_page_size) == 0);
+    mf_free_bhdr(hp2);
+
+    /* releasing it again keeps the same copy, a wrong size drops it */
+    zb = mfp->mf_zip_first;
+    mf_zip_add(mfp, hp);
+    assert(mfp->mf_zip_first == zb && mfp->mf_zip_last == zb);
+    hp2 = mf_alloc_bhdr(mfp, 2);
+    assert(hp2 != NULL);
+    hp2->bh_bnum = nr;
+    assert(mf_zip_get(mfp, hp2) == FAIL);
+    assert(mfp->mf_zip_first == NULL && total_zip_used == 0);
+    mf_free_bhdr(hp2);
+
+    /* freeing the block drops the compressed copy */
+    mf_zip_add(mfp, hp);
+    assert(mfp->mf_zip_first != NULL);
+    mf_put(mfp, hp, FALSE, FALSE);
+    mf_free_nr(mfp, nr, 1);
+    assert(mfp->mf_zip_first == NULL && total_zip_used == 0);
+
+    /* when full the oldest block is dropped */
+    p_mmz = 1;
+    for (i = 0; i < 200; ++i)
+    {
+	hp = mf_new(mfp, FALSE, 1);
+	assert(hp != NULL);
+	if (i == 0)
+	    nr = hp->bh_bnum;
+	vim_memset(hp->bh_data, 'a' + i % 26, mfp->mf_page_size);
+	mf_zip_add(mfp, hp);
+	mf_put(mfp, hp, FALSE, FALSE);
+	assert(total_zip_used <= 1024);
+	assert(mfp->mf_zip_last != NULL
+				      && mfp->mf_zip_last->zb_bnum == hp->bh_bnum);
+    }
+    assert(mf_hash_find(&mfp->mf_zip, nr) == NULL);
+    assert(mfp->mf_zip_first->zb_bnum > nr);
+    mf_close(mfp, TRUE);
+    assert(total_zip_used == 0);
+    p_mmz = save_mmz;
+}
+#endif
+
     int
 main()
 {
     test_mf_hash();
+    test_mf_blocktab();
+    test_mf_clock();
+    test_mf_free_nr();
+#ifdef FEAT_MEMZIP
+    test_mf_zip();
+#endif
     return 0;
 }
@@ -87,6 +87,32 @@ struct pointer_block
 				 * followed by empty space until end of page */
 };
 
+#ifdef FEAT_BYTEOFF
+/*
+ * The number of text bytes in each branch, including the NUL of every line,
+ * is kept in an array of longs after the last possible entry of a pointer
+ * block.  Older versions only look at the entries, they can still recover
+ * the swap file.
+ */
+# define PB_BYTES(pp)	((long *)&(pp)->pb_pointer[(pp)->pb_count_max])
+# define PB_ENTRY_SIZE	(sizeof(PTR_EN) + sizeof(long))
+#else
+# define PB_ENTRY_SIZE	sizeof(PTR_EN)
+#endif
+#define PB_COUNT_MAX(mfp) \
+	((short_u)(((mfp)->mf_page_size - sizeof(PTR_BL) + sizeof(PTR_EN)) \
+							    / PB_ENTRY_SIZE))
+
+/*
+ * A pointer block entry with the number of text bytes in the branch, used by
+ * ml_append_lines() while building pointer blocks bottom-up.
+ */
+typedef struct
+{
+    PTR_EN	me_pe;
+    long	me_bytes;
+} mlentry_T;
+
 /*
  * A data block is a leaf in the tree.
  *
@@ -238,14 +264,21 @@ static void add_b0_fenc __ARGS((ZERO_BL *b0p, buf_T *buf));
 static time_t swapfile_info __ARGS((char_u *));
 static int recov_file_names __ARGS((char_u **, char_u *, int prepend_dot));
 static int ml_append_int __ARGS((buf_T *, linenr_T, char_u *, colnr_T, int, int));
+static void ml_pack_text __ARGS((DATA_BL *dp, char_u *line, colnr_T len, unsigned mark));
+static int ml_pack_line __ARGS((buf_T *buf, garray_T *gap, bhdr_T **hpp, char_u *line, colnr_T len, unsigned mark, linenr_T lnum, int newfile));
+static int ml_pack_close __ARGS((memfile_T *mfp, garray_T *gap, bhdr_T **hpp, linenr_T lnum));
+static int ml_pack_ptr __ARGS((memfile_T *mfp, garray_T *gap, bhdr_T *hp));
+static int ml_insert_entries __ARGS((buf_T *buf, garray_T *gap, int lineadd, long byteadd));
 static int ml_delete_int __ARGS((buf_T *, linenr_T, int));
+static linenr_T ml_delete_branch __ARGS((memfile_T *mfp, PTR_EN *pe, int depth, linenr_T first, linenr_T last, long *bytesp));
+static void ml_free_branch __ARGS((memfile_T *mfp, blocknr_T bnum, int page_count, int depth));
 static char_u *findswapname __ARGS((buf_T *, char_u **, char_u *));
 static void ml_flush_line __ARGS((buf_T *));
 static bhdr_T *ml_new_data __ARGS((memfile_T *, int, int));
 static bhdr_T *ml_new_ptr __ARGS((memfile_T *));
 static bhdr_T *ml_find_line __ARGS((buf_T *, linenr_T, int));
 static int ml_add_stack __ARGS((buf_T *));
-static void ml_lineadd __ARGS((buf_T *, int));
+static void ml_lineadd __ARGS((buf_T *, int, long));
 static int b0_magic_wrong __ARGS((ZERO_BL *));
 #ifdef CHECK_INODE
 static int fnamecmp_ino __ARGS((char_u *, char_u *, long));
@@ -255,11 +288,29 @@ static long char_to_long __ARGS((char_u *));
 #if defined(UNIX) || defined(WIN3264)
 static char_u *make_percent_swname __ARGS((char_u *dir, char_u *name));
 #endif
+#ifdef UNIX
+static int swap_index_open __ARGS((char_u *dir, int flags));
+static int swap_index_add __ARGS((garray_T *gap, char_u *name, int add, long ino));
+static int swap_index_compare __ARGS((const void *s1, const void *s2));
+static void swap_index_live __ARGS((garray_T *gap));
+static int swap_index_time __ARGS((struct stat *st, char_u *buf));
+static int swap_index_read __ARGS((char_u *dir, char_u *mtime, int num_pats, char_u **pats, garray_T *gap));
+static int swap_index_scan __ARGS((char_u *dir_name, char_u *dir, char_u *mtime, garray_T *gap));
+static int swap_index_expand __ARGS((char_u *dir_name, int num_names, char_u **names, int *num_files, char_u ***files));
+#endif
 #ifdef FEAT_CRYPT
 static void ml_crypt_prepare __ARGS((memfile_T *mfp, off_t offset, int reading));
 #endif
-#ifdef FEAT_BYTEOFF
-static void ml_updatechunk __ARGS((buf_T *buf, long line, long len, int updtype));
+#ifdef FEAT_MMAP
+static int ml_map_add_entry __ARGS((memfile_T *mfp, bhdr_T **lvl, int level, blocknr_T bnum, int page_count, linenr_T line_count, long size, linenr_T lnum));
+static int ml_map_close_level __ARGS((memfile_T *mfp, bhdr_T **lvl, int level));
+static int ml_map_check_text __ARGS((char_u *p, char_u *nl, char_u *end, int raw, int try_mac));
+static int ml_map_scan __ARGS((mlmap_T *mm, char_u *p, int raw, int try_mac, unsigned page_size, garray_T *offs, garray_T *leaves, int *eolp));
+static int ml_map_text __ARGS((mlmap_T *mm, int raw, int skip_bom, unsigned page_size, garray_T *offs, garray_T *leaves, int *ffp, int *bomp, int *eolp));
+static int ml_map_text_catch __ARGS((mlmap_T *mm, int raw, int skip_bom, unsigned page_size, garray_T *offs, garray_T *leaves, int *ffp, int *bomp, int *eolp));
+static int ml_map_check_file __ARGS((mlmap_T *mm));
+static void ml_map_copy __ARGS((mlmap_T *mm, bhdr_T *hp, blocknr_T slot, unsigned page_size));
+static void ml_map_free __ARGS((mlmap_T *mm));
 #endif
 
 /*
@@ -285,9 +336,6 @@ ml_open(buf)
     buf->b_ml.ml_stack_top = 0;	/* nothing in the stack */
     buf->b_ml.ml_locked = NULL;	/* no cached block */
     buf->b_ml.ml_line_lnum = 0;	/* no cached line */
-#ifdef FEAT_BYTEOFF
-    buf->b_ml.ml_chunksize = NULL;
-#endif
 
     /*
      * When 'updatecount' is non-zero swap file may be opened later.
@@ -388,6 +436,9 @@ ml_open(buf)
     pp->pb_pointer[0].pe_page_count = 1;
     pp->pb_pointer[0].pe_old_lnum = 1;
     pp->pb_pointer[0].pe_line_count = 1;    /* line count after insertion */
+#ifdef FEAT_BYTEOFF
+    PB_BYTES(pp)[0] = 1;		    /* the NUL of the empty line */
+#endif
     mf_put(mfp, hp, TRUE, FALSE);
 
     /*
@@ -647,6 +698,9 @@ ml_setname(buf)
 	/* need to close the swap file before renaming */
 	if (mfp->mf_fd >= 0)
 	{
+#ifdef FEAT_SWAP_THREAD
+	    mf_writer_wait(mfp);
+#endif
 	    close(mfp->mf_fd);
 	    mfp->mf_fd = -1;
 	}
@@ -655,6 +709,10 @@ ml_setname(buf)
 	if (vim_rename(mfp->mf_fname, fname) == 0)
 	{
 	    success = TRUE;
+#ifdef UNIX
+	    ml_swap_index(mfp->mf_fname, FALSE);
+	    ml_swap_index(fname, TRUE);
+#endif
 	    vim_free(mfp->mf_fname);
 	    mfp->mf_fname = fname;
 	    vim_free(mfp->mf_ffname);
@@ -764,6 +822,9 @@ ml_open_file(buf)
 	    /* Flush block zero, so others can read it */
 	    if (mf_sync(mfp, MFS_ZERO) == OK)
 	    {
+#ifdef UNIX
+		ml_swap_index(mfp->mf_fname, TRUE);
+#endif
 		/* Mark all blocks that should be in the swapfile as dirty.
 		 * Needed for when the 'swapfile' option was reset, so that
 		 * the swap file was deleted, and then on again. */
@@ -809,16 +870,26 @@ ml_close(buf, del_file)
     buf_T	*buf;
     int		del_file;
 {
+#ifdef FEAT_MMAP
+    mlmap_T	*mm;
+#endif
+
+#ifdef FEAT_PROGRESSIVE_LOAD
+    buf_load_stop(buf);
+#endif
     if (buf->b_ml.ml_mfp == NULL)		/* not open */
 	return;
+#ifdef FEAT_MMAP
+    mm = buf->b_ml.ml_mfp->mf_map;
+#endif
     mf_close(buf->b_ml.ml_mfp, del_file);	/* close the .swp file */
+#ifdef FEAT_MMAP
+    if (mm != NULL)
+	ml_map_free(mm);
+#endif
     if (buf->b_ml.ml_line_lnum != 0 && (buf->b_ml.ml_flags & ML_LINE_DIRTY))
 	vim_free(buf->b_ml.ml_line_ptr);
     vim_free(buf->b_ml.ml_stack);
-#ifdef FEAT_BYTEOFF
-    vim_free(buf->b_ml.ml_chunksize);
-    buf->b_ml.ml_chunksize = NULL;
-#endif
     buf->b_ml.ml_mfp = NULL;
 
     /* Reset the "recovered" flag, give the ATTENTION prompt the next time
@@ -1479,9 +1550,22 @@ ml_recover()
 			 */
 			if (!cannot_open)
 			{
+			    /* Following blocks that are not in the swap file
+			     * either, e.g. of a mapped file, are read at
+			     * once. */
+			    i = idx;
 			    line_count = pp->pb_pointer[idx].pe_line_count;
+			    while (idx + 1 < (int)pp->pb_count
+				    && pp->pb_pointer[idx + 1].pe_bnum < 0
+				    && pp->pb_pointer[idx + 1].pe_old_lnum
+					     == pp->pb_pointer[idx].pe_old_lnum
+					     + pp->pb_pointer[idx].pe_line_count)
+			    {
+				++idx;
+				line_count += pp->pb_pointer[idx].pe_line_count;
+			    }
 			    if (readfile(curbuf->b_ffname, NULL, lnum,
-					pp->pb_pointer[idx].pe_old_lnum - 1,
+					pp->pb_pointer[i].pe_old_lnum - 1,
 					line_count, NULL, 0) == FAIL)
 				cannot_open = TRUE;
 			    else
@@ -1860,6 +1944,16 @@ recover_names(fname, list, nr, fname_out)
 	}
 	if (num_names == 0)
 	    num_files = 0;
+#ifdef UNIX
+	/* A directory ending in "//" may hold many swap files, use the swap
+	 * file index to avoid scanning it. */
+	else if (STRLEN(dir_name) > 2
+		&& after_pathsep(dir_name, dir_name + STRLEN(dir_name))
+		&& vim_ispathsep(dir_name[STRLEN(dir_name) - 2])
+		&& swap_index_expand(dir_name, num_names, names,
+						      &num_files, &files) == OK)
+	    ;
+#endif
 	else if (expand_wildcards(num_names, names, &num_files, &files,
 					EW_KEEPALL|EW_FILE|EW_SILENT) == FAIL)
 	    num_files = 0;
@@ -2003,6 +2097,529 @@ make_percent_swname(dir, name)
 }
 #endif
 
+#if defined(UNIX) || defined(PROTO)
+/*
+ * Swap file index.
+ *
+ * A directory in 'directory' ending in "//" holds the swap files for many
+ * files.  Finding the swap files for one file means expanding a wildcard in a
+ * directory that may have thousands of entries.  To avoid that the directory
+ * can have an index file that lists the swap files in it.  Each line is a
+ * record:
+ *	+{pid} {inode} {mtime} {name}	swap file {name} was created
+ *	-{pid} 0 {mtime} {name}		swap file {name} was deleted
+ *	={pid} 0 {mtime}		the directory was scanned
+ * {mtime} is the time the directory was changed, obtained after creating or
+ * deleting the swap file.  Records are only appended, thus several Vims can
+ * update the index at the same time.
+ *
+ * The index is only used when the {mtime} of the last record equals the time
+ * the directory was changed, thus no file was created or deleted since then
+ * without updating the index.  Otherwise the directory is scanned and the
+ * index written again.  The index is only created when scanning.
+ */
+# define SWAP_INDEX_NAME ".vim-swap-index"
+
+typedef struct
+{
+    long	si_seq;		/* record number in the index */
+    int		si_add;		/* TRUE for created, FALSE for deleted */
+    long	si_ino;		/* inode number of the swap file */
+    char_u	si_name[1];	/* swap file name, actually longer */
+} swapidx_T;
+
+/*
+ * Open the swap file index in directory "dir" with open() flags "flags".
+ * The index must be a file owned by the user, an index that someone else put
+ * there is not used.
+ * Returns the file descriptor, -1 when there is no usable index.
+ */
+    static int
+swap_index_open(dir, flags)
+    char_u	*dir;
+    int		flags;
+{
+    char_u	*fname;
+    struct stat	st;
+    int		fd = -1;
+
+    fname = concat_fnames(dir, (char_u *)SWAP_INDEX_NAME, TRUE);
+    if (fname == NULL)
+	return -1;
+    if (mch_lstat((char *)fname, &st) < 0)
+    {
+	if (flags & O_CREAT)
+	    fd = mch_open((char *)fname,
+			  flags | O_EXCL | O_NOFOLLOW | O_EXTRA, (mode_t)0600);
+    }
+    else if (S_ISREG(st.st_mode) && st.st_uid == getuid())
+	fd = mch_open((char *)fname,
+		     (flags & ~O_CREAT) | O_NOFOLLOW | O_EXTRA, (mode_t)0600);
+    vim_free(fname);
+    return fd;
+}
+
+/* room for the modification time in the swap file index */
+#define SWAP_INDEX_TIME_LEN 40
+
+/*
+ * Put the modification time of "st" in "buf" the way it is kept in the swap
+ * file index, with nanoseconds when the file system has them.
+ * Returns FAIL when there are no nanoseconds and the time is in the current
+ * second: another change in this second would not change the time, the index
+ * can't be trusted then.
+ */
+    static int
+swap_index_time(st, buf)
+    struct stat	*st;
+    char_u	*buf;
+{
+#ifdef HAVE_ST_MTIM
+    if (st->st_mtim.tv_nsec != 0)
+    {
+	sprintf((char *)buf, "%ld.%09ld", (long)st->st_mtime,
+						   (long)st->st_mtim.tv_nsec);
+	return OK;
+    }
+#endif
+    sprintf((char *)buf, "%ld", (long)st->st_mtime);
+    return time(NULL) > st->st_mtime ? OK : FAIL;
+}
+
+/*
+ * Add a record to the swap file index of the directory of swap file "fname",
+ * for it being created ("add" is TRUE) or deleted.
+ * Does nothing when the directory has no index.
+ */
+    void
+ml_swap_index(fname, add)
+    char_u	*fname;
+    int		add;
+{
+    char_u	*tail;
+    char_u	*dir;
+    char_u	*line;
+    struct stat	st;
+    long	ino = 0;
+    char_u	mtime[SWAP_INDEX_TIME_LEN];
+    int		fd;
+
+    if (fname == NULL)
+	return;
+    tail = gettail(fname);
+    if (*tail == NUL || vim_strchr(tail, '\n') != NULL)
+	return;
+    if (tail == fname)
+	dir = vim_strsave((char_u *)".");
+    else
+	dir = vim_strnsave(fname, (int)(tail - fname));
+    if (dir == NULL)
+	return;
+
+    fd = swap_index_open(dir, O_WRONLY | O_APPEND);
+    if (fd >= 0)
+    {
+	if (add && mch_stat((char *)fname, &st) >= 0)
+	    ino = (long)st.st_ino;
+	line = alloc((unsigned)STRLEN(tail) + 80);
+
+	/* When the record can't be written the directory time won't match
+	 * and the index is not used.  Also when the time does not show a
+	 * change made later, then a zero time is written. */
+	if (line != NULL && (!add || ino != 0)
+					    && mch_stat((char *)dir, &st) >= 0)
+	{
+	    if (swap_index_time(&st, mtime) == FAIL)
+		STRCPY(mtime, "0");
+	    sprintf((char *)line, "%c%ld %ld %s %s\n", add ? '+' : '-',
+					 mch_get_pid(), ino, mtime, tail);
+	    (void)write_eintr(fd, line, STRLEN(line));
+	}
+	vim_free(line);
+	close(fd);
+    }
+    vim_free(dir);
+}
+
+/*
+ * Add a record for swap file "name" to "gap".
+ */
+    static int
+swap_index_add(gap, name, add, ino)
+    garray_T	*gap;
+    char_u	*name;
+    int		add;
+    long	ino;
+{
+    swapidx_T	*si;
+
+    if (ga_grow(gap, 1) == FAIL)
+	return FAIL;
+    si = (swapidx_T *)alloc((unsigned)(sizeof(swapidx_T) + STRLEN(name)));
+    if (si == NULL)
+	return FAIL;
+    si->si_seq = gap->ga_len;
+    si->si_add = add;
+    si->si_ino = ino;
+    STRCPY(si->si_name, name);
+    ((swapidx_T **)gap->ga_data)[gap->ga_len++] = si;
+    return OK;
+}
+
+/*
+ * Compare two records by name, and for the same name in the order they were
+ * added.
+ */
+    static int
+swap_index_compare(s1, s2)
+    const void	*s1;
+    const void	*s2;
+{
+    swapidx_T	*si1 = *(swapidx_T **)s1;
+    swapidx_T	*si2 = *(swapidx_T **)s2;
+    int		c = STRCMP(si1->si_name, si2->si_name);
+
+    if (c != 0)
+	return c;
+    return si1->si_seq < si2->si_seq ? -1 : 1;
+}
+
+/*
+ * Reduce the records in "gap" to the swap files that exist: for each name the
+ * last record says it was created.  The result is sorted by name.
+ */
+    static void
+swap_index_live(gap)
+    garray_T	*gap;
+{
+    swapidx_T	**sip = (swapidx_T **)gap->ga_data;
+    int		i;
+    int		n = 0;
+
+    if (gap->ga_len == 0)
+	return;
+    qsort((void *)sip, (size_t)gap->ga_len, sizeof(swapidx_T *),
+							  swap_index_compare);
+    for (i = 0; i < gap->ga_len; ++i)
+    {
+	if (sip[i]->si_add && (i + 1 == gap->ga_len
+		       || STRCMP(sip[i]->si_name, sip[i + 1]->si_name) != 0))
+	    sip[n++] = sip[i];
+	else
+	    vim_free(sip[i]);
+    }
+    gap->ga_len = n;
+}
+
+/*
+ * Read the swap file index of directory "dir" into "gap".  Only names that
+ * start like one of the patterns "pats[num_pats]" are kept, the others are
+ * skipped to avoid the work of storing them.
+ * Returns FAIL when there is no index, it does not match "mtime", the time
+ * the directory was changed as put by swap_index_time(), or it has many
+ * deleted entries.
+ */
+    static int
+swap_index_read(dir, mtime, num_pats, pats, gap)
+    char_u	*dir;
+    char_u	*mtime;
+    int		num_pats;
+    char_u	**pats;
+    garray_T	*gap;
+{
+    FILE	*fp;
+    int		fd;
+    char_u	*line;
+    char_u	*p;
+    int		*prefix_len;
+    char_u	*q;
+    long	ino;
+    char_u	last_mtime[SWAP_INDEX_TIME_LEN];
+    long	records = 0;
+    long	live = 0;
+    int		type;
+    int		i;
+    int		retval = OK;
+
+    /* Length of the literal text at the start of each pattern. */
+    prefix_len = (int *)alloc((unsigned)(num_pats * sizeof(int)));
+    if (prefix_len == NULL)
+	return FAIL;
+    for (i = 0; i < num_pats; ++i)
+	prefix_len[i] = p_fic ? 0 : (int)strcspn((char *)pats[i],
+							   "*?[{\\~$`");
+
+    fd = swap_index_open(dir, O_RDONLY);
+    fp = fd < 0 ? NULL : fdopen(fd, "r");
+    if (fp == NULL)
+    {
+	if (fd >= 0)
+	    close(fd);
+	vim_free(prefix_len);
+	return FAIL;
+    }
+    line = alloc(MAXPATHL + 100);
+    if (line == NULL)
+	retval = FAIL;
+    *last_mtime = NUL;
+    while (retval == OK && fgets((char *)line, MAXPATHL + 100, fp) != NULL)
+    {
+	++records;
+	p = line + STRLEN(line);
+	if (p == line || p[-1] != '\n')
+	{
+	    retval = FAIL;	/* line too long or incomplete */
+	    break;
+	}
+	p[-1] = NUL;
+	type = *line;
+	p = line + 1;
+	(void)getdigits(&p);
+	if (*p++ != ' ')
+	{
+	    retval = FAIL;
+	    break;
+	}
+	ino = getdigits(&p);
+	if (*p++ != ' ')
+	{
+	    retval = FAIL;
+	    break;
+	}
+	for (q = p; VIM_ISDIGIT(*p) || *p == '.'; ++p)
+	    ;
+	if (p - q >= SWAP_INDEX_TIME_LEN)
+	{
+	    retval = FAIL;
+	    break;
+	}
+	vim_strncpy(last_mtime, q, p - q);
+	if (type == '=')
+	    continue;
+	if ((type != '+' && type != '-') || *p++ != ' ' || *p == NUL)
+	{
+	    retval = FAIL;
+	    break;
+	}
+	live += type == '+' ? 1 : -1;
+
+	for (i = 0; i < num_pats; ++i)
+	    if (STRNCMP(p, pats[i], prefix_len[i]) == 0)
+		break;
+	if (i < num_pats)
+	    retval = swap_index_add(gap, p, type == '+', ino);
+    }
+    vim_free(line);
+    vim_free(prefix_len);
+    fclose(fp);
+
+    if (STRCMP(last_mtime, mtime) != 0 || records > live * 3 + 1000)
+	retval = FAIL;
+    if (retval == OK)
+	swap_index_live(gap);
+    return retval;
+}
+
+/*
+ * Scan directory "dir_name" for swap files and add them to "gap".  "dir" is
+ * the directory name with environment variables expanded, "mtime" the time
+ * it was changed before the scan as put by swap_index_time().
+ * The index is only written when "mtime" is not NULL, otherwise a change made
+ * during the scan might go unnoticed.
+ */
+    static int
+swap_index_scan(dir_name, dir, mtime, gap)
+    char_u	*dir_name;
+    char_u	*dir;
+    char_u	*mtime;
+    garray_T	*gap;
+{
+    char_u	*(pats[3]);
+    char_u	**files;
+    int		num_files;
+    char_u	*tail;
+    swapidx_T	*si;
+    struct stat	st;
+    garray_T	ga;
+    int		fd;
+    int		i;
+    int		retval = OK;
+
+    pats[0] = concat_fnames(dir_name, (char_u *)"*.sw?", TRUE);
+    pats[1] = concat_fnames(dir_name, (char_u *)".*.sw?", TRUE);
+    pats[2] = concat_fnames(dir_name, (char_u *)".sw?", TRUE);
+    if (pats[0] == NULL || pats[1] == NULL || pats[2] == NULL
+	    || expand_wildcards(3, pats, &num_files, &files,
+					EW_KEEPALL|EW_FILE|EW_SILENT) == FAIL)
+	num_files = 0;
+    for (i = 0; i < 3; ++i)
+	vim_free(pats[i]);
+
+    for (i = 0; i < num_files && retval == OK; ++i)
+    {
+	tail = gettail(files[i]);
+	if (mch_stat((char *)files[i], &st) >= 0
+					   && vim_strchr(tail, '\n') == NULL)
+	    retval = swap_index_add(gap, tail, TRUE, (long)st.st_ino);
+    }
+    if (num_files > 0)
+	FreeWild(num_files, files);
+    if (retval == FAIL)
+	return FAIL;
+    swap_index_live(gap);
+    if (mtime == NULL)
+	return OK;
+
+    /* Write the index with one record for every swap file and a last record
+     * with the time the directory was changed before scanning.  When a swap
+     * file was created or deleted since then the time does not match. */
+    ga_init2(&ga, 1, 1000);
+    for (i = 0; i < gap->ga_len; ++i)
+    {
+	si = ((swapidx_T **)gap->ga_data)[i];
+	if (ga_grow(&ga, (int)STRLEN(si->si_name) + 80) == FAIL)
+	    break;
+	sprintf((char *)ga.ga_data + ga.ga_len, "+%ld %ld %s %s\n",
+			   mch_get_pid(), si->si_ino, mtime, si->si_name);
+	ga.ga_len += (int)STRLEN((char_u *)ga.ga_data + ga.ga_len);
+    }
+    if (i == gap->ga_len && ga_grow(&ga, 80) == OK)
+    {
+	sprintf((char *)ga.ga_data + ga.ga_len, "=%ld 0 %s\n",
+						       mch_get_pid(), mtime);
+	ga.ga_len += (int)STRLEN((char_u *)ga.ga_data + ga.ga_len);
+
+	fd = swap_index_open(dir, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+	if (fd >= 0)
+	{
+	    (void)write_eintr(fd, ga.ga_data, (size_t)ga.ga_len);
+	    close(fd);
+	}
+    }
+    ga_clear(&ga);
+    return OK;
+}
+
+/*
+ * Find the swap files matching the patterns "names[num_names]" in directory
+ * "dir_name", using the swap file index when it is valid.  The result is
+ * like what expand_wildcards() returns.
+ * Returns FAIL when the directory can't be found, "files" is not set then.
+ */
+    static int
+swap_index_expand(dir_name, num_names, names, num_files, files)
+    char_u	*dir_name;
+    int		num_names;
+    char_u	**names;
+    int		*num_files;
+    char_u	***files;
+{
+    char_u	*dir;
+    char_u	**pats;
+    char_u	*fname;
+    struct stat	st;
+    char_u	mtime[SWAP_INDEX_TIME_LEN];
+    garray_T	idx;
+    swapidx_T	*si;
+    regmatch_T	regmatch;
+    garray_T	ga;
+    int		use_index;
+    int		start;
+    int		i;
+    int		j;
+    int		retval = OK;
+
+    dir = expand_env_save(dir_name);
+    pats = (char_u **)alloc((unsigned)(num_names * sizeof(char_u *)));
+    if (dir == NULL || pats == NULL || mch_stat((char *)dir, &st) < 0
+						       || !S_ISDIR(st.st_mode))
+    {
+	vim_free(dir);
+	vim_free(pats);
+	return FAIL;
+    }
+    for (i = 0; i < num_names; ++i)
+	pats[i] = gettail(names[i]);
+
+    ga_init2(&idx, (int)sizeof(swapidx_T *), 100);
+    use_index = (swap_index_time(&st, mtime) == OK
+	      && swap_index_read(dir, mtime, num_names, pats, &idx) == OK);
+    ga_init2(&ga, (int)sizeof(char_u *), 10);
+    for (;;)
+    {
+	if (!use_index)
+	{
+	    ga_clear_strings(&idx);
+	    if (mch_stat((char *)dir, &st) < 0
+		    || swap_index_scan(dir_name, dir,
+			 swap_index_time(&st, mtime) == OK ? mtime : NULL,
+							       &idx) == FAIL)
+		retval = FAIL;
+	}
+
+	for (i = 0; i < num_names && retval == OK; ++i)
+	{
+	    start = ga.ga_len;
+	    fname = file_pat_to_reg_pat(pats[i], NULL, NULL, FALSE);
+	    if (fname == NULL)
+	    {
+		retval = FAIL;
+		break;
+	    }
+	    regmatch.regprog = vim_regcomp(fname, RE_MAGIC);
+	    regmatch.rm_ic = p_fic;
+	    vim_free(fname);
+	    if (regmatch.regprog == NULL)
+		continue;
+
+	    /* Names starting with a dot only match a pattern starting with a
+	     * dot, like with expand_wildcards(). */
+	    for (j = 0; j < idx.ga_len && retval == OK; ++j)
+	    {
+		si = ((swapidx_T **)idx.ga_data)[j];
+		if ((si->si_name[0] == '.' && *pats[i] != '.')
+			  || !vim_regexec(&regmatch, si->si_name, (colnr_T)0))
+		    continue;
+		fname = concat_fnames(dir, si->si_name, TRUE);
+		if (fname == NULL || ga_grow(&ga, 1) == FAIL
+			|| (use_index && (mch_stat((char *)fname, &st) < 0
+					     || (long)st.st_ino != si->si_ino)))
+		{
+		    vim_free(fname);
+		    retval = FAIL;
+		}
+		else
+		    ((char_u **)ga.ga_data)[ga.ga_len++] = fname;
+	    }
+	    vim_regfree(regmatch.regprog);
+	    if (ga.ga_len > start)
+		sort_strings((char_u **)ga.ga_data + start, ga.ga_len - start);
+	}
+	if (retval == OK || !use_index)
+	    break;
+
+	/* A swap file in the index was deleted or replaced, the index is out
+	 * of date after all.  Scan the directory. */
+	ga_clear_strings(&ga);
+	use_index = FALSE;
+	retval = OK;
+    }
+    ga_clear_strings(&idx);
+    vim_free(pats);
+    vim_free(dir);
+
+    if (retval == FAIL || ga.ga_len == 0)
+    {
+	ga_clear_strings(&ga);
+	*num_files = 0;
+	return retval;
+    }
+    *num_files = ga.ga_len;
+    *files = (char_u **)ga.ga_data;
+    return OK;
+}
+#endif
+
 #if (defined(UNIX) || defined(__EMX__) || defined(VMS)) && (defined(FEAT_GUI_DIALOG) || defined(FEAT_CON_DIALOG))
 static int process_still_running;
 #endif
@@ -2270,8 +2887,9 @@ ml_sync_all(check_file, check_char)
 	}
 	if (buf->b_ml.ml_mfp->mf_dirty)
 	{
-	    (void)mf_sync(buf->b_ml.ml_mfp, (check_char ? MFS_STOP : 0)
-					| (bufIsChanged(buf) ? MFS_FLUSH : 0));
+	    (void)mf_sync(buf->b_ml.ml_mfp,
+				       (check_char ? MFS_STOP | MFS_ASYNC : 0)
+				       | (bufIsChanged(buf) ? MFS_FLUSH : 0));
 	    if (check_char && ui_char_avail())	/* character available now */
 		break;
 	}
@@ -2488,6 +3106,56 @@ errorret:
     return buf->b_ml.ml_line_ptr;
 }
 
+/*
+ * Get the text of lines "lnum" to "lnum_max" of "buf" that are in the same
+ * data block as "lnum", at most "maxcount" of them.  Pointers to the text go
+ * in "lines[]" and the lengths, without the NUL, in "lens[]".  The text stays
+ * valid until the next ml_ function is used for "buf".
+ * Returns the number of lines, zero when "lnum" can't be found.
+ */
+    int
+ml_get_buf_lines(buf, lnum, lnum_max, maxcount, lines, lens)
+    buf_T	*buf;
+    linenr_T	lnum;
+    linenr_T	lnum_max;
+    int		maxcount;
+    char_u	**lines;
+    colnr_T	*lens;
+{
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    unsigned	start;
+    unsigned	end;
+    int		idx;
+    int		count;
+
+    if (lnum < 1 || lnum > buf->b_ml.ml_line_count
+						  || buf->b_ml.ml_mfp == NULL)
+	return 0;
+    /* A changed line must be put in its block first. */
+    ml_flush_line(buf);
+    if ((hp = ml_find_line(buf, lnum, ML_FIND)) == NULL)
+	return 0;
+    dp = (DATA_BL *)(hp->bh_data);
+
+    if (lnum_max > buf->b_ml.ml_locked_high)
+	lnum_max = buf->b_ml.ml_locked_high;
+    idx = lnum - buf->b_ml.ml_locked_low;
+    for (count = 0; count < maxcount && lnum + count <= lnum_max; ++count)
+    {
+	/* The text of a line ends where the one of the line before it
+	 * starts, the first one at the end of the block. */
+	start = dp->db_index[idx + count] & DB_INDEX_MASK;
+	if (idx + count == 0)
+	    end = dp->db_txt_end;
+	else
+	    end = dp->db_index[idx + count - 1] & DB_INDEX_MASK;
+	lines[count] = (char_u *)dp + start;
+	lens[count] = (colnr_T)(end - start - 1);
+    }
+    return count;
+}
+
 /*
  * Check if a line that was just obtained by a call to ml_get
  * is in allocated memory.
@@ -2526,7 +3194,7 @@ ml_append(lnum, line, len, newfile)
     return ml_append_int(curbuf, lnum, line, len, newfile, FALSE);
 }
 
-#if defined(FEAT_SPELL) || defined(PROTO)
+#if defined(FEAT_SPELL) || defined(FEAT_PROGRESSIVE_LOAD) || defined(PROTO)
 /*
  * Like ml_append() but for an arbitrary buffer.  The buffer must already have
  * a memline.
@@ -2548,9 +3216,517 @@ ml_append_buf(buf, lnum, line, len, newfile)
 }
 #endif
 
-    static int
-ml_append_int(buf, lnum, line, len, newfile, mark)
-    buf_T	*buf;
+/*
+ * Append "count" lines after line "lnum" of buffer "buf" (may be 0 to insert
+ * in front of the first line).  "lines[]" has the text of the lines and
+ * "lens[]" the length of each, including the NUL.  "lens" can be NULL.
+ * "newfile" is like for ml_append().
+ *
+ * Instead of inserting the lines one at a time, which updates the pointer
+ * blocks for every line and splits data blocks over and over, the text is
+ * copied into new data blocks and the pointer blocks are changed once,
+ * bottom-up.  When the lines fit in the data block they are inserted one by
+ * one, that is cheaper.
+ * Check: The caller of this function should probably also call
+ * appended_lines_mark().
+ *
+ * Returns the number of lines appended, less than "count" for failure.
+ */
+    long
+ml_append_lines(buf, lnum, lines, lens, count, newfile)
+    buf_T	*buf;
+    linenr_T	lnum;		/* append after this line (can be 0) */
+    char_u	**lines;	/* text of the new lines */
+    colnr_T	*lens;		/* lengths of the new lines, or NULL */
+    long	count;		/* number of lines */
+    int		newfile;	/* flag, see ml_append() */
+{
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+    bhdr_T	*hp_new = NULL;
+    DATA_BL	*dp;
+    garray_T	ga;
+    mlentry_T	*me;
+    long	space;
+    long	room;
+    long	byteadd;
+    int		lineadd;
+    int		line_count;
+    int		db_idx;
+    int		data_moved = 0;
+    int		lines_moved = 0;
+    int		nfill = 0;
+    int		i;
+    long	l;
+    colnr_T	len;
+    unsigned	start, end;
+
+    if (count <= 0)
+	return 0;
+
+    /* When starting up, we might still need to create the memfile */
+    if (buf->b_ml.ml_mfp == NULL
+		    && (buf != curbuf || open_buffer(FALSE, NULL, 0) == FAIL))
+	return 0;
+    if (lnum > buf->b_ml.ml_line_count)
+	return 0;
+    if (buf->b_ml.ml_line_lnum != 0)
+	ml_flush_line(buf);
+
+    mfp = buf->b_ml.ml_mfp;
+    if ((hp = ml_find_line(buf, lnum == 0 ? (linenr_T)1 : lnum,
+							     ML_FIND)) == NULL)
+	return 0;
+    dp = (DATA_BL *)(hp->bh_data);
+    line_count = dp->db_line_count;
+    if (lnum == 0)		/* got line one instead, correct db_idx */
+	db_idx = -1;		/* careful, it is negative! */
+    else
+	db_idx = lnum - buf->b_ml.ml_locked_low;
+
+    /* When the lines fit in the block insert them one by one. */
+    space = 0;
+    for (l = 0; l < count && space <= (long)dp->db_free; ++l)
+	space += (lens == NULL ? (long)STRLEN(lines[l]) + 1 : (long)lens[l])
+								 + INDEX_SIZE;
+    if (space <= (long)dp->db_free)
+    {
+	for (l = 0; l < count; ++l)
+	    if (ml_append_int(buf, lnum + l, lines[l],
+			     lens == NULL ? (colnr_T)0 : lens[l], newfile,
+							       FALSE) == FAIL)
+		break;
+	return l;
+    }
+
+    if (lowest_marked && lowest_marked > lnum)
+	lowest_marked = lnum + 1;
+
+    /*
+     * The lines after "lnum" in the block are moved to after the new lines.
+     * The first new lines go in the space that leaves, the others in new
+     * blocks.  When inserting in front of the first line the block stays
+     * as it is.
+     */
+    if (db_idx >= 0)
+    {
+	lines_moved = line_count - db_idx - 1;
+	data_moved = ((dp->db_index[db_idx]) & DB_INDEX_MASK)
+							   - dp->db_txt_start;
+	room = dp->db_free + data_moved + lines_moved * INDEX_SIZE;
+	for (space = 0; nfill < count; ++nfill)
+	{
+	    space += (lens == NULL ? (long)STRLEN(lines[nfill]) + 1
+					: (long)lens[nfill]) + INDEX_SIZE;
+	    if (space > room)
+		break;
+	}
+    }
+
+    /* The block itself is the first entry, lines after it keep their
+     * place. */
+    ga_init2(&ga, (int)sizeof(mlentry_T), 100);
+    if (db_idx >= 0)
+    {
+	if (ga_grow(&ga, 1) == FAIL)
+	    return 0;
+	++ga.ga_len;
+    }
+    byteadd = 0;
+    for (l = nfill; l < count; ++l)
+    {
+	len = lens == NULL ? (colnr_T)STRLEN(lines[l]) + 1 : lens[l];
+	if (ml_pack_line(buf, &ga, &hp_new, lines[l], len, 0,
+				 (linenr_T)(lnum + 1 + l), newfile) == FAIL)
+	    goto fail;
+	byteadd += len;
+    }
+    for (i = db_idx + 1; i < db_idx + 1 + lines_moved; ++i)
+    {
+	start = dp->db_index[i] & DB_INDEX_MASK;
+	end = i == 0 ? dp->db_txt_end : dp->db_index[i - 1] & DB_INDEX_MASK;
+	if (ml_pack_line(buf, &ga, &hp_new, (char_u *)dp + start,
+		    (colnr_T)(end - start), dp->db_index[i] & DB_MARKED,
+			      (linenr_T)(lnum + count + i - db_idx), newfile)
+								      == FAIL)
+	    goto fail;
+    }
+    if (hp_new != NULL && ml_pack_close(mfp, &ga, &hp_new,
+			   (linenr_T)(lnum + count + lines_moved + 1)) == FAIL)
+	goto fail;
+
+    /* Now that the lines have been copied the block can be changed. */
+    if (db_idx >= 0)
+    {
+	dp->db_txt_start += data_moved;
+	dp->db_free += data_moved + lines_moved * INDEX_SIZE;
+	dp->db_line_count = db_idx + 1;
+	for (l = 0; l < nfill; ++l)
+	{
+	    len = lens == NULL ? (colnr_T)STRLEN(lines[l]) + 1 : lens[l];
+	    ml_pack_text(dp, lines[l], len, 0);
+	    byteadd += len;
+	}
+	buf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+	if (!newfile)
+	    buf->b_ml.ml_flags |= ML_LOCKED_POS;
+    }
+    else if (ga_grow(&ga, 1) == FAIL)
+	goto fail;
+    else
+	++ga.ga_len;
+
+    me = (mlentry_T *)ga.ga_data + (db_idx >= 0 ? 0 : ga.ga_len - 1);
+    me->me_pe.pe_bnum = hp->bh_bnum;
+    me->me_pe.pe_page_count = hp->bh_page_count;
+    me->me_pe.pe_line_count = dp->db_line_count;
+    me->me_pe.pe_old_lnum = 0;	/* keep the old one */
+    me->me_bytes = dp->db_txt_end - dp->db_txt_start;
+
+    /*
+     * Release the data block and replace its entry in the pointer block.
+     * The lines added to it before are included in the line and byte counts
+     * for the blocks above.
+     */
+    lineadd = buf->b_ml.ml_locked_lineadd + (int)count;
+    buf->b_ml.ml_locked_lineadd = 0;
+#ifdef FEAT_BYTEOFF
+    byteadd += buf->b_ml.ml_locked_byteadd;
+    buf->b_ml.ml_locked_byteadd = 0;
+#endif
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+
+    buf->b_ml.ml_line_count += count;
+    buf->b_ml.ml_flags &= ~ML_EMPTY;
+    i = ml_insert_entries(buf, &ga, lineadd, byteadd);
+    ga_clear(&ga);
+    if (i == FAIL)
+	return 0;
+
+#ifdef FEAT_NETBEANS_INTG
+    if (netbeans_active())
+	for (l = 0; l < count; ++l)
+	{
+	    len = (colnr_T)STRLEN(lines[l]);
+	    if (len > 0)
+		netbeans_inserted(buf, lnum + 1 + l, (colnr_T)0, lines[l], len);
+	    netbeans_inserted(buf, lnum + 1 + l, len, (char_u *)"\n", 1);
+	}
+#endif
+    return count;
+
+fail:
+    /* Out of memory, free the new blocks, nothing was changed. */
+    if (hp_new != NULL)
+	mf_free(mfp, hp_new);
+    for (i = db_idx >= 0 ? 1 : 0; i < ga.ga_len; ++i)
+    {
+	me = (mlentry_T *)ga.ga_data + i;
+	if ((hp_new = mf_get(mfp, mf_trans_del(mfp, me->me_pe.pe_bnum),
+					     me->me_pe.pe_page_count)) != NULL)
+	    mf_free(mfp, hp_new);
+    }
+    ga_clear(&ga);
+    return 0;
+}
+
+/*
+ * Add line "line" with length "len" after the last line in data block "dp".
+ * There must be room for it.
+ */
+    static void
+ml_pack_text(dp, line, len, mark)
+    DATA_BL	*dp;
+    char_u	*line;
+    colnr_T	len;
+    unsigned	mark;		/* DB_MARKED or zero */
+{
+    dp->db_txt_start -= len;
+    dp->db_free -= len + INDEX_SIZE;
+    dp->db_index[dp->db_line_count++] = dp->db_txt_start | mark;
+    mch_memmove((char *)dp + dp->db_txt_start, line, (size_t)len);
+}
+
+/*
+ * Add line "line" to the new data block "*hpp" that ml_append_lines() is
+ * filling.  When it doesn't fit the block is closed and a new one started.
+ * "lnum" is the number the line will get.
+ * Returns FAIL when out of memory.
+ */
+    static int
+ml_pack_line(buf, gap, hpp, line, len, mark, lnum, newfile)
+    buf_T	*buf;
+    garray_T	*gap;
+    bhdr_T	**hpp;
+    char_u	*line;
+    colnr_T	len;
+    unsigned	mark;
+    linenr_T	lnum;
+    int		newfile;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    int		page_size = mfp->mf_page_size;
+
+    if (*hpp != NULL && (long)((DATA_BL *)(*hpp)->bh_data)->db_free
+						       < (long)(len + INDEX_SIZE)
+	    && ml_pack_close(mfp, gap, hpp, lnum) == FAIL)
+	return FAIL;
+    if (*hpp == NULL && (*hpp = ml_new_data(mfp, newfile,
+			(int)((len + INDEX_SIZE + HEADER_SIZE + page_size - 1)
+							/ page_size))) == NULL)
+	return FAIL;
+    ml_pack_text((DATA_BL *)(*hpp)->bh_data, line, len, mark);
+    return OK;
+}
+
+/*
+ * Release the data block "*hpp" and add an entry for it to "gap".  "lnum" is
+ * the number of the line after the last line in the block.
+ * Returns FAIL when out of memory, the block is freed then.
+ */
+    static int
+ml_pack_close(mfp, gap, hpp, lnum)
+    memfile_T	*mfp;
+    garray_T	*gap;
+    bhdr_T	**hpp;
+    linenr_T	lnum;
+{
+    bhdr_T	*hp = *hpp;
+    DATA_BL	*dp = (DATA_BL *)(hp->bh_data);
+    mlentry_T	*me;
+
+    *hpp = NULL;
+    if (ga_grow(gap, 1) == FAIL)
+    {
+	mf_free(mfp, hp);
+	return FAIL;
+    }
+    me = (mlentry_T *)gap->ga_data + gap->ga_len++;
+    me->me_pe.pe_bnum = hp->bh_bnum;
+    me->me_pe.pe_page_count = hp->bh_page_count;
+    me->me_pe.pe_line_count = dp->db_line_count;
+    me->me_pe.pe_old_lnum = lnum - dp->db_line_count;
+    me->me_bytes = dp->db_txt_end - dp->db_txt_start;
+    mf_put(mfp, hp, TRUE, FALSE);
+    return OK;
+}
+
+/*
+ * Put the entries in "gap" in as few pointer blocks as possible, spread
+ * evenly.  The first one is "hp" when not NULL, its entry in the level above
+ * is kept, the others are new.  "gap" is changed to have the entries for the
+ * level above.
+ * Returns FAIL when out of memory.
+ */
+    static int
+ml_pack_ptr(mfp, gap, hp)
+    memfile_T	*mfp;
+    garray_T	*gap;
+    bhdr_T	*hp;
+{
+    mlentry_T	*me = (mlentry_T *)gap->ga_data;
+    mlentry_T	*ue;
+    garray_T	up;
+    PTR_BL	*pp;
+    int		max = PB_COUNT_MAX(mfp);
+    int		nblocks = (gap->ga_len + max - 1) / max;
+    int		reuse = hp != NULL;
+    int		from, to;
+    int		b, i;
+
+    ga_init2(&up, (int)sizeof(mlentry_T), nblocks);
+    if (ga_grow(&up, nblocks) == FAIL)
+    {
+	if (hp != NULL)
+	    mf_put(mfp, hp, FALSE, FALSE);
+	return FAIL;
+    }
+    for (b = 0, from = 0; b < nblocks; ++b, from = to)
+    {
+	to = (int)((long)gap->ga_len * (b + 1) / nblocks);
+	if (hp == NULL && (hp = ml_new_ptr(mfp)) == NULL)
+	{
+	    ga_clear(&up);
+	    return FAIL;
+	}
+	pp = (PTR_BL *)(hp->bh_data);
+	ue = (mlentry_T *)up.ga_data + up.ga_len++;
+	ue->me_pe.pe_bnum = hp->bh_bnum;
+	ue->me_pe.pe_page_count = 1;
+	ue->me_pe.pe_line_count = 0;
+	ue->me_pe.pe_old_lnum = (b == 0 && reuse) ? 0
+						  : me[from].me_pe.pe_old_lnum;
+	ue->me_bytes = 0;
+	pp->pb_count = to - from;
+	for (i = from; i < to; ++i)
+	{
+	    pp->pb_pointer[i - from] = me[i].me_pe;
+#ifdef FEAT_BYTEOFF
+	    PB_BYTES(pp)[i - from] = me[i].me_bytes;
+#endif
+	    ue->me_pe.pe_line_count += me[i].me_pe.pe_line_count;
+	    ue->me_bytes += me[i].me_bytes;
+	}
+	mf_put(mfp, hp, TRUE, FALSE);
+	hp = NULL;
+    }
+    ga_clear(gap);
+    *gap = up;
+    return OK;
+}
+
+/*
+ * Replace the entry for the locked block in the lowest pointer block on the
+ * stack with the entries in "gap".  When they don't fit the pointer block is
+ * split in as many as needed and the entries for those replace its entry in
+ * the level above, and so on.  When the root does not have room the tree
+ * gets another level.
+ * "lineadd" and "byteadd" are added to the blocks above the last one
+ * changed.
+ * Returns FAIL when out of memory, the tree is broken then.
+ */
+    static int
+ml_insert_entries(buf, gap, lineadd, byteadd)
+    buf_T	*buf;
+    garray_T	*gap;
+    int		lineadd;
+    long	byteadd;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    infoptr_T	*ip;
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    mlentry_T	*me;
+    mlentry_T	*ae;
+    garray_T	all;
+    int		stack_idx;
+    int		idx;
+    int		n;
+    int		i;
+
+    for (stack_idx = buf->b_ml.ml_stack_top - 1; stack_idx >= 0; --stack_idx)
+    {
+	ip = &(buf->b_ml.ml_stack[stack_idx]);
+	idx = ip->ip_index;
+	if ((hp = mf_get(mfp, ip->ip_bnum, 1)) == NULL)
+	    return FAIL;
+	pp = (PTR_BL *)(hp->bh_data);	/* must be pointer block */
+	if (pp->pb_id != PTR_ID)
+	{
+	    EMSG(_("E317: pointer block id wrong 3"));
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    return FAIL;
+	}
+
+	/* A zero pe_old_lnum means keeping the one of the replaced entry. */
+	me = (mlentry_T *)gap->ga_data;
+	for (i = 0; i < gap->ga_len; ++i)
+	    if (me[i].me_pe.pe_old_lnum == 0)
+		me[i].me_pe.pe_old_lnum = pp->pb_pointer[idx].pe_old_lnum;
+
+	n = pp->pb_count - 1 + gap->ga_len;
+	if (n <= (int)pp->pb_count_max)
+	{
+	    /* The entries fit in the block. */
+	    mch_memmove(&pp->pb_pointer[idx + gap->ga_len],
+			&pp->pb_pointer[idx + 1],
+			   (size_t)(pp->pb_count - idx - 1) * sizeof(PTR_EN));
+#ifdef FEAT_BYTEOFF
+	    mch_memmove(&PB_BYTES(pp)[idx + gap->ga_len],
+			&PB_BYTES(pp)[idx + 1],
+			     (size_t)(pp->pb_count - idx - 1) * sizeof(long));
+#endif
+	    for (i = 0; i < gap->ga_len; ++i)
+	    {
+		pp->pb_pointer[idx + i] = me[i].me_pe;
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[idx + i] = me[i].me_bytes;
+#endif
+	    }
+	    pp->pb_count = n;
+	    mf_put(mfp, hp, TRUE, FALSE);
+	    buf->b_ml.ml_stack_top = stack_idx + 1;	    /* truncate stack */
+
+	    if (lineadd || byteadd)
+	    {
+		--(buf->b_ml.ml_stack_top);
+		/* fix line count for rest of blocks in the stack */
+		ml_lineadd(buf, lineadd, byteadd);
+							/* fix stack itself */
+		buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high += lineadd;
+		++(buf->b_ml.ml_stack_top);
+	    }
+	    return OK;
+	}
+
+	/*
+	 * Make a list of all the entries of the block with the new ones in
+	 * the place of the old one.
+	 */
+	ga_init2(&all, (int)sizeof(mlentry_T), n);
+	if (ga_grow(&all, n) == FAIL)
+	{
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    return FAIL;
+	}
+	for (i = 0; i < (int)pp->pb_count; ++i)
+	{
+	    if (i == idx)
+	    {
+		mch_memmove((mlentry_T *)all.ga_data + all.ga_len, me,
+				      (size_t)gap->ga_len * sizeof(mlentry_T));
+		all.ga_len += gap->ga_len;
+		continue;
+	    }
+	    ae = (mlentry_T *)all.ga_data + all.ga_len++;
+	    ae->me_pe = pp->pb_pointer[i];
+#ifdef FEAT_BYTEOFF
+	    ae->me_bytes = PB_BYTES(pp)[i];
+#else
+	    ae->me_bytes = 0;
+#endif
+	}
+	ga_clear(gap);
+	*gap = all;
+
+	if (hp->bh_bnum == 1)
+	{
+	    /* The root must stay block 1, move the entries to new blocks
+	     * until they fit in it.  That adds levels to the tree. */
+	    while (gap->ga_len > (int)pp->pb_count_max)
+		if (ml_pack_ptr(mfp, gap, NULL) == FAIL)
+		{
+		    mf_put(mfp, hp, FALSE, FALSE);
+		    return FAIL;
+		}
+	    me = (mlentry_T *)gap->ga_data;
+	    for (i = 0; i < gap->ga_len; ++i)
+	    {
+		pp->pb_pointer[i] = me[i].me_pe;
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[i] = me[i].me_bytes;
+#endif
+	    }
+	    pp->pb_count = gap->ga_len;
+	    mf_put(mfp, hp, TRUE, FALSE);
+	    buf->b_ml.ml_stack_top = 0;		/* invalidate stack */
+	    return OK;
+	}
+
+	/* Spread the entries over this block and new ones, their entries
+	 * replace the one for this block in the level above. */
+	if (ml_pack_ptr(mfp, gap, hp) == FAIL)
+	    return FAIL;
+    }
+
+    EMSG(_("E318: Updated too many blocks?"));
+    buf->b_ml.ml_stack_top = 0;		/* invalidate stack */
+    return FAIL;
+}
+
+    static int
+ml_append_int(buf, lnum, line, len, newfile, mark)
+    buf_T	*buf;
     linenr_T	lnum;		/* append after this line (can be 0) */
     char_u	*line;		/* text of the new line */
     colnr_T	len;		/* length of line, including NUL, or 0 */
@@ -2681,6 +3857,9 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	buf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
 	if (!newfile)
 	    buf->b_ml.ml_flags |= ML_LOCKED_POS;
+#ifdef FEAT_BYTEOFF
+	buf->b_ml.ml_locked_byteadd += len;
+#endif
     }
     else	    /* not enough space in data block */
     {
@@ -2694,6 +3873,10 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
  * ml_find_line().
  */
 	long	    line_count_left, line_count_right;
+#ifdef FEAT_BYTEOFF
+	long	    bytes_left, bytes_right;
+#endif
+	long	    byteadd = 0;
 	int	    page_count_left, page_count_right;
 	bhdr_T	    *hp_left;
 	bhdr_T	    *hp_right;
@@ -2848,6 +4031,10 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	}
 	dp_left->db_line_count = line_count_left;
 	dp_right->db_line_count = line_count_right;
+#ifdef FEAT_BYTEOFF
+	bytes_left = dp_left->db_txt_end - dp_left->db_txt_start;
+	bytes_right = dp_right->db_txt_end - dp_right->db_txt_start;
+#endif
 
 	/*
 	 * release the two data blocks
@@ -2868,6 +4055,10 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	 */
 	lineadd = buf->b_ml.ml_locked_lineadd;
 	buf->b_ml.ml_locked_lineadd = 0;
+#ifdef FEAT_BYTEOFF
+	byteadd = buf->b_ml.ml_locked_byteadd + len;
+	buf->b_ml.ml_locked_byteadd = 0;
+#endif
 	ml_find_line(buf, (linenr_T)0, ML_FLUSH);   /* flush data block */
 
 	/*
@@ -2895,9 +4086,16 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	    if (pp->pb_count < pp->pb_count_max)
 	    {
 		if (pb_idx + 1 < (int)pp->pb_count)
+		{
 		    mch_memmove(&pp->pb_pointer[pb_idx + 2],
 				&pp->pb_pointer[pb_idx + 1],
 			(size_t)(pp->pb_count - pb_idx - 1) * sizeof(PTR_EN));
+#ifdef FEAT_BYTEOFF
+		    mch_memmove(&PB_BYTES(pp)[pb_idx + 2],
+				&PB_BYTES(pp)[pb_idx + 1],
+			  (size_t)(pp->pb_count - pb_idx - 1) * sizeof(long));
+#endif
+		}
 		++pp->pb_count;
 		pp->pb_pointer[pb_idx].pe_line_count = line_count_left;
 		pp->pb_pointer[pb_idx].pe_bnum = bnum_left;
@@ -2905,6 +4103,10 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		pp->pb_pointer[pb_idx + 1].pe_line_count = line_count_right;
 		pp->pb_pointer[pb_idx + 1].pe_bnum = bnum_right;
 		pp->pb_pointer[pb_idx + 1].pe_page_count = page_count_right;
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[pb_idx] = bytes_left;
+		PB_BYTES(pp)[pb_idx + 1] = bytes_right;
+#endif
 
 		if (lnum_left != 0)
 		    pp->pb_pointer[pb_idx].pe_old_lnum = lnum_left;
@@ -2914,11 +4116,11 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		mf_put(mfp, hp, TRUE, FALSE);
 		buf->b_ml.ml_stack_top = stack_idx + 1;	    /* truncate stack */
 
-		if (lineadd)
+		if (lineadd || byteadd)
 		{
 		    --(buf->b_ml.ml_stack_top);
 		    /* fix line count for rest of blocks in the stack */
-		    ml_lineadd(buf, lineadd);
+		    ml_lineadd(buf, lineadd, byteadd);
 							/* fix stack itself */
 		    buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high +=
 								      lineadd;
@@ -2977,6 +4179,11 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		    mch_memmove(&pp_new->pb_pointer[0],
 				&pp->pb_pointer[pb_idx + 1],
 				(size_t)(total_moved) * sizeof(PTR_EN));
+#ifdef FEAT_BYTEOFF
+		    mch_memmove(&PB_BYTES(pp_new)[0], &PB_BYTES(pp)[pb_idx + 1],
+					    (size_t)(total_moved) * sizeof(long));
+		    PB_BYTES(pp)[pb_idx + 1] = bytes_right;
+#endif
 		    pp_new->pb_count = total_moved;
 		    pp->pb_count -= total_moved - 1;
 		    pp->pb_pointer[pb_idx + 1].pe_bnum = bnum_right;
@@ -2992,12 +4199,18 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		    pp_new->pb_pointer[0].pe_line_count = line_count_right;
 		    pp_new->pb_pointer[0].pe_page_count = page_count_right;
 		    pp_new->pb_pointer[0].pe_old_lnum = lnum_right;
+#ifdef FEAT_BYTEOFF
+		    PB_BYTES(pp_new)[0] = bytes_right;
+#endif
 		}
 		pp->pb_pointer[pb_idx].pe_bnum = bnum_left;
 		pp->pb_pointer[pb_idx].pe_line_count = line_count_left;
 		pp->pb_pointer[pb_idx].pe_page_count = page_count_left;
 		if (lnum_left)
 		    pp->pb_pointer[pb_idx].pe_old_lnum = lnum_left;
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[pb_idx] = bytes_left;
+#endif
 		lnum_left = 0;
 		lnum_right = 0;
 
@@ -3010,6 +4223,14 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 		line_count_left = 0;
 		for (i = 0; i < (int)pp->pb_count; ++i)
 		    line_count_left += pp->pb_pointer[i].pe_line_count;
+#ifdef FEAT_BYTEOFF
+		bytes_right = 0;
+		for (i = 0; i < (int)pp_new->pb_count; ++i)
+		    bytes_right += PB_BYTES(pp_new)[i];
+		bytes_left = 0;
+		for (i = 0; i < (int)pp->pb_count; ++i)
+		    bytes_left += PB_BYTES(pp)[i];
+#endif
 
 		bnum_left = hp->bh_bnum;
 		bnum_right = hp_new->bh_bnum;
@@ -3030,10 +4251,6 @@ ml_append_int(buf, lnum, line, len, newfile, mark)
 	}
     }
 
-#ifdef FEAT_BYTEOFF
-    /* The line was inserted below 'lnum' */
-    ml_updatechunk(buf, lnum + 1, (long)len, ML_CHNK_ADDLINE);
-#endif
 #ifdef FEAT_NETBEANS_INTG
     if (netbeans_active())
     {
@@ -3216,18 +4433,28 @@ ml_delete_int(buf, lnum, message)
 	    else
 	    {
 		if (count != idx)	/* move entries after the deleted one */
+		{
 		    mch_memmove(&pp->pb_pointer[idx], &pp->pb_pointer[idx + 1],
 				      (size_t)(count - idx) * sizeof(PTR_EN));
+#ifdef FEAT_BYTEOFF
+		    mch_memmove(&PB_BYTES(pp)[idx], &PB_BYTES(pp)[idx + 1],
+					(size_t)(count - idx) * sizeof(long));
+#endif
+		}
 		mf_put(mfp, hp, TRUE, FALSE);
 
 		buf->b_ml.ml_stack_top = stack_idx;	/* truncate stack */
 		/* fix line count for rest of blocks in the stack */
+#ifdef FEAT_BYTEOFF
+		ml_lineadd(buf, buf->b_ml.ml_locked_lineadd,
+				     buf->b_ml.ml_locked_byteadd - line_size);
+		buf->b_ml.ml_locked_byteadd = 0;
+#else
 		if (buf->b_ml.ml_locked_lineadd != 0)
-		{
-		    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
-		    buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high +=
+		    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd, 0L);
+#endif
+		buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high +=
 						  buf->b_ml.ml_locked_lineadd;
-		}
 		++(buf->b_ml.ml_stack_top);
 
 		break;
@@ -3259,17 +4486,278 @@ ml_delete_int(buf, lnum, message)
 	 * mark the block dirty and make sure it is in the file (for recovery)
 	 */
 	buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
-    }
-
 #ifdef FEAT_BYTEOFF
-    ml_updatechunk(buf, lnum, line_size, ML_CHNK_DELLINE);
+	buf->b_ml.ml_locked_byteadd -= line_size;
 #endif
+    }
+
     return OK;
 }
 
 /*
- * set the B_MARKED flag for line 'lnum'
- */
+ * Delete "count" lines from line "lnum" in the current buffer.
+ *
+ * Deleting the lines one at a time changes the pointer blocks for every line.
+ * Here the lines are removed from the tree in one walk: data blocks and
+ * branches that only have deleted lines are freed, without reading the data
+ * blocks, and only the data blocks at the ends of the range are changed.
+ *
+ * Check: The caller of this function should probably also call
+ * deleted_lines() after this.
+ *
+ * return FAIL for failure, OK otherwise
+ */
+    int
+ml_delete_lines(lnum, count, message)
+    linenr_T	lnum;
+    long	count;
+    int		message;
+{
+    buf_T	*buf = curbuf;
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    PTR_EN	root;
+    blocknr_T	bnum;
+    int		page_count;
+    int		depth;
+    int		dirty;
+    int		all;
+    linenr_T	done;
+    long	bytes = 0;
+
+    if (lnum < 1 || lnum > buf->b_ml.ml_line_count || count <= 0)
+	return FAIL;
+    if (count > buf->b_ml.ml_line_count - lnum + 1)
+	count = buf->b_ml.ml_line_count - lnum + 1;
+    mfp = buf->b_ml.ml_mfp;
+    if (mfp == NULL)
+	return FAIL;
+    ml_flush_line(buf);
+
+    if (count == 1
+#ifdef FEAT_NETBEANS_INTG
+	    || netbeans_active()	/* netbeans wants to see every line */
+#endif
+       )
+    {
+	while (count-- > 0)
+	    if (ml_delete_int(buf, lnum, message) == FAIL)
+		return FAIL;
+	return OK;
+    }
+
+    /* When all lines go the last one is deleted separately, the buffer is
+     * left with one empty line then. */
+    all = (count == buf->b_ml.ml_line_count);
+    if (all)
+	--count;
+
+    /* Release the locked block, this updates the pointer blocks above it.
+     * The stack is invalid after the change. */
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+    buf->b_ml.ml_stack_top = 0;
+
+    /* All the data blocks are at the same depth in the tree, find out how
+     * many pointer blocks are above them. */
+    bnum = 1;
+    page_count = 1;
+    for (depth = 0; ; ++depth)
+    {
+	if ((hp = mf_get(mfp, bnum, page_count)) == NULL)
+	    return FAIL;
+	pp = (PTR_BL *)(hp->bh_data);
+	if (pp->pb_id != PTR_ID)
+	{
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    break;
+	}
+	dirty = FALSE;
+	bnum = pp->pb_pointer[0].pe_bnum;
+	page_count = pp->pb_pointer[0].pe_page_count;
+	if (bnum < 0 && (bnum = mf_trans_del(mfp, bnum))
+						 != pp->pb_pointer[0].pe_bnum)
+	{
+	    pp->pb_pointer[0].pe_bnum = bnum;
+	    dirty = TRUE;
+	}
+	mf_put(mfp, hp, dirty, FALSE);
+    }
+
+    root.pe_bnum = 1;
+    root.pe_page_count = 1;
+    root.pe_line_count = buf->b_ml.ml_line_count;
+    done = ml_delete_branch(mfp, &root, depth, lnum - 1,
+					      (linenr_T)(lnum + count - 2), &bytes);
+    buf->b_ml.ml_line_count -= done;
+    if (lowest_marked && lowest_marked > lnum)
+	lowest_marked -= lowest_marked - lnum < done
+						   ? lowest_marked - lnum : done;
+    if (done < count)
+	return FAIL;
+
+    if (all)
+	return ml_delete_int(buf, (linenr_T)1, message);
+    return OK;
+}
+
+/*
+ * Delete lines "first" to "last" of the branch that "pe" points to, counting
+ * from zero at the start of the branch.  Some lines of the branch must
+ * remain.  "depth" is the number of levels of pointer blocks in the branch,
+ * zero for a data block.  The number of text bytes deleted is added to
+ * "*bytesp".  Line and byte counts in "pe" are not changed.
+ * Returns the number of lines deleted, fewer than asked for when a block
+ * could not be read.
+ */
+    static linenr_T
+ml_delete_branch(mfp, pe, depth, first, last, bytesp)
+    memfile_T	*mfp;
+    PTR_EN	*pe;
+    int		depth;
+    linenr_T	first;
+    linenr_T	last;
+    long	*bytesp;
+{
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    PTR_BL	*pp;
+    PTR_EN	*cpe;
+    linenr_T	low;
+    linenr_T	t;
+    linenr_T	n;
+    linenr_T	done = 0;
+    unsigned	start, end;
+    long	size;
+    int		idx;
+    int		i;
+
+    if (pe->pe_bnum < 0)
+	pe->pe_bnum = mf_trans_del(mfp, pe->pe_bnum);
+    if ((hp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+	return 0;
+    dp = (DATA_BL *)(hp->bh_data);
+    pp = (PTR_BL *)(hp->bh_data);
+    if (depth == 0 ? dp->db_id != DATA_ID : pp->pb_id != PTR_ID)
+    {
+	EMSG(_("E317: pointer block id wrong 5"));
+	mf_put(mfp, hp, FALSE, FALSE);
+	return 0;
+    }
+
+    if (depth == 0)
+    {
+	/* Move the text of the lines after "last" to where the deleted text
+	 * ends and the indexes to after "first". */
+	start = dp->db_index[last] & DB_INDEX_MASK;
+	if (first == 0)
+	    end = dp->db_txt_end;
+	else
+	    end = dp->db_index[first - 1] & DB_INDEX_MASK;
+	size = end - start;
+	mch_memmove((char *)dp + dp->db_txt_start + size,
+			   (char *)dp + dp->db_txt_start,
+					    (size_t)(start - dp->db_txt_start));
+	n = last - first + 1;
+	for (i = last + 1; i < (int)dp->db_line_count; ++i)
+	    dp->db_index[i - n] = dp->db_index[i] + size;
+	dp->db_free += size + n * INDEX_SIZE;
+	dp->db_txt_start += size;
+	dp->db_line_count -= n;
+	*bytesp += size;
+
+	/* make sure it is in the file (for recovery) */
+	mf_put(mfp, hp, TRUE, TRUE);
+	return n;
+    }
+
+    low = 0;
+    for (idx = 0; idx < (int)pp->pb_count && low <= last; ++idx)
+    {
+	cpe = &pp->pb_pointer[idx];
+	t = cpe->pe_line_count;
+	if (low + t > first)
+	{
+	    if (first <= low && last >= low + t - 1)
+	    {
+		/* all lines of the branch go */
+		ml_free_branch(mfp, cpe->pe_bnum, cpe->pe_page_count,
+								    depth - 1);
+#ifdef FEAT_BYTEOFF
+		*bytesp += PB_BYTES(pp)[idx];
+#endif
+		n = t;
+	    }
+	    else
+	    {
+		size = 0;
+		n = ml_delete_branch(mfp, cpe, depth - 1,
+				  first > low ? first - low : 0,
+				  last < low + t - 1 ? last - low : t - 1, &size);
+		*bytesp += size;
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[idx] -= size;
+#endif
+	    }
+	    cpe->pe_line_count -= n;
+	    done += n;
+	}
+	low += t;
+    }
+
+    /* Remove the entries of the freed branches. */
+    for (i = idx = 0; idx < (int)pp->pb_count; ++idx)
+	if (pp->pb_pointer[idx].pe_line_count > 0)
+	{
+	    if (i != idx)
+	    {
+		pp->pb_pointer[i] = pp->pb_pointer[idx];
+#ifdef FEAT_BYTEOFF
+		PB_BYTES(pp)[i] = PB_BYTES(pp)[idx];
+#endif
+	    }
+	    ++i;
+	}
+    pp->pb_count = i;
+    mf_put(mfp, hp, TRUE, FALSE);
+    return done;
+}
+
+/*
+ * Free block "bnum" of "page_count" pages and, when "depth" is not zero, all
+ * the blocks below it.  Data blocks are freed without reading them.
+ */
+    static void
+ml_free_branch(mfp, bnum, page_count, depth)
+    memfile_T	*mfp;
+    blocknr_T	bnum;
+    int		page_count;
+    int		depth;
+{
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    int		idx;
+
+    if (depth == 0)
+    {
+	mf_free_nr(mfp, bnum, page_count);
+	return;
+    }
+    if (bnum < 0)
+	bnum = mf_trans_del(mfp, bnum);
+    if ((hp = mf_get(mfp, bnum, page_count)) == NULL)
+	return;
+    pp = (PTR_BL *)(hp->bh_data);
+    if (pp->pb_id == PTR_ID)
+	for (idx = 0; idx < (int)pp->pb_count; ++idx)
+	    ml_free_branch(mfp, pp->pb_pointer[idx].pe_bnum,
+				pp->pb_pointer[idx].pe_page_count, depth - 1);
+    mf_free(mfp, hp);
+}
+
+/*
+ * set the B_MARKED flag for line 'lnum'
+ */
     void
 ml_setmarked(lnum)
     linenr_T lnum;
@@ -3463,7 +4951,7 @@ ml_flush_line(buf)
 		buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
 #ifdef FEAT_BYTEOFF
 		/* The else case is already covered by the insert and delete */
-		ml_updatechunk(buf, lnum, (long)extra, ML_CHNK_UPDLINE);
+		buf->b_ml.ml_locked_byteadd += extra;
 #endif
 	    }
 	    else
@@ -3529,8 +5017,7 @@ ml_new_ptr(mfp)
     pp = (PTR_BL *)(hp->bh_data);
     pp->pb_id = PTR_ID;
     pp->pb_count = 0;
-    pp->pb_count_max = (short_u)((mfp->mf_page_size - sizeof(PTR_BL))
-							/ sizeof(PTR_EN) + 1);
+    pp->pb_count_max = PB_COUNT_MAX(mfp);
 
     return hp;
 }
@@ -3607,8 +5094,15 @@ ml_find_line(buf, lnum, action)
 	 * If lines have been added or deleted in the locked block, need to
 	 * update the line count in pointer blocks.
 	 */
+#ifdef FEAT_BYTEOFF
+	if (buf->b_ml.ml_locked_lineadd != 0
+				       || buf->b_ml.ml_locked_byteadd != 0)
+	    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd,
+						 buf->b_ml.ml_locked_byteadd);
+#else
 	if (buf->b_ml.ml_locked_lineadd != 0)
-	    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
+	    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd, 0L);
+#endif
     }
 
     if (action == ML_FLUSH)	    /* nothing else to do */
@@ -3662,6 +5156,9 @@ ml_find_line(buf, lnum, action)
 	    buf->b_ml.ml_locked_low = low;
 	    buf->b_ml.ml_locked_high = high;
 	    buf->b_ml.ml_locked_lineadd = 0;
+#ifdef FEAT_BYTEOFF
+	    buf->b_ml.ml_locked_byteadd = 0;
+#endif
 	    buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
 	    return hp;
 	}
@@ -3743,9 +5240,9 @@ error_noblock:
      * inserted/deleted after all.
      */
     if (action == ML_DELETE)
-	ml_lineadd(buf, 1);
+	ml_lineadd(buf, 1, 0L);
     else if (action == ML_INSERT)
-	ml_lineadd(buf, -1);
+	ml_lineadd(buf, -1, 0L);
     buf->b_ml.ml_stack_top = 0;
     return NULL;
 }
@@ -3793,11 +5290,13 @@ ml_add_stack(buf)
  * walking through the stack.
  *
  * Count is the number of lines added, negative if lines have been deleted.
+ * Bytes is the number of text bytes added, negative if the text got smaller.
  */
     static void
-ml_lineadd(buf, count)
+ml_lineadd(buf, count, bytes)
     buf_T	*buf;
     int		count;
+    long	bytes UNUSED;
 {
     int		idx;
     infoptr_T	*ip;
@@ -3818,6 +5317,9 @@ ml_lineadd(buf, count)
 	    break;
 	}
 	pp->pb_pointer[ip->ip_index].pe_line_count += count;
+#ifdef FEAT_BYTEOFF
+	PB_BYTES(pp)[ip->ip_index] += bytes;
+#endif
 	ip->ip_high += count;
 	mf_put(mfp, hp, TRUE, FALSE);
     }
@@ -4550,6 +6052,9 @@ findswapname(buf, dirp, old_fname)
 				break;
 			    case 4:
 				mch_remove(fname);
+#ifdef UNIX
+				ml_swap_index(fname, FALSE);
+#endif
 				break;
 			    case 5:
 				swap_exists_action = SEA_QUIT;
@@ -4777,21 +6282,18 @@ ml_setflags(buf)
 
     if (!buf->b_ml.ml_mfp)
 	return;
-    for (hp = buf->b_ml.ml_mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+    hp = mf_find_block(buf->b_ml.ml_mfp, (blocknr_T)0);
+    if (hp != NULL)
     {
-	if (hp->bh_bnum == 0)
-	{
-	    b0p = (ZERO_BL *)(hp->bh_data);
-	    b0p->b0_dirty = buf->b_changed ? B0_DIRTY : 0;
-	    b0p->b0_flags = (b0p->b0_flags & ~B0_FF_MASK)
+	b0p = (ZERO_BL *)(hp->bh_data);
+	b0p->b0_dirty = buf->b_changed ? B0_DIRTY : 0;
+	b0p->b0_flags = (b0p->b0_flags & ~B0_FF_MASK)
 						  | (get_fileformat(buf) + 1);
 #ifdef FEAT_MBYTE
-	    add_b0_fenc(b0p, buf);
+	add_b0_fenc(b0p, buf);
 #endif
-	    hp->bh_flags |= BH_DIRTY;
-	    mf_sync(buf->b_ml.ml_mfp, MFS_ZERO);
-	    break;
-	}
+	hp->bh_flags |= BH_DIRTY;
+	mf_sync(buf->b_ml.ml_mfp, MFS_ZERO);
     }
 }
 
@@ -4923,254 +6425,14 @@ ml_crypt_prepare(mfp, offset, reading)
 
 #if defined(FEAT_BYTEOFF) || defined(PROTO)
 
-#define MLCS_MAXL 800	/* max no of lines in chunk */
-#define MLCS_MINL 400   /* should be half of MLCS_MAXL */
-
-/*
- * Keep information for finding byte offset of a line, updtype may be one of:
- * ML_CHNK_ADDLINE: Add len to parent chunk, possibly splitting it
- *	   Careful: ML_CHNK_ADDLINE may cause ml_find_line() to be called.
- * ML_CHNK_DELLINE: Subtract len from parent chunk, possibly deleting it
- * ML_CHNK_UPDLINE: Add len to parent chunk, as a signed entity.
- */
-    static void
-ml_updatechunk(buf, line, len, updtype)
-    buf_T	*buf;
-    linenr_T	line;
-    long	len;
-    int		updtype;
-{
-    static buf_T	*ml_upd_lastbuf = NULL;
-    static linenr_T	ml_upd_lastline;
-    static linenr_T	ml_upd_lastcurline;
-    static int		ml_upd_lastcurix;
-
-    linenr_T		curline = ml_upd_lastcurline;
-    int			curix = ml_upd_lastcurix;
-    long		size;
-    chunksize_T		*curchnk;
-    int			rest;
-    bhdr_T		*hp;
-    DATA_BL		*dp;
-
-    if (buf->b_ml.ml_usedchunks == -1 || len == 0)
-	return;
-    if (buf->b_ml.ml_chunksize == NULL)
-    {
-	buf->b_ml.ml_chunksize = (chunksize_T *)
-				  alloc((unsigned)sizeof(chunksize_T) * 100);
-	if (buf->b_ml.ml_chunksize == NULL)
-	{
-	    buf->b_ml.ml_usedchunks = -1;
-	    return;
-	}
-	buf->b_ml.ml_numchunks = 100;
-	buf->b_ml.ml_usedchunks = 1;
-	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
-	buf->b_ml.ml_chunksize[0].mlcs_totalsize = 1;
-    }
-
-    if (updtype == ML_CHNK_UPDLINE && buf->b_ml.ml_line_count == 1)
-    {
-	/*
-	 * First line in empty buffer from ml_flush_line() -- reset
-	 */
-	buf->b_ml.ml_usedchunks = 1;
-	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
-	buf->b_ml.ml_chunksize[0].mlcs_totalsize =
-				  (long)STRLEN(buf->b_ml.ml_line_ptr) + 1;
-	return;
-    }
-
-    /*
-     * Find chunk that our line belongs to, curline will be at start of the
-     * chunk.
-     */
-    if (buf != ml_upd_lastbuf || line != ml_upd_lastline + 1
-	    || updtype != ML_CHNK_ADDLINE)
-    {
-	for (curline = 1, curix = 0;
-	     curix < buf->b_ml.ml_usedchunks - 1
-	     && line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	     curix++)
-	{
-	    curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	}
-    }
-    else if (line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines
-		 && curix < buf->b_ml.ml_usedchunks - 1)
-    {
-	/* Adjust cached curix & curline */
-	curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	curix++;
-    }
-    curchnk = buf->b_ml.ml_chunksize + curix;
-
-    if (updtype == ML_CHNK_DELLINE)
-	len = -len;
-    curchnk->mlcs_totalsize += len;
-    if (updtype == ML_CHNK_ADDLINE)
-    {
-	curchnk->mlcs_numlines++;
-
-	/* May resize here so we don't have to do it in both cases below */
-	if (buf->b_ml.ml_usedchunks + 1 >= buf->b_ml.ml_numchunks)
-	{
-	    buf->b_ml.ml_numchunks = buf->b_ml.ml_numchunks * 3 / 2;
-	    buf->b_ml.ml_chunksize = (chunksize_T *)
-		vim_realloc(buf->b_ml.ml_chunksize,
-			    sizeof(chunksize_T) * buf->b_ml.ml_numchunks);
-	    if (buf->b_ml.ml_chunksize == NULL)
-	    {
-		/* Hmmmm, Give up on offset for this buffer */
-		buf->b_ml.ml_usedchunks = -1;
-		return;
-	    }
-	}
-
-	if (buf->b_ml.ml_chunksize[curix].mlcs_numlines >= MLCS_MAXL)
-	{
-	    int	    count;	    /* number of entries in block */
-	    int	    idx;
-	    int	    text_end;
-	    int	    linecnt;
-
-	    mch_memmove(buf->b_ml.ml_chunksize + curix + 1,
-			buf->b_ml.ml_chunksize + curix,
-			(buf->b_ml.ml_usedchunks - curix) *
-			sizeof(chunksize_T));
-	    /* Compute length of first half of lines in the split chunk */
-	    size = 0;
-	    linecnt = 0;
-	    while (curline < buf->b_ml.ml_line_count
-			&& linecnt < MLCS_MINL)
-	    {
-		if ((hp = ml_find_line(buf, curline, ML_FIND)) == NULL)
-		{
-		    buf->b_ml.ml_usedchunks = -1;
-		    return;
-		}
-		dp = (DATA_BL *)(hp->bh_data);
-		count = (long)(buf->b_ml.ml_locked_high) -
-			(long)(buf->b_ml.ml_locked_low) + 1;
-		idx = curline - buf->b_ml.ml_locked_low;
-		curline = buf->b_ml.ml_locked_high + 1;
-		if (idx == 0)/* first line in block, text at the end */
-		    text_end = dp->db_txt_end;
-		else
-		    text_end = ((dp->db_index[idx - 1]) & DB_INDEX_MASK);
-		/* Compute index of last line to use in this MEMLINE */
-		rest = count - idx;
-		if (linecnt + rest > MLCS_MINL)
-		{
-		    idx += MLCS_MINL - linecnt - 1;
-		    linecnt = MLCS_MINL;
-		}
-		else
-		{
-		    idx = count - 1;
-		    linecnt += rest;
-		}
-		size += text_end - ((dp->db_index[idx]) & DB_INDEX_MASK);
-	    }
-	    buf->b_ml.ml_chunksize[curix].mlcs_numlines = linecnt;
-	    buf->b_ml.ml_chunksize[curix + 1].mlcs_numlines -= linecnt;
-	    buf->b_ml.ml_chunksize[curix].mlcs_totalsize = size;
-	    buf->b_ml.ml_chunksize[curix + 1].mlcs_totalsize -= size;
-	    buf->b_ml.ml_usedchunks++;
-	    ml_upd_lastbuf = NULL;   /* Force recalc of curix & curline */
-	    return;
-	}
-	else if (buf->b_ml.ml_chunksize[curix].mlcs_numlines >= MLCS_MINL
-		     && curix == buf->b_ml.ml_usedchunks - 1
-		     && buf->b_ml.ml_line_count - line <= 1)
-	{
-	    /*
-	     * We are in the last chunk and it is cheap to crate a new one
-	     * after this. Do it now to avoid the loop above later on
-	     */
-	    curchnk = buf->b_ml.ml_chunksize + curix + 1;
-	    buf->b_ml.ml_usedchunks++;
-	    if (line == buf->b_ml.ml_line_count)
-	    {
-		curchnk->mlcs_numlines = 0;
-		curchnk->mlcs_totalsize = 0;
-	    }
-	    else
-	    {
-		/*
-		 * Line is just prior to last, move count for last
-		 * This is the common case  when loading a new file
-		 */
-		hp = ml_find_line(buf, buf->b_ml.ml_line_count, ML_FIND);
-		if (hp == NULL)
-		{
-		    buf->b_ml.ml_usedchunks = -1;
-		    return;
-		}
-		dp = (DATA_BL *)(hp->bh_data);
-		if (dp->db_line_count == 1)
-		    rest = dp->db_txt_end - dp->db_txt_start;
-		else
-		    rest =
-			((dp->db_index[dp->db_line_count - 2]) & DB_INDEX_MASK)
-			- dp->db_txt_start;
-		curchnk->mlcs_totalsize = rest;
-		curchnk->mlcs_numlines = 1;
-		curchnk[-1].mlcs_totalsize -= rest;
-		curchnk[-1].mlcs_numlines -= 1;
-	    }
-	}
-    }
-    else if (updtype == ML_CHNK_DELLINE)
-    {
-	curchnk->mlcs_numlines--;
-	ml_upd_lastbuf = NULL;   /* Force recalc of curix & curline */
-	if (curix < (buf->b_ml.ml_usedchunks - 1)
-		&& (curchnk->mlcs_numlines + curchnk[1].mlcs_numlines)
-		   <= MLCS_MINL)
-	{
-	    curix++;
-	    curchnk = buf->b_ml.ml_chunksize + curix;
-	}
-	else if (curix == 0 && curchnk->mlcs_numlines <= 0)
-	{
-	    buf->b_ml.ml_usedchunks--;
-	    mch_memmove(buf->b_ml.ml_chunksize, buf->b_ml.ml_chunksize + 1,
-			buf->b_ml.ml_usedchunks * sizeof(chunksize_T));
-	    return;
-	}
-	else if (curix == 0 || (curchnk->mlcs_numlines > 10
-		    && (curchnk->mlcs_numlines + curchnk[-1].mlcs_numlines)
-		       > MLCS_MINL))
-	{
-	    return;
-	}
-
-	/* Collapse chunks */
-	curchnk[-1].mlcs_numlines += curchnk->mlcs_numlines;
-	curchnk[-1].mlcs_totalsize += curchnk->mlcs_totalsize;
-	buf->b_ml.ml_usedchunks--;
-	if (curix < buf->b_ml.ml_usedchunks)
-	{
-	    mch_memmove(buf->b_ml.ml_chunksize + curix,
-			buf->b_ml.ml_chunksize + curix + 1,
-			(buf->b_ml.ml_usedchunks - curix) *
-			sizeof(chunksize_T));
-	}
-	return;
-    }
-    ml_upd_lastbuf = buf;
-    ml_upd_lastline = line;
-    ml_upd_lastcurline = curline;
-    ml_upd_lastcurix = curix;
-}
-
 /*
  * Find offset for line or line with offset.
  * Find line with offset if "lnum" is 0; return remaining offset in offp
  * Find offset of line if "lnum" > 0
  * return -1 if information is not available
+ *
+ * Goes down the tree once, skipping over the branches before the line or
+ * offset using the line and byte counts in the pointer blocks.
  */
     long
 ml_find_line_or_offset(buf, lnum, offp)
@@ -5178,26 +6440,24 @@ ml_find_line_or_offset(buf, lnum, offp)
     linenr_T	lnum;
     long	*offp;
 {
-    linenr_T	curline;
-    int		curix;
-    long	size;
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    linenr_T	curline = 1;
+    long	size = 0;
+    long	offset;
     bhdr_T	*hp;
     DATA_BL	*dp;
+    PTR_BL	*pp;
+    blocknr_T	bnum, bnum2;
+    int		page_count;
+    linenr_T	t;
+    long	bytes;
+    int		dirty;
     int		count;		/* number of entries in block */
     int		idx;
-    int		start_idx;
     int		text_end;
-    long	offset;
-    int		len;
     int		ffdos = (get_fileformat(buf) == EOL_DOS);
-    int		extra = 0;
-
-    /* take care of cached line first */
-    ml_flush_line(curbuf);
 
-    if (buf->b_ml.ml_usedchunks == -1
-	    || buf->b_ml.ml_chunksize == NULL
-	    || lnum < 0)
+    if (mfp == NULL || lnum < 0 || lnum > buf->b_ml.ml_line_count + 1)
 	return -1;
 
     if (offp == NULL)
@@ -5206,94 +6466,106 @@ ml_find_line_or_offset(buf, lnum, offp)
 	offset = *offp;
     if (lnum == 0 && offset <= 0)
 	return 1;   /* Not a "find offset" and offset 0 _must_ be in line 1 */
-    /*
-     * Find the last chunk before the one containing our line. Last chunk is
-     * special because it will never qualify
-     */
-    curline = 1;
-    curix = size = 0;
-    while (curix < buf->b_ml.ml_usedchunks - 1
-	    && ((lnum != 0
-	     && lnum >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines)
-		|| (offset != 0
-	       && offset > size + buf->b_ml.ml_chunksize[curix].mlcs_totalsize
-		      + ffdos * buf->b_ml.ml_chunksize[curix].mlcs_numlines)))
-    {
-	curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	size += buf->b_ml.ml_chunksize[curix].mlcs_totalsize;
-	if (offset && ffdos)
-	    size += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	curix++;
-    }
-
-    while ((lnum != 0 && curline < lnum) || (offset != 0 && size < offset))
-    {
-	if (curline > buf->b_ml.ml_line_count
-		|| (hp = ml_find_line(buf, curline, ML_FIND)) == NULL)
+
+    /* Take care of the cached line and get the counts of the locked block
+     * into the pointer blocks. */
+    ml_flush_line(buf);
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+
+    bnum = 1;			    /* start at the root of the tree */
+    page_count = 1;
+    for (;;)
+    {
+	if ((hp = mf_get(mfp, bnum, page_count)) == NULL)
 	    return -1;
 	dp = (DATA_BL *)(hp->bh_data);
-	count = (long)(buf->b_ml.ml_locked_high) -
-		(long)(buf->b_ml.ml_locked_low) + 1;
-	start_idx = idx = curline - buf->b_ml.ml_locked_low;
-	if (idx == 0)/* first line in block, text at the end */
-	    text_end = dp->db_txt_end;
-	else
-	    text_end = ((dp->db_index[idx - 1]) & DB_INDEX_MASK);
-	/* Compute index of last line to use in this MEMLINE */
-	if (lnum != 0)
+	if (dp->db_id == DATA_ID)
+	    break;
+
+	pp = (PTR_BL *)(dp);		/* must be pointer block */
+	if (pp->pb_id != PTR_ID)
 	{
-	    if (curline + (count - idx) >= lnum)
-		idx += lnum - curline - 1;
-	    else
-		idx = count - 1;
+	    EMSG(_("E317: pointer block id wrong"));
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    return -1;
 	}
-	else
+	dirty = FALSE;
+	for (idx = 0; idx < (int)pp->pb_count; ++idx)
 	{
-	    extra = 0;
-	    while (offset >= size
-		       + text_end - (int)((dp->db_index[idx]) & DB_INDEX_MASK)
-								      + ffdos)
-	    {
-		if (ffdos)
-		    size++;
-		if (idx == count - 1)
-		{
-		    extra = 1;
-		    break;
-		}
-		idx++;
-	    }
+	    t = pp->pb_pointer[idx].pe_line_count;
+	    bytes = PB_BYTES(pp)[idx];
+	    if (lnum != 0 ? lnum < curline + t
+			  : offset < size + bytes + ffdos * (long)t)
+		break;
+	    curline += t;
+	    size += bytes;
+	    if (lnum == 0)
+		size += ffdos * (long)t;
 	}
-	len = text_end - ((dp->db_index[idx]) & DB_INDEX_MASK);
-	size += len;
-	if (offset != 0 && size >= offset)
+	if (idx == (int)pp->pb_count)
 	{
-	    if (size + ffdos == offset)
-		*offp = 0;
-	    else if (idx == start_idx)
-		*offp = offset - size + len;
-	    else
-		*offp = offset - size + len
-		     - (text_end - ((dp->db_index[idx - 1]) & DB_INDEX_MASK));
-	    curline += idx - start_idx + extra;
-	    if (curline > buf->b_ml.ml_line_count)
-		return -1;	/* exactly one byte beyond the end */
-	    return curline;
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    /* Only the line below the last line can be after all blocks. */
+	    if (lnum == 0 || bnum != 1)
+		return -1;
+	    hp = NULL;
+	    break;
 	}
-	curline = buf->b_ml.ml_locked_high + 1;
+	bnum = pp->pb_pointer[idx].pe_bnum;
+	page_count = pp->pb_pointer[idx].pe_page_count;
+
+	/* a negative block number may have been changed */
+	if (bnum < 0)
+	{
+	    bnum2 = mf_trans_del(mfp, bnum);
+	    if (bnum != bnum2)
+	    {
+		bnum = bnum2;
+		pp->pb_pointer[idx].pe_bnum = bnum;
+		dirty = TRUE;
+	    }
+	}
+	mf_put(mfp, hp, dirty, FALSE);
     }
 
-    if (lnum != 0)
+    if (hp != NULL)
     {
-	/* Count extra CR characters. */
-	if (ffdos)
-	    size += lnum - 1;
-
-	/* Don't count the last line break if 'bin' and 'noeol'. */
-	if (buf->b_p_bin && !buf->b_p_eol)
-	    size -= ffdos + 1;
+	/* In the data block the first line has its text at the end. */
+	count = dp->db_line_count;
+	text_end = dp->db_txt_end;
+	if (lnum != 0)
+	{
+	    idx = lnum - curline;
+	    if (idx > 0)
+		size += text_end - (dp->db_index[idx - 1] & DB_INDEX_MASK);
+	}
+	else
+	{
+	    for (idx = 0; idx < count; ++idx)
+	    {
+		bytes = text_end - (dp->db_index[idx] & DB_INDEX_MASK) + ffdos;
+		if (offset < size + bytes)
+		    break;
+		size += bytes;
+		text_end = dp->db_index[idx] & DB_INDEX_MASK;
+	    }
+	    mf_put(mfp, hp, FALSE, FALSE);
+	    if (idx == count)
+		return -1;
+	    *offp = offset - size;
+	    return curline + idx;
+	}
+	mf_put(mfp, hp, FALSE, FALSE);
     }
 
+    /* Count extra CR characters. */
+    if (ffdos)
+	size += lnum - 1;
+
+    /* Don't count the last line break if 'bin' and 'noeol'. */
+    if (buf->b_p_bin && !buf->b_p_eol)
+	size -= ffdos + 1;
+
     return size;
 }
 
@@ -5336,3 +6608,654 @@ goto_byte(cnt)
 # endif
 }
 #endif
+
+#if defined(FEAT_MMAP) || defined(PROTO)
+
+#define MLM_LEVELS	10	/* maximum depth of the tree of a mapped file */
+#define MLM_CACHE	1024	/* number of clean blocks kept in memory */
+
+/*
+ * A data block of a mapped file, used while building the tree.
+ */
+typedef struct
+{
+    int		ml_lines;	/* number of lines in the block */
+    int		ml_pages;	/* number of pages of the block */
+    long	ml_size;	/* number of text bytes, including NULs */
+} mlmleaf_T;
+
+/*
+ * Add an entry for block "bnum" to the pointer block being filled at "level"
+ * of "lvl[]".  When that block is full it is added to the level above and a
+ * new one is started.
+ */
+    static int
+ml_map_add_entry(mfp, lvl, level, bnum, page_count, line_count, size, lnum)
+    memfile_T	*mfp;
+    bhdr_T	**lvl;
+    int		level;
+    blocknr_T	bnum;
+    int		page_count;
+    linenr_T	line_count;
+    long	size UNUSED;
+    linenr_T	lnum;
+{
+    PTR_BL	*pp;
+    PTR_EN	*pe;
+
+    if (level >= MLM_LEVELS)
+	return FAIL;
+    if (lvl[level] != NULL)
+    {
+	pp = (PTR_BL *)(lvl[level]->bh_data);
+	if (pp->pb_count == pp->pb_count_max
+			       && ml_map_close_level(mfp, lvl, level) == FAIL)
+	    return FAIL;
+    }
+    if (lvl[level] == NULL && (lvl[level] = ml_new_ptr(mfp)) == NULL)
+	return FAIL;
+    pp = (PTR_BL *)(lvl[level]->bh_data);
+#ifdef FEAT_BYTEOFF
+    PB_BYTES(pp)[pp->pb_count] = size;
+#endif
+    pe = &pp->pb_pointer[pp->pb_count++];
+    pe->pe_bnum = bnum;
+    pe->pe_page_count = page_count;
+    pe->pe_line_count = line_count;
+    pe->pe_old_lnum = lnum;
+    return OK;
+}
+
+/*
+ * Add the pointer block being filled at "level" of "lvl[]" to the level
+ * above.
+ */
+    static int
+ml_map_close_level(mfp, lvl, level)
+    memfile_T	*mfp;
+    bhdr_T	**lvl;
+    int		level;
+{
+    bhdr_T	*hp = lvl[level];
+    PTR_BL	*pp = (PTR_BL *)(hp->bh_data);
+    blocknr_T	bnum = hp->bh_bnum;
+    linenr_T	lnum = pp->pb_pointer[0].pe_old_lnum;
+    linenr_T	line_count = 0;
+    long	size = 0;
+    int		i;
+
+    for (i = 0; i < (int)pp->pb_count; ++i)
+    {
+	line_count += pp->pb_pointer[i].pe_line_count;
+#ifdef FEAT_BYTEOFF
+	size += PB_BYTES(pp)[i];
+#endif
+    }
+    lvl[level] = NULL;
+    mf_put(mfp, hp, TRUE, FALSE);
+    return ml_map_add_entry(mfp, lvl, level + 1, bnum, 1, line_count, size,
+									lnum);
+}
+
+/*
+ * Check that the text of a line from "p" up to the line break at "nl" is
+ * used by readfile() as it is.  "end" is the end of the file.
+ */
+    static int
+ml_map_check_text(p, nl, end, raw, try_mac)
+    char_u	*p;
+    char_u	*nl;
+    char_u	*end;
+    int		raw;
+    int		try_mac;
+{
+    char_u	*cr;
+
+    /* readfile() turns a NUL into a NL. */
+    if (memchr(p, NUL, (size_t)(nl - p)) != NULL)
+	return FAIL;
+    /* With a CR that is not part of a CR-NL 'fileformat' may be "mac". */
+    if (try_mac && (cr = memchr(p, CAR, (size_t)(nl - p))) != NULL
+					       && (cr + 1 != nl || nl == end))
+	return FAIL;
+    if (raw == RAW_ANY)
+	return OK;
+    if (raw == RAW_UTF8)
+	return scan_utf8(p, (long)(nl - p)) == nl - p ? OK : FAIL;
+    for ( ; p < nl; ++p)
+	if (*p >= 0x80)
+	    return FAIL;
+    return OK;
+}
+
+/*
+ * Check the text of mapped file "mm" from "p" and find the data blocks for
+ * its lines.  Adds the offsets of the pages to "offs" and the blocks to
+ * "leaves".  "raw" is what the bytes may be, see fenc_raw_mode().
+ * "try_mac" is set when a file with CR line breaks is read with 'fileformat'
+ * "mac".  Sets "*eolp" to FALSE when the last line has no line break.
+ * Returns FAIL when readfile() would not use the lines as they are.
+ */
+    static int
+ml_map_scan(mm, p, raw, try_mac, page_size, offs, leaves, eolp)
+    mlmap_T	*mm;
+    char_u	*p;
+    int		raw;
+    int		try_mac;
+    unsigned	page_size;
+    garray_T	*offs;
+    garray_T	*leaves;
+    int		*eolp;
+{
+    char_u	*end = mm->mm_data + mm->mm_len;
+    char_u	*line = p;
+    char_u	*leaf_start = p;
+    long	leaf_size = HEADER_SIZE;
+    int		leaf_lines = 0;
+    mlmleaf_T	*leaf;
+    size_t	len;
+    int		n;
+    int		i;
+
+    for (;;)
+    {
+	p = memchr(line, '\n', (size_t)(end - line));
+	if (p == NULL)
+	    p = end;
+	if (ml_map_check_text(line, p, end, raw, try_mac) == FAIL)
+	    return FAIL;
+
+	if (p == line && p == end)
+	    break;		    /* file ends in a line break */
+	len = p - line;
+	if (p < end && mm->mm_dos)
+	{
+	    if (len == 0 || p[-1] != CAR)
+		return FAIL;	    /* CR missing */
+	    --len;
+	}
+	else if (p == end)
+	{
+	    *eolp = FALSE;
+	    /* A CTRL-Z at the end of a DOS file is dropped. */
+	    if (mm->mm_dos && len == 1 && *line == Ctrl_Z)
+		return FAIL;
+	}
+	if (len > MAXCOL / 2)
+	    return FAIL;
+
+	/* Start a new block when the line doesn't fit in the current one. */
+	if (leaf_lines > 0
+		&& leaf_size + INDEX_SIZE + len + 1 > (long)page_size)
+	{
+	    if (ga_grow(leaves, 1) == FAIL || ga_grow(offs, 1) == FAIL)
+		return FAIL;
+	    leaf = (mlmleaf_T *)leaves->ga_data + leaves->ga_len++;
+	    leaf->ml_lines = leaf_lines;
+	    leaf->ml_pages = 1;
+	    leaf->ml_size = leaf_size - HEADER_SIZE - leaf_lines * INDEX_SIZE;
+	    ((size_t *)offs->ga_data)[offs->ga_len++] =
+						    leaf_start - mm->mm_data;
+	    leaf_start = line;
+	    leaf_size = HEADER_SIZE;
+	    leaf_lines = 0;
+	}
+	leaf_size += INDEX_SIZE + len + 1;
+	++leaf_lines;
+
+	if (p == end)
+	    break;
+	line = ++p;
+
+	/* A line that doesn't fit in a page gets a block of its own. */
+	if (leaf_size > (long)page_size)
+	{
+	    n = (int)((leaf_size + page_size - 1) / page_size);
+	    if (ga_grow(leaves, 1) == FAIL || ga_grow(offs, n) == FAIL)
+		return FAIL;
+	    leaf = (mlmleaf_T *)leaves->ga_data + leaves->ga_len++;
+	    leaf->ml_lines = 1;
+	    leaf->ml_pages = n;
+	    leaf->ml_size = leaf_size - HEADER_SIZE - INDEX_SIZE;
+	    for (i = 0; i < n; ++i)
+		((size_t *)offs->ga_data)[offs->ga_len++] =
+						    leaf_start - mm->mm_data;
+	    leaf_start = line;
+	    leaf_size = HEADER_SIZE;
+	    leaf_lines = 0;
+	}
+    }
+
+    if (leaf_lines > 0)
+    {
+	n = (int)((leaf_size + page_size - 1) / page_size);
+	if (ga_grow(leaves, 1) == FAIL || ga_grow(offs, n + 1) == FAIL)
+	    return FAIL;
+	leaf = (mlmleaf_T *)leaves->ga_data + leaves->ga_len++;
+	leaf->ml_lines = leaf_lines;
+	leaf->ml_pages = n;
+	leaf->ml_size = leaf_size - HEADER_SIZE - leaf_lines * INDEX_SIZE;
+	for (i = 0; i < n; ++i)
+	    ((size_t *)offs->ga_data)[offs->ga_len++] =
+						    leaf_start - mm->mm_data;
+    }
+    else if (ga_grow(offs, 1) == FAIL)
+	return FAIL;
+    /* The end of the text of the last block. */
+    ((size_t *)offs->ga_data)[offs->ga_len] = mm->mm_len;
+    return leaves->ga_len > 0 ? OK : FAIL;
+}
+
+/*
+ * Check the text of mapped file "mm" and find the data blocks for its lines,
+ * see ml_map_scan().  Sets "*ffp" to the fileformat, "*bomp" when a BOM is
+ * to be skipped and "*eolp" to FALSE when the last line has no line break.
+ */
+    static int
+ml_map_text(mm, raw, skip_bom, page_size, offs, leaves, ffp, bomp, eolp)
+    mlmap_T	*mm;
+    int		raw;
+    int		skip_bom;
+    unsigned	page_size;
+    garray_T	*offs;
+    garray_T	*leaves;
+    int		*ffp;
+    int		*bomp;
+    int		*eolp;
+{
+    char_u	*p = mm->mm_data;
+    char_u	*end = p + mm->mm_len;
+    char_u	*nl;
+    int		try_dos, try_unix;
+
+    *bomp = FALSE;
+    *eolp = TRUE;
+#ifdef FEAT_CRYPT
+    /* Starts with the magic of an encrypted file, see fileio.c. */
+    if (mm->mm_len >= 9 && memcmp(p, "VimCrypt~", 9) == 0)
+	return FAIL;
+#endif
+    if (mm->mm_len >= 2 && ((p[0] == 0xfe && p[1] == 0xff)
+					       || (p[0] == 0xff && p[1] == 0xfe)))
+	return FAIL;	    /* may be a UCS-2 or UTF-16 BOM */
+    if (mm->mm_len >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf)
+    {
+	/* A UTF-8 BOM is removed, or the text is converted from UTF-8. */
+	if (!enc_utf8 || (!skip_bom && raw != RAW_UTF8))
+	    return FAIL;
+	p += 3;
+	raw = RAW_UTF8;
+	*bomp = TRUE;
+    }
+
+    /* The first line break decides the fileformat, like readfile() does. */
+    try_dos = vim_strchr(p_ffs, 'd') != NULL;
+    try_unix = vim_strchr(p_ffs, 'x') != NULL;
+    nl = memchr(p, '\n', (size_t)(end - p));
+    if (nl == NULL || (!try_dos && !try_unix))
+	return FAIL;
+    mm->mm_dos = try_dos && (!try_unix || (nl > p && nl[-1] == CAR));
+    *ffp = mm->mm_dos ? EOL_DOS : EOL_UNIX;
+
+    return ml_map_scan(mm, p, raw,
+			      !mm->mm_dos && vim_strchr(p_ffs, 'm') != NULL,
+					      page_size, offs, leaves, eolp);
+}
+
+/*
+ * Call ml_map_text().  When the file is truncated while scanning it, touching
+ * a page past the new end causes a SIGBUS.  Catch it and return FAIL, the
+ * file is read instead then.  Separate from ml_map_file() so that the
+ * longjmp() can't clobber its variables.
+ */
+    static int
+ml_map_text_catch(mm, raw, skip_bom, page_size, offs, leaves, ffp, bomp, eolp)
+    mlmap_T	*mm;
+    int		raw;
+    int		skip_bom;
+    unsigned	page_size;
+    garray_T	*offs;
+    garray_T	*leaves;
+    int		*ffp;
+    int		*bomp;
+    int		*eolp;
+{
+    int		retval;
+
+#ifdef HAVE_SETJMP_H
+    mch_startjmp();
+    if (SETJMP(lc_jump_env) != 0)
+    {
+	mch_didjmp();
+	return FAIL;
+    }
+#endif
+    retval = ml_map_text(mm, raw, skip_bom, page_size, offs, leaves,
+							    ffp, bomp, eolp);
+#ifdef HAVE_SETJMP_H
+    mch_endjmp();
+#endif
+    return retval;
+}
+
+/*
+ * Use file "fname" for the lines of "buf" by mapping it into memory, instead
+ * of reading it.  "buf" must have a new, empty memline without a swap file.
+ * Only done when readfile() would use the text as it is, apart from removing
+ * a BOM and the line breaks.
+ * Data blocks are filled from the mapped file when they are needed, only the
+ * ones that are changed stay in memory.  They get negative numbers, thus a
+ * swap file only gets the changed blocks and recovery reads the others from
+ * the file, like it does for blocks that were not written yet.
+ * Sets "*ffp" to the fileformat, "*bomp" when a BOM was skipped and "*eolp"
+ * to FALSE when the last line has no line break.
+ * Returns FAIL when the file can't be used this way, nothing was changed
+ * then.
+ */
+    int
+ml_map_file(buf, fname, ffp, bomp, eolp)
+    buf_T	*buf;
+    char_u	*fname;
+    int		*ffp;
+    int		*bomp;
+    int		*eolp;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    mlmap_T	*mm;
+    int		raw;
+    int		skip_bom;
+    garray_T	offs;
+    garray_T	leaves;
+    mlmleaf_T	*leaf;
+    int		*lines = NULL;
+    bhdr_T	*lvl[MLM_LEVELS];
+    bhdr_T	*hp;
+    struct stat	st;
+    PTR_BL	*pp;
+    blocknr_T	bnum;
+    linenr_T	lnum;
+    int		level;
+    int		top;
+    int		i;
+
+    if (mfp == NULL || mfp->mf_fd >= 0 || *p_ffs == NUL
+			       || (raw = fenc_raw_mode(buf, &skip_bom)) == RAW_NONE)
+	return FAIL;
+    mm = (mlmap_T *)alloc_clear((unsigned)sizeof(mlmap_T));
+    if (mm == NULL)
+	return FAIL;
+    mm->mm_fd = -1;
+    mm->mm_data = mch_map_file(fname, &mm->mm_len, &mm->mm_fd);
+    if (mm->mm_data == NULL || fstat(mm->mm_fd, &st) < 0)
+    {
+	ml_map_free(mm);
+	return FAIL;
+    }
+    mm->mm_dev = st.st_dev;
+    mm->mm_ino = st.st_ino;
+    mm->mm_mtime = st.st_mtime;
+#ifdef HAVE_ST_MTIM
+    mm->mm_mtime_ns = (long)st.st_mtim.tv_nsec;
+#endif
+    ga_init2(&offs, (int)sizeof(size_t),
+			      (int)(mm->mm_len / mfp->mf_page_size / 4) + 100);
+    ga_init2(&leaves, (int)sizeof(mlmleaf_T),
+			      (int)(mm->mm_len / mfp->mf_page_size / 4) + 100);
+
+    if (ml_map_text_catch(mm, raw, skip_bom, mfp->mf_page_size, &offs,
+					   &leaves, ffp, bomp, eolp) == FAIL
+	    || ml_map_check_file(mm) == FAIL)
+	goto fail;
+    lines = (int *)lalloc_clear((long_u)(offs.ga_len * sizeof(int)), TRUE);
+    if (lines == NULL)
+	goto fail;
+    mm->mm_last = mfp->mf_blocknr_min + 1;
+    mm->mm_first = mm->mm_last - offs.ga_len;
+
+    /*
+     * Replace the empty data block with a tree of pointer blocks for the
+     * blocks of the mapped file.  The negative numbers of these are
+     * reserved, a block spanning several pages gets as many numbers.
+     */
+    ml_flush_line(buf);
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+    buf->b_ml.ml_stack_top = 0;
+    if ((hp = mf_get(mfp, (blocknr_T)2, 1)) == NULL)
+	goto fail;
+    mf_free(mfp, hp);
+    mfp->mf_blocknr_min = mm->mm_first - 1;
+
+    vim_memset(lvl, 0, sizeof(lvl));
+    bnum = mm->mm_first;
+    lnum = 1;
+    for (i = 0; i < leaves.ga_len; ++i)
+    {
+	leaf = (mlmleaf_T *)leaves.ga_data + i;
+	if (ml_map_add_entry(mfp, lvl, 0, bnum, leaf->ml_pages,
+		       (linenr_T)leaf->ml_lines, leaf->ml_size, lnum) == FAIL)
+	    goto fail_tree;
+	lines[bnum - mm->mm_first] = leaf->ml_lines;
+	bnum += leaf->ml_pages;
+	lnum += leaf->ml_lines;
+    }
+    /* Close the levels until a single block is left, its entries go into
+     * the root. */
+    for (level = 0; ; ++level)
+    {
+	for (top = MLM_LEVELS - 1; top > level && lvl[top] == NULL; --top)
+	    ;
+	if (top == level)
+	    break;
+	if (lvl[level] != NULL && ml_map_close_level(mfp, lvl, level) == FAIL)
+	    goto fail_tree;
+    }
+    if ((hp = mf_get(mfp, (blocknr_T)1, 1)) == NULL)
+	goto fail_tree;
+    pp = (PTR_BL *)(hp->bh_data);
+    pp->pb_count = ((PTR_BL *)(lvl[top]->bh_data))->pb_count;
+    mch_memmove(pp->pb_pointer, ((PTR_BL *)(lvl[top]->bh_data))->pb_pointer,
+					      pp->pb_count * sizeof(PTR_EN));
+#ifdef FEAT_BYTEOFF
+    mch_memmove(PB_BYTES(pp), PB_BYTES((PTR_BL *)(lvl[top]->bh_data)),
+						pp->pb_count * sizeof(long));
+#endif
+    mf_put(mfp, hp, TRUE, FALSE);
+    mf_free(mfp, lvl[top]);
+
+    ga_clear(&leaves);
+    buf->b_ml.ml_line_count = lnum - 1;
+    buf->b_ml.ml_flags &= ~ML_EMPTY;
+    mm->mm_off = (size_t *)offs.ga_data;
+    mm->mm_lines = lines;
+    mfp->mf_map = mm;
+    /* Keep only a few clean blocks of the file in memory. */
+    if (mfp->mf_used_count + MLM_CACHE < mfp->mf_used_count_max)
+	mfp->mf_used_count_max = mfp->mf_used_count + MLM_CACHE;
+    return OK;
+
+fail_tree:
+    /* Can only happen when out of memory, the buffer is unusable. */
+    for (level = 0; level < MLM_LEVELS; ++level)
+	if (lvl[level] != NULL)
+	    mf_put(mfp, lvl[level], TRUE, FALSE);
+fail:
+    ga_clear(&offs);
+    ga_clear(&leaves);
+    vim_free(lines);
+    ml_map_free(mm);
+    return FAIL;
+}
+
+/*
+ * Check that mapped file "mm" still has the size and time it had when it was
+ * mapped.  When another program changed it the mapped pages may have other
+ * text and touching pages past its end causes a SIGBUS.
+ */
+    static int
+ml_map_check_file(mm)
+    mlmap_T	*mm;
+{
+    struct stat	st;
+
+    if (fstat(mm->mm_fd, &st) < 0 || (size_t)st.st_size != mm->mm_len
+	    || st.st_mtime != mm->mm_mtime
+#ifdef HAVE_ST_MTIM
+	    || (long)st.st_mtim.tv_nsec != mm->mm_mtime_ns
+#endif
+	    )
+	return FAIL;
+    return OK;
+}
+
+/*
+ * Copy the lines of the block at page "slot" of mapped file "mm" into the
+ * data block "hp".
+ */
+    static void
+ml_map_copy(mm, hp, slot, page_size)
+    mlmap_T	*mm;
+    bhdr_T	*hp;
+    blocknr_T	slot;
+    unsigned	page_size;
+{
+    DATA_BL	*dp = (DATA_BL *)(hp->bh_data);
+    char_u	*p = mm->mm_data + mm->mm_off[slot];
+    char_u	*end = mm->mm_data + mm->mm_off[slot + hp->bh_page_count];
+    char_u	*nl;
+    unsigned	txt_start = page_size * hp->bh_page_count;
+    int		len;
+    int		count = 0;
+
+    dp->db_id = DATA_ID;
+    dp->db_txt_end = txt_start;
+    while (p < end)
+    {
+	nl = memchr(p, '\n', (size_t)(end - p));
+	if (nl == NULL)
+	    nl = end;		/* last line without a line break */
+	len = (int)(nl - p);
+	if (mm->mm_dos && nl < end)
+	    --len;
+	txt_start -= len + 1;
+	mch_memmove((char *)dp + txt_start, p, (size_t)len);
+	*((char_u *)dp + txt_start + len) = NUL;
+	dp->db_index[count++] = txt_start;
+	p = nl + 1;
+    }
+    dp->db_txt_start = txt_start;
+    dp->db_line_count = count;
+    dp->db_free = txt_start - (HEADER_SIZE + count * INDEX_SIZE);
+}
+
+/*
+ * Fill the data block "hp" of memfile "mfp" with the text of a mapped file.
+ * "hp" has the number and page count of the block.
+ * When the file was changed by another program its text can't be used, the
+ * block gets empty lines then.
+ */
+    void
+ml_map_fill(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+    mlmap_T	*mm = mfp->mf_map;
+    DATA_BL	*dp = (DATA_BL *)(hp->bh_data);
+    blocknr_T	slot = hp->bh_bnum - mm->mm_first;
+    unsigned	txt_start;
+    int		i;
+
+    if (!mm->mm_changed)
+    {
+	if (ml_map_check_file(mm) == OK)
+	{
+	    /* The file may still be truncated before the copy is done. */
+#ifdef HAVE_SETJMP_H
+	    mch_startjmp();
+	    if (SETJMP(lc_jump_env) != 0)
+		mch_didjmp();
+	    else
+#endif
+	    {
+		ml_map_copy(mm, hp, slot, mfp->mf_page_size);
+#ifdef HAVE_SETJMP_H
+		mch_endjmp();
+#endif
+		return;
+	    }
+	}
+	mm->mm_changed = TRUE;
+	EMSG(_("E884: Mapped file was changed by another program, lines are lost"));
+    }
+    txt_start = mfp->mf_page_size * hp->bh_page_count;
+    dp->db_id = DATA_ID;
+    dp->db_txt_end = txt_start;
+    for (i = 0; i < mm->mm_lines[slot]; ++i)
+    {
+	--txt_start;
+	*((char_u *)dp + txt_start) = NUL;
+	dp->db_index[i] = txt_start;
+    }
+    dp->db_txt_start = txt_start;
+    dp->db_line_count = mm->mm_lines[slot];
+    dp->db_free = txt_start - (HEADER_SIZE + mm->mm_lines[slot] * INDEX_SIZE);
+}
+
+/*
+ * Get all the text of mapped file of "buf" into memory, it is no longer
+ * mapped then.  Used before the file is overwritten.
+ */
+    void
+ml_map_detach(buf)
+    buf_T	*buf;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    mlmap_T	*mm;
+    linenr_T	lnum;
+
+    if (mfp == NULL || (mm = mfp->mf_map) == NULL)
+	return;
+    ml_flush_line(buf);
+    for (lnum = 1; lnum <= buf->b_ml.ml_line_count;
+					    lnum = buf->b_ml.ml_locked_high + 1)
+    {
+	if (ml_find_line(buf, lnum, ML_FIND) == NULL)
+	    break;
+	/* A dirty block is written to the swap file or stays in memory. */
+	buf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+    }
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+    mf_unmap(mfp);
+    ml_map_free(mm);
+}
+
+/*
+ * Return TRUE when some text of "buf" is in mapped file "fname".
+ */
+    int
+ml_map_uses_file(buf, fname)
+    buf_T	*buf;
+    char_u	*fname;
+{
+    mlmap_T	*mm;
+    struct stat	st;
+
+    if (buf->b_ml.ml_mfp == NULL || (mm = buf->b_ml.ml_mfp->mf_map) == NULL)
+	return FALSE;
+    return mch_stat((char *)fname, &st) >= 0
+		       && st.st_dev == mm->mm_dev && st.st_ino == mm->mm_ino;
+}
+
+    static void
+ml_map_free(mm)
+    mlmap_T	*mm;
+{
+    if (mm->mm_data != NULL)
+	mch_unmap_file(mm->mm_data, mm->mm_len);
+    if (mm->mm_fd >= 0)
+	close(mm->mm_fd);
+    vim_free(mm->mm_off);
+    vim_free(mm->mm_lines);
+    vim_free(mm);
+}
+
+#endif /* FEAT_MMAP */
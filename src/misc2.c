@@ -3180,6 +3180,40 @@ default_fileformat()
     return EOL_UNIX;
 }
 
+/*
+ * Return "cmd" with 'shellxquote' around it, in allocated memory.  When
+ * 'shellxquote' is "(" the characters in 'shellxescape' are escaped with a
+ * '^'.  Returns NULL when out of memory.
+ */
+    char_u *
+shell_xquote(cmd)
+    char_u	*cmd;
+{
+    char_u	*ecmd = cmd;
+    char_u	*ncmd;
+
+    if (*p_sxe != NUL && STRCMP(p_sxq, "(") == 0)
+    {
+	ecmd = vim_strsave_escaped_ext(cmd, p_sxe, '^', FALSE);
+	if (ecmd == NULL)
+	    ecmd = cmd;
+    }
+    ncmd = alloc((unsigned)(STRLEN(ecmd) + STRLEN(p_sxq) * 2 + 1));
+    if (ncmd != NULL)
+    {
+	STRCPY(ncmd, p_sxq);
+	STRCAT(ncmd, ecmd);
+	/* When 'shellxquote' is ( append ).
+	 * When 'shellxquote' is "( append )". */
+	STRCAT(ncmd, STRCMP(p_sxq, "(") == 0 ? (char_u *)")"
+		   : STRCMP(p_sxq, "\"(") == 0 ? (char_u *)")\""
+		   : p_sxq);
+    }
+    if (ecmd != cmd)
+	vim_free(ecmd);
+    return ncmd;
+}
+
 /*
  * Call shell.	Calls mch_call_shell, with 'shellxquote' added.
  */
@@ -3230,31 +3264,14 @@ call_shell(cmd, opt)
 	    retval = mch_call_shell(cmd, opt);
 	else
 	{
-	    char_u *ecmd = cmd;
-
-	    if (*p_sxe != NUL && STRCMP(p_sxq, "(") == 0)
-	    {
-		ecmd = vim_strsave_escaped_ext(cmd, p_sxe, '^', FALSE);
-		if (ecmd == NULL)
-		    ecmd = cmd;
-	    }
-	    ncmd = alloc((unsigned)(STRLEN(ecmd) + STRLEN(p_sxq) * 2 + 1));
+	    ncmd = shell_xquote(cmd);
 	    if (ncmd != NULL)
 	    {
-		STRCPY(ncmd, p_sxq);
-		STRCAT(ncmd, ecmd);
-		/* When 'shellxquote' is ( append ).
-		 * When 'shellxquote' is "( append )". */
-		STRCAT(ncmd, STRCMP(p_sxq, "(") == 0 ? (char_u *)")"
-			   : STRCMP(p_sxq, "\"(") == 0 ? (char_u *)")\""
-			   : p_sxq);
 		retval = mch_call_shell(ncmd, opt);
 		vim_free(ncmd);
 	    }
 	    else
 		retval = -1;
-	    if (ecmd != cmd)
-		vim_free(ecmd);
 	}
 #ifdef FEAT_GUI
 	--hold_gui_events;
@@ -6854,6 +6854,9 @@ nv_percent(cap)
 	{
 	    cap->oap->motion_type = MLINE;
 	    setpcmark();
+#ifdef FEAT_PROGRESSIVE_LOAD
+	    buf_load_finish(curbuf);	/* need the number of lines */
+#endif
 	    /* Round up, so CTRL-G will give same value.  Watch out for a
 	     * large line count, the line number must not go negative! */
 	    if (curbuf->b_ml.ml_line_count > 1000000)
@@ -9001,6 +9004,13 @@ nv_goto(cap)
 {
     linenr_T	lnum;
 
+#ifdef FEAT_PROGRESSIVE_LOAD
+    /* Going to the last line or a line that was not read yet. */
+    if (cap->count0 != 0)
+	(void)buf_load_more(curbuf, (linenr_T)cap->count0);
+    else if (cap->arg)
+	buf_load_finish(curbuf);
+#endif
     if (cap->arg)
 	lnum = curbuf->b_ml.ml_line_count;
     else
@@ -3385,6 +3385,8 @@ do_put(regname, dir, count, flags)
     char_u	*insert_string = NULL;
     int		allocated = FALSE;
     long	cnt;
+    long	n;
+    long	added;
 
 #ifdef FEAT_CLIPBOARD
     /* Adjust register name for "unnamed" in 'clipboard'. */
@@ -3910,6 +3912,22 @@ do_put(regname, dir, count, flags)
 		    i = 1;
 		}
 
+		if (!(flags & PUT_FIXINDENT))
+		{
+		    /* Append the lines at once.  For MCHAR the last one was
+		     * inserted above. */
+		    n = y_size - i - (y_type == MCHAR ? 1 : 0);
+		    if (n > 0)
+		    {
+			added = ml_append_lines(curbuf, lnum, y_array + i, NULL,
+								     n, FALSE);
+			lnum += added;
+			nr_lines += added;
+			if (added < n)
+			    goto error;
+			i += n;
+		    }
+		}
 		for (; i < y_size; ++i)
 		{
 		    if ((y_type != MCHAR || i < y_size - 1)
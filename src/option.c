@@ -541,6 +541,13 @@ static struct vimoption
 			    {(char_u *)0L, (char_u *)0L}
 #endif
 			    SCRIPTID_INIT},
+    {"asyncmake",   "amk",  P_BOOL|P_VI_DEF,
+#ifdef FEAT_JOB_CONTROL
+			    (char_u *)&p_amk, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
 #ifdef FEAT_AUTOCHDIR
     {"autochdir",  "acd",   P_BOOL|P_VI_DEF,
 			    (char_u *)&p_acd, PV_NONE,
@@ -1078,6 +1085,20 @@ static struct vimoption
 			    (char_u *)NULL, PV_NONE,
 #endif
 			    {(char_u *)"", (char_u *)0L} SCRIPTID_INIT},
+    {"eventqueuefull", "eqf", P_STRING|P_VI_DEF,
+#ifdef FEAT_EVENT_LOOP
+			    (char_u *)&p_eqf, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)"block", (char_u *)0L} SCRIPTID_INIT},
+    {"eventqueuesize", "eqs", P_NUM|P_VI_DEF,
+#ifdef FEAT_EVENT_LOOP
+			    (char_u *)&p_eqs, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)1024L, (char_u *)0L} SCRIPTID_INIT},
     {"expandtab",   "et",   P_BOOL|P_VI_DEF|P_VIM,
 			    (char_u *)&p_et, PV_ET,
 			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
@@ -1731,6 +1752,13 @@ static struct vimoption
     {"listchars",   "lcs",  P_STRING|P_VI_DEF|P_RALL|P_COMMA|P_NODUP,
 			    (char_u *)&p_lcs, PV_NONE,
 			    {(char_u *)"eol:$", (char_u *)0L} SCRIPTID_INIT},
+    {"loadlines",   "lol",  P_NUM|P_VI_DEF,
+#ifdef FEAT_PROGRESSIVE_LOAD
+			    (char_u *)&p_lol, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)0L, (char_u *)0L} SCRIPTID_INIT},
     {"loadplugins", "lpl",  P_BOOL|P_VI_DEF,
 			    (char_u *)&p_lpl, PV_NONE,
 			    {(char_u *)TRUE, (char_u *)0L} SCRIPTID_INIT},
@@ -1799,6 +1827,13 @@ static struct vimoption
 			    (char_u *)&p_mmt, PV_NONE,
 			    {(char_u *)DFLT_MAXMEMTOT, (char_u *)0L}
 			    SCRIPTID_INIT},
+    {"maxmemzip",   "mmz",  P_NUM|P_VI_DEF,
+#ifdef FEAT_MEMZIP
+			    (char_u *)&p_mmz, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)0L, (char_u *)0L} SCRIPTID_INIT},
     {"menuitems",   "mis",  P_NUM|P_VI_DEF,
 #ifdef FEAT_MENU
 			    (char_u *)&p_mis, PV_NONE,
@@ -1818,6 +1853,13 @@ static struct vimoption
 			    {(char_u *)0L, (char_u *)0L}
 #endif
 			    SCRIPTID_INIT},
+    {"mmapsize",    "mms",  P_NUM|P_VI_DEF,
+#ifdef FEAT_MMAP
+			    (char_u *)&p_mms, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)0L, (char_u *)0L} SCRIPTID_INIT},
     {"modeline",    "ml",   P_BOOL|P_VIM,
 			    (char_u *)&p_ml, PV_ML,
 			    {(char_u *)FALSE, (char_u *)TRUE} SCRIPTID_INIT},
@@ -2482,6 +2524,13 @@ static struct vimoption
     {"swapsync",    "sws",  P_STRING|P_VI_DEF,
 			    (char_u *)&p_sws, PV_NONE,
 			    {(char_u *)"fsync", (char_u *)0L} SCRIPTID_INIT},
+    {"swapthread",  "swt",  P_BOOL|P_VI_DEF,
+#ifdef FEAT_SWAP_THREAD
+			    (char_u *)&p_swt, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)TRUE, (char_u *)0L} SCRIPTID_INIT},
     {"switchbuf",   "swb",  P_STRING|P_VI_DEF|P_COMMA|P_NODUP,
 			    (char_u *)&p_swb, PV_NONE,
 			    {(char_u *)"", (char_u *)0L} SCRIPTID_INIT},
@@ -2692,6 +2741,13 @@ static struct vimoption
 			    (char_u *)100L,
 #endif
 				(char_u *)0L} SCRIPTID_INIT},
+    {"undomaxmem",  "umm",  P_NUM|P_VI_DEF|P_VIM,
+#ifdef FEAT_PERSISTENT_UNDO
+			    (char_u *)&p_umm, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)0L, (char_u *)0L} SCRIPTID_INIT},
     {"undoreload",  "ur",   P_NUM|P_VI_DEF,
 			    (char_u *)&p_ur, PV_NONE,
 			    { (char_u *)10000L, (char_u *)0L} SCRIPTID_INIT},
@@ -2966,6 +3022,9 @@ static struct vimoption
 static char *(p_ambw_values[]) = {"single", "double", NULL};
 #endif
 static char *(p_bg_values[]) = {"light", "dark", NULL};
+#ifdef FEAT_EVENT_LOOP
+static char *(p_eqf_values[]) = {"block", "drop", "coalesce", NULL};
+#endif
 static char *(p_nf_values[]) = {"octal", "hex", "alpha", NULL};
 static char *(p_ff_values[]) = {FF_UNIX, FF_DOS, FF_MAC, NULL};
 #ifdef FEAT_CRYPT
@@ -5943,6 +6002,17 @@ did_set_string_option(opt_idx, varp, new_value_alloced, oldval, errbuf,
     }
 #endif
 
+#ifdef FEAT_EVENT_LOOP
+    /* 'eventqueuefull' */
+    else if (varp == &p_eqf)
+    {
+	if (check_opt_strings(p_eqf, p_eqf_values, FALSE) != OK)
+	    errmsg = e_invarg;
+	else
+	    ev_set_full_policy(p_eqf);
+    }
+#endif
+
 #ifdef FEAT_MBYTE
     /* 'encoding' and 'fileencoding' */
     else if (varp == &p_enc || gvarp == &p_fenc || varp == &p_tenc)
@@ -8650,6 +8720,13 @@ set_num_option(opt_idx, varp, value, errbuf, errbuflen, opt_flags)
 	errmsg = e_positive;
 	p_report = 1;
     }
+#ifdef FEAT_PERSISTENT_UNDO
+    if (p_umm < 0)
+    {
+	errmsg = e_positive;
+	p_umm = 0;
+    }
+#endif
     if ((p_sj < -100 || p_sj >= Rows) && full_screen)
     {
 	if (Rows != old_Rows)	/* Rows changed, just adjust p_sj */
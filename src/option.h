@@ -310,6 +310,9 @@
 #ifdef FEAT_RIGHTLEFT
 EXTERN long	p_aleph;	/* 'aleph' */
 #endif
+#ifdef FEAT_JOB_CONTROL
+EXTERN int	p_amk;		/* 'asyncmake' */
+#endif
 #ifdef FEAT_AUTOCHDIR
 EXTERN int	p_acd;		/* 'autochdir' */
 #endif
@@ -447,6 +450,10 @@ EXTERN char_u	*p_gp;		/* 'grepprg' */
 #ifdef FEAT_AUTOCMD
 EXTERN char_u	*p_ei;		/* 'eventignore' */
 #endif
+#ifdef FEAT_EVENT_LOOP
+EXTERN char_u	*p_eqf;		/* 'eventqueuefull' */
+EXTERN long	p_eqs;		/* 'eventqueuesize' */
+#endif
 EXTERN int	p_ek;		/* 'esckeys' */
 EXTERN int	p_exrc;		/* 'exrc' */
 #ifdef FEAT_MBYTE
@@ -594,6 +601,9 @@ EXTERN long	p_stal;		/* 'showtabline' */
 EXTERN char_u	*p_lcs;		/* 'listchars' */
 
 EXTERN int	p_lz;		/* 'lazyredraw' */
+#ifdef FEAT_PROGRESSIVE_LOAD
+EXTERN long	p_lol;		/* 'loadlines' */
+#endif
 EXTERN int	p_lpl;		/* 'loadplugins' */
 #ifdef FEAT_GUI_MAC
 EXTERN int	p_macatsui;	/* 'macatsui' */
@@ -618,12 +628,18 @@ EXTERN long	p_mmd;		/* 'maxmapdepth' */
 EXTERN long	p_mm;		/* 'maxmem' */
 EXTERN long	p_mmp;		/* 'maxmempattern' */
 EXTERN long	p_mmt;		/* 'maxmemtot' */
+#ifdef FEAT_MEMZIP
+EXTERN long	p_mmz;		/* 'maxmemzip' */
+#endif
 #ifdef FEAT_MENU
 EXTERN long	p_mis;		/* 'menuitems' */
 #endif
 #ifdef FEAT_SPELL
 EXTERN char_u	*p_msm;		/* 'mkspellmem' */
 #endif
+#ifdef FEAT_MMAP
+EXTERN long	p_mms;		/* 'mmapsize' */
+#endif
 EXTERN long	p_mls;		/* 'modelines' */
 EXTERN char_u	*p_mouse;	/* 'mouse' */
 #ifdef FEAT_GUI
@@ -761,6 +777,9 @@ EXTERN int	p_spr;		/* 'splitright' */
 EXTERN int	p_sol;		/* 'startofline' */
 EXTERN char_u	*p_su;		/* 'suffixes' */
 EXTERN char_u	*p_sws;		/* 'swapsync' */
+#ifdef FEAT_SWAP_THREAD
+EXTERN int	p_swt;		/* 'swapthread' */
+#endif
 EXTERN char_u	*p_swb;		/* 'switchbuf' */
 EXTERN unsigned	swb_flags;
 #ifdef IN_OPTION_C
@@ -839,6 +858,7 @@ static char *(p_ttym_values[]) = {"xterm", "xterm2", "dec", "netterm", "jsbterm"
 #endif
 EXTERN char_u	*p_udir;	/* 'undodir' */
 EXTERN long	p_ul;		/* 'undolevels' */
+EXTERN long	p_umm;		/* 'undomaxmem' */
 EXTERN long	p_ur;		/* 'undoreload' */
 EXTERN long	p_uc;		/* 'updatecount' */
 EXTERN long	p_ut;		/* 'updatetime' */
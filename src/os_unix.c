@@ -37,6 +37,10 @@
 
 #include "os_unixx.h"	    /* unix includes for os_unix.c only */
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #ifdef USE_XSMP
 # include <X11/SM/SMlib.h>
 #endif
@@ -412,6 +416,12 @@ mch_inchar(buf, maxlen, wtime, tb_change_cnt)
 	 */
 	if (WaitForChar(p_ut) == 0)
 	{
+#ifdef FEAT_EVENT_LOOP
+	    /* Woken up by an event from another thread, 'updatetime' didn't
+	     * pass yet. */
+	    if (ev_pending())
+		return 0;
+#endif
 #ifdef FEAT_AUTOCMD
 	    if (trigger_cursorhold() && maxlen >= 3
 					   && !typebuf_changed(tb_change_cnt))
@@ -909,7 +919,7 @@ sig_alarm SIGDEFARG(sigarg)
 
 #if (defined(HAVE_SETJMP_H) \
 	&& ((defined(FEAT_X11) && defined(FEAT_XCLIPBOARD)) \
-	    || defined(FEAT_LIBCALL))) \
+	    || defined(FEAT_LIBCALL) || defined(FEAT_MMAP))) \
     || defined(PROTO)
 /*
  * A simplistic version of setjmp() that only allows one level of using.
@@ -3154,6 +3164,10 @@ mch_exit(r)
 {
     exiting = TRUE;
 
+#ifdef FEAT_JOB_CONTROL
+    job_stop_all();
+#endif
+
 #if defined(FEAT_X11) && defined(FEAT_CLIPBOARD)
     x11_export_final_selection();
 #endif
@@ -4944,6 +4958,175 @@ error:
 #endif /* USE_SYSTEM */
 }
 
+#if defined(FEAT_JOB_CONTROL) || defined(PROTO)
+/*
+ * Start "argv" in the background, with its stdin, stdout and stderr
+ * connected to non-blocking pipes.  The process gets its own process group,
+ * so that mch_stop_job() also stops what it started.
+ * Returns FAIL when the pipes or the process could not be created.
+ */
+    int
+mch_start_job(argv, pidp, fd_in, fd_out, fd_err)
+    char	**argv;
+    int		*pidp;
+    int		*fd_in;
+    int		*fd_out;
+    int		*fd_err;
+{
+    int		fds[6];
+    int		n;
+    int		i;
+    pid_t	pid;
+
+    for (n = 0; n < 6; n += 2)
+	if (pipe(fds + n) < 0)
+	{
+	    for (i = 0; i < n; ++i)
+		close(fds[i]);
+	    return FAIL;
+	}
+
+    if ((pid = fork()) == -1)
+    {
+	for (i = 0; i < 6; ++i)
+	    close(fds[i]);
+	return FAIL;
+    }
+
+    if (pid == 0)	/* child */
+    {
+	reset_signals();		/* handle signals normally */
+# ifdef HAVE_SETSID
+	(void)setsid();
+# endif
+	/* set up stdin, stdout and stderr for the child */
+	close(0);
+	ignored = dup(fds[0]);
+	close(1);
+	ignored = dup(fds[3]);
+	close(2);
+	ignored = dup(fds[5]);
+	for (i = 0; i < 6; ++i)
+	    close(fds[i]);
+
+	execvp(argv[0], argv);
+	_exit(127);	    /* exec failed, like the shell does */
+    }
+
+    /* parent */
+    close(fds[0]);
+    close(fds[3]);
+    close(fds[5]);
+    *pidp = (int)pid;
+    *fd_in = fds[1];
+    *fd_out = fds[2];
+    *fd_err = fds[4];
+
+    /* Not inherited by other children, never wait for the job. */
+    for (i = 0; i < 3; ++i)
+    {
+	n = i == 0 ? *fd_in : i == 1 ? *fd_out : *fd_err;
+	(void)fcntl(n, F_SETFD, FD_CLOEXEC);
+	(void)fcntl(n, F_SETFL, fcntl(n, F_GETFL) | O_NONBLOCK);
+    }
+    return OK;
+}
+
+/*
+ * Ask job process "pid" and its process group to terminate.
+ */
+    void
+mch_stop_job(pid)
+    int		pid;
+{
+# ifdef HAVE_SETSID
+    kill(-(pid_t)pid, SIGTERM);
+# endif
+    kill((pid_t)pid, SIGTERM);
+}
+
+/*
+ * Check whether job process "pid" exited without waiting.  If so store the
+ * exit status in "*status", or 128 plus the signal number when it was
+ * killed, and return OK.
+ */
+    int
+mch_job_status(pid, status)
+    int		pid;
+    int		*status;
+{
+    waitstatus	ws;
+    pid_t	wait_pid;
+
+    wait_pid = waitpid((pid_t)pid, &ws, WNOHANG);
+    if (wait_pid == 0)
+	return FAIL;
+    if (wait_pid < 0)
+	*status = -1;	/* already reaped by someone else */
+# if defined(WIFSIGNALED) && defined(WTERMSIG)
+    else if (WIFSIGNALED(ws))
+	*status = 128 + WTERMSIG(ws);
+# endif
+    else
+	*status = WEXITSTATUS(ws);
+    return OK;
+}
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) || defined(PROTO)
+/*
+ * Map regular file "fname" into memory, read-only.  Sets "*lenp" to its size.
+ * When "fdp" is not NULL the file is kept open and "*fdp" set to the file
+ * descriptor.
+ * Returns NULL when it can't be opened or mapped, or is empty.
+ * Doesn't use Vim's memory functions, may be called from any thread.
+ */
+    char_u *
+mch_map_file(fname, lenp, fdp)
+    char_u	*fname;
+    size_t	*lenp;
+    int		*fdp;
+{
+    int		fd;
+    struct stat	st;
+    void	*p = MAP_FAILED;
+
+    fd = open((char *)fname, O_RDONLY | O_EXTRA, 0);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+				  && (off_t)(size_t)st.st_size == st.st_size)
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, (off_t)0);
+    if (p == MAP_FAILED || fdp == NULL)
+	close(fd);
+    if (p == MAP_FAILED)
+	return NULL;
+    if (fdp != NULL)
+    {
+# ifdef HAVE_FD_CLOEXEC
+	int fdflags = fcntl(fd, F_GETFD);
+
+	if (fdflags >= 0 && (fdflags & FD_CLOEXEC) == 0)
+	    fcntl(fd, F_SETFD, fdflags | FD_CLOEXEC);
+# endif
+	*fdp = fd;
+    }
+    *lenp = (size_t)st.st_size;
+    return (char_u *)p;
+}
+
+/*
+ * Undo mch_map_file().
+ */
+    void
+mch_unmap_file(p, len)
+    char_u	*p;
+    size_t	len;
+{
+    munmap((void *)p, len);
+}
+#endif
+
 /*
  * Check for CTRL-C typed by reading all available characters.
  * In cooked mode we should get SIGINT, no need to check.
@@ -5060,6 +5243,15 @@ RealWaitForChar(fd, msec, check_for_gpm)
 #ifdef FEAT_NETBEANS_INTG
     int		nb_fd = netbeans_filedesc();
 #endif
+#ifdef FEAT_EVENT_LOOP
+    int		ev_fd = ev_wakeup_fd();
+#endif
+#ifdef FEAT_JOB_CONTROL
+    int		job_fd[JOB_MAX_FDS];
+    int		job_wr[JOB_MAX_FDS];
+    int		job_nfd;
+    int		job_i;
+#endif
 #if defined(FEAT_XCLIPBOARD) || defined(USE_XSMP) || defined(FEAT_MZSCHEME)
     static int	busy = FALSE;
 
@@ -5109,7 +5301,12 @@ RealWaitForChar(fd, msec, check_for_gpm)
 # endif
 #endif
 #ifndef HAVE_SELECT
-	struct pollfd   fds[6];
+# ifdef FEAT_JOB_CONTROL
+	struct pollfd   fds[7 + JOB_MAX_FDS];
+	int		job_idx = -1;
+# else
+	struct pollfd   fds[7];
+# endif
 	int		nfd;
 # ifdef FEAT_XCLIPBOARD
 	int		xterm_idx = -1;
@@ -5122,6 +5319,9 @@ RealWaitForChar(fd, msec, check_for_gpm)
 # endif
 # ifdef FEAT_NETBEANS_INTG
 	int		nb_idx = -1;
+# endif
+# ifdef FEAT_EVENT_LOOP
+	int		ev_idx = -1;
 # endif
 	int		towait = (int)msec;
 
@@ -5182,6 +5382,26 @@ RealWaitForChar(fd, msec, check_for_gpm)
 	    nfd++;
 	}
 #endif
+#ifdef FEAT_EVENT_LOOP
+	if (ev_fd != -1)
+	{
+	    ev_idx = nfd;
+	    fds[nfd].fd = ev_fd;
+	    fds[nfd].events = POLLIN;
+	    nfd++;
+	}
+#endif
+#ifdef FEAT_JOB_CONTROL
+	job_nfd = job_get_fds(job_fd, job_wr, JOB_MAX_FDS);
+	job_idx = nfd;
+	for (job_i = 0; job_i < job_nfd; ++job_i)
+	{
+	    fds[nfd].fd = job_fd[job_i];
+	    fds[nfd].events = job_wr[job_i] ? POLLOUT : POLLIN;
+	    nfd++;
+	}
+	towait = (int)job_wait_time((long)towait);
+#endif
 
 	ret = poll(fds, nfd, towait);
 # ifdef FEAT_MZSCHEME
@@ -5242,13 +5462,32 @@ RealWaitForChar(fd, msec, check_for_gpm)
 	    --ret;
 	}
 #endif
+#ifdef FEAT_EVENT_LOOP
+	/* An event was pushed by another thread, return without a character
+	 * so that the caller can handle it. */
+	if (ret > 0 && ev_idx != -1 && fds[ev_idx].revents & POLLIN)
+	{
+	    ev_wakeup_clear();
+	    --ret;
+	}
+#endif
+#ifdef FEAT_JOB_CONTROL
+	/* Output of a job is passed on as an event. */
+	for (job_i = 0; ret > 0 && job_i < job_nfd; ++job_i)
+	    if (fds[job_idx + job_i].revents & (POLLIN | POLLOUT | POLLHUP
+								  | POLLERR))
+	    {
+		job_fd_ready(job_fd[job_i], job_wr[job_i]);
+		--ret;
+	    }
+#endif
 
 
 #else /* HAVE_SELECT */
 
 	struct timeval  tv;
 	struct timeval	*tvp;
-	fd_set		rfds, efds;
+	fd_set		rfds, wfds, efds;
 	int		maxfd;
 	long		towait = msec;
 
@@ -5267,6 +5506,9 @@ RealWaitForChar(fd, msec, check_for_gpm)
 	    return 0;
 # endif
 
+# ifdef FEAT_JOB_CONTROL
+	towait = job_wait_time(towait);
+# endif
 	if (towait >= 0)
 	{
 	    tv.tv_sec = towait / 1000;
@@ -5281,6 +5523,7 @@ RealWaitForChar(fd, msec, check_for_gpm)
 	 */
 select_eintr:
 	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
 	FD_ZERO(&efds);
 	FD_SET(fd, &rfds);
 # if !defined(__QNX__) && !defined(__CYGWIN32__)
@@ -5336,8 +5579,25 @@ select_eintr:
 		maxfd = nb_fd;
 	}
 # endif
+# ifdef FEAT_EVENT_LOOP
+	if (ev_fd != -1)
+	{
+	    FD_SET(ev_fd, &rfds);
+	    if (maxfd < ev_fd)
+		maxfd = ev_fd;
+	}
+# endif
+# ifdef FEAT_JOB_CONTROL
+	job_nfd = job_get_fds(job_fd, job_wr, JOB_MAX_FDS);
+	for (job_i = 0; job_i < job_nfd; ++job_i)
+	{
+	    FD_SET(job_fd[job_i], job_wr[job_i] ? &wfds : &rfds);
+	    if (maxfd < job_fd[job_i])
+		maxfd = job_fd[job_i];
+	}
+# endif
 
-	ret = select(maxfd + 1, &rfds, NULL, &efds, tvp);
+	ret = select(maxfd + 1, &rfds, &wfds, &efds, tvp);
 # ifdef EINTR
 	if (ret == -1 && errno == EINTR)
 	{
@@ -5429,6 +5689,22 @@ select_eintr:
 	    --ret;
 	}
 #endif
+#ifdef FEAT_EVENT_LOOP
+	if (ret > 0 && ev_fd != -1 && FD_ISSET(ev_fd, &rfds))
+	{
+	    ev_wakeup_clear();
+	    --ret;
+	}
+#endif
+#ifdef FEAT_JOB_CONTROL
+	/* Output of a job is passed on as an event. */
+	for (job_i = 0; ret > 0 && job_i < job_nfd; ++job_i)
+	    if (FD_ISSET(job_fd[job_i], job_wr[job_i] ? &wfds : &rfds))
+	    {
+		job_fd_ready(job_fd[job_i], job_wr[job_i]);
+		--ret;
+	    }
+#endif
 
 #endif /* HAVE_SELECT */
 
@@ -137,6 +137,13 @@ int vim_vsnprintf(char *str, size_t str_m, char *fmt, va_list ap, typval_T *tvs)
 #  include "event_loop.pro"
 # endif
 
+# ifdef FEAT_JOB_CONTROL
+#  include "job.pro"
+# endif
+# ifdef FEAT_TIMERS
+#  include "timer.pro"
+# endif
+
 # include "message.pro"
 # include "misc1.pro"
 # include "misc2.pro"
@@ -172,6 +179,7 @@ void qsort __ARGS((void *base, size_t elm_count, size_t elm_size, int (*cmp)(con
 # if defined(HAVE_TGETENT) && (defined(AMIGA) || defined(VMS))
 #  include "termlib.pro"
 # endif
+# include "textscan.pro"
 # include "ui.pro"
 # include "undo.pro"
 # include "version.pro"
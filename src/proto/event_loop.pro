@@ -1,4 +1,11 @@
 /* event_loop.c */
 int ev_next __ARGS((char_u *buf, int maxlen, long wtime, int tb_change_cnt));
+int ev_wakeup_fd __ARGS((void));
+void ev_wakeup_clear __ARGS((void));
+int ev_pending __ARGS((void));
+void ev_init __ARGS((void));
+void ev_set_full_policy __ARGS((char_u *val));
 void ev_trigger __ARGS((char_u *event, char_u *event_args));
+void event_autocmd __ARGS((char_u *name, char_u *event_args));
 void apply_event_autocmd __ARGS((void));
+int ev_dispatching __ARGS((void));
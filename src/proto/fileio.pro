@@ -1,8 +1,16 @@
 /* fileio.c */
 void filemess __ARGS((buf_T *buf, char_u *name, char_u *s, int attr));
 int readfile __ARGS((char_u *fname, char_u *sfname, linenr_T from, linenr_T lines_to_skip, linenr_T lines_to_read, exarg_T *eap, int flags));
+int buf_load_start __ARGS((buf_T *buf, int fd, int fileformat, off_t offset));
+void buf_load_stop __ARGS((buf_T *buf));
+int buf_load_pending __ARGS((void));
+void buf_load_step __ARGS((void));
+void buf_load_finish __ARGS((buf_T *buf));
+int buf_load_more __ARGS((buf_T *buf, linenr_T lnum));
+int buf_load_percent __ARGS((buf_T *buf));
 int prep_exarg __ARGS((exarg_T *eap, buf_T *buf));
 void set_file_options __ARGS((int set_options, exarg_T *eap));
+int fenc_raw_mode __ARGS((buf_T *buf, int *bomp));
 void set_forced_fenc __ARGS((exarg_T *eap));
 int prepare_crypt_read __ARGS((FILE *fp));
 char_u *prepare_crypt_write __ARGS((buf_T *buf, int *lenp));
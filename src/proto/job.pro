@@ -0,0 +1,14 @@
+/* job.c */
+int job_start __ARGS((char_u *name, char **argv));
+int job_start_cb __ARGS((char **argv, void (*cb)(int id, int what, char_u *data, int len)));
+int job_start_shell __ARGS((char_u *cmd, void (*cb)(int id, int what, char_u *data, int len)));
+int job_send __ARGS((int id, char_u *data, int len));
+int job_stop __ARGS((int id));
+void job_stop_all __ARGS((void));
+int job_get_fds __ARGS((int *fds, int *writing, int max));
+long job_wait_time __ARGS((long msec));
+void job_fd_ready __ARGS((int fd, int writing));
+void job_poll __ARGS((void));
+int job_callbacks_pending __ARGS((void));
+void job_run_callbacks __ARGS((void));
+/* vim: set ft=c : */
@@ -8,11 +8,15 @@ bhdr_T *mf_new __ARGS((memfile_T *mfp, int negative, int page_count));
 bhdr_T *mf_get __ARGS((memfile_T *mfp, blocknr_T nr, int page_count));
 void mf_put __ARGS((memfile_T *mfp, bhdr_T *hp, int dirty, int infile));
 void mf_free __ARGS((memfile_T *mfp, bhdr_T *hp));
+void mf_free_nr __ARGS((memfile_T *mfp, blocknr_T nr, int page_count));
 int mf_sync __ARGS((memfile_T *mfp, int flags));
 void mf_set_dirty __ARGS((memfile_T *mfp));
+bhdr_T *mf_find_block __ARGS((memfile_T *mfp, blocknr_T nr));
 int mf_release_all __ARGS((void));
+void mf_writer_wait __ARGS((memfile_T *mfp));
 blocknr_T mf_trans_del __ARGS((memfile_T *mfp, blocknr_T old_nr));
 void mf_set_ffname __ARGS((memfile_T *mfp));
 void mf_fullname __ARGS((memfile_T *mfp));
 int mf_need_trans __ARGS((memfile_T *mfp));
+void mf_unmap __ARGS((memfile_T *mfp));
 /* vim: set ft=c : */
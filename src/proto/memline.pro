@@ -11,6 +11,7 @@ void ml_close_notmod __ARGS((void));
 void ml_timestamp __ARGS((buf_T *buf));
 void ml_recover __ARGS((void));
 int recover_names __ARGS((char_u *fname, int list, int nr, char_u **fname_out));
+void ml_swap_index __ARGS((char_u *fname, int add));
 void ml_sync_all __ARGS((int check_file, int check_char));
 void ml_preserve __ARGS((buf_T *buf, int message));
 char_u *ml_get __ARGS((linenr_T lnum));
@@ -18,11 +19,14 @@ char_u *ml_get_pos __ARGS((pos_T *pos));
 char_u *ml_get_curline __ARGS((void));
 char_u *ml_get_cursor __ARGS((void));
 char_u *ml_get_buf __ARGS((buf_T *buf, linenr_T lnum, int will_change));
+int ml_get_buf_lines __ARGS((buf_T *buf, linenr_T lnum, linenr_T lnum_max, int maxcount, char_u **lines, colnr_T *lens));
 int ml_line_alloced __ARGS((void));
 int ml_append __ARGS((linenr_T lnum, char_u *line, colnr_T len, int newfile));
 int ml_append_buf __ARGS((buf_T *buf, linenr_T lnum, char_u *line, colnr_T len, int newfile));
+long ml_append_lines __ARGS((buf_T *buf, linenr_T lnum, char_u **lines, colnr_T *lens, long count, int newfile));
 int ml_replace __ARGS((linenr_T lnum, char_u *line, int copy));
 int ml_delete __ARGS((linenr_T lnum, int message));
+int ml_delete_lines __ARGS((linenr_T lnum, long count, int message));
 void ml_setmarked __ARGS((linenr_T lnum));
 linenr_T ml_firstmarked __ARGS((void));
 void ml_clearmarked __ARGS((void));
@@ -34,4 +38,8 @@ char_u *ml_encrypt_data __ARGS((memfile_T *mfp, char_u *data, off_t offset, unsi
 void ml_decrypt_data __ARGS((memfile_T *mfp, char_u *data, off_t offset, unsigned size));
 long ml_find_line_or_offset __ARGS((buf_T *buf, linenr_T lnum, long *offp));
 void goto_byte __ARGS((long cnt));
+int ml_map_file __ARGS((buf_T *buf, char_u *fname, int *ffp, int *bomp, int *eolp));
+void ml_map_fill __ARGS((memfile_T *mfp, bhdr_T *hp));
+void ml_map_detach __ARGS((buf_T *buf));
+int ml_map_uses_file __ARGS((buf_T *buf, char_u *fname));
 /* vim: set ft=c : */
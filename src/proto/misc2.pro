@@ -75,6 +75,7 @@ int get_fileformat __ARGS((buf_T *buf));
 int get_fileformat_force __ARGS((buf_T *buf, exarg_T *eap));
 void set_fileformat __ARGS((int t, int opt_flags));
 int default_fileformat __ARGS((void));
+char_u *shell_xquote __ARGS((char_u *cmd));
 int call_shell __ARGS((char_u *cmd, int opt));
 int get_real_state __ARGS((void));
 int after_pathsep __ARGS((char_u *b, char_u *p));
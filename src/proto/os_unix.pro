@@ -56,6 +56,11 @@ int mch_get_shellsize __ARGS((void));
 void mch_set_shellsize __ARGS((void));
 void mch_new_shellsize __ARGS((void));
 int mch_call_shell __ARGS((char_u *cmd, int options));
+int mch_start_job __ARGS((char **argv, int *pidp, int *fd_in, int *fd_out, int *fd_err));
+void mch_stop_job __ARGS((int pid));
+int mch_job_status __ARGS((int pid, int *status));
+char_u *mch_map_file __ARGS((char_u *fname, size_t *lenp, int *fdp));
+void mch_unmap_file __ARGS((char_u *p, size_t len));
 void mch_breakcheck __ARGS((void));
 int mch_expandpath __ARGS((garray_T *gap, char_u *path, int flags));
 int mch_expand_wildcards __ARGS((int num_pat, char_u **pat, int *num_file, char_u ***file, int flags));
@@ -0,0 +1,7 @@
+/* textscan.c */
+int scan_set_level __ARGS((int level));
+long scan_eol __ARGS((char_u *p, long len, int mac));
+long scan_count __ARGS((char_u *p, long len, int c));
+long scan_find __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+long scan_utf8 __ARGS((char_u *p, long len));
+/* vim: set ft=c : */
@@ -0,0 +1,7 @@
+/* timer.c */
+int timer_start __ARGS((long msec, char_u *callback, int repeat));
+int timer_stop __ARGS((int id));
+long timer_wait_time __ARGS((void));
+int timer_due __ARGS((void));
+void timer_run_due __ARGS((void));
+/* vim: set ft=c : */
@@ -106,7 +106,125 @@ struct efm_S
     int		    conthere;	/* %> used */
 };
 
+/*
+ * State of parsing error messages with 'errorformat', kept from one line to
+ * the next.
+ */
+typedef struct qfstate_S
+{
+    qf_info_T	    *qi;	/* the current list of "qi" is added to */
+    efm_T	    *fmt_first;	/* compiled 'errorformat' */
+    efm_T	    *fmt_start;	/* %> item of the previous line */
+    qfline_T	    *qfprev;	/* last added entry */
+    char_u	    *namebuf;
+    char_u	    *errmsg;
+    char_u	    *pattern;
+    char_u	    *directory;	/* current directory, in "dir_stack" */
+    char_u	    *currfile;	/* current file, in "file_stack" */
+    struct dir_stack_T *file_stack;
+    int		    multiline;
+    int		    multiignore;
+} qfstate_T;
+
+#ifdef FEAT_JOB_CONTROL
+/*
+ * A ":make" or ":grep" running in the background with 'asyncmake'.  Its
+ * output is parsed as it arrives.
+ */
+typedef struct
+{
+    qfstate_T	    qs_state;	/* "qs_state.qi" holds the list */
+    int		    qs_job;	/* job ID */
+    int		    qs_loclist;	/* "qs_state.qi" is a location list */
+    int		    qs_list;	/* index of the list in "qs_state.qi" */
+    int		    qs_count;	/* number of entries added so far */
+    struct dir_stack_T *qs_dir_stack;	/* "dir_stack" between chunks */
+    garray_T	    qs_partial[2];	/* incomplete line of stdout, stderr */
+    struct timeval  qs_updated;	/* when the quickfix window was updated */
+    int		    qs_jump;	/* jump to the first error */
+    char_u	    *qs_au_name;	/* for QuickFixCmdPost */
+    int		    qs_busy;	/* parsing, must not be freed */
+    int		    qs_end;	/* qf_stream_end() called while busy */
+} qfstream_T;
+
+/* Values for the argument of qf_stream_end(). */
+# define QS_DONE    1	/* the command exited */
+# define QS_STOP    2	/* stopped, keep what was found so far */
+# define QS_ERROR   3	/* 'errorformat' error, drop the list */
+
+# define QS_UPDATE_MSEC	200	/* msec between updates of the window */
+
+static qfstream_T   *qf_stream = NULL;
+#endif
+
+#ifdef UNIX
+/*
+ * ":vimgrep" reads files that are not loaded into memory and searches their
+ * lines directly, without loading them into a dummy buffer.  With the event
+ * loop, which brings pthreads, a few reader threads read and check the files
+ * ahead of the main thread, which does the matching in file order.
+ * The files are read, not mapped: when a mapped file is truncated meanwhile,
+ * touching a page past its new end causes a SIGBUS, which can't be caught in
+ * a reader thread.
+ * Although the state of a match is kept per call, the matching is not done
+ * in the readers: the engines check for CTRL-C with fast_breakcheck(), may
+ * give an error message, build the DFA of the program lazily and update the
+ * ":regexpprofile" counters.  The entries must be added in file order
+ * anyway.
+ */
+# define VGR_FAST
+# ifdef FEAT_EVENT_LOOP
+#  include <pthread.h>
+# endif
+
+# define VGR_MAXTHREADS	8	/* maximum number of reader threads */
+# define VGR_AHEAD	32	/* files read ahead of the main thread */
+# define VGR_AHEAD_BYTES (64L * 1024 * 1024) /* bytes read ahead */
+# define VGR_MAXSIZE	(256L * 1024 * 1024) /* bigger files use a buffer */
+
+/* States of a file. */
+# define VF_PENDING	0	/* not read yet */
+# define VF_READY	1	/* read, can be searched */
+# define VF_FALLBACK	2	/* must be loaded into a buffer */
+
+typedef struct
+{
+    char_u	*vf_fname;	/* full file name */
+    int		vf_state;	/* VF_PENDING, VF_READY or VF_FALLBACK */
+    char_u	*vf_data;	/* file contents, allocated with malloc() */
+    size_t	vf_len;
+    size_t	vf_start;	/* offset of the text, after a BOM */
+    int		vf_dos;		/* lines end in CR-NL */
+} vgrfile_T;
+
+typedef struct
+{
+    vgrfile_T	*vg_files;
+    int		vg_count;
+    int		vg_fenc;	/* RAW_ANY, RAW_UTF8 or RAW_ASCII */
+    int		vg_bom;		/* 'fileencodings' has "ucs-bom" */
+    int		vg_utf8;	/* 'encoding' is UTF-8 */
+    int		vg_dos;		/* 'fileformats' has "dos" */
+    int		vg_mac;		/* 'fileformats' has "mac" */
+# ifdef FEAT_EVENT_LOOP
+    pthread_t	vg_threads[VGR_MAXTHREADS];
+    int		vg_nthreads;
+    pthread_mutex_t vg_mutex;
+    pthread_cond_t vg_cond;	/* a file was read or released */
+    int		vg_next;	/* next file for a reader */
+    int		vg_done;	/* files released by the main thread */
+    long	vg_bytes;	/* size of files read but not released */
+    int		vg_stop;	/* readers must exit */
+# endif
+} vgrpool_T;
+#endif
+
 static int	qf_init_ext __ARGS((qf_info_T *qi, char_u *efile, buf_T *buf, typval_T *tv, char_u *errorformat, int newlist, linenr_T lnumfirst, linenr_T lnumlast, char_u *qf_title));
+static int	qf_parse_start __ARGS((qfstate_T *st, qf_info_T *qi, char_u *efm));
+static int	qf_parse_line __ARGS((qfstate_T *st));
+static void	qf_parse_end __ARGS((qfstate_T *st));
+static void	qf_list_done __ARGS((qf_info_T *qi));
+static void	qf_drop_list __ARGS((qf_info_T *qi));
 static void	qf_new_list __ARGS((qf_info_T *qi, char_u *qf_title));
 static void	ll_free_all __ARGS((qf_info_T **pqi));
 static int	qf_add_entry __ARGS((qf_info_T *qi, qfline_T **prevp, char_u *dir, char_u *fname, int bufnum, char_u *mesg, long lnum, int col, int vis_col, char_u *pattern, int nr, int type, int valid));
@@ -129,12 +247,35 @@ static void	qf_update_buffer __ARGS((qf_info_T *qi));
 static void	qf_set_title __ARGS((qf_info_T *qi));
 static void	qf_fill_buffer __ARGS((qf_info_T *qi));
 #endif
+static char_u	*make_get_cmd __ARGS((char_u *arg, char_u *fname));
 static char_u	*get_mef_name __ARGS((void));
 static void	restore_start_dir __ARGS((char_u *dirname_start));
 static buf_T	*load_dummy_buffer __ARGS((char_u *fname, char_u *dirname_start, char_u *resulting_dir));
 static void	wipe_dummy_buffer __ARGS((buf_T *buf, char_u *dirname_start));
 static void	unload_dummy_buffer __ARGS((buf_T *buf, char_u *dirname_start));
 static qf_info_T *ll_get_or_alloc_list __ARGS((win_T *));
+#ifdef FEAT_JOB_CONTROL
+static int	qf_stream_start __ARGS((win_T *wp, char_u *cmd, char_u *efm, int newlist, char_u *qf_title, char_u *au_name, int jump));
+static void	qf_stream_output __ARGS((int id, int what, char_u *data, int len));
+static int	qf_stream_lines __ARGS((qfstream_T *qs, garray_T *gap, int flush));
+static int	qf_stream_current __ARGS((qfstream_T *qs));
+static void	qf_stream_jump __ARGS((qfstream_T *qs));
+static void	qf_stream_end __ARGS((qfstream_T *qs, int how));
+#endif
+#ifdef VGR_FAST
+static int	vgr_pattern_ok __ARGS((char_u *pat));
+static vgrpool_T *vgr_start __ARGS((char_u **fnames, int fcount, char_u *pat));
+static char_u	*vgr_read __ARGS((char_u *fname, size_t *lenp));
+static void	vgr_read_file __ARGS((vgrpool_T *vg, vgrfile_T *vf));
+# ifdef FEAT_EVENT_LOOP
+static void	*vgr_reader __ARGS((void *arg));
+# endif
+static vgrfile_T *vgr_get __ARGS((vgrpool_T *vg, int idx));
+static void	vgr_release __ARGS((vgrpool_T *vg, int idx));
+static void	vgr_end __ARGS((vgrpool_T *vg));
+static int	vgr_may_read __ARGS((char_u *fname));
+static void	vgr_match_file __ARGS((qf_info_T *qi, qfline_T **prevp, vgrfile_T *vf, char_u *fname, regmatch_T *regmatch, int flags, long *tomatch, garray_T *gap));
+#endif
 
 /* Quickfix window check helper macro */
 #define IS_QF_WINDOW(wp) (bt_quickfix(wp->w_buffer) && wp->w_llist_ref == NULL)
@@ -198,42 +339,181 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
     linenr_T	    lnumlast;		/* last line number to use */
     char_u	    *qf_title;
 {
-    char_u	    *namebuf;
-    char_u	    *errmsg;
-    char_u	    *pattern;
-    char_u	    *fmtstr = NULL;
-    int		    col = 0;
-    char_u	    use_viscol = FALSE;
-    int		    type = 0;
-    int		    valid;
+    qfstate_T	    state;
+    char_u	    *efmp;
+    char_u	    *efm;
     linenr_T	    buflnum = lnumfirst;
-    long	    lnum = 0L;
-    int		    enr = 0;
     FILE	    *fd = NULL;
-    qfline_T	    *qfprev = NULL;	/* init to make SASC shut up */
+    int		    len;
+    int		    retval = -1;	/* default: return error flag */
+    char_u	    *p_str = NULL;
+    listitem_T	    *p_li = NULL;
+
+    vim_memset(&state, 0, sizeof(state));
+
+    if (efile != NULL && (fd = mch_fopen((char *)efile, "r")) == NULL)
+    {
+	EMSG2(_(e_openerrf), efile);
+	goto qf_init_end;
+    }
+
+    if (newlist || qi->qf_curlist == qi->qf_listcount)
+	/* make place for a new list */
+	qf_new_list(qi, qf_title);
+    else if (qi->qf_lists[qi->qf_curlist].qf_count > 0)
+	/* Adding to existing list, find last entry. */
+	for (state.qfprev = qi->qf_lists[qi->qf_curlist].qf_start;
+		  state.qfprev->qf_next != state.qfprev;
+					     state.qfprev = state.qfprev->qf_next)
+	    ;
+
+    /* Use the local value of 'errorformat' if it's set. */
+    if (errorformat == p_efm && tv == NULL && *buf->b_p_efm != NUL)
+	efm = buf->b_p_efm;
+    else
+	efm = errorformat;
+    if (qf_parse_start(&state, qi, efm) == FAIL)
+	goto error2;
+
+    /*
+     * got_int is reset here, because it was probably set when killing the
+     * ":make" command, but we still want to read the errorfile then.
+     */
+    got_int = FALSE;
+
+    if (tv != NULL)
+    {
+	if (tv->v_type == VAR_STRING)
+	    p_str = tv->vval.v_string;
+	else if (tv->v_type == VAR_LIST)
+	    p_li = tv->vval.v_list->lv_first;
+    }
+
+    /*
+     * Read the lines in the error file one by one.
+     * Try to recognize one of the error formats in each line.
+     */
+    while (!got_int)
+    {
+	/* Get the next line. */
+	if (fd == NULL)
+	{
+	    if (tv != NULL)
+	    {
+		if (tv->v_type == VAR_STRING)
+		{
+		    /* Get the next line from the supplied string */
+		    char_u *p;
+
+		    if (!*p_str) /* Reached the end of the string */
+			break;
+
+		    p = vim_strchr(p_str, '\n');
+		    if (p)
+			len = (int)(p - p_str + 1);
+		    else
+			len = (int)STRLEN(p_str);
+
+		    if (len > CMDBUFFSIZE - 2)
+			vim_strncpy(IObuff, p_str, CMDBUFFSIZE - 2);
+		    else
+			vim_strncpy(IObuff, p_str, len);
+
+		    p_str += len;
+		}
+		else if (tv->v_type == VAR_LIST)
+		{
+		    /* Get the next line from the supplied list */
+		    while (p_li && p_li->li_tv.v_type != VAR_STRING)
+			p_li = p_li->li_next;	/* Skip non-string items */
+
+		    if (!p_li)			/* End of the list */
+			break;
+
+		    len = (int)STRLEN(p_li->li_tv.vval.v_string);
+		    if (len > CMDBUFFSIZE - 2)
+			len = CMDBUFFSIZE - 2;
+
+		    vim_strncpy(IObuff, p_li->li_tv.vval.v_string, len);
+
+		    p_li = p_li->li_next;	/* next item */
+		}
+	    }
+	    else
+	    {
+		/* Get the next line from the supplied buffer */
+		if (buflnum > lnumlast)
+		    break;
+		vim_strncpy(IObuff, ml_get_buf(buf, buflnum++, FALSE),
+			    CMDBUFFSIZE - 2);
+	    }
+	}
+	else if (fgets((char *)IObuff, CMDBUFFSIZE - 2, fd) == NULL)
+	    break;
+
+	IObuff[CMDBUFFSIZE - 2] = NUL;  /* for very long lines */
+#ifdef FEAT_MBYTE
+	remove_bom(IObuff);
+#endif
+
+	if ((efmp = vim_strrchr(IObuff, '\n')) != NULL)
+	    *efmp = NUL;
+#ifdef USE_CRNL
+	if ((efmp = vim_strrchr(IObuff, '\r')) != NULL)
+	    *efmp = NUL;
+#endif
+
+	if (qf_parse_line(&state) == FAIL)
+	    goto error2;
+	line_breakcheck();
+    }
+    if (fd == NULL || !ferror(fd))
+    {
+	qf_list_done(qi);
+	/* return number of matches */
+	retval = qi->qf_lists[qi->qf_curlist].qf_count;
+	goto qf_init_ok;
+    }
+    EMSG(_(e_readerrf));
+error2:
+    qf_drop_list(qi);
+qf_init_ok:
+    if (fd != NULL)
+	fclose(fd);
+    qf_parse_end(&state);
+qf_init_end:
+#ifdef FEAT_WINDOWS
+    qf_update_buffer(qi);
+#endif
+
+    return retval;
+}
+
+/*
+ * Prepare "st" for parsing lines with 'errorformat' value "efm" and adding
+ * them to the current list of "qi".  "st->qfprev" must be set already.
+ * Each part of the format string is copied and modified from errorformat to
+ * regex prog.  Only a few % characters are allowed.
+ * Returns FAIL for an error, qf_parse_end() must be called anyway.
+ */
+    static int
+qf_parse_start(st, qi, efm)
+    qfstate_T	    *st;
+    qf_info_T	    *qi;
+    char_u	    *efm;
+{
+    char_u	    *errmsg;
+    char_u	    *fmtstr = NULL;
     char_u	    *efmp;
-    efm_T	    *fmt_first = NULL;
     efm_T	    *fmt_last = NULL;
     efm_T	    *fmt_ptr;
-    efm_T	    *fmt_start = NULL;
-    char_u	    *efm;
     char_u	    *ptr;
     char_u	    *srcptr;
     int		    len;
     int		    i;
     int		    round;
     int		    idx = 0;
-    int		    multiline = FALSE;
-    int		    multiignore = FALSE;
-    int		    multiscan = FALSE;
-    int		    retval = -1;	/* default: return error flag */
-    char_u	    *directory = NULL;
-    char_u	    *currfile = NULL;
-    char_u	    *tail = NULL;
-    char_u	    *p_str = NULL;
-    listitem_T	    *p_li = NULL;
-    struct dir_stack_T  *file_stack = NULL;
-    regmatch_T	    regmatch;
+    int		    retval = FAIL;
     static struct fmtpattern
     {
 	char_u	convchar;
@@ -252,36 +532,13 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 			{'s', ".\\+"}
 		    };
 
-    namebuf = alloc(CMDBUFFSIZE + 1);
-    errmsg = alloc(CMDBUFFSIZE + 1);
-    pattern = alloc(CMDBUFFSIZE + 1);
-    if (namebuf == NULL || errmsg == NULL || pattern == NULL)
-	goto qf_init_end;
-
-    if (efile != NULL && (fd = mch_fopen((char *)efile, "r")) == NULL)
-    {
-	EMSG2(_(e_openerrf), efile);
-	goto qf_init_end;
-    }
-
-    if (newlist || qi->qf_curlist == qi->qf_listcount)
-	/* make place for a new list */
-	qf_new_list(qi, qf_title);
-    else if (qi->qf_lists[qi->qf_curlist].qf_count > 0)
-	/* Adding to existing list, find last entry. */
-	for (qfprev = qi->qf_lists[qi->qf_curlist].qf_start;
-			  qfprev->qf_next != qfprev; qfprev = qfprev->qf_next)
-	    ;
+    st->qi = qi;
+    st->namebuf = alloc(CMDBUFFSIZE + 1);
+    st->errmsg = errmsg = alloc(CMDBUFFSIZE + 1);
+    st->pattern = alloc(CMDBUFFSIZE + 1);
+    if (st->namebuf == NULL || errmsg == NULL || st->pattern == NULL)
+	return FAIL;
 
-/*
- * Each part of the format string is copied and modified from errorformat to
- * regex prog.  Only a few % characters are allowed.
- */
-    /* Use the local value of 'errorformat' if it's set. */
-    if (errorformat == p_efm && tv == NULL && *buf->b_p_efm != NUL)
-	efm = buf->b_p_efm;
-    else
-	efm = errorformat;
     /*
      * Get some space to modify the format string into.
      */
@@ -294,7 +551,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
     i += 2; /* "%f" can become two chars longer */
 #endif
     if ((fmtstr = alloc(i)) == NULL)
-	goto error2;
+	goto parse_start_end;
 
     while (efm[0] != NUL)
     {
@@ -303,9 +560,9 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 	 */
 	fmt_ptr = (efm_T *)alloc_clear((unsigned)sizeof(efm_T));
 	if (fmt_ptr == NULL)
-	    goto error2;
-	if (fmt_first == NULL)	    /* first one */
-	    fmt_first = fmt_ptr;
+	    goto parse_start_end;
+	if (st->fmt_first == NULL)	    /* first one */
+	    st->fmt_first = fmt_ptr;
 	else
 	    fmt_last->next = fmt_ptr;
 	fmt_last = fmt_ptr;
@@ -338,7 +595,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 			sprintf((char *)errmsg,
 				_("E372: Too many %%%c in format string"), *efmp);
 			EMSG(errmsg);
-			goto error2;
+			goto parse_start_end;
 		    }
 		    if ((idx
 				&& idx < 6
@@ -351,7 +608,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 			sprintf((char *)errmsg,
 				_("E373: Unexpected %%%c in format string"), *efmp);
 			EMSG(errmsg);
-			goto error2;
+			goto parse_start_end;
 		    }
 		    fmt_ptr->addr[idx] = (char_u)++round;
 		    *ptr++ = '\\';
@@ -412,7 +669,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 				if (efmp == efm + len)
 				{
 				    EMSG(_("E374: Missing ] in format string"));
-				    goto error2;
+				    goto parse_start_end;
 				}
 			    }
 			}
@@ -427,7 +684,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 			sprintf((char *)errmsg,
 				_("E375: Unsupported %%%c in format string"), *efmp);
 			EMSG(errmsg);
-			goto error2;
+			goto parse_start_end;
 		    }
 		}
 		else if (vim_strchr((char_u *)"%\\.^$~[", *efmp) != NULL)
@@ -447,7 +704,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 			sprintf((char *)errmsg,
 				_("E376: Invalid %%%c in format string prefix"), *efmp);
 			EMSG(errmsg);
-			goto error2;
+			goto parse_start_end;
 		    }
 		}
 		else
@@ -455,7 +712,7 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 		    sprintf((char *)errmsg,
 			    _("E377: Invalid %%%c in format string"), *efmp);
 		    EMSG(errmsg);
-		    goto error2;
+		    goto parse_start_end;
 		}
 	    }
 	    else			/* copy normal character */
@@ -471,414 +728,369 @@ qf_init_ext(qi, efile, buf, tv, errorformat, newlist, lnumfirst, lnumlast,
 	*ptr++ = '$';
 	*ptr = NUL;
 	if ((fmt_ptr->prog = vim_regcomp(fmtstr, RE_MAGIC + RE_STRING)) == NULL)
-	    goto error2;
+	    goto parse_start_end;
 	/*
 	 * Advance to next part
 	 */
 	efm = skip_to_option_part(efm + len);	/* skip comma and spaces */
     }
-    if (fmt_first == NULL)	/* nothing found */
+    if (st->fmt_first == NULL)	/* nothing found */
     {
 	EMSG(_("E378: 'errorformat' contains no pattern"));
-	goto error2;
+	goto parse_start_end;
     }
 
-    /*
-     * got_int is reset here, because it was probably set when killing the
-     * ":make" command, but we still want to read the errorfile then.
-     */
-    got_int = FALSE;
+    retval = OK;
+
+parse_start_end:
+    vim_free(fmtstr);
+    return retval;
+}
+
+/*
+ * Parse the error message in IObuff, which must not have a trailing line
+ * break, and add it to the error list.
+ * Returns FAIL for an error, the list must then be dropped.
+ */
+    static int
+qf_parse_line(st)
+    qfstate_T	    *st;
+{
+    char_u	    *namebuf = st->namebuf;
+    char_u	    *errmsg = st->errmsg;
+    char_u	    *pattern = st->pattern;
+    int		    col = 0;
+    char_u	    use_viscol = FALSE;
+    int		    type = 0;
+    int		    valid;
+    long	    lnum = 0L;
+    int		    enr = 0;
+    efm_T	    *fmt_ptr;
+    char_u	    *ptr;
+    int		    len;
+    int		    i;
+    int		    idx = 0;
+    int		    multiscan = FALSE;
+    char_u	    *tail = NULL;
+    regmatch_T	    regmatch;
 
     /* Always ignore case when looking for a matching error. */
     regmatch.rm_ic = TRUE;
 
-    if (tv != NULL)
+    /* If there was no %> item start at the first pattern */
+    if (st->fmt_start == NULL)
+	fmt_ptr = st->fmt_first;
+    else
     {
-	if (tv->v_type == VAR_STRING)
-	    p_str = tv->vval.v_string;
-	else if (tv->v_type == VAR_LIST)
-	    p_li = tv->vval.v_list->lv_first;
+	fmt_ptr = st->fmt_start;
+	st->fmt_start = NULL;
     }
 
     /*
-     * Read the lines in the error file one by one.
-     * Try to recognize one of the error formats in each line.
+     * Try to match each part of 'errorformat' until we find a complete
+     * match or no match.
      */
-    while (!got_int)
+    valid = TRUE;
+restofline:
+    for ( ; fmt_ptr != NULL; fmt_ptr = fmt_ptr->next)
     {
-	/* Get the next line. */
-	if (fd == NULL)
+	idx = fmt_ptr->prefix;
+	if (multiscan && vim_strchr((char_u *)"OPQ", idx) == NULL)
+	    continue;
+	namebuf[0] = NUL;
+	pattern[0] = NUL;
+	if (!multiscan)
+	    errmsg[0] = NUL;
+	lnum = 0;
+	col = 0;
+	use_viscol = FALSE;
+	enr = -1;
+	type = 0;
+	tail = NULL;
+
+	regmatch.regprog = fmt_ptr->prog;
+	if (vim_regexec(&regmatch, IObuff, (colnr_T)0))
 	{
-	    if (tv != NULL)
+	    if ((idx == 'C' || idx == 'Z') && !st->multiline)
+		continue;
+	    if (vim_strchr((char_u *)"EWI", idx) != NULL)
+		type = idx;
+	    else
+		type = 0;
+	    /*
+	     * Extract error message data from matched line.
+	     * We check for an actual submatch, because "\[" and "\]" in
+	     * the 'errorformat' may cause the wrong submatch to be used.
+	     */
+	    if ((i = (int)fmt_ptr->addr[0]) > 0)		/* %f */
 	    {
-		if (tv->v_type == VAR_STRING)
-		{
-		    /* Get the next line from the supplied string */
-		    char_u *p;
-
-		    if (!*p_str) /* Reached the end of the string */
-			break;
-
-		    p = vim_strchr(p_str, '\n');
-		    if (p)
-			len = (int)(p - p_str + 1);
-		    else
-			len = (int)STRLEN(p_str);
-
-		    if (len > CMDBUFFSIZE - 2)
-			vim_strncpy(IObuff, p_str, CMDBUFFSIZE - 2);
-		    else
-			vim_strncpy(IObuff, p_str, len);
-
-		    p_str += len;
-		}
-		else if (tv->v_type == VAR_LIST)
-		{
-		    /* Get the next line from the supplied list */
-		    while (p_li && p_li->li_tv.v_type != VAR_STRING)
-			p_li = p_li->li_next;	/* Skip non-string items */
-
-		    if (!p_li)			/* End of the list */
-			break;
+		int c;
 
-		    len = (int)STRLEN(p_li->li_tv.vval.v_string);
-		    if (len > CMDBUFFSIZE - 2)
-			len = CMDBUFFSIZE - 2;
+		if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
+		    continue;
 
-		    vim_strncpy(IObuff, p_li->li_tv.vval.v_string, len);
+		/* Expand ~/file and $HOME/file to full path. */
+		c = *regmatch.endp[i];
+		*regmatch.endp[i] = NUL;
+		expand_env(regmatch.startp[i], namebuf, CMDBUFFSIZE);
+		*regmatch.endp[i] = c;
 
-		    p_li = p_li->li_next;	/* next item */
-		}
+		if (vim_strchr((char_u *)"OPQ", idx) != NULL
+					    && mch_getperm(namebuf) == -1)
+		    continue;
 	    }
-	    else
+	    if ((i = (int)fmt_ptr->addr[1]) > 0)		/* %n */
 	    {
-		/* Get the next line from the supplied buffer */
-		if (buflnum > lnumlast)
-		    break;
-		vim_strncpy(IObuff, ml_get_buf(buf, buflnum++, FALSE),
-			    CMDBUFFSIZE - 2);
+		if (regmatch.startp[i] == NULL)
+		    continue;
+		enr = (int)atol((char *)regmatch.startp[i]);
 	    }
-	}
-	else if (fgets((char *)IObuff, CMDBUFFSIZE - 2, fd) == NULL)
-	    break;
-
-	IObuff[CMDBUFFSIZE - 2] = NUL;  /* for very long lines */
-#ifdef FEAT_MBYTE
-	remove_bom(IObuff);
-#endif
-
-	if ((efmp = vim_strrchr(IObuff, '\n')) != NULL)
-	    *efmp = NUL;
-#ifdef USE_CRNL
-	if ((efmp = vim_strrchr(IObuff, '\r')) != NULL)
-	    *efmp = NUL;
-#endif
-
-	/* If there was no %> item start at the first pattern */
-	if (fmt_start == NULL)
-	    fmt_ptr = fmt_first;
-	else
-	{
-	    fmt_ptr = fmt_start;
-	    fmt_start = NULL;
-	}
-
-	/*
-	 * Try to match each part of 'errorformat' until we find a complete
-	 * match or no match.
-	 */
-	valid = TRUE;
-restofline:
-	for ( ; fmt_ptr != NULL; fmt_ptr = fmt_ptr->next)
-	{
-	    idx = fmt_ptr->prefix;
-	    if (multiscan && vim_strchr((char_u *)"OPQ", idx) == NULL)
-		continue;
-	    namebuf[0] = NUL;
-	    pattern[0] = NUL;
-	    if (!multiscan)
-		errmsg[0] = NUL;
-	    lnum = 0;
-	    col = 0;
-	    use_viscol = FALSE;
-	    enr = -1;
-	    type = 0;
-	    tail = NULL;
-
-	    regmatch.regprog = fmt_ptr->prog;
-	    if (vim_regexec(&regmatch, IObuff, (colnr_T)0))
+	    if ((i = (int)fmt_ptr->addr[2]) > 0)		/* %l */
 	    {
-		if ((idx == 'C' || idx == 'Z') && !multiline)
+		if (regmatch.startp[i] == NULL)
 		    continue;
-		if (vim_strchr((char_u *)"EWI", idx) != NULL)
-		    type = idx;
-		else
-		    type = 0;
-		/*
-		 * Extract error message data from matched line.
-		 * We check for an actual submatch, because "\[" and "\]" in
-		 * the 'errorformat' may cause the wrong submatch to be used.
-		 */
-		if ((i = (int)fmt_ptr->addr[0]) > 0)		/* %f */
-		{
-		    int c;
-
-		    if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
-			continue;
-
-		    /* Expand ~/file and $HOME/file to full path. */
-		    c = *regmatch.endp[i];
-		    *regmatch.endp[i] = NUL;
-		    expand_env(regmatch.startp[i], namebuf, CMDBUFFSIZE);
-		    *regmatch.endp[i] = c;
+		lnum = atol((char *)regmatch.startp[i]);
+	    }
+	    if ((i = (int)fmt_ptr->addr[3]) > 0)		/* %c */
+	    {
+		if (regmatch.startp[i] == NULL)
+		    continue;
+		col = (int)atol((char *)regmatch.startp[i]);
+	    }
+	    if ((i = (int)fmt_ptr->addr[4]) > 0)		/* %t */
+	    {
+		if (regmatch.startp[i] == NULL)
+		    continue;
+		type = *regmatch.startp[i];
+	    }
+	    if (fmt_ptr->flags == '+' && !multiscan)	/* %+ */
+		STRCPY(errmsg, IObuff);
+	    else if ((i = (int)fmt_ptr->addr[5]) > 0)	/* %m */
+	    {
+		if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
+		    continue;
+		len = (int)(regmatch.endp[i] - regmatch.startp[i]);
+		vim_strncpy(errmsg, regmatch.startp[i], len);
+	    }
+	    if ((i = (int)fmt_ptr->addr[6]) > 0)		/* %r */
+	    {
+		if (regmatch.startp[i] == NULL)
+		    continue;
+		tail = regmatch.startp[i];
+	    }
+	    if ((i = (int)fmt_ptr->addr[7]) > 0)		/* %p */
+	    {
+		char_u	*match_ptr;
 
-		    if (vim_strchr((char_u *)"OPQ", idx) != NULL
-						&& mch_getperm(namebuf) == -1)
-			continue;
-		}
-		if ((i = (int)fmt_ptr->addr[1]) > 0)		/* %n */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    enr = (int)atol((char *)regmatch.startp[i]);
-		}
-		if ((i = (int)fmt_ptr->addr[2]) > 0)		/* %l */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    lnum = atol((char *)regmatch.startp[i]);
-		}
-		if ((i = (int)fmt_ptr->addr[3]) > 0)		/* %c */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    col = (int)atol((char *)regmatch.startp[i]);
-		}
-		if ((i = (int)fmt_ptr->addr[4]) > 0)		/* %t */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    type = *regmatch.startp[i];
-		}
-		if (fmt_ptr->flags == '+' && !multiscan)	/* %+ */
-		    STRCPY(errmsg, IObuff);
-		else if ((i = (int)fmt_ptr->addr[5]) > 0)	/* %m */
-		{
-		    if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
-			continue;
-		    len = (int)(regmatch.endp[i] - regmatch.startp[i]);
-		    vim_strncpy(errmsg, regmatch.startp[i], len);
-		}
-		if ((i = (int)fmt_ptr->addr[6]) > 0)		/* %r */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    tail = regmatch.startp[i];
-		}
-		if ((i = (int)fmt_ptr->addr[7]) > 0)		/* %p */
+		if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
+		    continue;
+		col = 0;
+		for (match_ptr = regmatch.startp[i];
+			       match_ptr != regmatch.endp[i]; ++match_ptr)
 		{
-		    char_u	*match_ptr;
-
-		    if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
-			continue;
-		    col = 0;
-		    for (match_ptr = regmatch.startp[i];
-				   match_ptr != regmatch.endp[i]; ++match_ptr)
+		    ++col;
+		    if (*match_ptr == TAB)
 		    {
-			++col;
-			if (*match_ptr == TAB)
-			{
-			    col += 7;
-			    col -= col % 8;
-			}
+			col += 7;
+			col -= col % 8;
 		    }
-		    ++col;
-		    use_viscol = TRUE;
-		}
-		if ((i = (int)fmt_ptr->addr[8]) > 0)		/* %v */
-		{
-		    if (regmatch.startp[i] == NULL)
-			continue;
-		    col = (int)atol((char *)regmatch.startp[i]);
-		    use_viscol = TRUE;
 		}
-		if ((i = (int)fmt_ptr->addr[9]) > 0)		/* %s */
-		{
-		    if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
-			continue;
-		    len = (int)(regmatch.endp[i] - regmatch.startp[i]);
-		    if (len > CMDBUFFSIZE - 5)
-			len = CMDBUFFSIZE - 5;
-		    STRCPY(pattern, "^\\V");
-		    STRNCAT(pattern, regmatch.startp[i], len);
-		    pattern[len + 3] = '\\';
-		    pattern[len + 4] = '$';
-		    pattern[len + 5] = NUL;
-		}
-		break;
+		++col;
+		use_viscol = TRUE;
+	    }
+	    if ((i = (int)fmt_ptr->addr[8]) > 0)		/* %v */
+	    {
+		if (regmatch.startp[i] == NULL)
+		    continue;
+		col = (int)atol((char *)regmatch.startp[i]);
+		use_viscol = TRUE;
+	    }
+	    if ((i = (int)fmt_ptr->addr[9]) > 0)		/* %s */
+	    {
+		if (regmatch.startp[i] == NULL || regmatch.endp[i] == NULL)
+		    continue;
+		len = (int)(regmatch.endp[i] - regmatch.startp[i]);
+		if (len > CMDBUFFSIZE - 5)
+		    len = CMDBUFFSIZE - 5;
+		STRCPY(pattern, "^\\V");
+		STRNCAT(pattern, regmatch.startp[i], len);
+		pattern[len + 3] = '\\';
+		pattern[len + 4] = '$';
+		pattern[len + 5] = NUL;
 	    }
+	    break;
 	}
-	multiscan = FALSE;
+    }
+    multiscan = FALSE;
 
-	if (fmt_ptr == NULL || idx == 'D' || idx == 'X')
+    if (fmt_ptr == NULL || idx == 'D' || idx == 'X')
+    {
+	if (fmt_ptr != NULL)
 	{
-	    if (fmt_ptr != NULL)
+	    if (idx == 'D')				/* enter st->directory */
 	    {
-		if (idx == 'D')				/* enter directory */
+		if (*namebuf == NUL)
 		{
-		    if (*namebuf == NUL)
-		    {
-			EMSG(_("E379: Missing or empty directory name"));
-			goto error2;
-		    }
-		    if ((directory = qf_push_dir(namebuf, &dir_stack)) == NULL)
-			goto error2;
+		    EMSG(_("E379: Missing or empty st->directory name"));
+		    return FAIL;
 		}
-		else if (idx == 'X')			/* leave directory */
-		    directory = qf_pop_dir(&dir_stack);
+		if ((st->directory = qf_push_dir(namebuf, &dir_stack)) == NULL)
+		    return FAIL;
 	    }
-	    namebuf[0] = NUL;		/* no match found, remove file name */
-	    lnum = 0;			/* don't jump to this line */
-	    valid = FALSE;
-	    STRCPY(errmsg, IObuff);	/* copy whole line to error message */
-	    if (fmt_ptr == NULL)
-		multiline = multiignore = FALSE;
+	    else if (idx == 'X')			/* leave st->directory */
+		st->directory = qf_pop_dir(&dir_stack);
 	}
-	else if (fmt_ptr != NULL)
-	{
-	    /* honor %> item */
-	    if (fmt_ptr->conthere)
-		fmt_start = fmt_ptr;
-
-	    if (vim_strchr((char_u *)"AEWI", idx) != NULL)
-		multiline = TRUE;	/* start of a multi-line message */
-	    else if (vim_strchr((char_u *)"CZ", idx) != NULL)
-	    {				/* continuation of multi-line msg */
-		if (qfprev == NULL)
-		    goto error2;
-		if (*errmsg && !multiignore)
-		{
-		    len = (int)STRLEN(qfprev->qf_text);
-		    if ((ptr = alloc((unsigned)(len + STRLEN(errmsg) + 2)))
-								    == NULL)
-			goto error2;
-		    STRCPY(ptr, qfprev->qf_text);
-		    vim_free(qfprev->qf_text);
-		    qfprev->qf_text = ptr;
-		    *(ptr += len) = '\n';
-		    STRCPY(++ptr, errmsg);
-		}
-		if (qfprev->qf_nr == -1)
-		    qfprev->qf_nr = enr;
-		if (vim_isprintc(type) && !qfprev->qf_type)
-		    qfprev->qf_type = type;  /* only printable chars allowed */
-		if (!qfprev->qf_lnum)
-		    qfprev->qf_lnum = lnum;
-		if (!qfprev->qf_col)
-		    qfprev->qf_col = col;
-		qfprev->qf_viscol = use_viscol;
-		if (!qfprev->qf_fnum)
-		    qfprev->qf_fnum = qf_get_fnum(directory,
-					*namebuf || directory ? namebuf
-					  : currfile && valid ? currfile : 0);
-		if (idx == 'Z')
-		    multiline = multiignore = FALSE;
-		line_breakcheck();
-		continue;
+	namebuf[0] = NUL;		/* no match found, remove file name */
+	lnum = 0;			/* don't jump to this line */
+	valid = FALSE;
+	STRCPY(errmsg, IObuff);	/* copy whole line to error message */
+	if (fmt_ptr == NULL)
+	    st->multiline = st->multiignore = FALSE;
+    }
+    else if (fmt_ptr != NULL)
+    {
+	/* honor %> item */
+	if (fmt_ptr->conthere)
+	    st->fmt_start = fmt_ptr;
+
+	if (vim_strchr((char_u *)"AEWI", idx) != NULL)
+	    st->multiline = TRUE;	/* start of a multi-line message */
+	else if (vim_strchr((char_u *)"CZ", idx) != NULL)
+	{				/* continuation of multi-line msg */
+	    if (st->qfprev == NULL)
+		return FAIL;
+	    if (*errmsg && !st->multiignore)
+	    {
+		len = (int)STRLEN(st->qfprev->qf_text);
+		if ((ptr = alloc((unsigned)(len + STRLEN(errmsg) + 2)))
+								== NULL)
+		    return FAIL;
+		STRCPY(ptr, st->qfprev->qf_text);
+		vim_free(st->qfprev->qf_text);
+		st->qfprev->qf_text = ptr;
+		*(ptr += len) = '\n';
+		STRCPY(++ptr, errmsg);
 	    }
-	    else if (vim_strchr((char_u *)"OPQ", idx) != NULL)
+	    if (st->qfprev->qf_nr == -1)
+		st->qfprev->qf_nr = enr;
+	    if (vim_isprintc(type) && !st->qfprev->qf_type)
+		st->qfprev->qf_type = type;  /* only printable chars allowed */
+	    if (!st->qfprev->qf_lnum)
+		st->qfprev->qf_lnum = lnum;
+	    if (!st->qfprev->qf_col)
+		st->qfprev->qf_col = col;
+	    st->qfprev->qf_viscol = use_viscol;
+	    if (!st->qfprev->qf_fnum)
+		st->qfprev->qf_fnum = qf_get_fnum(st->directory,
+				    *namebuf || st->directory ? namebuf
+				      : st->currfile && valid ? st->currfile : 0);
+	    if (idx == 'Z')
+		st->multiline = st->multiignore = FALSE;
+	    return OK;
+	}
+	else if (vim_strchr((char_u *)"OPQ", idx) != NULL)
+	{
+	    /* global file names */
+	    valid = FALSE;
+	    if (*namebuf == NUL || mch_getperm(namebuf) >= 0)
 	    {
-		/* global file names */
-		valid = FALSE;
-		if (*namebuf == NUL || mch_getperm(namebuf) >= 0)
+		if (*namebuf && idx == 'P')
+		    st->currfile = qf_push_dir(namebuf, &st->file_stack);
+		else if (idx == 'Q')
+		    st->currfile = qf_pop_dir(&st->file_stack);
+		*namebuf = NUL;
+		if (tail && *tail)
 		{
-		    if (*namebuf && idx == 'P')
-			currfile = qf_push_dir(namebuf, &file_stack);
-		    else if (idx == 'Q')
-			currfile = qf_pop_dir(&file_stack);
-		    *namebuf = NUL;
-		    if (tail && *tail)
-		    {
-			STRMOVE(IObuff, skipwhite(tail));
-			multiscan = TRUE;
-			goto restofline;
-		    }
+		    STRMOVE(IObuff, skipwhite(tail));
+		    multiscan = TRUE;
+		    goto restofline;
 		}
 	    }
-	    if (fmt_ptr->flags == '-')	/* generally exclude this line */
-	    {
-		if (multiline)
-		    multiignore = TRUE;	/* also exclude continuation lines */
-		continue;
-	    }
 	}
+	if (fmt_ptr->flags == '-')	/* generally exclude this line */
+	{
+	    if (st->multiline)
+		st->multiignore = TRUE;	/* also exclude continuation lines */
+	    return OK;
+	}
+    }
 
-	if (qf_add_entry(qi, &qfprev,
-			directory,
-			(*namebuf || directory)
-			    ? namebuf
-			    : ((currfile && valid) ? currfile : (char_u *)NULL),
-			0,
-			errmsg,
-			lnum,
-			col,
-			use_viscol,
-			pattern,
-			enr,
-			type,
-			valid) == FAIL)
-	    goto error2;
-	line_breakcheck();
+    if (qf_add_entry(st->qi, &st->qfprev,
+		    st->directory,
+		    (*namebuf || st->directory)
+			? namebuf
+			: ((st->currfile && valid) ? st->currfile : (char_u *)NULL),
+		    0,
+		    errmsg,
+		    lnum,
+		    col,
+		    use_viscol,
+		    pattern,
+		    enr,
+		    type,
+		    valid) == FAIL)
+	return FAIL;
+    return OK;
+}
+
+/*
+ * Free what qf_parse_start() allocated.
+ */
+    static void
+qf_parse_end(st)
+    qfstate_T	    *st;
+{
+    efm_T	    *fmt_ptr;
+
+    while ((fmt_ptr = st->fmt_first) != NULL)
+    {
+	st->fmt_first = fmt_ptr->next;
+	vim_regfree(fmt_ptr->prog);
+	vim_free(fmt_ptr);
     }
-    if (fd == NULL || !ferror(fd))
+    qf_clean_dir_stack(&dir_stack);
+    qf_clean_dir_stack(&st->file_stack);
+    vim_free(st->namebuf);
+    vim_free(st->errmsg);
+    vim_free(st->pattern);
+}
+
+/*
+ * Called when all lines were added to the current list of "qi": select the
+ * first valid entry.
+ */
+    static void
+qf_list_done(qi)
+    qf_info_T	    *qi;
+{
+    if (qi->qf_lists[qi->qf_curlist].qf_index == 0)
     {
-	if (qi->qf_lists[qi->qf_curlist].qf_index == 0)
-	{
-	    /* no valid entry found */
+	/* no valid entry found */
+	qi->qf_lists[qi->qf_curlist].qf_ptr =
+	    qi->qf_lists[qi->qf_curlist].qf_start;
+	qi->qf_lists[qi->qf_curlist].qf_index = 1;
+	qi->qf_lists[qi->qf_curlist].qf_nonevalid = TRUE;
+    }
+    else
+    {
+	qi->qf_lists[qi->qf_curlist].qf_nonevalid = FALSE;
+	if (qi->qf_lists[qi->qf_curlist].qf_ptr == NULL)
 	    qi->qf_lists[qi->qf_curlist].qf_ptr =
 		qi->qf_lists[qi->qf_curlist].qf_start;
-	    qi->qf_lists[qi->qf_curlist].qf_index = 1;
-	    qi->qf_lists[qi->qf_curlist].qf_nonevalid = TRUE;
-	}
-	else
-	{
-	    qi->qf_lists[qi->qf_curlist].qf_nonevalid = FALSE;
-	    if (qi->qf_lists[qi->qf_curlist].qf_ptr == NULL)
-		qi->qf_lists[qi->qf_curlist].qf_ptr =
-		    qi->qf_lists[qi->qf_curlist].qf_start;
-	}
-	/* return number of matches */
-	retval = qi->qf_lists[qi->qf_curlist].qf_count;
-	goto qf_init_ok;
     }
-    EMSG(_(e_readerrf));
-error2:
+}
+
+/*
+ * Remove the current list of "qi" after an error while building it.
+ */
+    static void
+qf_drop_list(qi)
+    qf_info_T	    *qi;
+{
     qf_free(qi, qi->qf_curlist);
     qi->qf_listcount--;
     if (qi->qf_curlist > 0)
 	--qi->qf_curlist;
-qf_init_ok:
-    if (fd != NULL)
-	fclose(fd);
-    for (fmt_ptr = fmt_first; fmt_ptr != NULL; fmt_ptr = fmt_first)
-    {
-	fmt_first = fmt_ptr->next;
-	vim_regfree(fmt_ptr->prog);
-	vim_free(fmt_ptr);
-    }
-    qf_clean_dir_stack(&dir_stack);
-    qf_clean_dir_stack(&file_stack);
-qf_init_end:
-    vim_free(namebuf);
-    vim_free(errmsg);
-    vim_free(pattern);
-    vim_free(fmtstr);
-
-#ifdef FEAT_WINDOWS
-    qf_update_buffer(qi);
-#endif
-
-    return retval;
 }
 
 /*
@@ -891,6 +1103,12 @@ qf_new_list(qi, qf_title)
 {
     int		i;
 
+#ifdef FEAT_JOB_CONTROL
+    /* Lists may be freed or moved, a background ":make" can't go on. */
+    if (qf_stream != NULL && qf_stream->qs_state.qi == qi)
+	qf_stream_end(qf_stream, QS_STOP);
+#endif
+
     /*
      * If the current entry is not the last entry, delete entries below
      * the current entry.  This makes it possible to browse in a tree-like
@@ -962,9 +1180,15 @@ qf_free_all(wp)
 	ll_free_all(&wp->w_llist_ref);
     }
     else
+    {
+#ifdef FEAT_JOB_CONTROL
+	if (qf_stream != NULL && qf_stream->qs_state.qi == qi)
+	    qf_stream_end(qf_stream, QS_STOP);
+#endif
 	/* quickfix list */
 	for (i = 0; i < qi->qf_listcount; ++i)
 	    qf_free(qi, i);
+    }
 }
 
 /*
@@ -2785,6 +3009,31 @@ grep_internal(cmdidx)
 			*curbuf->b_p_gp == NUL ? p_gp : curbuf->b_p_gp) == 0);
 }
 
+/*
+ * Return the shell command for ":make" and ":grep": "arg" with 'shellquote'
+ * around it.  When "fname" is not NULL and 'shellpipe' is not empty the
+ * output is redirected to "fname".  Returns NULL when out of memory.
+ */
+    static char_u *
+make_get_cmd(arg, fname)
+    char_u	*arg;
+    char_u	*fname;
+{
+    char_u	*cmd;
+    unsigned	len;
+
+    len = (unsigned)STRLEN(p_shq) * 2 + (unsigned)STRLEN(arg) + 1;
+    if (fname != NULL && *p_sp != NUL)
+	len += (unsigned)STRLEN(p_sp) + (unsigned)STRLEN(fname) + 3;
+    cmd = alloc(len);
+    if (cmd == NULL)
+	return NULL;
+    sprintf((char *)cmd, "%s%s%s", (char *)p_shq, (char *)arg, (char *)p_shq);
+    if (fname != NULL && *p_sp != NUL)
+	append_redir(cmd, len, p_sp, fname);
+    return cmd;
+}
+
 /*
  * Used for ":make", ":lmake", ":grep", ":lgrep", ":grepadd", and ":lgrepadd"
  */
@@ -2794,7 +3043,6 @@ ex_make(eap)
 {
     char_u	*fname;
     char_u	*cmd;
-    unsigned	len;
     win_T	*wp = NULL;
     qf_info_T	*qi = &ql_info;
     int		res;
@@ -2808,94 +3056,431 @@ ex_make(eap)
 	return;
     }
 
-    switch (eap->cmdidx)
+    switch (eap->cmdidx)
+    {
+	case CMD_make:	    au_name = (char_u *)"make"; break;
+	case CMD_lmake:	    au_name = (char_u *)"lmake"; break;
+	case CMD_grep:	    au_name = (char_u *)"grep"; break;
+	case CMD_lgrep:	    au_name = (char_u *)"lgrep"; break;
+	case CMD_grepadd:   au_name = (char_u *)"grepadd"; break;
+	case CMD_lgrepadd:  au_name = (char_u *)"lgrepadd"; break;
+	default: break;
+    }
+    if (au_name != NULL)
+    {
+	apply_autocmds(EVENT_QUICKFIXCMDPRE, au_name,
+					       curbuf->b_fname, TRUE, curbuf);
+# ifdef FEAT_EVAL
+	if (did_throw || force_abort)
+	    return;
+# endif
+    }
+#endif
+
+    if (eap->cmdidx == CMD_lmake || eap->cmdidx == CMD_lgrep
+	|| eap->cmdidx == CMD_lgrepadd)
+	wp = curwin;
+
+    autowrite_all();
+
+#ifdef FEAT_JOB_CONTROL
+    /* With 'asyncmake' run the command in the background and parse its
+     * output while it arrives.  Not in the GUI, it doesn't read from jobs. */
+    if (p_amk
+# ifdef FEAT_GUI
+	    && !gui.in_use
+# endif
+	    )
+    {
+	/* The output is read from the pipes of the job instead of the
+	 * error file. */
+	cmd = make_get_cmd(eap->arg, NULL);
+	if (cmd == NULL)
+	    return;
+	if (qf_stream_start(wp, cmd, (eap->cmdidx != CMD_make
+			    && eap->cmdidx != CMD_lmake) ? p_gefm : p_efm,
+			(eap->cmdidx != CMD_grepadd
+			 && eap->cmdidx != CMD_lgrepadd),
+			*eap->cmdlinep,
+# ifdef FEAT_AUTOCMD
+			au_name,
+# else
+			NULL,
+# endif
+			!eap->forceit) == OK)
+	{
+	    if (msg_col == 0)
+		msg_didout = FALSE;
+	    msg_start();
+	    MSG_PUTS(":!");
+	    msg_outtrans(cmd);
+	    vim_free(cmd);
+	    return;
+	}
+	vim_free(cmd);
+    }
+#endif
+
+    fname = get_mef_name();
+    if (fname == NULL)
+	return;
+    mch_remove(fname);	    /* in case it's not unique */
+
+    cmd = make_get_cmd(eap->arg, fname);
+    if (cmd == NULL)
+    {
+	vim_free(fname);
+	return;
+    }
+    /*
+     * Output a newline if there's something else than the :make command that
+     * was typed (in which case the cursor is in column 0).
+     */
+    if (msg_col == 0)
+	msg_didout = FALSE;
+    msg_start();
+    MSG_PUTS(":!");
+    msg_outtrans(cmd);		/* show what we are doing */
+
+    /* let the shell know if we are redirecting output or not */
+    do_shell(cmd, *p_sp != NUL ? SHELL_DOOUT : 0);
+
+#ifdef AMIGA
+    out_flush();
+		/* read window status report and redraw before message */
+    (void)char_avail();
+#endif
+
+    res = qf_init(wp, fname, (eap->cmdidx != CMD_make
+			    && eap->cmdidx != CMD_lmake) ? p_gefm : p_efm,
+					   (eap->cmdidx != CMD_grepadd
+					    && eap->cmdidx != CMD_lgrepadd),
+					   *eap->cmdlinep);
+    if (wp != NULL)
+	qi = GET_LOC_LIST(wp);
+#ifdef FEAT_AUTOCMD
+    if (au_name != NULL)
+    {
+	apply_autocmds(EVENT_QUICKFIXCMDPOST, au_name,
+					       curbuf->b_fname, TRUE, curbuf);
+	if (qi->qf_curlist < qi->qf_listcount)
+	    res = qi->qf_lists[qi->qf_curlist].qf_count;
+	else
+	    res = 0;
+    }
+#endif
+    if (res > 0 && !eap->forceit)
+	qf_jump(qi, 0, 0, FALSE);		/* display first error */
+
+    mch_remove(fname);
+    vim_free(fname);
+    vim_free(cmd);
+}
+
+#ifdef FEAT_JOB_CONTROL
+/*
+ * Start shell command "cmd" in the background for ":make" or ":grep".  Its
+ * output is parsed with "efm" into the quickfix list, or the location list of
+ * window "wp" when not NULL, while it arrives.  "newlist" and "qf_title" are
+ * like for qf_init().  "au_name" is used for QuickFixCmdPost when the command
+ * is done.  When "jump" is TRUE jump to the first error once it was found.
+ * Returns FAIL when the command could not be started.
+ */
+    static int
+qf_stream_start(wp, cmd, efm, newlist, qf_title, au_name, jump)
+    win_T	*wp;
+    char_u	*cmd;
+    char_u	*efm;
+    int		newlist;
+    char_u	*qf_title;
+    char_u	*au_name;
+    int		jump;
+{
+    qf_info_T	*qi = &ql_info;
+    qfstream_T	*qs;
+
+    if (wp != NULL && (qi = ll_get_or_alloc_list(wp)) == NULL)
+	return FAIL;
+    qs = (qfstream_T *)alloc_clear((unsigned)sizeof(qfstream_T));
+    if (qs == NULL)
+	return FAIL;
+
+    /* Only one command runs in the background. */
+    if (qf_stream != NULL)
+	qf_stream_end(qf_stream, QS_STOP);
+
+    qs->qs_job = job_start_shell(cmd, qf_stream_output);
+    if (qs->qs_job <= 0)
+    {
+	vim_free(qs);
+	return FAIL;
+    }
+
+    if (newlist || qi->qf_curlist == qi->qf_listcount)
+	/* make place for a new list */
+	qf_new_list(qi, qf_title);
+    else if (qi->qf_lists[qi->qf_curlist].qf_count > 0)
+	/* Adding to existing list, find last entry. */
+	for (qs->qs_state.qfprev = qi->qf_lists[qi->qf_curlist].qf_start;
+		  qs->qs_state.qfprev->qf_next != qs->qs_state.qfprev;
+			 qs->qs_state.qfprev = qs->qs_state.qfprev->qf_next)
+	    ;
+
+    /* Use the local value of 'errorformat' if it's set. */
+    if (efm == p_efm && *curbuf->b_p_efm != NUL)
+	efm = curbuf->b_p_efm;
+    if (qf_parse_start(&qs->qs_state, qi, efm) == FAIL)
+    {
+	job_stop(qs->qs_job);
+	qf_drop_list(qi);
+	qf_parse_end(&qs->qs_state);
+	vim_free(qs);
+#ifdef FEAT_WINDOWS
+	qf_update_buffer(qi);
+#endif
+	return OK;
+    }
+
+    if (wp != NULL)
+    {
+	/* The window may be closed while the command runs. */
+	++qi->qf_refcount;
+	qs->qs_loclist = TRUE;
+    }
+    qs->qs_list = qi->qf_curlist;
+    qs->qs_count = qi->qf_lists[qi->qf_curlist].qf_count;
+    ga_init2(&qs->qs_partial[JOB_STDOUT], 1, CMDBUFFSIZE);
+    ga_init2(&qs->qs_partial[JOB_STDERR], 1, CMDBUFFSIZE);
+    gettimeofday(&qs->qs_updated, NULL);
+    qs->qs_jump = jump;
+    qs->qs_au_name = au_name;
+    qf_stream = qs;
+#ifdef FEAT_WINDOWS
+    qf_update_buffer(qi);
+#endif
+    return OK;
+}
+
+/*
+ * Job callback for the background ":make": parse the complete lines of its
+ * output and update the quickfix window now and then.
+ */
+    static void
+qf_stream_output(id, what, data, len)
+    int		id;
+    int		what;
+    char_u	*data;
+    int		len;
+{
+    qfstream_T	*qs = qf_stream;
+    garray_T	*gap;
+    int		res;
+#ifdef FEAT_WINDOWS
+    struct timeval now;
+#endif
+
+    if (qs == NULL || qs->qs_job != id)
+	return;	    /* output of a command that was stopped */
+    if (what == JOB_EXIT)
+    {
+	qf_stream_end(qs, QS_DONE);
+	return;
+    }
+    if (!qf_stream_current(qs))
+    {
+	/* Another list was selected or entries were added, e.g. with
+	 * ":colder" or setqflist(). */
+	qf_stream_end(qs, QS_STOP);
+	return;
+    }
+
+    gap = &qs->qs_partial[what];
+    if (ga_grow(gap, len + 1) == FAIL)
+	return;
+    mch_memmove((char_u *)gap->ga_data + gap->ga_len, data, (size_t)len);
+    gap->ga_len += len;
+    res = qf_stream_lines(qs, gap, FALSE);
+    if (qs->qs_end != 0)
+	qf_stream_end(qs, qs->qs_end);
+    else if (res == FAIL)
+	qf_stream_end(qs, QS_ERROR);
+    else
+    {
+#ifdef FEAT_WINDOWS
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - qs->qs_updated.tv_sec) * 1000L
+		 + (now.tv_usec - qs->qs_updated.tv_usec) / 1000L
+							    >= QS_UPDATE_MSEC)
+	{
+	    qs->qs_updated = now;
+	    qf_update_buffer(qs->qs_state.qi);
+	}
+#endif
+	/* Check again, autocommands may have stopped the command. */
+	if (qf_stream == qs)
+	    qf_stream_jump(qs);
+    }
+}
+
+/*
+ * Parse the complete lines of output in "gap" and remove them, with "flush"
+ * also an incomplete last line.
+ * Returns FAIL for an error in 'errorformat'.
+ */
+    static int
+qf_stream_lines(qs, gap, flush)
+    qfstream_T	*qs;
+    garray_T	*gap;
+    int		flush;
+{
+    char_u	*start = (char_u *)gap->ga_data;
+    char_u	*end = start + gap->ga_len;
+    char_u	*p;
+    int		len;
+    int		res = OK;
+
+    if (gap->ga_len == 0)
+	return OK;
+    *end = NUL;
+
+    /* "dir_stack" is only used while parsing, keep ours aside meanwhile. */
+    dir_stack = qs->qs_dir_stack;
+    qs->qs_busy = TRUE;
+    while (res == OK && start < end && qs->qs_end == 0)
+    {
+	p = vim_strchr(start, '\n');
+	if (p == NULL)
+	{
+	    if (!flush)
+		break;
+	    p = end;
+	}
+	len = (int)(p - start);
+	if (len > CMDBUFFSIZE - 2)
+	    len = CMDBUFFSIZE - 2;  /* for very long lines */
+	vim_strncpy(IObuff, start, len);
+#ifdef FEAT_MBYTE
+	remove_bom(IObuff);
+#endif
+#ifdef USE_CRNL
+	if ((start = vim_strrchr(IObuff, '\r')) != NULL)
+	    *start = NUL;
+#endif
+	res = qf_parse_line(&qs->qs_state);
+	start = p < end ? p + 1 : end;
+    }
+    qs->qs_busy = FALSE;
+    qs->qs_dir_stack = dir_stack;
+    dir_stack = NULL;
+
+    gap->ga_len = (int)(end - start);
+    mch_memmove(gap->ga_data, start, (size_t)gap->ga_len);
+    qs->qs_count = qs->qs_state.qi->qf_lists[qs->qs_list].qf_count;
+    return res;
+}
+
+/*
+ * Return TRUE when entries are still to be added to the list of "qs": it is
+ * the current list and nothing else was added to it.
+ */
+    static int
+qf_stream_current(qs)
+    qfstream_T	*qs;
+{
+    qf_info_T	*qi = qs->qs_state.qi;
+
+    return qi->qf_curlist == qs->qs_list
+	    && qs->qs_list < qi->qf_listcount
+	    && qi->qf_lists[qs->qs_list].qf_count == qs->qs_count;
+}
+
+/*
+ * Jump to the first error of the background ":make" once it was found, when
+ * wanted.  Only in Normal mode, not to disturb typing a command or text.
+ */
+    static void
+qf_stream_jump(qs)
+    qfstream_T	*qs;
+{
+    qf_info_T	*qi = qs->qs_state.qi;
+
+    if (!qs->qs_jump || qi->qf_lists[qs->qs_list].qf_index == 0
+	    || (State != NORMAL && State != NORMAL_BUSY) || VIsual_active)
+	return;
+    qs->qs_jump = FALSE;
+    /* Not when another window was entered meanwhile. */
+    if (qs->qs_loclist && GET_LOC_LIST(curwin) != qi)
+	return;
+    qf_jump(qi, 0, 0, FALSE);
+}
+
+/*
+ * Finish background ":make" "qs".  "how" is QS_DONE when the command exited,
+ * QS_STOP to stop it and keep what was found, QS_ERROR to drop the list.
+ */
+    static void
+qf_stream_end(qs, how)
+    qfstream_T	*qs;
+    int		how;
+{
+    qf_info_T	*qi = qs->qs_state.qi;
+    int		current;
+
+    if (qf_stream == qs)
+	qf_stream = NULL;
+    if (how != QS_DONE)
+	job_stop(qs->qs_job);
+    if (qs->qs_busy)
+    {
+	/* qf_stream_output() finishes it when parsing is done */
+	if (qs->qs_end == 0)
+	    qs->qs_end = how;
+	return;
+    }
+
+    current = qf_stream_current(qs);
+    if (how == QS_DONE && current)
     {
-	case CMD_make:	    au_name = (char_u *)"make"; break;
-	case CMD_lmake:	    au_name = (char_u *)"lmake"; break;
-	case CMD_grep:	    au_name = (char_u *)"grep"; break;
-	case CMD_lgrep:	    au_name = (char_u *)"lgrep"; break;
-	case CMD_grepadd:   au_name = (char_u *)"grepadd"; break;
-	case CMD_lgrepadd:  au_name = (char_u *)"lgrepadd"; break;
-	default: break;
+	/* The output may not end in a line break. */
+	if (qf_stream_lines(qs, &qs->qs_partial[JOB_STDOUT], TRUE) == FAIL
+		|| qf_stream_lines(qs, &qs->qs_partial[JOB_STDERR], TRUE)
+									== FAIL)
+	    how = QS_ERROR;
+	else if (qs->qs_end != 0)
+	    how = qs->qs_end;
+	current = qf_stream_current(qs);
     }
-    if (au_name != NULL)
+    if (current)
     {
-	apply_autocmds(EVENT_QUICKFIXCMDPRE, au_name,
-					       curbuf->b_fname, TRUE, curbuf);
-# ifdef FEAT_EVAL
-	if (did_throw || force_abort)
-	    return;
-# endif
+	if (how == QS_ERROR)
+	    qf_drop_list(qi);
+	else
+	    qf_list_done(qi);
     }
+    dir_stack = qs->qs_dir_stack;
+    qf_parse_end(&qs->qs_state);
+#ifdef FEAT_WINDOWS
+    qf_update_buffer(qi);
 #endif
 
-    if (eap->cmdidx == CMD_lmake || eap->cmdidx == CMD_lgrep
-	|| eap->cmdidx == CMD_lgrepadd)
-	wp = curwin;
-
-    autowrite_all();
-    fname = get_mef_name();
-    if (fname == NULL)
-	return;
-    mch_remove(fname);	    /* in case it's not unique */
-
-    /*
-     * If 'shellpipe' empty: don't redirect to 'errorfile'.
-     */
-    len = (unsigned)STRLEN(p_shq) * 2 + (unsigned)STRLEN(eap->arg) + 1;
-    if (*p_sp != NUL)
-	len += (unsigned)STRLEN(p_sp) + (unsigned)STRLEN(fname) + 3;
-    cmd = alloc(len);
-    if (cmd == NULL)
-	return;
-    sprintf((char *)cmd, "%s%s%s", (char *)p_shq, (char *)eap->arg,
-							       (char *)p_shq);
-    if (*p_sp != NUL)
-	append_redir(cmd, len, p_sp, fname);
-    /*
-     * Output a newline if there's something else than the :make command that
-     * was typed (in which case the cursor is in column 0).
-     */
-    if (msg_col == 0)
-	msg_didout = FALSE;
-    msg_start();
-    MSG_PUTS(":!");
-    msg_outtrans(cmd);		/* show what we are doing */
-
-    /* let the shell know if we are redirecting output or not */
-    do_shell(cmd, *p_sp != NUL ? SHELL_DOOUT : 0);
-
-#ifdef AMIGA
-    out_flush();
-		/* read window status report and redraw before message */
-    (void)char_avail();
-#endif
-
-    res = qf_init(wp, fname, (eap->cmdidx != CMD_make
-			    && eap->cmdidx != CMD_lmake) ? p_gefm : p_efm,
-					   (eap->cmdidx != CMD_grepadd
-					    && eap->cmdidx != CMD_lgrepadd),
-					   *eap->cmdlinep);
-    if (wp != NULL)
-	qi = GET_LOC_LIST(wp);
-#ifdef FEAT_AUTOCMD
-    if (au_name != NULL)
+    if (how == QS_DONE)
     {
-	apply_autocmds(EVENT_QUICKFIXCMDPOST, au_name,
+#ifdef FEAT_AUTOCMD
+	if (qs->qs_au_name != NULL)
+	    apply_autocmds(EVENT_QUICKFIXCMDPOST, qs->qs_au_name,
 					       curbuf->b_fname, TRUE, curbuf);
-	if (qi->qf_curlist < qi->qf_listcount)
-	    res = qi->qf_lists[qi->qf_curlist].qf_count;
-	else
-	    res = 0;
-    }
 #endif
-    if (res > 0 && !eap->forceit)
-	qf_jump(qi, 0, 0, FALSE);		/* display first error */
+	if (current && qf_stream_current(qs) && qs->qs_count > 0)
+	    qf_stream_jump(qs);
+    }
 
-    mch_remove(fname);
-    vim_free(fname);
-    vim_free(cmd);
+    if (qs->qs_loclist)
+	ll_free_all(&qi);
+    ga_clear(&qs->qs_partial[JOB_STDOUT]);
+    ga_clear(&qs->qs_partial[JOB_STDERR]);
+    vim_free(qs);
 }
+#endif
 
 /*
  * Return the name for the errorfile, in allocated memory.
@@ -3106,6 +3691,451 @@ ex_cfile(eap)
     }
 }
 
+#ifdef VGR_FAST
+/*
+ * Return TRUE when pattern "pat" can be matched against a line without a
+ * buffer: it doesn't match a line break and doesn't refer to the cursor,
+ * marks, the Visual area or line numbers.  Errs on the safe side.
+ */
+    static int
+vgr_pattern_ok(pat)
+    char_u	*pat;
+{
+    char_u	*p;
+
+    for (p = pat; *p != NUL; mb_ptr_adv(p))
+    {
+	if (*p == '\\' && p[1] != NUL)
+	{
+	    ++p;
+	    if (*p == 'n' || *p == '_')
+		return FALSE;
+	}
+	if (*p == '%' && p[1] != NUL && (VIM_ISDIGIT(p[1])
+				|| vim_strchr((char_u *)"#V'^$<>", p[1]) != NULL))
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Prepare for searching files "fnames[fcount]" with pattern "pat" without
+ * buffers.  Starts the reader threads.
+ * Returns NULL when the pattern needs a buffer.
+ */
+    static vgrpool_T *
+vgr_start(fnames, fcount, pat)
+    char_u	**fnames;
+    int		fcount;
+    char_u	*pat;
+{
+    vgrpool_T	*vg;
+    int		i;
+    int		fenc;
+    int		bom;
+# ifdef FEAT_EVENT_LOOP
+    int		n = 1;
+# endif
+
+    if (!vgr_pattern_ok(pat))
+	return NULL;
+    fenc = fenc_raw_mode(NULL, &bom);
+    if (fenc == RAW_NONE)
+	return NULL;
+    vg = (vgrpool_T *)alloc_clear((unsigned)sizeof(vgrpool_T));
+    if (vg == NULL)
+	return NULL;
+    vg->vg_files = (vgrfile_T *)alloc_clear(
+				      (unsigned)(fcount * sizeof(vgrfile_T)));
+    if (vg->vg_files == NULL)
+    {
+	vim_free(vg);
+	return NULL;
+    }
+    vg->vg_count = fcount;
+    for (i = 0; i < fcount; ++i)
+    {
+	/* Readers use the full name, autocommands of files loaded into a
+	 * dummy buffer may change directory. */
+	vg->vg_files[i].vf_fname = FullName_save(fnames[i], TRUE);
+	if (vg->vg_files[i].vf_fname == NULL)
+	    vg->vg_files[i].vf_state = VF_FALLBACK;
+    }
+
+    vg->vg_fenc = fenc;
+    vg->vg_bom = bom;
+# ifdef FEAT_MBYTE
+    vg->vg_utf8 = enc_utf8;
+# endif
+    vg->vg_dos = vim_strchr(p_ffs, 'd') != NULL;
+    vg->vg_mac = vim_strchr(p_ffs, 'm') != NULL;
+
+# ifdef FEAT_EVENT_LOOP
+#  ifdef _SC_NPROCESSORS_ONLN
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#  endif
+    if (n > VGR_MAXTHREADS)
+	n = VGR_MAXTHREADS;
+    if (n > fcount - 1)
+	n = fcount - 1;	    /* the main thread reads a single file itself */
+    pthread_mutex_init(&vg->vg_mutex, NULL);
+    pthread_cond_init(&vg->vg_cond, NULL);
+    for (i = 0; i < n; ++i)
+    {
+	if (pthread_create(&vg->vg_threads[i], NULL, vgr_reader, vg) != 0)
+	    break;
+	++vg->vg_nthreads;
+    }
+# endif
+    return vg;
+}
+
+/*
+ * Read file "fname" into memory allocated with malloc() and set "*lenp" to
+ * its size.  Returns NULL when it is not a regular file, is empty, is bigger
+ * than VGR_MAXSIZE or can't be read.
+ * Called in a reader thread, must not use Vim's memory functions.
+ */
+    static char_u *
+vgr_read(fname, lenp)
+    char_u	*fname;
+    size_t	*lenp;
+{
+    int		fd;
+    struct stat	st;
+    char_u	*data = NULL;
+    size_t	len = 0;
+    ssize_t	n = 0;
+
+    fd = open((char *)fname, O_RDONLY | O_EXTRA, 0);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+						&& st.st_size <= VGR_MAXSIZE)
+	data = (char_u *)malloc((size_t)st.st_size);
+    if (data != NULL)
+    {
+	/* When the file shrinks meanwhile use what is left. */
+	while (len < (size_t)st.st_size)
+	{
+	    n = read(fd, data + len, (size_t)st.st_size - len);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    len += n;
+	}
+	if (len == 0 || n < 0)
+	{
+	    free(data);
+	    data = NULL;
+	}
+    }
+    close(fd);
+    *lenp = len;
+    return data;
+}
+
+/*
+ * Read the file of "vf" and check that readfile() would load it without
+ * changes, apart from a BOM and the line endings.  Sets "vf->vf_state" to
+ * VF_READY or VF_FALLBACK.
+ * Called in a reader thread, must not use Vim's memory functions or options.
+ */
+    static void
+vgr_read_file(vg, vf)
+    vgrpool_T	*vg;
+    vgrfile_T	*vf;
+{
+    char_u	*p;
+    char_u	*end;
+    long	nl = 0;
+    long	crnl = 0;
+    int		cr = FALSE;
+    int		n;
+    int		state = VF_FALLBACK;
+
+    vf->vf_data = vgr_read(vf->vf_fname, &vf->vf_len);
+    if (vf->vf_data == NULL)
+	goto theend;
+    p = vf->vf_data;
+    end = p + vf->vf_len;
+    if ((vg->vg_bom || vg->vg_fenc == RAW_UTF8) && vf->vf_len >= 3
+			      && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf)
+    {
+	/* readfile() removes the BOM, or converts from UTF-8 */
+	if (!vg->vg_utf8)
+	    goto theend;
+	p += 3;
+    }
+    vf->vf_start = p - vf->vf_data;
+
+    for ( ; p < end; ++p)
+    {
+	if (*p == '\n')
+	{
+	    ++nl;
+	    if (p > vf->vf_data && p[-1] == '\r')
+		++crnl;
+	}
+	else if (*p == '\r')
+	    cr = TRUE;
+	else if (*p == NUL)
+	    goto theend;
+	else if (*p >= 0x80 && vg->vg_fenc != RAW_ANY)
+	{
+	    if (vg->vg_fenc == RAW_ASCII)
+		goto theend;
+# ifdef FEAT_MBYTE
+	    /* Illegal UTF-8 is converted, check it the way readfile() does. */
+	    n = utf_ptr2len_len(p, end - p > 6 ? 6 : (int)(end - p));
+	    if (n == 1 || n > end - p)
+		goto theend;
+	    p += n - 1;
+# endif
+	}
+    }
+    /* A file with CR line breaks would be read with 'fileformat' "mac". */
+    if (nl == 0 && cr && vg->vg_mac)
+	goto theend;
+    vf->vf_dos = vg->vg_dos && nl > 0 && crnl == nl;
+    state = VF_READY;
+
+theend:
+    if (state == VF_FALLBACK && vf->vf_data != NULL)
+    {
+	free(vf->vf_data);
+	vf->vf_data = NULL;
+    }
+    vf->vf_state = state;
+}
+
+# ifdef FEAT_EVENT_LOOP
+/*
+ * Reader thread: read files in order, at most VGR_AHEAD files or
+ * VGR_AHEAD_BYTES before the main thread.
+ */
+    static void *
+vgr_reader(arg)
+    void	*arg;
+{
+    vgrpool_T	*vg = (vgrpool_T *)arg;
+    vgrfile_T	*vf;
+    vgrfile_T	tmp;
+
+    pthread_mutex_lock(&vg->vg_mutex);
+    for (;;)
+    {
+	while (!vg->vg_stop && vg->vg_next < vg->vg_count
+				 && (vg->vg_next >= vg->vg_done + VGR_AHEAD
+				     || vg->vg_bytes >= VGR_AHEAD_BYTES))
+	    pthread_cond_wait(&vg->vg_cond, &vg->vg_mutex);
+	if (vg->vg_stop || vg->vg_next >= vg->vg_count)
+	    break;
+	vf = &vg->vg_files[vg->vg_next++];
+	if (vf->vf_state != VF_PENDING)
+	    continue;
+
+	/* Work on a copy, the main thread only looks at "vf" once its state
+	 * was set with the mutex held. */
+	tmp = *vf;
+	pthread_mutex_unlock(&vg->vg_mutex);
+	vgr_read_file(vg, &tmp);
+	pthread_mutex_lock(&vg->vg_mutex);
+	*vf = tmp;
+	if (vf->vf_data != NULL)
+	    vg->vg_bytes += (long)vf->vf_len;
+	pthread_cond_broadcast(&vg->vg_cond);
+    }
+    pthread_mutex_unlock(&vg->vg_mutex);
+    return NULL;
+}
+# endif
+
+/*
+ * Get file "idx" of "vg", waiting for a reader when needed.
+ * Returns NULL when it must be loaded into a buffer.
+ */
+    static vgrfile_T *
+vgr_get(vg, idx)
+    vgrpool_T	*vg;
+    int		idx;
+{
+    vgrfile_T	*vf = &vg->vg_files[idx];
+
+# ifdef FEAT_EVENT_LOOP
+    if (vg->vg_nthreads > 0)
+    {
+	pthread_mutex_lock(&vg->vg_mutex);
+	while (vf->vf_state == VF_PENDING)
+	    pthread_cond_wait(&vg->vg_cond, &vg->vg_mutex);
+	pthread_mutex_unlock(&vg->vg_mutex);
+    }
+# endif
+    if (vf->vf_state == VF_PENDING)
+	vgr_read_file(vg, vf);
+    return vf->vf_state == VF_READY ? vf : NULL;
+}
+
+/*
+ * Done with file "idx" of "vg", free its text.
+ */
+    static void
+vgr_release(vg, idx)
+    vgrpool_T	*vg;
+    int		idx;
+{
+    vgrfile_T	*vf = &vg->vg_files[idx];
+
+# ifdef FEAT_EVENT_LOOP
+    if (vg->vg_nthreads > 0)
+    {
+	pthread_mutex_lock(&vg->vg_mutex);
+	/* A reader may be busy with it. */
+	while (vf->vf_state == VF_PENDING && idx < vg->vg_next)
+	    pthread_cond_wait(&vg->vg_cond, &vg->vg_mutex);
+	vf->vf_state = VF_FALLBACK;
+	if (vf->vf_data != NULL)
+	    vg->vg_bytes -= (long)vf->vf_len;
+	vg->vg_done = idx + 1;
+	pthread_cond_broadcast(&vg->vg_cond);
+	pthread_mutex_unlock(&vg->vg_mutex);
+    }
+    else
+# endif
+	vf->vf_state = VF_FALLBACK;
+    if (vf->vf_data != NULL)
+    {
+	free(vf->vf_data);
+	vf->vf_data = NULL;
+    }
+}
+
+/*
+ * Stop the readers and free everything.
+ */
+    static void
+vgr_end(vg)
+    vgrpool_T	*vg;
+{
+    int		i;
+
+# ifdef FEAT_EVENT_LOOP
+    pthread_mutex_lock(&vg->vg_mutex);
+    vg->vg_stop = TRUE;
+    pthread_cond_broadcast(&vg->vg_cond);
+    pthread_mutex_unlock(&vg->vg_mutex);
+    for (i = 0; i < vg->vg_nthreads; ++i)
+	pthread_join(vg->vg_threads[i], NULL);
+    pthread_cond_destroy(&vg->vg_cond);
+    pthread_mutex_destroy(&vg->vg_mutex);
+# endif
+    for (i = 0; i < vg->vg_count; ++i)
+    {
+	free(vg->vg_files[i].vf_data);
+	vim_free(vg->vg_files[i].vf_fname);
+    }
+    vim_free(vg->vg_files);
+    vim_free(vg);
+}
+
+/*
+ * Return TRUE when file "fname" may be searched without loading it: no
+ * autocommands read it or prepare for changing the text, like the gzip and
+ * zip plugins do, or expect the dummy buffer to go away.  BufReadPost alone
+ * is mostly used for filetype detection, which ":vimgrep" doesn't want
+ * anyway.
+ */
+    static int
+vgr_may_read(fname)
+    char_u	*fname;
+{
+# ifdef FEAT_AUTOCMD
+    return !has_autocmd(EVENT_BUFREADCMD, fname, NULL)
+	    && !has_autocmd(EVENT_BUFREADPRE, fname, NULL)
+	    && !has_autocmd(EVENT_BUFUNLOAD, fname, NULL)
+	    && !has_autocmd(EVENT_BUFWIPEOUT, fname, NULL);
+# else
+    return TRUE;
+# endif
+}
+
+/*
+ * Search the lines of file "vf" for "regmatch" and add the matches to
+ * the list of "qi", like ex_vimgrep() does for a buffer.  "gap" is used for a
+ * copy of the line.  Sets got_int when out of memory.
+ */
+    static void
+vgr_match_file(qi, prevp, vf, fname, regmatch, flags, tomatch, gap)
+    qf_info_T	*qi;
+    qfline_T	**prevp;
+    vgrfile_T	*vf;
+    char_u	*fname;
+    regmatch_T	*regmatch;
+    int		flags;
+    long	*tomatch;
+    garray_T	*gap;
+{
+    char_u	*p = vf->vf_data + vf->vf_start;
+    char_u	*end = vf->vf_data + vf->vf_len;
+    char_u	*nl;
+    char_u	*line;
+    long	lnum = 0;
+    int		len;
+    colnr_T	col;
+
+    while (p < end && *tomatch > 0)
+    {
+	nl = memchr(p, '\n', (size_t)(end - p));
+	len = (int)((nl == NULL ? end : nl) - p);
+	/* Like readfile() a last line without a NL keeps its CR. */
+	if (vf->vf_dos && nl != NULL && len > 0 && p[len - 1] == '\r')
+	    --len;
+	++lnum;
+	if (ga_grow(gap, len + 1) == FAIL)
+	{
+	    got_int = TRUE;
+	    break;
+	}
+	line = (char_u *)gap->ga_data;
+	mch_memmove(line, p, (size_t)len);
+	line[len] = NUL;
+
+	col = 0;
+	while (vim_regexec(regmatch, line, col))
+	{
+	    if (qf_add_entry(qi, prevp,
+			NULL,       /* dir */
+			fname,
+			0,
+			line,
+			lnum,
+			(int)(regmatch->startp[0] - line) + 1,
+			FALSE,      /* vis_col */
+			NULL,	    /* search pattern */
+			0,	    /* nr */
+			0,	    /* type */
+			TRUE	    /* valid */
+			) == FAIL)
+	    {
+		got_int = TRUE;
+		break;
+	    }
+	    if (--*tomatch == 0 || (flags & VGR_GLOBAL) == 0)
+		break;
+	    col = (colnr_T)(regmatch->endp[0] - line)
+			       + (col == (colnr_T)(regmatch->endp[0] - line));
+	    if (col > len)
+		break;
+	}
+	line_breakcheck();
+	if (got_int)
+	    break;
+	p = nl == NULL ? end : nl + 1;
+    }
+}
+#endif
+
 /*
  * ":vimgrep {pattern} file(s)"
  * ":vimgrepadd {pattern} file(s)"
@@ -3147,6 +4177,12 @@ ex_vimgrep(eap)
     char_u	*dirname_start = NULL;
     char_u	*dirname_now = NULL;
     char_u	*target_dir = NULL;
+#ifdef VGR_FAST
+    vgrpool_T	*vg;
+    vgrfile_T	*vf;
+    regmatch_T	lregmatch;
+    garray_T	linega;
+#endif
 #ifdef FEAT_AUTOCMD
     char_u	*au_name =  NULL;
 
@@ -3255,6 +4291,14 @@ ex_vimgrep(eap)
     cur_qf_start = qi->qf_lists[qi->qf_curlist].qf_start;
 #endif
 
+#ifdef VGR_FAST
+    vg = vgr_start(fnames, fcount,
+			  (s == NULL || *s == NUL) ? last_search_pat() : s);
+    lregmatch.regprog = regmatch.regprog;
+    lregmatch.rm_ic = p_ic;
+    ga_init2(&linega, 1, 200);
+#endif
+
     seconds = (time_t)0;
     for (fi = 0; fi < fcount && !got_int && tomatch > 0; ++fi)
     {
@@ -3281,6 +4325,27 @@ ex_vimgrep(eap)
 	}
 
 	buf = buflist_findname_exp(fnames[fi]);
+#ifdef VGR_FAST
+	if (vg != NULL)
+	{
+	    /* Search a file that isn't loaded without a buffer when
+	     * possible. */
+	    vf = NULL;
+	    if ((buf == NULL || buf->b_ml.ml_mfp == NULL) && vgr_may_read(fname))
+		vf = vgr_get(vg, fi);
+	    if (vf != NULL)
+		vgr_match_file(qi, &prevp, vf, fname, &lregmatch, flags,
+							     &tomatch, &linega);
+	    vgr_release(vg, fi);
+	    if (vf != NULL)
+	    {
+# ifdef FEAT_AUTOCMD
+		cur_qf_start = qi->qf_lists[qi->qf_curlist].qf_start;
+# endif
+		continue;
+	    }
+	}
+#endif
 	if (buf == NULL || buf->b_ml.ml_mfp == NULL)
 	{
 	    /* Remember that a buffer with this name already exists. */
@@ -3446,6 +4511,11 @@ ex_vimgrep(eap)
 	}
     }
 
+#ifdef VGR_FAST
+    if (vg != NULL)
+	vgr_end(vg);
+    ga_clear(&linega);
+#endif
     FreeWild(fcount, fnames);
 
     qi->qf_lists[qi->qf_curlist].qf_nonevalid = FALSE;
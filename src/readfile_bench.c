@@ -0,0 +1,212 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * readfile_bench.c: Benchmark for readfile() and textscan.c.
+ *
+ * Writes big files with various line breaks and text, then reads each of
+ * them into a buffer with every version of the scanning functions that the
+ * CPU supports.  Reports bytes per second and checks that all versions give
+ * the same lines.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Must include main.c because it contains much more than just main() */
+#define NO_VIM_MAIN
+#include "main.c"
+
+#define BENCH_SIZE  (64L * 1024L * 1024L)   /* bytes in each file */
+#define BENCH_RUNS  3			    /* the fastest run is reported */
+
+typedef struct
+{
+    char	*name;
+    char	*eol;		/* line break */
+    int		multibyte;	/* add UTF-8 characters */
+} bench_file_T;
+
+static bench_file_T bench_files[] =
+{
+    {"unix", "\n", FALSE},
+    {"dos", "\r\n", FALSE},
+    {"mac", "\r", FALSE},
+    {"unix utf-8", "\n", TRUE},
+};
+
+static char *level_names[] = {"scalar", "sse2", "avx2"};
+
+static char_u	bench_fname[40];
+static unsigned long bench_seed;
+
+static int bench_random __ARGS((int n));
+static long bench_write __ARGS((bench_file_T *bf));
+static long bench_usec_since __ARGS((struct timeval *tv));
+static long_u bench_read __ARGS((long *usec));
+static void bench_init __ARGS((void));
+
+/*
+ * Return a pseudo random number from 0 to "n" - 1.  Always the same
+ * sequence, the files must be the same every time.
+ */
+    static int
+bench_random(n)
+    int		n;
+{
+    bench_seed = bench_seed * 1103515245UL + 12345UL;
+    return (int)((bench_seed >> 16) % (unsigned long)n);
+}
+
+/*
+ * Write about BENCH_SIZE bytes of text with lines of 0 to 120 characters.
+ * Returns the number of bytes written.
+ */
+    static long
+bench_write(bf)
+    bench_file_T *bf;
+{
+    static char	*words[] = {"if", "(", "x", ")", "return", "vim_free",
+				"\t", "    ", "buf", "->", "b_ml", ";", "0"};
+    static char	*mb_words[] = {"\303\244", "\342\202\254", "\316\273",
+						   "\360\237\230\200", "\344\270\255"};
+    FILE	*fd;
+    long	written = 0;
+    int		len;
+    int		linelen;
+    char	*w;
+
+    fd = fopen((char *)bench_fname, "w");
+    assert(fd != NULL);
+    bench_seed = 1;
+    while (written < BENCH_SIZE)
+    {
+	linelen = bench_random(121);
+	for (len = 0; len < linelen; len += (int)strlen(w))
+	{
+	    if (bf->multibyte && bench_random(4) == 0)
+		w = mb_words[bench_random(5)];
+	    else
+		w = words[bench_random(13)];
+	    fputs(w, fd);
+	}
+	fputs(bf->eol, fd);
+	written += len + (long)strlen(bf->eol);
+    }
+    assert(fclose(fd) == 0);
+    return written;
+}
+
+    static long
+bench_usec_since(tv)
+    struct timeval *tv;
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - tv->tv_sec) * 1000000L + (now.tv_usec - tv->tv_usec);
+}
+
+/*
+ * Read the file into an empty buffer.  Sets "*usec" to the time readfile()
+ * took.  Returns a hash of the lines.
+ */
+    static long_u
+bench_read(usec)
+    long	*usec;
+{
+    struct timeval  start;
+    long_u	    hash = 0;
+    linenr_T	    lnum;
+    char_u	    *p;
+
+    ml_close(curbuf, TRUE);
+    assert(ml_open(curbuf) == OK);
+    curbuf->b_p_swf = FALSE;
+
+    gettimeofday(&start, NULL);
+    assert(readfile(bench_fname, NULL, (linenr_T)0, (linenr_T)0,
+				 (linenr_T)MAXLNUM, NULL, READ_NEW) == OK);
+    *usec = bench_usec_since(&start);
+
+    for (lnum = 1; lnum <= curbuf->b_ml.ml_line_count; ++lnum)
+	for (p = ml_get(lnum); *p != NUL; ++p)
+	    hash = hash * 31 + *p;
+    return hash * 31 + (long_u)curbuf->b_ml.ml_line_count;
+}
+
+/*
+ * The parts of Vim's startup that readfile() needs.
+ */
+    static void
+bench_init()
+{
+    mch_early_init();
+#ifdef FEAT_MBYTE
+    (void)mb_init();
+#endif
+    eval_init();
+    IObuff = alloc(IOSIZE);
+    NameBuff = alloc(MAXPATHL);
+    assert(IObuff != NULL && NameBuff != NULL);
+    assert(win_alloc_first() == OK);
+    set_init_1();
+
+    /* Read the whole file the normal way, without messages. */
+    do_cmdline_cmd((char_u *)"set encoding=utf-8 fileformats=unix,dos,mac");
+    do_cmdline_cmd((char_u *)"silent! set mmapsize=0");
+    do_cmdline_cmd((char_u *)"silent! set loadlines=0");
+    msg_silent = 1;
+}
+
+    int
+main()
+{
+    long	size;
+    long	usec;
+    long	best;
+    long_u	hash;
+    long_u	first_hash;
+    int		level;
+    int		i;
+    int		run;
+
+    bench_init();
+    sprintf((char *)bench_fname, "readfile_bench%ld.txt", (long)getpid());
+
+    printf("readfile_bench: reading %ld Mbyte files\n",
+						  BENCH_SIZE / 1024L / 1024L);
+    for (i = 0; i < (int)(sizeof(bench_files) / sizeof(bench_file_T)); ++i)
+    {
+	size = bench_write(&bench_files[i]);
+	first_hash = 0;
+	for (level = SCAN_SCALAR; level <= SCAN_AVX2; ++level)
+	{
+	    if (scan_set_level(level) != level)
+		continue;
+	    best = 0;
+	    for (run = 0; run < BENCH_RUNS; ++run)
+	    {
+		hash = bench_read(&usec);
+		if (best == 0 || usec < best)
+		    best = usec;
+	    }
+	    if (first_hash == 0)
+		first_hash = hash;
+	    assert(hash == first_hash);
+	    printf("  %-10s %-6s %7ld lines  %6.0f Mbyte/sec\n",
+		    bench_files[i].name, level_names[level],
+		    (long)curbuf->b_ml.ml_line_count,
+		    (double)size / best * 1000000.0 / 1024.0 / 1024.0);
+	}
+	assert(curbuf->b_p_ff[0] == *bench_files[i].name);
+    }
+    mch_remove(bench_fname);
+    return 0;
+}
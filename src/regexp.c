@@ -347,8 +347,8 @@ toggle_Magic(x)
 #define MAX_LIMIT	(32767L << 16L)
 
 static int re_multi_type __ARGS((int));
-static int cstrncmp __ARGS((char_u *s1, char_u *s2, int *n));
-static char_u *cstrchr __ARGS((char_u *, int));
+static int cstrncmp __ARGS((regexec_T *rex, char_u *s1, char_u *s2, int *n));
+static char_u *cstrchr __ARGS((regexec_T *rex, char_u *, int));
 
 #ifdef BT_REGEXP_DUMP
 static void	regdump __ARGS((char_u *, bt_regprog_T *));
@@ -708,7 +708,7 @@ static char_u	*regnode __ARGS((int));
 #ifdef FEAT_MBYTE
 static int	use_multibytecode __ARGS((int c));
 #endif
-static int	prog_magic_wrong __ARGS((void));
+static int	prog_magic_wrong __ARGS((regexec_T *rex));
 static char_u	*regnext __ARGS((char_u *));
 static void	regc __ARGS((int b));
 #ifdef FEAT_MBYTE
@@ -730,6 +730,10 @@ static void	regoptail __ARGS((char_u *, char_u *));
 
 static regengine_T bt_regengine;
 static regengine_T nfa_regengine;
+static void	regcache_clear __ARGS((void));
+#if defined(FEAT_PROFILE) && defined(EXITFREE)
+static void	regprof_free __ARGS((void));
+#endif
 
 /*
  * Return TRUE if compiled regular expression "prog" can match a line break.
@@ -3440,22 +3444,6 @@ read_limits(minval, maxval)
  * vim_regexec and friends
  */
 
-/*
- * Global work variables for vim_regexec().
- */
-
-/* The current match-position is remembered with these variables: */
-static linenr_T	reglnum;	/* line number, relative to first line */
-static char_u	*regline;	/* start of current line */
-static char_u	*reginput;	/* current input, points into "regline" */
-
-static int	need_clear_subexpr;	/* subexpressions still need to be
-					 * cleared */
-#ifdef FEAT_SYN_HL
-static int	need_clear_zsubexpr = FALSE;	/* extmatch subexpressions
-						 * still need to be cleared */
-#endif
-
 /*
  * Structure used to save the current input state, when it needs to be
  * restored after trying a match.  Used by reg_save() and reg_restore().
@@ -3491,25 +3479,27 @@ typedef struct regbehind_S
     save_se_T   save_end[NSUBEXP];
 } regbehind_T;
 
-static char_u	*reg_getline __ARGS((linenr_T lnum));
-static long	bt_regexec_both __ARGS((char_u *line, colnr_T col, proftime_T *tm));
-static long	regtry __ARGS((bt_regprog_T *prog, colnr_T col));
-static void	cleanup_subexpr __ARGS((void));
+static char_u	*reg_getline __ARGS((regexec_T *rex, linenr_T lnum));
+static long	bt_regexec_both __ARGS((regexec_T *rex, char_u *line, colnr_T col, proftime_T *tm));
+static long	regtry __ARGS((regexec_T *rex, bt_regprog_T *prog, colnr_T col));
+static void	cleanup_subexpr __ARGS((regexec_T *rex));
 #ifdef FEAT_SYN_HL
-static void	cleanup_zsubexpr __ARGS((void));
-#endif
-static void	save_subexpr __ARGS((regbehind_T *bp));
-static void	restore_subexpr __ARGS((regbehind_T *bp));
-static void	reg_nextline __ARGS((void));
-static void	reg_save __ARGS((regsave_T *save, garray_T *gap));
-static void	reg_restore __ARGS((regsave_T *save, garray_T *gap));
-static int	reg_save_equal __ARGS((regsave_T *save));
-static void	save_se_multi __ARGS((save_se_T *savep, lpos_T *posp));
-static void	save_se_one __ARGS((save_se_T *savep, char_u **pp));
+static void	cleanup_zsubexpr __ARGS((regexec_T *rex));
+#endif
+static void	save_subexpr __ARGS((regexec_T *rex, regbehind_T *bp));
+static void	restore_subexpr __ARGS((regexec_T *rex, regbehind_T *bp));
+static int	reg_grow __ARGS((regexec_T *rex, garray_T *gap, int n));
+static void	reg_nextline __ARGS((regexec_T *rex));
+static void	reg_save __ARGS((regexec_T *rex, regsave_T *save, garray_T *gap));
+static void	reg_restore __ARGS((regexec_T *rex, regsave_T *save, garray_T *gap));
+static int	reg_save_equal __ARGS((regexec_T *rex, regsave_T *save));
+static void	save_se_multi __ARGS((regexec_T *rex, save_se_T *savep, lpos_T *posp));
+static void	save_se_one __ARGS((regexec_T *rex, save_se_T *savep, char_u **pp));
 
 /* Save the sub-expressions before attempting a match. */
 #define save_se(savep, posp, pp) \
-    REG_MULTI ? save_se_multi((savep), (posp)) : save_se_one((savep), (pp))
+    REG_MULTI ? save_se_multi(rex, (savep), (posp)) \
+				      : save_se_one(rex, (savep), (pp))
 
 /* After a failed match restore the sub-expressions. */
 #define restore_se(savep, posp, pp) { \
@@ -3519,72 +3509,14 @@ static void	save_se_one __ARGS((save_se_T *savep, char_u **pp));
 	*(pp) = (savep)->se_u.ptr; }
 
 static int	re_num_cmp __ARGS((long_u val, char_u *scan));
-static int	match_with_backref __ARGS((linenr_T start_lnum, colnr_T start_col, linenr_T end_lnum, colnr_T end_col, int *bytelen));
-static int	regmatch __ARGS((char_u *prog));
-static int	regrepeat __ARGS((char_u *p, long maxcount));
+static int	match_with_backref __ARGS((regexec_T *rex, linenr_T start_lnum, colnr_T start_col, linenr_T end_lnum, colnr_T end_col, int *bytelen));
+static int	regmatch __ARGS((regexec_T *rex, char_u *prog));
+static int	regrepeat __ARGS((regexec_T *rex, char_u *p, long maxcount));
 
 #ifdef DEBUG
 int		regnarrate = 0;
 #endif
 
-/*
- * Internal copy of 'ignorecase'.  It is set at each call to vim_regexec().
- * Normally it gets the value of "rm_ic" or "rmm_ic", but when the pattern
- * contains '\c' or '\C' the value is overruled.
- */
-static int	ireg_ic;
-
-#ifdef FEAT_MBYTE
-/*
- * Similar to ireg_ic, but only for 'combining' characters.  Set with \Z flag
- * in the regexp.  Defaults to false, always.
- */
-static int	ireg_icombine;
-#endif
-
-/*
- * Copy of "rmm_maxcol": maximum column to search for a match.  Zero when
- * there is no maximum.
- */
-static colnr_T	ireg_maxcol;
-
-/*
- * Sometimes need to save a copy of a line.  Since alloc()/free() is very
- * slow, we keep one allocated piece of memory and only re-allocate it when
- * it's too small.  It's freed in bt_regexec_both() when finished.
- */
-static char_u	*reg_tofree = NULL;
-static unsigned	reg_tofreelen;
-
-/*
- * These variables are set when executing a regexp to speed up the execution.
- * Which ones are set depends on whether a single-line or multi-line match is
- * done:
- *			single-line		multi-line
- * reg_match		&regmatch_T		NULL
- * reg_mmatch		NULL			&regmmatch_T
- * reg_startp		reg_match->startp	<invalid>
- * reg_endp		reg_match->endp		<invalid>
- * reg_startpos		<invalid>		reg_mmatch->startpos
- * reg_endpos		<invalid>		reg_mmatch->endpos
- * reg_win		NULL			window in which to search
- * reg_buf		curbuf			buffer in which to search
- * reg_firstlnum	<invalid>		first line in which to search
- * reg_maxline		0			last line nr
- * reg_line_lbr		FALSE or TRUE		FALSE
- */
-static regmatch_T	*reg_match;
-static regmmatch_T	*reg_mmatch;
-static char_u		**reg_startp = NULL;
-static char_u		**reg_endp = NULL;
-static lpos_T		*reg_startpos = NULL;
-static lpos_T		*reg_endpos = NULL;
-static win_T		*reg_win;
-static buf_T		*reg_buf;
-static linenr_T		reg_firstlnum;
-static linenr_T		reg_maxline;
-static int		reg_line_lbr;	    /* "\n" in string is line break */
-
 /* Values for rs_state in regitem_T. */
 typedef enum regstate_E
 {
@@ -3624,8 +3556,10 @@ typedef struct regitem_S
     short	rs_no;		/* submatch nr or BEHIND/NOBEHIND */
 } regitem_T;
 
-static regitem_T *regstack_push __ARGS((regstate_T state, char_u *scan));
-static void regstack_pop __ARGS((char_u **scan));
+static void regexec_init __ARGS((regexec_T *rex));
+static void regexec_clear __ARGS((regexec_T *rex));
+static regitem_T *regstack_push __ARGS((regexec_T *rex, regstate_T state, char_u *scan));
+static void regstack_pop __ARGS((regexec_T *rex, char_u **scan));
 
 /* used for STAR, PLUS and BRACE_SIMPLE matching */
 typedef struct regstar_S
@@ -3645,71 +3579,259 @@ typedef struct backpos_S
     regsave_T	bp_pos;		/* last input position */
 } backpos_T;
 
-/*
- * "regstack" and "backpos" are used by regmatch().  They are kept over calls
- * to avoid invoking malloc() and free() often.
- * "regstack" is a stack with regitem_T items, sometimes preceded by regstar_T
- * or regbehind_T.
- * "backpos_T" is a table with backpos_T for BACK
- */
-static garray_T	regstack = {0, 0, 0, 0, NULL};
-static garray_T	backpos = {0, 0, 0, 0, NULL};
-
 /*
  * Both for regstack and backpos tables we use the following strategy of
  * allocation (to reduce malloc/free calls):
- * - Initial size is fairly small.
- * - When needed, the tables are grown bigger (8 times at first, double after
- *   that).
- * - After executing the match we free the memory only if the array has grown.
- *   Thus the memory is kept allocated when it's at the initial size.
- * This makes it fast while not keeping a lot of memory allocated.
+ * - Initial size is fairly small, it is in the regexec_T, thus a match that
+ *   does not need more does not allocate memory.
+ * - When needed, the tables are moved to allocated memory and grown bigger
+ *   (8 times at first, double after that).
+ * - After executing the match the allocated memory is freed.
  * A three times speed increase was observed when using many simple patterns.
  */
 #define REGSTACK_INITIAL	2048
 #define BACKPOS_INITIAL		64
 
+/*
+ * The state of executing a regexp.  vim_regexec(), vim_regexec_nl() and
+ * vim_regexec_multi() have one on the stack and pass it down to the engine.
+ * Each match has its own, thus a match can be done while another one is in
+ * progress, e.g. for an expression in the substitute string.
+ * What is not in here is changed in the program while matching: the lazily
+ * built DFA of the NFA engine and the counters for ":regexpprofile".  A match
+ * does not evaluate expressions while using them, thus a nested match can't
+ * see them half-way.  No lock is used, a program must not be used by more
+ * than one thread.
+ */
+struct regexec_S
+{
+    /* The current match-position is remembered with these: */
+    linenr_T	lnum;		/* line number, relative to first line */
+    char_u	*line;		/* start of current line */
+    char_u	*input;		/* current input, points into "line" */
+
+    int		need_clear_subexpr;	/* subexpressions still need to be
+					 * cleared */
+#ifdef FEAT_SYN_HL
+    int		need_clear_zsubexpr;	/* extmatch subexpressions still
+					 * need to be cleared */
+#endif
+
+    /*
+     * Internal copy of 'ignorecase'.  It is set at each call to
+     * vim_regexec().  Normally it gets the value of "rm_ic" or "rmm_ic", but
+     * when the pattern contains '\c' or '\C' the value is overruled.
+     */
+    int		reg_ic;
+
+#ifdef FEAT_MBYTE
+    /*
+     * Similar to reg_ic, but only for 'combining' characters.  Set with \Z
+     * flag in the regexp.  Defaults to false, always.
+     */
+    int		reg_icombine;
+#endif
+
+    /* Copy of "rmm_maxcol": maximum column to search for a match.  Zero
+     * when there is no maximum. */
+    colnr_T	reg_maxcol;
+
+    /*
+     * These are set when executing a regexp to speed up the execution.
+     * Which ones are set depends on whether a single-line or multi-line
+     * match is done:
+     *			single-line		multi-line
+     * reg_match	&regmatch_T		NULL
+     * reg_mmatch	NULL			&regmmatch_T
+     * reg_startp	reg_match->startp	<invalid>
+     * reg_endp		reg_match->endp		<invalid>
+     * reg_startpos	<invalid>		reg_mmatch->startpos
+     * reg_endpos	<invalid>		reg_mmatch->endpos
+     * reg_win		NULL			window in which to search
+     * reg_buf		curbuf			buffer in which to search
+     * reg_firstlnum	<invalid>		first line in which to search
+     * reg_maxline	0			last line nr
+     * reg_line_lbr	FALSE or TRUE		FALSE
+     */
+    regmatch_T	*reg_match;
+    regmmatch_T	*reg_mmatch;
+    char_u	**reg_startp;
+    char_u	**reg_endp;
+    lpos_T	*reg_startpos;
+    lpos_T	*reg_endpos;
+    win_T	*reg_win;
+    buf_T	*reg_buf;
+    linenr_T	reg_firstlnum;
+    linenr_T	reg_maxline;
+    int		reg_line_lbr;	/* "\n" in string is line break */
+
+    /*
+     * Sometimes need to save a copy of a line.  Since alloc()/free() is very
+     * slow, we keep one allocated piece of memory and only re-allocate it
+     * when it's too small.
+     */
+    char_u	*reg_tofree;
+    unsigned	reg_tofreelen;
+
+    /*
+     * "regstack" and "backpos" are used by regmatch().
+     * "regstack" is a stack with regitem_T items, sometimes preceded by
+     * regstar_T or regbehind_T.
+     * "backpos_T" is a table with backpos_T for BACK
+     */
+    garray_T	regstack;
+    garray_T	backpos;
+
+    regsave_T	behind_pos;
+
+    /* The arguments from BRACE_LIMITS are stored here.  They are actually
+     * local to regmatch(), but they are here to reduce the amount of stack
+     * space used. */
+    long	bl_minval;
+    long	bl_maxval;
+
+#ifdef FEAT_SYN_HL
+    char_u	*reg_startzp[NSUBEXP];	/* Workspace to mark beginning */
+    char_u	*reg_endzp[NSUBEXP];	/*   and end of \z(...\) matches */
+    lpos_T	reg_startzpos[NSUBEXP];	/* idem, beginning pos */
+    lpos_T	reg_endzpos[NSUBEXP];	/* idem, end pos */
+#endif
+
+    /* Used by the NFA engine. */
+    int		nfa_has_zend;	/* NFA regexp \ze operator encountered */
+    int		nfa_has_backref; /* NFA regexp \1 .. \9 encountered */
+#ifdef FEAT_SYN_HL
+    int		nfa_has_zsubexpr; /* NFA regexp has \z( ), set zsubexpr */
+#endif
+    int		nfa_nsubexpr;	/* Number of sub expressions actually being
+				 * used.  1 if only the whole match (subexpr
+				 * 0) is used. */
+    save_se_T	*nfa_endp;	/* if not NULL match must end at this
+				 * position */
+    int		nfa_match;	/* whether a match has been found */
+
+    /* Used in nfa_regmatch() to mark states that are on a list.  The list
+     * ID is incremented for each list, thus the marks never need to be
+     * cleared.  Each level of recursive_regmatch() has its own marks in
+     * "nfa_lastlists", the ones for the current level are in
+     * "nfa_lastlist". */
+    int		nfa_listid;
+    int		nfa_alt_listid;	/* highest list ID used by a recursive call */
+    int		nfa_ll_index;	/* recursion level, 0 for the first call */
+    int		*nfa_lastlist;
+    garray_T	nfa_lastlists;	/* int pointers */
+
+#ifdef FEAT_PROFILE
+    /* Counted for ":regexpprofile". */
+    long	prof_steps;	/* states visited */
+    long	prof_addstate;	/* calls to addstate() */
+    long	prof_fallback;	/* times the DFA was given up */
+#endif
+
+    /* Initial space for "regstack" and "backpos".  Must be last, it is not
+     * cleared by regexec_init(). */
+    long_u	regstack_buf[REGSTACK_INITIAL / sizeof(long_u)];
+    backpos_T	backpos_buf[BACKPOS_INITIAL];
+};
+
 #if defined(EXITFREE) || defined(PROTO)
     void
 free_regexp_stuff()
 {
-    ga_clear(&regstack);
-    ga_clear(&backpos);
-    vim_free(reg_tofree);
     vim_free(reg_prev_sub);
+    regcache_clear();
+# ifdef FEAT_PROFILE
+    regprof_free();
+# endif
 }
 #endif
 
+/*
+ * Initialize "rex" for executing a regexp.
+ */
+    static void
+regexec_init(rex)
+    regexec_T	*rex;
+{
+    /* Clearing the buffers at the end would only take time. */
+    vim_memset(rex, 0, (size_t)((char *)rex->regstack_buf - (char *)rex));
+    ga_init2(&rex->nfa_lastlists, (int)sizeof(int *), 4);
+}
+
+/*
+ * Free the memory used by "rex" after executing a regexp.
+ */
+    static void
+regexec_clear(rex)
+    regexec_T	*rex;
+{
+    int		i;
+
+    if (rex->regstack.ga_data != (void *)rex->regstack_buf)
+	ga_clear(&rex->regstack);
+    if (rex->backpos.ga_data != (void *)rex->backpos_buf)
+	ga_clear(&rex->backpos);
+    vim_free(rex->reg_tofree);
+    for (i = 0; i < rex->nfa_lastlists.ga_len; ++i)
+	vim_free(((int **)rex->nfa_lastlists.ga_data)[i]);
+    ga_clear(&rex->nfa_lastlists);
+}
+
+/*
+ * Make room for "n" more items in "gap", which is "rex->regstack" or
+ * "rex->backpos".  When it is still in the space in "rex" it is moved to
+ * allocated memory.
+ */
+    static int
+reg_grow(rex, gap, n)
+    regexec_T	*rex;
+    garray_T	*gap;
+    int		n;
+{
+    void	*data = gap->ga_data;
+    int		len = gap->ga_len;
+
+    if (gap->ga_maxlen - len >= n)
+	return OK;
+    if (data != (void *)rex->regstack_buf && data != (void *)rex->backpos_buf)
+	return ga_grow(gap, n);
+    gap->ga_data = NULL;
+    gap->ga_maxlen = 0;
+    gap->ga_len = 0;
+    if (ga_grow(gap, len + n) == FAIL)
+    {
+	gap->ga_data = data;
+	gap->ga_maxlen = len;
+	gap->ga_len = len;
+	return FAIL;
+    }
+    mch_memmove(gap->ga_data, data, (size_t)(len * gap->ga_itemsize));
+    gap->ga_len = len;
+    return OK;
+}
+
 /*
  * Get pointer to the line "lnum", which is relative to "reg_firstlnum".
  */
     static char_u *
-reg_getline(lnum)
+reg_getline(rex, lnum)
+    regexec_T	*rex;
     linenr_T	lnum;
 {
     /* when looking behind for a match/no-match lnum is negative.  But we
      * can't go before line 1 */
-    if (reg_firstlnum + lnum < 1)
+    if (rex->reg_firstlnum + lnum < 1)
 	return NULL;
-    if (lnum > reg_maxline)
+    if (lnum > rex->reg_maxline)
 	/* Must have matched the "\n" in the last line. */
 	return (char_u *)"";
-    return ml_get_buf(reg_buf, reg_firstlnum + lnum, FALSE);
+    return ml_get_buf(rex->reg_buf, rex->reg_firstlnum + lnum, FALSE);
 }
 
-static regsave_T behind_pos;
-
-#ifdef FEAT_SYN_HL
-static char_u	*reg_startzp[NSUBEXP];	/* Workspace to mark beginning */
-static char_u	*reg_endzp[NSUBEXP];	/*   and end of \z(...\) matches */
-static lpos_T	reg_startzpos[NSUBEXP];	/* idem, beginning pos */
-static lpos_T	reg_endzpos[NSUBEXP];	/* idem, end pos */
-#endif
-
-/* TRUE if using multi-line regexp. */
-#define REG_MULTI	(reg_match == NULL)
+/* TRUE if using multi-line regexp.  Uses "rex". */
+#define REG_MULTI	(rex->reg_match == NULL)
 
-static int  bt_regexec __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
+static int  bt_regexec __ARGS((regexec_T *rex, regmatch_T *rmp, char_u *line, colnr_T col));
 
 /*
  * Match a regexp against a string.
@@ -3719,55 +3841,57 @@ static int  bt_regexec __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
  * Return TRUE if there is a match, FALSE if not.
  */
     static int
-bt_regexec(rmp, line, col)
+bt_regexec(rex, rmp, line, col)
+    regexec_T	*rex;
     regmatch_T	*rmp;
     char_u	*line;	/* string to match against */
     colnr_T	col;	/* column to start looking for match */
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = FALSE;
-    reg_buf = curbuf;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
+    rex->reg_line_lbr = FALSE;
+    rex->reg_buf = curbuf;
+    rex->reg_win = NULL;
+    rex->reg_ic = rmp->rm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = 0;
-    return (bt_regexec_both(line, col, NULL) != 0);
+    rex->reg_maxcol = 0;
+    return (bt_regexec_both(rex, line, col, NULL) != 0);
 }
 
 #if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
 	|| defined(FIND_REPLACE_DIALOG) || defined(PROTO)
 
-static int  bt_regexec_nl __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
+static int  bt_regexec_nl __ARGS((regexec_T *rex, regmatch_T *rmp, char_u *line, colnr_T col));
 
 /*
  * Like vim_regexec(), but consider a "\n" in "line" to be a line break.
  */
     static int
-bt_regexec_nl(rmp, line, col)
+bt_regexec_nl(rex, rmp, line, col)
+    regexec_T	*rex;
     regmatch_T	*rmp;
     char_u	*line;	/* string to match against */
     colnr_T	col;	/* column to start looking for match */
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = TRUE;
-    reg_buf = curbuf;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
+    rex->reg_line_lbr = TRUE;
+    rex->reg_buf = curbuf;
+    rex->reg_win = NULL;
+    rex->reg_ic = rmp->rm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = 0;
-    return (bt_regexec_both(line, col, NULL) != 0);
+    rex->reg_maxcol = 0;
+    return (bt_regexec_both(rex, line, col, NULL) != 0);
 }
 #endif
 
-static long bt_regexec_multi __ARGS((regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum, colnr_T col, proftime_T *tm));
+static long bt_regexec_multi __ARGS((regexec_T *rex, regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum, colnr_T col, proftime_T *tm));
 
 /*
  * Match a regexp against multiple lines.
@@ -3778,7 +3902,8 @@ static long bt_regexec_multi __ARGS((regmmatch_T *rmp, win_T *win, buf_T *buf, l
  * match otherwise.
  */
     static long
-bt_regexec_multi(rmp, win, buf, lnum, col, tm)
+bt_regexec_multi(rex, rmp, win, buf, lnum, col, tm)
+    regexec_T	*rex;
     regmmatch_T	*rmp;
     win_T	*win;		/* window in which to search or NULL */
     buf_T	*buf;		/* buffer in which to search */
@@ -3788,20 +3913,20 @@ bt_regexec_multi(rmp, win, buf, lnum, col, tm)
 {
     long	r;
 
-    reg_match = NULL;
-    reg_mmatch = rmp;
-    reg_buf = buf;
-    reg_win = win;
-    reg_firstlnum = lnum;
-    reg_maxline = reg_buf->b_ml.ml_line_count - lnum;
-    reg_line_lbr = FALSE;
-    ireg_ic = rmp->rmm_ic;
+    rex->reg_match = NULL;
+    rex->reg_mmatch = rmp;
+    rex->reg_buf = buf;
+    rex->reg_win = win;
+    rex->reg_firstlnum = lnum;
+    rex->reg_maxline = rex->reg_buf->b_ml.ml_line_count - lnum;
+    rex->reg_line_lbr = FALSE;
+    rex->reg_ic = rmp->rmm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = rmp->rmm_maxcol;
+    rex->reg_maxcol = rmp->rmm_maxcol;
 
-    r = bt_regexec_both(NULL, col, tm);
+    r = bt_regexec_both(rex, NULL, col, tm);
 
     return r;
 }
@@ -3811,7 +3936,8 @@ bt_regexec_multi(rmp, win, buf, lnum, col, tm)
  * lines ("line" is NULL, use reg_getline()).
  */
     static long
-bt_regexec_both(line, col, tm)
+bt_regexec_both(rex, line, col, tm)
+    regexec_T	*rex;
     char_u	*line;
     colnr_T	col;		/* column to start looking for match */
     proftime_T	*tm UNUSED;	/* timeout limit or NULL */
@@ -3820,38 +3946,37 @@ bt_regexec_both(line, col, tm)
     char_u	*s;
     long	retval = 0L;
 
-    /* Create "regstack" and "backpos" if they are not allocated yet.
-     * We allocate *_INITIAL amount of bytes first and then set the grow size
-     * to much bigger value to avoid many malloc calls in case of deep regular
-     * expressions.  */
-    if (regstack.ga_data == NULL)
+    /* Use the space in "rex" for "regstack" and "backpos" first and then
+     * set the grow size to much bigger value to avoid many malloc calls in
+     * case of deep regular expressions.  */
+    if (rex->regstack.ga_data == NULL)
     {
 	/* Use an item size of 1 byte, since we push different things
 	 * onto the regstack. */
-	ga_init2(&regstack, 1, REGSTACK_INITIAL);
-	ga_grow(&regstack, REGSTACK_INITIAL);
-	regstack.ga_growsize = REGSTACK_INITIAL * 8;
+	ga_init2(&rex->regstack, 1, REGSTACK_INITIAL * 8);
+	rex->regstack.ga_data = (void *)rex->regstack_buf;
+	rex->regstack.ga_maxlen = REGSTACK_INITIAL;
     }
 
-    if (backpos.ga_data == NULL)
+    if (rex->backpos.ga_data == NULL)
     {
-	ga_init2(&backpos, sizeof(backpos_T), BACKPOS_INITIAL);
-	ga_grow(&backpos, BACKPOS_INITIAL);
-	backpos.ga_growsize = BACKPOS_INITIAL * 8;
+	ga_init2(&rex->backpos, sizeof(backpos_T), BACKPOS_INITIAL * 8);
+	rex->backpos.ga_data = (void *)rex->backpos_buf;
+	rex->backpos.ga_maxlen = BACKPOS_INITIAL;
     }
 
     if (REG_MULTI)
     {
-	prog = (bt_regprog_T *)reg_mmatch->regprog;
-	line = reg_getline((linenr_T)0);
-	reg_startpos = reg_mmatch->startpos;
-	reg_endpos = reg_mmatch->endpos;
+	prog = (bt_regprog_T *)rex->reg_mmatch->regprog;
+	line = reg_getline(rex, (linenr_T)0);
+	rex->reg_startpos = rex->reg_mmatch->startpos;
+	rex->reg_endpos = rex->reg_mmatch->endpos;
     }
     else
     {
-	prog = (bt_regprog_T *)reg_match->regprog;
-	reg_startp = reg_match->startp;
-	reg_endp = reg_match->endp;
+	prog = (bt_regprog_T *)rex->reg_match->regprog;
+	rex->reg_startp = rex->reg_match->startp;
+	rex->reg_endp = rex->reg_match->endp;
     }
 
     /* Be paranoid... */
@@ -3862,23 +3987,23 @@ bt_regexec_both(line, col, tm)
     }
 
     /* Check validity of program. */
-    if (prog_magic_wrong())
+    if (prog_magic_wrong(rex))
 	goto theend;
 
     /* If the start column is past the maximum column: no need to try. */
-    if (ireg_maxcol > 0 && col >= ireg_maxcol)
+    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
 	goto theend;
 
-    /* If pattern contains "\c" or "\C": overrule value of ireg_ic */
+    /* If pattern contains "\c" or "\C": overrule value of reg_ic */
     if (prog->regflags & RF_ICASE)
-	ireg_ic = TRUE;
+	rex->reg_ic = TRUE;
     else if (prog->regflags & RF_NOICASE)
-	ireg_ic = FALSE;
+	rex->reg_ic = FALSE;
 
 #ifdef FEAT_MBYTE
-    /* If pattern contains "\Z" overrule value of ireg_icombine */
+    /* If pattern contains "\Z" overrule value of reg_icombine */
     if (prog->regflags & RF_ICOMBINE)
-	ireg_icombine = TRUE;
+	rex->reg_icombine = TRUE;
 #endif
 
     /* If there is a "must appear" string, look for it. */
@@ -3897,31 +4022,32 @@ bt_regexec_both(line, col, tm)
 	/*
 	 * This is used very often, esp. for ":global".  Use three versions of
 	 * the loop to avoid overhead of conditions.
+	 * Without ignoring case, in UTF-8 the bytes can only match at a
+	 * character boundary, thus scan_find() can look for the bytes.
 	 */
-	if (!ireg_ic
+	if (!rex->reg_ic
 #ifdef FEAT_MBYTE
-		&& !has_mbyte
+		&& (!has_mbyte || (enc_utf8 && !rex->reg_icombine))
 #endif
 		)
-	    while ((s = vim_strbyte(s, c)) != NULL)
-	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
-		    break;		/* Found it. */
-		++s;
-	    }
+	{
+	    if (scan_find(s, (long)STRLEN(s), &prog->regmust, &prog->regmlen,
+							       1, FALSE) < 0)
+		s = NULL;
+	}
 #ifdef FEAT_MBYTE
-	else if (!ireg_ic || (!enc_utf8 && mb_char2len(c) > 1))
+	else if (!rex->reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
 	    while ((s = vim_strchr(s, c)) != NULL)
 	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
+		if (cstrncmp(rex, s, prog->regmust, &prog->regmlen) == 0)
 		    break;		/* Found it. */
 		mb_ptr_adv(s);
 	    }
 #endif
 	else
-	    while ((s = cstrchr(s, c)) != NULL)
+	    while ((s = cstrchr(rex, s, c)) != NULL)
 	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
+		if (cstrncmp(rex, s, prog->regmust, &prog->regmlen) == 0)
 		    break;		/* Found it. */
 		mb_ptr_adv(s);
 	    }
@@ -3929,8 +4055,8 @@ bt_regexec_both(line, col, tm)
 	    goto theend;
     }
 
-    regline = line;
-    reglnum = 0;
+    rex->line = line;
+    rex->lnum = 0;
     reg_toolong = FALSE;
 
     /* Simplest case: Anchored match need be tried only once. */
@@ -3940,19 +4066,19 @@ bt_regexec_both(line, col, tm)
 
 #ifdef FEAT_MBYTE
 	if (has_mbyte)
-	    c = (*mb_ptr2char)(regline + col);
+	    c = (*mb_ptr2char)(rex->line + col);
 	else
 #endif
-	    c = regline[col];
+	    c = rex->line[col];
 	if (prog->regstart == NUL
 		|| prog->regstart == c
-		|| (ireg_ic && ((
+		|| (rex->reg_ic && ((
 #ifdef FEAT_MBYTE
 			(enc_utf8 && utf_fold(prog->regstart) == utf_fold(c)))
 			|| (c < 255 && prog->regstart < 255 &&
 #endif
 			    MB_TOLOWER(prog->regstart) == MB_TOLOWER(c)))))
-	    retval = regtry(prog, col);
+	    retval = regtry(rex, prog, col);
 	else
 	    retval = 0;
     }
@@ -3968,44 +4094,44 @@ bt_regexec_both(line, col, tm)
 	    {
 		/* Skip until the char we know it must start with.
 		 * Used often, do some work to avoid call overhead. */
-		if (!ireg_ic
+		if (!rex->reg_ic
 #ifdef FEAT_MBYTE
 			    && !has_mbyte
 #endif
 			    )
-		    s = vim_strbyte(regline + col, prog->regstart);
+		    s = vim_strbyte(rex->line + col, prog->regstart);
 		else
-		    s = cstrchr(regline + col, prog->regstart);
+		    s = cstrchr(rex, rex->line + col, prog->regstart);
 		if (s == NULL)
 		{
 		    retval = 0;
 		    break;
 		}
-		col = (int)(s - regline);
+		col = (int)(s - rex->line);
 	    }
 
 	    /* Check for maximum column to try. */
-	    if (ireg_maxcol > 0 && col >= ireg_maxcol)
+	    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
 	    {
 		retval = 0;
 		break;
 	    }
 
-	    retval = regtry(prog, col);
+	    retval = regtry(rex, prog, col);
 	    if (retval > 0)
 		break;
 
 	    /* if not currently on the first line, get it again */
-	    if (reglnum != 0)
+	    if (rex->lnum != 0)
 	    {
-		reglnum = 0;
-		regline = reg_getline((linenr_T)0);
+		rex->lnum = 0;
+		rex->line = reg_getline(rex, (linenr_T)0);
 	    }
-	    if (regline[col] == NUL)
+	    if (rex->line[col] == NUL)
 		break;
 #ifdef FEAT_MBYTE
 	    if (has_mbyte)
-		col += (*mb_ptr2len)(regline + col);
+		col += (*mb_ptr2len)(rex->line + col);
 	    else
 #endif
 		++col;
@@ -4022,18 +4148,6 @@ bt_regexec_both(line, col, tm)
     }
 
 theend:
-    /* Free "reg_tofree" when it's a bit big.
-     * Free regstack and backpos if they are bigger than their initial size. */
-    if (reg_tofreelen > 400)
-    {
-	vim_free(reg_tofree);
-	reg_tofree = NULL;
-    }
-    if (regstack.ga_maxlen > REGSTACK_INITIAL)
-	ga_clear(&regstack);
-    if (backpos.ga_maxlen > BACKPOS_INITIAL)
-	ga_clear(&backpos);
-
     return retval;
 }
 
@@ -4090,44 +4204,45 @@ unref_extmatch(em)
  * Returns 0 for failure, number of lines contained in the match otherwise.
  */
     static long
-regtry(prog, col)
+regtry(rex, prog, col)
+    regexec_T       *rex;
     bt_regprog_T    *prog;
     colnr_T	col;
 {
-    reginput = regline + col;
-    need_clear_subexpr = TRUE;
+    rex->input = rex->line + col;
+    rex->need_clear_subexpr = TRUE;
 #ifdef FEAT_SYN_HL
     /* Clear the external match subpointers if necessary. */
     if (prog->reghasz == REX_SET)
-	need_clear_zsubexpr = TRUE;
+	rex->need_clear_zsubexpr = TRUE;
 #endif
 
-    if (regmatch(prog->program + 1) == 0)
+    if (regmatch(rex, prog->program + 1) == 0)
 	return 0;
 
-    cleanup_subexpr();
+    cleanup_subexpr(rex);
     if (REG_MULTI)
     {
-	if (reg_startpos[0].lnum < 0)
+	if (rex->reg_startpos[0].lnum < 0)
 	{
-	    reg_startpos[0].lnum = 0;
-	    reg_startpos[0].col = col;
+	    rex->reg_startpos[0].lnum = 0;
+	    rex->reg_startpos[0].col = col;
 	}
-	if (reg_endpos[0].lnum < 0)
+	if (rex->reg_endpos[0].lnum < 0)
 	{
-	    reg_endpos[0].lnum = reglnum;
-	    reg_endpos[0].col = (int)(reginput - regline);
+	    rex->reg_endpos[0].lnum = rex->lnum;
+	    rex->reg_endpos[0].col = (int)(rex->input - rex->line);
 	}
 	else
 	    /* Use line number of "\ze". */
-	    reglnum = reg_endpos[0].lnum;
+	    rex->lnum = rex->reg_endpos[0].lnum;
     }
     else
     {
-	if (reg_startp[0] == NULL)
-	    reg_startp[0] = regline + col;
-	if (reg_endp[0] == NULL)
-	    reg_endp[0] = reginput;
+	if (rex->reg_startp[0] == NULL)
+	    rex->reg_startp[0] = rex->line + col;
+	if (rex->reg_endp[0] == NULL)
+	    rex->reg_endp[0] = rex->input;
     }
 #ifdef FEAT_SYN_HL
     /* Package any found \z(...\) matches for export. Default is none. */
@@ -4138,69 +4253,71 @@ regtry(prog, col)
     {
 	int		i;
 
-	cleanup_zsubexpr();
+	cleanup_zsubexpr(rex);
 	re_extmatch_out = make_extmatch();
 	for (i = 0; i < NSUBEXP; i++)
 	{
 	    if (REG_MULTI)
 	    {
 		/* Only accept single line matches. */
-		if (reg_startzpos[i].lnum >= 0
-			&& reg_endzpos[i].lnum == reg_startzpos[i].lnum)
+		if (rex->reg_startzpos[i].lnum >= 0
+			&& rex->reg_endzpos[i].lnum == rex->reg_startzpos[i].lnum)
 		    re_extmatch_out->matches[i] =
-			vim_strnsave(reg_getline(reg_startzpos[i].lnum)
-						       + reg_startzpos[i].col,
-				   reg_endzpos[i].col - reg_startzpos[i].col);
+			vim_strnsave(reg_getline(rex, rex->reg_startzpos[i].lnum)
+						       + rex->reg_startzpos[i].col,
+				   rex->reg_endzpos[i].col - rex->reg_startzpos[i].col);
 	    }
 	    else
 	    {
-		if (reg_startzp[i] != NULL && reg_endzp[i] != NULL)
+		if (rex->reg_startzp[i] != NULL && rex->reg_endzp[i] != NULL)
 		    re_extmatch_out->matches[i] =
-			    vim_strnsave(reg_startzp[i],
-					(int)(reg_endzp[i] - reg_startzp[i]));
+			    vim_strnsave(rex->reg_startzp[i],
+					(int)(rex->reg_endzp[i] - rex->reg_startzp[i]));
 	    }
 	}
     }
 #endif
-    return 1 + reglnum;
+    return 1 + rex->lnum;
 }
 
 #ifdef FEAT_MBYTE
-static int reg_prev_class __ARGS((void));
+static int reg_prev_class __ARGS((regexec_T *rex));
 
 /*
  * Get class of previous character.
  */
     static int
-reg_prev_class()
+reg_prev_class(rex)
+    regexec_T	*rex;
 {
-    if (reginput > regline)
-	return mb_get_class_buf(reginput - 1
-			    - (*mb_head_off)(regline, reginput - 1), reg_buf);
+    if (rex->input > rex->line)
+	return mb_get_class_buf(rex->input - 1
+			    - (*mb_head_off)(rex->line, rex->input - 1), rex->reg_buf);
     return -1;
 }
 
 #endif
 #ifdef FEAT_VISUAL
-static int reg_match_visual __ARGS((void));
+static int reg_match_visual __ARGS((regexec_T *rex));
 
 /*
  * Return TRUE if the current reginput position matches the Visual area.
  */
     static int
-reg_match_visual()
+reg_match_visual(rex)
+    regexec_T	*rex;
 {
     pos_T	top, bot;
     linenr_T    lnum;
     colnr_T	col;
-    win_T	*wp = reg_win == NULL ? curwin : reg_win;
+    win_T	*wp = rex->reg_win == NULL ? curwin : rex->reg_win;
     int		mode;
     colnr_T	start, end;
     colnr_T	start2, end2;
     colnr_T	cols;
 
     /* Check if the buffer is the current buffer. */
-    if (reg_buf != curbuf || VIsual.lnum == 0)
+    if (rex->reg_buf != curbuf || VIsual.lnum == 0)
 	return FALSE;
 
     if (VIsual_active)
@@ -4231,13 +4348,13 @@ reg_match_visual()
 	}
 	mode = curbuf->b_visual.vi_mode;
     }
-    lnum = reglnum + reg_firstlnum;
+    lnum = rex->lnum + rex->reg_firstlnum;
     if (lnum < top.lnum || lnum > bot.lnum)
 	return FALSE;
 
     if (mode == 'v')
     {
-	col = (colnr_T)(reginput - regline);
+	col = (colnr_T)(rex->input - rex->line);
 	if ((lnum == top.lnum && col < top.col)
 		|| (lnum == bot.lnum && col >= bot.col + (*p_sel != 'e')))
 	    return FALSE;
@@ -4252,7 +4369,7 @@ reg_match_visual()
 	    end = end2;
 	if (top.col == MAXCOL || bot.col == MAXCOL)
 	    end = MAXCOL;
-	cols = win_linetabsize(wp, regline, (colnr_T)(reginput - regline));
+	cols = win_linetabsize(wp, rex->line, (colnr_T)(rex->input - rex->line));
 	if (cols < start || cols > end - (*p_sel == 'e'))
 	    return FALSE;
     }
@@ -4260,15 +4377,7 @@ reg_match_visual()
 }
 #endif
 
-#define ADVANCE_REGINPUT() mb_ptr_adv(reginput)
-
-/*
- * The arguments from BRACE_LIMITS are stored here.  They are actually local
- * to regmatch(), but they are here to reduce the amount of stack space used
- * (it can be called recursively many times).
- */
-static long	bl_minval;
-static long	bl_maxval;
+#define ADVANCE_REGINPUT() mb_ptr_adv(rex->input)
 
 /*
  * regmatch - main matching routine
@@ -4286,7 +4395,8 @@ static long	bl_maxval;
  * undefined state!
  */
     static int
-regmatch(scan)
+regmatch(rex, scan)
+    regexec_T	*rex;
     char_u	*scan;		/* Current node. */
 {
   char_u	*next;		/* Next node. */
@@ -4303,8 +4413,8 @@ regmatch(scan)
 
   /* Make "regstack" and "backpos" empty.  They are allocated and freed in
    * bt_regexec_both() to reduce malloc()/free() calls. */
-  regstack.ga_len = 0;
-  backpos.ga_len = 0;
+  rex->regstack.ga_len = 0;
+  rex->backpos.ga_len = 0;
 
   /*
    * Repeat until "regstack" is empty.
@@ -4335,6 +4445,9 @@ regmatch(scan)
 	    break;
 	}
 	status = RA_CONT;
+#ifdef FEAT_PROFILE
+	++rex->prof_steps;
+#endif
 
 #ifdef DEBUG
 	if (regnarrate)
@@ -4362,12 +4475,12 @@ regmatch(scan)
 
 	op = OP(scan);
 	/* Check for character class with NL added. */
-	if (!reg_line_lbr && WITH_NL(op) && REG_MULTI
-				&& *reginput == NUL && reglnum <= reg_maxline)
+	if (!rex->reg_line_lbr && WITH_NL(op) && REG_MULTI
+				&& *rex->input == NUL && rex->lnum <= rex->reg_maxline)
 	{
-	    reg_nextline();
+	    reg_nextline(rex);
 	}
-	else if (reg_line_lbr && WITH_NL(op) && *reginput == '\n')
+	else if (rex->reg_line_lbr && WITH_NL(op) && *rex->input == '\n')
 	{
 	    ADVANCE_REGINPUT();
 	}
@@ -4377,14 +4490,14 @@ regmatch(scan)
 	      op -= ADD_NL;
 #ifdef FEAT_MBYTE
 	  if (has_mbyte)
-	      c = (*mb_ptr2char)(reginput);
+	      c = (*mb_ptr2char)(rex->input);
 	  else
 #endif
-	      c = *reginput;
+	      c = *rex->input;
 	  switch (op)
 	  {
 	  case BOL:
-	    if (reginput != regline)
+	    if (rex->input != rex->line)
 		status = RA_NOMATCH;
 	    break;
 
@@ -4397,22 +4510,22 @@ regmatch(scan)
 	    /* We're not at the beginning of the file when below the first
 	     * line where we started, not at the start of the line or we
 	     * didn't start at the first line of the buffer. */
-	    if (reglnum != 0 || reginput != regline
-					  || (REG_MULTI && reg_firstlnum > 1))
+	    if (rex->lnum != 0 || rex->input != rex->line
+					  || (REG_MULTI && rex->reg_firstlnum > 1))
 		status = RA_NOMATCH;
 	    break;
 
 	  case RE_EOF:
-	    if (reglnum != reg_maxline || c != NUL)
+	    if (rex->lnum != rex->reg_maxline || c != NUL)
 		status = RA_NOMATCH;
 	    break;
 
 	  case CURSOR:
 	    /* Check if the buffer is in a window and compare the
 	     * reg_win->w_cursor position to the match position. */
-	    if (reg_win == NULL
-		    || (reglnum + reg_firstlnum != reg_win->w_cursor.lnum)
-		    || ((colnr_T)(reginput - regline) != reg_win->w_cursor.col))
+	    if (rex->reg_win == NULL
+		    || (rex->lnum + rex->reg_firstlnum != rex->reg_win->w_cursor.lnum)
+		    || ((colnr_T)(rex->input - rex->line) != rex->reg_win->w_cursor.col))
 		status = RA_NOMATCH;
 	    break;
 
@@ -4423,16 +4536,16 @@ regmatch(scan)
 		int	cmp = OPERAND(scan)[1];
 		pos_T	*pos;
 
-		pos = getmark_buf(reg_buf, mark, FALSE);
+		pos = getmark_buf(rex->reg_buf, mark, FALSE);
 		if (pos == NULL		     /* mark doesn't exist */
 			|| pos->lnum <= 0    /* mark isn't set in reg_buf */
-			|| (pos->lnum == reglnum + reg_firstlnum
-				? (pos->col == (colnr_T)(reginput - regline)
+			|| (pos->lnum == rex->lnum + rex->reg_firstlnum
+				? (pos->col == (colnr_T)(rex->input - rex->line)
 				    ? (cmp == '<' || cmp == '>')
-				    : (pos->col < (colnr_T)(reginput - regline)
+				    : (pos->col < (colnr_T)(rex->input - rex->line)
 					? cmp != '>'
 					: cmp != '<'))
-				: (pos->lnum < reglnum + reg_firstlnum
+				: (pos->lnum < rex->lnum + rex->reg_firstlnum
 				    ? cmp != '>'
 				    : cmp != '<')))
 		    status = RA_NOMATCH;
@@ -4441,26 +4554,26 @@ regmatch(scan)
 
 	  case RE_VISUAL:
 #ifdef FEAT_VISUAL
-	    if (!reg_match_visual())
+	    if (!reg_match_visual(rex))
 #endif
 		status = RA_NOMATCH;
 	    break;
 
 	  case RE_LNUM:
-	    if (!REG_MULTI || !re_num_cmp((long_u)(reglnum + reg_firstlnum),
+	    if (!REG_MULTI || !re_num_cmp((long_u)(rex->lnum + rex->reg_firstlnum),
 									scan))
 		status = RA_NOMATCH;
 	    break;
 
 	  case RE_COL:
-	    if (!re_num_cmp((long_u)(reginput - regline) + 1, scan))
+	    if (!re_num_cmp((long_u)(rex->input - rex->line) + 1, scan))
 		status = RA_NOMATCH;
 	    break;
 
 	  case RE_VCOL:
 	    if (!re_num_cmp((long_u)win_linetabsize(
-			    reg_win == NULL ? curwin : reg_win,
-			    regline, (colnr_T)(reginput - regline)) + 1, scan))
+			    rex->reg_win == NULL ? curwin : rex->reg_win,
+			    rex->line, (colnr_T)(rex->input - rex->line)) + 1, scan))
 		status = RA_NOMATCH;
 	    break;
 
@@ -4473,23 +4586,23 @@ regmatch(scan)
 		int this_class;
 
 		/* Get class of current and previous char (if it exists). */
-		this_class = mb_get_class_buf(reginput, reg_buf);
+		this_class = mb_get_class_buf(rex->input, rex->reg_buf);
 		if (this_class <= 1)
 		    status = RA_NOMATCH;  /* not on a word at all */
-		else if (reg_prev_class() == this_class)
+		else if (reg_prev_class(rex) == this_class)
 		    status = RA_NOMATCH;  /* previous char is in same word */
 	    }
 #endif
 	    else
 	    {
-		if (!vim_iswordc_buf(c, reg_buf) || (reginput > regline
-				   && vim_iswordc_buf(reginput[-1], reg_buf)))
+		if (!vim_iswordc_buf(c, rex->reg_buf) || (rex->input > rex->line
+				   && vim_iswordc_buf(rex->input[-1], rex->reg_buf)))
 		    status = RA_NOMATCH;
 	    }
 	    break;
 
 	  case EOW:	/* word\>; reginput points after d */
-	    if (reginput == regline)    /* Can't match at start of line */
+	    if (rex->input == rex->line)    /* Can't match at start of line */
 		status = RA_NOMATCH;
 #ifdef FEAT_MBYTE
 	    else if (has_mbyte)
@@ -4497,8 +4610,8 @@ regmatch(scan)
 		int this_class, prev_class;
 
 		/* Get class of current and previous char (if it exists). */
-		this_class = mb_get_class_buf(reginput, reg_buf);
-		prev_class = reg_prev_class();
+		this_class = mb_get_class_buf(rex->input, rex->reg_buf);
+		prev_class = reg_prev_class(rex);
 		if (this_class == prev_class
 			|| prev_class == 0 || prev_class == 1)
 		    status = RA_NOMATCH;
@@ -4506,8 +4619,8 @@ regmatch(scan)
 #endif
 	    else
 	    {
-		if (!vim_iswordc_buf(reginput[-1], reg_buf)
-			|| (reginput[0] != NUL && vim_iswordc_buf(c, reg_buf)))
+		if (!vim_iswordc_buf(rex->input[-1], rex->reg_buf)
+			|| (rex->input[0] != NUL && vim_iswordc_buf(c, rex->reg_buf)))
 		    status = RA_NOMATCH;
 	    }
 	    break; /* Matched with EOW */
@@ -4528,21 +4641,21 @@ regmatch(scan)
 	    break;
 
 	  case SIDENT:
-	    if (VIM_ISDIGIT(*reginput) || !vim_isIDc(c))
+	    if (VIM_ISDIGIT(*rex->input) || !vim_isIDc(c))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
 	    break;
 
 	  case KWORD:
-	    if (!vim_iswordp_buf(reginput, reg_buf))
+	    if (!vim_iswordp_buf(rex->input, rex->reg_buf))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
 	    break;
 
 	  case SKWORD:
-	    if (VIM_ISDIGIT(*reginput) || !vim_iswordp_buf(reginput, reg_buf))
+	    if (VIM_ISDIGIT(*rex->input) || !vim_iswordp_buf(rex->input, rex->reg_buf))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
@@ -4556,21 +4669,21 @@ regmatch(scan)
 	    break;
 
 	  case SFNAME:
-	    if (VIM_ISDIGIT(*reginput) || !vim_isfilec(c))
+	    if (VIM_ISDIGIT(*rex->input) || !vim_isfilec(c))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
 	    break;
 
 	  case PRINT:
-	    if (!vim_isprintc(PTR2CHAR(reginput)))
+	    if (!vim_isprintc(PTR2CHAR(rex->input)))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
 	    break;
 
 	  case SPRINT:
-	    if (VIM_ISDIGIT(*reginput) || !vim_isprintc(PTR2CHAR(reginput)))
+	    if (VIM_ISDIGIT(*rex->input) || !vim_isprintc(PTR2CHAR(rex->input)))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
@@ -4709,12 +4822,12 @@ regmatch(scan)
 
 		opnd = OPERAND(scan);
 		/* Inline the first byte, for speed. */
-		if (*opnd != *reginput
-			&& (!ireg_ic || (
+		if (*opnd != *rex->input
+			&& (!rex->reg_ic || (
 #ifdef FEAT_MBYTE
 			    !enc_utf8 &&
 #endif
-			    MB_TOLOWER(*opnd) != MB_TOLOWER(*reginput))))
+			    MB_TOLOWER(*opnd) != MB_TOLOWER(*rex->input))))
 		    status = RA_NOMATCH;
 		else if (*opnd == NUL)
 		{
@@ -4723,30 +4836,30 @@ regmatch(scan)
 		}
 		else if (opnd[1] == NUL
 #ifdef FEAT_MBYTE
-			    && !(enc_utf8 && ireg_ic)
+			    && !(enc_utf8 && rex->reg_ic)
 #endif
 			)
-		    ++reginput;		/* matched a single char */
+		    ++rex->input;		/* matched a single char */
 		else
 		{
 		    len = (int)STRLEN(opnd);
 		    /* Need to match first byte again for multi-byte. */
-		    if (cstrncmp(opnd, reginput, &len) != 0)
+		    if (cstrncmp(rex, opnd, rex->input, &len) != 0)
 			status = RA_NOMATCH;
 #ifdef FEAT_MBYTE
 		    /* Check for following composing character. */
 		    else if (enc_utf8
-			       && UTF_COMPOSINGLIKE(reginput, reginput + len))
+			       && UTF_COMPOSINGLIKE(rex->input, rex->input + len))
 		    {
 			/* raaron: This code makes a composing character get
 			 * ignored, which is the correct behavior (sometimes)
 			 * for voweled Hebrew texts. */
-			if (!ireg_icombine)
+			if (!rex->reg_icombine)
 			    status = RA_NOMATCH;
 		    }
 #endif
 		    else
-			reginput += len;
+			rex->input += len;
 		}
 	    }
 	    break;
@@ -4755,7 +4868,7 @@ regmatch(scan)
 	  case ANYBUT:
 	    if (c == NUL)
 		status = RA_NOMATCH;
-	    else if ((cstrchr(OPERAND(scan), c) == NULL) == (op == ANYOF))
+	    else if ((cstrchr(rex, OPERAND(scan), c) == NULL) == (op == ANYOF))
 		status = RA_NOMATCH;
 	    else
 		ADVANCE_REGINPUT();
@@ -4784,9 +4897,9 @@ regmatch(scan)
 		    /* When only a composing char is given match at any
 		     * position where that composing char appears. */
 		    status = RA_NOMATCH;
-		    for (i = 0; reginput[i] != NUL; i += utf_char2len(inpc))
+		    for (i = 0; rex->input[i] != NUL; i += utf_char2len(inpc))
 		    {
-			inpc = mb_ptr2char(reginput + i);
+			inpc = mb_ptr2char(rex->input + i);
 			if (!utf_iscomposing(inpc))
 			{
 			    if (i > 0)
@@ -4795,7 +4908,7 @@ regmatch(scan)
 			else if (opndc == inpc)
 			{
 			    /* Include all following composing chars. */
-			    len = i + mb_ptr2len(reginput + i);
+			    len = i + mb_ptr2len(rex->input + i);
 			    status = RA_MATCH;
 			    break;
 			}
@@ -4803,12 +4916,12 @@ regmatch(scan)
 		}
 		else
 		    for (i = 0; i < len; ++i)
-			if (opnd[i] != reginput[i])
+			if (opnd[i] != rex->input[i])
 			{
 			    status = RA_NOMATCH;
 			    break;
 			}
-		reginput += len;
+		rex->input += len;
 	    }
 	    else
 		status = RA_NOMATCH;
@@ -4831,29 +4944,29 @@ regmatch(scan)
 		 * The positions are stored in "backpos" and found by the
 		 * current value of "scan", the position in the RE program.
 		 */
-		bp = (backpos_T *)backpos.ga_data;
-		for (i = 0; i < backpos.ga_len; ++i)
+		bp = (backpos_T *)rex->backpos.ga_data;
+		for (i = 0; i < rex->backpos.ga_len; ++i)
 		    if (bp[i].bp_scan == scan)
 			break;
-		if (i == backpos.ga_len)
+		if (i == rex->backpos.ga_len)
 		{
 		    /* First time at this BACK, make room to store the pos. */
-		    if (ga_grow(&backpos, 1) == FAIL)
+		    if (reg_grow(rex, &rex->backpos, 1) == FAIL)
 			status = RA_FAIL;
 		    else
 		    {
 			/* get "ga_data" again, it may have changed */
-			bp = (backpos_T *)backpos.ga_data;
+			bp = (backpos_T *)rex->backpos.ga_data;
 			bp[i].bp_scan = scan;
-			++backpos.ga_len;
+			++rex->backpos.ga_len;
 		    }
 		}
-		else if (reg_save_equal(&bp[i].bp_pos))
+		else if (reg_save_equal(rex, &bp[i].bp_pos))
 		    /* Still at same position as last time, fail. */
 		    status = RA_NOMATCH;
 
 		if (status != RA_FAIL && status != RA_NOMATCH)
-		    reg_save(&bp[i].bp_pos, &backpos);
+		    reg_save(rex, &bp[i].bp_pos, &rex->backpos);
 	    }
 	    break;
 
@@ -4869,15 +4982,15 @@ regmatch(scan)
 	  case MOPEN + 9:
 	    {
 		no = op - MOPEN;
-		cleanup_subexpr();
-		rp = regstack_push(RS_MOPEN, scan);
+		cleanup_subexpr(rex);
+		rp = regstack_push(rex, RS_MOPEN, scan);
 		if (rp == NULL)
 		    status = RA_FAIL;
 		else
 		{
 		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_startpos[no],
-							     &reg_startp[no]);
+		    save_se(&rp->rs_un.sesave, &rex->reg_startpos[no],
+							     &rex->reg_startp[no]);
 		    /* We simply continue and handle the result when done. */
 		}
 	    }
@@ -4885,7 +4998,7 @@ regmatch(scan)
 
 	  case NOPEN:	    /* \%( */
 	  case NCLOSE:	    /* \) after \%( */
-		if (regstack_push(RS_NOPEN, scan) == NULL)
+		if (regstack_push(rex, RS_NOPEN, scan) == NULL)
 		    status = RA_FAIL;
 		/* We simply continue and handle the result when done. */
 		break;
@@ -4902,15 +5015,15 @@ regmatch(scan)
 	  case ZOPEN + 9:
 	    {
 		no = op - ZOPEN;
-		cleanup_zsubexpr();
-		rp = regstack_push(RS_ZOPEN, scan);
+		cleanup_zsubexpr(rex);
+		rp = regstack_push(rex, RS_ZOPEN, scan);
 		if (rp == NULL)
 		    status = RA_FAIL;
 		else
 		{
 		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_startzpos[no],
-							     &reg_startzp[no]);
+		    save_se(&rp->rs_un.sesave, &rex->reg_startzpos[no],
+							     &rex->reg_startzp[no]);
 		    /* We simply continue and handle the result when done. */
 		}
 	    }
@@ -4929,14 +5042,14 @@ regmatch(scan)
 	  case MCLOSE + 9:
 	    {
 		no = op - MCLOSE;
-		cleanup_subexpr();
-		rp = regstack_push(RS_MCLOSE, scan);
+		cleanup_subexpr(rex);
+		rp = regstack_push(rex, RS_MCLOSE, scan);
 		if (rp == NULL)
 		    status = RA_FAIL;
 		else
 		{
 		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_endpos[no], &reg_endp[no]);
+		    save_se(&rp->rs_un.sesave, &rex->reg_endpos[no], &rex->reg_endp[no]);
 		    /* We simply continue and handle the result when done. */
 		}
 	    }
@@ -4954,15 +5067,15 @@ regmatch(scan)
 	  case ZCLOSE + 9:
 	    {
 		no = op - ZCLOSE;
-		cleanup_zsubexpr();
-		rp = regstack_push(RS_ZCLOSE, scan);
+		cleanup_zsubexpr(rex);
+		rp = regstack_push(rex, RS_ZCLOSE, scan);
 		if (rp == NULL)
 		    status = RA_FAIL;
 		else
 		{
 		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_endzpos[no],
-							      &reg_endzp[no]);
+		    save_se(&rp->rs_un.sesave, &rex->reg_endzpos[no],
+							      &rex->reg_endzp[no]);
 		    /* We simply continue and handle the result when done. */
 		}
 	    }
@@ -4982,10 +5095,10 @@ regmatch(scan)
 		int		len;
 
 		no = op - BACKREF;
-		cleanup_subexpr();
+		cleanup_subexpr(rex);
 		if (!REG_MULTI)		/* Single-line regexp */
 		{
-		    if (reg_startp[no] == NULL || reg_endp[no] == NULL)
+		    if (rex->reg_startp[no] == NULL || rex->reg_endp[no] == NULL)
 		    {
 			/* Backref was not set: Match an empty string. */
 			len = 0;
@@ -4994,38 +5107,38 @@ regmatch(scan)
 		    {
 			/* Compare current input with back-ref in the same
 			 * line. */
-			len = (int)(reg_endp[no] - reg_startp[no]);
-			if (cstrncmp(reg_startp[no], reginput, &len) != 0)
+			len = (int)(rex->reg_endp[no] - rex->reg_startp[no]);
+			if (cstrncmp(rex, rex->reg_startp[no], rex->input, &len) != 0)
 			    status = RA_NOMATCH;
 		    }
 		}
 		else				/* Multi-line regexp */
 		{
-		    if (reg_startpos[no].lnum < 0 || reg_endpos[no].lnum < 0)
+		    if (rex->reg_startpos[no].lnum < 0 || rex->reg_endpos[no].lnum < 0)
 		    {
 			/* Backref was not set: Match an empty string. */
 			len = 0;
 		    }
 		    else
 		    {
-			if (reg_startpos[no].lnum == reglnum
-				&& reg_endpos[no].lnum == reglnum)
+			if (rex->reg_startpos[no].lnum == rex->lnum
+				&& rex->reg_endpos[no].lnum == rex->lnum)
 			{
 			    /* Compare back-ref within the current line. */
-			    len = reg_endpos[no].col - reg_startpos[no].col;
-			    if (cstrncmp(regline + reg_startpos[no].col,
-							  reginput, &len) != 0)
+			    len = rex->reg_endpos[no].col - rex->reg_startpos[no].col;
+			    if (cstrncmp(rex, rex->line + rex->reg_startpos[no].col,
+							  rex->input, &len) != 0)
 				status = RA_NOMATCH;
 			}
 			else
 			{
 			    /* Messy situation: Need to compare between two
 			     * lines. */
-			    int r = match_with_backref(
-					    reg_startpos[no].lnum,
-					    reg_startpos[no].col,
-					    reg_endpos[no].lnum,
-					    reg_endpos[no].col,
+			    int r = match_with_backref(rex, 
+					    rex->reg_startpos[no].lnum,
+					    rex->reg_startpos[no].col,
+					    rex->reg_endpos[no].lnum,
+					    rex->reg_endpos[no].col,
 					    &len);
 
 			    if (r != RA_MATCH)
@@ -5035,7 +5148,7 @@ regmatch(scan)
 		}
 
 		/* Matched the backref, skip over it. */
-		reginput += len;
+		rex->input += len;
 	    }
 	    break;
 
@@ -5052,17 +5165,17 @@ regmatch(scan)
 	    {
 		int	len;
 
-		cleanup_zsubexpr();
+		cleanup_zsubexpr(rex);
 		no = op - ZREF;
 		if (re_extmatch_in != NULL
 			&& re_extmatch_in->matches[no] != NULL)
 		{
 		    len = (int)STRLEN(re_extmatch_in->matches[no]);
-		    if (cstrncmp(re_extmatch_in->matches[no],
-							  reginput, &len) != 0)
+		    if (cstrncmp(rex, re_extmatch_in->matches[no],
+							  rex->input, &len) != 0)
 			status = RA_NOMATCH;
 		    else
-			reginput += len;
+			rex->input += len;
 		}
 		else
 		{
@@ -5078,7 +5191,7 @@ regmatch(scan)
 		    next = OPERAND(scan);	/* Avoid recursion. */
 		else
 		{
-		    rp = regstack_push(RS_BRANCH, scan);
+		    rp = regstack_push(rex, RS_BRANCH, scan);
 		    if (rp == NULL)
 			status = RA_FAIL;
 		    else
@@ -5091,8 +5204,8 @@ regmatch(scan)
 	    {
 		if (OP(next) == BRACE_SIMPLE)
 		{
-		    bl_minval = OPERAND_MIN(scan);
-		    bl_maxval = OPERAND_MAX(scan);
+		    rex->bl_minval = OPERAND_MIN(scan);
+		    rex->bl_maxval = OPERAND_MAX(scan);
 		}
 		else if (OP(next) >= BRACE_COMPLEX
 			&& OP(next) < BRACE_COMPLEX + 10)
@@ -5128,13 +5241,13 @@ regmatch(scan)
 		if (brace_count[no] <= (brace_min[no] <= brace_max[no]
 					     ? brace_min[no] : brace_max[no]))
 		{
-		    rp = regstack_push(RS_BRCPLX_MORE, scan);
+		    rp = regstack_push(rex, RS_BRCPLX_MORE, scan);
 		    if (rp == NULL)
 			status = RA_FAIL;
 		    else
 		    {
 			rp->rs_no = no;
-			reg_save(&rp->rs_un.regsave, &backpos);
+			reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 			next = OPERAND(scan);
 			/* We continue and handle the result when done. */
 		    }
@@ -5147,13 +5260,13 @@ regmatch(scan)
 		    /* Range is the normal way around, use longest match */
 		    if (brace_count[no] <= brace_max[no])
 		    {
-			rp = regstack_push(RS_BRCPLX_LONG, scan);
+			rp = regstack_push(rex, RS_BRCPLX_LONG, scan);
 			if (rp == NULL)
 			    status = RA_FAIL;
 			else
 			{
 			    rp->rs_no = no;
-			    reg_save(&rp->rs_un.regsave, &backpos);
+			    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 			    next = OPERAND(scan);
 			    /* We continue and handle the result when done. */
 			}
@@ -5164,12 +5277,12 @@ regmatch(scan)
 		    /* Range is backwards, use shortest match first */
 		    if (brace_count[no] <= brace_min[no])
 		    {
-			rp = regstack_push(RS_BRCPLX_SHORT, scan);
+			rp = regstack_push(rex, RS_BRCPLX_SHORT, scan);
 			if (rp == NULL)
 			    status = RA_FAIL;
 			else
 			{
-			    reg_save(&rp->rs_un.regsave, &backpos);
+			    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 			    /* We continue and handle the result when done. */
 			}
 		    }
@@ -5190,7 +5303,7 @@ regmatch(scan)
 		if (OP(next) == EXACTLY)
 		{
 		    rst.nextb = *OPERAND(next);
-		    if (ireg_ic)
+		    if (rex->reg_ic)
 		    {
 			if (MB_ISUPPER(rst.nextb))
 			    rst.nextb_ic = MB_TOLOWER(rst.nextb);
@@ -5212,8 +5325,8 @@ regmatch(scan)
 		}
 		else
 		{
-		    rst.minval = bl_minval;
-		    rst.maxval = bl_maxval;
+		    rst.minval = rex->bl_minval;
+		    rst.maxval = rex->bl_maxval;
 		}
 
 		/*
@@ -5222,7 +5335,7 @@ regmatch(scan)
 		 * minimal number (since the range is backwards, that's also
 		 * maxval!).
 		 */
-		rst.count = regrepeat(OPERAND(scan), rst.maxval);
+		rst.count = regrepeat(rex, OPERAND(scan), rst.maxval);
 		if (got_int)
 		{
 		    status = RA_FAIL;
@@ -5234,17 +5347,17 @@ regmatch(scan)
 		    /* It could match.  Prepare for trying to match what
 		     * follows.  The code is below.  Parameters are stored in
 		     * a regstar_T on the regstack. */
-		    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+		    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
 		    {
 			EMSG(_(e_maxmempat));
 			status = RA_FAIL;
 		    }
-		    else if (ga_grow(&regstack, sizeof(regstar_T)) == FAIL)
+		    else if (reg_grow(rex, &rex->regstack, sizeof(regstar_T)) == FAIL)
 			status = RA_FAIL;
 		    else
 		    {
-			regstack.ga_len += sizeof(regstar_T);
-			rp = regstack_push(rst.minval <= rst.maxval
+			rex->regstack.ga_len += sizeof(regstar_T);
+			rp = regstack_push(rex, rst.minval <= rst.maxval
 					? RS_STAR_LONG : RS_STAR_SHORT, scan);
 			if (rp == NULL)
 			    status = RA_FAIL;
@@ -5264,13 +5377,13 @@ regmatch(scan)
 	  case NOMATCH:
 	  case MATCH:
 	  case SUBPAT:
-	    rp = regstack_push(RS_NOMATCH, scan);
+	    rp = regstack_push(rex, RS_NOMATCH, scan);
 	    if (rp == NULL)
 		status = RA_FAIL;
 	    else
 	    {
 		rp->rs_no = op;
-		reg_save(&rp->rs_un.regsave, &backpos);
+		reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 		next = OPERAND(scan);
 		/* We continue and handle the result when done. */
 	    }
@@ -5279,27 +5392,27 @@ regmatch(scan)
 	  case BEHIND:
 	  case NOBEHIND:
 	    /* Need a bit of room to store extra positions. */
-	    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+	    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
 	    {
 		EMSG(_(e_maxmempat));
 		status = RA_FAIL;
 	    }
-	    else if (ga_grow(&regstack, sizeof(regbehind_T)) == FAIL)
+	    else if (reg_grow(rex, &rex->regstack, sizeof(regbehind_T)) == FAIL)
 		status = RA_FAIL;
 	    else
 	    {
-		regstack.ga_len += sizeof(regbehind_T);
-		rp = regstack_push(RS_BEHIND1, scan);
+		rex->regstack.ga_len += sizeof(regbehind_T);
+		rp = regstack_push(rex, RS_BEHIND1, scan);
 		if (rp == NULL)
 		    status = RA_FAIL;
 		else
 		{
 		    /* Need to save the subexpr to be able to restore them
 		     * when there is a match but we don't use it. */
-		    save_subexpr(((regbehind_T *)rp) - 1);
+		    save_subexpr(rex, ((regbehind_T *)rp) - 1);
 
 		    rp->rs_no = op;
-		    reg_save(&rp->rs_un.regsave, &backpos);
+		    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 		    /* First try if what follows matches.  If it does then we
 		     * check the behind match by looping. */
 		}
@@ -5309,22 +5422,22 @@ regmatch(scan)
 	  case BHPOS:
 	    if (REG_MULTI)
 	    {
-		if (behind_pos.rs_u.pos.col != (colnr_T)(reginput - regline)
-			|| behind_pos.rs_u.pos.lnum != reglnum)
+		if (rex->behind_pos.rs_u.pos.col != (colnr_T)(rex->input - rex->line)
+			|| rex->behind_pos.rs_u.pos.lnum != rex->lnum)
 		    status = RA_NOMATCH;
 	    }
-	    else if (behind_pos.rs_u.ptr != reginput)
+	    else if (rex->behind_pos.rs_u.ptr != rex->input)
 		status = RA_NOMATCH;
 	    break;
 
 	  case NEWL:
-	    if ((c != NUL || !REG_MULTI || reglnum > reg_maxline
-			     || reg_line_lbr) && (c != '\n' || !reg_line_lbr))
+	    if ((c != NUL || !REG_MULTI || rex->lnum > rex->reg_maxline
+			     || rex->reg_line_lbr) && (c != '\n' || !rex->reg_line_lbr))
 		status = RA_NOMATCH;
-	    else if (reg_line_lbr)
+	    else if (rex->reg_line_lbr)
 		ADVANCE_REGINPUT();
 	    else
-		reg_nextline();
+		reg_nextline(rex);
 	    break;
 
 	  case END:
@@ -5354,75 +5467,75 @@ regmatch(scan)
      * If there is something on the regstack execute the code for the state.
      * If the state is popped then loop and use the older state.
      */
-    while (regstack.ga_len > 0 && status != RA_FAIL)
+    while (rex->regstack.ga_len > 0 && status != RA_FAIL)
     {
-	rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
+	rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1;
 	switch (rp->rs_state)
 	{
 	  case RS_NOPEN:
 	    /* Result is passed on as-is, simply pop the state. */
-	    regstack_pop(&scan);
+	    regstack_pop(rex, &scan);
 	    break;
 
 	  case RS_MOPEN:
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_startpos[rp->rs_no],
-						  &reg_startp[rp->rs_no]);
-	    regstack_pop(&scan);
+		restore_se(&rp->rs_un.sesave, &rex->reg_startpos[rp->rs_no],
+						  &rex->reg_startp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 
 #ifdef FEAT_SYN_HL
 	  case RS_ZOPEN:
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_startzpos[rp->rs_no],
-						 &reg_startzp[rp->rs_no]);
-	    regstack_pop(&scan);
+		restore_se(&rp->rs_un.sesave, &rex->reg_startzpos[rp->rs_no],
+						 &rex->reg_startzp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 #endif
 
 	  case RS_MCLOSE:
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_endpos[rp->rs_no],
-						    &reg_endp[rp->rs_no]);
-	    regstack_pop(&scan);
+		restore_se(&rp->rs_un.sesave, &rex->reg_endpos[rp->rs_no],
+						    &rex->reg_endp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 
 #ifdef FEAT_SYN_HL
 	  case RS_ZCLOSE:
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_endzpos[rp->rs_no],
-						   &reg_endzp[rp->rs_no]);
-	    regstack_pop(&scan);
+		restore_se(&rp->rs_un.sesave, &rex->reg_endzpos[rp->rs_no],
+						   &rex->reg_endzp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 #endif
 
 	  case RS_BRANCH:
 	    if (status == RA_MATCH)
 		/* this branch matched, use it */
-		regstack_pop(&scan);
+		regstack_pop(rex, &scan);
 	    else
 	    {
 		if (status != RA_BREAK)
 		{
 		    /* After a non-matching branch: try next one. */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 		    scan = rp->rs_scan;
 		}
 		if (scan == NULL || OP(scan) != BRANCH)
 		{
 		    /* no more branches, didn't find a match */
 		    status = RA_NOMATCH;
-		    regstack_pop(&scan);
+		    regstack_pop(rex, &scan);
 		}
 		else
 		{
 		    /* Prepare to try a branch. */
 		    rp->rs_scan = regnext(scan);
-		    reg_save(&rp->rs_un.regsave, &backpos);
+		    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 		    scan = OPERAND(scan);
 		}
 	    }
@@ -5432,10 +5545,10 @@ regmatch(scan)
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
 	    {
-		reg_restore(&rp->rs_un.regsave, &backpos);
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 		--brace_count[rp->rs_no];	/* decrement match count */
 	    }
-	    regstack_pop(&scan);
+	    regstack_pop(rex, &scan);
 	    break;
 
 	  case RS_BRCPLX_LONG:
@@ -5443,12 +5556,12 @@ regmatch(scan)
 	    if (status == RA_NOMATCH)
 	    {
 		/* There was no match, but we did find enough matches. */
-		reg_restore(&rp->rs_un.regsave, &backpos);
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 		--brace_count[rp->rs_no];
 		/* continue with the items after "\{}" */
 		status = RA_CONT;
 	    }
-	    regstack_pop(&scan);
+	    regstack_pop(rex, &scan);
 	    if (status == RA_CONT)
 		scan = regnext(scan);
 	    break;
@@ -5457,8 +5570,8 @@ regmatch(scan)
 	    /* Pop the state.  Restore pointers when there is no match. */
 	    if (status == RA_NOMATCH)
 		/* There was no match, try to match one more item. */
-		reg_restore(&rp->rs_un.regsave, &backpos);
-	    regstack_pop(&scan);
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+	    regstack_pop(rex, &scan);
 	    if (status == RA_NOMATCH)
 	    {
 		scan = OPERAND(scan);
@@ -5476,9 +5589,9 @@ regmatch(scan)
 	    {
 		status = RA_CONT;
 		if (rp->rs_no != SUBPAT)	/* zero-width */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 	    }
-	    regstack_pop(&scan);
+	    regstack_pop(rex, &scan);
 	    if (status == RA_CONT)
 		scan = regnext(scan);
 	    break;
@@ -5486,8 +5599,8 @@ regmatch(scan)
 	  case RS_BEHIND1:
 	    if (status == RA_NOMATCH)
 	    {
-		regstack_pop(&scan);
-		regstack.ga_len -= sizeof(regbehind_T);
+		regstack_pop(rex, &scan);
+		rex->regstack.ga_len -= sizeof(regbehind_T);
 	    }
 	    else
 	    {
@@ -5498,7 +5611,7 @@ regmatch(scan)
 		 * the current position. */
 
 		/* save the position after the found match for next */
-		reg_save(&(((regbehind_T *)rp) - 1)->save_after, &backpos);
+		reg_save(rex, &(((regbehind_T *)rp) - 1)->save_after, &rex->backpos);
 
 		/* Start looking for a match with operand at the current
 		 * position.  Go back one character until we find the
@@ -5506,12 +5619,12 @@ regmatch(scan)
 		 * line (for multi-line matching).
 		 * Set behind_pos to where the match should end, BHPOS
 		 * will match it.  Save the current value. */
-		(((regbehind_T *)rp) - 1)->save_behind = behind_pos;
-		behind_pos = rp->rs_un.regsave;
+		(((regbehind_T *)rp) - 1)->save_behind = rex->behind_pos;
+		rex->behind_pos = rp->rs_un.regsave;
 
 		rp->rs_state = RS_BEHIND2;
 
-		reg_restore(&rp->rs_un.regsave, &backpos);
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 		scan = OPERAND(rp->rs_scan) + 4;
 	    }
 	    break;
@@ -5520,23 +5633,23 @@ regmatch(scan)
 	    /*
 	     * Looping for BEHIND / NOBEHIND match.
 	     */
-	    if (status == RA_MATCH && reg_save_equal(&behind_pos))
+	    if (status == RA_MATCH && reg_save_equal(rex, &rex->behind_pos))
 	    {
 		/* found a match that ends where "next" started */
-		behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+		rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
 		if (rp->rs_no == BEHIND)
-		    reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-								    &backpos);
+		    reg_restore(rex, &(((regbehind_T *)rp) - 1)->save_after,
+								    &rex->backpos);
 		else
 		{
 		    /* But we didn't want a match.  Need to restore the
 		     * subexpr, because what follows matched, so they have
 		     * been set. */
 		    status = RA_NOMATCH;
-		    restore_subexpr(((regbehind_T *)rp) - 1);
+		    restore_subexpr(rex, ((regbehind_T *)rp) - 1);
 		}
-		regstack_pop(&scan);
-		regstack.ga_len -= sizeof(regbehind_T);
+		regstack_pop(rex, &scan);
+		rex->regstack.ga_len -= sizeof(regbehind_T);
 	    }
 	    else
 	    {
@@ -5550,24 +5663,24 @@ regmatch(scan)
 		{
 		    if (limit > 0
 			    && ((rp->rs_un.regsave.rs_u.pos.lnum
-						    < behind_pos.rs_u.pos.lnum
-				    ? (colnr_T)STRLEN(regline)
-				    : behind_pos.rs_u.pos.col)
+						    < rex->behind_pos.rs_u.pos.lnum
+				    ? (colnr_T)STRLEN(rex->line)
+				    : rex->behind_pos.rs_u.pos.col)
 				- rp->rs_un.regsave.rs_u.pos.col >= limit))
 			no = FAIL;
 		    else if (rp->rs_un.regsave.rs_u.pos.col == 0)
 		    {
 			if (rp->rs_un.regsave.rs_u.pos.lnum
-					< behind_pos.rs_u.pos.lnum
-				|| reg_getline(
+					< rex->behind_pos.rs_u.pos.lnum
+				|| reg_getline(rex, 
 					--rp->rs_un.regsave.rs_u.pos.lnum)
 								  == NULL)
 			    no = FAIL;
 			else
 			{
-			    reg_restore(&rp->rs_un.regsave, &backpos);
+			    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 			    rp->rs_un.regsave.rs_u.pos.col =
-						 (colnr_T)STRLEN(regline);
+						 (colnr_T)STRLEN(rex->line);
 			}
 		    }
 		    else
@@ -5575,7 +5688,7 @@ regmatch(scan)
 #ifdef FEAT_MBYTE
 			if (has_mbyte)
 			    rp->rs_un.regsave.rs_u.pos.col -=
-				(*mb_head_off)(regline, regline
+				(*mb_head_off)(rex->line, rex->line
 				    + rp->rs_un.regsave.rs_u.pos.col - 1) + 1;
 			else
 #endif
@@ -5584,12 +5697,12 @@ regmatch(scan)
 		}
 		else
 		{
-		    if (rp->rs_un.regsave.rs_u.ptr == regline)
+		    if (rp->rs_un.regsave.rs_u.ptr == rex->line)
 			no = FAIL;
 		    else
 		    {
-			mb_ptr_back(regline, rp->rs_un.regsave.rs_u.ptr);
-			if (limit > 0 && (long)(behind_pos.rs_u.ptr
+			mb_ptr_back(rex->line, rp->rs_un.regsave.rs_u.ptr);
+			if (limit > 0 && (long)(rex->behind_pos.rs_u.ptr
 				     - rp->rs_un.regsave.rs_u.ptr) > limit)
 			    no = FAIL;
 		    }
@@ -5597,24 +5710,24 @@ regmatch(scan)
 		if (no == OK)
 		{
 		    /* Advanced, prepare for finding match again. */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 		    scan = OPERAND(rp->rs_scan) + 4;
 		    if (status == RA_MATCH)
 		    {
 			/* We did match, so subexpr may have been changed,
 			 * need to restore them for the next try. */
 			status = RA_NOMATCH;
-			restore_subexpr(((regbehind_T *)rp) - 1);
+			restore_subexpr(rex, ((regbehind_T *)rp) - 1);
 		    }
 		}
 		else
 		{
 		    /* Can't advance.  For NOBEHIND that's a match. */
-		    behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+		    rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
 		    if (rp->rs_no == NOBEHIND)
 		    {
-			reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-								    &backpos);
+			reg_restore(rex, &(((regbehind_T *)rp) - 1)->save_after,
+								    &rex->backpos);
 			status = RA_MATCH;
 		    }
 		    else
@@ -5625,11 +5738,11 @@ regmatch(scan)
 			if (status == RA_MATCH)
 			{
 			    status = RA_NOMATCH;
-			    restore_subexpr(((regbehind_T *)rp) - 1);
+			    restore_subexpr(rex, ((regbehind_T *)rp) - 1);
 			}
 		    }
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regbehind_T);
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regbehind_T);
 		}
 	    }
 	    break;
@@ -5641,14 +5754,14 @@ regmatch(scan)
 
 		if (status == RA_MATCH)
 		{
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regstar_T);
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regstar_T);
 		    break;
 		}
 
 		/* Tried once already, restore input pointers. */
 		if (status != RA_BREAK)
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
 
 		/* Repeat until we found a position where it could match. */
 		for (;;)
@@ -5662,20 +5775,20 @@ regmatch(scan)
 			     * didn't match -- back up one char. */
 			    if (--rst->count < rst->minval)
 				break;
-			    if (reginput == regline)
+			    if (rex->input == rex->line)
 			    {
 				/* backup to last char of previous line */
-				--reglnum;
-				regline = reg_getline(reglnum);
+				--rex->lnum;
+				rex->line = reg_getline(rex, rex->lnum);
 				/* Just in case regrepeat() didn't count
 				 * right. */
-				if (regline == NULL)
+				if (rex->line == NULL)
 				    break;
-				reginput = regline + STRLEN(regline);
+				rex->input = rex->line + STRLEN(rex->line);
 				fast_breakcheck();
 			    }
 			    else
-				mb_ptr_back(regline, reginput);
+				mb_ptr_back(rex->line, rex->input);
 			}
 			else
 			{
@@ -5684,7 +5797,7 @@ regmatch(scan)
 			     * Couldn't or didn't match: try advancing one
 			     * char. */
 			    if (rst->count == rst->minval
-				  || regrepeat(OPERAND(rp->rs_scan), 1L) == 0)
+				  || regrepeat(rex, OPERAND(rp->rs_scan), 1L) == 0)
 				break;
 			    ++rst->count;
 			}
@@ -5695,10 +5808,10 @@ regmatch(scan)
 			status = RA_NOMATCH;
 
 		    /* If it could match, try it. */
-		    if (rst->nextb == NUL || *reginput == rst->nextb
-					     || *reginput == rst->nextb_ic)
+		    if (rst->nextb == NUL || *rex->input == rst->nextb
+					     || *rex->input == rst->nextb_ic)
 		    {
-			reg_save(&rp->rs_un.regsave, &backpos);
+			reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
 			scan = regnext(rp->rs_scan);
 			status = RA_CONT;
 			break;
@@ -5707,8 +5820,8 @@ regmatch(scan)
 		if (status != RA_CONT)
 		{
 		    /* Failed. */
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regstar_T);
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regstar_T);
 		    status = RA_NOMATCH;
 		}
 	    }
@@ -5718,7 +5831,7 @@ regmatch(scan)
 	/* If we want to continue the inner loop or didn't pop a state
 	 * continue matching loop */
 	if (status == RA_CONT || rp == (regitem_T *)
-			     ((char *)regstack.ga_data + regstack.ga_len) - 1)
+			     ((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1)
 	    break;
     }
 
@@ -5729,7 +5842,7 @@ regmatch(scan)
     /*
      * If the regstack is empty or something failed we are done.
      */
-    if (regstack.ga_len == 0 || status == RA_FAIL)
+    if (rex->regstack.ga_len == 0 || status == RA_FAIL)
     {
 	if (scan == NULL)
 	{
@@ -5757,25 +5870,26 @@ regmatch(scan)
  * Returns pointer to new item.  Returns NULL when out of memory.
  */
     static regitem_T *
-regstack_push(state, scan)
+regstack_push(rex, state, scan)
+    regexec_T	*rex;
     regstate_T	state;
     char_u	*scan;
 {
     regitem_T	*rp;
 
-    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
     {
 	EMSG(_(e_maxmempat));
 	return NULL;
     }
-    if (ga_grow(&regstack, sizeof(regitem_T)) == FAIL)
+    if (reg_grow(rex, &rex->regstack, sizeof(regitem_T)) == FAIL)
 	return NULL;
 
-    rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len);
+    rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len);
     rp->rs_state = state;
     rp->rs_scan = scan;
 
-    regstack.ga_len += sizeof(regitem_T);
+    rex->regstack.ga_len += sizeof(regitem_T);
     return rp;
 }
 
@@ -5783,15 +5897,16 @@ regstack_push(state, scan)
  * Pop an item from the regstack.
  */
     static void
-regstack_pop(scan)
+regstack_pop(rex, scan)
+    regexec_T	*rex;
     char_u	**scan;
 {
     regitem_T	*rp;
 
-    rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
+    rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len) - 1;
     *scan = rp->rs_scan;
 
-    regstack.ga_len -= sizeof(regitem_T);
+    rex->regstack.ga_len -= sizeof(regitem_T);
 }
 
 /*
@@ -5799,7 +5914,8 @@ regstack_pop(scan)
  * Advances reginput (and reglnum) to just after the matched chars.
  */
     static int
-regrepeat(p, maxcount)
+regrepeat(rex, p, maxcount)
+    regexec_T	*rex;
     char_u	*p;
     long	maxcount;   /* maximum number of matches allowed */
 {
@@ -5809,7 +5925,7 @@ regrepeat(p, maxcount)
     int		mask;
     int		testval = 0;
 
-    scan = reginput;	    /* Make local copy of reginput for speed. */
+    scan = rex->input;	    /* Make local copy of reginput for speed. */
     opnd = OPERAND(p);
     switch (OP(p))
     {
@@ -5824,12 +5940,12 @@ regrepeat(p, maxcount)
 		++count;
 		mb_ptr_adv(scan);
 	    }
-	    if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-					 || reg_line_lbr || count == maxcount)
+	    if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+					 || rex->reg_line_lbr || count == maxcount)
 		break;
 	    ++count;		/* count the line-break */
-	    reg_nextline();
-	    scan = reginput;
+	    reg_nextline(rex);
+	    scan = rex->input;
 	    if (got_int)
 		break;
 	}
@@ -5849,15 +5965,15 @@ regrepeat(p, maxcount)
 	    }
 	    else if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 	    else
 		break;
@@ -5873,22 +5989,22 @@ regrepeat(p, maxcount)
       case SKWORD + ADD_NL:
 	while (count < maxcount)
 	{
-	    if (vim_iswordp_buf(scan, reg_buf)
+	    if (vim_iswordp_buf(scan, rex->reg_buf)
 					  && (testval || !VIM_ISDIGIT(*scan)))
 	    {
 		mb_ptr_adv(scan);
 	    }
 	    else if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 	    else
 		break;
@@ -5910,15 +6026,15 @@ regrepeat(p, maxcount)
 	    }
 	    else if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 	    else
 		break;
@@ -5936,11 +6052,11 @@ regrepeat(p, maxcount)
 	{
 	    if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
@@ -5949,7 +6065,7 @@ regrepeat(p, maxcount)
 	    {
 		mb_ptr_adv(scan);
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 	    else
 		break;
@@ -5968,11 +6084,11 @@ do_class:
 #endif
 	    if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
@@ -5986,7 +6102,7 @@ do_class:
 #endif
 	    else if ((class_tab[*scan] & mask) == testval)
 		++scan;
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 	    else
 		break;
@@ -6070,7 +6186,7 @@ do_class:
 	    /* This doesn't do a multi-byte character, because a MULTIBYTECODE
 	     * would have been used for it.  It does handle single-byte
 	     * characters, such as latin1. */
-	    if (ireg_ic)
+	    if (rex->reg_ic)
 	    {
 		cu = MB_TOUPPER(*opnd);
 		cl = MB_TOLOWER(*opnd);
@@ -6101,14 +6217,14 @@ do_class:
 	     * compiling the program). */
 	    if ((len = (*mb_ptr2len)(opnd)) > 1)
 	    {
-		if (ireg_ic && enc_utf8)
+		if (rex->reg_ic && enc_utf8)
 		    cf = utf_fold(utf_ptr2char(opnd));
 		while (count < maxcount)
 		{
 		    for (i = 0; i < len; ++i)
 			if (opnd[i] != scan[i])
 			    break;
-		    if (i < len && (!ireg_ic || !enc_utf8
+		    if (i < len && (!rex->reg_ic || !enc_utf8
 					|| utf_fold(utf_ptr2char(scan)) != cf))
 			break;
 		    scan += len;
@@ -6133,27 +6249,27 @@ do_class:
 #endif
 	    if (*scan == NUL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		if (!REG_MULTI || !WITH_NL(OP(p)) || rex->lnum > rex->reg_maxline
+							      || rex->reg_line_lbr)
 		    break;
-		reg_nextline();
-		scan = reginput;
+		reg_nextline(rex);
+		scan = rex->input;
 		if (got_int)
 		    break;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
 		++scan;
 #ifdef FEAT_MBYTE
 	    else if (has_mbyte && (len = (*mb_ptr2len)(scan)) > 1)
 	    {
-		if ((cstrchr(opnd, (*mb_ptr2char)(scan)) == NULL) == testval)
+		if ((cstrchr(rex, opnd, (*mb_ptr2char)(scan)) == NULL) == testval)
 		    break;
 		scan += len;
 	    }
 #endif
 	    else
 	    {
-		if ((cstrchr(opnd, *scan) == NULL) == testval)
+		if ((cstrchr(rex, opnd, *scan) == NULL) == testval)
 		    break;
 		++scan;
 	    }
@@ -6163,15 +6279,15 @@ do_class:
 
       case NEWL:
 	while (count < maxcount
-		&& ((*scan == NUL && reglnum <= reg_maxline && !reg_line_lbr
-			    && REG_MULTI) || (*scan == '\n' && reg_line_lbr)))
+		&& ((*scan == NUL && rex->lnum <= rex->reg_maxline && !rex->reg_line_lbr
+			    && REG_MULTI) || (*scan == '\n' && rex->reg_line_lbr)))
 	{
 	    count++;
-	    if (reg_line_lbr)
+	    if (rex->reg_line_lbr)
 		ADVANCE_REGINPUT();
 	    else
-		reg_nextline();
-	    scan = reginput;
+		reg_nextline(rex);
+	    scan = rex->input;
 	    if (got_int)
 		break;
 	}
@@ -6185,7 +6301,7 @@ do_class:
 	break;
     }
 
-    reginput = scan;
+    rex->input = scan;
 
     return (int)count;
 }
@@ -6219,11 +6335,12 @@ regnext(p)
  * Return TRUE if it's wrong.
  */
     static int
-prog_magic_wrong()
+prog_magic_wrong(rex)
+    regexec_T	*rex;
 {
     regprog_T	*prog;
 
-    prog = REG_MULTI ? reg_mmatch->regprog : reg_match->regprog;
+    prog = REG_MULTI ? rex->reg_mmatch->regprog : rex->reg_match->regprog;
     if (prog->engine == &nfa_regengine)
 	/* For NFA matcher we don't check the magic */
 	return FALSE;
@@ -6242,43 +6359,45 @@ prog_magic_wrong()
  * used (to increase speed).
  */
     static void
-cleanup_subexpr()
+cleanup_subexpr(rex)
+    regexec_T	*rex;
 {
-    if (need_clear_subexpr)
+    if (rex->need_clear_subexpr)
     {
 	if (REG_MULTI)
 	{
 	    /* Use 0xff to set lnum to -1 */
-	    vim_memset(reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
-	    vim_memset(reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
 	}
 	else
 	{
-	    vim_memset(reg_startp, 0, sizeof(char_u *) * NSUBEXP);
-	    vim_memset(reg_endp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_startp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_endp, 0, sizeof(char_u *) * NSUBEXP);
 	}
-	need_clear_subexpr = FALSE;
+	rex->need_clear_subexpr = FALSE;
     }
 }
 
 #ifdef FEAT_SYN_HL
     static void
-cleanup_zsubexpr()
+cleanup_zsubexpr(rex)
+    regexec_T	*rex;
 {
-    if (need_clear_zsubexpr)
+    if (rex->need_clear_zsubexpr)
     {
 	if (REG_MULTI)
 	{
 	    /* Use 0xff to set lnum to -1 */
-	    vim_memset(reg_startzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
-	    vim_memset(reg_endzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_startzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_endzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
 	}
 	else
 	{
-	    vim_memset(reg_startzp, 0, sizeof(char_u *) * NSUBEXP);
-	    vim_memset(reg_endzp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_startzp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_endzp, 0, sizeof(char_u *) * NSUBEXP);
 	}
-	need_clear_zsubexpr = FALSE;
+	rex->need_clear_zsubexpr = FALSE;
     }
 }
 #endif
@@ -6288,27 +6407,28 @@ cleanup_zsubexpr()
  * later by restore_subexpr().
  */
     static void
-save_subexpr(bp)
+save_subexpr(rex, bp)
+    regexec_T   *rex;
     regbehind_T *bp;
 {
     int i;
 
     /* When "need_clear_subexpr" is set we don't need to save the values, only
      * remember that this flag needs to be set again when restoring. */
-    bp->save_need_clear_subexpr = need_clear_subexpr;
-    if (!need_clear_subexpr)
+    bp->save_need_clear_subexpr = rex->need_clear_subexpr;
+    if (!rex->need_clear_subexpr)
     {
 	for (i = 0; i < NSUBEXP; ++i)
 	{
 	    if (REG_MULTI)
 	    {
-		bp->save_start[i].se_u.pos = reg_startpos[i];
-		bp->save_end[i].se_u.pos = reg_endpos[i];
+		bp->save_start[i].se_u.pos = rex->reg_startpos[i];
+		bp->save_end[i].se_u.pos = rex->reg_endpos[i];
 	    }
 	    else
 	    {
-		bp->save_start[i].se_u.ptr = reg_startp[i];
-		bp->save_end[i].se_u.ptr = reg_endp[i];
+		bp->save_start[i].se_u.ptr = rex->reg_startp[i];
+		bp->save_end[i].se_u.ptr = rex->reg_endp[i];
 	    }
 	}
     }
@@ -6318,26 +6438,27 @@ save_subexpr(bp)
  * Restore the subexpr from "bp".
  */
     static void
-restore_subexpr(bp)
+restore_subexpr(rex, bp)
+    regexec_T   *rex;
     regbehind_T *bp;
 {
     int i;
 
     /* Only need to restore saved values when they are not to be cleared. */
-    need_clear_subexpr = bp->save_need_clear_subexpr;
-    if (!need_clear_subexpr)
+    rex->need_clear_subexpr = bp->save_need_clear_subexpr;
+    if (!rex->need_clear_subexpr)
     {
 	for (i = 0; i < NSUBEXP; ++i)
 	{
 	    if (REG_MULTI)
 	    {
-		reg_startpos[i] = bp->save_start[i].se_u.pos;
-		reg_endpos[i] = bp->save_end[i].se_u.pos;
+		rex->reg_startpos[i] = bp->save_start[i].se_u.pos;
+		rex->reg_endpos[i] = bp->save_end[i].se_u.pos;
 	    }
 	    else
 	    {
-		reg_startp[i] = bp->save_start[i].se_u.ptr;
-		reg_endp[i] = bp->save_end[i].se_u.ptr;
+		rex->reg_startp[i] = bp->save_start[i].se_u.ptr;
+		rex->reg_endp[i] = bp->save_end[i].se_u.ptr;
 	    }
 	}
     }
@@ -6347,10 +6468,11 @@ restore_subexpr(bp)
  * Advance reglnum, regline and reginput to the next line.
  */
     static void
-reg_nextline()
+reg_nextline(rex)
+    regexec_T	*rex;
 {
-    regline = reg_getline(++reglnum);
-    reginput = regline;
+    rex->line = reg_getline(rex, ++rex->lnum);
+    rex->input = rex->line;
     fast_breakcheck();
 }
 
@@ -6358,17 +6480,18 @@ reg_nextline()
  * Save the input line and position in a regsave_T.
  */
     static void
-reg_save(save, gap)
+reg_save(rex, save, gap)
+    regexec_T	*rex;
     regsave_T	*save;
     garray_T	*gap;
 {
     if (REG_MULTI)
     {
-	save->rs_u.pos.col = (colnr_T)(reginput - regline);
-	save->rs_u.pos.lnum = reglnum;
+	save->rs_u.pos.col = (colnr_T)(rex->input - rex->line);
+	save->rs_u.pos.lnum = rex->lnum;
     }
     else
-	save->rs_u.ptr = reginput;
+	save->rs_u.ptr = rex->input;
     save->rs_len = gap->ga_len;
 }
 
@@ -6376,23 +6499,24 @@ reg_save(save, gap)
  * Restore the input line and position from a regsave_T.
  */
     static void
-reg_restore(save, gap)
+reg_restore(rex, save, gap)
+    regexec_T	*rex;
     regsave_T	*save;
     garray_T	*gap;
 {
     if (REG_MULTI)
     {
-	if (reglnum != save->rs_u.pos.lnum)
+	if (rex->lnum != save->rs_u.pos.lnum)
 	{
 	    /* only call reg_getline() when the line number changed to save
 	     * a bit of time */
-	    reglnum = save->rs_u.pos.lnum;
-	    regline = reg_getline(reglnum);
+	    rex->lnum = save->rs_u.pos.lnum;
+	    rex->line = reg_getline(rex, rex->lnum);
 	}
-	reginput = regline + save->rs_u.pos.col;
+	rex->input = rex->line + save->rs_u.pos.col;
     }
     else
-	reginput = save->rs_u.ptr;
+	rex->input = save->rs_u.ptr;
     gap->ga_len = save->rs_len;
 }
 
@@ -6400,13 +6524,14 @@ reg_restore(save, gap)
  * Return TRUE if current position is equal to saved position.
  */
     static int
-reg_save_equal(save)
+reg_save_equal(rex, save)
+    regexec_T	*rex;
     regsave_T	*save;
 {
     if (REG_MULTI)
-	return reglnum == save->rs_u.pos.lnum
-				  && reginput == regline + save->rs_u.pos.col;
-    return reginput == save->rs_u.ptr;
+	return rex->lnum == save->rs_u.pos.lnum
+				  && rex->input == rex->line + save->rs_u.pos.col;
+    return rex->input == save->rs_u.ptr;
 }
 
 /*
@@ -6417,22 +6542,24 @@ reg_save_equal(save)
  * depending on REG_MULTI.
  */
     static void
-save_se_multi(savep, posp)
+save_se_multi(rex, savep, posp)
+    regexec_T	*rex;
     save_se_T	*savep;
     lpos_T	*posp;
 {
     savep->se_u.pos = *posp;
-    posp->lnum = reglnum;
-    posp->col = (colnr_T)(reginput - regline);
+    posp->lnum = rex->lnum;
+    posp->col = (colnr_T)(rex->input - rex->line);
 }
 
     static void
-save_se_one(savep, pp)
+save_se_one(rex, savep, pp)
+    regexec_T	*rex;
     save_se_T	*savep;
     char_u	**pp;
 {
     savep->se_u.ptr = *pp;
-    *pp = reginput;
+    *pp = rex->input;
 }
 
 /*
@@ -6459,7 +6586,8 @@ re_num_cmp(val, scan)
  * last line.
  */
     static int
-match_with_backref(start_lnum, start_col, end_lnum, end_col, bytelen)
+match_with_backref(rex, start_lnum, start_col, end_lnum, end_col, bytelen)
+    regexec_T *rex;
     linenr_T start_lnum;
     colnr_T  start_col;
     linenr_T end_lnum;
@@ -6477,41 +6605,41 @@ match_with_backref(start_lnum, start_col, end_lnum, end_col, bytelen)
     {
 	/* Since getting one line may invalidate the other, need to make copy.
 	 * Slow! */
-	if (regline != reg_tofree)
+	if (rex->line != rex->reg_tofree)
 	{
-	    len = (int)STRLEN(regline);
-	    if (reg_tofree == NULL || len >= (int)reg_tofreelen)
+	    len = (int)STRLEN(rex->line);
+	    if (rex->reg_tofree == NULL || len >= (int)rex->reg_tofreelen)
 	    {
 		len += 50;	/* get some extra */
-		vim_free(reg_tofree);
-		reg_tofree = alloc(len);
-		if (reg_tofree == NULL)
+		vim_free(rex->reg_tofree);
+		rex->reg_tofree = alloc(len);
+		if (rex->reg_tofree == NULL)
 		    return RA_FAIL; /* out of memory!*/
-		reg_tofreelen = len;
+		rex->reg_tofreelen = len;
 	    }
-	    STRCPY(reg_tofree, regline);
-	    reginput = reg_tofree + (reginput - regline);
-	    regline = reg_tofree;
+	    STRCPY(rex->reg_tofree, rex->line);
+	    rex->input = rex->reg_tofree + (rex->input - rex->line);
+	    rex->line = rex->reg_tofree;
 	}
 
 	/* Get the line to compare with. */
-	p = reg_getline(clnum);
+	p = reg_getline(rex, clnum);
 	if (clnum == end_lnum)
 	    len = end_col - ccol;
 	else
 	    len = (int)STRLEN(p + ccol);
 
-	if (cstrncmp(p + ccol, reginput, &len) != 0)
+	if (cstrncmp(rex, p + ccol, rex->input, &len) != 0)
 	    return RA_NOMATCH;  /* doesn't match */
 	if (bytelen != NULL)
 	    *bytelen += len;
 	if (clnum == end_lnum)
 	    break;		/* match and at end! */
-	if (reglnum >= reg_maxline)
+	if (rex->lnum >= rex->reg_maxline)
 	    return RA_NOMATCH;  /* text too short */
 
 	/* Advance to next line. */
-	reg_nextline();
+	reg_nextline(rex);
 	if (bytelen != NULL)
 	    *bytelen = 0;
 	++clnum;
@@ -7085,25 +7213,26 @@ mb_decompose(c, c1, c2, c3)
 #endif
 
 /*
- * Compare two strings, ignore case if ireg_ic set.
+ * Compare two strings, ignore case if rex->reg_ic set.
  * Return 0 if strings match, non-zero otherwise.
  * Correct the length "*n" when composing characters are ignored.
  */
     static int
-cstrncmp(s1, s2, n)
+cstrncmp(rex, s1, s2, n)
+    regexec_T	*rex;
     char_u	*s1, *s2;
     int		*n;
 {
     int		result;
 
-    if (!ireg_ic)
+    if (!rex->reg_ic)
 	result = STRNCMP(s1, s2, *n);
     else
 	result = MB_STRNICMP(s1, s2, *n);
 
 #ifdef FEAT_MBYTE
     /* if it failed and it's utf8 and we want to combineignore: */
-    if (result != 0 && enc_utf8 && ireg_icombine)
+    if (result != 0 && enc_utf8 && rex->reg_icombine)
     {
 	char_u	*str1, *str2;
 	int	c1, c2, c11, c12;
@@ -7122,14 +7251,14 @@ cstrncmp(s1, s2, n)
 	    /* decompose the character if necessary, into 'base' characters
 	     * because I don't care about Arabic, I will hard-code the Hebrew
 	     * which I *do* care about!  So sue me... */
-	    if (c1 != c2 && (!ireg_ic || utf_fold(c1) != utf_fold(c2)))
+	    if (c1 != c2 && (!rex->reg_ic || utf_fold(c1) != utf_fold(c2)))
 	    {
 		/* decomposition necessary? */
 		mb_decompose(c1, &c11, &junk, &junk);
 		mb_decompose(c2, &c12, &junk, &junk);
 		c1 = c11;
 		c2 = c12;
-		if (c11 != c12 && (!ireg_ic || utf_fold(c11) != utf_fold(c12)))
+		if (c11 != c12 && (!rex->reg_ic || utf_fold(c11) != utf_fold(c12)))
 		    break;
 	    }
 	}
@@ -7146,14 +7275,15 @@ cstrncmp(s1, s2, n)
  * cstrchr: This function is used a lot for simple searches, keep it fast!
  */
     static char_u *
-cstrchr(s, c)
+cstrchr(rex, s, c)
+    regexec_T	*rex;
     char_u	*s;
     int		c;
 {
     char_u	*p;
     int		cc;
 
-    if (!ireg_ic
+    if (!rex->reg_ic
 #ifdef FEAT_MBYTE
 	    || (!enc_utf8 && mb_char2len(c) > 1)
 #endif
@@ -7222,7 +7352,7 @@ static fptr_T do_Upper __ARGS((int *, int));
 static fptr_T do_lower __ARGS((int *, int));
 static fptr_T do_Lower __ARGS((int *, int));
 
-static int vim_regsub_both __ARGS((char_u *source, char_u *dest, int copy, int magic, int backslash));
+static int vim_regsub_both __ARGS((regexec_T *rex, char_u *source, char_u *dest, int copy, int magic, int backslash));
 
     static fptr_T
 do_upper(d, c)
@@ -7342,14 +7472,10 @@ regtilde(source, magic)
 #ifdef FEAT_EVAL
 static int can_f_submatch = FALSE;	/* TRUE when submatch() can be used */
 
-/* These pointers are used instead of reg_match and reg_mmatch for
- * reg_submatch().  Needed for when the substitution string is an expression
- * that contains a call to substitute() and submatch(). */
-static regmatch_T	*submatch_match;
-static regmmatch_T	*submatch_mmatch;
-static linenr_T		submatch_firstlnum;
-static linenr_T		submatch_maxline;
-static int		submatch_line_lbr;
+/* The match that reg_submatch() gets the text from.  The substitution string
+ * can be an expression that contains a call to substitute() and submatch(),
+ * that uses its own regexec_T. */
+static regexec_T	*submatch_rex;
 #endif
 
 #if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) || defined(PROTO)
@@ -7380,11 +7506,15 @@ vim_regsub(rmp, source, dest, copy, magic, backslash)
     int		magic;
     int		backslash;
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_buf = curbuf;
-    return vim_regsub_both(source, dest, copy, magic, backslash);
+    regexec_T	rex;
+
+    vim_memset(&rex, 0, sizeof(rex));
+    rex.reg_match = rmp;
+    rex.reg_mmatch = NULL;
+    rex.reg_maxline = 0;
+    rex.reg_buf = curbuf;
+    rex.reg_line_lbr = rmp->rm_line_lbr;
+    return vim_regsub_both(&rex, source, dest, copy, magic, backslash);
 }
 #endif
 
@@ -7398,16 +7528,20 @@ vim_regsub_multi(rmp, lnum, source, dest, copy, magic, backslash)
     int		magic;
     int		backslash;
 {
-    reg_match = NULL;
-    reg_mmatch = rmp;
-    reg_buf = curbuf;		/* always works on the current buffer! */
-    reg_firstlnum = lnum;
-    reg_maxline = curbuf->b_ml.ml_line_count - lnum;
-    return vim_regsub_both(source, dest, copy, magic, backslash);
+    regexec_T	rex;
+
+    vim_memset(&rex, 0, sizeof(rex));
+    rex.reg_match = NULL;
+    rex.reg_mmatch = rmp;
+    rex.reg_buf = curbuf;		/* always works on the current buffer! */
+    rex.reg_firstlnum = lnum;
+    rex.reg_maxline = curbuf->b_ml.ml_line_count - lnum;
+    return vim_regsub_both(&rex, source, dest, copy, magic, backslash);
 }
 
     static int
-vim_regsub_both(source, dest, copy, magic, backslash)
+vim_regsub_both(rex, source, dest, copy, magic, backslash)
+    regexec_T	*rex;
     char_u	*source;
     char_u	*dest;
     int		copy;
@@ -7434,7 +7568,7 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	EMSG(_(e_null));
 	return 0;
     }
-    if (prog_magic_wrong())
+    if (prog_magic_wrong(rex))
 	return 0;
     src = source;
     dst = dest;
@@ -7465,22 +7599,12 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	}
 	else
 	{
-	    win_T	*save_reg_win;
-	    int		save_ireg_ic;
-
 	    vim_free(eval_result);
 
 	    /* The expression may contain substitute(), which calls us
-	     * recursively.  Make sure submatch() gets the text from the first
-	     * level.  Don't need to save "reg_buf", because
-	     * vim_regexec_multi() can't be called recursively. */
-	    submatch_match = reg_match;
-	    submatch_mmatch = reg_mmatch;
-	    submatch_firstlnum = reg_firstlnum;
-	    submatch_maxline = reg_maxline;
-	    submatch_line_lbr = reg_line_lbr;
-	    save_reg_win = reg_win;
-	    save_ireg_ic = ireg_ic;
+	     * recursively with another "rex".  Make sure submatch() gets the
+	     * text from the first level. */
+	    submatch_rex = rex;
 	    can_f_submatch = TRUE;
 
 	    eval_result = eval_to_string(source + 2, NULL, TRUE);
@@ -7493,7 +7617,7 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 		    /* Change NL to CR, so that it becomes a line break,
 		     * unless called from vim_regexec_nl().
 		     * Skip over a backslashed character. */
-		    if (*s == NL && !submatch_line_lbr)
+		    if (*s == NL && !rex->reg_line_lbr)
 			*s = CAR;
 		    else if (*s == '\\' && s[1] != NUL)
 		    {
@@ -7504,7 +7628,7 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 			 *   def
 			 * Not when called from vim_regexec_nl().
 			 */
-			if (*s == NL && !submatch_line_lbr)
+			if (*s == NL && !rex->reg_line_lbr)
 			    *s = CAR;
 			had_backslash = TRUE;
 		    }
@@ -7523,13 +7647,6 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 		dst += STRLEN(eval_result);
 	    }
 
-	    reg_match = submatch_match;
-	    reg_mmatch = submatch_mmatch;
-	    reg_firstlnum = submatch_firstlnum;
-	    reg_maxline = submatch_maxline;
-	    reg_line_lbr = submatch_line_lbr;
-	    reg_win = save_reg_win;
-	    ireg_ic = save_ireg_ic;
 	    can_f_submatch = FALSE;
 	}
 #endif
@@ -7659,26 +7776,26 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	{
 	    if (REG_MULTI)
 	    {
-		clnum = reg_mmatch->startpos[no].lnum;
-		if (clnum < 0 || reg_mmatch->endpos[no].lnum < 0)
+		clnum = rex->reg_mmatch->startpos[no].lnum;
+		if (clnum < 0 || rex->reg_mmatch->endpos[no].lnum < 0)
 		    s = NULL;
 		else
 		{
-		    s = reg_getline(clnum) + reg_mmatch->startpos[no].col;
-		    if (reg_mmatch->endpos[no].lnum == clnum)
-			len = reg_mmatch->endpos[no].col
-					       - reg_mmatch->startpos[no].col;
+		    s = reg_getline(rex, clnum) + rex->reg_mmatch->startpos[no].col;
+		    if (rex->reg_mmatch->endpos[no].lnum == clnum)
+			len = rex->reg_mmatch->endpos[no].col
+					       - rex->reg_mmatch->startpos[no].col;
 		    else
 			len = (int)STRLEN(s);
 		}
 	    }
 	    else
 	    {
-		s = reg_match->startp[no];
-		if (reg_match->endp[no] == NULL)
+		s = rex->reg_match->startp[no];
+		if (rex->reg_match->endp[no] == NULL)
 		    s = NULL;
 		else
-		    len = (int)(reg_match->endp[no] - s);
+		    len = (int)(rex->reg_match->endp[no] - s);
 	    }
 	    if (s != NULL)
 	    {
@@ -7688,14 +7805,14 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 		    {
 			if (REG_MULTI)
 			{
-			    if (reg_mmatch->endpos[no].lnum == clnum)
+			    if (rex->reg_mmatch->endpos[no].lnum == clnum)
 				break;
 			    if (copy)
 				*dst = CAR;
 			    ++dst;
-			    s = reg_getline(++clnum);
-			    if (reg_mmatch->endpos[no].lnum == clnum)
-				len = reg_mmatch->endpos[no].col;
+			    s = reg_getline(rex, ++clnum);
+			    if (rex->reg_mmatch->endpos[no].lnum == clnum)
+				len = rex->reg_mmatch->endpos[no].col;
 			    else
 				len = (int)STRLEN(s);
 			}
@@ -7784,31 +7901,6 @@ exit:
 }
 
 #ifdef FEAT_EVAL
-static char_u *reg_getline_submatch __ARGS((linenr_T lnum));
-
-/*
- * Call reg_getline() with the line numbers from the submatch.  If a
- * substitute() was used the reg_maxline and other values have been
- * overwritten.
- */
-    static char_u *
-reg_getline_submatch(lnum)
-    linenr_T	lnum;
-{
-    char_u *s;
-    linenr_T save_first = reg_firstlnum;
-    linenr_T save_max = reg_maxline;
-
-    reg_firstlnum = submatch_firstlnum;
-    reg_maxline = submatch_maxline;
-
-    s = reg_getline(lnum);
-
-    reg_firstlnum = save_first;
-    reg_maxline = save_max;
-    return s;
-}
-
 /*
  * Used for the submatch() function: get the string from the n'th submatch in
  * allocated memory.
@@ -7818,6 +7910,7 @@ reg_getline_submatch(lnum)
 reg_submatch(no)
     int		no;
 {
+    regexec_T	*rex = submatch_rex;
     char_u	*retval = NULL;
     char_u	*s;
     int		len;
@@ -7827,7 +7920,7 @@ reg_submatch(no)
     if (!can_f_submatch || no < 0)
 	return NULL;
 
-    if (submatch_match == NULL)
+    if (REG_MULTI)
     {
 	/*
 	 * First round: compute the length and allocate memory.
@@ -7835,18 +7928,18 @@ reg_submatch(no)
 	 */
 	for (round = 1; round <= 2; ++round)
 	{
-	    lnum = submatch_mmatch->startpos[no].lnum;
-	    if (lnum < 0 || submatch_mmatch->endpos[no].lnum < 0)
+	    lnum = rex->reg_mmatch->startpos[no].lnum;
+	    if (lnum < 0 || rex->reg_mmatch->endpos[no].lnum < 0)
 		return NULL;
 
-	    s = reg_getline_submatch(lnum) + submatch_mmatch->startpos[no].col;
+	    s = reg_getline(rex, lnum) + rex->reg_mmatch->startpos[no].col;
 	    if (s == NULL)  /* anti-crash check, cannot happen? */
 		break;
-	    if (submatch_mmatch->endpos[no].lnum == lnum)
+	    if (rex->reg_mmatch->endpos[no].lnum == lnum)
 	    {
 		/* Within one line: take form start to end col. */
-		len = submatch_mmatch->endpos[no].col
-					  - submatch_mmatch->startpos[no].col;
+		len = rex->reg_mmatch->endpos[no].col
+					  - rex->reg_mmatch->startpos[no].col;
 		if (round == 2)
 		    vim_strncpy(retval, s, len);
 		++len;
@@ -7863,9 +7956,9 @@ reg_submatch(no)
 		}
 		++len;
 		++lnum;
-		while (lnum < submatch_mmatch->endpos[no].lnum)
+		while (lnum < rex->reg_mmatch->endpos[no].lnum)
 		{
-		    s = reg_getline_submatch(lnum++);
+		    s = reg_getline(rex, lnum++);
 		    if (round == 2)
 			STRCPY(retval + len, s);
 		    len += (int)STRLEN(s);
@@ -7874,9 +7967,9 @@ reg_submatch(no)
 		    ++len;
 		}
 		if (round == 2)
-		    STRNCPY(retval + len, reg_getline_submatch(lnum),
-					     submatch_mmatch->endpos[no].col);
-		len += submatch_mmatch->endpos[no].col;
+		    STRNCPY(retval + len, reg_getline(rex, lnum),
+					     rex->reg_mmatch->endpos[no].col);
+		len += rex->reg_mmatch->endpos[no].col;
 		if (round == 2)
 		    retval[len] = NUL;
 		++len;
@@ -7892,11 +7985,11 @@ reg_submatch(no)
     }
     else
     {
-	s = submatch_match->startp[no];
-	if (s == NULL || submatch_match->endp[no] == NULL)
+	s = rex->reg_match->startp[no];
+	if (s == NULL || rex->reg_match->endp[no] == NULL)
 	    retval = NULL;
 	else
-	    retval = vim_strnsave(s, (int)(submatch_match->endp[no] - s));
+	    retval = vim_strnsave(s, (int)(rex->reg_match->endp[no] - s));
     }
 
     return retval;
@@ -7950,10 +8043,523 @@ static char_u regname[][30] = {
 			    };
 #endif
 
+/*
+ * Cache of compiled programs.  The same pattern is often compiled again and
+ * again: for "n", for 'hlsearch' on every redraw, for match() in a loop.
+ * The key is the pattern with everything else compiling depends on:
+ * "re_flags" (which has RE_MAGIC for 'magic'), 'regexpengine', the 'cpo'
+ * flags, \z() handling and the encoding.  A pattern with "~" is not cached,
+ * it depends on the previous substitute string.
+ * Programs are shared by counting references, the cache holds one.  When
+ * the cache is full the least recently used entry is dropped.
+ */
+#define REGCACHE_SIZE	32
+
+typedef struct
+{
+    char_u	*rc_expr;	/* pattern, NULL for an unused entry */
+    hash_T	rc_hash;	/* hash of rc_expr */
+    int		rc_flags;	/* "re_flags" */
+    int		rc_env;		/* from regcache_env() */
+#ifdef FEAT_MBYTE
+    int		rc_dbcs;	/* "enc_dbcs" */
+#endif
+#ifdef FEAT_SYN_HL
+    int		rc_had_eol;	/* "had_eol" after compiling */
+#endif
+    long_u	rc_used;	/* "regcache_tick" when last used */
+    regprog_T	*rc_prog;
+} regcache_T;
+
+static regcache_T regcache[REGCACHE_SIZE];
+static long_u	regcache_tick = 0;
+static long	regcache_hits = 0;
+static long	regcache_misses = 0;
+
+static int	regcache_env __ARGS((void));
+static regcache_T *regcache_find __ARGS((char_u *expr, hash_T hash, int re_flags));
+static void	regcache_add __ARGS((char_u *expr, hash_T hash, int re_flags, regprog_T *prog));
+
+/*
+ * Return the option values, other than "re_flags", that compiling depends
+ * on.
+ */
+    static int
+regcache_env()
+{
+    int		env = (int)p_re;	/* 0, 1 or 2 */
+
+    if (vim_strchr(p_cpo, CPO_LITERAL) != NULL)
+	env |= 0x04;
+    if (vim_strchr(p_cpo, CPO_BACKSL) != NULL)
+	env |= 0x08;
+#ifdef FEAT_SYN_HL
+    env |= reg_do_extmatch << 4;	/* REX_SET and REX_USE */
+#endif
+#ifdef FEAT_MBYTE
+    if (has_mbyte)
+	env |= 0x40;
+    if (enc_utf8)
+	env |= 0x80;
+#endif
+    return env;
+}
+
+/*
+ * Find the entry for pattern "expr" compiled with "re_flags" and the current
+ * options.  Returns NULL when there is none.
+ */
+    static regcache_T *
+regcache_find(expr, hash, re_flags)
+    char_u	*expr;
+    hash_T	hash;
+    int		re_flags;
+{
+    regcache_T	*rc;
+    int		env = regcache_env();
+
+    for (rc = regcache; rc < regcache + REGCACHE_SIZE; ++rc)
+	if (rc->rc_expr != NULL
+		&& rc->rc_hash == hash
+		&& rc->rc_flags == re_flags
+		&& rc->rc_env == env
+#ifdef FEAT_MBYTE
+		&& rc->rc_dbcs == enc_dbcs
+#endif
+		&& STRCMP(rc->rc_expr, expr) == 0)
+	    return rc;
+    return NULL;
+}
+
+/*
+ * Add "prog", compiled from "expr" with "re_flags", to the cache.  Drops the
+ * least recently used entry when the cache is full.
+ */
+    static void
+regcache_add(expr, hash, re_flags, prog)
+    char_u	*expr;
+    hash_T	hash;
+    int		re_flags;
+    regprog_T	*prog;
+{
+    regcache_T	*rc;
+    regcache_T	*oldest = regcache;
+    char_u	*p;
+
+    p = vim_strsave(expr);
+    if (p == NULL)
+	return;
+    for (rc = regcache; rc < regcache + REGCACHE_SIZE; ++rc)
+    {
+	if (rc->rc_expr == NULL)
+	{
+	    oldest = rc;
+	    break;
+	}
+	if (rc->rc_used < oldest->rc_used)
+	    oldest = rc;
+    }
+    if (oldest->rc_expr != NULL)
+    {
+	vim_free(oldest->rc_expr);
+	vim_regfree(oldest->rc_prog);
+    }
+
+    oldest->rc_expr = p;
+    oldest->rc_hash = hash;
+    oldest->rc_flags = re_flags;
+    oldest->rc_env = regcache_env();
+#ifdef FEAT_MBYTE
+    oldest->rc_dbcs = enc_dbcs;
+#endif
+#ifdef FEAT_SYN_HL
+    oldest->rc_had_eol = had_eol;
+#endif
+    oldest->rc_used = ++regcache_tick;
+    oldest->rc_prog = prog;
+    ++prog->refcnt;
+}
+
+/*
+ * Drop all entries from the cache.  Programs still in use are freed when
+ * their last user frees them.
+ */
+    static void
+regcache_clear()
+{
+    regcache_T	*rc;
+
+    for (rc = regcache; rc < regcache + REGCACHE_SIZE; ++rc)
+	if (rc->rc_expr != NULL)
+	{
+	    vim_free(rc->rc_expr);
+	    rc->rc_expr = NULL;
+	    vim_regfree(rc->rc_prog);
+	    rc->rc_prog = NULL;
+	}
+}
+
+#if defined(FEAT_EVAL) || defined(PROTO)
+/*
+ * Add the cache statistics to "dict", for regexpcache().
+ */
+    void
+regcache_eval(dict)
+    dict_T	*dict;
+{
+    regcache_T	*rc;
+    long	count = 0;
+
+    for (rc = regcache; rc < regcache + REGCACHE_SIZE; ++rc)
+	if (rc->rc_expr != NULL)
+	    ++count;
+    dict_add_nr_str(dict, "hits", regcache_hits, NULL);
+    dict_add_nr_str(dict, "misses", regcache_misses, NULL);
+    dict_add_nr_str(dict, "count", count, NULL);
+    dict_add_nr_str(dict, "size", (long)REGCACHE_SIZE, NULL);
+}
+#endif
+
+#if defined(FEAT_PROFILE) || defined(PROTO)
+/*
+ * ":regexpprofile": time and counters for executing each pattern, separately
+ * for the two engines.  Only patterns compiled while profiling is on are
+ * measured: vim_regcomp() links the program to the entry for its pattern.
+ * The entries are kept until exiting, ":regexpprofile clear" only zeroes
+ * them, thus programs never point to a freed entry.
+ * When the measurements show that the backtracking engine is much faster for
+ * a pattern, the automatic engine uses it, see regprof_engine().
+ */
+typedef struct
+{
+    proftime_T	total;		/* total time used */
+    proftime_T	slowest;	/* time of slowest call */
+    long	count;		/* nr of times used */
+    long	match;		/* nr of times matched */
+    long	steps;		/* states visited */
+    long	addstate;	/* NFA: calls to addstate() */
+    long	fallback;	/* NFA: times the DFA was given up */
+} regprof_stat_T;
+
+struct regprof_S
+{
+    regprof_stat_T rp_stat[2];	/* backtracking and NFA engine */
+    char_u	rp_pattern[1];	/* pattern without "\%#=", actually longer */
+};
+
+static regprof_T dumrp;
+#define RP_KEY_OFF  (unsigned)(dumrp.rp_pattern - (char_u *)&dumrp)
+#define HI2RP(hi)   ((regprof_T *)((hi)->hi_key - RP_KEY_OFF))
+
+/* Both engines must have been used this often before the measurements are
+ * used to choose the engine. */
+#define REGPROF_MIN_COUNT   20
+
+static int	regprof_on = FALSE;
+static hashtab_T regprof_ht;
+static int	regprof_ht_init = FALSE;
+
+static regprof_T *regprof_find __ARGS((char_u *expr, int add));
+static void	regprof_add __ARGS((regprog_T *prog, regexec_T *rex, proftime_T *tm, int matched));
+static double	regprof_time __ARGS((proftime_T *tm));
+static int	regprof_engine __ARGS((char_u *expr));
+static void	regprof_report __ARGS((void));
+#ifdef __BORLANDC__
+static int _RTLENTRYF regprof_compare __ARGS((const void *v1, const void *v2));
+#else
+static int	regprof_compare __ARGS((const void *v1, const void *v2));
+#endif
+
+/*
+ * Find the entry for pattern "expr".  When there is none and "add" is TRUE
+ * add one.  Returns NULL when there is none or out of memory.
+ */
+    static regprof_T *
+regprof_find(expr, add)
+    char_u	*expr;
+    int		add;
+{
+    hash_T	hash;
+    hashitem_T	*hi;
+    regprof_T	*rp;
+
+    if (!regprof_ht_init)
+    {
+	if (!add)
+	    return NULL;
+	hash_init(&regprof_ht);
+	regprof_ht_init = TRUE;
+    }
+    hash = hash_hash(expr);
+    hi = hash_lookup(&regprof_ht, expr, hash);
+    if (!HASHITEM_EMPTY(hi))
+	return HI2RP(hi);
+    if (!add)
+	return NULL;
+
+    rp = (regprof_T *)alloc_clear((unsigned)(sizeof(regprof_T)
+							     + STRLEN(expr)));
+    if (rp == NULL)
+	return NULL;
+    STRCPY(rp->rp_pattern, expr);
+    if (hash_add_item(&regprof_ht, hi, rp->rp_pattern, hash) == FAIL)
+    {
+	vim_free(rp);
+	return NULL;
+    }
+    return rp;
+}
+
+/*
+ * Add one execution of "prog", which started at time "tm", to its entry.
+ */
+    static void
+regprof_add(prog, rex, tm, matched)
+    regprog_T	*prog;
+    regexec_T	*rex;
+    proftime_T	*tm;
+    int		matched;
+{
+    regprof_stat_T *st;
+
+    profile_end(tm);
+    st = &prog->regprof->rp_stat[prog->engine == &nfa_regengine];
+    profile_add(&st->total, tm);
+    if (profile_cmp(tm, &st->slowest) < 0)
+	st->slowest = *tm;
+    ++st->count;
+    if (matched)
+	++st->match;
+    st->steps += rex->prof_steps;
+    st->addstate += rex->prof_addstate;
+    st->fallback += rex->prof_fallback;
+}
+
+/*
+ * Return time "tm" as a number, only for comparing.
+ */
+    static double
+regprof_time(tm)
+    proftime_T	*tm;
+{
+# ifdef WIN3264
+    return (double)tm->QuadPart;
+# else
+    return tm->tv_sec * 1000000.0 + tm->tv_usec;
+# endif
+}
+
+/*
+ * Return the engine to use for "expr" when 'regexpengine' is zero:
+ * BACKTRACKING_ENGINE when both engines were measured and backtracking took
+ * less than half the time on average, AUTOMATIC_ENGINE otherwise.
+ */
+    static int
+regprof_engine(expr)
+    char_u	*expr;
+{
+    regprof_T	*rp = regprof_find(expr, FALSE);
+    regprof_stat_T *bt;
+    regprof_stat_T *nfa;
+
+    if (rp == NULL)
+	return AUTOMATIC_ENGINE;
+    bt = &rp->rp_stat[0];
+    nfa = &rp->rp_stat[1];
+    if (bt->count >= REGPROF_MIN_COUNT && nfa->count >= REGPROF_MIN_COUNT
+	    && regprof_time(&bt->total) / bt->count * 2
+				  < regprof_time(&nfa->total) / nfa->count)
+	return BACKTRACKING_ENGINE;
+    return AUTOMATIC_ENGINE;
+}
+
+/*
+ * ":regexpprofile {on,off,clear,report}".
+ * Any change drops the cached programs, so that patterns are compiled again
+ * with (or without) an entry to record in and with the engine the
+ * measurements favor.
+ */
+    void
+ex_regexpprofile(eap)
+    exarg_T	*eap;
+{
+    hashitem_T	*hi;
+    int		todo;
+
+    if (STRCMP(eap->arg, "on") == 0)
+	regprof_on = TRUE;
+    else if (STRCMP(eap->arg, "off") == 0)
+	regprof_on = FALSE;
+    else if (STRCMP(eap->arg, "clear") == 0)
+    {
+	if (regprof_ht_init)
+	{
+	    todo = (int)regprof_ht.ht_used;
+	    for (hi = regprof_ht.ht_array; todo > 0; ++hi)
+		if (!HASHITEM_EMPTY(hi))
+		{
+		    --todo;
+		    vim_memset(HI2RP(hi)->rp_stat, 0,
+					   sizeof(HI2RP(hi)->rp_stat));
+		}
+	}
+    }
+    else if (STRCMP(eap->arg, "report") == 0)
+    {
+	regprof_report();
+	return;
+    }
+    else
+    {
+	EMSG2(_(e_invarg2), eap->arg);
+	return;
+    }
+    regcache_clear();
+}
+
+typedef struct
+{
+    regprof_stat_T *st;
+    char	*engine;
+    char_u	*pattern;
+} regprof_entry_T;
+
+    static int
+#ifdef __BORLANDC__
+_RTLENTRYF
+#endif
+regprof_compare(v1, v2)
+    const void	*v1;
+    const void	*v2;
+{
+    const regprof_entry_T	*e1 = v1;
+    const regprof_entry_T	*e2 = v2;
+
+    return profile_cmp(&e1->st->total, &e2->st->total);
+}
+
+/*
+ * List the measurements, slowest pattern first.  The engine that the
+ * automatic engine would use is marked with a "*".
+ */
+    static void
+regprof_report()
+{
+    garray_T	    ga;
+    regprof_entry_T *p;
+    regprof_T	    *rp;
+    hashitem_T	    *hi;
+    int		    todo;
+    int		    i;
+    int		    len;
+
+    ga_init2(&ga, sizeof(regprof_entry_T), 50);
+    if (regprof_ht_init)
+    {
+	todo = (int)regprof_ht.ht_used;
+	for (hi = regprof_ht.ht_array; todo > 0; ++hi)
+	    if (!HASHITEM_EMPTY(hi))
+	    {
+		--todo;
+		rp = HI2RP(hi);
+		for (i = 0; i < 2; ++i)
+		    if (rp->rp_stat[i].count > 0 && ga_grow(&ga, 1) == OK)
+		    {
+			p = ((regprof_entry_T *)ga.ga_data) + ga.ga_len;
+			p->st = &rp->rp_stat[i];
+			if (i == 0)
+			    p->engine = regprof_engine(rp->rp_pattern)
+				      == BACKTRACKING_ENGINE ? "bt*" : "bt";
+			else
+			    p->engine = regprof_engine(rp->rp_pattern)
+				    == BACKTRACKING_ENGINE ? "nfa" : "nfa*";
+			p->pattern = rp->rp_pattern;
+			++ga.ga_len;
+		    }
+	    }
+    }
+    if (ga.ga_len == 0)
+    {
+	MSG(_("No patterns were measured"));
+	return;
+    }
+
+    /* sort on total time */
+    qsort(ga.ga_data, (size_t)ga.ga_len, sizeof(regprof_entry_T),
+							     regprof_compare);
+
+    MSG_PUTS_TITLE(_("  TOTAL      COUNT  MATCH   SLOWEST     STEPS     ADDSTATE  FALLBACK ENGINE PATTERN"));
+    MSG_PUTS("\n");
+    for (i = 0; i < ga.ga_len && !got_int; ++i)
+    {
+	p = ((regprof_entry_T *)ga.ga_data) + i;
+
+	MSG_PUTS(profile_msg(&p->st->total));
+	MSG_PUTS(" "); /* make sure there is always a separating space */
+	msg_advance(13);
+	msg_outnum(p->st->count);
+	MSG_PUTS(" ");
+	msg_advance(20);
+	msg_outnum(p->st->match);
+	MSG_PUTS(" ");
+	msg_advance(26);
+	MSG_PUTS(profile_msg(&p->st->slowest));
+	MSG_PUTS(" ");
+	msg_advance(38);
+	msg_outnum(p->st->steps);
+	MSG_PUTS(" ");
+	msg_advance(48);
+	msg_outnum(p->st->addstate);
+	MSG_PUTS(" ");
+	msg_advance(58);
+	msg_outnum(p->st->fallback);
+	MSG_PUTS(" ");
+	msg_advance(67);
+	MSG_PUTS(p->engine);
+	MSG_PUTS(" ");
+
+	msg_advance(74);
+	if (Columns < 85)
+	    len = 20; /* will wrap anyway */
+	else
+	    len = Columns - 75;
+	if (len > (int)STRLEN(p->pattern))
+	    len = (int)STRLEN(p->pattern);
+	msg_outtrans_len(p->pattern, len);
+	MSG_PUTS("\n");
+    }
+    ga_clear(&ga);
+}
+
+# ifdef EXITFREE
+/*
+ * Free all the entries.
+ */
+    static void
+regprof_free()
+{
+    hashitem_T	*hi;
+    int		todo;
+
+    if (!regprof_ht_init)
+	return;
+    todo = (int)regprof_ht.ht_used;
+    for (hi = regprof_ht.ht_array; todo > 0; ++hi)
+	if (!HASHITEM_EMPTY(hi))
+	{
+	    --todo;
+	    vim_free(HI2RP(hi));
+	}
+    hash_clear(&regprof_ht);
+    regprof_ht_init = FALSE;
+}
+# endif
+#endif
+
 /*
  * Compile a regular expression into internal code.
- * Returns the program in allocated memory.
- * Use vim_regfree() to free the memory.
+ * Returns the program in allocated memory, possibly shared with other users.
+ * Use vim_regfree() to free it.
  * Returns NULL for an error.
  */
     regprog_T *
@@ -7963,6 +8569,28 @@ vim_regcomp(expr_arg, re_flags)
 {
     regprog_T   *prog = NULL;
     char_u	*expr = expr_arg;
+    regcache_T	*rc;
+    hash_T	hash = 0;
+    int		cache = vim_strchr(expr_arg, '~') == NULL;
+    int		save_called_emsg = called_emsg;
+
+    if (cache)
+    {
+	hash = hash_hash(expr_arg);
+	rc = regcache_find(expr_arg, hash, re_flags);
+	if (rc != NULL)
+	{
+	    ++regcache_hits;
+	    rc->rc_used = ++regcache_tick;
+#ifdef FEAT_SYN_HL
+	    had_eol = rc->rc_had_eol;
+#endif
+	    ++rc->rc_prog->refcnt;
+	    return rc->rc_prog;
+	}
+	++regcache_misses;
+    }
+    called_emsg = FALSE;
 
     regexp_engine = p_re;
 
@@ -7988,6 +8616,11 @@ vim_regcomp(expr_arg, re_flags)
 	    regexp_engine = AUTOMATIC_ENGINE;
 	}
     }
+#ifdef FEAT_PROFILE
+    /* Use the engine that was measured to be much faster. */
+    if (regexp_engine == AUTOMATIC_ENGINE)
+	regexp_engine = regprof_engine(expr);
+#endif
 #ifdef DEBUG
     bt_regengine.expr = expr;
     nfa_regengine.expr = expr;
@@ -8025,18 +8658,32 @@ vim_regcomp(expr_arg, re_flags)
 	    prog = bt_regengine.regcomp(expr, re_flags);
 	 */
     }
+    else
+    {
+	prog->refcnt = 1;
+	prog->regprof = NULL;
+#ifdef FEAT_PROFILE
+	if (regprof_on)
+	    prog->regprof = regprof_find(expr, TRUE);
+#endif
+	/* Don't cache when there was a message, it would not be given again. */
+	if (cache && !called_emsg)
+	    regcache_add(expr_arg, hash, re_flags, prog);
+    }
 
+    called_emsg |= save_called_emsg;
     return prog;
 }
 
 /*
- * Free a compiled regexp program, returned by vim_regcomp().
+ * Free a compiled regexp program, returned by vim_regcomp().  Only frees it
+ * when there are no other users.
  */
     void
 vim_regfree(prog)
     regprog_T   *prog;
 {
-    if (prog != NULL)
+    if (prog != NULL && --prog->refcnt <= 0)
 	prog->engine->regfree(prog);
 }
 
@@ -8053,7 +8700,25 @@ vim_regexec(rmp, line, col)
     char_u      *line;  /* string to match against */
     colnr_T     col;    /* column to start looking for match */
 {
-    return rmp->regprog->engine->regexec(rmp, line, col);
+    regexec_T	rex;
+    int		r;
+#ifdef FEAT_PROFILE
+    regprog_T	*prog = rmp->regprog;
+    proftime_T	tm;
+
+    if (regprof_on && prog->regprof != NULL)
+	profile_start(&tm);
+#endif
+
+    rmp->rm_line_lbr = FALSE;
+    regexec_init(&rex);
+    r = rmp->regprog->engine->regexec(&rex, rmp, line, col);
+#ifdef FEAT_PROFILE
+    if (regprof_on && prog->regprof != NULL)
+	regprof_add(prog, &rex, &tm, r);
+#endif
+    regexec_clear(&rex);
+    return r;
 }
 
 #if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
@@ -8067,7 +8732,25 @@ vim_regexec_nl(rmp, line, col)
     char_u *line;
     colnr_T col;
 {
-    return rmp->regprog->engine->regexec_nl(rmp, line, col);
+    regexec_T	rex;
+    int		r;
+#ifdef FEAT_PROFILE
+    regprog_T	*prog = rmp->regprog;
+    proftime_T	tm;
+
+    if (regprof_on && prog->regprof != NULL)
+	profile_start(&tm);
+#endif
+
+    rmp->rm_line_lbr = TRUE;
+    regexec_init(&rex);
+    r = rmp->regprog->engine->regexec_nl(&rex, rmp, line, col);
+#ifdef FEAT_PROFILE
+    if (regprof_on && prog->regprof != NULL)
+	regprof_add(prog, &rex, &tm, r);
+#endif
+    regexec_clear(&rex);
+    return r;
 }
 #endif
 
@@ -8088,5 +8771,23 @@ vim_regexec_multi(rmp, win, buf, lnum, col, tm)
     colnr_T     col;            /* column to start looking for match */
     proftime_T	*tm;		/* timeout limit or NULL */
 {
-    return rmp->regprog->engine->regexec_multi(rmp, win, buf, lnum, col, tm);
+    regexec_T	rex;
+    long	r;
+#ifdef FEAT_PROFILE
+    regprog_T	*prog = rmp->regprog;
+    proftime_T	ptm;
+
+    if (regprof_on && prog->regprof != NULL)
+	profile_start(&ptm);
+#endif
+
+    regexec_init(&rex);
+    r = rmp->regprog->engine->regexec_multi(&rex, rmp, win, buf, lnum, col,
+									  tm);
+#ifdef FEAT_PROFILE
+    if (regprof_on && prog->regprof != NULL)
+	regprof_add(prog, &rex, &ptm, r > 0);
+#endif
+    regexec_clear(&rex);
+    return r;
 }
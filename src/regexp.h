@@ -28,6 +28,8 @@
 #define NFA_MAX_BRACES 20
 
 typedef struct regengine regengine_T;
+typedef struct regexec_S regexec_T;
+typedef struct regprof_S regprof_T;
 
 /*
  * Structure returned by vim_regcomp() to pass on to vim_regexec().
@@ -38,6 +40,8 @@ typedef struct regprog
 {
     regengine_T		*engine;
     unsigned		regflags;
+    int			refcnt;		/* users, including the cache */
+    regprof_T		*regprof;	/* for ":regexpprofile" or NULL */
 } regprog_T;
 
 /*
@@ -47,9 +51,11 @@ typedef struct regprog
  */
 typedef struct
 {
-    /* These two members implement regprog_T */
+    /* These four members implement regprog_T */
     regengine_T		*engine;
     unsigned		regflags;
+    int			refcnt;
+    regprof_T		*regprof;
 
     int			regstart;
     char_u		reganch;
@@ -72,18 +78,21 @@ struct nfa_state
     nfa_state_T		*out;
     nfa_state_T		*out1;
     int			id;
-    int			lastlist[2]; /* 0: normal, 1: recursive */
     int			val;
 };
 
+typedef struct nfa_dfa_S nfa_dfa_T;
+
 /*
  * Structure used by the NFA matcher.
  */
 typedef struct
 {
-    /* These two members implement regprog_T */
+    /* These four members implement regprog_T */
     regengine_T		*engine;
     unsigned		regflags;
+    int			refcnt;
+    regprof_T		*regprof;
 
     nfa_state_T		*start;		/* points into state[] */
 
@@ -100,6 +109,14 @@ typedef struct
     char_u		*pattern;
 #endif
     int			nsubexp;	/* number of () */
+    /* The DFA is built and these may be changed while matching, see the
+     * comment for regexec_T. */
+    int			dfa_flags;	/* NFA_DFA_ flags */
+    nfa_dfa_T		*dfa;		/* lazily built DFA, or NULL */
+    int			nlits;		/* number of items in lits[] */
+    int			lit_flags;	/* NFA_LIT_ flags */
+    char_u		*lits[SCAN_MAX_LITS]; /* every match has one of these */
+    int			lit_lens[SCAN_MAX_LITS];
     int			nstate;
     nfa_state_T		state[1];	/* actually longer.. */
 } nfa_regprog_T;
@@ -115,6 +132,7 @@ typedef struct
     char_u		*startp[NSUBEXP];
     char_u		*endp[NSUBEXP];
     int			rm_ic;
+    int			rm_line_lbr;	/* set by vim_regexec_nl() */
 } regmatch_T;
 
 /*
@@ -149,12 +167,12 @@ struct regengine
 {
     regprog_T	*(*regcomp)(char_u*, int);
     void	(*regfree)(regprog_T *);
-    int		(*regexec)(regmatch_T*, char_u*, colnr_T);
+    int		(*regexec)(regexec_T*, regmatch_T*, char_u*, colnr_T);
 #if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
 	|| defined(FIND_REPLACE_DIALOG) || defined(PROTO)
-    int		(*regexec_nl)(regmatch_T*, char_u*, colnr_T);
+    int		(*regexec_nl)(regexec_T*, regmatch_T*, char_u*, colnr_T);
 #endif
-    long	(*regexec_multi)(regmmatch_T*, win_T*, buf_T*, linenr_T, colnr_T, proftime_T*);
+    long	(*regexec_multi)(regexec_T*, regmmatch_T*, win_T*, buf_T*, linenr_T, colnr_T, proftime_T*);
 #ifdef DEBUG
     char_u	*expr;
 #endif
@@ -0,0 +1,250 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * regexp_bench.c: Benchmark for the two regexp engines.
+ *
+ * Reads Vim's own C sources and Vim script into a buffer and finds all the
+ * matches of a corpus of real patterns, taken from the C and Vim syntax
+ * files plus some common searches, once with each engine.  Reports the time
+ * for each engine and checks that they find the same matches.  Then lists
+ * the ":regexpprofile" counters and which engine the automatic selection
+ * uses based on the measurements.
+ * Arguments are files to use instead of the default ones.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Must include main.c because it contains much more than just main() */
+#define NO_VIM_MAIN
+#include "main.c"
+
+#define BENCH_COPIES	2	/* number of times the text is read */
+
+static char *bench_text[] =
+{
+    "eval.c", "normal.c", "regexp.c", "regexp_nfa.c", "screen.c",
+    "../runtime/syntax/vim.vim", "../runtime/syntax/c.vim",
+    "../runtime/autoload/netrw.vim", NULL
+};
+
+typedef struct
+{
+    char	*where;		/* where the pattern comes from */
+    char	*pattern;
+} bench_pat_T;
+
+static bench_pat_T bench_pats[] =
+{
+    /* syntax/c.vim */
+    {"cSpaceError",	"\\s\\+$"},
+    {"cSpecial",	"\\\\\\(x\\x\\+\\|\\o\\{1,3}\\|.\\|$\\)"},
+    {"cString",		"L\\=\""},
+    {"cFormat",		"%\\(\\d\\+\\$\\)\\=[-+' #0*]*\\(\\d*\\|\\*\\|\\*\\d\\+\\$\\)\\(\\.\\(\\d*\\|\\*\\|\\*\\d\\+\\$\\)\\)\\=\\([hlLjzt]\\|ll\\|hh\\)\\=\\([aAbdiuoxXDOUfFeEgGcCsSpn]\\|\\[\\^\\=.[^]]*\\]\\)"},
+    {"cCharacter",	"L\\='[^\\\\]'"},
+    {"cSpecialChar",	"L\\='\\\\\\o\\{1,3}'"},
+    {"cNumber",		"\\d\\+\\(u\\=l\\{0,2}\\|ll\\=u\\)\\>"},
+    {"cFloat",		"\\d\\+\\.\\d*\\(e[-+]\\=\\d\\+\\)\\=[fl]\\="},
+    {"cCommentError",	"\\*/"},
+    {"cPreCondit",	"^\\s*\\(%:\\|#\\)\\s*\\(if\\|ifdef\\|ifndef\\|elif\\)\\>"},
+    {"cInclude",	"^\\s*\\(%:\\|#\\)\\s*include\\>\\s*[\"<]"},
+    {"cUserCont",	"^\\s*\\I\\i*\\s*:[^:]"},
+    {"cBitField",	";\\s*\\I\\i*\\s*:\\s*[1-9]"},
+    /* syntax/vim.vim */
+    {"vimNumber",	"\\<\\d\\+\\%(\\.\\d\\+\\%([eE][+-]\\=\\d\\+\\)\\=\\)\\="},
+    {"vimIsCommand",	"\\<\\h\\w*\\>"},
+    {"vimVar",		"\\<[bwglsav]:\\h[a-zA-Z0-9#_]*\\>"},
+    {"vimOper",		"\\(==\\|!=\\|>=\\|<=\\|=\\~\\|!\\~\\|>\\|<\\|=\\)[?#]\\{0,2}"},
+    {"vimFunction",	"\\<fu\\%[nction]!\\=\\s\\+\\%(<[sS][iI][dD]>\\|[sSgGbBwWtTlL]:\\)\\=\\%(\\i\\|[#.]\\|{.\\{-1,}}\\)*\\ze\\s*("},
+    {"vimFuncSID",	"\\c<sid>\\|\\<s:"},
+    {"vimSpecFile",	"<\\([acs]file\\|amatch\\|abuf\\)>"},
+    {"vimUserCmd",	"\\<com\\%[mand]!\\=\\>.*$"},
+    /* searches */
+    {"word",		"\\<regmatch\\>"},
+    {"ignorecase",	"\\cvim_free"},
+    {"alternatives",	"vim_strsave\\|vim_free\\|alloc_clear"},
+    {"call",		"\\<\\h\\w*\\s*([^)]*)\\s*;"},
+    {"trailing",	"[ \\t]\\+$"},
+    {"assignment",	"\\w\\+\\s*=\\s*NULL;"},
+    {"backref",		"\\(\\<\\w\\+\\>\\) \\1"},
+    {"lookbehind",	"\\(->\\)\\@<=b_\\w\\+"},
+    {"non-greedy",	"\".\\{-}\""},
+    {"comment",		"/\\*.*\\*/"},
+    {NULL, NULL}
+};
+
+static long bench_usec_since __ARGS((struct timeval *tv));
+static long bench_run __ARGS((regprog_T *prog, long_u *hash));
+static void bench_init __ARGS((void));
+
+    static long
+bench_usec_since(tv)
+    struct timeval *tv;
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - tv->tv_sec) * 1000000L + (now.tv_usec - tv->tv_usec);
+}
+
+/*
+ * Find all matches of "prog" in the buffer, like a search does.  Returns the
+ * number of matches and sets "*hash" to a hash of their positions.
+ */
+    static long
+bench_run(prog, hash)
+    regprog_T	*prog;
+    long_u	*hash;
+{
+    regmmatch_T	regmatch;
+    linenr_T	lnum;
+    colnr_T	col;
+    char_u	*line;
+    long	count = 0;
+
+    regmatch.regprog = prog;
+    regmatch.rmm_ic = FALSE;
+    regmatch.rmm_maxcol = 0;
+    *hash = 0;
+    for (lnum = 1; lnum <= curbuf->b_ml.ml_line_count; ++lnum)
+    {
+	col = 0;
+	while (vim_regexec_multi(&regmatch, NULL, curbuf, lnum, col, NULL) > 0)
+	{
+	    ++count;
+	    *hash = *hash * 31 + (long_u)lnum;
+	    *hash = *hash * 31 + (long_u)regmatch.startpos[0].col;
+	    *hash = *hash * 31 + (long_u)regmatch.endpos[0].col;
+	    if (regmatch.endpos[0].lnum > 0)
+		break;
+	    if (regmatch.endpos[0].col > regmatch.startpos[0].col)
+		col = regmatch.endpos[0].col;
+	    else
+	    {
+		/* Empty match: try again after the next character. */
+		line = ml_get(lnum);
+		if (line[regmatch.startpos[0].col] == NUL)
+		    break;
+		col = regmatch.startpos[0].col
+			       + (*mb_ptr2len)(line + regmatch.startpos[0].col);
+	    }
+	}
+    }
+    return count;
+}
+
+/*
+ * The parts of Vim's startup that the regexp code needs.
+ */
+    static void
+bench_init()
+{
+    mch_early_init();
+#ifdef FEAT_MBYTE
+    (void)mb_init();
+#endif
+    eval_init();
+    IObuff = alloc(IOSIZE);
+    NameBuff = alloc(MAXPATHL);
+    assert(IObuff != NULL && NameBuff != NULL);
+    assert(win_alloc_first() == OK);
+    set_init_1();
+
+    do_cmdline_cmd((char_u *)"set encoding=utf-8 fileformats=unix");
+    msg_silent = 1;
+    Columns = 200;	/* room for the patterns in the report */
+}
+
+    int
+main(argc, argv)
+    int		argc;
+    char	**argv;
+{
+    char	**files = argc > 1 ? argv + 1 : bench_text;
+    char	**fname;
+    char_u	pat[1000];
+    regprog_T	*bt_prog;
+    regprog_T	*nfa_prog;
+    regprog_T	*auto_prog;
+    long	bt_usec;
+    long	nfa_usec;
+    long	bt_total = 0;
+    long	nfa_total = 0;
+    long	bt_count;
+    long	nfa_count;
+    long_u	bt_hash;
+    long_u	nfa_hash;
+    struct timeval start;
+    char_u	*report;
+    int		i;
+
+    bench_init();
+    ml_close(curbuf, TRUE);
+    assert(ml_open(curbuf) == OK);
+    curbuf->b_p_swf = FALSE;
+    for (i = 0; i < BENCH_COPIES; ++i)
+	for (fname = files; *fname != NULL; ++fname)
+	    assert(readfile((char_u *)*fname, NULL, curbuf->b_ml.ml_line_count,
+				(linenr_T)0, (linenr_T)MAXLNUM, NULL, 0) == OK);
+
+    printf("regexp_bench: %ld lines\n", (long)curbuf->b_ml.ml_line_count);
+    printf("  %-14s %9s %9s %8s  %s\n",
+				 "PATTERN", "BT ms", "NFA ms", "MATCHES", "AUTO");
+    do_cmdline_cmd((char_u *)"regexpprofile on");
+    for (i = 0; bench_pats[i].pattern != NULL; ++i)
+    {
+	vim_snprintf((char *)pat, sizeof(pat), "\\%%#=1%s",
+							bench_pats[i].pattern);
+	bt_prog = vim_regcomp(pat, RE_MAGIC);
+	assert(bt_prog != NULL);
+	gettimeofday(&start, NULL);
+	bt_count = bench_run(bt_prog, &bt_hash);
+	bt_usec = bench_usec_since(&start);
+
+	pat[4] = '2';
+	nfa_prog = vim_regcomp(pat, RE_MAGIC);
+	assert(nfa_prog != NULL);
+	gettimeofday(&start, NULL);
+	nfa_count = bench_run(nfa_prog, &nfa_hash);
+	nfa_usec = bench_usec_since(&start);
+
+	if (bt_count != nfa_count || bt_hash != nfa_hash)
+	{
+	    printf("%s: backtracking finds %ld, NFA finds %ld matches\n",
+				     bench_pats[i].where, bt_count, nfa_count);
+	    return 1;
+	}
+
+	/* Both engines ran once for every line, thus the automatic selection
+	 * can use the measurements now. */
+	pat[4] = '0';
+	auto_prog = vim_regcomp(pat, RE_MAGIC);
+	assert(auto_prog != NULL);
+
+	printf("  %-14s %9.1f %9.1f %8ld  %s\n", bench_pats[i].where,
+		bt_usec / 1000.0, nfa_usec / 1000.0, bt_count,
+		auto_prog->engine == bt_prog->engine ? "bt" : "nfa");
+	bt_total += bt_usec;
+	nfa_total += nfa_usec;
+	vim_regfree(bt_prog);
+	vim_regfree(nfa_prog);
+	vim_regfree(auto_prog);
+    }
+    printf("  %-14s %9.1f %9.1f\n\n", "total",
+					  bt_total / 1000.0, nfa_total / 1000.0);
+
+    do_cmdline_cmd((char_u *)"redir => g:report");
+    do_cmdline_cmd((char_u *)"regexpprofile report");
+    do_cmdline_cmd((char_u *)"redir END");
+    report = get_var_value((char_u *)"g:report");
+    assert(report != NULL);
+    puts((char *)skipwhite(report));
+    return 0;
+}
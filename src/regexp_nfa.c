@@ -249,34 +249,128 @@ static int nfa_has_zend;
 /* NFA regexp \1 .. \9 encountered. */
 static int nfa_has_backref;
 
-#ifdef FEAT_SYN_HL
-/* NFA regexp has \z( ), set zsubexpr. */
-static int nfa_has_zsubexpr;
-#endif
-
-/* Number of sub expressions actually being used during execution. 1 if only
- * the whole match (subexpr 0) is used. */
-static int nfa_nsubexpr;
-
 static int *post_start;  /* holds the postfix form of r.e. */
 static int *post_end;
 static int *post_ptr;
 
-static int nstate;	/* Number of states in the NFA. Also used when
-			 * executing. */
+static int nstate;	/* Number of states in the NFA. */
 static int istate;	/* Index in the state vector, used in alloc_state() */
 
-/* If not NULL match must end at this position */
-static save_se_T *nfa_endp = NULL;
+/*
+ * Lazily built DFA.
+ *
+ * When a pattern has no back references, look-around or other items that
+ * depend on more than the current character, the NFA can be simulated as a
+ * DFA: a DFA state is the set of NFA states that are active at a position in
+ * the text.  DFA states and the transitions for single-byte characters are
+ * built when they are first needed and kept with the program, thus after a
+ * few lines the text is scanned with one table lookup per byte.
+ *
+ * The DFA only finds out whether there is a match in the line.  It is used
+ * before running the NFA, which is still needed to find the position of the
+ * match and the submatches.  Where the DFA can't be exact it assumes a match,
+ * so that it never rejects a line that the NFA would match.
+ *
+ * The callers of vim_regexec() and friends use the match position, thus the
+ * DFA can't give the answer by itself, not even without submatches: it does
+ * not know where the match that the NFA prefers starts.  A line that matches
+ * is scanned twice then, which made ":s///n" up to a third slower when every
+ * line matches.  Therefore, when the DFA rejects few of the lines it is tried
+ * on, it is not used for the next DFA_SKIP lines.
+ */
+
+/* Values for prog->dfa_flags. */
+#define NFA_DFA_OK	1	/* DFA can be used */
+#define NFA_DFA_WORD	2	/* uses 'iskeyword' for \<, \>, \k or \K */
+#define NFA_DFA_BOUND	4	/* uses \< or \> */
+
+#define DFA_MAX_STATES	128	/* max number of cached DFA states */
+#define DFA_HASH_SIZE	256	/* size of the hash table, power of two */
+#define DFA_MAX_FLUSH	3	/* give up after flushing this often in a line */
+#define DFA_PROBE	64	/* check how useful the DFA is after this many
+				   lines */
+#define DFA_SKIP	1024	/* lines to skip the DFA when it is not useful */
+
+/* Values for ds_next[] and returned by nfa_dfa_step() that are not a state
+ * index. */
+#define DFA_UNKNOWN	-1	/* transition not computed yet */
+#define DFA_MATCHED	-2	/* a match ends before the character */
+#define DFA_DEAD	-3	/* no match is possible */
+#define DFA_FULL	-4	/* out of memory, never stored */
+
+/* Values for ds_flags. */
+#define DS_BOL		1	/* at the start of the line */
+
+typedef struct
+{
+    short	ds_next[256];	/* next state for each byte or DFA_ value */
+    int		ds_hnext;	/* next state with the same hash or -1 */
+    int		ds_flags;	/* DS_ flags */
+    int		ds_prev;	/* class of the previous character */
+    int		ds_nstate;	/* number of entries in ds_state[] */
+    int		ds_state[1];	/* NFA state indexes, actually longer */
+} nfa_dstate_T;
+
+struct nfa_dfa_S
+{
+    int		dfa_ic;		/* reg_ic used for the states */
+#ifdef FEAT_MBYTE
+    int		dfa_icombine;	/* reg_icombine used for the states */
+    int		dfa_enc;	/* encoding used for the states */
+#endif
+    char_u	dfa_chartab[32]; /* reg_buf->b_chartab used for the states */
+    int		dfa_count;	/* number of states in dfa_states[] */
+    int		dfa_flushes;	/* number of times the states were flushed */
+    int		dfa_tries;	/* lines tried since the last check */
+    int		dfa_rejects;	/* lines without a match among them */
+    int		dfa_skip;	/* lines to skip before trying again */
+    nfa_dstate_T *dfa_states[DFA_MAX_STATES];
+    int		dfa_hash[DFA_HASH_SIZE]; /* first state for each hash value */
+
+    int		*dfa_mark;	/* dfa_markid for NFA states in dfa_set */
+    int		dfa_markid;
+    int		*dfa_work[2];	/* two sets of NFA state indexes */
+    int		*dfa_set;	/* set being built by nfa_dfa_add() */
+    int		dfa_setlen;	/* number of entries in dfa_set[] */
+
+    /* How nfa_dfa_add() handles assertions. */
+    int		dfa_resolve;	/* check them, otherwise add to dfa_set[] */
+    int		dfa_bol;	/* at the start of the line */
+    int		dfa_eol;	/* at the end of the line */
+    int		dfa_prev;	/* class of the previous character */
+    int		dfa_cur;	/* class of the current character */
+};
+
+/*
+ * Literal prefilter.
+ *
+ * When compiling, a set of strings is found of which at least one appears in
+ * every match, e.g. "Bar" for "foo.*Bar\d\+" and "xab" and "xcd" for
+ * "x\(ab\|cd\)".  Lines that contain none of them are skipped without
+ * running the DFA or the NFA, scan_find() looks for them many bytes at a
+ * time.  Only ASCII characters are used.
+ */
+
+/* Values for prog->lit_flags. */
+#define NFA_LIT_NL	1	/* pattern can match a line break */
+#define NFA_LIT_NOIC	2	/* can't be used when ignoring case */
 
-/* listid is global, so that it increases on recursive calls to
- * nfa_regmatch(), which means we don't have to clear the lastlist field of
- * all the states. */
-static int nfa_listid;
-static int nfa_alt_listid;
+#define NFA_LIT_LEN	16	/* max length of a literal plus one */
 
-/* 0 for first call to nfa_regmatch(), 1 for recursive call. */
-static int nfa_ll_index = 0;
+/* A set of strings found while going over the postfix form. */
+typedef struct
+{
+    int		ls_count;	/* number of strings, -1 when unknown */
+    char_u	ls_str[SCAN_MAX_LITS][NFA_LIT_LEN];
+} nfa_litset_T;
+
+typedef struct
+{
+    nfa_litset_T lit_exact;	/* all text the item can match */
+    nfa_litset_T lit_prefix;	/* every match starts with one */
+    nfa_litset_T lit_suffix;	/* every match ends with one */
+    nfa_litset_T lit_need;	/* every match contains one, or ls_count 0 */
+} nfa_lits_T;
 
 static int nfa_regcomp_start __ARGS((char_u *expr, int re_flags));
 static int nfa_get_reganch __ARGS((nfa_state_T *start, int depth));
@@ -303,16 +397,36 @@ static void st_error __ARGS((int *postfix, int *end, int *p));
 static int nfa_max_width __ARGS((nfa_state_T *startstate, int depth));
 static nfa_state_T *post2nfa __ARGS((int *postfix, int *end, int nfa_calc_size));
 static void nfa_postprocess __ARGS((nfa_regprog_T *prog));
+static int nfa_litset_add __ARGS((nfa_litset_T *set, char_u *s1, char_u *s2));
+static void nfa_litset_product __ARGS((nfa_litset_T *set, nfa_litset_T *set1, nfa_litset_T *set2));
+static void nfa_litset_union __ARGS((nfa_litset_T *set1, nfa_litset_T *set2));
+static int nfa_litset_score __ARGS((nfa_litset_T *set));
+static void nfa_lits_concat __ARGS((nfa_lits_T *lits1, nfa_lits_T *lits2));
+static void nfa_lits_or __ARGS((nfa_lits_T *lits1, nfa_lits_T *lits2));
+static void nfa_get_literals __ARGS((nfa_regprog_T *prog, int *postfix, int *end));
+static int nfa_prefilter __ARGS((regexec_T *rex, nfa_regprog_T *prog, colnr_T col));
 static int check_char_class __ARGS((int class, int c));
-static void nfa_save_listids __ARGS((nfa_regprog_T *prog, int *list));
-static void nfa_restore_listids __ARGS((nfa_regprog_T *prog, int *list));
+static int nfa_match_coll __ARGS((regexec_T *rex, nfa_state_T *start, int curc));
+static int nfa_match_class __ARGS((regexec_T *rex, int class, int curc, char_u *p));
+static int nfa_use_lastlist __ARGS((regexec_T *rex, nfa_regprog_T *prog, int level));
 static int nfa_re_num_cmp __ARGS((long_u val, int op, long_u pos));
-static long nfa_regtry __ARGS((nfa_regprog_T *prog, colnr_T col));
-static long nfa_regexec_both __ARGS((char_u *line, colnr_T col));
+static int nfa_dfa_flags __ARGS((nfa_regprog_T *prog));
+static void nfa_dfa_flush __ARGS((nfa_dfa_T *dfa));
+static void nfa_dfa_free __ARGS((nfa_dfa_T *dfa));
+static void nfa_dfa_newset __ARGS((nfa_dfa_T *dfa, nfa_regprog_T *prog, int w));
+static void nfa_dfa_add __ARGS((nfa_dfa_T *dfa, nfa_regprog_T *prog, nfa_state_T *state));
+static int nfa_dfa_char_match __ARGS((regexec_T *rex, nfa_state_T *state, int curc, int clen, char_u *p));
+static int nfa_dfa_compare __ARGS((const void *s1, const void *s2));
+static int nfa_dfa_lookup __ARGS((nfa_dfa_T *dfa, int flags, int prev));
+static int nfa_dfa_class __ARGS((regexec_T *rex, char_u *p));
+static int nfa_dfa_step __ARGS((regexec_T *rex, nfa_dfa_T *dfa, nfa_regprog_T *prog, nfa_dstate_T *ds, int curc, int clen, char_u *p));
+static int nfa_dfa_match __ARGS((regexec_T *rex, nfa_regprog_T *prog, colnr_T col));
+static long nfa_regtry __ARGS((regexec_T *rex, nfa_regprog_T *prog, colnr_T col));
+static long nfa_regexec_both __ARGS((regexec_T *rex, char_u *line, colnr_T col));
 static regprog_T *nfa_regcomp __ARGS((char_u *expr, int re_flags));
 static void nfa_regfree __ARGS((regprog_T *prog));
-static int nfa_regexec __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
-static long nfa_regexec_multi __ARGS((regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum, colnr_T col, proftime_T *tm));
+static int nfa_regexec __ARGS((regexec_T *rex, regmatch_T *rmp, char_u *line, colnr_T col));
+static long nfa_regexec_multi __ARGS((regexec_T *rex, regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum, colnr_T col, proftime_T *tm));
 static int match_follows __ARGS((nfa_state_T *startstate, int depth));
 static int failure_chance __ARGS((nfa_state_T *state, int depth));
 
@@ -2690,8 +2804,6 @@ alloc_state(c, out, out1)
     s->val  = 0;
 
     s->id   = istate;
-    s->lastlist[0] = 0;
-    s->lastlist[1] = 0;
 
     return s;
 }
@@ -3636,6 +3748,416 @@ theend:
 #undef PUSH
 }
 
+/*
+ * Add the concatenation of "s1" and "s2" to "set", unless it is already there.
+ * Returns FAIL when it doesn't fit, "set" is then unknown.
+ */
+    static int
+nfa_litset_add(set, s1, s2)
+    nfa_litset_T *set;
+    char_u	*s1;
+    char_u	*s2;
+{
+    size_t	len1 = STRLEN(s1);
+    int		i;
+
+    if (set->ls_count < 0)
+	return FAIL;
+    for (i = 0; i < set->ls_count; ++i)
+	if (STRNCMP(set->ls_str[i], s1, len1) == 0
+				   && STRCMP(set->ls_str[i] + len1, s2) == 0)
+	    return OK;
+    if (set->ls_count == SCAN_MAX_LITS || len1 + STRLEN(s2) >= NFA_LIT_LEN)
+    {
+	set->ls_count = -1;
+	return FAIL;
+    }
+    STRCPY(set->ls_str[set->ls_count], s1);
+    STRCAT(set->ls_str[set->ls_count], s2);
+    ++set->ls_count;
+    return OK;
+}
+
+/*
+ * Set "set" to each string of "set1" followed by each string of "set2".
+ */
+    static void
+nfa_litset_product(set, set1, set2)
+    nfa_litset_T *set;
+    nfa_litset_T *set1;
+    nfa_litset_T *set2;
+{
+    int		i;
+    int		j;
+
+    set->ls_count = 0;
+    if (set1->ls_count < 0 || set2->ls_count < 0)
+	set->ls_count = -1;
+    for (i = 0; i < set1->ls_count && set->ls_count >= 0; ++i)
+	for (j = 0; j < set2->ls_count && set->ls_count >= 0; ++j)
+	    (void)nfa_litset_add(set, set1->ls_str[i], set2->ls_str[j]);
+}
+
+/*
+ * Add the strings of "set2" to "set1".
+ */
+    static void
+nfa_litset_union(set1, set2)
+    nfa_litset_T *set1;
+    nfa_litset_T *set2;
+{
+    int		i;
+
+    if (set2->ls_count < 0)
+	set1->ls_count = -1;
+    for (i = 0; i < set2->ls_count; ++i)
+	if (nfa_litset_add(set1, set2->ls_str[i], (char_u *)"") == FAIL)
+	    break;
+}
+
+/*
+ * Return how useful "set" is to skip lines: higher when its shortest string is
+ * longer and when it has fewer strings.  Returns -1 when it can't be used.
+ */
+    static int
+nfa_litset_score(set)
+    nfa_litset_T *set;
+{
+    int		min = NFA_LIT_LEN;
+    int		i;
+
+    if (set->ls_count <= 0)
+	return -1;
+    for (i = 0; i < set->ls_count; ++i)
+	if ((int)STRLEN(set->ls_str[i]) < min)
+	    min = (int)STRLEN(set->ls_str[i]);
+    if (min == 0)
+	return -1;
+    return min * (SCAN_MAX_LITS + 1) - set->ls_count;
+}
+
+/*
+ * Combine "lits1" and "lits2" for "lits1" followed by "lits2" into "lits1".
+ */
+    static void
+nfa_lits_concat(lits1, lits2)
+    nfa_lits_T	*lits1;
+    nfa_lits_T	*lits2;
+{
+    nfa_litset_T set;
+    int		score;
+
+    /* The text where the two meet is in every match.  Prefer later strings
+     * when they are as good, the start is already checked with regstart. */
+    nfa_litset_product(&set, &lits1->lit_suffix, &lits2->lit_prefix);
+    score = nfa_litset_score(&lits1->lit_need);
+    if (nfa_litset_score(&lits2->lit_need) >= score
+				     && nfa_litset_score(&lits2->lit_need) > 0)
+    {
+	lits1->lit_need = lits2->lit_need;
+	score = nfa_litset_score(&lits1->lit_need);
+    }
+    if (nfa_litset_score(&set) >= score && nfa_litset_score(&set) > 0)
+	lits1->lit_need = set;
+
+    if (lits1->lit_exact.ls_count >= 0)
+    {
+	nfa_litset_product(&set, &lits1->lit_exact, &lits2->lit_prefix);
+	if (set.ls_count >= 0)
+	    lits1->lit_prefix = set;
+    }
+    if (lits2->lit_exact.ls_count >= 0)
+    {
+	nfa_litset_product(&set, &lits1->lit_suffix, &lits2->lit_exact);
+	lits1->lit_suffix = set.ls_count >= 0 ? set : lits2->lit_exact;
+    }
+    else
+	lits1->lit_suffix = lits2->lit_suffix;
+    nfa_litset_product(&set, &lits1->lit_exact, &lits2->lit_exact);
+    lits1->lit_exact = set;
+}
+
+/*
+ * Combine "lits1" and "lits2" for "lits1\|lits2" into "lits1".
+ */
+    static void
+nfa_lits_or(lits1, lits2)
+    nfa_lits_T	*lits1;
+    nfa_lits_T	*lits2;
+{
+    nfa_litset_union(&lits1->lit_exact, &lits2->lit_exact);
+    nfa_litset_union(&lits1->lit_prefix, &lits2->lit_prefix);
+    nfa_litset_union(&lits1->lit_suffix, &lits2->lit_suffix);
+
+    /* Either side may match, thus one of the needed strings of each. */
+    if (lits1->lit_need.ls_count <= 0 || lits2->lit_need.ls_count <= 0)
+	lits1->lit_need.ls_count = 0;
+    else
+	nfa_litset_union(&lits1->lit_need, &lits2->lit_need);
+}
+
+/*
+ * Find the strings for the literal prefilter.  Goes over the postfix form
+ * like post2nfa(), keeping for each item on the stack the text it matches
+ * exactly, if that is a few short strings, and the strings that every match
+ * of it contains.  Characters, collections, etc. that are not plain ASCII
+ * are unknown text.
+ */
+    static void
+nfa_get_literals(prog, postfix, end)
+    nfa_regprog_T *prog;
+    int		*postfix;
+    int		*end;
+{
+    static nfa_lits_T	unknown = {{-1}, {-1}, {-1}, {0}};
+    static nfa_lits_T	empty = {{1}, {1}, {1}, {0}}; /* empty strings */
+    nfa_lits_T	*stack;
+    nfa_lits_T	*sp;
+    nfa_litset_T *need;
+    int		*p;
+    int		c;
+    int		n;
+    int		i;
+    int		len = 0;
+    char_u	*s;
+
+    prog->nlits = 0;
+    prog->lit_flags = 0;
+    prog->lits[0] = NULL;
+
+    /* The stack gets as deep as in post2nfa(). */
+    stack = (nfa_lits_T *)lalloc(
+		     (long_u)((prog->nstate + 1) * sizeof(nfa_lits_T)), FALSE);
+    if (stack == NULL)
+	return;
+    sp = stack;
+
+    for (p = postfix; p < end; ++p)
+    {
+	switch (*p)
+	{
+	    case NFA_CONCAT:
+	    case NFA_OR:
+	    case NFA_RANGE:
+		if (sp - stack < 2)
+		    goto theend;
+		--sp;
+		if (*p == NFA_CONCAT)
+		    nfa_lits_concat(sp - 1, sp);
+		else if (*p == NFA_OR)
+		    nfa_lits_or(sp - 1, sp);
+		else
+		    sp[-1] = unknown;
+		break;
+
+	    case NFA_STAR:
+	    case NFA_STAR_NONGREEDY:
+	    case NFA_END_COLL:
+	    case NFA_END_NEG_COLL:
+		if (sp == stack)
+		    goto theend;
+		sp[-1] = unknown;
+		break;
+
+	    case NFA_QUEST:
+	    case NFA_QUEST_NONGREEDY:
+		/* The same text or nothing. */
+		if (sp == stack)
+		    goto theend;
+		nfa_litset_union(&sp[-1].lit_exact, &empty.lit_exact);
+		nfa_litset_union(&sp[-1].lit_prefix, &empty.lit_prefix);
+		nfa_litset_union(&sp[-1].lit_suffix, &empty.lit_suffix);
+		sp[-1].lit_need.ls_count = 0;
+		break;
+
+	    case NFA_OPT_CHARS:
+		n = *++p;
+		if (sp - stack < n)
+		    goto theend;
+		sp -= n;
+		*sp++ = unknown;
+		break;
+
+	    case NFA_PREV_ATOM_JUST_BEFORE:
+	    case NFA_PREV_ATOM_JUST_BEFORE_NEG:
+		++p;
+		/* FALLTHROUGH */
+	    case NFA_PREV_ATOM_NO_WIDTH:
+	    case NFA_PREV_ATOM_NO_WIDTH_NEG:
+		/* Zero width, the text may be before the match. */
+		if (sp == stack)
+		    goto theend;
+		sp[-1] = empty;
+		break;
+
+	    case NFA_PREV_ATOM_LIKE_PATTERN:
+		if (sp == stack)
+		    goto theend;
+		sp[-1].lit_exact.ls_count = -1;
+		break;
+
+#ifdef FEAT_MBYTE
+	    case NFA_COMPOSING:
+		if (sp > stack)
+		    --sp;
+		*sp++ = unknown;
+		break;
+#endif
+
+	    case NFA_MOPEN:
+	    case NFA_MOPEN1:
+	    case NFA_MOPEN2:
+	    case NFA_MOPEN3:
+	    case NFA_MOPEN4:
+	    case NFA_MOPEN5:
+	    case NFA_MOPEN6:
+	    case NFA_MOPEN7:
+	    case NFA_MOPEN8:
+	    case NFA_MOPEN9:
+#ifdef FEAT_SYN_HL
+	    case NFA_ZOPEN:
+	    case NFA_ZOPEN1:
+	    case NFA_ZOPEN2:
+	    case NFA_ZOPEN3:
+	    case NFA_ZOPEN4:
+	    case NFA_ZOPEN5:
+	    case NFA_ZOPEN6:
+	    case NFA_ZOPEN7:
+	    case NFA_ZOPEN8:
+	    case NFA_ZOPEN9:
+#endif
+	    case NFA_NOPEN:
+		/* A group matches the same as what's inside, post2nfa() turns
+		 * an empty stack into an empty group. */
+		if (sp == stack)
+		    *sp++ = empty;
+		break;
+
+	    case NFA_LNUM:
+	    case NFA_LNUM_GT:
+	    case NFA_LNUM_LT:
+	    case NFA_VCOL:
+	    case NFA_VCOL_GT:
+	    case NFA_VCOL_LT:
+	    case NFA_COL:
+	    case NFA_COL_GT:
+	    case NFA_COL_LT:
+	    case NFA_MARK:
+	    case NFA_MARK_GT:
+	    case NFA_MARK_LT:
+		++p;
+		*sp++ = empty;
+		break;
+
+	    case NFA_EMPTY:
+	    case NFA_BOL:
+	    case NFA_EOL:
+	    case NFA_BOW:
+	    case NFA_EOW:
+	    case NFA_BOF:
+	    case NFA_EOF:
+	    case NFA_ZSTART:
+	    case NFA_ZEND:
+	    case NFA_CURSOR:
+	    case NFA_VISUAL:
+		*sp++ = empty;
+		break;
+
+	    default:
+		/* Back references, character classes, the start of a
+		 * collection, etc. are unknown. */
+		c = *p;
+		if (c == TAB || (c >= ' ' && c < 0x7f))
+		{
+		    sp->lit_exact.ls_count = 1;
+		    sp->lit_exact.ls_str[0][0] = c;
+		    sp->lit_exact.ls_str[0][1] = NUL;
+		    sp->lit_prefix = sp->lit_exact;
+		    sp->lit_suffix = sp->lit_exact;
+		    sp->lit_need = sp->lit_exact;
+		    ++sp;
+		}
+		else
+		    *sp++ = unknown;
+		break;
+	}
+    }
+    if (sp != stack + 1)
+	goto theend;
+
+    /* Not useful when it's just the first character, skip_to_start() already
+     * looks for it. */
+    need = &stack[0].lit_need;
+    if (nfa_litset_score(&stack[0].lit_exact) > nfa_litset_score(need))
+	need = &stack[0].lit_exact;
+    if (need->ls_count <= 0 || (need->ls_count == 1
+		  && need->ls_str[0][1] == NUL
+		  && need->ls_str[0][0] == prog->regstart))
+	goto theend;
+
+    for (i = 0; i < need->ls_count; ++i)
+	len += (int)STRLEN(need->ls_str[i]) + 1;
+    s = alloc(len);
+    if (s == NULL)
+	goto theend;
+    for (i = 0; i < need->ls_count; ++i)
+    {
+	STRCPY(s, need->ls_str[i]);
+	prog->lits[i] = s;
+	prog->lit_lens[i] = (int)STRLEN(s);
+	if (vim_strpbrk(s, (char_u *)"iIkK") != NULL)
+	    prog->lit_flags |= NFA_LIT_NOIC;
+	s += prog->lit_lens[i] + 1;
+    }
+    prog->nlits = need->ls_count;
+
+    for (i = 0; i < prog->nstate; ++i)
+    {
+	c = prog->state[i].c;
+	if (c == NFA_NEWL || (c >= NFA_FIRST_NL && c <= NFA_LAST_NL))
+	    prog->lit_flags |= NFA_LIT_NL;
+    }
+
+theend:
+    vim_free(stack);
+}
+
+/*
+ * Return FALSE when the text from "col" to the end of the line contains none
+ * of the literals, thus a match can't start in this line.
+ */
+    static int
+nfa_prefilter(rex, prog, col)
+    regexec_T	    *rex;
+    nfa_regprog_T   *prog;
+    colnr_T	    col;
+{
+    char_u	*p;
+
+    if (prog->nlits == 0)
+	return TRUE;
+    /* The literal may be in a following line. */
+    if (REG_MULTI && (prog->lit_flags & NFA_LIT_NL))
+	return TRUE;
+#ifdef FEAT_MBYTE
+    if (rex->reg_icombine)
+	return TRUE;
+#endif
+    if (rex->reg_ic)
+    {
+#ifdef FEAT_MBYTE
+	/* Only for UTF-8 is it known that only the Kelvin sign and the dotted
+	 * I fold to ASCII, these are for "k" and "i". */
+	if (!enc_utf8 || (prog->lit_flags & NFA_LIT_NOIC))
+#endif
+	    return TRUE;
+    }
+
+    p = rex->line + col;
+    return scan_find(p, (long)STRLEN(p), prog->lits, prog->lit_lens,
+					     prog->nlits, rex->reg_ic) >= 0;
+}
+
 /*
  * After building the NFA program, inspect it to add optimization hints.
  */
@@ -3767,23 +4289,25 @@ typedef struct
 } nfa_list_T;
 
 #ifdef ENABLE_LOG
-static void log_subsexpr __ARGS((regsubs_T *subs));
-static void log_subexpr __ARGS((regsub_T *sub));
-static char *pim_info __ARGS((nfa_pim_T *pim));
+static void log_subsexpr __ARGS((regexec_T *rex, regsubs_T *subs));
+static void log_subexpr __ARGS((regexec_T *rex, regsub_T *sub));
+static char *pim_info __ARGS((regexec_T *rex, nfa_pim_T *pim));
 
     static void
-log_subsexpr(subs)
+log_subsexpr(rex, subs)
+    regexec_T *rex;
     regsubs_T *subs;
 {
-    log_subexpr(&subs->norm);
+    log_subexpr(rex, &subs->norm);
 # ifdef FEAT_SYN_HL
-    if (nfa_has_zsubexpr)
-	log_subexpr(&subs->synt);
+    if (rex->nfa_has_zsubexpr)
+	log_subexpr(rex, &subs->synt);
 # endif
 }
 
     static void
-log_subexpr(sub)
+log_subexpr(rex, sub)
+    regexec_T *rex;
     regsub_T *sub;
 {
     int j;
@@ -3809,7 +4333,8 @@ log_subexpr(sub)
 }
 
     static char *
-pim_info(pim)
+pim_info(rex, pim)
+    regexec_T *rex;
     nfa_pim_T *pim;
 {
     static char buf[30];
@@ -3819,57 +4344,56 @@ pim_info(pim)
     else
     {
 	sprintf(buf, " PIM col %d", REG_MULTI ? (int)pim->end.pos.col
-		: (int)(pim->end.ptr - reginput));
+		: (int)(pim->end.ptr - rex->input));
     }
     return buf;
 }
 
 #endif
 
-/* Used during execution: whether a match has been found. */
-static int nfa_match;
-
-static void copy_pim __ARGS((nfa_pim_T *to, nfa_pim_T *from));
-static void clear_sub __ARGS((regsub_T *sub));
-static void copy_sub __ARGS((regsub_T *to, regsub_T *from));
-static void copy_sub_off __ARGS((regsub_T *to, regsub_T *from));
-static void copy_ze_off __ARGS((regsub_T *to, regsub_T *from));
-static int sub_equal __ARGS((regsub_T *sub1, regsub_T *sub2));
-static int match_backref __ARGS((regsub_T *sub, int subidx, int *bytelen));
-static int has_state_with_pos __ARGS((nfa_list_T *l, nfa_state_T *state, regsubs_T *subs, nfa_pim_T *pim));
-static int pim_equal __ARGS((nfa_pim_T *one, nfa_pim_T *two));
-static int state_in_list __ARGS((nfa_list_T *l, nfa_state_T *state, regsubs_T *subs));
-static regsubs_T *addstate __ARGS((nfa_list_T *l, nfa_state_T *state, regsubs_T *subs_arg, nfa_pim_T *pim, int off));
-static void addstate_here __ARGS((nfa_list_T *l, nfa_state_T *state, regsubs_T *subs, nfa_pim_T *pim, int *ip));
+static void copy_pim __ARGS((regexec_T *rex, nfa_pim_T *to, nfa_pim_T *from));
+static void clear_sub __ARGS((regexec_T *rex, regsub_T *sub));
+static void copy_sub __ARGS((regexec_T *rex, regsub_T *to, regsub_T *from));
+static void copy_sub_off __ARGS((regexec_T *rex, regsub_T *to, regsub_T *from));
+static void copy_ze_off __ARGS((regexec_T *rex, regsub_T *to, regsub_T *from));
+static int sub_equal __ARGS((regexec_T *rex, regsub_T *sub1, regsub_T *sub2));
+static int match_backref __ARGS((regexec_T *rex, regsub_T *sub, int subidx, int *bytelen));
+static int has_state_with_pos __ARGS((regexec_T *rex, nfa_list_T *l, nfa_state_T *state, regsubs_T *subs, nfa_pim_T *pim));
+static int pim_equal __ARGS((regexec_T *rex, nfa_pim_T *one, nfa_pim_T *two));
+static int state_in_list __ARGS((regexec_T *rex, nfa_list_T *l, nfa_state_T *state, regsubs_T *subs));
+static regsubs_T *addstate __ARGS((regexec_T *rex, nfa_list_T *l, nfa_state_T *state, regsubs_T *subs_arg, nfa_pim_T *pim, int off));
+static void addstate_here __ARGS((regexec_T *rex, nfa_list_T *l, nfa_state_T *state, regsubs_T *subs, nfa_pim_T *pim, int *ip));
 
 /*
  * Copy postponed invisible match info from "from" to "to".
  */
     static void
-copy_pim(to, from)
+copy_pim(rex, to, from)
+    regexec_T *rex;
     nfa_pim_T *to;
     nfa_pim_T *from;
 {
     to->result = from->result;
     to->state = from->state;
-    copy_sub(&to->subs.norm, &from->subs.norm);
+    copy_sub(rex, &to->subs.norm, &from->subs.norm);
 #ifdef FEAT_SYN_HL
-    if (nfa_has_zsubexpr)
-	copy_sub(&to->subs.synt, &from->subs.synt);
+    if (rex->nfa_has_zsubexpr)
+	copy_sub(rex, &to->subs.synt, &from->subs.synt);
 #endif
     to->end = from->end;
 }
 
     static void
-clear_sub(sub)
+clear_sub(rex, sub)
+    regexec_T *rex;
     regsub_T *sub;
 {
     if (REG_MULTI)
 	/* Use 0xff to set lnum to -1 */
 	vim_memset(sub->list.multi, 0xff,
-				      sizeof(struct multipos) * nfa_nsubexpr);
+				      sizeof(struct multipos) * rex->nfa_nsubexpr);
     else
-	vim_memset(sub->list.line, 0, sizeof(struct linepos) * nfa_nsubexpr);
+	vim_memset(sub->list.line, 0, sizeof(struct linepos) * rex->nfa_nsubexpr);
     sub->in_use = 0;
 }
 
@@ -3877,7 +4401,8 @@ clear_sub(sub)
  * Copy the submatches from "from" to "to".
  */
     static void
-copy_sub(to, from)
+copy_sub(rex, to, from)
+    regexec_T	*rex;
     regsub_T	*to;
     regsub_T	*from;
 {
@@ -3900,7 +4425,8 @@ copy_sub(to, from)
  * Like copy_sub() but exclude the main match.
  */
     static void
-copy_sub_off(to, from)
+copy_sub_off(rex, to, from)
+    regexec_T	*rex;
     regsub_T	*to;
     regsub_T	*from;
 {
@@ -3924,11 +4450,12 @@ copy_sub_off(to, from)
  * Like copy_sub() but only do the end of the main match if \ze is present.
  */
     static void
-copy_ze_off(to, from)
+copy_ze_off(rex, to, from)
+    regexec_T	*rex;
     regsub_T	*to;
     regsub_T	*from;
 {
-    if (nfa_has_zend)
+    if (rex->nfa_has_zend)
     {
 	if (REG_MULTI)
 	{
@@ -3947,7 +4474,8 @@ copy_ze_off(to, from)
  * Return TRUE if "sub1" and "sub2" have the same start positions.
  */
     static int
-sub_equal(sub1, sub2)
+sub_equal(rex, sub1, sub2)
+    regexec_T	*rex;
     regsub_T	*sub1;
     regsub_T	*sub2;
 {
@@ -4000,7 +4528,8 @@ sub_equal(sub1, sub2)
 
 #ifdef ENABLE_LOG
     static void
-report_state(char *action,
+report_state(regexec_T *rex,
+	     char *action,
 	     regsub_T *sub,
 	     nfa_state_T *state,
 	     int lid,
@@ -4013,11 +4542,11 @@ report_state(char *action,
     else if (REG_MULTI)
 	col = sub->list.multi[0].start.col;
     else
-	col = (int)(sub->list.line[0].start - regline);
+	col = (int)(sub->list.line[0].start - rex->line);
     nfa_set_code(state->c);
     fprintf(log_fd, "> %s state %d to list %d. char %d: %s (start col %d)%s\n",
 	    action, abs(state->id), lid, state->c, code, col,
-	    pim_info(pim));
+	    pim_info(rex, pim));
 }
 #endif
 
@@ -4026,7 +4555,8 @@ report_state(char *action,
  * positions as "subs".
  */
     static int
-has_state_with_pos(l, state, subs, pim)
+has_state_with_pos(rex, l, state, subs, pim)
+    regexec_T		*rex;
     nfa_list_T		*l;	/* runtime state list */
     nfa_state_T		*state;	/* state to update */
     regsubs_T		*subs;	/* pointers to subexpressions */
@@ -4039,12 +4569,12 @@ has_state_with_pos(l, state, subs, pim)
     {
 	thread = &l->t[i];
 	if (thread->state->id == state->id
-		&& sub_equal(&thread->subs.norm, &subs->norm)
+		&& sub_equal(rex, &thread->subs.norm, &subs->norm)
 #ifdef FEAT_SYN_HL
-		&& (!nfa_has_zsubexpr
-				|| sub_equal(&thread->subs.synt, &subs->synt))
+		&& (!rex->nfa_has_zsubexpr
+				|| sub_equal(rex, &thread->subs.synt, &subs->synt))
 #endif
-		&& pim_equal(&thread->pim, pim))
+		&& pim_equal(rex, &thread->pim, pim))
 	    return TRUE;
     }
     return FALSE;
@@ -4055,7 +4585,8 @@ has_state_with_pos(l, state, subs, pim)
  * set.
  */
     static int
-pim_equal(one, two)
+pim_equal(rex, one, two)
+    regexec_T *rex;
     nfa_pim_T *one;
     nfa_pim_T *two;
 {
@@ -4176,14 +4707,15 @@ match_follows(startstate, depth)
  * Return TRUE if "state" is already in list "l".
  */
     static int
-state_in_list(l, state, subs)
+state_in_list(rex, l, state, subs)
+    regexec_T		*rex;
     nfa_list_T		*l;	/* runtime state list */
     nfa_state_T		*state;	/* state to update */
     regsubs_T		*subs;	/* pointers to subexpressions */
 {
-    if (state->lastlist[nfa_ll_index] == l->id)
+    if (rex->nfa_lastlist[state->id] == l->id)
     {
-	if (!nfa_has_backref || has_state_with_pos(l, state, subs, NULL))
+	if (!rex->nfa_has_backref || has_state_with_pos(rex, l, state, subs, NULL))
 	    return TRUE;
     }
     return FALSE;
@@ -4195,7 +4727,8 @@ state_in_list(l, state, subs)
  */
 
     static regsubs_T *
-addstate(l, state, subs_arg, pim, off)
+addstate(rex, l, state, subs_arg, pim, off)
+    regexec_T		*rex;
     nfa_list_T		*l;	    /* runtime state list */
     nfa_state_T		*state;	    /* state to update */
     regsubs_T		*subs_arg;  /* pointers to subexpressions */
@@ -4215,6 +4748,9 @@ addstate(l, state, subs_arg, pim, off)
     int			did_print = FALSE;
 #endif
 
+#ifdef FEAT_PROFILE
+    ++rex->prof_addstate;
+#endif
     switch (state->c)
     {
 	case NFA_NCLOSE:
@@ -4253,11 +4789,11 @@ addstate(l, state, subs_arg, pim, off)
 	    /* "^" won't match past end-of-line, don't bother trying.
 	     * Except when at the end of the line, or when we are going to the
 	     * next line for a look-behind match. */
-	    if (reginput > regline
-		    && *reginput != NUL
-		    && (nfa_endp == NULL
+	    if (rex->input > rex->line
+		    && *rex->input != NUL
+		    && (rex->nfa_endp == NULL
 			|| !REG_MULTI
-			|| reglnum == nfa_endp->se_u.pos.lnum))
+			|| rex->lnum == rex->nfa_endp->se_u.pos.lnum))
 		goto skip_add;
 	    /* FALLTHROUGH */
 
@@ -4289,12 +4825,12 @@ addstate(l, state, subs_arg, pim, off)
 	     * endless loop for "\(\)*" */
 
 	default:
-	    if (state->lastlist[nfa_ll_index] == l->id && state->c != NFA_SKIP)
+	    if (rex->nfa_lastlist[state->id] == l->id && state->c != NFA_SKIP)
 	    {
 		/* This state is already in the list, don't add it again,
 		 * unless it is an MOPEN that is used for a backreference or
 		 * when there is a PIM. */
-		if (!nfa_has_backref && pim == NULL && !l->has_pim)
+		if (!rex->nfa_has_backref && pim == NULL && !l->has_pim)
 		{
 skip_add:
 #ifdef ENABLE_LOG
@@ -4307,7 +4843,7 @@ skip_add:
 
 		/* Do not add the state again when it exists with the same
 		 * positions. */
-		if (has_state_with_pos(l, state, subs, pim))
+		if (has_state_with_pos(rex, l, state, subs, pim))
 		    goto skip_add;
 	    }
 
@@ -4321,10 +4857,10 @@ skip_add:
 		{
 		    /* "subs" may point into the current array, need to make a
 		     * copy before it becomes invalid. */
-		    copy_sub(&temp_subs.norm, &subs->norm);
+		    copy_sub(rex, &temp_subs.norm, &subs->norm);
 #ifdef FEAT_SYN_HL
-		    if (nfa_has_zsubexpr)
-			copy_sub(&temp_subs.synt, &subs->synt);
+		    if (rex->nfa_has_zsubexpr)
+			copy_sub(rex, &temp_subs.synt, &subs->synt);
 #endif
 		    subs = &temp_subs;
 		}
@@ -4334,47 +4870,47 @@ skip_add:
 	    }
 
 	    /* add the state to the list */
-	    state->lastlist[nfa_ll_index] = l->id;
+	    rex->nfa_lastlist[state->id] = l->id;
 	    thread = &l->t[l->n++];
 	    thread->state = state;
 	    if (pim == NULL)
 		thread->pim.result = NFA_PIM_UNUSED;
 	    else
 	    {
-		copy_pim(&thread->pim, pim);
+		copy_pim(rex, &thread->pim, pim);
 		l->has_pim = TRUE;
 	    }
-	    copy_sub(&thread->subs.norm, &subs->norm);
+	    copy_sub(rex, &thread->subs.norm, &subs->norm);
 #ifdef FEAT_SYN_HL
-	    if (nfa_has_zsubexpr)
-		copy_sub(&thread->subs.synt, &subs->synt);
+	    if (rex->nfa_has_zsubexpr)
+		copy_sub(rex, &thread->subs.synt, &subs->synt);
 #endif
 #ifdef ENABLE_LOG
-	    report_state("Adding", &thread->subs.norm, state, l->id, pim);
+	    report_state(rex, "Adding", &thread->subs.norm, state, l->id, pim);
 	    did_print = TRUE;
 #endif
     }
 
 #ifdef ENABLE_LOG
     if (!did_print)
-	report_state("Processing", &subs->norm, state, l->id, pim);
+	report_state(rex, "Processing", &subs->norm, state, l->id, pim);
 #endif
     switch (state->c)
     {
 	case NFA_MATCH:
-	    nfa_match = TRUE;
+	    rex->nfa_match = TRUE;
 	    break;
 
 	case NFA_SPLIT:
 	    /* order matters here */
-	    subs = addstate(l, state->out, subs, pim, off);
-	    subs = addstate(l, state->out1, subs, pim, off);
+	    subs = addstate(rex, l, state->out, subs, pim, off);
+	    subs = addstate(rex, l, state->out1, subs, pim, off);
 	    break;
 
 	case NFA_EMPTY:
 	case NFA_NOPEN:
 	case NFA_NCLOSE:
-	    subs = addstate(l, state->out, subs, pim, off);
+	    subs = addstate(rex, l, state->out, subs, pim, off);
 	    break;
 
 	case NFA_MOPEN:
@@ -4444,14 +4980,14 @@ skip_add:
 		}
 		if (off == -1)
 		{
-		    sub->list.multi[subidx].start.lnum = reglnum + 1;
+		    sub->list.multi[subidx].start.lnum = rex->lnum + 1;
 		    sub->list.multi[subidx].start.col = 0;
 		}
 		else
 		{
-		    sub->list.multi[subidx].start.lnum = reglnum;
+		    sub->list.multi[subidx].start.lnum = rex->lnum;
 		    sub->list.multi[subidx].start.col =
-					  (colnr_T)(reginput - regline + off);
+					  (colnr_T)(rex->input - rex->line + off);
 		}
 	    }
 	    else
@@ -4471,10 +5007,10 @@ skip_add:
 		    }
 		    sub->in_use = subidx + 1;
 		}
-		sub->list.line[subidx].start = reginput + off;
+		sub->list.line[subidx].start = rex->input + off;
 	    }
 
-	    subs = addstate(l, state->out, subs, pim, off);
+	    subs = addstate(rex, l, state->out, subs, pim, off);
 	    /* "subs" may have changed, need to set "sub" again */
 #ifdef FEAT_SYN_HL
 	    if (state->c >= NFA_ZOPEN && state->c <= NFA_ZOPEN9)
@@ -4495,12 +5031,12 @@ skip_add:
 	    break;
 
 	case NFA_MCLOSE:
-	    if (nfa_has_zend && (REG_MULTI
+	    if (rex->nfa_has_zend && (REG_MULTI
 			? subs->norm.list.multi[0].end.lnum >= 0
 			: subs->norm.list.line[0].end != NULL))
 	    {
 		/* Do not overwrite the position set by \ze. */
-		subs = addstate(l, state->out, subs, pim, off);
+		subs = addstate(rex, l, state->out, subs, pim, off);
 		break;
 	    }
 	case NFA_MCLOSE1:
@@ -4553,14 +5089,14 @@ skip_add:
 		save_lpos = sub->list.multi[subidx].end;
 		if (off == -1)
 		{
-		    sub->list.multi[subidx].end.lnum = reglnum + 1;
+		    sub->list.multi[subidx].end.lnum = rex->lnum + 1;
 		    sub->list.multi[subidx].end.col = 0;
 		}
 		else
 		{
-		    sub->list.multi[subidx].end.lnum = reglnum;
+		    sub->list.multi[subidx].end.lnum = rex->lnum;
 		    sub->list.multi[subidx].end.col =
-					  (colnr_T)(reginput - regline + off);
+					  (colnr_T)(rex->input - rex->line + off);
 		}
 		/* avoid compiler warnings */
 		save_ptr = NULL;
@@ -4568,13 +5104,13 @@ skip_add:
 	    else
 	    {
 		save_ptr = sub->list.line[subidx].end;
-		sub->list.line[subidx].end = reginput + off;
+		sub->list.line[subidx].end = rex->input + off;
 		/* avoid compiler warnings */
 		save_lpos.lnum = 0;
 		save_lpos.col = 0;
 	    }
 
-	    subs = addstate(l, state->out, subs, pim, off);
+	    subs = addstate(rex, l, state->out, subs, pim, off);
 	    /* "subs" may have changed, need to set "sub" again */
 #ifdef FEAT_SYN_HL
 	    if (state->c >= NFA_ZCLOSE && state->c <= NFA_ZCLOSE9)
@@ -4600,7 +5136,8 @@ skip_add:
  * matters for alternatives.
  */
     static void
-addstate_here(l, state, subs, pim, ip)
+addstate_here(rex, l, state, subs, pim, ip)
+    regexec_T		*rex;
     nfa_list_T		*l;	/* runtime state list */
     nfa_state_T		*state;	/* state to update */
     regsubs_T		*subs;	/* pointers to subexpressions */
@@ -4612,7 +5149,7 @@ addstate_here(l, state, subs, pim, ip)
     int listidx = *ip;
 
     /* first add the state(s) at the end, so that we know how many there are */
-    addstate(l, state, subs, pim, 0);
+    addstate(rex, l, state, subs, pim, 0);
 
     /* when "*ip" was at the end of the list, nothing to do */
     if (listidx + 1 == tlen)
@@ -4751,37 +5288,173 @@ check_char_class(class, c)
 }
 
 /*
- * Check for a match with subexpression "subidx".
+ * Check character "curc" against the collection that starts at "start", a
+ * NFA_START_COLL or NFA_START_NEG_COLL state.
  * Return TRUE if it matches.
  */
     static int
-match_backref(sub, subidx, bytelen)
-    regsub_T	*sub;	    /* pointers to subexpressions */
-    int		subidx;
-    int		*bytelen;   /* out: length of match in bytes */
+nfa_match_coll(rex, start, curc)
+    regexec_T	*rex;
+    nfa_state_T	*start;
+    int		curc;
 {
-    int		len;
+    nfa_state_T	*state;
+    int		result_if_matched;
+    int		c1, c2;
 
-    if (sub->in_use <= subidx)
-    {
-retempty:
-	/* backref was not set, match an empty string */
-	*bytelen = 0;
-	return TRUE;
-    }
+    /* Never match EOL. If it's part of the collection it is added
+     * as a separate state with an OR. */
+    if (curc == NUL)
+	return FALSE;
 
-    if (REG_MULTI)
+    state = start->out;
+    result_if_matched = (start->c == NFA_START_COLL);
+    for (;;)
     {
-	if (sub->list.multi[subidx].start.lnum < 0
-				       || sub->list.multi[subidx].end.lnum < 0)
-	    goto retempty;
-	if (sub->list.multi[subidx].start.lnum == reglnum
-			       && sub->list.multi[subidx].end.lnum == reglnum)
+	if (state->c == NFA_END_COLL)
+	    return !result_if_matched;
+	if (state->c == NFA_RANGE_MIN)
+	{
+	    c1 = state->val;
+	    state = state->out; /* advance to NFA_RANGE_MAX */
+	    c2 = state->val;
+#ifdef ENABLE_LOG
+	    if (log_fd != NULL)
+		fprintf(log_fd, "NFA_RANGE_MIN curc=%d c1=%d c2=%d\n",
+								curc, c1, c2);
+#endif
+	    if (curc >= c1 && curc <= c2)
+		return result_if_matched;
+	    if (rex->reg_ic)
+	    {
+		int curc_low = MB_TOLOWER(curc);
+
+		for ( ; c1 <= c2; ++c1)
+		    if (MB_TOLOWER(c1) == curc_low)
+			return result_if_matched;
+	    }
+	}
+	else if (state->c < 0 ? check_char_class(state->c, curc)
+		    : (curc == state->c
+			|| (rex->reg_ic && MB_TOLOWER(curc) == MB_TOLOWER(state->c))))
+	    return result_if_matched;
+	state = state->out;
+    }
+}
+
+/*
+ * Check character "curc" at "p" against character class "class", one of
+ * NFA_IDENT - NFA_NUPPER_IC.
+ * Return TRUE if it matches.
+ */
+    static int
+nfa_match_class(rex, class, curc, p)
+    regexec_T	*rex;
+    int		class;
+    int		curc;
+    char_u	*p;
+{
+    switch (class)
+    {
+	case NFA_IDENT:	/*  \i	*/
+	    return vim_isIDc(curc);
+	case NFA_SIDENT:	/*  \I	*/
+	    return !VIM_ISDIGIT(curc) && vim_isIDc(curc);
+	case NFA_KWORD:	/*  \k	*/
+	    return vim_iswordp_buf(p, rex->reg_buf);
+	case NFA_SKWORD:	/*  \K	*/
+	    return !VIM_ISDIGIT(curc) && vim_iswordp_buf(p, rex->reg_buf);
+	case NFA_FNAME:	/*  \f	*/
+	    return vim_isfilec(curc);
+	case NFA_SFNAME:	/*  \F	*/
+	    return !VIM_ISDIGIT(curc) && vim_isfilec(curc);
+	case NFA_PRINT:	/*  \p	*/
+	    return vim_isprintc(PTR2CHAR(p));
+	case NFA_SPRINT:	/*  \P	*/
+	    return !VIM_ISDIGIT(curc) && vim_isprintc(PTR2CHAR(p));
+	case NFA_WHITE:	/*  \s	*/
+	    return vim_iswhite(curc);
+	case NFA_NWHITE:	/*  \S	*/
+	    return curc != NUL && !vim_iswhite(curc);
+	case NFA_DIGIT:	/*  \d	*/
+	    return ri_digit(curc);
+	case NFA_NDIGIT:	/*  \D	*/
+	    return curc != NUL && !ri_digit(curc);
+	case NFA_HEX:	/*  \x	*/
+	    return ri_hex(curc);
+	case NFA_NHEX:	/*  \X	*/
+	    return curc != NUL && !ri_hex(curc);
+	case NFA_OCTAL:	/*  \o	*/
+	    return ri_octal(curc);
+	case NFA_NOCTAL:	/*  \O	*/
+	    return curc != NUL && !ri_octal(curc);
+	case NFA_WORD:	/*  \w	*/
+	    return ri_word(curc);
+	case NFA_NWORD:	/*  \W	*/
+	    return curc != NUL && !ri_word(curc);
+	case NFA_HEAD:	/*  \h	*/
+	    return ri_head(curc);
+	case NFA_NHEAD:	/*  \H	*/
+	    return curc != NUL && !ri_head(curc);
+	case NFA_ALPHA:	/*  \a	*/
+	    return ri_alpha(curc);
+	case NFA_NALPHA:	/*  \A	*/
+	    return curc != NUL && !ri_alpha(curc);
+	case NFA_LOWER:	/*  \l	*/
+	    return ri_lower(curc);
+	case NFA_NLOWER:	/*  \L	*/
+	    return curc != NUL && !ri_lower(curc);
+	case NFA_UPPER:	/*  \u	*/
+	    return ri_upper(curc);
+	case NFA_NUPPER:	/*  \U	*/
+	    return curc != NUL && !ri_upper(curc);
+	case NFA_LOWER_IC:	/* [a-z] */
+	    return ri_lower(curc) || (rex->reg_ic && ri_upper(curc));
+	case NFA_NLOWER_IC:	/* [^a-z] */
+	    return curc != NUL
+			  && !(ri_lower(curc) || (rex->reg_ic && ri_upper(curc)));
+	case NFA_UPPER_IC:	/* [A-Z] */
+	    return ri_upper(curc) || (rex->reg_ic && ri_lower(curc));
+	case NFA_NUPPER_IC:	/* ^[A-Z] */
+	    return curc != NUL
+			  && !(ri_upper(curc) || (rex->reg_ic && ri_lower(curc)));
+    }
+    return FALSE;
+}
+
+/*
+ * Check for a match with subexpression "subidx".
+ * Return TRUE if it matches.
+ */
+    static int
+match_backref(rex, sub, subidx, bytelen)
+    regexec_T	*rex;
+    regsub_T	*sub;	    /* pointers to subexpressions */
+    int		subidx;
+    int		*bytelen;   /* out: length of match in bytes */
+{
+    int		len;
+
+    if (sub->in_use <= subidx)
+    {
+retempty:
+	/* backref was not set, match an empty string */
+	*bytelen = 0;
+	return TRUE;
+    }
+
+    if (REG_MULTI)
+    {
+	if (sub->list.multi[subidx].start.lnum < 0
+				       || sub->list.multi[subidx].end.lnum < 0)
+	    goto retempty;
+	if (sub->list.multi[subidx].start.lnum == rex->lnum
+			       && sub->list.multi[subidx].end.lnum == rex->lnum)
 	{
 	    len = sub->list.multi[subidx].end.col
 					  - sub->list.multi[subidx].start.col;
-	    if (cstrncmp(regline + sub->list.multi[subidx].start.col,
-							 reginput, &len) == 0)
+	    if (cstrncmp(rex, rex->line + sub->list.multi[subidx].start.col,
+							 rex->input, &len) == 0)
 	    {
 		*bytelen = len;
 		return TRUE;
@@ -4789,7 +5462,7 @@ retempty:
 	}
 	else
 	{
-	    if (match_with_backref(
+	    if (match_with_backref(rex, 
 			sub->list.multi[subidx].start.lnum,
 			sub->list.multi[subidx].start.col,
 			sub->list.multi[subidx].end.lnum,
@@ -4804,7 +5477,7 @@ retempty:
 					|| sub->list.line[subidx].end == NULL)
 	    goto retempty;
 	len = (int)(sub->list.line[subidx].end - sub->list.line[subidx].start);
-	if (cstrncmp(sub->list.line[subidx].start, reginput, &len) == 0)
+	if (cstrncmp(rex, sub->list.line[subidx].start, rex->input, &len) == 0)
 	{
 	    *bytelen = len;
 	    return TRUE;
@@ -4815,20 +5488,21 @@ retempty:
 
 #ifdef FEAT_SYN_HL
 
-static int match_zref __ARGS((int subidx, int *bytelen));
+static int match_zref __ARGS((regexec_T *rex, int subidx, int *bytelen));
 
 /*
  * Check for a match with \z subexpression "subidx".
  * Return TRUE if it matches.
  */
     static int
-match_zref(subidx, bytelen)
+match_zref(rex, subidx, bytelen)
+    regexec_T	*rex;
     int		subidx;
     int		*bytelen;   /* out: length of match in bytes */
 {
     int		len;
 
-    cleanup_zsubexpr();
+    cleanup_zsubexpr(rex);
     if (re_extmatch_in == NULL || re_extmatch_in->matches[subidx] == NULL)
     {
 	/* backref was not set, match an empty string */
@@ -4837,7 +5511,7 @@ match_zref(subidx, bytelen)
     }
 
     len = (int)STRLEN(re_extmatch_in->matches[subidx]);
-    if (cstrncmp(re_extmatch_in->matches[subidx], reginput, &len) == 0)
+    if (cstrncmp(rex, re_extmatch_in->matches[subidx], rex->input, &len) == 0)
     {
 	*bytelen = len;
 	return TRUE;
@@ -4847,45 +5521,30 @@ match_zref(subidx, bytelen)
 #endif
 
 /*
- * Save list IDs for all NFA states of "prog" into "list".
- * Also reset the IDs to zero.
- * Only used for the recursive value lastlist[1].
- */
-    static void
-nfa_save_listids(prog, list)
-    nfa_regprog_T   *prog;
-    int		    *list;
-{
-    int		    i;
-    nfa_state_T	    *p;
-
-    /* Order in the list is reverse, it's a bit faster that way. */
-    p = &prog->state[0];
-    for (i = prog->nstate; --i >= 0; )
-    {
-	list[i] = p->lastlist[1];
-	p->lastlist[1] = 0;
-	++p;
-    }
-}
-
-/*
- * Restore list IDs from "list" to all NFA states.
+ * Switch to the list IDs of the NFA states for recursion level "level".
+ * They are allocated when the level is used for the first time.
+ * Returns FAIL when out of memory.
  */
-    static void
-nfa_restore_listids(prog, list)
+    static int
+nfa_use_lastlist(rex, prog, level)
+    regexec_T	    *rex;
     nfa_regprog_T   *prog;
-    int		    *list;
+    int		    level;
 {
-    int		    i;
-    nfa_state_T	    *p;
+    int		    *ll;
 
-    p = &prog->state[0];
-    for (i = prog->nstate; --i >= 0; )
+    if (level >= rex->nfa_lastlists.ga_len)
     {
-	p->lastlist[1] = list[i];
-	++p;
+	if (ga_grow(&rex->nfa_lastlists, 1) == FAIL)
+	    return FAIL;
+	ll = (int *)lalloc_clear((long_u)(sizeof(int) * prog->nstate), TRUE);
+	if (ll == NULL)
+	    return FAIL;
+	((int **)rex->nfa_lastlists.ga_data)[rex->nfa_lastlists.ga_len++] = ll;
     }
+    rex->nfa_ll_index = level;
+    rex->nfa_lastlist = ((int **)rex->nfa_lastlists.ga_data)[level];
+    return OK;
 }
 
     static int
@@ -4899,8 +5558,8 @@ nfa_re_num_cmp(val, op, pos)
     return val == pos;
 }
 
-static int recursive_regmatch __ARGS((nfa_state_T *state, nfa_pim_T *pim, nfa_regprog_T *prog, regsubs_T *submatch, regsubs_T *m, int **listids));
-static int nfa_regmatch __ARGS((nfa_regprog_T *prog, nfa_state_T *start, regsubs_T *submatch, regsubs_T *m));
+static int recursive_regmatch __ARGS((regexec_T *rex, nfa_state_T *state, nfa_pim_T *pim, nfa_regprog_T *prog, regsubs_T *submatch, regsubs_T *m));
+static int nfa_regmatch __ARGS((regexec_T *rex, nfa_regprog_T *prog, nfa_state_T *start, regsubs_T *submatch, regsubs_T *m));
 
 /*
  * Recursively call nfa_regmatch()
@@ -4908,31 +5567,30 @@ static int nfa_regmatch __ARGS((nfa_regprog_T *prog, nfa_state_T *start, regsubs
  * position).
  */
     static int
-recursive_regmatch(state, pim, prog, submatch, m, listids)
+recursive_regmatch(rex, state, pim, prog, submatch, m)
+    regexec_T	    *rex;
     nfa_state_T	    *state;
     nfa_pim_T	    *pim;
     nfa_regprog_T   *prog;
     regsubs_T	    *submatch;
     regsubs_T	    *m;
-    int		    **listids;
 {
-    int		save_reginput_col = (int)(reginput - regline);
-    int		save_reglnum = reglnum;
-    int		save_nfa_match = nfa_match;
-    int		save_nfa_listid = nfa_listid;
-    save_se_T   *save_nfa_endp = nfa_endp;
+    int		save_reginput_col = (int)(rex->input - rex->line);
+    int		save_reglnum = rex->lnum;
+    int		save_nfa_match = rex->nfa_match;
+    int		save_nfa_listid = rex->nfa_listid;
+    save_se_T   *save_nfa_endp = rex->nfa_endp;
     save_se_T   endpos;
     save_se_T   *endposp = NULL;
     int		result;
-    int		need_restore = FALSE;
 
     if (pim != NULL)
     {
 	/* start at the position where the postponed match was */
 	if (REG_MULTI)
-	    reginput = regline + pim->end.pos.col;
+	    rex->input = rex->line + pim->end.pos.col;
 	else
-	    reginput = pim->end.ptr;
+	    rex->input = pim->end.ptr;
     }
 
     if (state->c == NFA_START_INVISIBLE_BEFORE
@@ -4947,8 +5605,8 @@ recursive_regmatch(state, pim, prog, submatch, m, listids)
 	{
 	    if (pim == NULL)
 	    {
-		endpos.se_u.pos.col = (int)(reginput - regline);
-		endpos.se_u.pos.lnum = reglnum;
+		endpos.se_u.pos.col = (int)(rex->input - rex->line);
+		endpos.se_u.pos.lnum = rex->lnum;
 	    }
 	    else
 		endpos.se_u.pos = pim->end.pos;
@@ -4956,7 +5614,7 @@ recursive_regmatch(state, pim, prog, submatch, m, listids)
 	else
 	{
 	    if (pim == NULL)
-		endpos.se_u.ptr = reginput;
+		endpos.se_u.ptr = rex->input;
 	    else
 		endpos.se_u.ptr = pim->end.ptr;
 	}
@@ -4969,39 +5627,39 @@ recursive_regmatch(state, pim, prog, submatch, m, listids)
 	{
 	    if (REG_MULTI)
 	    {
-		regline = reg_getline(--reglnum);
-		if (regline == NULL)
+		rex->line = reg_getline(rex, --rex->lnum);
+		if (rex->line == NULL)
 		    /* can't go before the first line */
-		    regline = reg_getline(++reglnum);
+		    rex->line = reg_getline(rex, ++rex->lnum);
 	    }
-	    reginput = regline;
+	    rex->input = rex->line;
 	}
 	else
 	{
-	    if (REG_MULTI && (int)(reginput - regline) < state->val)
+	    if (REG_MULTI && (int)(rex->input - rex->line) < state->val)
 	    {
 		/* Not enough bytes in this line, go to end of
 		 * previous line. */
-		regline = reg_getline(--reglnum);
-		if (regline == NULL)
+		rex->line = reg_getline(rex, --rex->lnum);
+		if (rex->line == NULL)
 		{
 		    /* can't go before the first line */
-		    regline = reg_getline(++reglnum);
-		    reginput = regline;
+		    rex->line = reg_getline(rex, ++rex->lnum);
+		    rex->input = rex->line;
 		}
 		else
-		    reginput = regline + STRLEN(regline);
+		    rex->input = rex->line + STRLEN(rex->line);
 	    }
-	    if ((int)(reginput - regline) >= state->val)
+	    if ((int)(rex->input - rex->line) >= state->val)
 	    {
-		reginput -= state->val;
+		rex->input -= state->val;
 #ifdef FEAT_MBYTE
 		if (has_mbyte)
-		    reginput -= mb_head_off(regline, reginput);
+		    rex->input -= mb_head_off(rex->line, rex->input);
 #endif
 	    }
 	    else
-		reginput = regline;
+		rex->input = rex->line;
 	}
     }
 
@@ -5010,56 +5668,35 @@ recursive_regmatch(state, pim, prog, submatch, m, listids)
 	fclose(log_fd);
     log_fd = NULL;
 #endif
-    /* Have to clear the lastlist field of the NFA nodes, so that
-     * nfa_regmatch() and addstate() can run properly after recursion. */
-    if (nfa_ll_index == 1)
+    /* Each recursion level has its own list IDs for the NFA states, so
+     * that nfa_regmatch() and addstate() can run properly after recursion.
+     * Make sure nfa_listid is different from a previous recursive call,
+     * because some states may still have this ID. */
+    if (nfa_use_lastlist(rex, prog, rex->nfa_ll_index + 1) == FAIL)
     {
-	/* Already calling nfa_regmatch() recursively.  Save the lastlist[1]
-	 * values and clear them. */
-	if (*listids == NULL)
-	{
-	    *listids = (int *)lalloc(sizeof(int) * nstate, TRUE);
-	    if (*listids == NULL)
-	    {
-		EMSG(_("E878: (NFA) Could not allocate memory for branch traversal!"));
-		return 0;
-	    }
-	}
-	nfa_save_listids(prog, *listids);
-	need_restore = TRUE;
-	/* any value of nfa_listid will do */
-    }
-    else
-    {
-	/* First recursive nfa_regmatch() call, switch to the second lastlist
-	 * entry.  Make sure nfa_listid is different from a previous recursive
-	 * call, because some states may still have this ID. */
-	++nfa_ll_index;
-	if (nfa_listid <= nfa_alt_listid)
-	    nfa_listid = nfa_alt_listid;
+	EMSG(_("E878: (NFA) Could not allocate memory for branch traversal!"));
+	return 0;
     }
+    if (rex->nfa_listid <= rex->nfa_alt_listid)
+	rex->nfa_listid = rex->nfa_alt_listid;
 
     /* Call nfa_regmatch() to check if the current concat matches at this
      * position. The concat ends with the node NFA_END_INVISIBLE */
-    nfa_endp = endposp;
-    result = nfa_regmatch(prog, state->out, submatch, m);
+    rex->nfa_endp = endposp;
+    result = nfa_regmatch(rex, prog, state->out, submatch, m);
 
-    if (need_restore)
-	nfa_restore_listids(prog, *listids);
-    else
-    {
-	--nfa_ll_index;
-	nfa_alt_listid = nfa_listid;
-    }
+    (void)nfa_use_lastlist(rex, prog, rex->nfa_ll_index - 1);
+    if (rex->nfa_alt_listid < rex->nfa_listid)
+	rex->nfa_alt_listid = rex->nfa_listid;
 
     /* restore position in input text */
-    reglnum = save_reglnum;
+    rex->lnum = save_reglnum;
     if (REG_MULTI)
-	regline = reg_getline(reglnum);
-    reginput = regline + save_reginput_col;
-    nfa_match = save_nfa_match;
-    nfa_endp = save_nfa_endp;
-    nfa_listid = save_nfa_listid;
+	rex->line = reg_getline(rex, rex->lnum);
+    rex->input = rex->line + save_reginput_col;
+    rex->nfa_match = save_nfa_match;
+    rex->nfa_endp = save_nfa_endp;
+    rex->nfa_listid = save_nfa_listid;
 
 #ifdef ENABLE_LOG
     log_fd = fopen(NFA_REGEXP_RUN_LOG, "a");
@@ -5080,8 +5717,8 @@ recursive_regmatch(state, pim, prog, submatch, m, listids)
     return result;
 }
 
-static int skip_to_start __ARGS((int c, colnr_T *colp));
-static long find_match_text __ARGS((colnr_T startcol, int regstart, char_u *match_text));
+static int skip_to_start __ARGS((regexec_T *rex, int c, colnr_T *colp));
+static long find_match_text __ARGS((regexec_T *rex, colnr_T startcol, int regstart, char_u *match_text));
 
 /*
  * Estimate the chance of a match with "state" failing.
@@ -5251,24 +5888,25 @@ failure_chance(state, depth)
  * Skip until the char "c" we know a match must start with.
  */
     static int
-skip_to_start(c, colp)
+skip_to_start(rex, c, colp)
+    regexec_T	*rex;
     int		c;
     colnr_T	*colp;
 {
     char_u *s;
 
     /* Used often, do some work to avoid call overhead. */
-    if (!ireg_ic
+    if (!rex->reg_ic
 #ifdef FEAT_MBYTE
 		&& !has_mbyte
 #endif
 		)
-	s = vim_strbyte(regline + *colp, c);
+	s = vim_strbyte(rex->line + *colp, c);
     else
-	s = cstrchr(regline + *colp, c);
+	s = cstrchr(rex, rex->line + *colp, c);
     if (s == NULL)
 	return FAIL;
-    *colp = (int)(s - regline);
+    *colp = (int)(s - rex->line);
     return OK;
 }
 
@@ -5278,7 +5916,8 @@ skip_to_start(c, colp)
  * Returns zero for no match, 1 for a match.
  */
     static long
-find_match_text(startcol, regstart, match_text)
+find_match_text(rex, startcol, regstart, match_text)
+    regexec_T *rex;
     colnr_T startcol;
     int	    regstart;
     char_u  *match_text;
@@ -5295,8 +5934,8 @@ find_match_text(startcol, regstart, match_text)
 	for (len1 = 0; match_text[len1] != NUL; len1 += MB_CHAR2LEN(c1))
 	{
 	    c1 = PTR2CHAR(match_text + len1);
-	    c2 = PTR2CHAR(regline + col + len2);
-	    if (c1 != c2 && (!ireg_ic || MB_TOLOWER(c1) != MB_TOLOWER(c2)))
+	    c2 = PTR2CHAR(rex->line + col + len2);
+	    if (c1 != c2 && (!rex->reg_ic || MB_TOLOWER(c1) != MB_TOLOWER(c2)))
 	    {
 		match = FALSE;
 		break;
@@ -5307,29 +5946,29 @@ find_match_text(startcol, regstart, match_text)
 #ifdef FEAT_MBYTE
 		/* check that no composing char follows */
 		&& !(enc_utf8
-			   && utf_iscomposing(PTR2CHAR(regline + col + len2)))
+			   && utf_iscomposing(PTR2CHAR(rex->line + col + len2)))
 #endif
 		)
 	{
-	    cleanup_subexpr();
+	    cleanup_subexpr(rex);
 	    if (REG_MULTI)
 	    {
-		reg_startpos[0].lnum = reglnum;
-		reg_startpos[0].col = col;
-		reg_endpos[0].lnum = reglnum;
-		reg_endpos[0].col = col + len2;
+		rex->reg_startpos[0].lnum = rex->lnum;
+		rex->reg_startpos[0].col = col;
+		rex->reg_endpos[0].lnum = rex->lnum;
+		rex->reg_endpos[0].col = col + len2;
 	    }
 	    else
 	    {
-		reg_startp[0] = regline + col;
-		reg_endp[0] = regline + col + len2;
+		rex->reg_startp[0] = rex->line + col;
+		rex->reg_endp[0] = rex->line + col + len2;
 	    }
 	    return 1L;
 	}
 
 	/* Try finding regstart after the current match. */
 	col += MB_CHAR2LEN(regstart); /* skip regstart */
-	if (skip_to_start(regstart, &col) == FAIL)
+	if (skip_to_start(rex, regstart, &col) == FAIL)
 	    break;
     }
     return 0L;
@@ -5347,7 +5986,8 @@ find_match_text(startcol, regstart, match_text)
  * Note: Caller must ensure that: start != NULL.
  */
     static int
-nfa_regmatch(prog, start, submatch, m)
+nfa_regmatch(rex, prog, start, submatch, m)
+    regexec_T		*rex;
     nfa_regprog_T	*prog;
     nfa_state_T		*start;
     regsubs_T		*submatch;
@@ -5362,7 +6002,6 @@ nfa_regmatch(prog, start, submatch, m)
     int		listidx;
     nfa_list_T	*thislist;
     nfa_list_T	*nextlist;
-    int		*listids = NULL;
     nfa_state_T *add_state;
     int		add_here;
     int		add_count;
@@ -5383,14 +6022,14 @@ nfa_regmatch(prog, start, submatch, m)
     if (got_int)
 	return FALSE;
 
-    nfa_match = FALSE;
+    rex->nfa_match = FALSE;
 
     /* Allocate memory for the lists of nodes. */
-    size = (nstate + 1) * sizeof(nfa_thread_T);
+    size = (prog->nstate + 1) * sizeof(nfa_thread_T);
     list[0].t = (nfa_thread_T *)lalloc(size, TRUE);
-    list[0].len = nstate + 1;
+    list[0].len = prog->nstate + 1;
     list[1].t = (nfa_thread_T *)lalloc(size, TRUE);
-    list[1].len = nstate + 1;
+    list[1].len = prog->nstate + 1;
     if (list[0].t == NULL || list[1].t == NULL)
 	goto theend;
 
@@ -5420,7 +6059,7 @@ nfa_regmatch(prog, start, submatch, m)
 #ifdef ENABLE_LOG
     fprintf(log_fd, "(---) STARTSTATE first\n");
 #endif
-    thislist->id = nfa_listid + 1;
+    thislist->id = rex->nfa_listid + 1;
 
     /* Inline optimized code for addstate(thislist, start, m, 0) if we know
      * it's the first MOPEN. */
@@ -5428,16 +6067,16 @@ nfa_regmatch(prog, start, submatch, m)
     {
 	if (REG_MULTI)
 	{
-	    m->norm.list.multi[0].start.lnum = reglnum;
-	    m->norm.list.multi[0].start.col = (colnr_T)(reginput - regline);
+	    m->norm.list.multi[0].start.lnum = rex->lnum;
+	    m->norm.list.multi[0].start.col = (colnr_T)(rex->input - rex->line);
 	}
 	else
-	    m->norm.list.line[0].start = reginput;
+	    m->norm.list.line[0].start = rex->input;
 	m->norm.in_use = 1;
-	addstate(thislist, start->out, m, NULL, 0);
+	addstate(rex, thislist, start->out, m, NULL, 0);
     }
     else
-	addstate(thislist, start, m, NULL, 0);
+	addstate(rex, thislist, start, m, NULL, 0);
 
 #define	ADD_STATE_IF_MATCH(state)			\
     if (result) {					\
@@ -5456,13 +6095,13 @@ nfa_regmatch(prog, start, submatch, m)
 #ifdef FEAT_MBYTE
 	if (has_mbyte)
 	{
-	    curc = (*mb_ptr2char)(reginput);
-	    clen = (*mb_ptr2len)(reginput);
+	    curc = (*mb_ptr2char)(rex->input);
+	    clen = (*mb_ptr2len)(rex->input);
 	}
 	else
 #endif
 	{
-	    curc = *reginput;
+	    curc = *rex->input;
 	    clen = 1;
 	}
 	if (curc == NUL)
@@ -5476,13 +6115,13 @@ nfa_regmatch(prog, start, submatch, m)
 	nextlist = &list[flag ^= 1];
 	nextlist->n = 0;	    /* clear nextlist */
 	nextlist->has_pim = FALSE;
-	++nfa_listid;
-	thislist->id = nfa_listid;
-	nextlist->id = nfa_listid + 1;
+	++rex->nfa_listid;
+	thislist->id = rex->nfa_listid;
+	nextlist->id = rex->nfa_listid + 1;
 
 #ifdef ENABLE_LOG
 	fprintf(log_fd, "------------------------------------------\n");
-	fprintf(log_fd, ">>> Reginput is \"%s\"\n", reginput);
+	fprintf(log_fd, ">>> Reginput is \"%s\"\n", rex->input);
 	fprintf(log_fd, ">>> Advanced one character ... Current char is %c (code %d) \n", curc, (int)curc);
 	fprintf(log_fd, ">>> Thislist has %d states available: ", thislist->n);
 	{
@@ -5507,6 +6146,9 @@ nfa_regmatch(prog, start, submatch, m)
 	for (listidx = 0; listidx < thislist->n; ++listidx)
 	{
 	    t = &thislist->t[listidx];
+#ifdef FEAT_PROFILE
+	    ++rex->prof_steps;
+#endif
 
 #ifdef NFA_REGEXP_DEBUG_LOG
 	    nfa_set_code(t->state->c);
@@ -5521,11 +6163,11 @@ nfa_regmatch(prog, start, submatch, m)
 		else if (REG_MULTI)
 		    col = t->subs.norm.list.multi[0].start.col;
 		else
-		    col = (int)(t->subs.norm.list.line[0].start - regline);
+		    col = (int)(t->subs.norm.list.line[0].start - rex->line);
 		nfa_set_code(t->state->c);
 		fprintf(log_fd, "(%d) char %d %s (start col %d)%s ... \n",
 			abs(t->state->id), (int)t->state->c, code, col,
-			pim_info(&t->pim));
+			pim_info(rex, &t->pim));
 	    }
 #endif
 
@@ -5540,14 +6182,14 @@ nfa_regmatch(prog, start, submatch, m)
 	    {
 	    case NFA_MATCH:
 	      {
-		nfa_match = TRUE;
-		copy_sub(&submatch->norm, &t->subs.norm);
+		rex->nfa_match = TRUE;
+		copy_sub(rex, &submatch->norm, &t->subs.norm);
 #ifdef FEAT_SYN_HL
-		if (nfa_has_zsubexpr)
-		    copy_sub(&submatch->synt, &t->subs.synt);
+		if (rex->nfa_has_zsubexpr)
+		    copy_sub(rex, &submatch->synt, &t->subs.synt);
 #endif
 #ifdef ENABLE_LOG
-		log_subsexpr(&t->subs);
+		log_subsexpr(rex, &t->subs);
 #endif
 		/* Found the left-most longest match, do not look at any other
 		 * states at this position.  When the list of states is going
@@ -5573,43 +6215,43 @@ nfa_regmatch(prog, start, submatch, m)
 		 * Submatches are stored in *m, and used in the parent call.
 		 */
 #ifdef ENABLE_LOG
-		if (nfa_endp != NULL)
+		if (rex->nfa_endp != NULL)
 		{
 		    if (REG_MULTI)
 			fprintf(log_fd, "Current lnum: %d, endp lnum: %d; current col: %d, endp col: %d\n",
-				(int)reglnum,
-				(int)nfa_endp->se_u.pos.lnum,
-				(int)(reginput - regline),
-				nfa_endp->se_u.pos.col);
+				(int)rex->lnum,
+				(int)rex->nfa_endp->se_u.pos.lnum,
+				(int)(rex->input - rex->line),
+				rex->nfa_endp->se_u.pos.col);
 		    else
 			fprintf(log_fd, "Current col: %d, endp col: %d\n",
-				(int)(reginput - regline),
-				(int)(nfa_endp->se_u.ptr - reginput));
+				(int)(rex->input - rex->line),
+				(int)(rex->nfa_endp->se_u.ptr - rex->input));
 		}
 #endif
 		/* If "nfa_endp" is set it's only a match if it ends at
 		 * "nfa_endp" */
-		if (nfa_endp != NULL && (REG_MULTI
-			? (reglnum != nfa_endp->se_u.pos.lnum
-			    || (int)(reginput - regline)
-						!= nfa_endp->se_u.pos.col)
-			: reginput != nfa_endp->se_u.ptr))
+		if (rex->nfa_endp != NULL && (REG_MULTI
+			? (rex->lnum != rex->nfa_endp->se_u.pos.lnum
+			    || (int)(rex->input - rex->line)
+						!= rex->nfa_endp->se_u.pos.col)
+			: rex->input != rex->nfa_endp->se_u.ptr))
 		    break;
 
 		/* do not set submatches for \@! */
 		if (t->state->c != NFA_END_INVISIBLE_NEG)
 		{
-		    copy_sub(&m->norm, &t->subs.norm);
+		    copy_sub(rex, &m->norm, &t->subs.norm);
 #ifdef FEAT_SYN_HL
-		    if (nfa_has_zsubexpr)
-			copy_sub(&m->synt, &t->subs.synt);
+		    if (rex->nfa_has_zsubexpr)
+			copy_sub(rex, &m->synt, &t->subs.synt);
 #endif
 		}
 #ifdef ENABLE_LOG
 		fprintf(log_fd, "Match found:\n");
-		log_subsexpr(m);
+		log_subsexpr(rex, m);
 #endif
-		nfa_match = TRUE;
+		rex->nfa_match = TRUE;
 		/* See comment above at "goto nextchar". */
 		if (nextlist->n == 0)
 		    clen = 0;
@@ -5641,18 +6283,18 @@ nfa_regmatch(prog, start, submatch, m)
 
 			/* Copy submatch info for the recursive call, opposite
 			 * of what happens on success below. */
-			copy_sub_off(&m->norm, &t->subs.norm);
+			copy_sub_off(rex, &m->norm, &t->subs.norm);
 #ifdef FEAT_SYN_HL
-			if (nfa_has_zsubexpr)
-			    copy_sub_off(&m->synt, &t->subs.synt);
+			if (rex->nfa_has_zsubexpr)
+			    copy_sub_off(rex, &m->synt, &t->subs.synt);
 #endif
 
 			/*
 			 * First try matching the invisible match, then what
 			 * follows.
 			 */
-			result = recursive_regmatch(t->state, NULL, prog,
-						       submatch, m, &listids);
+			result = recursive_regmatch(rex, t->state, NULL, prog,
+						       submatch, m);
 
 			/* for \@! and \@<! it is a match when the result is
 			 * FALSE */
@@ -5664,14 +6306,14 @@ nfa_regmatch(prog, start, submatch, m)
 				     == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
 			{
 			    /* Copy submatch info from the recursive call */
-			    copy_sub_off(&t->subs.norm, &m->norm);
+			    copy_sub_off(rex, &t->subs.norm, &m->norm);
 #ifdef FEAT_SYN_HL
-			    if (nfa_has_zsubexpr)
-				copy_sub_off(&t->subs.synt, &m->synt);
+			    if (rex->nfa_has_zsubexpr)
+				copy_sub_off(rex, &t->subs.synt, &m->synt);
 #endif
 			    /* If the pattern has \ze and it matched in the
 			     * sub pattern, use it. */
-			    copy_ze_off(&t->subs.norm, &m->norm);
+			    copy_ze_off(rex, &t->subs.norm, &m->norm);
 
 			    /* t->state->out1 is the corresponding
 			     * END_INVISIBLE node; Add its out to the current
@@ -5699,16 +6341,16 @@ nfa_regmatch(prog, start, submatch, m)
 #endif
 			if (REG_MULTI)
 			{
-			    pim.end.pos.col = (int)(reginput - regline);
-			    pim.end.pos.lnum = reglnum;
+			    pim.end.pos.col = (int)(rex->input - rex->line);
+			    pim.end.pos.lnum = rex->lnum;
 			}
 			else
-			    pim.end.ptr = reginput;
+			    pim.end.ptr = rex->input;
 
 			/* t->state->out1 is the corresponding END_INVISIBLE
 			 * node; Add its out to the current list (zero-width
 			 * match). */
-			addstate_here(thislist, t->state->out1->out, &t->subs,
+			addstate_here(rex, thislist, t->state->out1->out, &t->subs,
 							       &pim, &listidx);
 		    }
 		}
@@ -5723,14 +6365,14 @@ nfa_regmatch(prog, start, submatch, m)
 
 		/* There is no point in trying to match the pattern if the
 		 * output state is not going to be added to the list. */
-		if (state_in_list(nextlist, t->state->out1->out, &t->subs))
+		if (state_in_list(rex, nextlist, t->state->out1->out, &t->subs))
 		{
 		    skip = t->state->out1->out;
 #ifdef ENABLE_LOG
 		    skip_lid = nextlist->id;
 #endif
 		}
-		else if (state_in_list(nextlist,
+		else if (state_in_list(rex, nextlist,
 					  t->state->out1->out->out, &t->subs))
 		{
 		    skip = t->state->out1->out->out;
@@ -5738,7 +6380,7 @@ nfa_regmatch(prog, start, submatch, m)
 		    skip_lid = nextlist->id;
 #endif
 		}
-		else if (state_in_list(thislist,
+		else if (state_in_list(rex, thislist,
 					  t->state->out1->out->out, &t->subs))
 		{
 		    skip = t->state->out1->out->out;
@@ -5757,37 +6399,37 @@ nfa_regmatch(prog, start, submatch, m)
 		}
 		/* Copy submatch info to the recursive call, opposite of what
 		 * happens afterwards. */
-		copy_sub_off(&m->norm, &t->subs.norm);
+		copy_sub_off(rex, &m->norm, &t->subs.norm);
 #ifdef FEAT_SYN_HL
-		if (nfa_has_zsubexpr)
-		    copy_sub_off(&m->synt, &t->subs.synt);
+		if (rex->nfa_has_zsubexpr)
+		    copy_sub_off(rex, &m->synt, &t->subs.synt);
 #endif
 
 		/* First try matching the pattern. */
-		result = recursive_regmatch(t->state, NULL, prog,
-						       submatch, m, &listids);
+		result = recursive_regmatch(rex, t->state, NULL, prog,
+						       submatch, m);
 		if (result)
 		{
 		    int bytelen;
 
 #ifdef ENABLE_LOG
 		    fprintf(log_fd, "NFA_START_PATTERN matches:\n");
-		    log_subsexpr(m);
+		    log_subsexpr(rex, m);
 #endif
 		    /* Copy submatch info from the recursive call */
-		    copy_sub_off(&t->subs.norm, &m->norm);
+		    copy_sub_off(rex, &t->subs.norm, &m->norm);
 #ifdef FEAT_SYN_HL
-		    if (nfa_has_zsubexpr)
-			copy_sub_off(&t->subs.synt, &m->synt);
+		    if (rex->nfa_has_zsubexpr)
+			copy_sub_off(rex, &t->subs.synt, &m->synt);
 #endif
 		    /* Now we need to skip over the matched text and then
 		     * continue with what follows. */
 		    if (REG_MULTI)
 			/* TODO: multi-line match */
 			bytelen = m->norm.list.multi[0].end.col
-						  - (int)(reginput - regline);
+						  - (int)(rex->input - rex->line);
 		    else
-			bytelen = (int)(m->norm.list.line[0].end - reginput);
+			bytelen = (int)(m->norm.list.line[0].end - rex->input);
 
 #ifdef ENABLE_LOG
 		    fprintf(log_fd, "NFA_START_PATTERN length: %d\n", bytelen);
@@ -5820,7 +6462,7 @@ nfa_regmatch(prog, start, submatch, m)
 	      }
 
 	    case NFA_BOL:
-		if (reginput == regline)
+		if (rex->input == rex->line)
 		{
 		    add_here = TRUE;
 		    add_state = t->state->out;
@@ -5846,16 +6488,16 @@ nfa_regmatch(prog, start, submatch, m)
 		    int this_class;
 
 		    /* Get class of current and previous char (if it exists). */
-		    this_class = mb_get_class_buf(reginput, reg_buf);
+		    this_class = mb_get_class_buf(rex->input, rex->reg_buf);
 		    if (this_class <= 1)
 			result = FALSE;
-		    else if (reg_prev_class() == this_class)
+		    else if (reg_prev_class(rex) == this_class)
 			result = FALSE;
 		}
 #endif
-		else if (!vim_iswordc_buf(curc, reg_buf)
-			   || (reginput > regline
-				   && vim_iswordc_buf(reginput[-1], reg_buf)))
+		else if (!vim_iswordc_buf(curc, rex->reg_buf)
+			   || (rex->input > rex->line
+				   && vim_iswordc_buf(rex->input[-1], rex->reg_buf)))
 		    result = FALSE;
 		if (result)
 		{
@@ -5866,7 +6508,7 @@ nfa_regmatch(prog, start, submatch, m)
 
 	    case NFA_EOW:
 		result = TRUE;
-		if (reginput == regline)
+		if (rex->input == rex->line)
 		    result = FALSE;
 #ifdef FEAT_MBYTE
 		else if (has_mbyte)
@@ -5874,16 +6516,16 @@ nfa_regmatch(prog, start, submatch, m)
 		    int this_class, prev_class;
 
 		    /* Get class of current and previous char (if it exists). */
-		    this_class = mb_get_class_buf(reginput, reg_buf);
-		    prev_class = reg_prev_class();
+		    this_class = mb_get_class_buf(rex->input, rex->reg_buf);
+		    prev_class = reg_prev_class(rex);
 		    if (this_class == prev_class
 					|| prev_class == 0 || prev_class == 1)
 			result = FALSE;
 		}
 #endif
-		else if (!vim_iswordc_buf(reginput[-1], reg_buf)
-			|| (reginput[0] != NUL
-					   && vim_iswordc_buf(curc, reg_buf)))
+		else if (!vim_iswordc_buf(rex->input[-1], rex->reg_buf)
+			|| (rex->input[0] != NUL
+					   && vim_iswordc_buf(curc, rex->reg_buf)))
 		    result = FALSE;
 		if (result)
 		{
@@ -5893,8 +6535,8 @@ nfa_regmatch(prog, start, submatch, m)
 		break;
 
 	    case NFA_BOF:
-		if (reglnum == 0 && reginput == regline
-					&& (!REG_MULTI || reg_firstlnum == 1))
+		if (rex->lnum == 0 && rex->input == rex->line
+					&& (!REG_MULTI || rex->reg_firstlnum == 1))
 		{
 		    add_here = TRUE;
 		    add_state = t->state->out;
@@ -5902,7 +6544,7 @@ nfa_regmatch(prog, start, submatch, m)
 		break;
 
 	    case NFA_EOF:
-		if (reglnum == reg_maxline && curc == NUL)
+		if (rex->lnum == rex->reg_maxline && curc == NUL)
 		{
 		    add_here = TRUE;
 		    add_state = t->state->out;
@@ -5929,7 +6571,7 @@ nfa_regmatch(prog, start, submatch, m)
 		     * (no preceding character). */
 		    len += mb_char2len(mc);
 		}
-		if (ireg_icombine && len == 0)
+		if (rex->reg_icombine && len == 0)
 		{
 		    /* If \Z was present, then ignore composing characters.
 		     * When ignoring the base character this always matches. */
@@ -5954,7 +6596,7 @@ nfa_regmatch(prog, start, submatch, m)
 		     * Get them into cchars[] first. */
 		    while (len < clen)
 		    {
-			mc = mb_ptr2char(reginput + len);
+			mc = mb_ptr2char(rex->input + len);
 			cchars[ccount++] = mc;
 			len += mb_char2len(mc);
 			if (ccount == MAX_MCO)
@@ -5988,8 +6630,8 @@ nfa_regmatch(prog, start, submatch, m)
 #endif
 
 	    case NFA_NEWL:
-		if (curc == NUL && !reg_line_lbr && REG_MULTI
-						    && reglnum <= reg_maxline)
+		if (curc == NUL && !rex->reg_line_lbr && REG_MULTI
+						    && rex->lnum <= rex->reg_maxline)
 		{
 		    go_to_nextline = TRUE;
 		    /* Pass -1 for the offset, which means taking the position
@@ -5997,7 +6639,7 @@ nfa_regmatch(prog, start, submatch, m)
 		    add_state = t->state->out;
 		    add_off = -1;
 		}
-		else if (curc == '\n' && reg_line_lbr)
+		else if (curc == '\n' && rex->reg_line_lbr)
 		{
 		    /* match \n as if it is an ordinary character */
 		    add_state = t->state->out;
@@ -6007,68 +6649,9 @@ nfa_regmatch(prog, start, submatch, m)
 
 	    case NFA_START_COLL:
 	    case NFA_START_NEG_COLL:
-	      {
 		/* What follows is a list of characters, until NFA_END_COLL.
 		 * One of them must match or none of them must match. */
-		nfa_state_T	*state;
-		int		result_if_matched;
-		int		c1, c2;
-
-		/* Never match EOL. If it's part of the collection it is added
-		 * as a separate state with an OR. */
-		if (curc == NUL)
-		    break;
-
-		state = t->state->out;
-		result_if_matched = (t->state->c == NFA_START_COLL);
-		for (;;)
-		{
-		    if (state->c == NFA_END_COLL)
-		    {
-			result = !result_if_matched;
-			break;
-		    }
-		    if (state->c == NFA_RANGE_MIN)
-		    {
-			c1 = state->val;
-			state = state->out; /* advance to NFA_RANGE_MAX */
-			c2 = state->val;
-#ifdef ENABLE_LOG
-			fprintf(log_fd, "NFA_RANGE_MIN curc=%d c1=%d c2=%d\n",
-				curc, c1, c2);
-#endif
-			if (curc >= c1 && curc <= c2)
-			{
-			    result = result_if_matched;
-			    break;
-			}
-			if (ireg_ic)
-			{
-			    int curc_low = MB_TOLOWER(curc);
-			    int done = FALSE;
-
-			    for ( ; c1 <= c2; ++c1)
-				if (MB_TOLOWER(c1) == curc_low)
-				{
-				    result = result_if_matched;
-				    done = TRUE;
-				    break;
-				}
-			    if (done)
-				break;
-			}
-		    }
-		    else if (state->c < 0 ? check_char_class(state->c, curc)
-			        : (curc == state->c
-				   || (ireg_ic && MB_TOLOWER(curc)
-						    == MB_TOLOWER(state->c))))
-		    {
-			result = result_if_matched;
-			break;
-		    }
-		    state = state->out;
-		}
-		if (result)
+		if (nfa_match_coll(rex, t->state, curc))
 		{
 		    /* next state is in out of the NFA_END_COLL, out1 of
 		     * START points to the END state */
@@ -6076,7 +6659,6 @@ nfa_regmatch(prog, start, submatch, m)
 		    add_off = clen;
 		}
 		break;
-	      }
 
 	    case NFA_ANY:
 		/* Any char except '\0', (end of input) does not match. */
@@ -6091,155 +6673,36 @@ nfa_regmatch(prog, start, submatch, m)
 	     * Character classes like \a for alpha, \d for digit etc.
 	     */
 	    case NFA_IDENT:	/*  \i	*/
-		result = vim_isIDc(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_SIDENT:	/*  \I	*/
-		result = !VIM_ISDIGIT(curc) && vim_isIDc(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_KWORD:	/*  \k	*/
-		result = vim_iswordp_buf(reginput, reg_buf);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_SKWORD:	/*  \K	*/
-		result = !VIM_ISDIGIT(curc)
-					&& vim_iswordp_buf(reginput, reg_buf);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_FNAME:	/*  \f	*/
-		result = vim_isfilec(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_SFNAME:	/*  \F	*/
-		result = !VIM_ISDIGIT(curc) && vim_isfilec(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_PRINT:	/*  \p	*/
-		result = vim_isprintc(PTR2CHAR(reginput));
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_SPRINT:	/*  \P	*/
-		result = !VIM_ISDIGIT(curc) && vim_isprintc(PTR2CHAR(reginput));
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_WHITE:	/*  \s	*/
-		result = vim_iswhite(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NWHITE:	/*  \S	*/
-		result = curc != NUL && !vim_iswhite(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_DIGIT:	/*  \d	*/
-		result = ri_digit(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NDIGIT:	/*  \D	*/
-		result = curc != NUL && !ri_digit(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_HEX:	/*  \x	*/
-		result = ri_hex(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NHEX:	/*  \X	*/
-		result = curc != NUL && !ri_hex(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_OCTAL:	/*  \o	*/
-		result = ri_octal(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NOCTAL:	/*  \O	*/
-		result = curc != NUL && !ri_octal(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_WORD:	/*  \w	*/
-		result = ri_word(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NWORD:	/*  \W	*/
-		result = curc != NUL && !ri_word(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_HEAD:	/*  \h	*/
-		result = ri_head(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NHEAD:	/*  \H	*/
-		result = curc != NUL && !ri_head(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_ALPHA:	/*  \a	*/
-		result = ri_alpha(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NALPHA:	/*  \A	*/
-		result = curc != NUL && !ri_alpha(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_LOWER:	/*  \l	*/
-		result = ri_lower(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NLOWER:	/*  \L	*/
-		result = curc != NUL && !ri_lower(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_UPPER:	/*  \u	*/
-		result = ri_upper(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
-	    case NFA_NUPPER:	/* \U	*/
-		result = curc != NUL && !ri_upper(curc);
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
+	    case NFA_NUPPER:	/*  \U	*/
 	    case NFA_LOWER_IC:	/* [a-z] */
-		result = ri_lower(curc) || (ireg_ic && ri_upper(curc));
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NLOWER_IC:	/* [^a-z] */
-		result = curc != NUL
-			  && !(ri_lower(curc) || (ireg_ic && ri_upper(curc)));
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_UPPER_IC:	/* [A-Z] */
-		result = ri_upper(curc) || (ireg_ic && ri_lower(curc));
-		ADD_STATE_IF_MATCH(t->state);
-		break;
-
 	    case NFA_NUPPER_IC:	/* ^[A-Z] */
-		result = curc != NUL
-			  && !(ri_upper(curc) || (ireg_ic && ri_lower(curc)));
+		result = nfa_match_class(rex, t->state->c, curc, rex->input);
 		ADD_STATE_IF_MATCH(t->state);
 		break;
 
@@ -6271,13 +6734,13 @@ nfa_regmatch(prog, start, submatch, m)
 		if (t->state->c <= NFA_BACKREF9)
 		{
 		    subidx = t->state->c - NFA_BACKREF1 + 1;
-		    result = match_backref(&t->subs.norm, subidx, &bytelen);
+		    result = match_backref(rex, &t->subs.norm, subidx, &bytelen);
 		}
 #ifdef FEAT_SYN_HL
 		else
 		{
 		    subidx = t->state->c - NFA_ZREF1 + 1;
-		    result = match_zref(subidx, &bytelen);
+		    result = match_zref(rex, subidx, &bytelen);
 		}
 #endif
 
@@ -6330,7 +6793,7 @@ nfa_regmatch(prog, start, submatch, m)
 	    case NFA_LNUM_LT:
 		result = (REG_MULTI &&
 			nfa_re_num_cmp(t->state->val, t->state->c - NFA_LNUM,
-			    (long_u)(reglnum + reg_firstlnum)));
+			    (long_u)(rex->lnum + rex->reg_firstlnum)));
 		if (result)
 		{
 		    add_here = TRUE;
@@ -6342,7 +6805,7 @@ nfa_regmatch(prog, start, submatch, m)
 	    case NFA_COL_GT:
 	    case NFA_COL_LT:
 		result = nfa_re_num_cmp(t->state->val, t->state->c - NFA_COL,
-			(long_u)(reginput - regline) + 1);
+			(long_u)(rex->input - rex->line) + 1);
 		if (result)
 		{
 		    add_here = TRUE;
@@ -6355,8 +6818,8 @@ nfa_regmatch(prog, start, submatch, m)
 	    case NFA_VCOL_LT:
 		result = nfa_re_num_cmp(t->state->val, t->state->c - NFA_VCOL,
 		    (long_u)win_linetabsize(
-			    reg_win == NULL ? curwin : reg_win,
-			    regline, (colnr_T)(reginput - regline)) + 1);
+			    rex->reg_win == NULL ? curwin : rex->reg_win,
+			    rex->line, (colnr_T)(rex->input - rex->line)) + 1);
 		if (result)
 		{
 		    add_here = TRUE;
@@ -6368,18 +6831,18 @@ nfa_regmatch(prog, start, submatch, m)
 	    case NFA_MARK_GT:
 	    case NFA_MARK_LT:
 	      {
-		pos_T	*pos = getmark_buf(reg_buf, t->state->val, FALSE);
+		pos_T	*pos = getmark_buf(rex->reg_buf, t->state->val, FALSE);
 
 		/* Compare the mark position to the match position. */
 		result = (pos != NULL		     /* mark doesn't exist */
 			&& pos->lnum > 0    /* mark isn't set in reg_buf */
-			&& (pos->lnum == reglnum + reg_firstlnum
-				? (pos->col == (colnr_T)(reginput - regline)
+			&& (pos->lnum == rex->lnum + rex->reg_firstlnum
+				? (pos->col == (colnr_T)(rex->input - rex->line)
 				    ? t->state->c == NFA_MARK
-				    : (pos->col < (colnr_T)(reginput - regline)
+				    : (pos->col < (colnr_T)(rex->input - rex->line)
 					? t->state->c == NFA_MARK_GT
 					: t->state->c == NFA_MARK_LT))
-				: (pos->lnum < reglnum + reg_firstlnum
+				: (pos->lnum < rex->lnum + rex->reg_firstlnum
 				    ? t->state->c == NFA_MARK_GT
 				    : t->state->c == NFA_MARK_LT)));
 		if (result)
@@ -6391,10 +6854,10 @@ nfa_regmatch(prog, start, submatch, m)
 	      }
 
 	    case NFA_CURSOR:
-		result = (reg_win != NULL
-			&& (reglnum + reg_firstlnum == reg_win->w_cursor.lnum)
-			&& ((colnr_T)(reginput - regline)
-						   == reg_win->w_cursor.col));
+		result = (rex->reg_win != NULL
+			&& (rex->lnum + rex->reg_firstlnum == rex->reg_win->w_cursor.lnum)
+			&& ((colnr_T)(rex->input - rex->line)
+						   == rex->reg_win->w_cursor.col));
 		if (result)
 		{
 		    add_here = TRUE;
@@ -6404,7 +6867,7 @@ nfa_regmatch(prog, start, submatch, m)
 
 	    case NFA_VISUAL:
 #ifdef FEAT_VISUAL
-		result = reg_match_visual();
+		result = reg_match_visual(rex);
 		if (result)
 		{
 		    add_here = TRUE;
@@ -6450,13 +6913,13 @@ nfa_regmatch(prog, start, submatch, m)
 #endif
 		result = (c == curc);
 
-		if (!result && ireg_ic)
+		if (!result && rex->reg_ic)
 		    result = MB_TOLOWER(c) == MB_TOLOWER(curc);
 #ifdef FEAT_MBYTE
 		/* If there is a composing character which is not being
 		 * ignored there can be no match. Match with composing
 		 * character uses NFA_COMPOSING above. */
-		if (result && enc_utf8 && !ireg_icombine
+		if (result && enc_utf8 && !rex->reg_icombine
 						&& clen != utf_char2len(curc))
 		    result = FALSE;
 #endif
@@ -6488,8 +6951,8 @@ nfa_regmatch(prog, start, submatch, m)
 			fprintf(log_fd, "Postponed recursive nfa_regmatch()\n");
 			fprintf(log_fd, "\n");
 #endif
-			result = recursive_regmatch(pim->state, pim,
-						 prog, submatch, m, &listids);
+			result = recursive_regmatch(rex, pim->state, pim,
+						 prog, submatch, m);
 			pim->result = result ? NFA_PIM_MATCH : NFA_PIM_NOMATCH;
 			/* for \@! and \@<! it is a match when the result is
 			 * FALSE */
@@ -6501,10 +6964,10 @@ nfa_regmatch(prog, start, submatch, m)
 				     == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
 			{
 			    /* Copy submatch info from the recursive call */
-			    copy_sub_off(&pim->subs.norm, &m->norm);
+			    copy_sub_off(rex, &pim->subs.norm, &m->norm);
 #ifdef FEAT_SYN_HL
-			    if (nfa_has_zsubexpr)
-				copy_sub_off(&pim->subs.synt, &m->synt);
+			    if (rex->nfa_has_zsubexpr)
+				copy_sub_off(rex, &pim->subs.synt, &m->synt);
 #endif
 			}
 		    }
@@ -6528,10 +6991,10 @@ nfa_regmatch(prog, start, submatch, m)
 				     == NFA_START_INVISIBLE_BEFORE_NEG_FIRST))
 		    {
 			/* Copy submatch info from the recursive call */
-			copy_sub_off(&t->subs.norm, &pim->subs.norm);
+			copy_sub_off(rex, &t->subs.norm, &pim->subs.norm);
 #ifdef FEAT_SYN_HL
-			if (nfa_has_zsubexpr)
-			    copy_sub_off(&t->subs.synt, &pim->subs.synt);
+			if (rex->nfa_has_zsubexpr)
+			    copy_sub_off(rex, &t->subs.synt, &pim->subs.synt);
 #endif
 		    }
 		    else
@@ -6548,15 +7011,15 @@ nfa_regmatch(prog, start, submatch, m)
 		 * local copy to avoid that. */
 		if (pim == &t->pim)
 		{
-		    copy_pim(&pim_copy, pim);
+		    copy_pim(rex, &pim_copy, pim);
 		    pim = &pim_copy;
 		}
 
 		if (add_here)
-		    addstate_here(thislist, add_state, &t->subs, pim, &listidx);
+		    addstate_here(rex, thislist, add_state, &t->subs, pim, &listidx);
 		else
 		{
-		    addstate(nextlist, add_state, &t->subs, pim, add_off);
+		    addstate(rex, nextlist, add_state, &t->subs, pim, add_off);
 		    if (add_count > 0)
 			nextlist->t[nextlist->n - 1].count = add_count;
 		}
@@ -6572,19 +7035,19 @@ nfa_regmatch(prog, start, submatch, m)
 	 * because recursive calls should only start in the first position.
 	 * Unless "nfa_endp" is not NULL, then we match the end position.
 	 * Also don't start a match past the first line. */
-	if (nfa_match == FALSE
+	if (rex->nfa_match == FALSE
 		&& ((toplevel
-			&& reglnum == 0
+			&& rex->lnum == 0
 			&& clen != 0
-			&& (ireg_maxcol == 0
-			    || (colnr_T)(reginput - regline) < ireg_maxcol))
-		    || (nfa_endp != NULL
+			&& (rex->reg_maxcol == 0
+			    || (colnr_T)(rex->input - rex->line) < rex->reg_maxcol))
+		    || (rex->nfa_endp != NULL
 			&& (REG_MULTI
-			    ? (reglnum < nfa_endp->se_u.pos.lnum
-			       || (reglnum == nfa_endp->se_u.pos.lnum
-			           && (int)(reginput - regline)
-						    < nfa_endp->se_u.pos.col))
-			    : reginput < nfa_endp->se_u.ptr))))
+			    ? (rex->lnum < rex->nfa_endp->se_u.pos.lnum
+			       || (rex->lnum == rex->nfa_endp->se_u.pos.lnum
+			           && (int)(rex->input - rex->line)
+						    < rex->nfa_endp->se_u.pos.col))
+			    : rex->input < rex->nfa_endp->se_u.ptr))))
 	{
 #ifdef ENABLE_LOG
 	    fprintf(log_fd, "(---) STARTSTATE\n");
@@ -6600,24 +7063,24 @@ nfa_regmatch(prog, start, submatch, m)
 		{
 		    if (nextlist->n == 0)
 		    {
-			colnr_T col = (colnr_T)(reginput - regline) + clen;
+			colnr_T col = (colnr_T)(rex->input - rex->line) + clen;
 
 			/* Nextlist is empty, we can skip ahead to the
 			 * character that must appear at the start. */
-			if (skip_to_start(prog->regstart, &col) == FAIL)
+			if (skip_to_start(rex, prog->regstart, &col) == FAIL)
 			    break;
 #ifdef ENABLE_LOG
 			fprintf(log_fd, "  Skipping ahead %d bytes to regstart\n",
-				col - ((colnr_T)(reginput - regline) + clen));
+				col - ((colnr_T)(rex->input - rex->line) + clen));
 #endif
-			reginput = regline + col - clen;
+			rex->input = rex->line + col - clen;
 		    }
 		    else
 		    {
 			/* Checking if the required start character matches is
 			 * cheaper than adding a state that won't match. */
-			c = PTR2CHAR(reginput + clen);
-			if (c != prog->regstart && (!ireg_ic || MB_TOLOWER(c)
+			c = PTR2CHAR(rex->input + clen);
+			if (c != prog->regstart && (!rex->reg_ic || MB_TOLOWER(c)
 					       != MB_TOLOWER(prog->regstart)))
 			{
 #ifdef ENABLE_LOG
@@ -6632,14 +7095,14 @@ nfa_regmatch(prog, start, submatch, m)
 		{
 		    if (REG_MULTI)
 			m->norm.list.multi[0].start.col =
-					 (colnr_T)(reginput - regline) + clen;
+					 (colnr_T)(rex->input - rex->line) + clen;
 		    else
-			m->norm.list.line[0].start = reginput + clen;
-		    addstate(nextlist, start->out, m, NULL, clen);
+			m->norm.list.line[0].start = rex->input + clen;
+		    addstate(rex, nextlist, start->out, m, NULL, clen);
 		}
 	    }
 	    else
-		addstate(nextlist, start, m, NULL, clen);
+		addstate(rex, nextlist, start, m, NULL, clen);
 	}
 
 #ifdef ENABLE_LOG
@@ -6657,10 +7120,10 @@ nextchar:
 	/* Advance to the next character, or advance to the next line, or
 	 * finish. */
 	if (clen != 0)
-	    reginput += clen;
-	else if (go_to_nextline || (nfa_endp != NULL && REG_MULTI
-					&& reglnum < nfa_endp->se_u.pos.lnum))
-	    reg_nextline();
+	    rex->input += clen;
+	else if (go_to_nextline || (rex->nfa_endp != NULL && REG_MULTI
+					&& rex->lnum < rex->nfa_endp->se_u.pos.lnum))
+	    reg_nextline(rex);
 	else
 	    break;
     }
@@ -6675,13 +7138,529 @@ theend:
     /* Free memory */
     vim_free(list[0].t);
     vim_free(list[1].t);
-    vim_free(listids);
 #undef ADD_STATE_IF_MATCH
 #ifdef NFA_REGEXP_DEBUG_LOG
     fclose(debug);
 #endif
 
-    return nfa_match;
+    return rex->nfa_match;
+}
+
+/*
+ * Return NFA_DFA_ flags for "prog", zero if the DFA can't be used.
+ */
+    static int
+nfa_dfa_flags(prog)
+    nfa_regprog_T *prog;
+{
+    int		flags = NFA_DFA_OK;
+    int		i;
+    int		c;
+
+    for (i = 0; i < prog->nstate; ++i)
+    {
+	c = prog->state[i].c;
+	switch (c)
+	{
+	    case NFA_BOW:
+	    case NFA_EOW:
+		flags |= NFA_DFA_BOUND;
+		/* FALLTHROUGH */
+	    case NFA_KWORD:
+	    case NFA_SKWORD:
+		flags |= NFA_DFA_WORD;
+		break;
+
+	    case NFA_SPLIT:
+	    case NFA_MATCH:
+	    case NFA_EMPTY:
+	    case NFA_START_COLL:
+	    case NFA_END_COLL:
+	    case NFA_START_NEG_COLL:
+	    case NFA_RANGE_MIN:
+	    case NFA_RANGE_MAX:
+	    case NFA_BOL:
+	    case NFA_EOL:
+	    case NFA_ZSTART:
+	    case NFA_ZEND:
+	    case NFA_NOPEN:
+	    case NFA_NCLOSE:
+		break;
+
+	    default:
+		if (c > 0
+			|| (c >= NFA_MOPEN && c <= NFA_MCLOSE9)
+#ifdef FEAT_SYN_HL
+			|| (c >= NFA_ZOPEN && c <= NFA_ZCLOSE9)
+#endif
+			|| (c >= NFA_ANY && c <= NFA_NUPPER_IC)
+			|| (c >= NFA_CLASS_ALNUM && c <= NFA_CLASS_ESCAPE))
+		    break;
+		/* Anything else needs the NFA: back references,
+		 * look-around, line breaks, composing characters, etc. */
+		return 0;
+	}
+    }
+    return flags;
+}
+
+/*
+ * Free the cached DFA states.
+ */
+    static void
+nfa_dfa_flush(dfa)
+    nfa_dfa_T	*dfa;
+{
+    int		i;
+
+    for (i = 0; i < dfa->dfa_count; ++i)
+	vim_free(dfa->dfa_states[i]);
+    dfa->dfa_count = 0;
+    for (i = 0; i < DFA_HASH_SIZE; ++i)
+	dfa->dfa_hash[i] = -1;
+    ++dfa->dfa_flushes;
+}
+
+/*
+ * Free the DFA of a program.
+ */
+    static void
+nfa_dfa_free(dfa)
+    nfa_dfa_T	*dfa;
+{
+    if (dfa != NULL)
+    {
+	nfa_dfa_flush(dfa);
+	vim_free(dfa->dfa_mark);
+	vim_free(dfa->dfa_work[0]);
+	vim_free(dfa->dfa_work[1]);
+	vim_free(dfa);
+    }
+}
+
+/*
+ * Start building a new set of NFA states in dfa_work["w"].
+ */
+    static void
+nfa_dfa_newset(dfa, prog, w)
+    nfa_dfa_T	    *dfa;
+    nfa_regprog_T   *prog;
+    int		    w;
+{
+    if (++dfa->dfa_markid <= 0)
+    {
+	vim_memset(dfa->dfa_mark, 0, sizeof(int) * prog->nstate);
+	dfa->dfa_markid = 1;
+    }
+    dfa->dfa_set = dfa->dfa_work[w];
+    dfa->dfa_setlen = 0;
+}
+
+/*
+ * Add NFA state "state" and the states reachable from it without consuming a
+ * character to the set being built.  Assertions are checked or added to the
+ * set, depending on dfa_resolve.
+ */
+    static void
+nfa_dfa_add(dfa, prog, state)
+    nfa_dfa_T	    *dfa;
+    nfa_regprog_T   *prog;
+    nfa_state_T	    *state;
+{
+    int		idx = (int)(state - prog->state);
+    int		result;
+
+    if (dfa->dfa_mark[idx] == dfa->dfa_markid)
+	return;
+    dfa->dfa_mark[idx] = dfa->dfa_markid;
+
+    switch (state->c)
+    {
+	case NFA_SPLIT:
+	    nfa_dfa_add(dfa, prog, state->out);
+	    nfa_dfa_add(dfa, prog, state->out1);
+	    return;
+
+	case NFA_BOL:
+	case NFA_EOL:
+	case NFA_BOW:
+	case NFA_EOW:
+	    /* "^" can only match at the start of the line. */
+	    if (state->c == NFA_BOL && !dfa->dfa_bol)
+		return;
+	    if (!dfa->dfa_resolve)
+		break;
+	    if (state->c == NFA_BOL)
+		result = TRUE;
+	    else if (state->c == NFA_EOL)
+		result = dfa->dfa_eol;
+	    else if (state->c == NFA_BOW)
+		result = dfa->dfa_cur > 1 && dfa->dfa_cur != dfa->dfa_prev;
+	    else
+		result = dfa->dfa_prev > 1 && dfa->dfa_cur != dfa->dfa_prev;
+	    if (result)
+		nfa_dfa_add(dfa, prog, state->out);
+	    return;
+
+	case NFA_MATCH:
+	case NFA_START_COLL:
+	case NFA_START_NEG_COLL:
+	    break;
+
+	default:
+	    if (state->c > 0 || (state->c >= NFA_ANY
+						 && state->c <= NFA_NUPPER_IC))
+		break;
+	    /* MOPEN, MCLOSE, EMPTY, etc. */
+	    nfa_dfa_add(dfa, prog, state->out);
+	    return;
+    }
+    dfa->dfa_set[dfa->dfa_setlen++] = idx;
+}
+
+/*
+ * Return TRUE if NFA state "state" can consume character "curc" at "p",
+ * which is "clen" bytes long.
+ */
+    static int
+nfa_dfa_char_match(rex, state, curc, clen, p)
+    regexec_T	*rex;
+    nfa_state_T	*state;
+    int		curc;
+    int		clen UNUSED;
+    char_u	*p;
+{
+    int		c = state->c;
+    int		result;
+
+    switch (c)
+    {
+	case NFA_MATCH:
+	    return FALSE;
+
+	case NFA_START_COLL:
+	case NFA_START_NEG_COLL:
+	    return nfa_match_coll(rex, state, curc);
+
+	case NFA_ANY:
+	    return curc > 0;
+
+	case NFA_IDENT:
+	case NFA_SIDENT:
+	case NFA_FNAME:
+	case NFA_SFNAME:
+	case NFA_PRINT:
+	case NFA_SPRINT:
+	    /* These depend on global options, which are not checked when
+	     * using cached states.  Assume a match. */
+	    return TRUE;
+    }
+    if (c < 0)
+	return nfa_match_class(rex, c, curc, p);
+
+    /* regular character, as in nfa_regmatch() */
+    result = (c == curc);
+    if (!result && rex->reg_ic)
+	result = MB_TOLOWER(c) == MB_TOLOWER(curc);
+#ifdef FEAT_MBYTE
+    if (result && enc_utf8 && !rex->reg_icombine && clen != utf_char2len(curc))
+	result = FALSE;
+#endif
+    return result;
+}
+
+/*
+ * Sort compare function for NFA state indexes.
+ */
+    static int
+nfa_dfa_compare(s1, s2)
+    const void	*s1;
+    const void	*s2;
+{
+    return *(int *)s1 - *(int *)s2;
+}
+
+/*
+ * Find the DFA state for the set built in dfa_set[], "flags" and "prev".
+ * Adds a new state when it does not exist yet.
+ * Returns the index of the state or DFA_FULL when out of memory.
+ */
+    static int
+nfa_dfa_lookup(dfa, flags, prev)
+    nfa_dfa_T	*dfa;
+    int		flags;
+    int		prev;
+{
+    nfa_dstate_T    *ds;
+    unsigned	    hash;
+    int		    i;
+    int		    idx;
+
+    if (dfa->dfa_setlen > 1)
+	qsort((void *)dfa->dfa_set, (size_t)dfa->dfa_setlen, sizeof(int),
+							     nfa_dfa_compare);
+    hash = (unsigned)(flags * 31 + prev);
+    for (i = 0; i < dfa->dfa_setlen; ++i)
+	hash = hash * 33 + (unsigned)dfa->dfa_set[i];
+    hash &= DFA_HASH_SIZE - 1;
+
+    for (idx = dfa->dfa_hash[hash]; idx >= 0; idx = ds->ds_hnext)
+    {
+	ds = dfa->dfa_states[idx];
+	if (ds->ds_flags == flags && ds->ds_prev == prev
+		&& ds->ds_nstate == dfa->dfa_setlen
+		&& memcmp(ds->ds_state, dfa->dfa_set,
+					  sizeof(int) * dfa->dfa_setlen) == 0)
+	    return idx;
+    }
+
+    /* Not found, add a new state.  When there are too many start all over,
+     * the states that are still useful will be added again. */
+    if (dfa->dfa_count == DFA_MAX_STATES)
+	nfa_dfa_flush(dfa);
+    ds = (nfa_dstate_T *)alloc((unsigned)(sizeof(nfa_dstate_T)
+					   + sizeof(int) * dfa->dfa_setlen));
+    if (ds == NULL)
+	return DFA_FULL;
+    for (i = 0; i < 256; ++i)
+	ds->ds_next[i] = DFA_UNKNOWN;
+    ds->ds_flags = flags;
+    ds->ds_prev = prev;
+    ds->ds_nstate = dfa->dfa_setlen;
+    mch_memmove(ds->ds_state, dfa->dfa_set, sizeof(int) * dfa->dfa_setlen);
+    idx = dfa->dfa_count++;
+    dfa->dfa_states[idx] = ds;
+    ds->ds_hnext = dfa->dfa_hash[hash];
+    dfa->dfa_hash[hash] = idx;
+    return idx;
+}
+
+/*
+ * Return the class of the character at "p" as used for \< and \>: zero for
+ * NUL, two or more for a word character.
+ */
+    static int
+nfa_dfa_class(rex, p)
+    regexec_T	*rex;
+    char_u	*p;
+{
+#ifdef FEAT_MBYTE
+    if (has_mbyte)
+	return mb_get_class_buf(p, rex->reg_buf);
+#endif
+    if (*p == NUL)
+	return 0;
+    return vim_iswordc_buf(*p, rex->reg_buf) ? 2 : 1;
+}
+
+/*
+ * Compute the transition from DFA state "ds" for character "curc" at "p",
+ * which is "clen" bytes long.  "curc" is NUL at the end of the line.
+ * Returns the index of the next state or a DFA_ value.
+ * Note that "ds" may be freed.
+ */
+    static int
+nfa_dfa_step(rex, dfa, prog, ds, curc, clen, p)
+    regexec_T	    *rex;
+    nfa_dfa_T	    *dfa;
+    nfa_regprog_T   *prog;
+    nfa_dstate_T    *ds;
+    int		    curc;
+    int		    clen;
+    char_u	    *p;
+{
+    int		cur = 0;
+    int		*work;
+    int		n;
+    int		i;
+    nfa_state_T	*state;
+
+    if (prog->dfa_flags & NFA_DFA_BOUND)
+	cur = nfa_dfa_class(rex, p);
+
+    /* Now that the character is known, check the assertions. */
+    nfa_dfa_newset(dfa, prog, 0);
+    dfa->dfa_resolve = TRUE;
+    dfa->dfa_bol = (ds->ds_flags & DS_BOL) != 0;
+    dfa->dfa_eol = (curc == NUL);
+    dfa->dfa_prev = ds->ds_prev;
+    dfa->dfa_cur = cur;
+    for (i = 0; i < ds->ds_nstate; ++i)
+	nfa_dfa_add(dfa, prog, &prog->state[ds->ds_state[i]]);
+    work = dfa->dfa_set;
+    n = dfa->dfa_setlen;
+    for (i = 0; i < n; ++i)
+	if (prog->state[work[i]].c == NFA_MATCH)
+	    return DFA_MATCHED;
+    if (curc == NUL)
+	return DFA_DEAD;
+
+    /* Advance over the character. */
+    nfa_dfa_newset(dfa, prog, 1);
+    dfa->dfa_resolve = FALSE;
+    dfa->dfa_bol = FALSE;
+    for (i = 0; i < n; ++i)
+    {
+	state = &prog->state[work[i]];
+	if (nfa_dfa_char_match(rex, state, curc, clen, p))
+	    nfa_dfa_add(dfa, prog, state->c == NFA_START_COLL
+					  || state->c == NFA_START_NEG_COLL
+					      ? state->out1->out : state->out);
+    }
+    /* A match may also start at the next position. */
+    nfa_dfa_add(dfa, prog, prog->start);
+    if (dfa->dfa_setlen == 0)
+	return DFA_DEAD;
+    return nfa_dfa_lookup(dfa, 0, cur);
+}
+
+/*
+ * Use the DFA of "prog" to check whether there can be a match in regline
+ * starting at "col".
+ * Returns FALSE when there is no match, TRUE when there might be one.
+ */
+    static int
+nfa_dfa_match(rex, prog, col)
+    regexec_T       *rex;
+    nfa_regprog_T   *prog;
+    colnr_T	    col;
+{
+    nfa_dfa_T	*dfa = prog->dfa;
+    nfa_dstate_T *ds;
+    char_u	*p = rex->line + col;
+    int		flushes;
+    int		init = FALSE;
+    int		prev = 0;
+    int		n;
+    int		c;
+    int		clen;
+#ifdef FEAT_MBYTE
+    int		enc = has_mbyte + enc_utf8 * 2 + enc_dbcs * 4;
+#endif
+
+    if (!(prog->dfa_flags & NFA_DFA_OK) || rex->reg_line_lbr)
+	return TRUE;
+    if (dfa != NULL && dfa->dfa_skip > 0)
+    {
+	--dfa->dfa_skip;
+	return TRUE;
+    }
+
+    if (dfa == NULL)
+    {
+	dfa = (nfa_dfa_T *)alloc_clear((unsigned)sizeof(nfa_dfa_T));
+	if (dfa == NULL)
+	    return TRUE;
+	dfa->dfa_mark = (int *)alloc_clear(
+					(unsigned)(sizeof(int) * prog->nstate));
+	dfa->dfa_work[0] = (int *)alloc((unsigned)(sizeof(int) * prog->nstate));
+	dfa->dfa_work[1] = (int *)alloc((unsigned)(sizeof(int) * prog->nstate));
+	if (dfa->dfa_mark == NULL || dfa->dfa_work[0] == NULL
+						   || dfa->dfa_work[1] == NULL)
+	{
+	    nfa_dfa_free(dfa);
+	    return TRUE;
+	}
+	prog->dfa = dfa;
+	init = TRUE;
+    }
+
+    /* The cached states depend on ignoring case, the encoding and
+     * 'iskeyword'. */
+    if (init
+	    || dfa->dfa_ic != rex->reg_ic
+#ifdef FEAT_MBYTE
+	    || dfa->dfa_icombine != rex->reg_icombine
+	    || dfa->dfa_enc != enc
+#endif
+	    || ((prog->dfa_flags & NFA_DFA_WORD)
+		&& memcmp(dfa->dfa_chartab, rex->reg_buf->b_chartab, 32) != 0))
+    {
+	nfa_dfa_flush(dfa);
+	dfa->dfa_ic = rex->reg_ic;
+#ifdef FEAT_MBYTE
+	dfa->dfa_icombine = rex->reg_icombine;
+	dfa->dfa_enc = enc;
+#endif
+	if (prog->dfa_flags & NFA_DFA_WORD)
+	    mch_memmove(dfa->dfa_chartab, rex->reg_buf->b_chartab, 32);
+    }
+    flushes = dfa->dfa_flushes;
+
+    /* The initial state: the start state at "col". */
+    if ((prog->dfa_flags & NFA_DFA_BOUND) && col > 0)
+    {
+	char_u	*pp = p - 1;
+
+#ifdef FEAT_MBYTE
+	if (has_mbyte)
+	    pp -= (*mb_head_off)(rex->line, pp);
+#endif
+	prev = nfa_dfa_class(rex, pp);
+    }
+    else if (prog->dfa_flags & NFA_DFA_BOUND)
+	prev = -1;
+    nfa_dfa_newset(dfa, prog, 1);
+    dfa->dfa_resolve = FALSE;
+    dfa->dfa_bol = (col == 0);
+    nfa_dfa_add(dfa, prog, prog->start);
+    n = nfa_dfa_lookup(dfa, col == 0 ? DS_BOL : 0, prev);
+
+    while (n >= 0)
+    {
+	ds = dfa->dfa_states[n];
+#ifdef FEAT_PROFILE
+	++rex->prof_steps;
+#endif
+	c = *p;
+	if (c == NUL)
+	{
+	    n = nfa_dfa_step(rex, dfa, prog, ds, NUL, 0, p);
+	    break;
+	}
+	clen = 1;
+#ifdef FEAT_MBYTE
+	if (has_mbyte && (c >= 0x80 || (enc_utf8 && p[1] >= 0x80)))
+	    clen = (*mb_ptr2len)(p);
+	if (clen > 1)
+	    n = nfa_dfa_step(rex, dfa, prog, ds, (*mb_ptr2char)(p), clen, p);
+	else
+#endif
+	{
+	    n = ds->ds_next[c];
+	    if (n == DFA_UNKNOWN)
+	    {
+		n = nfa_dfa_step(rex, dfa, prog, ds, c, 1, p);
+		/* Can't store the transition if "ds" was freed. */
+		if (n != DFA_FULL && dfa->dfa_flushes == flushes)
+		    ds->ds_next[c] = n;
+	    }
+	}
+	if (dfa->dfa_flushes - flushes > DFA_MAX_FLUSH)
+	{
+	    /* The pattern needs too many states, the DFA does not help. */
+#ifdef FEAT_PROFILE
+	    ++rex->prof_fallback;
+#endif
+	    nfa_dfa_free(dfa);
+	    prog->dfa = NULL;
+	    prog->dfa_flags = 0;
+	    return TRUE;
+	}
+	p += clen;
+    }
+
+    /* When nearly all lines match the DFA only costs time. */
+    if (n == DFA_DEAD)
+	++dfa->dfa_rejects;
+    if (++dfa->dfa_tries == DFA_PROBE)
+    {
+	if (dfa->dfa_rejects < DFA_PROBE / 8)
+	    dfa->dfa_skip = DFA_SKIP;
+	dfa->dfa_tries = 0;
+	dfa->dfa_rejects = 0;
+    }
+    return n != DFA_DEAD;
 }
 
 /*
@@ -6689,7 +7668,8 @@ theend:
  * Returns 0 for failure, number of lines contained in the match otherwise.
  */
     static long
-nfa_regtry(prog, col)
+nfa_regtry(rex, prog, col)
+    regexec_T       *rex;
     nfa_regprog_T   *prog;
     colnr_T	    col;
 {
@@ -6700,7 +7680,7 @@ nfa_regtry(prog, col)
     FILE	*f;
 #endif
 
-    reginput = regline + col;
+    rex->input = rex->line + col;
 
 #ifdef ENABLE_LOG
     f = fopen(NFA_REGEXP_RUN_LOG, "a");
@@ -6710,7 +7690,7 @@ nfa_regtry(prog, col)
 #ifdef DEBUG
 	fprintf(f, "\tRegexp is \"%s\"\n", nfa_regengine.expr);
 #endif
-	fprintf(f, "\tInput text is \"%s\" \n", reginput);
+	fprintf(f, "\tInput text is \"%s\" \n", rex->input);
 	fprintf(f, "\t=======================================================\n\n");
 	nfa_print_state(f, start);
 	fprintf(f, "\n\n");
@@ -6720,52 +7700,52 @@ nfa_regtry(prog, col)
 	EMSG(_("Could not open temporary log file for writing "));
 #endif
 
-    clear_sub(&subs.norm);
-    clear_sub(&m.norm);
+    clear_sub(rex, &subs.norm);
+    clear_sub(rex, &m.norm);
 #ifdef FEAT_SYN_HL
-    clear_sub(&subs.synt);
-    clear_sub(&m.synt);
+    clear_sub(rex, &subs.synt);
+    clear_sub(rex, &m.synt);
 #endif
 
-    if (nfa_regmatch(prog, start, &subs, &m) == FALSE)
+    if (nfa_regmatch(rex, prog, start, &subs, &m) == FALSE)
 	return 0;
 
-    cleanup_subexpr();
+    cleanup_subexpr(rex);
     if (REG_MULTI)
     {
 	for (i = 0; i < subs.norm.in_use; i++)
 	{
-	    reg_startpos[i] = subs.norm.list.multi[i].start;
-	    reg_endpos[i] = subs.norm.list.multi[i].end;
+	    rex->reg_startpos[i] = subs.norm.list.multi[i].start;
+	    rex->reg_endpos[i] = subs.norm.list.multi[i].end;
 	}
 
-	if (reg_startpos[0].lnum < 0)
+	if (rex->reg_startpos[0].lnum < 0)
 	{
-	    reg_startpos[0].lnum = 0;
-	    reg_startpos[0].col = col;
+	    rex->reg_startpos[0].lnum = 0;
+	    rex->reg_startpos[0].col = col;
 	}
-	if (reg_endpos[0].lnum < 0)
+	if (rex->reg_endpos[0].lnum < 0)
 	{
 	    /* pattern has a \ze but it didn't match, use current end */
-	    reg_endpos[0].lnum = reglnum;
-	    reg_endpos[0].col = (int)(reginput - regline);
+	    rex->reg_endpos[0].lnum = rex->lnum;
+	    rex->reg_endpos[0].col = (int)(rex->input - rex->line);
 	}
 	else
 	    /* Use line number of "\ze". */
-	    reglnum = reg_endpos[0].lnum;
+	    rex->lnum = rex->reg_endpos[0].lnum;
     }
     else
     {
 	for (i = 0; i < subs.norm.in_use; i++)
 	{
-	    reg_startp[i] = subs.norm.list.line[i].start;
-	    reg_endp[i] = subs.norm.list.line[i].end;
+	    rex->reg_startp[i] = subs.norm.list.line[i].start;
+	    rex->reg_endp[i] = subs.norm.list.line[i].end;
 	}
 
-	if (reg_startp[0] == NULL)
-	    reg_startp[0] = regline + col;
-	if (reg_endp[0] == NULL)
-	    reg_endp[0] = reginput;
+	if (rex->reg_startp[0] == NULL)
+	    rex->reg_startp[0] = rex->line + col;
+	if (rex->reg_endp[0] == NULL)
+	    rex->reg_endp[0] = rex->input;
     }
 
 #ifdef FEAT_SYN_HL
@@ -6775,7 +7755,7 @@ nfa_regtry(prog, col)
 
     if (prog->reghasz == REX_SET)
     {
-	cleanup_zsubexpr();
+	cleanup_zsubexpr(rex);
 	re_extmatch_out = make_extmatch();
 	for (i = 0; i < subs.synt.in_use; i++)
 	{
@@ -6786,7 +7766,7 @@ nfa_regtry(prog, col)
 		/* Only accept single line matches. */
 		if (mpos->start.lnum >= 0 && mpos->start.lnum == mpos->end.lnum)
 		    re_extmatch_out->matches[i] =
-			vim_strnsave(reg_getline(mpos->start.lnum)
+			vim_strnsave(reg_getline(rex, mpos->start.lnum)
 							    + mpos->start.col,
 					     mpos->end.col - mpos->start.col);
 	    }
@@ -6803,7 +7783,7 @@ nfa_regtry(prog, col)
     }
 #endif
 
-    return 1 + reglnum;
+    return 1 + rex->lnum;
 }
 
 /*
@@ -6813,27 +7793,27 @@ nfa_regtry(prog, col)
  * Returns 0 for failure, number of lines contained in the match otherwise.
  */
     static long
-nfa_regexec_both(line, startcol)
+nfa_regexec_both(rex, line, startcol)
+    regexec_T	*rex;
     char_u	*line;
     colnr_T	startcol;	/* column to start looking for match */
 {
     nfa_regprog_T   *prog;
     long	    retval = 0L;
-    int		    i;
     colnr_T	    col = startcol;
 
     if (REG_MULTI)
     {
-	prog = (nfa_regprog_T *)reg_mmatch->regprog;
-	line = reg_getline((linenr_T)0);    /* relative to the cursor */
-	reg_startpos = reg_mmatch->startpos;
-	reg_endpos = reg_mmatch->endpos;
+	prog = (nfa_regprog_T *)rex->reg_mmatch->regprog;
+	line = reg_getline(rex, (linenr_T)0);    /* relative to the cursor */
+	rex->reg_startpos = rex->reg_mmatch->startpos;
+	rex->reg_endpos = rex->reg_mmatch->endpos;
     }
     else
     {
-	prog = (nfa_regprog_T *)reg_match->regprog;
-	reg_startp = reg_match->startp;
-	reg_endp = reg_match->endp;
+	prog = (nfa_regprog_T *)rex->reg_match->regprog;
+	rex->reg_startp = rex->reg_match->startp;
+	rex->reg_endp = rex->reg_match->endp;
     }
 
     /* Be paranoid... */
@@ -6843,26 +7823,26 @@ nfa_regexec_both(line, startcol)
 	goto theend;
     }
 
-    /* If pattern contains "\c" or "\C": overrule value of ireg_ic */
+    /* If pattern contains "\c" or "\C": overrule value of reg_ic */
     if (prog->regflags & RF_ICASE)
-	ireg_ic = TRUE;
+	rex->reg_ic = TRUE;
     else if (prog->regflags & RF_NOICASE)
-	ireg_ic = FALSE;
+	rex->reg_ic = FALSE;
 
 #ifdef FEAT_MBYTE
-    /* If pattern contains "\Z" overrule value of ireg_icombine */
+    /* If pattern contains "\Z" overrule value of reg_icombine */
     if (prog->regflags & RF_ICOMBINE)
-	ireg_icombine = TRUE;
+	rex->reg_icombine = TRUE;
 #endif
 
-    regline = line;
-    reglnum = 0;    /* relative to line */
+    rex->line = line;
+    rex->lnum = 0;    /* relative to line */
 
-    nfa_has_zend = prog->has_zend;
-    nfa_has_backref = prog->has_backref;
-    nfa_nsubexpr = prog->nsubexp;
-    nfa_listid = 1;
-    nfa_alt_listid = 2;
+    rex->nfa_has_zend = prog->has_zend;
+    rex->nfa_has_backref = prog->has_backref;
+    rex->nfa_nsubexpr = prog->nsubexp;
+    rex->nfa_listid = 1;
+    rex->nfa_alt_listid = 2;
 #ifdef DEBUG
     nfa_regengine.expr = prog->pattern;
 #endif
@@ -6870,48 +7850,51 @@ nfa_regexec_both(line, startcol)
     if (prog->reganch && col > 0)
 	return 0L;
 
-    need_clear_subexpr = TRUE;
+    rex->need_clear_subexpr = TRUE;
 #ifdef FEAT_SYN_HL
     /* Clear the external match subpointers if necessary. */
     if (prog->reghasz == REX_SET)
     {
-	nfa_has_zsubexpr = TRUE;
-	need_clear_zsubexpr = TRUE;
+	rex->nfa_has_zsubexpr = TRUE;
+	rex->need_clear_zsubexpr = TRUE;
     }
     else
-	nfa_has_zsubexpr = FALSE;
+	rex->nfa_has_zsubexpr = FALSE;
 #endif
 
     if (prog->regstart != NUL)
     {
 	/* Skip ahead until a character we know the match must start with.
 	 * When there is none there is no match. */
-	if (skip_to_start(prog->regstart, &col) == FAIL)
+	if (skip_to_start(rex, prog->regstart, &col) == FAIL)
 	    return 0L;
 
 	/* If match_text is set it contains the full text that must match.
 	 * Nothing else to try. Doesn't handle combining chars well. */
 	if (prog->match_text != NULL
 #ifdef FEAT_MBYTE
-		    && !ireg_icombine
+		    && !rex->reg_icombine
 #endif
 		)
-	    return find_match_text(col, prog->regstart, prog->match_text);
+	    return find_match_text(rex, col, prog->regstart, prog->match_text);
     }
 
     /* If the start column is past the maximum column: no need to try. */
-    if (ireg_maxcol > 0 && col >= ireg_maxcol)
+    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
 	goto theend;
 
-    nstate = prog->nstate;
-    for (i = 0; i < nstate; ++i)
-    {
-	prog->state[i].id = i;
-	prog->state[i].lastlist[0] = 0;
-	prog->state[i].lastlist[1] = 0;
-    }
+    /* Skip the line when it doesn't contain text that every match has. */
+    if (!nfa_prefilter(rex, prog, col))
+	goto theend;
 
-    retval = nfa_regtry(prog, col);
+    /* Find out quickly whether there is a match at all. */
+    if (!nfa_dfa_match(rex, prog, col))
+	goto theend;
+
+    if (nfa_use_lastlist(rex, prog, 0) == FAIL)
+	goto theend;
+
+    retval = nfa_regtry(rex, prog, col);
 
 #ifdef DEBUG
     nfa_regengine.expr = NULL;
@@ -6933,6 +7916,7 @@ nfa_regcomp(expr, re_flags)
     nfa_regprog_T	*prog = NULL;
     size_t		prog_size;
     int			*postfix;
+    int			i;
 
     if (expr == NULL)
 	return NULL;
@@ -7007,11 +7991,18 @@ nfa_regcomp(expr, re_flags)
     prog->reganch = nfa_get_reganch(prog->start, 0);
     prog->regstart = nfa_get_regstart(prog->start, 0);
     prog->match_text = nfa_get_match_text(prog->start);
+    prog->dfa_flags = nfa_dfa_flags(prog);
+    prog->dfa = NULL;
+    nfa_get_literals(prog, postfix, post_ptr);
 
 #ifdef ENABLE_LOG
     nfa_postfix_dump(expr, OK);
     nfa_dump(prog);
 #endif
+
+    /* The list IDs used while matching are stored by state index. */
+    for (i = 0; i < prog->nstate; ++i)
+	prog->state[i].id = i;
 #ifdef FEAT_SYN_HL
     /* Remember whether this pattern has any \z specials in it. */
     prog->reghasz = re_has_z;
@@ -7049,6 +8040,8 @@ nfa_regfree(prog)
     if (prog != NULL)
     {
 	vim_free(((nfa_regprog_T *)prog)->match_text);
+	nfa_dfa_free(((nfa_regprog_T *)prog)->dfa);
+	vim_free(((nfa_regprog_T *)prog)->lits[0]);
 #ifdef DEBUG
 	vim_free(((nfa_regprog_T *)prog)->pattern);
 #endif
@@ -7064,51 +8057,53 @@ nfa_regfree(prog)
  * Return TRUE if there is a match, FALSE if not.
  */
     static int
-nfa_regexec(rmp, line, col)
+nfa_regexec(rex, rmp, line, col)
+    regexec_T	*rex;
     regmatch_T	*rmp;
     char_u	*line;	/* string to match against */
     colnr_T	col;	/* column to start looking for match */
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = FALSE;
-    reg_buf = curbuf;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
+    rex->reg_line_lbr = FALSE;
+    rex->reg_buf = curbuf;
+    rex->reg_win = NULL;
+    rex->reg_ic = rmp->rm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = 0;
-    return (nfa_regexec_both(line, col) != 0);
+    rex->reg_maxcol = 0;
+    return (nfa_regexec_both(rex, line, col) != 0);
 }
 
 #if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
 	|| defined(FIND_REPLACE_DIALOG) || defined(PROTO)
 
-static int  nfa_regexec_nl __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
+static int  nfa_regexec_nl __ARGS((regexec_T *rex, regmatch_T *rmp, char_u *line, colnr_T col));
 
 /*
  * Like nfa_regexec(), but consider a "\n" in "line" to be a line break.
  */
     static int
-nfa_regexec_nl(rmp, line, col)
+nfa_regexec_nl(rex, rmp, line, col)
+    regexec_T	*rex;
     regmatch_T	*rmp;
     char_u	*line;	/* string to match against */
     colnr_T	col;	/* column to start looking for match */
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = TRUE;
-    reg_buf = curbuf;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
+    rex->reg_line_lbr = TRUE;
+    rex->reg_buf = curbuf;
+    rex->reg_win = NULL;
+    rex->reg_ic = rmp->rm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = 0;
-    return (nfa_regexec_both(line, col) != 0);
+    rex->reg_maxcol = 0;
+    return (nfa_regexec_both(rex, line, col) != 0);
 }
 #endif
 
@@ -7139,7 +8134,8 @@ nfa_regexec_nl(rmp, line, col)
  * FIXME if this behavior is not compatible.
  */
     static long
-nfa_regexec_multi(rmp, win, buf, lnum, col, tm)
+nfa_regexec_multi(rex, rmp, win, buf, lnum, col, tm)
+    regexec_T	*rex;
     regmmatch_T	*rmp;
     win_T	*win;		/* window in which to search or NULL */
     buf_T	*buf;		/* buffer in which to search */
@@ -7147,20 +8143,20 @@ nfa_regexec_multi(rmp, win, buf, lnum, col, tm)
     colnr_T	col;		/* column to start looking for match */
     proftime_T	*tm UNUSED;	/* timeout limit or NULL */
 {
-    reg_match = NULL;
-    reg_mmatch = rmp;
-    reg_buf = buf;
-    reg_win = win;
-    reg_firstlnum = lnum;
-    reg_maxline = reg_buf->b_ml.ml_line_count - lnum;
-    reg_line_lbr = FALSE;
-    ireg_ic = rmp->rmm_ic;
+    rex->reg_match = NULL;
+    rex->reg_mmatch = rmp;
+    rex->reg_buf = buf;
+    rex->reg_win = win;
+    rex->reg_firstlnum = lnum;
+    rex->reg_maxline = rex->reg_buf->b_ml.ml_line_count - lnum;
+    rex->reg_line_lbr = FALSE;
+    rex->reg_ic = rmp->rmm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = rmp->rmm_maxcol;
+    rex->reg_maxcol = rmp->rmm_maxcol;
 
-    return nfa_regexec_both(NULL, col);
+    return nfa_regexec_both(rex, NULL, col);
 }
 
 #ifdef DEBUG
@@ -6422,6 +6422,9 @@ win_redr_status(wp)
 		|| wp->w_p_pvw
 #endif
 		|| bufIsChanged(wp->w_buffer)
+#ifdef FEAT_PROGRESSIVE_LOAD
+		|| wp->w_buffer->b_load != NULL
+#endif
 		|| wp->w_buffer->b_p_ro)
 	    *(p + len++) = ' ';
 	if (wp->w_buffer->b_help)
@@ -6446,6 +6449,14 @@ win_redr_status(wp)
 	    STRCPY(p + len, _("[RO]"));
 	    len += 4;
 	}
+#ifdef FEAT_PROGRESSIVE_LOAD
+	if (wp->w_buffer->b_load != NULL)
+	{
+	    sprintf((char *)p + len, _("[Loading %d%%]"),
+						buf_load_percent(wp->w_buffer));
+	    len += (int)STRLEN(p + len);
+	}
+#endif
 
 #ifndef FEAT_VERTSPLIT
 	this_ru_col = ru_col;
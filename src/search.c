@@ -620,7 +620,12 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
 
 	for (loop = 0; loop <= 1; ++loop)   /* loop twice if 'wrapscan' set */
 	{
-	    for ( ; lnum > 0 && lnum <= buf->b_ml.ml_line_count;
+	    for ( ; lnum > 0 && (lnum <= buf->b_ml.ml_line_count
+#ifdef FEAT_PROGRESSIVE_LOAD
+				/* continue into the part not read yet */
+				|| buf_load_more(buf, lnum)
+#endif
+				);
 					   lnum += dir, at_first_line = FALSE)
 	    {
 		/* Stop after checking "stop_lnum", if it's set. */
@@ -956,7 +961,12 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
 	     * written.
 	     */
 	    if (dir == BACKWARD)    /* start second loop at the other end */
+	    {
+#ifdef FEAT_PROGRESSIVE_LOAD
+		buf_load_finish(buf);
+#endif
 		lnum = buf->b_ml.ml_line_count;
+	    }
 	    else
 		lnum = 1;
 	    if (!shortmess(SHM_SEARCH) && (options & SEARCH_MSG))
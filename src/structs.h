@@ -311,11 +311,18 @@ struct u_entry
     linenr_T	ue_lcount;	/* linecount when u_save called */
     char_u	**ue_array;	/* array of lines in undo block */
     long	ue_size;	/* number of lines in ue_array */
+    int		ue_flags;	/* UE_ flags */
 #ifdef U_DEBUG
     int		ue_magic;	/* magic number to check allocation */
 #endif
 };
 
+/* values for ue_flags */
+#define UE_ONEBLOCK 0x01	/* the text of the lines is in the block of
+				   ue_array, after the pointers */
+#define UE_DELTA    0x02	/* lines are stored as the change from the
+				   lines in the buffer when the entry is used */
+
 struct u_header
 {
     /* The following have a pointer and a number. The number is used when
@@ -352,6 +359,18 @@ struct u_header
     time_t	uh_time;	/* timestamp when the change was made */
     long	uh_save_nr;	/* set when the file was saved after the
 				   changes in this block */
+#ifdef FEAT_PERSISTENT_UNDO
+    off_t	uh_file_off;	/* offset of the record for this header in
+				   the undo file, zero when not written */
+    long	uh_file_len;	/* number of bytes in that record */
+    int		uh_file_unread;	/* TRUE when uh_entry is only in the undo
+				   file or the spill file */
+    off_t	uh_spill_off;	/* offset of the record for this header in
+				   the spill file, zero when not written */
+    long	uh_spill_len;	/* number of bytes in that record */
+    long	uh_mem;		/* bytes used for uh_entry, counted when
+				   the header is closed */
+#endif
 #ifdef U_DEBUG
     int		uh_magic;	/* magic number to check allocation */
 #endif
@@ -401,6 +420,8 @@ typedef long		    blocknr_T;
  * structures as items.  This is an intrusive data structure: we require
  * that items begin with mf_hashitem_T which contains the key and linked
  * list pointers.  List of items in each bucket is doubly-linked.
+ * It is used for the trans lists, the blocks in memory are in a
+ * mf_blocktab_T.
  */
 
 typedef struct mf_hashitem_S mf_hashitem_T;
@@ -428,13 +449,13 @@ typedef struct mf_hashtab_S
 /*
  * for each (previously) used block in the memfile there is one block header.
  *
- * The block may be linked in the used list OR in the free list.
- * The used blocks are also kept in hash lists.
+ * The block may be in the block table OR in the free list.
  *
- * The used list is a doubly linked list, most recently used block first.
- *	The blocks in the used list have a block of memory allocated.
- *	mf_used_count is the number of pages in the used list.
- * The hash lists are used to quickly find a block in the used list.
+ * The block table holds the used blocks, they have a block of memory
+ *	allocated.  mf_used_count is the number of pages in the table.
+ *	When a block is needed and there are too many, one is released with
+ *	the CLOCK algorithm: it goes around the table and takes the first
+ *	unlocked block that wasn't used since the last time it came by.
  * The free list is a single linked list, not sorted.
  *	The blocks in the free list have no block of memory allocated and
  *	the contents of the block in the file (if any) is irrelevant.
@@ -442,19 +463,44 @@ typedef struct mf_hashtab_S
 
 struct block_hdr
 {
-    mf_hashitem_T bh_hashitem;      /* header for hash table and key */
-#define bh_bnum bh_hashitem.mhi_key /* block number, part of bh_hashitem */
-
-    bhdr_T	*bh_next;	    /* next block_hdr in free or used list */
-    bhdr_T	*bh_prev;	    /* previous block_hdr in used list */
+    blocknr_T	bh_bnum;	    /* block number */
+    bhdr_T	*bh_next;	    /* next block_hdr in free list */
     char_u	*bh_data;	    /* pointer to memory (for used block) */
     int		bh_page_count;	    /* number of pages in this block */
 
 #define BH_DIRTY    1
 #define BH_LOCKED   2
-    char	bh_flags;	    /* BH_DIRTY or BH_LOCKED */
+#define BH_USED	    4		    /* used since the CLOCK hand passed it */
+    char	bh_flags;	    /* BH_DIRTY, BH_LOCKED and BH_USED */
 };
 
+/*
+ * mf_blocktab_T is a hashtable with open addressing for the blocks of a
+ * memfile that are in memory.  The block number is kept next to the pointer
+ * to the block header, finding a block only looks at consecutive slots of
+ * one array.  The headers can't be in the array, memline.c keeps pointers to
+ * them while slots are moved around.
+ * There are no markers for removed items: the items after it that are out of
+ * place are moved back.
+ */
+typedef struct
+{
+    blocknr_T	mbs_bnum;	    /* block number */
+    bhdr_T	*mbs_hp;	    /* block header, NULL for an empty slot */
+} mf_blockslot_T;
+
+#define MBT_INIT_SIZE	64
+
+typedef struct mf_blocktab_S
+{
+    long_u	    mbt_mask;	    /* nr of slots - 1, a power of two - 1 */
+    long_u	    mbt_count;	    /* nr of blocks in the table */
+    long_u	    mbt_hand;	    /* slot the CLOCK hand points to */
+    mf_blockslot_T  *mbt_slots;	    /* points to mbt_small_slots or
+				     * dynamically allocated array */
+    mf_blockslot_T  mbt_small_slots[MBT_INIT_SIZE];   /* initial slots */
+} mf_blocktab_T;
+
 /*
  * when a block with a negative number is flushed to the file, it gets
  * a positive number. Because the reference to the block is still the negative
@@ -471,6 +517,26 @@ struct nr_trans
     blocknr_T	nt_new_bnum;		/* new, positive, number */
 };
 
+#ifdef FEAT_MEMZIP
+/*
+ * A block that is not in memory but kept compressed, see 'maxmemzip'.  Each
+ * memfile has them in a hash table and in a list from old to new.
+ */
+typedef struct mf_zipblock_S mf_zipblock_T;
+
+struct mf_zipblock_S
+{
+    mf_hashitem_T zb_hashitem;		/* header for hash table and key */
+#define zb_bnum zb_hashitem.mhi_key	/* block number */
+
+    mf_zipblock_T *zb_prev;		/* older compressed block */
+    mf_zipblock_T *zb_next;		/* newer compressed block */
+    int		zb_page_count;		/* number of pages in the block */
+    unsigned	zb_len;			/* length of zb_data */
+    char_u	zb_data[1];		/* compressed data (actually longer) */
+};
+#endif
+
 /*
  * structure used to store one block of the stuff/redo/recording buffers
  */
@@ -550,17 +616,63 @@ typedef struct
 
 #define MF_SEED_LEN	8
 
+#ifdef FEAT_MMAP
+/*
+ * A file that is mapped into memory.  Data blocks "mm_first" up to "mm_last"
+ * of the memfile are filled from it when they are not in memory, see
+ * ml_map_file().  These have negative numbers, like blocks that were not
+ * written to the swap file yet.  A block may span several pages, the offsets
+ * of the pages other than the first one are the same as for the first page.
+ */
+typedef struct
+{
+    char_u	*mm_data;	/* the mapped file */
+    size_t	mm_len;		/* number of bytes mapped */
+    int		mm_dos;		/* lines end in CR-NL */
+    blocknr_T	mm_first;	/* number of the first data block */
+    blocknr_T	mm_last;	/* number of the block after the last one */
+    size_t	*mm_off;	/* offset of the text of each page, plus the
+				   end of the text */
+    int		*mm_lines;	/* number of lines in the block starting at
+				   each page */
+    dev_t	mm_dev;		/* device and inode of the file */
+    ino_t	mm_ino;
+    int		mm_fd;		/* file descriptor of the file, to check if
+				   it was changed */
+    time_t	mm_mtime;	/* modification time of the file */
+# ifdef HAVE_ST_MTIM
+    long	mm_mtime_ns;	/* nanoseconds of mm_mtime */
+# endif
+    int		mm_changed;	/* the file was changed, its text is lost */
+} mlmap_T;
+#endif
+
+#ifdef FEAT_PROGRESSIVE_LOAD
+/*
+ * The rest of a file that is read into a buffer while Vim waits for the user
+ * to type something, see 'loadlines'.
+ */
+typedef struct
+{
+    int		bl_fd;		/* file descriptor, positioned after the bytes
+				   read so far */
+    int		bl_fileformat;	/* EOL_UNIX, EOL_DOS or EOL_MAC */
+    off_t	bl_done;	/* number of bytes read so far */
+    char_u	*bl_buf;	/* read buffer, starts with a partial line */
+    long	bl_len;		/* length of the partial line */
+    long	bl_size;	/* allocated size of bl_buf */
+} bufload_T;
+#endif
+
 struct memfile
 {
     char_u	*mf_fname;		/* name of the file */
     char_u	*mf_ffname;		/* idem, full path */
     int		mf_fd;			/* file descriptor */
     bhdr_T	*mf_free_first;		/* first block_hdr in free list */
-    bhdr_T	*mf_used_first;		/* mru block_hdr in used list */
-    bhdr_T	*mf_used_last;		/* lru block_hdr in used list */
-    unsigned	mf_used_count;		/* number of pages in used list */
+    mf_blocktab_T mf_blocks;		/* blocks in memory */
+    unsigned	mf_used_count;		/* number of pages in memory */
     unsigned	mf_used_count_max;	/* maximum number of pages in memory */
-    mf_hashtab_T mf_hash;		/* hash lists */
     mf_hashtab_T mf_trans;		/* trans lists */
     blocknr_T	mf_blocknr_max;		/* highest positive block number + 1*/
     blocknr_T	mf_blocknr_min;		/* lowest negative block number - 1 */
@@ -568,6 +680,16 @@ struct memfile
     blocknr_T	mf_infile_count;	/* number of pages in the file */
     unsigned	mf_page_size;		/* number of bytes in a page */
     int		mf_dirty;		/* TRUE if there are dirty blocks */
+#ifdef FEAT_MEMZIP
+    mf_hashtab_T mf_zip;		/* compressed blocks */
+    mf_zipblock_T *mf_zip_first;	/* oldest compressed block */
+    mf_zipblock_T *mf_zip_last;		/* newest compressed block */
+#endif
+#ifdef FEAT_SWAP_THREAD
+    /* Used by the writer thread, only with mf_job_mutex locked. */
+    int		mf_jobs;		/* number of jobs not done yet */
+    int		mf_job_failed;		/* TRUE when writing a job failed */
+#endif
 #ifdef FEAT_CRYPT
     buf_T	*mf_buffer;		/* bufer this memfile is for */
     char_u	mf_seed[MF_SEED_LEN];	/* seed for encryption */
@@ -578,6 +700,10 @@ struct memfile
     int		mf_old_cm;
     char_u	mf_old_seed[MF_SEED_LEN];
 #endif
+#ifdef FEAT_MMAP
+    mlmap_T	*mf_map;		/* mapped file with the text of data
+					   blocks that are not in memory */
+#endif
 };
 
 /*
@@ -596,20 +722,6 @@ typedef struct info_pointer
     int		ip_index;	/* index for block with current lnum */
 } infoptr_T;	/* block/index pair */
 
-#ifdef FEAT_BYTEOFF
-typedef struct ml_chunksize
-{
-    int		mlcs_numlines;
-    long	mlcs_totalsize;
-} chunksize_T;
-
- /* Flags when calling ml_updatechunk() */
-
-#define ML_CHNK_ADDLINE 1
-#define ML_CHNK_DELLINE 2
-#define ML_CHNK_UPDLINE 3
-#endif
-
 /*
  * the memline structure holds all the information about a memline
  */
@@ -637,9 +749,7 @@ typedef struct memline
     linenr_T	ml_locked_high;	/* last line in ml_locked */
     int		ml_locked_lineadd;  /* number of lines inserted in ml_locked */
 #ifdef FEAT_BYTEOFF
-    chunksize_T *ml_chunksize;
-    int		ml_numchunks;
-    int		ml_usedchunks;
+    long	ml_locked_byteadd;  /* number of bytes inserted in ml_locked */
 #endif
 } memline_T;
 
@@ -1398,6 +1508,9 @@ struct file_buffer
     long	b_mtime_read;	/* last change time when reading */
     off_t	b_orig_size;	/* size of original file in bytes */
     int		b_orig_mode;	/* mode of original file */
+#ifdef FEAT_PROGRESSIVE_LOAD
+    bufload_T	*b_load;	/* rest of the file still to be read */
+#endif
 
     pos_T	b_namedm[NMARKS]; /* current named marks (mark.c) */
 
@@ -1464,6 +1577,20 @@ struct file_buffer
     long	b_u_seq_cur;	/* hu_seq of header below which we are now */
     time_t	b_u_time_cur;	/* uh_time of header below which we are now */
     long	b_u_save_nr_cur; /* file write nr after which we are now */
+#ifdef FEAT_PERSISTENT_UNDO
+    char_u	*b_u_file_name;	/* undo file with the records of the headers,
+				   NULL when there is none */
+    FILE	*b_u_file_fp;	/* that undo file, kept open for reading the
+				   entries */
+    long	b_u_file_id;	/* identifies that undo file */
+    off_t	b_u_file_size;	/* size of the undo file */
+    off_t	b_u_file_used;	/* bytes in the undo file that are used */
+    FILE	*b_u_spill_fp;	/* spill file for 'undomaxmem' or NULL */
+    char_u	*b_u_spill_name; /* name of the spill file */
+    off_t	b_u_spill_size;	/* size of the spill file */
+    off_t	b_u_spill_used;	/* bytes in the spill file that are used */
+    long	b_u_mem;	/* sum of uh_mem of all headers */
+#endif
 
     /*
      * variables for "U" command in undo.c
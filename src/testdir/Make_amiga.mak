@@ -34,7 +34,26 @@ SCRIPTS = test1.out test3.out test4.out test5.out test6.out \
 		test81.out test82.out test83.out test84.out test88.out \
 		test89.out test90.out test91.out test92.out test93.out \
 		test94.out test95.out test96.out test97.out test98.out \
-		test99.out test100.out test101.out test102.out test103.out
+		test99.out test100.out test101.out test102.out test103.out \
+		test104.out \
+		test105.out \
+		test106.out \
+		test107.out \
+		test108.out \
+		test109.out \
+		test110.out \
+		test111.out \
+		test112.out \
+		test113.out \
+		test114.out \
+		test115.out \
+		test116.out \
+		test117.out \
+		test118.out \
+		test119.out \
+		test120.out \
+		test121.out \
+		test122.out
 
 .SUFFIXES: .in .out
 
@@ -154,3 +173,22 @@ test100.out: test100.in
 test101.out: test101.in
 test102.out: test102.in
 test103.out: test103.in
+test104.out: test104.in
+test105.out: test105.in
+test106.out: test106.in
+test107.out: test107.in
+test108.out: test108.in
+test109.out: test109.in
+test110.out: test110.in
+test111.out: test111.in
+test112.out: test112.in
+test113.out: test113.in
+test114.out: test114.in
+test115.out: test115.in
+test116.out: test116.in
+test117.out: test117.in
+test118.out: test118.in
+test119.out: test119.in
+test120.out: test120.in
+test121.out: test121.in
+test122.out: test122.in
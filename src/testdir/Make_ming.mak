@@ -53,7 +53,26 @@ SCRIPTS =	test3.out test4.out test5.out test6.out test7.out \
 		test84.out test85.out test86.out test87.out test88.out \
 		test89.out test90.out test91.out test92.out test93.out \
 		test94.out test95.out test96.out test98.out test99.out \
-		test100.out test101.out test102.out test103.out
+		test100.out test101.out test102.out test103.out \
+		test104.out \
+		test105.out \
+		test106.out \
+		test107.out \
+		test108.out \
+		test109.out \
+		test110.out \
+		test111.out \
+		test112.out \
+		test113.out \
+		test114.out \
+		test115.out \
+		test116.out \
+		test117.out \
+		test118.out \
+		test119.out \
+		test120.out \
+		test121.out \
+		test122.out
 
 SCRIPTS32 =	test50.out test70.out
 
@@ -0,0 +1,553 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * textscan.c: Scanning text for line breaks and checking UTF-8, used by
+ * readfile() for every byte of a file.  Also finding literal strings, used by
+ * the regexp engines to skip lines that cannot match.
+ *
+ * On x86 the bytes are checked 16 (SSE2) or 32 (AVX2) at a time.  Which
+ * version is used is decided the first time, depending on what the CPU
+ * supports.  Elsewhere, or when the compiler can't produce the vector code,
+ * a plain loop is used.  All versions give the same results.
+ */
+
+#include "vim.h"
+
+#if defined(HAVE_X86_CPU_DISPATCH) && defined(__SSE2__)
+# define SCAN_VECTOR
+# include <immintrin.h>
+#endif
+
+static long scan_eol_scalar __ARGS((char_u *p, long len, int mac));
+static long scan_count_scalar __ARGS((char_u *p, long len, int c));
+static long scan_ascii_scalar __ARGS((char_u *p, long len));
+static int scan_lit_at __ARGS((char_u *p, char_u *lit, int len, int ic));
+static int scan_any_at __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+static long scan_find_scalar __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+#ifdef SCAN_VECTOR
+static long scan_eol_sse2 __ARGS((char_u *p, long len, int mac));
+static long scan_count_sse2 __ARGS((char_u *p, long len, int c));
+static long scan_ascii_sse2 __ARGS((char_u *p, long len));
+static long scan_find_sse2 __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+static long scan_eol_avx2 __ARGS((char_u *p, long len, int mac));
+static long scan_count_avx2 __ARGS((char_u *p, long len, int c));
+static long scan_ascii_avx2 __ARGS((char_u *p, long len));
+static long scan_find_avx2 __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+#endif
+static void scan_select __ARGS((void));
+
+static int scan_level = -1;	/* SCAN_SCALAR etc., -1 when not set yet */
+static long (*scan_eol_fn) __ARGS((char_u *p, long len, int mac));
+static long (*scan_count_fn) __ARGS((char_u *p, long len, int c));
+static long (*scan_ascii_fn) __ARGS((char_u *p, long len));
+static long (*scan_find_fn) __ARGS((char_u *p, long len, char_u **lits, int *lens, int n, int ic));
+
+/*
+ * Plain versions, also used for the bytes after the last full vector.
+ */
+    static long
+scan_eol_scalar(p, len, mac)
+    char_u	*p;
+    long	len;
+    int		mac;
+{
+    long	i;
+
+    for (i = 0; i < len; ++i)
+	if (p[i] == NL || p[i] == NUL || (mac && p[i] == CAR))
+	    break;
+    return i;
+}
+
+    static long
+scan_count_scalar(p, len, c)
+    char_u	*p;
+    long	len;
+    int		c;
+{
+    long	i;
+    long	n = 0;
+
+    for (i = 0; i < len; ++i)
+	if (p[i] == c)
+	    ++n;
+    return n;
+}
+
+    static long
+scan_ascii_scalar(p, len)
+    char_u	*p;
+    long	len;
+{
+    long	i;
+
+    for (i = 0; i < len; ++i)
+	if (p[i] >= 0x80)
+	    break;
+    return i;
+}
+
+/*
+ * Return TRUE when "len" bytes at "p" are equal to "lit".  When "ic" is TRUE
+ * ASCII letters match in either case.
+ */
+    static int
+scan_lit_at(p, lit, len, ic)
+    char_u	*p;
+    char_u	*lit;
+    int		len;
+    int		ic;
+{
+    int		i;
+
+    if (!ic)
+	return memcmp(p, lit, (size_t)len) == 0;
+    for (i = 0; i < len; ++i)
+	if (TOLOWER_ASC(p[i]) != TOLOWER_ASC(lit[i]))
+	    return FALSE;
+    return TRUE;
+}
+
+/*
+ * Return TRUE when one of the "n" strings in "lits" is at "p", with "len"
+ * bytes available.
+ */
+    static int
+scan_any_at(p, len, lits, lens, n, ic)
+    char_u	*p;
+    long	len;
+    char_u	**lits;
+    int		*lens;
+    int		n;
+    int		ic;
+{
+    int		k;
+
+    for (k = 0; k < n; ++k)
+	if (lens[k] <= len && scan_lit_at(p, lits[k], lens[k], ic))
+	    return TRUE;
+    return FALSE;
+}
+
+    static long
+scan_find_scalar(p, len, lits, lens, n, ic)
+    char_u	*p;
+    long	len;
+    char_u	**lits;
+    int		*lens;
+    int		n;
+    int		ic;
+{
+    char_u	*s;
+    long	i;
+
+    if (n == 1 && !ic)
+    {
+	/* One string: memchr() for the first byte is fast enough. */
+	for (s = p; (s = memchr(s, lits[0][0], (size_t)(len - (s - p))))
+							       != NULL; ++s)
+	    if (lens[0] <= len - (s - p)
+				   && scan_lit_at(s, lits[0], lens[0], FALSE))
+		return (long)(s - p);
+	return -1;
+    }
+    for (i = 0; i < len; ++i)
+	if (scan_any_at(p + i, len - i, lits, lens, n, ic))
+	    return i;
+    return -1;
+}
+
+#ifdef SCAN_VECTOR
+/*
+ * For scan_find(): bits to set in a byte before comparing it with letter "c",
+ * so that both cases match.
+ */
+# define SCAN_FOLD(c, ic) ((ic) && ASCII_ISALPHA(c) ? 0x20 : 0)
+
+/*
+ * SSE2 is always there on x86_64, these only need the compiler flags.
+ */
+    static long
+scan_eol_sse2(p, len, mac)
+    char_u	*p;
+    long	len;
+    int		mac;
+{
+    __m128i	nl = _mm_set1_epi8(NL);
+    __m128i	cr = _mm_set1_epi8(mac ? CAR : NUL);
+    __m128i	nul = _mm_setzero_si128();
+    __m128i	v;
+    int		mask;
+    long	i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+	v = _mm_loadu_si128((__m128i *)(p + i));
+	mask = _mm_movemask_epi8(_mm_or_si128(
+		    _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, nul)),
+		    _mm_cmpeq_epi8(v, cr)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    return i + scan_eol_scalar(p + i, len - i, mac);
+}
+
+    static long
+scan_count_sse2(p, len, c)
+    char_u	*p;
+    long	len;
+    int		c;
+{
+    __m128i	cv = _mm_set1_epi8((char)c);
+    long	i;
+    long	n = 0;
+
+    for (i = 0; i + 16 <= len; i += 16)
+	n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((__m128i *)(p + i)), cv)));
+    return n + scan_count_scalar(p + i, len - i, c);
+}
+
+    static long
+scan_ascii_sse2(p, len)
+    char_u	*p;
+    long	len;
+{
+    int		mask;
+    long	i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+	/* the top bit of each byte is set for non-ASCII */
+	mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i *)(p + i)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    return i + scan_ascii_scalar(p + i, len - i);
+}
+
+/*
+ * Look for all the strings at once: for each string compare its first byte
+ * at every position and its last byte at the same distance, somewhat like the
+ * "Teddy" algorithm of Hyperscan.  Only where both match the whole string is
+ * compared.
+ */
+    static long
+scan_find_sse2(p, len, lits, lens, n, ic)
+    char_u	*p;
+    long	len;
+    char_u	**lits;
+    int		*lens;
+    int		n;
+    int		ic;
+{
+    __m128i	first[SCAN_MAX_LITS];
+    __m128i	ffold[SCAN_MAX_LITS];
+    __m128i	last[SCAN_MAX_LITS];
+    __m128i	lfold[SCAN_MAX_LITS];
+    __m128i	v;
+    int		maxlen = 0;
+    int		mask;
+    int		c;
+    int		j;
+    int		k;
+    long	i;
+    long	r;
+
+    for (k = 0; k < n; ++k)
+    {
+	c = lits[k][0];
+	ffold[k] = _mm_set1_epi8((char)SCAN_FOLD(c, ic));
+	first[k] = _mm_set1_epi8((char)(c | SCAN_FOLD(c, ic)));
+	c = lits[k][lens[k] - 1];
+	lfold[k] = _mm_set1_epi8((char)SCAN_FOLD(c, ic));
+	last[k] = _mm_set1_epi8((char)(c | SCAN_FOLD(c, ic)));
+	if (lens[k] > maxlen)
+	    maxlen = lens[k];
+    }
+
+    for (i = 0; i + maxlen + 15 <= len; i += 16)
+    {
+	v = _mm_loadu_si128((__m128i *)(p + i));
+	mask = 0;
+	for (k = 0; k < n; ++k)
+	    mask |= _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(_mm_or_si128(v, ffold[k]), first[k]),
+		    _mm_cmpeq_epi8(_mm_or_si128(_mm_loadu_si128(
+			      (__m128i *)(p + i + lens[k] - 1)), lfold[k]),
+								  last[k])));
+	for ( ; mask != 0; mask &= mask - 1)
+	{
+	    j = __builtin_ctz(mask);
+	    if (scan_any_at(p + i + j, len - i - j, lits, lens, n, ic))
+		return i + j;
+	}
+    }
+    r = scan_find_scalar(p + i, len - i, lits, lens, n, ic);
+    return r < 0 ? -1 : i + r;
+}
+
+/*
+ * AVX2 versions, only used when the CPU supports it.
+ * The bytes after the last full vector are done by the SSE2 version, which
+ * uses the legacy encoding.  The upper halves of the ymm registers must be
+ * cleared first, otherwise every SSE instruction after it is very slow.
+ */
+    __attribute__((target("avx2")))
+    static long
+scan_eol_avx2(p, len, mac)
+    char_u	*p;
+    long	len;
+    int		mac;
+{
+    __m256i	nl = _mm256_set1_epi8(NL);
+    __m256i	cr = _mm256_set1_epi8(mac ? CAR : NUL);
+    __m256i	nul = _mm256_setzero_si256();
+    __m256i	v;
+    unsigned	mask;
+    long	i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+	v = _mm256_loadu_si256((__m256i *)(p + i));
+	mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+	      _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+					       _mm256_cmpeq_epi8(v, nul)),
+	      _mm256_cmpeq_epi8(v, cr)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return i + scan_eol_sse2(p + i, len - i, mac);
+}
+
+    __attribute__((target("avx2")))
+    static long
+scan_count_avx2(p, len, c)
+    char_u	*p;
+    long	len;
+    int		c;
+{
+    __m256i	cv = _mm256_set1_epi8((char)c);
+    long	i;
+    long	n = 0;
+
+    for (i = 0; i + 32 <= len; i += 32)
+	n += __builtin_popcount((unsigned)_mm256_movemask_epi8(
+		    _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(p + i)),
+									cv)));
+    _mm256_zeroupper();
+    return n + scan_count_sse2(p + i, len - i, c);
+}
+
+    __attribute__((target("avx2")))
+    static long
+scan_ascii_avx2(p, len)
+    char_u	*p;
+    long	len;
+{
+    unsigned	mask;
+    long	i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+	mask = (unsigned)_mm256_movemask_epi8(
+				     _mm256_loadu_si256((__m256i *)(p + i)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return i + scan_ascii_sse2(p + i, len - i);
+}
+
+    __attribute__((target("avx2")))
+    static long
+scan_find_avx2(p, len, lits, lens, n, ic)
+    char_u	*p;
+    long	len;
+    char_u	**lits;
+    int		*lens;
+    int		n;
+    int		ic;
+{
+    __m256i	first[SCAN_MAX_LITS];
+    __m256i	ffold[SCAN_MAX_LITS];
+    __m256i	last[SCAN_MAX_LITS];
+    __m256i	lfold[SCAN_MAX_LITS];
+    __m256i	v;
+    int		maxlen = 0;
+    unsigned	mask;
+    int		c;
+    int		j;
+    int		k;
+    long	i;
+    long	r;
+
+    for (k = 0; k < n; ++k)
+    {
+	c = lits[k][0];
+	ffold[k] = _mm256_set1_epi8((char)SCAN_FOLD(c, ic));
+	first[k] = _mm256_set1_epi8((char)(c | SCAN_FOLD(c, ic)));
+	c = lits[k][lens[k] - 1];
+	lfold[k] = _mm256_set1_epi8((char)SCAN_FOLD(c, ic));
+	last[k] = _mm256_set1_epi8((char)(c | SCAN_FOLD(c, ic)));
+	if (lens[k] > maxlen)
+	    maxlen = lens[k];
+    }
+
+    for (i = 0; i + maxlen + 31 <= len; i += 32)
+    {
+	v = _mm256_loadu_si256((__m256i *)(p + i));
+	mask = 0;
+	for (k = 0; k < n; ++k)
+	    mask |= (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+		  _mm256_cmpeq_epi8(_mm256_or_si256(v, ffold[k]), first[k]),
+		  _mm256_cmpeq_epi8(_mm256_or_si256(_mm256_loadu_si256(
+			      (__m256i *)(p + i + lens[k] - 1)), lfold[k]),
+								  last[k])));
+	for ( ; mask != 0; mask &= mask - 1)
+	{
+	    j = __builtin_ctz(mask);
+	    if (scan_any_at(p + i + j, len - i - j, lits, lens, n, ic))
+	    {
+		_mm256_zeroupper();
+		return i + j;
+	    }
+	}
+    }
+    _mm256_zeroupper();
+    r = scan_find_sse2(p + i, len - i, lits, lens, n, ic);
+    return r < 0 ? -1 : i + r;
+}
+#endif
+
+/*
+ * Select the best version the CPU supports, unless one was set with
+ * scan_set_level().
+ */
+    static void
+scan_select()
+{
+    (void)scan_set_level(SCAN_AVX2);
+}
+
+/*
+ * Use version "level" of the scanning functions: SCAN_SCALAR, SCAN_SSE2 or
+ * SCAN_AVX2.  When that is not supported the best one below it is used.
+ * Returns the level used.  Meant for benchmarks and tests.
+ */
+    int
+scan_set_level(level)
+    int		level;
+{
+#ifdef SCAN_VECTOR
+    __builtin_cpu_init();
+    if (level >= SCAN_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+	scan_eol_fn = scan_eol_avx2;
+	scan_count_fn = scan_count_avx2;
+	scan_ascii_fn = scan_ascii_avx2;
+	scan_find_fn = scan_find_avx2;
+	return scan_level = SCAN_AVX2;
+    }
+    if (level >= SCAN_SSE2)
+    {
+	scan_eol_fn = scan_eol_sse2;
+	scan_count_fn = scan_count_sse2;
+	scan_ascii_fn = scan_ascii_sse2;
+	scan_find_fn = scan_find_sse2;
+	return scan_level = SCAN_SSE2;
+    }
+#endif
+    scan_eol_fn = scan_eol_scalar;
+    scan_count_fn = scan_count_scalar;
+    scan_ascii_fn = scan_ascii_scalar;
+    scan_find_fn = scan_find_scalar;
+    return scan_level = SCAN_SCALAR;
+}
+
+/*
+ * Return the number of bytes at "p", at most "len", before the first NL or
+ * NUL.  When "mac" is TRUE also stop at a CR.
+ */
+    long
+scan_eol(p, len, mac)
+    char_u	*p;
+    long	len;
+    int		mac;
+{
+    if (scan_level < 0)
+	scan_select();
+    return scan_eol_fn(p, len, mac);
+}
+
+/*
+ * Return the number of times byte "c" appears in "len" bytes at "p".
+ */
+    long
+scan_count(p, len, c)
+    char_u	*p;
+    long	len;
+    int		c;
+{
+    if (scan_level < 0)
+	scan_select();
+    return scan_count_fn(p, len, c);
+}
+
+/*
+ * Return the offset of the first of the "n" strings in "lits" found in "len"
+ * bytes at "p", -1 when there is none.  "lens" has the length of each string,
+ * at least one.  "n" is at most SCAN_MAX_LITS.  When "ic" is TRUE ASCII
+ * letters match in either case.
+ */
+    long
+scan_find(p, len, lits, lens, n, ic)
+    char_u	*p;
+    long	len;
+    char_u	**lits;
+    int		*lens;
+    int		n;
+    int		ic;
+{
+    if (scan_level < 0)
+	scan_select();
+    return scan_find_fn(p, len, lits, lens, n, ic);
+}
+
+#if defined(FEAT_MBYTE) || defined(PROTO)
+/*
+ * Return the number of bytes at "p", at most "len", that are valid UTF-8.
+ * Stops at an illegal byte or at a character that is cut off by "len".
+ * What is valid is decided by utf_ptr2len_len(), ASCII is skipped over a
+ * vector at a time.
+ */
+    long
+scan_utf8(p, len)
+    char_u	*p;
+    long	len;
+{
+    long	i = 0;
+    int		l;
+
+    if (scan_level < 0)
+	scan_select();
+    for (;;)
+    {
+	i += scan_ascii_fn(p + i, len - i);
+	if (i >= len)
+	    return len;
+	l = utf_ptr2len_len(p + i, (int)(len - i));
+	if (l == 1 || l > len - i)
+	    return i;
+	i += l;
+    }
+}
+#endif
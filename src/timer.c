@@ -0,0 +1,322 @@
+/* vi:set ts=8 sts=4 sw=4:
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * timer.c: Timers, see ":help timers".
+ *
+ * The timers are kept in a binary min-heap ordered on their deadline, the
+ * one that expires first is at the top.  ev_next() doesn't wait for input
+ * longer than timer_wait_time().  When a deadline has passed it returns
+ * K_USEREVENT, like for an event, and apply_event_autocmd() invokes the
+ * callbacks through timer_run_due().  Thus callbacks run in the same places
+ * as the User autocommands of events.
+ */
+
+#include "vim.h"
+
+#if defined(FEAT_TIMERS) || defined(PROTO)
+
+typedef struct
+{
+    int		    tr_id;
+    struct timeval  tr_due;	    /* when the callback is to be invoked */
+    long	    tr_interval;    /* msec between invocations */
+    int		    tr_repeat;	    /* invocations left, -1 for no limit */
+    char_u	    *tr_callback;   /* function name, see func_ref() */
+} timer_T;
+
+/* The heap: item "i" is due before items "2 * i + 1" and "2 * i + 2". */
+static garray_T	timer_heap = {0, 0, sizeof(timer_T *), 10, NULL};
+static int	last_timer_id = 0;
+
+#define HEAP_ITEM(i)	(((timer_T **)timer_heap.ga_data)[i])
+
+static long timer_usec_diff __ARGS((struct timeval *a, struct timeval *b));
+static void heap_up __ARGS((int idx));
+static void heap_down __ARGS((int idx));
+static void heap_remove __ARGS((int idx));
+static int heap_find __ARGS((int id));
+static void timer_free __ARGS((timer_T *timer));
+static void timer_set_due __ARGS((timer_T *timer, struct timeval *from));
+static void timer_invoke __ARGS((timer_T *timer));
+
+/*
+ * Return the time from "b" to "a" in usec, negative when "a" is earlier.
+ * Timers are never far away, this doesn't overflow.
+ */
+    static long
+timer_usec_diff(a, b)
+    struct timeval	*a;
+    struct timeval	*b;
+{
+    return (long)(a->tv_sec - b->tv_sec) * 1000000L
+					       + (long)(a->tv_usec - b->tv_usec);
+}
+
+/*
+ * Move the timer at "idx" up until its parent is due before it.
+ */
+    static void
+heap_up(idx)
+    int		idx;
+{
+    timer_T	*timer = HEAP_ITEM(idx);
+    int		parent;
+
+    while (idx > 0)
+    {
+	parent = (idx - 1) / 2;
+	if (timer_usec_diff(&HEAP_ITEM(parent)->tr_due, &timer->tr_due) <= 0)
+	    break;
+	HEAP_ITEM(idx) = HEAP_ITEM(parent);
+	idx = parent;
+    }
+    HEAP_ITEM(idx) = timer;
+}
+
+/*
+ * Move the timer at "idx" down until its children are due after it.
+ */
+    static void
+heap_down(idx)
+    int		idx;
+{
+    timer_T	*timer = HEAP_ITEM(idx);
+    int		child;
+
+    for (;;)
+    {
+	child = 2 * idx + 1;
+	if (child >= timer_heap.ga_len)
+	    break;
+	if (child + 1 < timer_heap.ga_len
+		&& timer_usec_diff(&HEAP_ITEM(child + 1)->tr_due,
+					       &HEAP_ITEM(child)->tr_due) < 0)
+	    ++child;
+	if (timer_usec_diff(&timer->tr_due, &HEAP_ITEM(child)->tr_due) <= 0)
+	    break;
+	HEAP_ITEM(idx) = HEAP_ITEM(child);
+	idx = child;
+    }
+    HEAP_ITEM(idx) = timer;
+}
+
+/*
+ * Take the timer at "idx" out of the heap.  It is not freed.
+ */
+    static void
+heap_remove(idx)
+    int		idx;
+{
+    --timer_heap.ga_len;
+    if (idx == timer_heap.ga_len)
+	return;
+    HEAP_ITEM(idx) = HEAP_ITEM(timer_heap.ga_len);
+    heap_down(idx);
+    heap_up(idx);
+}
+
+/*
+ * Return the index of timer "id" in the heap, -1 when not found.
+ */
+    static int
+heap_find(id)
+    int		id;
+{
+    int		i;
+
+    for (i = 0; i < timer_heap.ga_len; ++i)
+	if (HEAP_ITEM(i)->tr_id == id)
+	    return i;
+    return -1;
+}
+
+    static void
+timer_free(timer)
+    timer_T	*timer;
+{
+    func_unref(timer->tr_callback);
+    vim_free(timer->tr_callback);
+    vim_free(timer);
+}
+
+/*
+ * Set the deadline of "timer" to its interval after "from".
+ */
+    static void
+timer_set_due(timer, from)
+    timer_T		*timer;
+    struct timeval	*from;
+{
+    long	usec = from->tv_usec + (timer->tr_interval % 1000) * 1000L;
+
+    timer->tr_due.tv_sec = from->tv_sec + timer->tr_interval / 1000
+							   + usec / 1000000L;
+    timer->tr_due.tv_usec = usec % 1000000L;
+}
+
+/*
+ * Start a timer that invokes function "callback" after "msec" milliseconds,
+ * "repeat" times or without limit when it is -1.
+ * Returns the timer ID, zero when out of memory.
+ */
+    int
+timer_start(msec, callback, repeat)
+    long	msec;
+    char_u	*callback;
+    int		repeat;
+{
+    timer_T	    *timer;
+    struct timeval  now;
+
+    if (ga_grow(&timer_heap, 1) == FAIL)
+	return 0;
+    timer = (timer_T *)alloc_clear((unsigned)sizeof(timer_T));
+    if (timer == NULL)
+	return 0;
+    timer->tr_callback = vim_strsave(callback);
+    if (timer->tr_callback == NULL)
+    {
+	vim_free(timer);
+	return 0;
+    }
+    func_ref(timer->tr_callback);
+
+    timer->tr_id = ++last_timer_id;
+    timer->tr_interval = msec;
+    timer->tr_repeat = repeat == 0 ? 1 : repeat;
+    gettimeofday(&now, NULL);
+    timer_set_due(timer, &now);
+
+    HEAP_ITEM(timer_heap.ga_len++) = timer;
+    heap_up(timer_heap.ga_len - 1);
+    return timer->tr_id;
+}
+
+/*
+ * Stop timer "id".  Returns FAIL when there is no such timer.
+ */
+    int
+timer_stop(id)
+    int		id;
+{
+    int		idx = heap_find(id);
+    timer_T	*timer;
+
+    if (idx < 0)
+	return FAIL;
+    timer = HEAP_ITEM(idx);
+    heap_remove(idx);
+    timer_free(timer);
+    return OK;
+}
+
+/*
+ * Return the number of msec until the first timer expires, rounded up.
+ * Zero when it expired already, -1 when there are no timers.
+ */
+    long
+timer_wait_time()
+{
+    struct timeval  now;
+    long	    usec;
+
+    if (timer_heap.ga_len == 0)
+	return -1L;
+    gettimeofday(&now, NULL);
+    usec = timer_usec_diff(&HEAP_ITEM(0)->tr_due, &now);
+    if (usec <= 0)
+	return 0L;
+    return (usec + 999L) / 1000L;
+}
+
+/*
+ * Return TRUE when a timer has expired.
+ */
+    int
+timer_due()
+{
+    return timer_wait_time() == 0;
+}
+
+/*
+ * Invoke the callback of "timer" with the timer ID as argument.  The timer
+ * is stopped when the callback gives an error, to avoid a flood of error
+ * messages.
+ */
+    static void
+timer_invoke(timer)
+    timer_T	*timer;
+{
+    char_u	idbuf[NUMBUFLEN];
+    char_u	*argv[1];
+    char_u	*callback;
+    typval_T	rettv;
+    int		id = timer->tr_id;
+    int		save_called_emsg = called_emsg;
+
+    /* The timer may be stopped while the callback runs. */
+    callback = vim_strsave(timer->tr_callback);
+    if (callback == NULL)
+	return;
+    func_ref(callback);
+
+    sprintf((char *)idbuf, "%d", id);
+    argv[0] = idbuf;
+    /* did_emsg is reset after an error in a function without "abort". */
+    called_emsg = FALSE;
+    if (call_vim_function(callback, 1, argv, FALSE, FALSE, &rettv) == OK)
+	clear_tv(&rettv);
+    if (called_emsg)
+	timer_stop(id);
+    called_emsg |= save_called_emsg;
+
+    func_unref(callback);
+    vim_free(callback);
+}
+
+/*
+ * Invoke the callbacks of all timers that expired.  A repeating timer is
+ * rescheduled at its previous deadline plus the interval, so that it doesn't
+ * drift, unless that is already in the past.
+ */
+    void
+timer_run_due()
+{
+    struct timeval  now;
+    timer_T	    *timer;
+
+    gettimeofday(&now, NULL);
+    while (timer_heap.ga_len > 0
+	    && timer_usec_diff(&HEAP_ITEM(0)->tr_due, &now) <= 0)
+    {
+	timer = HEAP_ITEM(0);
+	if (timer->tr_repeat > 0)
+	    --timer->tr_repeat;
+	if (timer->tr_repeat == 0)
+	{
+	    heap_remove(0);
+	    timer_invoke(timer);
+	    timer_free(timer);
+	}
+	else
+	{
+	    /* A zero interval would expire again right away. */
+	    if (timer->tr_interval == 0)
+		timer->tr_interval = 1;
+	    timer_set_due(timer, &timer->tr_due);
+	    if (timer_usec_diff(&timer->tr_due, &now) <= 0)
+		timer_set_due(timer, &now);
+	    heap_down(0);
+	    timer_invoke(timer);
+	}
+    }
+}
+
+#endif /* FEAT_TIMERS */
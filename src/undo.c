@@ -88,7 +88,7 @@ static void u_unch_branch __ARGS((u_header_T *uhp));
 static u_entry_T *u_get_headentry __ARGS((void));
 static void u_getbot __ARGS((void));
 static void u_doit __ARGS((int count));
-static void u_undoredo __ARGS((int undo));
+static int  u_undoredo __ARGS((int undo));
 static void u_undo_end __ARGS((int did_undo, int absolute));
 static void u_add_time __ARGS((char_u *buf, size_t buflen, time_t tt));
 static void u_freeheader __ARGS((buf_T *buf, u_header_T *uhp, u_header_T **uhpp));
@@ -101,19 +101,62 @@ static void u_free_uhp __ARGS((u_header_T *uhp));
 static size_t fwrite_crypt __ARGS((buf_T *buf UNUSED, char_u *ptr, size_t len, FILE *fp));
 static char_u *read_string_decrypt __ARGS((buf_T *buf UNUSED, FILE *fd, int len));
 static int serialize_header __ARGS((FILE *fp, buf_T *buf, char_u *hash));
+static int serialize_state __ARGS((FILE *fp, buf_T *buf, char_u *hash));
 static int serialize_uhp __ARGS((FILE *fp, buf_T *buf, u_header_T *uhp));
-static u_header_T *unserialize_uhp __ARGS((FILE *fp, char_u *file_name));
+static u_header_T *unserialize_uhp __ARGS((FILE *fp, buf_T *buf, char_u *file_name, int entries));
 static int serialize_uep __ARGS((FILE *fp, buf_T *buf, u_entry_T *uep));
-static u_entry_T *unserialize_uep __ARGS((FILE *fp, int *error, char_u *file_name));
+static u_entry_T *unserialize_uep __ARGS((FILE *fp, buf_T *buf, int *error, char_u *file_name));
 static void serialize_pos __ARGS((pos_T pos, FILE *fp));
 static void unserialize_pos __ARGS((pos_T *pos, FILE *fp));
 static void serialize_visualinfo __ARGS((visualinfo_T *info, FILE *fp));
 static void unserialize_visualinfo __ARGS((visualinfo_T *info, FILE *fp));
 static void put_header_ptr __ARGS((FILE	*fp, u_header_T *uhp));
+static void put_off __ARGS((FILE *fp, off_t off));
+static off_t get_off __ARGS((FILE *fp));
+static u_header_T *u_walk_next __ARGS((u_header_T *uhp, int mark));
+static void u_forget_record __ARGS((buf_T *buf, u_header_T *uhp));
+static void u_forget_undofile __ARGS((buf_T *buf));
+static void u_keep_undofile __ARGS((buf_T *buf, FILE *fp));
+static FILE *u_open_undofile __ARGS((buf_T *buf));
+static int u_read_entries __ARGS((buf_T *buf, u_header_T *uhp, FILE *fp, off_t off, char_u *file_name));
+static int u_load_entries __ARGS((buf_T *buf, u_header_T *uhp));
+static int u_load_all_entries __ARGS((buf_T *buf, int spilled));
+static void u_update_mem __ARGS((buf_T *buf, u_header_T *uhp));
+static int u_copy_record __ARGS((FILE *from, off_t off, long len, FILE *to));
+static int u_spill_open __ARGS((buf_T *buf));
+static void u_spill_close __ARGS((buf_T *buf));
+static int u_collect_headers __ARGS((u_header_T *uhp, u_header_T **table, int count, int size));
+static void u_spill_compact __ARGS((buf_T *buf));
+static int u_spill_header __ARGS((buf_T *buf, u_header_T *uhp));
+static int
+# ifdef __BORLANDC__
+_RTLENTRYF
+# endif
+	u_seq_compare __ARGS((const void *s1, const void *s2));
+static void u_spill_check __ARGS((buf_T *buf));
+static int u_write_journal __ARGS((FILE *fp, buf_T *buf, char_u *hash));
 #endif
 
 #define U_ALLOC_LINE(size) lalloc((long_u)(size), FALSE)
 static char_u *u_save_line __ARGS((linenr_T));
+static char_u **u_save_lines __ARGS((linenr_T lnum, long count));
+static void u_free_lines __ARGS((char_u **array, long n, int flags));
+#ifdef FEAT_PERSISTENT_UNDO
+static void u_pack_lines __ARGS((u_entry_T *uep));
+#endif
+static char_u *u_put_number __ARGS((char_u *p, long n));
+static long u_get_number __ARGS((char_u **pp));
+static int u_number_len __ARGS((long n));
+static void u_delta_range __ARGS((char_u *line, int len, char_u *bline, int *pre, int *suf));
+static void u_encode_entry __ARGS((u_entry_T *uep, char_u **base, linenr_T base_lnum, long base_count));
+static int u_decode_entry __ARGS((u_entry_T *uep, linenr_T base_lnum, long base_count));
+static void u_encode_header __ARGS((u_header_T *uhp));
+#if defined(FEAT_EVAL) || defined(FEAT_PERSISTENT_UNDO)
+static long u_entry_mem __ARGS((u_entry_T *uep));
+#endif
+
+/* number of lines u_save_lines() gets from a data block at a time */
+#define U_SAVE_CHUNK 100
 
 /* used in undo_end() to report number of added and deleted lines */
 static long	u_newcount, u_oldcount;
@@ -362,7 +405,6 @@ u_savecommon(top, bot, newbot, reload)
     linenr_T	newbot;
     int		reload;
 {
-    linenr_T	lnum;
     long	i;
     u_header_T	*uhp;
     u_header_T	*old_curhead;
@@ -377,6 +419,12 @@ u_savecommon(top, bot, newbot, reload)
 	if (!undo_allowed())
 	    return FAIL;
 
+#ifdef FEAT_PROGRESSIVE_LOAD
+	/* Read the rest of the file before the text is changed, so that
+	 * lines are never appended to a buffer with undo information. */
+	buf_load_finish(curbuf);
+#endif
+
 #ifdef FEAT_NETBEANS_INTG
 	/*
 	 * Netbeans defines areas that cannot be modified.  Bail out here when
@@ -518,6 +566,14 @@ u_savecommon(top, bot, newbot, reload)
 	uhp->uh_walk = 0;
 	uhp->uh_entry = NULL;
 	uhp->uh_getbot_entry = NULL;
+#ifdef FEAT_PERSISTENT_UNDO
+	uhp->uh_file_off = 0;
+	uhp->uh_file_len = 0;
+	uhp->uh_file_unread = FALSE;
+	uhp->uh_spill_off = 0;
+	uhp->uh_spill_len = 0;
+	uhp->uh_mem = 0;
+#endif
 	uhp->uh_cursor = curwin->w_cursor;	/* save cursor pos. for undo */
 #ifdef FEAT_VIRTUALEDIT
 	if (virtual_active() && curwin->w_cursor.coladd > 0)
@@ -545,6 +601,10 @@ u_savecommon(top, bot, newbot, reload)
     {
 	if (get_undolevel() < 0)	/* no undo at all */
 	    return OK;
+#ifdef FEAT_PERSISTENT_UNDO
+	/* Entries are added to the header or changed. */
+	u_forget_record(curbuf, curbuf->b_u_newhead);
+#endif
 
 	/*
 	 * When saving a single line, and it has been saved just before, it
@@ -564,6 +624,11 @@ u_savecommon(top, bot, newbot, reload)
 		if (uep == NULL)
 		    break;
 
+		/* An entry stored as changes must stay as it is, the ones
+		 * before it too. */
+		if (uep->ue_flags & UE_DELTA)
+		    break;
+
 		/* If lines have been inserted/deleted we give up.
 		 * Also when the line was included in a multi-line save. */
 		if ((curbuf->b_u_newhead->uh_getbot_entry != uep
@@ -658,26 +723,14 @@ u_savecommon(top, bot, newbot, reload)
 
     if (size > 0)
     {
-	if ((uep->ue_array = (char_u **)U_ALLOC_LINE(
-					    sizeof(char_u *) * size)) == NULL)
+	if ((uep->ue_array = u_save_lines(top + 1, size)) == NULL)
 	{
 	    u_freeentry(uep, 0L);
-	    goto nomem;
-	}
-	for (i = 0, lnum = top + 1; i < size; ++i)
-	{
-	    fast_breakcheck();
 	    if (got_int)
-	    {
-		u_freeentry(uep, i);
 		return FAIL;
-	    }
-	    if ((uep->ue_array[i] = u_save_line(lnum++)) == NULL)
-	    {
-		u_freeentry(uep, i);
-		goto nomem;
-	    }
+	    goto nomem;
 	}
+	uep->ue_flags = UE_ONEBLOCK;
     }
     else
 	uep->ue_array = NULL;
@@ -711,8 +764,35 @@ nomem:
 # define UF_HEADER_END_MAGIC	0xe7aa	/* magic after last header */
 # define UF_ENTRY_MAGIC		0xf518	/* magic at start of entry */
 # define UF_ENTRY_END_MAGIC	0x3581	/* magic after last entry */
+# define UF_ENTRY_DELTA_MAGIC	0xf519	/* idem, lines stored as changes */
 # define UF_VERSION		2	/* 2-byte undofile version number */
 # define UF_VERSION_CRYPT	0x8002	/* idem, encrypted */
+# define UF_VERSION_JOURNAL	3	/* idem, journal */
+# define UF_TREE_MAGIC		0x7e35	/* magic at start of tree record */
+
+/*
+ * Version 3 of the undo file is a journal: writing it appends records,
+ * reading it only reads what is needed.  After the magic and the version
+ * come a number that identifies the file and the offset of the last tree
+ * record, then the records:
+ * - A header record, like a header in version 2, for each header that is
+ *   new or was changed since it was last written.
+ * - A tree record with the info of the header in version 2 and for every
+ *   undo header the sequence numbers of its links, uh_flags, uh_save_nr and
+ *   the offset and length of its header record.
+ * The offset at the start is only updated after a tree record was written,
+ * an interrupted write leaves the file usable.
+ * Reading gets the tree record and the header records without their entries,
+ * these are read when undo reaches the header.  The file stays open for that
+ * as long as the records are used, when it is removed or rewritten by another
+ * Vim the entries can still be read.  When 'key' is set the whole file is
+ * written in version 2.
+ */
+# define UF_JOURNAL_COMMIT	(UF_START_MAGIC_LEN + 2 + 4) /* offset of the
+						   last tree record offset */
+# define UF_JOURNAL_START	(UF_JOURNAL_COMMIT + 8)	/* first record */
+# define UF_JOURNAL_SLACK	65536L	/* unused bytes allowed in the journal
+					   on top of the used ones */
 
 /* extra fields for header */
 # define UF_LAST_SAVE_NR	1
@@ -887,7 +967,7 @@ fwrite_crypt(buf, ptr, len, fp)
 
 /*
  * Read a string of length "len" from "fd".
- * When 'key' is set decrypt the bytes.
+ * When "buf" is not NULL and 'key' is set decrypt the bytes.
  */
     static char_u *
 read_string_decrypt(buf, fd, len)
@@ -899,7 +979,7 @@ read_string_decrypt(buf, fd, len)
 
     ptr = read_string(fd, len);
 #ifdef FEAT_CRYPT
-    if (ptr != NULL && *buf->b_p_key != NUL)
+    if (ptr != NULL && buf != NULL && *buf->b_p_key != NUL)
 	crypt_decode(ptr, len);
 #endif
     return ptr;
@@ -941,6 +1021,19 @@ serialize_header(fp, buf, hash)
 #endif
 	put_bytes(fp, (long_u)UF_VERSION, 2);
 
+    return serialize_state(fp, buf, hash);
+}
+
+/*
+ * Write the undo info of "buf" that is not in the headers.
+ */
+    static int
+serialize_state(fp, buf, hash)
+    FILE	*fp;
+    buf_T	*buf;
+    char_u	*hash;
+{
+    int len;
 
     /* Write a hash of the buffer text, so that we can verify it is still the
      * same when reading the buffer text. */
@@ -1025,7 +1118,8 @@ serialize_uhp(fp, buf, uhp)
     /* Write all the entries. */
     for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
     {
-	put_bytes(fp, (long_u)UF_ENTRY_MAGIC, 2);
+	put_bytes(fp, (long_u)((uep->ue_flags & UE_DELTA)
+				 ? UF_ENTRY_DELTA_MAGIC : UF_ENTRY_MAGIC), 2);
 	if (serialize_uep(fp, buf, uep) == FAIL)
 	    return FAIL;
     }
@@ -1033,10 +1127,17 @@ serialize_uhp(fp, buf, uhp)
     return OK;
 }
 
+/*
+ * Read an undo header from "fp".  When "buf" is not NULL the text is
+ * decrypted with its key.  When "entries" is FALSE only read the header, not
+ * its entries.
+ */
     static u_header_T *
-unserialize_uhp(fp, file_name)
+unserialize_uhp(fp, buf, file_name, entries)
     FILE	*fp;
+    buf_T	*buf;
     char_u	*file_name;
+    int		entries;
 {
     u_header_T	*uhp;
     int		i;
@@ -1102,12 +1203,15 @@ unserialize_uhp(fp, file_name)
 	}
     }
 
+    if (!entries)
+	return uhp;
+
     /* Unserialize the uep list. */
     last_uep = NULL;
-    while ((c = get2c(fp)) == UF_ENTRY_MAGIC)
+    while ((c = get2c(fp)) == UF_ENTRY_MAGIC || c == UF_ENTRY_DELTA_MAGIC)
     {
 	error = FALSE;
-	uep = unserialize_uep(fp, &error, file_name);
+	uep = unserialize_uep(fp, buf, &error, file_name);
 	if (last_uep == NULL)
 	    uhp->uh_entry = uep;
 	else
@@ -1118,6 +1222,8 @@ unserialize_uhp(fp, file_name)
 	    u_free_uhp(uhp);
 	    return NULL;
 	}
+	if (c == UF_ENTRY_DELTA_MAGIC)
+	    uep->ue_flags |= UE_DELTA;
     }
     if (c != UF_ENTRY_END_MAGIC)
     {
@@ -1157,8 +1263,9 @@ serialize_uep(fp, buf, uep)
 }
 
     static u_entry_T *
-unserialize_uep(fp, error, file_name)
+unserialize_uep(fp, buf, error, file_name)
     FILE	*fp;
+    buf_T	*buf;
     int		*error;
     char_u	*file_name;
 {
@@ -1197,7 +1304,7 @@ unserialize_uep(fp, error, file_name)
     {
 	line_len = get4c(fp);
 	if (line_len >= 0)
-	    line = read_string_decrypt(curbuf, fp, line_len);
+	    line = read_string_decrypt(buf, fp, line_len);
 	else
 	{
 	    line = NULL;
@@ -1210,6 +1317,7 @@ unserialize_uep(fp, error, file_name)
 	}
 	array[i] = line;
     }
+    u_pack_lines(uep);
     return uep;
 }
 
@@ -1293,6 +1401,634 @@ put_header_ptr(fp, uhp)
     put_bytes(fp, (long_u)(uhp != NULL ? uhp->uh_seq : 0), 4);
 }
 
+/*
+ * Write file offset "off" to "fp" in 8 bytes.
+ */
+    static void
+put_off(fp, off)
+    FILE	*fp;
+    off_t	off;
+{
+    /* Shift in two steps, off_t may be 4 bytes. */
+    put_bytes(fp, (long_u)(off >> 16 >> 16), 4);
+    put_bytes(fp, (long_u)off & 0xffffffffUL, 4);
+}
+
+/*
+ * Read a file offset written with put_off() from "fp".
+ */
+    static off_t
+get_off(fp)
+    FILE	*fp;
+{
+    off_t	off;
+
+    off = (off_t)(unsigned)get4c(fp) << 16 << 16;
+    return off | (off_t)(unsigned)get4c(fp);
+}
+
+/*
+ * Return the header after "uhp" when going over the whole undo tree,
+ * starting at b_u_oldhead.  Headers may be found more than once, the caller
+ * must put "mark" in uh_walk of the headers it has seen.
+ */
+    static u_header_T *
+u_walk_next(uhp, mark)
+    u_header_T	*uhp;
+    int		mark;
+{
+    /* Algorithm from undo_time(). */
+    if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark)
+	return uhp->uh_prev.ptr;
+    if (uhp->uh_alt_next.ptr != NULL && uhp->uh_alt_next.ptr->uh_walk != mark)
+	return uhp->uh_alt_next.ptr;
+    if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL
+					 && uhp->uh_next.ptr->uh_walk != mark)
+	return uhp->uh_next.ptr;
+    if (uhp->uh_alt_prev.ptr != NULL)
+	return uhp->uh_alt_prev.ptr;
+    return uhp->uh_next.ptr;
+}
+
+/*
+ * Header "uhp" of "buf" is changed or freed, its records in the undo file and
+ * the spill file can no longer be used.
+ */
+    static void
+u_forget_record(buf, uhp)
+    buf_T	*buf;
+    u_header_T	*uhp;
+{
+    if (uhp == NULL)
+	return;
+    if (uhp->uh_file_off != 0)
+    {
+	buf->b_u_file_used -= uhp->uh_file_len;
+	uhp->uh_file_off = 0;
+	uhp->uh_file_len = 0;
+    }
+    if (uhp->uh_spill_off != 0)
+    {
+	buf->b_u_spill_used -= uhp->uh_spill_len;
+	uhp->uh_spill_off = 0;
+	uhp->uh_spill_len = 0;
+    }
+}
+
+/*
+ * Forget about the undo file of "buf", the next write starts a new one.
+ * The entries of all headers must have been read from it.
+ */
+    static void
+u_forget_undofile(buf)
+    buf_T	*buf;
+{
+    u_header_T	*uhp;
+    int		mark;
+
+    mark = ++lastmark;
+    for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+	if (uhp->uh_walk != mark)
+	{
+	    uhp->uh_walk = mark;
+	    uhp->uh_file_off = 0;
+	    uhp->uh_file_len = 0;
+	}
+    vim_free(buf->b_u_file_name);
+    buf->b_u_file_name = NULL;
+    if (buf->b_u_file_fp != NULL)
+    {
+	fclose(buf->b_u_file_fp);
+	buf->b_u_file_fp = NULL;
+    }
+    buf->b_u_file_size = 0;
+    buf->b_u_file_used = 0;
+}
+
+/*
+ * Keep undo file "fp" open for reading the entries of the headers of "buf".
+ */
+    static void
+u_keep_undofile(buf, fp)
+    buf_T	*buf;
+    FILE	*fp;
+{
+#ifdef HAVE_FD_CLOEXEC
+    int		fdflags = fcntl(fileno(fp), F_GETFD);
+
+    /* Don't let shell commands inherit it. */
+    if (fdflags >= 0 && (fdflags & FD_CLOEXEC) == 0)
+	fcntl(fileno(fp), F_SETFD, fdflags | FD_CLOEXEC);
+#endif
+    buf->b_u_file_fp = fp;
+}
+
+/*
+ * Open the undo file of "buf" for appending and check it is the one the
+ * headers were written to or read from and nobody else appended to it.
+ * Returns NULL when it can't be used.
+ */
+    static FILE *
+u_open_undofile(buf)
+    buf_T	*buf;
+{
+    FILE	*fp = NULL;
+    int		fd;
+    char_u	magic_buf[UF_START_MAGIC_LEN];
+
+    if (buf->b_u_file_name == NULL)
+	return NULL;
+    fd = mch_open((char *)buf->b_u_file_name, O_RDWR|O_EXTRA, 0);
+    if (fd >= 0 && (fp = fdopen(fd, "r+")) == NULL)
+	close(fd);
+    if (fp == NULL)
+	return NULL;
+    if (fread(magic_buf, UF_START_MAGIC_LEN, 1, fp) != 1
+		|| memcmp(magic_buf, UF_START_MAGIC, UF_START_MAGIC_LEN) != 0
+		|| get2c(fp) != UF_VERSION_JOURNAL
+		|| get4c(fp) != buf->b_u_file_id
+		|| fseek(fp, 0L, SEEK_END) != 0
+		|| ftell(fp) != (long)buf->b_u_file_size)
+    {
+	fclose(fp);
+	return NULL;
+    }
+    return fp;
+}
+
+/*
+ * Read the entries of header "uhp" of "buf" from the record at "off" in file
+ * "fp", called "file_name".
+ */
+    static int
+u_read_entries(buf, uhp, fp, off, file_name)
+    buf_T	*buf;
+    u_header_T	*uhp;
+    FILE	*fp;
+    off_t	off;
+    char_u	*file_name;
+{
+    u_header_T	*file_uhp;
+
+    if (fseek(fp, (long)off, SEEK_SET) != 0 || get2c(fp) != UF_HEADER_MAGIC)
+    {
+	corruption_error("header offset", file_name);
+	return FAIL;
+    }
+    file_uhp = unserialize_uhp(fp, NULL, file_name, TRUE);
+    if (file_uhp == NULL)
+	return FAIL;
+    if (file_uhp->uh_seq != uhp->uh_seq)
+    {
+	corruption_error("uh_seq", file_name);
+	u_free_uhp(file_uhp);
+	return FAIL;
+    }
+    uhp->uh_entry = file_uhp->uh_entry;
+    uhp->uh_file_unread = FALSE;
+    file_uhp->uh_entry = NULL;
+    u_free_uhp(file_uhp);
+    u_update_mem(buf, uhp);
+    return OK;
+}
+
+/*
+ * Make sure the entries of header "uhp" of "buf" are in memory.
+ * Returns FAIL when they could not be read, an error message was given.
+ */
+    static int
+u_load_entries(buf, uhp)
+    buf_T	*buf;
+    u_header_T	*uhp;
+{
+    if (!uhp->uh_file_unread)
+	return OK;
+    if (uhp->uh_spill_off != 0 && buf->b_u_spill_fp != NULL)
+	return u_read_entries(buf, uhp, buf->b_u_spill_fp, uhp->uh_spill_off,
+							  buf->b_u_spill_name);
+    if (buf->b_u_file_fp == NULL)
+    {
+	EMSG2(_(e_intern2), "u_load_entries()");
+	return FAIL;
+    }
+    return u_read_entries(buf, uhp, buf->b_u_file_fp, uhp->uh_file_off,
+							   buf->b_u_file_name);
+}
+
+/*
+ * Make sure the entries of all headers of "buf" are in memory.  When
+ * "spilled" is FALSE entries that are in the spill file are left there.
+ * Returns FAIL when they could not be read, an error message was given.
+ */
+    static int
+u_load_all_entries(buf, spilled)
+    buf_T	*buf;
+    int		spilled;
+{
+    u_header_T	*uhp;
+    int		mark;
+
+    mark = ++lastmark;
+    for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+	if (uhp->uh_walk != mark)
+	{
+	    uhp->uh_walk = mark;
+	    if (!uhp->uh_file_unread)
+		continue;
+	    if (!spilled && uhp->uh_spill_off != 0
+					       && buf->b_u_spill_fp != NULL)
+		continue;
+	    if (u_load_entries(buf, uhp) == FAIL)
+		return FAIL;
+	}
+    return OK;
+}
+
+/*
+ * Write the undo info of "buf" to journal "fp" at b_u_file_size: a record
+ * for each header that isn't in the file yet and a tree record, then make
+ * that tree record the current one.
+ */
+    static int
+u_write_journal(fp, buf, hash)
+    FILE	*fp;
+    buf_T	*buf;
+    char_u	*hash;
+{
+    u_header_T	*uhp;
+    off_t	off = buf->b_u_file_size;
+    off_t	tree_off;
+    int		mark;
+    int		retval = FAIL;
+
+    if (fseek(fp, (long)off, SEEK_SET) != 0)
+	return FAIL;
+
+    mark = ++lastmark;
+    for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+	if (uhp->uh_walk != mark)
+	{
+	    uhp->uh_walk = mark;
+	    if (uhp->uh_file_off != 0)
+		continue;
+	    if (uhp->uh_file_unread)
+	    {
+		/* The entries are only in the spill file, copy the record. */
+		if (uhp->uh_spill_off == 0 || buf->b_u_spill_fp == NULL
+			|| u_copy_record(buf->b_u_spill_fp, uhp->uh_spill_off,
+						  uhp->uh_spill_len, fp) == FAIL)
+		    goto theend;
+	    }
+	    else if (serialize_uhp(fp, buf, uhp) == FAIL)
+		goto theend;
+	    uhp->uh_file_off = off;
+	    off = (off_t)ftell(fp);
+	    uhp->uh_file_len = (long)(off - uhp->uh_file_off);
+	    buf->b_u_file_used += uhp->uh_file_len;
+	}
+
+    tree_off = off;
+    put_bytes(fp, (long_u)UF_TREE_MAGIC, 2);
+    if (serialize_state(fp, buf, hash) == FAIL)
+	goto theend;
+    mark = ++lastmark;
+    for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
+	if (uhp->uh_walk != mark)
+	{
+	    uhp->uh_walk = mark;
+	    put_bytes(fp, (long_u)uhp->uh_seq, 4);
+	    put_header_ptr(fp, uhp->uh_next.ptr);
+	    put_header_ptr(fp, uhp->uh_prev.ptr);
+	    put_header_ptr(fp, uhp->uh_alt_next.ptr);
+	    put_header_ptr(fp, uhp->uh_alt_prev.ptr);
+	    put_bytes(fp, (long_u)uhp->uh_flags, 2);
+	    put_bytes(fp, (long_u)uhp->uh_save_nr, 4);
+	    put_off(fp, uhp->uh_file_off);
+	    put_bytes(fp, (long_u)uhp->uh_file_len, 4);
+	}
+    put_bytes(fp, (long_u)UF_HEADER_END_MAGIC, 2);
+    if (fflush(fp) != 0 || ferror(fp))
+	goto theend;
+    off = (off_t)ftell(fp);
+
+    /* Only now the new records become part of the file. */
+    if (fseek(fp, (long)UF_JOURNAL_COMMIT, SEEK_SET) != 0)
+	goto theend;
+    put_off(fp, tree_off);
+    if (fflush(fp) == 0 && !ferror(fp))
+    {
+	buf->b_u_file_size = off;
+	retval = OK;
+    }
+
+theend:
+    if (retval == FAIL)
+    {
+	/* The records written now are not in the file. */
+	mark = ++lastmark;
+	for (uhp = buf->b_u_oldhead; uhp != NULL;
+					       uhp = u_walk_next(uhp, mark))
+	    if (uhp->uh_walk != mark)
+	    {
+		uhp->uh_walk = mark;
+		if (uhp->uh_file_off >= buf->b_u_file_size)
+		    u_forget_record(buf, uhp);
+	    }
+    }
+    return retval;
+}
+
+/*
+ * Count the bytes used for the entries of header "uhp" of "buf".
+ */
+    static void
+u_update_mem(buf, uhp)
+    buf_T	*buf;
+    u_header_T	*uhp;
+{
+    u_entry_T	*uep;
+    long	mem = 0;
+
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+	mem += u_entry_mem(uep);
+    buf->b_u_mem += mem - uhp->uh_mem;
+    uhp->uh_mem = mem;
+}
+
+/*
+ * Copy the "len" bytes at "off" in file "from" to file "to".
+ */
+    static int
+u_copy_record(from, off, len, to)
+    FILE	*from;
+    off_t	off;
+    long	len;
+    FILE	*to;
+{
+    char_u	buf[4096];
+    size_t	n;
+
+    if (fseek(from, (long)off, SEEK_SET) != 0)
+	return FAIL;
+    while (len > 0)
+    {
+	n = len > (long)sizeof(buf) ? sizeof(buf) : (size_t)len;
+	if (fread(buf, n, (size_t)1, from) != 1
+					   || fwrite(buf, n, (size_t)1, to) != 1)
+	    return FAIL;
+	len -= (long)n;
+    }
+    return OK;
+}
+
+/*
+ * The spill file of a buffer keeps the entries of undo headers that were
+ * freed to stay below 'undomaxmem'.  It starts with the undo file magic,
+ * followed by header records like in an undo file.  A record stays valid
+ * until the entries of its header change, then the header is written again
+ * when it is spilled.
+ */
+    static int
+u_spill_open(buf)
+    buf_T	*buf;
+{
+    if (buf->b_u_spill_fp != NULL)
+	return OK;
+    buf->b_u_spill_name = vim_tempname('u');
+    if (buf->b_u_spill_name == NULL)
+	return FAIL;
+    buf->b_u_spill_fp = mch_fopen((char *)buf->b_u_spill_name, "w+b");
+    if (buf->b_u_spill_fp == NULL
+	    || fwrite(UF_START_MAGIC, (size_t)UF_START_MAGIC_LEN, (size_t)1,
+						     buf->b_u_spill_fp) != 1)
+    {
+	u_spill_close(buf);
+	return FAIL;
+    }
+    buf->b_u_spill_size = UF_START_MAGIC_LEN;
+    buf->b_u_spill_used = 0;
+    return OK;
+}
+
+/*
+ * Close and delete the spill file of "buf".  No header must use it.
+ */
+    static void
+u_spill_close(buf)
+    buf_T	*buf;
+{
+    if (buf->b_u_spill_fp != NULL)
+    {
+	fclose(buf->b_u_spill_fp);
+	buf->b_u_spill_fp = NULL;
+    }
+    if (buf->b_u_spill_name != NULL)
+    {
+	mch_remove(buf->b_u_spill_name);
+	vim_free(buf->b_u_spill_name);
+	buf->b_u_spill_name = NULL;
+    }
+    buf->b_u_spill_size = 0;
+    buf->b_u_spill_used = 0;
+}
+
+/*
+ * Put header "uhp", the newer ones and their alternate branches in "table"
+ * from index "count", up to "size" of them.  Doesn't use uh_walk, undo may be
+ * using it.  Returns the new count.
+ */
+    static int
+u_collect_headers(uhp, table, count, size)
+    u_header_T	*uhp;
+    u_header_T	**table;
+    int		count;
+    int		size;
+{
+    while (uhp != NULL && count < size)
+    {
+	table[count++] = uhp;
+	if (uhp->uh_alt_next.ptr != NULL)
+	    count = u_collect_headers(uhp->uh_alt_next.ptr, table, count,
+									size);
+	uhp = uhp->uh_prev.ptr;
+    }
+    return count;
+}
+
+/*
+ * Copy the used records of the spill file of "buf" to a new spill file, to
+ * get rid of the records that are no longer used.
+ */
+    static void
+u_spill_compact(buf)
+    buf_T	*buf;
+{
+    char_u	*name;
+    FILE	*fp;
+    u_header_T	**table;
+    int		count;
+    int		i;
+    off_t	off;
+
+    if (buf->b_u_spill_used == 0)
+    {
+	/* Nothing is used, start writing at the start again. */
+	buf->b_u_spill_size = UF_START_MAGIC_LEN;
+	return;
+    }
+
+    table = (u_header_T **)alloc(
+			     (unsigned)(sizeof(u_header_T *) * buf->b_u_numhead));
+    if (table == NULL)
+	return;
+    count = u_collect_headers(buf->b_u_oldhead, table, 0, buf->b_u_numhead);
+    name = vim_tempname('u');
+    fp = name == NULL ? NULL : mch_fopen((char *)name, "w+b");
+    if (fp == NULL)
+    {
+	vim_free(name);
+	vim_free(table);
+	return;
+    }
+    if (fwrite(UF_START_MAGIC, (size_t)UF_START_MAGIC_LEN, (size_t)1, fp)
+									 != 1)
+	goto fail;
+    for (i = 0; i < count; ++i)
+	if (table[i]->uh_spill_off != 0 && u_copy_record(buf->b_u_spill_fp,
+		     table[i]->uh_spill_off, table[i]->uh_spill_len, fp) == FAIL)
+	    goto fail;
+    if (fflush(fp) != 0 || ferror(fp))
+	goto fail;
+
+    /* All records were copied, now use the new offsets. */
+    off = UF_START_MAGIC_LEN;
+    for (i = 0; i < count; ++i)
+	if (table[i]->uh_spill_off != 0)
+	{
+	    table[i]->uh_spill_off = off;
+	    off += table[i]->uh_spill_len;
+	}
+    vim_free(table);
+    u_spill_close(buf);
+    buf->b_u_spill_fp = fp;
+    buf->b_u_spill_name = name;
+    buf->b_u_spill_size = off;
+    buf->b_u_spill_used = off - UF_START_MAGIC_LEN;
+    return;
+
+fail:
+    vim_free(table);
+    fclose(fp);
+    mch_remove(name);
+    vim_free(name);
+}
+
+/*
+ * Free the entries of header "uhp" of "buf", after writing them to the spill
+ * file when they are not there yet.
+ */
+    static int
+u_spill_header(buf, uhp)
+    buf_T	*buf;
+    u_header_T	*uhp;
+{
+    u_entry_T	*uep, *nuep;
+    FILE	*fp;
+    off_t	off;
+
+    if (uhp->uh_file_unread)
+	return OK;
+    if (uhp->uh_spill_off == 0)
+    {
+	if (u_spill_open(buf) == FAIL)
+	    return FAIL;
+	fp = buf->b_u_spill_fp;
+	off = buf->b_u_spill_size;
+	if (fseek(fp, (long)off, SEEK_SET) != 0
+		|| serialize_uhp(fp, buf, uhp) == FAIL
+		|| fflush(fp) != 0 || ferror(fp))
+	    return FAIL;
+	uhp->uh_spill_off = off;
+	uhp->uh_spill_len = (long)((off_t)ftell(fp) - off);
+	buf->b_u_spill_size = off + uhp->uh_spill_len;
+	buf->b_u_spill_used += uhp->uh_spill_len;
+    }
+
+    for (uep = uhp->uh_entry; uep != NULL; uep = nuep)
+    {
+	nuep = uep->ue_next;
+	u_freeentry(uep, uep->ue_size);
+    }
+    uhp->uh_entry = NULL;
+    uhp->uh_file_unread = TRUE;
+    buf->b_u_mem -= uhp->uh_mem;
+    uhp->uh_mem = 0;
+    return OK;
+}
+
+/*
+ * Sort compare function: older header first.
+ */
+    static int
+#ifdef __BORLANDC__
+_RTLENTRYF
+#endif
+u_seq_compare(s1, s2)
+    const void	*s1;
+    const void	*s2;
+{
+    long	seq1 = (*(u_header_T **)s1)->uh_seq;
+    long	seq2 = (*(u_header_T **)s2)->uh_seq;
+
+    return seq1 == seq2 ? 0 : seq1 > seq2 ? 1 : -1;
+}
+
+/*
+ * When the undo blocks of "buf" use more memory than 'undomaxmem', move the
+ * entries of the oldest ones to the spill file until they use a quarter
+ * less.  The blocks used by the next undo and redo stay in memory.
+ */
+    static void
+u_spill_check(buf)
+    buf_T	*buf;
+{
+    long	limit = p_umm * 1024L;
+    u_header_T	**table;
+    u_header_T	*uhp;
+    int		count;
+    int		i;
+
+    if (p_umm <= 0 || buf->b_u_mem <= limit || buf->b_u_numhead <= 0
+#ifdef FEAT_CRYPT
+	    /* Don't put the text of an encrypted buffer in a file. */
+	    || *buf->b_p_key != NUL
+#endif
+	    )
+	return;
+
+    table = (u_header_T **)alloc(
+			      (unsigned)(sizeof(u_header_T *) * buf->b_u_numhead));
+    if (table == NULL)
+	return;
+    count = u_collect_headers(buf->b_u_oldhead, table, 0, buf->b_u_numhead);
+    qsort((void *)table, (size_t)count, sizeof(u_header_T *), u_seq_compare);
+    for (i = 0; i < count && buf->b_u_mem > limit - limit / 4; ++i)
+    {
+	uhp = table[i];
+	if (uhp->uh_mem > 0
+		&& uhp != buf->b_u_newhead && uhp != buf->b_u_curhead
+		&& (buf->b_u_curhead == NULL
+				    || uhp != buf->b_u_curhead->uh_next.ptr)
+		&& u_spill_header(buf, uhp) == FAIL)
+	    break;
+    }
+    vim_free(table);
+
+    if (buf->b_u_spill_size - buf->b_u_spill_used
+			      > buf->b_u_spill_used + UF_JOURNAL_SLACK)
+	u_spill_compact(buf);
+}
+
 /*
  * Write the undo tree in an undo file.
  * When "name" is not NULL, use it as the name of the undo file.
@@ -1301,6 +2037,8 @@ put_header_ptr(fp, uhp)
  * permissions.
  * "forceit" is TRUE for ":wundo!", FALSE otherwise.
  * "hash[UNDO_HASH_SIZE]" must be the hash value of the buffer text.
+ * When the file is the undo file the headers were written to or read from,
+ * only the changes are appended.
  */
     void
 u_write_undo(name, forceit, buf, hash)
@@ -1319,6 +2057,7 @@ u_write_undo(name, forceit, buf, hash)
     FILE	*fp = NULL;
     int		perm;
     int		write_ok = FALSE;
+    int		journal = TRUE;
 #ifdef UNIX
     int		st_old_valid = FALSE;
     struct stat	st_old;
@@ -1370,6 +2109,44 @@ u_write_undo(name, forceit, buf, hash)
     /* strip any s-bit */
     perm = perm & 0777;
 
+#ifdef FEAT_CRYPT
+    /* An encrypted undo file can't be appended to. */
+    if (*buf->b_p_key != NUL)
+	journal = FALSE;
+#endif
+
+    /* Append to the undo file when the headers are in it, unless too much of
+     * it is no longer used. */
+    if (journal && buf->b_u_file_name != NULL
+	    && fnamecmp(file_name, buf->b_u_file_name) == 0
+	    && buf->b_u_file_size - buf->b_u_file_used
+				 <= buf->b_u_file_used + UF_JOURNAL_SLACK
+	    && (buf->b_u_numhead > 0 || buf->b_u_line_ptr != NULL)
+	    && (fp = u_open_undofile(buf)) != NULL)
+    {
+	if (p_verbose > 0)
+	{
+	    verbose_enter();
+	    smsg((char_u *)_("Appending to undo file: %s"), file_name);
+	    verbose_leave();
+	}
+	u_sync(TRUE);
+	if (u_write_journal(fp, buf, hash) == OK)
+	    write_ok = TRUE;
+	goto write_error;
+    }
+
+    /* All of the undo file is written now, the entries that are only in the
+     * old one must be read first.  Spilled entries are copied to a journal
+     * as they are.  When that fails the undo history is incomplete, drop
+     * it. */
+    if (u_load_all_entries(buf, !journal) == FAIL)
+    {
+	u_blockfree(buf);
+	u_clearall(buf);
+    }
+    u_forget_undofile(buf);
+
     /* If the undo file already exists, verify that it actually is an undo
      * file, and delete it. */
     if (mch_getperm(file_name) >= 0)
@@ -1428,8 +2205,9 @@ u_write_undo(name, forceit, buf, hash)
 	goto theend;
     }
 
-    fd = mch_open((char *)file_name,
-			    O_CREAT|O_EXTRA|O_WRONLY|O_EXCL|O_NOFOLLOW, perm);
+    /* A journal is kept open for reading the entries. */
+    fd = mch_open((char *)file_name, (journal ? O_RDWR : O_WRONLY)
+				     |O_CREAT|O_EXTRA|O_EXCL|O_NOFOLLOW, perm);
     if (fd < 0)
     {
 	EMSG2(_(e_not_open), file_name);
@@ -1468,7 +2246,7 @@ u_write_undo(name, forceit, buf, hash)
 # endif
 #endif
 
-    fp = fdopen(fd, "w");
+    fp = fdopen(fd, journal ? "w+" : "w");
     if (fp == NULL)
     {
 	EMSG2(_(e_not_open), file_name);
@@ -1480,6 +2258,35 @@ u_write_undo(name, forceit, buf, hash)
     /* Undo must be synced. */
     u_sync(TRUE);
 
+    if (journal)
+    {
+	/*
+	 * Start a new journal and append everything to it.
+	 */
+	buf->b_u_file_id = ((long)time(NULL) ^ (mch_get_pid() << 16))
+								& 0x7fffffffL;
+	if (fwrite(UF_START_MAGIC, (size_t)UF_START_MAGIC_LEN, (size_t)1, fp)
+									 != 1
+		|| put_bytes(fp, (long_u)UF_VERSION_JOURNAL, 2) == FAIL
+		|| put_bytes(fp, (long_u)buf->b_u_file_id, 4) == FAIL)
+	    goto write_error;
+	put_off(fp, (off_t)0);
+	buf->b_u_file_size = UF_JOURNAL_START;
+	buf->b_u_file_used = 0;
+	if (u_write_journal(fp, buf, hash) == FAIL)
+	    goto write_error;
+	buf->b_u_file_name = vim_strsave(file_name);
+	if (buf->b_u_file_name == NULL)
+	    u_forget_undofile(buf);
+	else
+	{
+	    u_keep_undofile(buf, fp);
+	    fp = NULL;
+	}
+	write_ok = TRUE;
+	goto write_error;
+    }
+
     /*
      * Write the header.
      */
@@ -1494,9 +2301,7 @@ u_write_undo(name, forceit, buf, hash)
      * Iteratively serialize UHPs and their UEPs from the top down.
      */
     mark = ++lastmark;
-    uhp = buf->b_u_oldhead;
-    while (uhp != NULL)
-    {
+    for (uhp = buf->b_u_oldhead; uhp != NULL; uhp = u_walk_next(uhp, mark))
 	/* Serialize current UHP if we haven't seen it */
 	if (uhp->uh_walk != mark)
 	{
@@ -1508,21 +2313,6 @@ u_write_undo(name, forceit, buf, hash)
 		goto write_error;
 	}
 
-	/* Now walk through the tree - algorithm from undo_time(). */
-	if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark)
-	    uhp = uhp->uh_prev.ptr;
-	else if (uhp->uh_alt_next.ptr != NULL
-				     && uhp->uh_alt_next.ptr->uh_walk != mark)
-	    uhp = uhp->uh_alt_next.ptr;
-	else if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL
-					 && uhp->uh_next.ptr->uh_walk != mark)
-	    uhp = uhp->uh_next.ptr;
-	else if (uhp->uh_alt_prev.ptr != NULL)
-	    uhp = uhp->uh_alt_prev.ptr;
-	else
-	    uhp = uhp->uh_next.ptr;
-    }
-
     if (put_bytes(fp, (long_u)UF_HEADER_END_MAGIC, 2) == OK)
 	write_ok = TRUE;
 #ifdef U_DEBUG
@@ -1534,7 +2324,8 @@ u_write_undo(name, forceit, buf, hash)
 #endif
 
 write_error:
-    fclose(fp);
+    if (fp != NULL)
+	fclose(fp);
     if (!write_ok)
 	EMSG2(_("E829: write error in undo file: %s"), file_name);
 
@@ -1594,6 +2385,18 @@ u_read_undo(name, hash, orig_name)
     time_t	seq_time;
     int		i, j;
     int		c;
+    long	file_id = 0;
+    off_t	tree_off = 0;
+    off_t	uhp_off;
+    long	uhp_len;
+    long	next_seq, prev_seq, alt_next_seq, alt_prev_seq;
+    int		flags;
+    long	save_nr;
+    long	pos;
+    char_u	*undo_file_name = NULL;
+    off_t	file_size = 0;
+    off_t	file_used = 0;
+    buf_T	*crypt_buf = NULL;
     u_header_T	*uhp;
     u_header_T	**uhp_table = NULL;
     char_u	read_hash[UNDO_HASH_SIZE];
@@ -1677,11 +2480,25 @@ u_read_undo(name, hash, orig_name)
 	    goto error;
 	}
 	do_decrypt = TRUE;
+	crypt_buf = curbuf;
 #else
 	EMSG2(_("E827: Undo file is encrypted: %s"), file_name);
 	goto error;
 #endif
     }
+    else if (version == UF_VERSION_JOURNAL)
+    {
+	/* The undo info is in the last tree record. */
+	file_id = get4c(fp);
+	tree_off = get_off(fp);
+	if (tree_off < UF_JOURNAL_START
+		|| fseek(fp, (long)tree_off, SEEK_SET) != 0
+		|| get2c(fp) != UF_TREE_MAGIC)
+	{
+	    corruption_error("tree offset", file_name);
+	    goto error;
+	}
+    }
     else if (version != UF_VERSION)
     {
 	EMSG2(_("E824: Incompatible undo file: %s"), file_name);
@@ -1714,7 +2531,7 @@ u_read_undo(name, hash, orig_name)
     if (str_len < 0)
 	goto error;
     if (str_len > 0)
-	line_ptr = read_string_decrypt(curbuf, fp, str_len);
+	line_ptr = read_string_decrypt(crypt_buf, fp, str_len);
     line_lnum = (linenr_T)get4c(fp);
     line_colnr = (colnr_T)get4c(fp);
     if (line_lnum < 0 || line_colnr < 0)
@@ -1764,20 +2581,69 @@ u_read_undo(name, hash, orig_name)
 	if (uhp_table == NULL)
 	    goto error;
     }
-
-    while ((c = get2c(fp)) == UF_HEADER_MAGIC)
-    {
-	if (num_read_uhps >= num_head)
+
+    if (version == UF_VERSION_JOURNAL)
+    {
+	/* Read the headers from their records, without the entries.  The
+	 * links, flags and save number may have changed since the record was
+	 * written, they are in the tree record. */
+	while (num_read_uhps < num_head)
+	{
+	    i = get4c(fp);
+	    next_seq = get4c(fp);
+	    prev_seq = get4c(fp);
+	    alt_next_seq = get4c(fp);
+	    alt_prev_seq = get4c(fp);
+	    flags = get2c(fp);
+	    save_nr = get4c(fp);
+	    uhp_off = get_off(fp);
+	    uhp_len = get4c(fp);
+	    pos = ftell(fp);
+	    if (uhp_off < UF_JOURNAL_START || uhp_len <= 0 || uhp_off > tree_off
+		    || fseek(fp, (long)uhp_off, SEEK_SET) != 0
+		    || get2c(fp) != UF_HEADER_MAGIC)
+	    {
+		corruption_error("header offset", file_name);
+		goto error;
+	    }
+	    uhp = unserialize_uhp(fp, NULL, file_name, FALSE);
+	    if (uhp == NULL)
+		goto error;
+	    uhp_table[num_read_uhps++] = uhp;
+	    if (uhp->uh_seq != i)
+	    {
+		corruption_error("uh_seq", file_name);
+		goto error;
+	    }
+	    uhp->uh_next.seq = next_seq;
+	    uhp->uh_prev.seq = prev_seq;
+	    uhp->uh_alt_next.seq = alt_next_seq;
+	    uhp->uh_alt_prev.seq = alt_prev_seq;
+	    uhp->uh_flags = flags;
+	    uhp->uh_save_nr = save_nr;
+	    uhp->uh_file_off = uhp_off;
+	    uhp->uh_file_len = uhp_len;
+	    uhp->uh_file_unread = TRUE;
+	    file_used += uhp_len;
+	    if (fseek(fp, pos, SEEK_SET) != 0)
+		goto error;
+	}
+	c = get2c(fp);
+    }
+    else
+	while ((c = get2c(fp)) == UF_HEADER_MAGIC)
 	{
-	    corruption_error("num_head too small", file_name);
-	    goto error;
-	}
+	    if (num_read_uhps >= num_head)
+	    {
+		corruption_error("num_head too small", file_name);
+		goto error;
+	    }
 
-	uhp = unserialize_uhp(fp, file_name);
-	if (uhp == NULL)
-	    goto error;
-	uhp_table[num_read_uhps++] = uhp;
-    }
+	    uhp = unserialize_uhp(fp, crypt_buf, file_name, TRUE);
+	    if (uhp == NULL)
+		goto error;
+	    uhp_table[num_read_uhps++] = uhp;
+	}
 
     if (num_read_uhps != num_head)
     {
@@ -1862,6 +2728,16 @@ u_read_undo(name, hash, orig_name)
 	}
     }
 
+    /* When reading a journal the entries are read later, remember where they
+     * are. */
+    if (version == UF_VERSION_JOURNAL)
+    {
+	if ((undo_file_name = vim_strsave(file_name)) == NULL
+				       || fseek(fp, 0L, SEEK_END) != 0)
+	    goto error;
+	file_size = (off_t)ftell(fp);
+    }
+
     /* Now that we have read the undo info successfully, free the current undo
      * info and use the info from the file. */
     u_blockfree(curbuf);
@@ -1877,6 +2753,19 @@ u_read_undo(name, hash, orig_name)
     curbuf->b_u_time_cur = seq_time;
     curbuf->b_u_save_nr_last = last_save_nr;
     curbuf->b_u_save_nr_cur = last_save_nr;
+    curbuf->b_u_file_name = undo_file_name;
+    if (undo_file_name != NULL)
+    {
+	u_keep_undofile(curbuf, fp);
+	fp = NULL;
+    }
+    curbuf->b_u_file_id = file_id;
+    curbuf->b_u_file_size = file_size;
+    curbuf->b_u_file_used = file_used;
+    curbuf->b_u_mem = 0;
+    for (i = 0; i < num_head; ++i)
+	if (uhp_table[i] != NULL)
+	    u_update_mem(curbuf, uhp_table[i]);
 
     curbuf->b_u_synced = TRUE;
     vim_free(uhp_table);
@@ -1895,6 +2784,7 @@ u_read_undo(name, hash, orig_name)
 
 error:
     vim_free(line_ptr);
+    vim_free(undo_file_name);
     if (uhp_table != NULL)
     {
 	for (i = 0; i < num_read_uhps; i++)
@@ -1964,7 +2854,8 @@ u_redo(count)
 u_doit(startcount)
     int startcount;
 {
-    int count = startcount;
+    int		count = startcount;
+    u_header_T	*old_curhead;
 
     if (!undo_allowed())
 	return;
@@ -1983,6 +2874,7 @@ u_doit(startcount)
 
 	if (undo_undoes)
 	{
+	    old_curhead = curbuf->b_u_curhead;
 	    if (curbuf->b_u_curhead == NULL)		/* first undo */
 		curbuf->b_u_curhead = curbuf->b_u_newhead;
 	    else if (get_undolevel() > 0)		/* multi level undo */
@@ -2002,7 +2894,11 @@ u_doit(startcount)
 		break;
 	    }
 
-	    u_undoredo(TRUE);
+	    if (u_undoredo(TRUE) == FAIL)
+	    {
+		curbuf->b_u_curhead = old_curhead;
+		break;
+	    }
 	}
 	else
 	{
@@ -2017,7 +2913,8 @@ u_doit(startcount)
 		break;
 	    }
 
-	    u_undoredo(FALSE);
+	    if (u_undoredo(FALSE) == FAIL)
+		break;
 
 	    /* Advance for next redo.  Set "newhead" when at the end of the
 	     * redoable changes. */
@@ -2059,6 +2956,7 @@ undo_time(step, sec, file, absolute)
     int		    dofile = file;
     int		    above = FALSE;
     int		    did_undo = TRUE;
+    int		    failed = FALSE;
 
     /* First make sure the current undoable change is synced. */
     if (curbuf->b_u_synced == FALSE)
@@ -2286,15 +3184,21 @@ undo_time(step, sec, file, absolute)
 	    if (uhp == NULL || uhp->uh_walk != mark
 					 || (uhp->uh_seq == target && !above))
 		break;
+	    last = curbuf->b_u_curhead;
 	    curbuf->b_u_curhead = uhp;
-	    u_undoredo(TRUE);
+	    if (u_undoredo(TRUE) == FAIL)
+	    {
+		curbuf->b_u_curhead = last;
+		failed = TRUE;
+		break;
+	    }
 	    uhp->uh_walk = nomark;	/* don't go back down here */
 	}
 
 	/*
 	 * And now go down the tree (redo), branching off where needed.
 	 */
-	while (!got_int)
+	while (!failed && !got_int)
 	{
 	    /* Do the change warning now, for the same reason as above. */
 	    change_warning(0);
@@ -2346,7 +3250,8 @@ undo_time(step, sec, file, absolute)
 		break;
 	    }
 
-	    u_undoredo(FALSE);
+	    if (u_undoredo(FALSE) == FAIL)
+		break;
 
 	    /* Advance "curhead" to below the header we last used.  If it
 	     * becomes NULL then we need to set "newhead" to this leaf. */
@@ -2378,12 +3283,17 @@ undo_time(step, sec, file, absolute)
  * list for the next undo/redo.
  *
  * When "undo" is TRUE we go up in the tree, when FALSE we go down.
+ * Returns FAIL when the entries could not be read from the undo file, nothing
+ * was changed then.
  */
-    static void
+    static int
 u_undoredo(undo)
     int		undo;
 {
     char_u	**newarray = NULL;
+    int		newarray_flags;
+    char_u	**oldarray;
+    int		oldarray_flags;
     linenr_T	oldsize;
     linenr_T	newsize;
     linenr_T	top, bot;
@@ -2401,6 +3311,13 @@ u_undoredo(undo)
     int		empty_buffer;		    /* buffer became empty */
     u_header_T	*curhead = curbuf->b_u_curhead;
 
+#ifdef FEAT_PERSISTENT_UNDO
+    if (u_load_entries(curbuf, curhead) == FAIL)
+	return FAIL;
+    /* The entries and marks in the header are changed. */
+    u_forget_record(curbuf, curhead);
+#endif
+
 #ifdef FEAT_AUTOCMD
     /* Don't want autocommands using the undo structures here, they are
      * invalid till the end. */
@@ -2441,12 +3358,26 @@ u_undoredo(undo)
 #endif
 	    EMSG(_("E438: u_undo: line numbers wrong"));
 	    changed();		/* don't want UNCHANGED now */
-	    return;
+	    return OK;
 	}
 
 	oldsize = bot - top - 1;    /* number of lines before undo */
 	newsize = uep->ue_size;	    /* number of lines after undo */
 
+	/* Lines stored as changes need the lines they were changed from. */
+	if ((uep->ue_flags & UE_DELTA)
+		   && u_decode_entry(uep, top + 1, (long)oldsize) == FAIL)
+	{
+	    /* We have messed up the entry list, repair is impossible. */
+	    while (uep != NULL)
+	    {
+		nuep = uep->ue_next;
+		u_freeentry(uep, uep->ue_size);
+		uep = nuep;
+	    }
+	    break;
+	}
+
 	if (top < newlnum)
 	{
 	    /* If the saved cursor is somewhere in this undo block, move it to
@@ -2480,38 +3411,42 @@ u_undoredo(undo)
 	}
 
 	empty_buffer = FALSE;
+	newarray_flags = UE_ONEBLOCK;
 
 	/* delete the lines between top and bot and save them in newarray */
 	if (oldsize > 0)
 	{
-	    if ((newarray = (char_u **)U_ALLOC_LINE(
-					 sizeof(char_u *) * oldsize)) == NULL)
+	    /* Save the text in one block, when that fails line by line. */
+	    newarray = u_save_lines(top + 1, (long)oldsize);
+	    if (newarray == NULL)
 	    {
-		do_outofmem_msg((long_u)(sizeof(char_u *) * oldsize));
-		/*
-		 * We have messed up the entry list, repair is impossible.
-		 * we have to free the rest of the list.
-		 */
-		while (uep != NULL)
+		newarray_flags = 0;
+		if ((newarray = (char_u **)U_ALLOC_LINE(
+					 sizeof(char_u *) * oldsize)) == NULL)
 		{
-		    nuep = uep->ue_next;
-		    u_freeentry(uep, uep->ue_size);
-		    uep = nuep;
+		    do_outofmem_msg((long_u)(sizeof(char_u *) * oldsize));
+		    /*
+		     * We have messed up the entry list, repair is impossible.
+		     * we have to free the rest of the list.
+		     */
+		    while (uep != NULL)
+		    {
+			nuep = uep->ue_next;
+			u_freeentry(uep, uep->ue_size);
+			uep = nuep;
+		    }
+		    break;
 		}
-		break;
-	    }
-	    /* delete backwards, it goes faster in most cases */
-	    for (lnum = bot - 1, i = oldsize; --i >= 0; --lnum)
-	    {
-		/* what can we do when we run out of memory? */
-		if ((newarray[i] = u_save_line(lnum)) == NULL)
-		    do_outofmem_msg((long_u)0);
-		/* remember we deleted the last line in the buffer, and a
-		 * dummy empty line will be inserted */
-		if (curbuf->b_ml.ml_line_count == 1)
-		    empty_buffer = TRUE;
-		ml_delete(lnum, FALSE);
+		for (lnum = top + 1, i = 0; i < oldsize; ++i, ++lnum)
+		    /* what can we do when we run out of memory? */
+		    if ((newarray[i] = u_save_line(lnum)) == NULL)
+			do_outofmem_msg((long_u)0);
 	    }
+	    /* remember we deleted the last line in the buffer, and a
+	     * dummy empty line will be inserted */
+	    if (oldsize >= curbuf->b_ml.ml_line_count)
+		empty_buffer = TRUE;
+	    ml_delete_lines(top + 1, (long)oldsize, FALSE);
 	}
 	else
 	    newarray = NULL;
@@ -2519,19 +3454,19 @@ u_undoredo(undo)
 	/* insert the lines in u_array between top and bot */
 	if (newsize)
 	{
-	    for (lnum = top, i = 0; i < newsize; ++i, ++lnum)
+	    /*
+	     * If the file is empty, there is an empty line 1 that we
+	     * should get rid of, by replacing it with the new line
+	     */
+	    if (empty_buffer && top == 0)
 	    {
-		/*
-		 * If the file is empty, there is an empty line 1 that we
-		 * should get rid of, by replacing it with the new line
-		 */
-		if (empty_buffer && lnum == 0)
-		    ml_replace((linenr_T)1, uep->ue_array[i], TRUE);
-		else
-		    ml_append(lnum, uep->ue_array[i], (colnr_T)0, FALSE);
-		vim_free(uep->ue_array[i]);
+		ml_replace((linenr_T)1, uep->ue_array[0], TRUE);
+		ml_append_lines(curbuf, (linenr_T)1, uep->ue_array + 1, NULL,
+						     (long)newsize - 1, FALSE);
 	    }
-	    vim_free((char_u *)uep->ue_array);
+	    else
+		ml_append_lines(curbuf, top, uep->ue_array, NULL,
+							 (long)newsize, FALSE);
 	}
 
 	/* adjust marks */
@@ -2557,10 +3492,18 @@ u_undoredo(undo)
 
 	u_newcount += newsize;
 	u_oldcount += oldsize;
+	oldarray = uep->ue_array;
+	oldarray_flags = uep->ue_flags;
 	uep->ue_size = oldsize;
 	uep->ue_array = newarray;
+	uep->ue_flags = newarray_flags;
 	uep->ue_bot = top + newsize + 1;
 
+	/* The lines just inserted are there when the entry is used again,
+	 * the saved lines can be stored as the change from them. */
+	u_encode_entry(uep, oldarray, (linenr_T)0, (long)newsize);
+	u_free_lines(oldarray, (long)newsize, oldarray_flags);
+
 	/*
 	 * insert this entry in front of the new entry list
 	 */
@@ -2571,6 +3514,9 @@ u_undoredo(undo)
 
     curhead->uh_entry = newlist;
     curhead->uh_flags = new_flags;
+#ifdef FEAT_PERSISTENT_UNDO
+    u_update_mem(curbuf, curhead);
+#endif
     if ((old_flags & UH_EMPTYBUF) && bufempty())
 	curbuf->b_ml.ml_flags |= ML_EMPTY;
     if (old_flags & UH_CHANGED)
@@ -2657,12 +3603,17 @@ u_undoredo(undo)
      * the undone/redone change. */
     curbuf->b_u_time_cur = curhead->uh_time;
 
+#ifdef FEAT_PERSISTENT_UNDO
+    /* Entries may have been read from a file. */
+    u_spill_check(curbuf);
+#endif
 #ifdef FEAT_AUTOCMD
     unblock_autocmds();
 #endif
 #ifdef U_DEBUG
     u_check(FALSE);
 #endif
+    return OK;
 }
 
 /*
@@ -2770,6 +3721,14 @@ u_sync(force)
     {
 	u_getbot();		    /* compute ue_bot of previous u_save */
 	curbuf->b_u_curhead = NULL;
+	if (curbuf->b_u_newhead != NULL)
+	{
+	    u_encode_header(curbuf->b_u_newhead);
+#ifdef FEAT_PERSISTENT_UNDO
+	    u_update_mem(curbuf, curbuf->b_u_newhead);
+	    u_spill_check(curbuf);
+#endif
+	}
     }
 }
 
@@ -2926,6 +3885,10 @@ ex_undojoin(eap)
 	return;		    /* already unsynced */
     if (get_undolevel() < 0)
 	return;		    /* no entries, nothing to do */
+#ifdef FEAT_PERSISTENT_UNDO
+    else if (u_load_entries(curbuf, curbuf->b_u_newhead) == FAIL)
+	return;		    /* can't add entries */
+#endif
     else
     {
 	/* Go back to the last entry */
@@ -2962,7 +3925,13 @@ u_find_first_changed()
 
     /* Check that the last undo block was for the whole file. */
     uep = uhp->uh_entry;
-    if (uep->ue_top != 0 || uep->ue_bot != 0)
+    if (uep == NULL || uep->ue_top != 0 || uep->ue_bot != 0)
+	return;
+#ifdef FEAT_PERSISTENT_UNDO
+    u_forget_record(curbuf, uhp);
+#endif
+    if ((uep->ue_flags & UE_DELTA) && u_decode_entry(uep, (linenr_T)1,
+				       (long)curbuf->b_ml.ml_line_count) == FAIL)
 	return;
 
     for (lnum = 1; lnum < curbuf->b_ml.ml_line_count
@@ -3159,6 +4128,10 @@ u_freeentries(buf, uhp, uhpp)
 	buf->b_u_newhead = NULL;  /* freeing the newest entry */
     if (uhpp != NULL && uhp == *uhpp)
 	*uhpp = NULL;
+#ifdef FEAT_PERSISTENT_UNDO
+    u_forget_record(buf, uhp);
+    buf->b_u_mem -= uhp->uh_mem;
+#endif
 
     for (uep = uhp->uh_entry; uep != NULL; uep = nuep)
     {
@@ -3181,9 +4154,7 @@ u_freeentry(uep, n)
     u_entry_T	*uep;
     long	    n;
 {
-    while (n > 0)
-	vim_free(uep->ue_array[--n]);
-    vim_free((char_u *)uep->ue_array);
+    u_free_lines(uep->ue_array, n, uep->ue_flags);
 #ifdef U_DEBUG
     uep->ue_magic = 0;
 #endif
@@ -3202,6 +4173,17 @@ u_clearall(buf)
     buf->b_u_numhead = 0;
     buf->b_u_line_ptr = NULL;
     buf->b_u_line_lnum = 0;
+#ifdef FEAT_PERSISTENT_UNDO
+    buf->b_u_file_name = NULL;
+    buf->b_u_file_fp = NULL;
+    buf->b_u_file_size = 0;
+    buf->b_u_file_used = 0;
+    buf->b_u_spill_fp = NULL;
+    buf->b_u_spill_name = NULL;
+    buf->b_u_spill_size = 0;
+    buf->b_u_spill_used = 0;
+    buf->b_u_mem = 0;
+#endif
 }
 
 /*
@@ -3295,6 +4277,10 @@ u_blockfree(buf)
     while (buf->b_u_oldhead != NULL)
 	u_freeheader(buf, buf->b_u_oldhead, NULL);
     vim_free(buf->b_u_line_ptr);
+#ifdef FEAT_PERSISTENT_UNDO
+    u_forget_undofile(buf);
+    u_spill_close(buf);
+#endif
 }
 
 /*
@@ -3308,6 +4294,396 @@ u_save_line(lnum)
     return vim_strsave(ml_get(lnum));
 }
 
+/*
+ * Save lines "lnum" to "lnum + count - 1" in one allocated block: an array
+ * with a pointer for each line, followed by the text of the lines.
+ * Returns NULL when out of memory or interrupted.
+ */
+    static char_u **
+u_save_lines(lnum, count)
+    linenr_T	lnum;
+    long	count;
+{
+    char_u	*lines[U_SAVE_CHUNK];
+    colnr_T	lens[U_SAVE_CHUNK];
+    linenr_T	last = lnum + count - 1;
+    linenr_T	l;
+    long_u	size = 0;
+    char_u	**array;
+    char_u	*p;
+    int		n;
+    int		i;
+
+    /* First find out how much room the text takes. */
+    for (l = lnum; l <= last; l += n)
+    {
+	fast_breakcheck();
+	if (got_int)
+	    return NULL;
+	n = ml_get_buf_lines(curbuf, l, last, U_SAVE_CHUNK, lines, lens);
+	if (n == 0)
+	    return NULL;
+	for (i = 0; i < n; ++i)
+	    size += lens[i] + 1;
+    }
+
+    array = (char_u **)U_ALLOC_LINE(sizeof(char_u *) * count + size);
+    if (array == NULL)
+	return NULL;
+    p = (char_u *)(array + count);
+    for (l = lnum; l <= last; l += n)
+    {
+	n = ml_get_buf_lines(curbuf, l, last, U_SAVE_CHUNK, lines, lens);
+	if (n == 0)
+	{
+	    vim_free(array);
+	    return NULL;
+	}
+	for (i = 0; i < n; ++i)
+	{
+	    mch_memmove(p, lines[i], (size_t)lens[i] + 1);
+	    array[l - lnum + i] = p;
+	    p += lens[i] + 1;
+	}
+    }
+    return array;
+}
+
+/*
+ * Free "array" with "n" lines, stored the way "flags" (UE_ flags) says.
+ */
+    static void
+u_free_lines(array, n, flags)
+    char_u	**array;
+    long	n;
+    int		flags;
+{
+    if (array == NULL)
+	return;
+    if (!(flags & UE_ONEBLOCK))
+	while (n > 0)
+	    vim_free(array[--n]);
+    vim_free((char_u *)array);
+}
+
+#if defined(FEAT_PERSISTENT_UNDO) || defined(PROTO)
+/*
+ * Move the separately allocated lines of "uep" into one block.  Keeps them
+ * as they are when out of memory.
+ */
+    static void
+u_pack_lines(uep)
+    u_entry_T	*uep;
+{
+    char_u	**array;
+    char_u	*p;
+    long_u	size = 0;
+    size_t	len;
+    long	i;
+
+    if (uep->ue_size == 0 || (uep->ue_flags & UE_ONEBLOCK))
+	return;
+    for (i = 0; i < uep->ue_size; ++i)
+	size += STRLEN(uep->ue_array[i]) + 1;
+    array = (char_u **)U_ALLOC_LINE(sizeof(char_u *) * uep->ue_size + size);
+    if (array == NULL)
+	return;
+    p = (char_u *)(array + uep->ue_size);
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	len = STRLEN(uep->ue_array[i]) + 1;
+	mch_memmove(p, uep->ue_array[i], len);
+	array[i] = p;
+	p += len;
+    }
+    u_free_lines(uep->ue_array, uep->ue_size, uep->ue_flags);
+    uep->ue_array = array;
+    uep->ue_flags |= UE_ONEBLOCK;
+}
+#endif
+
+/*
+ * A line stored with UE_DELTA is the number of bytes it has in common with
+ * the line in the buffer at the start, the number of bytes in common at the
+ * end and the bytes in between, NUL terminated.  The numbers are stored plus
+ * one in seven bit pieces, lowest first, the high bit set when another piece
+ * follows.  This way a stored line never contains a NUL byte.
+ */
+    static char_u *
+u_put_number(p, n)
+    char_u	*p;
+    long	n;
+{
+    long_u	v = (long_u)n + 1;
+
+    while (v >= 0x80)
+    {
+	*p++ = (char_u)(v | 0x80);
+	v >>= 7;
+    }
+    *p++ = (char_u)v;
+    return p;
+}
+
+/*
+ * Get a number stored with u_put_number() at "*pp" and advance "*pp".
+ * Returns -1 when the number is invalid.
+ */
+    static long
+u_get_number(pp)
+    char_u	**pp;
+{
+    char_u	*p = *pp;
+    long_u	v = 0;
+    int		shift = 0;
+
+    while ((*p & 0x80) && shift < 28)
+    {
+	v |= (long_u)(*p++ & 0x7f) << shift;
+	shift += 7;
+    }
+    if (*p == NUL || (*p & 0x80))
+	return -1;
+    v |= (long_u)*p++ << shift;
+    *pp = p;
+    return (long)v - 1;
+}
+
+/*
+ * Return the number of bytes u_put_number() uses for "n".
+ */
+    static int
+u_number_len(n)
+    long	n;
+{
+    long_u	v = (long_u)n + 1;
+    int		len = 1;
+
+    while (v >= 0x80)
+    {
+	++len;
+	v >>= 7;
+    }
+    return len;
+}
+
+/*
+ * Find the bytes "line" with length "len" has in common with "bline": "*pre"
+ * at the start and "*suf" at the end, these don't overlap.
+ */
+    static void
+u_delta_range(line, len, bline, pre, suf)
+    char_u	*line;
+    int		len;
+    char_u	*bline;
+    int		*pre;
+    int		*suf;
+{
+    int		blen = (int)STRLEN(bline);
+    int		max = len < blen ? len : blen;
+    int		p;
+    int		s;
+
+    for (p = 0; p < max && line[p] == bline[p]; ++p)
+	;
+    for (s = 0; s < max - p && line[len - 1 - s] == bline[blen - 1 - s]; ++s)
+	;
+    *pre = p;
+    *suf = s;
+}
+
+/*
+ * Store the lines of entry "uep" as the change from the lines that will be
+ * in the buffer when the entry is used: "base[]" when not NULL, otherwise
+ * the buffer lines from "base_lnum".  There are "base_count" of them.
+ * The lines are kept as they are when this doesn't save much or when out of
+ * memory.
+ */
+    static void
+u_encode_entry(uep, base, base_lnum, base_count)
+    u_entry_T	*uep;
+    char_u	**base;
+    linenr_T	base_lnum;
+    long	base_count;
+{
+    char_u	**array;
+    char_u	*line;
+    char_u	*p;
+    long_u	full = 0;
+    long_u	size = 0;
+    long	i;
+    int		len;
+    int		pre;
+    int		suf;
+
+    if ((uep->ue_flags & UE_DELTA) || uep->ue_size == 0 || base_count <= 0)
+	return;
+
+    /* First find out how much room the changes take. */
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	line = uep->ue_array[i];
+	len = (int)STRLEN(line);
+	full += len + 1;
+	if (i < base_count)
+	    u_delta_range(line, len,
+			  base != NULL ? base[i] : ml_get(base_lnum + i),
+								 &pre, &suf);
+	else
+	    pre = suf = 0;
+	size += u_number_len(pre) + u_number_len(suf) + len - pre - suf + 1;
+    }
+    if (size > full - full / 4)
+	return;
+
+    array = (char_u **)U_ALLOC_LINE(sizeof(char_u *) * uep->ue_size + size);
+    if (array == NULL)
+	return;
+    p = (char_u *)(array + uep->ue_size);
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	line = uep->ue_array[i];
+	len = (int)STRLEN(line);
+	if (i < base_count)
+	    u_delta_range(line, len,
+			  base != NULL ? base[i] : ml_get(base_lnum + i),
+								 &pre, &suf);
+	else
+	    pre = suf = 0;
+	array[i] = p;
+	p = u_put_number(p, (long)pre);
+	p = u_put_number(p, (long)suf);
+	mch_memmove(p, line + pre, (size_t)(len - pre - suf));
+	p += len - pre - suf;
+	*p++ = NUL;
+    }
+    u_free_lines(uep->ue_array, uep->ue_size, uep->ue_flags);
+    uep->ue_array = array;
+    uep->ue_flags = UE_ONEBLOCK | UE_DELTA;
+}
+
+/*
+ * Turn the lines of entry "uep", stored with UE_DELTA, back into text, using
+ * the "base_count" buffer lines from "base_lnum".
+ * Returns FAIL when out of memory or the lines don't match, an error message
+ * was given.
+ */
+    static int
+u_decode_entry(uep, base_lnum, base_count)
+    u_entry_T	*uep;
+    linenr_T	base_lnum;
+    long	base_count;
+{
+    char_u	**array;
+    char_u	*bline;
+    char_u	*p;
+    char_u	*q;
+    long_u	size = 0;
+    long	i;
+    long	pre;
+    long	suf;
+    long	blen;
+    size_t	len;
+
+    /* First check the lines fit and find out how much room they take. */
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	p = uep->ue_array[i];
+	pre = u_get_number(&p);
+	suf = pre < 0 ? -1 : u_get_number(&p);
+	if (suf < 0 || (pre + suf > 0 && (i >= base_count
+		 || pre + suf > (long)STRLEN(ml_get(base_lnum + (linenr_T)i)))))
+	{
+	    EMSG(_("E883: u_undo: changed lines do not match"));
+	    return FAIL;
+	}
+	size += pre + suf + STRLEN(p) + 1;
+    }
+
+    array = (char_u **)U_ALLOC_LINE(sizeof(char_u *) * uep->ue_size + size);
+    if (array == NULL)
+    {
+	do_outofmem_msg((long_u)(sizeof(char_u *) * uep->ue_size + size));
+	return FAIL;
+    }
+    q = (char_u *)(array + uep->ue_size);
+    for (i = 0; i < uep->ue_size; ++i)
+    {
+	p = uep->ue_array[i];
+	pre = u_get_number(&p);
+	suf = u_get_number(&p);
+	array[i] = q;
+	if (pre + suf > 0)
+	{
+	    bline = ml_get(base_lnum + (linenr_T)i);
+	    blen = (long)STRLEN(bline);
+	    mch_memmove(q, bline, (size_t)pre);
+	    q += pre;
+	    len = STRLEN(p);
+	    mch_memmove(q, p, len);
+	    q += len;
+	    mch_memmove(q, bline + blen - suf, (size_t)suf);
+	    q += suf;
+	    *q++ = NUL;
+	}
+	else
+	{
+	    len = STRLEN(p) + 1;
+	    mch_memmove(q, p, len);
+	    q += len;
+	}
+    }
+    u_free_lines(uep->ue_array, uep->ue_size, uep->ue_flags);
+    uep->ue_array = array;
+    uep->ue_flags = UE_ONEBLOCK;
+    return OK;
+}
+
+/*
+ * Store the entries of header "uhp", which was just closed, as the change
+ * from the text in the buffer where possible.  The text of an entry is only
+ * known when the entries after it didn't change its lines: they must all be
+ * below it.
+ */
+    static void
+u_encode_header(uhp)
+    u_header_T	*uhp;
+{
+    u_entry_T	*uep;
+    linenr_T	min_top = MAXLNUM;
+    linenr_T	bot;
+
+    for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+    {
+	bot = uep->ue_bot;
+	if (bot == 0 && min_top == MAXLNUM)
+	    bot = curbuf->b_ml.ml_line_count + 1;
+	if (bot > uep->ue_top && bot - 1 <= min_top
+				     && bot <= curbuf->b_ml.ml_line_count + 1)
+	    u_encode_entry(uep, NULL, uep->ue_top + 1,
+					      (long)(bot - uep->ue_top - 1));
+	if (uep->ue_top < min_top)
+	    min_top = uep->ue_top;
+    }
+}
+
+#if defined(FEAT_EVAL) || defined(FEAT_PERSISTENT_UNDO) || defined(PROTO)
+/*
+ * Return the number of bytes used for entry "uep".
+ */
+    static long
+u_entry_mem(uep)
+    u_entry_T	*uep;
+{
+    long	mem = sizeof(u_entry_T) + sizeof(char_u *) * uep->ue_size;
+    long	i;
+
+    for (i = 0; i < uep->ue_size; ++i)
+	mem += (long)STRLEN(uep->ue_array[i]) + 1;
+    return mem;
+}
+#endif
+
 /*
  * Check if the 'modified' flag is set, or 'ff' has changed (only need to
  * check the first character, because it can only be "dos", "unix" or "mac").
@@ -3338,20 +4714,30 @@ curbufIsChanged()
 /*
  * For undotree(): Append the list of undo blocks at "first_uhp" to "list".
  * Recursive.
+ * Returns the number of bytes used for these undo blocks.  For a block whose
+ * entries were not read from a file (uh_entry is NULL) only the header is
+ * counted.
  */
-    void
+    long
 u_eval_tree(first_uhp, list)
     u_header_T  *first_uhp;
     list_T	*list;
 {
     u_header_T  *uhp = first_uhp;
+    u_entry_T	*uep;
     dict_T	*dict;
+    long	mem;
+    long	total = 0;
 
     while (uhp != NULL)
     {
 	dict = dict_alloc();
 	if (dict == NULL)
-	    return;
+	    return total;
+	mem = sizeof(u_header_T);
+	for (uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next)
+	    mem += u_entry_mem(uep);
+	total += mem;
 	dict_add_nr_str(dict, "seq", uhp->uh_seq, NULL);
 	dict_add_nr_str(dict, "time", (long)uhp->uh_time, NULL);
 	if (uhp == curbuf->b_u_newhead)
@@ -3360,6 +4746,7 @@ u_eval_tree(first_uhp, list)
 	    dict_add_nr_str(dict, "curhead", 1, NULL);
 	if (uhp->uh_save_nr > 0)
 	    dict_add_nr_str(dict, "save", uhp->uh_save_nr, NULL);
+	dict_add_nr_str(dict, "mem", mem, NULL);
 
 	if (uhp->uh_alt_next.ptr != NULL)
 	{
@@ -3368,7 +4755,7 @@ u_eval_tree(first_uhp, list)
 	    if (alt_list != NULL)
 	    {
 		/* Recursive call to add alternate undo tree. */
-		u_eval_tree(uhp->uh_alt_next.ptr, alt_list);
+		total += u_eval_tree(uhp->uh_alt_next.ptr, alt_list);
 		dict_add_list(dict, "alt", alt_list);
 	    }
 	}
@@ -3376,5 +4763,6 @@ u_eval_tree(first_uhp, list)
 	list_append_dict(list, dict);
 	uhp = uhp->uh_prev.ptr;
     }
+    return total;
 }
 #endif
@@ -286,6 +286,11 @@ static char *(features[]) =
 #else
 	"-insert_expand",
 #endif
+#ifdef FEAT_JOB_CONTROL
+	"+job_control",
+#else
+	"-job_control",
+#endif
 #ifdef FEAT_JUMPLIST
 	"+jumplist",
 #else
@@ -335,6 +340,11 @@ static char *(features[]) =
 #else
 	"-lua",
 #endif
+#ifdef FEAT_MEMZIP
+	"+memzip",
+#else
+	"-memzip",
+#endif
 #ifdef FEAT_MENU
 	"+menu",
 #else
@@ -345,6 +355,11 @@ static char *(features[]) =
 #else
 	"-mksession",
 #endif
+#ifdef FEAT_MMAP
+	"+mmap",
+#else
+	"-mmap",
+#endif
 #ifdef FEAT_MODIFY_FNAME
 	"+modify_fname",
 #else
@@ -488,6 +503,11 @@ static char *(features[]) =
 #else
 	"-profile",
 #endif
+#ifdef FEAT_PROGRESSIVE_LOAD
+	"+progressive_load",
+#else
+	"-progressive_load",
+#endif
 #ifdef FEAT_PYTHON
 # ifdef DYNAMIC_PYTHON
 	"+python/dyn",
@@ -565,6 +585,11 @@ static char *(features[]) =
 #else
 	"-sun_workshop",
 #endif
+#ifdef FEAT_SWAP_THREAD
+	"+swap_thread",
+#else
+	"-swap_thread",
+#endif
 #ifdef FEAT_SYN_HL
 	"+syntax",
 #else
@@ -622,6 +647,11 @@ static char *(features[]) =
 #else
 	"-textobjects",
 #endif
+#ifdef FEAT_TIMERS
+	"+timers",
+#else
+	"-timers",
+#endif
 #ifdef FEAT_TITLE
 	"+title",
 #else
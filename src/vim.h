@@ -972,6 +972,19 @@ extern char *(*dyn_libintl_textdomain)(const char *domainname);
 #define READ_DUMMY	0x10	/* reading into a dummy buffer */
 #define READ_KEEP_UNDO	0x20	/* keep undo info*/
 
+/* Values returned by fenc_raw_mode(): what the bytes of a file must be for
+ * readfile() to use them without conversion. */
+#define RAW_ANY		0	/* any byte but NUL */
+#define RAW_UTF8	1	/* valid UTF-8 */
+#define RAW_ASCII	2	/* only ASCII */
+#define RAW_NONE	(-1)	/* bytes are always converted */
+
+/* Values for scan_set_level(): instructions used to scan text */
+#define SCAN_SCALAR	0	/* one byte at a time */
+#define SCAN_SSE2	1	/* 16 bytes at a time */
+#define SCAN_AVX2	2	/* 32 bytes at a time */
+#define SCAN_MAX_LITS	8	/* max number of strings for scan_find() */
+
 /* Values for change_indent() */
 #define INDENT_SET	1	/* set indent */
 #define INDENT_INC	2	/* increase indent */
@@ -1053,6 +1066,7 @@ extern char *(*dyn_libintl_textdomain)(const char *domainname);
 #define MFS_STOP	2	/* stop syncing when a character is available */
 #define MFS_FLUSH	4	/* flushed file to disk */
 #define MFS_ZERO	8	/* only write block 0 */
+#define MFS_ASYNC	16	/* may leave writing to the writer thread */
 
 /* flags for buf_copy_options() */
 #define BCO_ENTER	1	/* going to enter the buffer */
@@ -1220,6 +1234,16 @@ extern char *(*dyn_libintl_textdomain)(const char *domainname);
 #define MIN_SWAP_PAGE_SIZE 1048
 #define MAX_SWAP_PAGE_SIZE 50000
 
+#ifdef FEAT_JOB_CONTROL
+# define JOB_MAX	32	/* maximum number of jobs at the same time */
+# define JOB_MAX_FDS	(JOB_MAX * 3)	/* stdin, stdout and stderr */
+
+/* "what" argument of a job callback, see job_start_cb() */
+# define JOB_STDOUT	0
+# define JOB_STDERR	1
+# define JOB_EXIT	2
+#endif
+
 /* Special values for current_SID. */
 #define SID_MODELINE	-1	/* when using a modeline */
 #define SID_CMDARG	-2	/* for "--cmd" argument */